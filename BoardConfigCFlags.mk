@@ -40,3 +40,14 @@ endif
 ifeq ($(BOARD_USES_HDRUI_GLES_CONVERSION), true)
     LOCAL_CFLAGS += -DUSES_HDR_GLES_CONVERSION
 endif
+
+# Fence tracking is debug bookkeeping, compile it out of release builds
+ifeq ($(HWC_DISABLE_FENCE_TRACE),)
+ifeq ($(TARGET_BUILD_VARIANT), user)
+HWC_DISABLE_FENCE_TRACE := true
+endif
+endif
+
+ifeq ($(HWC_DISABLE_FENCE_TRACE), true)
+    LOCAL_CFLAGS += -DDISABLE_FENCE_TRACE
+endif
@@ -52,6 +52,17 @@ enum BrightnessMode {
     BM_MAX = 2,
 };
 
+/// FNV-1a over the bytes of a value, seeded with the hash so far.
+inline uint64_t HashBytes(uint64_t seed, const void *bytes, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t *>(bytes);
+    for (size_t i = 0; i < len; i++) {
+        seed = (seed ^ p[i]) * 0x100000001b3ULL;
+    }
+    return seed;
+}
+
+constexpr uint64_t kHashSeed = 0xcbf29ce484222325ULL;
+
 struct LayerColorData {
     bool operator==(const LayerColorData &rhs) const {
         return dataspace == rhs.dataspace && matrix == rhs.matrix &&
@@ -59,6 +70,14 @@ struct LayerColorData {
                dynamic_metadata == rhs.dynamic_metadata;
     }
 
+    /// A hash of all the members compared by operator==.
+    uint64_t Hash() const {
+        uint64_t hash = HashBytes(kHashSeed, &dataspace, sizeof(dataspace));
+        hash = HashBytes(hash, matrix.data(), sizeof(matrix));
+        hash = static_metadata.Hash(hash);
+        return dynamic_metadata.Hash(hash);
+    }
+
     /**
      * @brief HDR static metadata.
      *
@@ -86,6 +105,11 @@ struct LayerColorData {
             return data == rhs.data && is_valid == rhs.is_valid;
         }
 
+        uint64_t Hash(uint64_t seed) const {
+            seed = HashBytes(seed, &is_valid, sizeof(is_valid));
+            return HashBytes(seed, data.data(), sizeof(data));
+        }
+
         /// Indicator for whether the data in this struct should be used.
         bool is_valid = false;
         /// This device's display's peak luminance, in nits.
@@ -127,6 +151,22 @@ struct LayerColorData {
                    bezier_curve_anchors == rhs.bezier_curve_anchors;
         }
 
+        uint64_t Hash(uint64_t seed) const {
+            seed = HashBytes(seed, &is_valid, sizeof(is_valid));
+            seed = HashBytes(seed, &display_maximum_luminance,
+                             sizeof(display_maximum_luminance));
+            seed = HashBytes(seed, maxscl.data(), sizeof(maxscl));
+            seed = HashBytes(seed, maxrgb_percentages.data(),
+                             maxrgb_percentages.size() * sizeof(uint8_t));
+            seed = HashBytes(seed, maxrgb_percentiles.data(),
+                             maxrgb_percentiles.size() * sizeof(uint32_t));
+            seed = HashBytes(seed, &tm_flag, sizeof(tm_flag));
+            seed = HashBytes(seed, &tm_knee_x, sizeof(tm_knee_x));
+            seed = HashBytes(seed, &tm_knee_y, sizeof(tm_knee_y));
+            return HashBytes(seed, bezier_curve_anchors.data(),
+                             bezier_curve_anchors.size() * sizeof(uint16_t));
+        }
+
         /// Indicator for whether the data in this struct should be used.
         bool is_valid = false;
 
@@ -169,7 +209,13 @@ struct LayerColorData {
  */
 struct DisplayScene {
     bool operator==(const DisplayScene &rhs) const {
-        return layer_data == rhs.layer_data &&
+        // the hashes stand for layer_data as long as both scenes keep them
+        bool same_layers = (layer_hash_valid && rhs.layer_hash_valid)
+                ? layer_hash == rhs.layer_hash &&
+                  layer_data.size() == rhs.layer_data.size()
+                : layer_data == rhs.layer_data;
+
+        return same_layers &&
                dpu_bit_depth == rhs.dpu_bit_depth &&
                color_mode == rhs.color_mode &&
                render_intent == rhs.render_intent &&
@@ -217,6 +263,68 @@ struct DisplayScene {
 
     /// hdr full screen mode
     bool hdr_full_screen;
+
+    /**
+     * @brief Replaces the color data of a layer and updates the layer hash in
+     * O(1). The HWC calls it only for the layers whose dataspace, matrix or
+     * HDR metadata changed.
+     */
+    void SetLayerColorData(size_t index, const LayerColorData &data) {
+        if (!layer_hash_valid) {
+            RehashLayers();
+        }
+        if (index >= layer_data.size()) {
+            ResizeLayers(index + 1);
+        }
+        layer_hash ^= LayerHash(index, layer_hashes[index]);
+        layer_data[index] = data;
+        layer_hashes[index] = data.Hash();
+        layer_hash ^= LayerHash(index, layer_hashes[index]);
+    }
+
+    /// Changes the number of layers keeping the hash of the remaining ones.
+    void ResizeLayers(size_t count) {
+        if (!layer_hash_valid) {
+            RehashLayers();
+        }
+        for (size_t i = count; i < layer_data.size(); i++) {
+            layer_hash ^= LayerHash(i, layer_hashes[i]);
+        }
+        size_t old_count = layer_data.size();
+        layer_data.resize(count);
+        layer_hashes.resize(count);
+        for (size_t i = old_count; i < count; i++) {
+            layer_hashes[i] = layer_data[i].Hash();
+            layer_hash ^= LayerHash(i, layer_hashes[i]);
+        }
+    }
+
+    /**
+     * @brief Recomputes the layer hash from layer_data. Writing layer_data
+     * directly must be followed by this, or by clearing layer_hash_valid.
+     */
+    void RehashLayers() {
+        layer_hashes.resize(layer_data.size());
+        layer_hash = 0;
+        for (size_t i = 0; i < layer_data.size(); i++) {
+            layer_hashes[i] = layer_data[i].Hash();
+            layer_hash ^= LayerHash(i, layer_hashes[i]);
+        }
+        layer_hash_valid = true;
+    }
+
+    /// Hash of layer_data, maintained by the functions above.
+    uint64_t layer_hash = 0;
+    /// Whether layer_hash can be compared instead of layer_data.
+    bool layer_hash_valid = false;
+
+   private:
+    // binds a layer hash to its position so that reordering changes the sum
+    static uint64_t LayerHash(size_t index, uint64_t hash) {
+        return HashBytes(hash, &index, sizeof(index));
+    }
+
+    std::vector<uint64_t> layer_hashes;
 };
 
 /// An interface specifying functions that are HW-agnostic.
@@ -24,7 +24,7 @@
 #include "acrylic_internal.h"
 
 Acrylic::Acrylic(const HW2DCapability &capability)
-    : mCapability(capability), mHasBackgroundColor(false),
+    : mLayersSorted(true), mCapability(capability), mHasBackgroundColor(false),
       mMaxTargetLuminance(100), mMinTargetLuminance(0), mTargetDisplayInfo(nullptr),
       mCanvas(this, AcrylicCanvas::CANVAS_TARGET)
 {
@@ -57,7 +57,10 @@ AcrylicLayer *Acrylic::createLayer()
         return NULL;
     }
 
-    mLayers.push_back(layer);
+    // Keep the layers sorted for sortLayers(). A layer of the same z-order is placed after the existing ones.
+    auto pos = std::upper_bound(std::begin(mLayers), std::end(mLayers), layer,
+                                [] (auto l1, auto l2) { return l1->getZOrder() < l2->getZOrder(); });
+    mLayers.insert(pos, layer);
 
     ALOGD_TEST("A new Acrylic layer is created. Total %zd layers", mLayers.size());
 
@@ -76,6 +79,20 @@ void Acrylic::removeLayer(AcrylicLayer *layer)
     }
 }
 
+void Acrylic::reorderLayer(AcrylicLayer *layer)
+{
+    if (!mLayersSorted)
+        return;
+
+    auto it = find(std::begin(mLayers), std::end(mLayers), layer);
+    if (it == std::end(mLayers))
+        return;
+
+    if (((it != std::begin(mLayers)) && ((*(it - 1))->getZOrder() > layer->getZOrder())) ||
+            (((it + 1) != std::end(mLayers)) && ((*(it + 1))->getZOrder() < layer->getZOrder())))
+        mLayersSorted = false;
+}
+
 int Acrylic::prioritize(int priority)
 {
     if ((priority < -1) || (priority > 15)) {
@@ -183,5 +200,9 @@ bool Acrylic::validateAllLayers()
 
 void Acrylic::sortLayers()
 {
-    std::sort(std::begin(mLayers), std::end(mLayers), [] (auto l1, auto l2) { return l1->getZOrder() < l2->getZOrder(); });
+    if (mLayersSorted)
+        return;
+
+    std::stable_sort(std::begin(mLayers), std::end(mLayers), [] (auto l1, auto l2) { return l1->getZOrder() < l2->getZOrder(); });
+    mLayersSorted = true;
 }
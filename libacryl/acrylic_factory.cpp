@@ -23,6 +23,7 @@
 
 #include "acrylic_internal.h"
 #include "acrylic_g2d.h"
+#include "acrylic_sw.h"
 
 static uint32_t all_fimg2d_gs101_formats[] = {
     HAL_PIXEL_FORMAT_RGBA_8888,
@@ -117,6 +118,61 @@ const static stHW2DCapability __capability_fimg2d_gs101 = {
 
 static const HW2DCapability capability_fimg2d_gs101(__capability_fimg2d_gs101);
 
+static uint32_t all_sw_formats[] = {
+    HAL_PIXEL_FORMAT_RGBA_8888,
+    HAL_PIXEL_FORMAT_RGBX_8888,
+    HAL_PIXEL_FORMAT_BGRA_8888,
+    HAL_PIXEL_FORMAT_RGB_565,
+    HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP,           // NV12 (YUV420 semi-planar)
+    HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M,         // NV12 on multi-buffer
+};
+
+static int all_sw_dataspaces[] = {
+    HAL_DATASPACE_STANDARD_BT709,
+    HAL_DATASPACE_STANDARD_BT709 | HAL_DATASPACE_RANGE_FULL,
+    HAL_DATASPACE_STANDARD_BT709 | HAL_DATASPACE_RANGE_LIMITED,
+    HAL_DATASPACE_STANDARD_BT601_625,
+    HAL_DATASPACE_STANDARD_BT601_625 | HAL_DATASPACE_RANGE_FULL,
+    HAL_DATASPACE_STANDARD_BT601_625 | HAL_DATASPACE_RANGE_LIMITED,
+    HAL_DATASPACE_STANDARD_BT601_525,
+    HAL_DATASPACE_STANDARD_BT601_525 | HAL_DATASPACE_RANGE_FULL,
+    HAL_DATASPACE_STANDARD_BT601_525 | HAL_DATASPACE_RANGE_LIMITED,
+    // 0 should be treated as BT709 Limited range
+    0,
+    HAL_DATASPACE_RANGE_FULL,
+    HAL_DATASPACE_RANGE_LIMITED,
+    // Depricated legacy dataspace definitions
+    HAL_DATASPACE_SRGB,
+    HAL_DATASPACE_JFIF,
+    HAL_DATASPACE_BT601_525,
+    HAL_DATASPACE_BT601_625,
+    HAL_DATASPACE_BT709,
+};
+
+const static stHW2DCapability __capability_sw = {
+    .max_upsampling_num = {8, 8},
+    .max_downsampling_factor = {4, 4},
+    .max_upsizing_num = {8, 8},
+    .max_downsizing_factor = {4, 4},
+    .min_src_dimension = {1, 1},
+    .max_src_dimension = {8192, 8192},
+    .min_dst_dimension = {1, 1},
+    .max_dst_dimension = {8192, 8192},
+    .min_pix_align = {1, 1},
+    .rescaling_count = 0,
+    .compositing_mode = HW2DCapability::BLEND_NONE | HW2DCapability::BLEND_SRC_COPY | HW2DCapability::BLEND_SRC_OVER,
+    .transform_type = HW2DCapability::TRANSFORM_FLIP_HV,
+    .auxiliary_feature = HW2DCapability::FEATURE_PLANE_ALPHA | HW2DCapability::FEATURE_SOLIDCOLOR,
+    .num_formats = ARRSIZE(all_sw_formats),
+    .num_dataspaces = ARRSIZE(all_sw_dataspaces),
+    .max_layers = 4,
+    .pixformats = all_sw_formats,
+    .dataspaces = all_sw_dataspaces,
+    .base_align = 1,
+};
+
+static const HW2DCapability capability_sw(__capability_sw);
+
 Acrylic *Acrylic::createInstance(const char *spec)
 {
     Acrylic *compositor = nullptr;
@@ -125,6 +181,8 @@ Acrylic *Acrylic::createInstance(const char *spec)
 
     if (strcmp(spec, "fimg2d_gs101") == 0) {
         compositor = new AcrylicCompositorG2D(capability_fimg2d_gs101, true);
+    } else if (strcmp(spec, "sw_compositor") == 0) {
+        compositor = new AcrylicCompositorSW(capability_sw);
     } else {
         ALOGE("Unknown HW2D compositor spec., %s", spec);
         return nullptr;
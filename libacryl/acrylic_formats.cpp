@@ -105,12 +105,23 @@ static uint32_t __halfmt_to_v4l2_ycbcr[][2] = {
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC,  V4L2_PIX_FMT_NV12N_SBWC_10B },
 };
 
+#define DEFINE_HALFMT_INDEX(table)                                                  \
+    static const HalFormatIndex &table##_index()                                    \
+    {                                                                               \
+        static const HalFormatIndex index(table, ARRSIZE(table),                    \
+                                          [] (auto &entry) { return entry[0]; });   \
+        return index;                                                               \
+    }
+
+DEFINE_HALFMT_INDEX(__halfmt_to_v4l2_rgb)
+DEFINE_HALFMT_INDEX(__halfmt_to_v4l2_rgb_deprecated)
+DEFINE_HALFMT_INDEX(__halfmt_to_v4l2_ycbcr)
+
 static uint32_t halfmt_to_v4l2_ycbcr(uint32_t halfmt)
 {
-    for (size_t i = 0 ; i < ARRSIZE(__halfmt_to_v4l2_ycbcr); i++) {
-        if (__halfmt_to_v4l2_ycbcr[i][0] == halfmt)
-            return __halfmt_to_v4l2_ycbcr[i][1];
-    }
+    int i = __halfmt_to_v4l2_ycbcr_index().find(halfmt);
+    if (i >= 0)
+        return __halfmt_to_v4l2_ycbcr[i][1];
 
     ALOGE("Unable to find the proper v4l2 format for HAL format %#x", halfmt);
 
@@ -119,20 +130,18 @@ static uint32_t halfmt_to_v4l2_ycbcr(uint32_t halfmt)
 
 uint32_t halfmt_to_v4l2(uint32_t halfmt)
 {
-    for (size_t i = 0 ; i < ARRSIZE(__halfmt_to_v4l2_rgb); i++) {
-        if (__halfmt_to_v4l2_rgb[i][0] == halfmt)
-            return __halfmt_to_v4l2_rgb[i][1];
-    }
+    int i = __halfmt_to_v4l2_rgb_index().find(halfmt);
+    if (i >= 0)
+        return __halfmt_to_v4l2_rgb[i][1];
 
     return halfmt_to_v4l2_ycbcr(halfmt);
 }
 
 uint32_t halfmt_to_v4l2_deprecated(uint32_t halfmt)
 {
-    for (size_t i = 0 ; i < ARRSIZE(__halfmt_to_v4l2_rgb_deprecated); i++) {
-        if (__halfmt_to_v4l2_rgb_deprecated[i][0] == halfmt)
-            return __halfmt_to_v4l2_rgb_deprecated[i][1];
-    }
+    int i = __halfmt_to_v4l2_rgb_deprecated_index().find(halfmt);
+    if (i >= 0)
+        return __halfmt_to_v4l2_rgb_deprecated[i][1];
 
     return halfmt_to_v4l2_ycbcr(halfmt);
 }
@@ -179,6 +188,13 @@ static struct {
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC,    1, 0x22, {24, 0, 0, 0}, HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC, 2},
 };
 
+static const HalFormatIndex &halfmt_plane_bpp_index()
+{
+    static const HalFormatIndex index(__halfmt_plane_bpp, ARRSIZE(__halfmt_plane_bpp),
+                                      [] (auto &e) { return e.fmt; });
+    return index;
+}
+
 #define MFC_PAD_SIZE                256
 #define MFC_2B_PAD_SIZE             (MFC_PAD_SIZE / 4)
 #define MFC_ALIGN(v)                (((v) + 15) & ~15)
@@ -189,14 +205,13 @@ static struct {
 
 size_t halfmt_plane_length(uint32_t fmt, unsigned int plane, uint32_t width, uint32_t height)
 {
-    for (size_t i = 0; i < ARRSIZE(__halfmt_plane_bpp); i++) {
-        if (__halfmt_plane_bpp[i].fmt == fmt) {
-            LOGASSERT(plane < __halfmt_plane_bpp[i].bufcnt,
-                      "Plane count of HAL format %#x is %u but %d plane is requested", fmt,
-                      __halfmt_plane_bpp[i].bufcnt, plane);
-            if (plane < __halfmt_plane_bpp[i].bufcnt)
-                return (__halfmt_plane_bpp[i].bpp[plane] * width * height) / 8;
-        }
+    int i = halfmt_plane_bpp_index().find(fmt);
+    if (i >= 0) {
+        LOGASSERT(plane < __halfmt_plane_bpp[i].bufcnt,
+                  "Plane count of HAL format %#x is %u but %d plane is requested", fmt,
+                  __halfmt_plane_bpp[i].bufcnt, plane);
+        if (plane < __halfmt_plane_bpp[i].bufcnt)
+            return (__halfmt_plane_bpp[i].bpp[plane] * width * height) / 8;
     }
 
     LOGASSERT(1, "Unable to find HAL format %#x with plane %d", fmt, plane);
@@ -206,10 +221,9 @@ size_t halfmt_plane_length(uint32_t fmt, unsigned int plane, uint32_t width, uin
 
 unsigned int halfmt_bpp(uint32_t fmt)
 {
-    for (size_t i = 0 ; i < ARRSIZE(__halfmt_plane_bpp); i++) {
-        if (__halfmt_plane_bpp[i].fmt == fmt)
-                return __halfmt_plane_bpp[i].bpp[0] + __halfmt_plane_bpp[i].bpp[1] + __halfmt_plane_bpp[i].bpp[2];
-    }
+    int i = halfmt_plane_bpp_index().find(fmt);
+    if (i >= 0)
+        return __halfmt_plane_bpp[i].bpp[0] + __halfmt_plane_bpp[i].bpp[1] + __halfmt_plane_bpp[i].bpp[2];
 
     LOGASSERT(1, "Unable to find HAL format %#x", fmt);
 
@@ -219,10 +233,9 @@ unsigned int halfmt_bpp(uint32_t fmt)
 #define DEFINE_HALFMT_PROPERTY_GETTER(rettype, funcname, member)    \
     rettype funcname(uint32_t fmt)                                  \
     {                                                               \
-        for (size_t i = 0 ; i < ARRSIZE(__halfmt_plane_bpp); i++) { \
-            if (__halfmt_plane_bpp[i].fmt == fmt)                   \
-                return __halfmt_plane_bpp[i].member;                \
-        }                                                           \
+        int i = halfmt_plane_bpp_index().find(fmt);                 \
+        if (i >= 0)                                                 \
+            return __halfmt_plane_bpp[i].member;                    \
         LOGASSERT(1, "Unable to find HAL format %#x", fmt);         \
         return 0;                                                   \
     }
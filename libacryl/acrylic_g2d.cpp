@@ -22,9 +22,13 @@
 #include <alloca.h>
 #include <exynos_format.h> // hardware/smasung_slsi/exynos/include
 #include <hardware/hwcomposer2.h>
+#include <linux/sync_file.h>
 #include <log/log.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <system/graphics.h>
+#include <unistd.h>
+#include <utils/Timers.h>
 #include <utils/Trace.h>
 
 #include <algorithm>
@@ -363,6 +367,26 @@ static unsigned int writeFilterCoefficients(uint32_t hfactor, uint32_t vfactor,
     return cnt;
 }
 
+#define MAX_FILTER_COEF_REGS (2 * (NUM_VERT_COEF_REGS + NUM_HORI_COEF_REGS))
+
+/*
+ * The registers written by writeFilterCoefficients() only depend on the
+ * coefficient sets chosen for luma and chroma and the layer index.
+ */
+static uint32_t getFilterCoefficientsKey(uint32_t hfactor, uint32_t vfactor, uint32_t colormode)
+{
+    uint32_t key = (1 << 16) | findFilterCoefficientsIndex(hfactor) |
+                   (findFilterCoefficientsIndex(vfactor) << 4);
+
+    if (IS_YUV(colormode)) {
+        getChromaScaleFactor(colormode, &hfactor, &vfactor);
+        key |= (findFilterCoefficientsIndex(hfactor) << 8) |
+               (findFilterCoefficientsIndex(vfactor) << 12) | (1 << 17);
+    }
+
+    return key;
+}
+
 static unsigned int getFilterCoefficientCount(uint32_t *src_cmds[], unsigned int layer_count)
 {
     unsigned int count = 0;
@@ -519,12 +543,22 @@ static g2d_fmt __halfmt_to_g2dfmt[] = {
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L80, G2D_FMT_NV12_SBWC_10B, 2, 0},
 };
 
-static g2d_fmt *halfmt_to_g2dfmt(struct g2d_fmt *tbl, size_t tbl_len, uint32_t halfmt)
+static const HalFormatIndex &halfmt_to_g2dfmt_index(bool newcolormode)
 {
-    for (size_t i = 0 ; i < tbl_len; i++) {
-        if (tbl[i].halfmt == halfmt)
-            return &tbl[i];
-    }
+    static const HalFormatIndex index(__halfmt_to_g2dfmt, ARRSIZE(__halfmt_to_g2dfmt),
+                                      [] (auto &e) { return e.halfmt; });
+    static const HalFormatIndex index_legacy(__halfmt_to_g2dfmt_legacy,
+                                             ARRSIZE(__halfmt_to_g2dfmt_legacy),
+                                             [] (auto &e) { return e.halfmt; });
+
+    return newcolormode ? index : index_legacy;
+}
+
+static g2d_fmt *halfmt_to_g2dfmt(struct g2d_fmt *tbl, const HalFormatIndex &index, uint32_t halfmt)
+{
+    int i = index.find(halfmt);
+    if (i >= 0)
+        return &tbl[i];
 
     ALOGE("Unable to find the proper G2D format for HAL format %#x", halfmt);
 
@@ -533,17 +567,29 @@ static g2d_fmt *halfmt_to_g2dfmt(struct g2d_fmt *tbl, size_t tbl_len, uint32_t h
 
 AcrylicCompositorG2D::AcrylicCompositorG2D(const HW2DCapability &capability, bool newcolormode)
     : Acrylic(capability), mDev((capability.maxLayerCount() > 2) ? "/dev/g2d" : "/dev/fimg2d"),
-      mMaxSourceCount(0), mPriority(-1)
+      mMaxSourceCount(0), mPriority(-1), mCommandCached(false), mCachedLayerCount(0),
+      mCachedBackground(false), mLaptimeUSec(0), mLastFillOnly(false), mFillJobCount(0),
+      mFillLaptimeUSec(0), mCompositionJobCount(0), mCompositionLaptimeUSec(0),
+      mLaptimeHistoryCount(0), mLaptimeHistoryIndex(0), mNextJob(0), mNextJobHandle(1), mLastSignalTime(0)
 {
     memset(&mTask, 0, sizeof(mTask));
 
+    for (auto &job : mJobs) {
+        job.handle = 0;
+        job.fence = -1;
+        job.submitTime = 0;
+        job.queueDelay = 0;
+        job.laptime = 0;
+        job.fillOnly = false;
+    }
+
     mVersion = 0;
     if (mDev.ioctl(G2D_IOC_VERSION, &mVersion) < 0)
         ALOGERR("Failed to get G2D command version");
     ALOGI("G2D API Version %d", mVersion);
 
     halfmt_to_g2dfmt_tbl = newcolormode ? __halfmt_to_g2dfmt : __halfmt_to_g2dfmt_legacy;
-    len_halfmt_to_g2dfmt_tbl = newcolormode ? ARRSIZE(__halfmt_to_g2dfmt) : ARRSIZE(__halfmt_to_g2dfmt_legacy);
+    index_halfmt_to_g2dfmt_tbl = &halfmt_to_g2dfmt_index(newcolormode);
 
     mUsePolyPhaseFilter = getCapabilities().supportedMinDecimation() == hw2d_coord_t{4, 4};
 
@@ -552,11 +598,20 @@ AcrylicCompositorG2D::AcrylicCompositorG2D(const HW2DCapability &capability, boo
 
 AcrylicCompositorG2D::~AcrylicCompositorG2D()
 {
+    for (auto &job : mJobs) {
+        if (job.fence >= 0)
+            close(job.fence);
+    }
+
     delete [] mTask.source;
     delete [] mTask.commands.target;
     for (unsigned int i = 0; i < mMaxSourceCount; i++)
         delete [] mTask.commands.source[i];
 
+    ALOGD_TEST("G2D laptime: %u compositions %llu usec, %u fills %llu usec",
+               mCompositionJobCount, static_cast<unsigned long long>(mCompositionLaptimeUSec),
+               mFillJobCount, static_cast<unsigned long long>(mFillLaptimeUSec));
+
     ALOGD_TEST("Deleting Acrylic for G2D on %p", this);
 }
 
@@ -567,15 +622,154 @@ unsigned int AcrylicCompositorG2D::updateFilterCoefficients(unsigned int layerco
 
     unsigned int cnt = 0;
 
-    for (unsigned int i = 0; i < layercount; i++)
-        cnt += writeFilterCoefficients(mTask.commands.source[i][G2DSFR_SRC_XSCALE],
-                                       mTask.commands.source[i][G2DSFR_SRC_YSCALE],
-                                       mTask.commands.source[i][G2DSFR_IMG_COLORMODE],
-                                       i, regs + cnt);
+    if (mFilterCoefCache.size() < layercount)
+        mFilterCoefCache.resize(layercount, FilterCoefCache{0, {}});
+
+    for (unsigned int i = 0; i < layercount; i++) {
+        uint32_t hfactor = mTask.commands.source[i][G2DSFR_SRC_XSCALE];
+        uint32_t vfactor = mTask.commands.source[i][G2DSFR_SRC_YSCALE];
+        uint32_t colormode = mTask.commands.source[i][G2DSFR_IMG_COLORMODE];
+        FilterCoefCache &cache = mFilterCoefCache[i];
+
+        uint32_t key = getFilterCoefficientsKey(hfactor, vfactor, colormode);
+        if (cache.key != key) {
+            cache.regs.resize(MAX_FILTER_COEF_REGS);
+            cache.regs.resize(writeFilterCoefficients(hfactor, vfactor, colormode,
+                                                      i, cache.regs.data()));
+            cache.key = key;
+        }
+
+        if (!cache.regs.empty()) {
+            memcpy(regs + cnt, cache.regs.data(), sizeof(g2d_reg) * cache.regs.size());
+            cnt += cache.regs.size();
+        }
+    }
 
     return cnt;
 }
 
+static const uint32_t G2D_COMMAND_MODIFIED = AcrylicCanvas::SETTING_TYPE_MODIFIED |
+                                             AcrylicCanvas::SETTING_DIMENSION_MODIFIED |
+                                             AcrylicCanvas::SETTING_COMPOSIT_MODIFIED;
+
+/*
+ * Crop, window and transform are compared by value because HWC configures
+ * them again on every frame and setImageDimension() resets the crop.
+ */
+bool AcrylicCompositorG2D::canReuseCommands(unsigned int layercount, bool hasBackground)
+{
+    if (!mCommandCached || (mCachedLayerCount != layercount) ||
+            (mCachedBackground != hasBackground))
+        return false;
+
+    if (getCanvas().getSettingFlags() & G2D_COMMAND_MODIFIED)
+        return false;
+
+    if (hasBackground) {
+        uint16_t color[4];
+        getBackgroundColor(&color[0], &color[1], &color[2], &color[3]);
+        if (memcmp(color, mCachedBackgroundColor, sizeof(color)) != 0)
+            return false;
+    }
+
+    unsigned int baseidx = hasBackground ? 1 : 0;
+
+    for (unsigned int i = baseidx; i < layercount; i++) {
+        AcrylicLayer *layer = getLayer(i - baseidx);
+        const CachedSource &cached = mCachedSource[i];
+
+        if ((cached.layer != layer) || (layer->getSettingFlags() & G2D_COMMAND_MODIFIED) ||
+                !(cached.imageRect == layer->getImageRect()) ||
+                !(cached.targetRect == layer->getTargetRect()) ||
+                (cached.transform != layer->getTransform()))
+            return false;
+    }
+
+    return true;
+}
+
+void AcrylicCompositorG2D::storeCommandCache(unsigned int layercount, bool hasBackground)
+{
+    if (layercount > G2D_MAX_IMAGES)
+        return;
+
+    unsigned int baseidx = hasBackground ? 1 : 0;
+
+    for (unsigned int i = baseidx; i < layercount; i++) {
+        AcrylicLayer *layer = getLayer(i - baseidx);
+        CachedSource &cached = mCachedSource[i];
+
+        cached.layer = layer;
+        cached.imageRect = layer->getImageRect();
+        cached.targetRect = layer->getTargetRect();
+        cached.transform = layer->getTransform();
+    }
+
+    getBackgroundColor(&mCachedBackgroundColor[0], &mCachedBackgroundColor[1],
+                       &mCachedBackgroundColor[2], &mCachedBackgroundColor[3]);
+
+    mCachedLayerCount = layercount;
+    mCachedBackground = hasBackground;
+    mCommandCached = true;
+}
+
+/*
+ * Solid color layers have neither YCbCr nor HDR colors and are never scaled.
+ * Only an RGB target without HDR transfer keeps CSC and HDR away from the task.
+ */
+bool AcrylicCompositorG2D::isFillOnly()
+{
+    if (getCanvas().isOTF())
+        return false;
+
+    uint32_t transfer = getCanvas().getDataspace() & HAL_DATASPACE_TRANSFER_MASK;
+    if ((transfer == HAL_DATASPACE_TRANSFER_ST2084) || (transfer == HAL_DATASPACE_TRANSFER_HLG))
+        return false;
+
+    g2d_fmt *g2dfmt = halfmt_to_g2dfmt(halfmt_to_g2dfmt_tbl, *index_halfmt_to_g2dfmt_tbl, getCanvas().getFormat());
+    if (!g2dfmt || g2dfmt_is_ycbcr(g2dfmt->g2dfmt))
+        return false;
+
+    for (unsigned int i = 0; i < layerCount(); i++) {
+        if (!getLayer(i)->isSolidColor())
+            return false;
+    }
+
+    return true;
+}
+
+void AcrylicCompositorG2D::accountLaptime(unsigned int laptime, bool fillOnly)
+{
+    mLaptimeUSec = laptime;
+
+    if (fillOnly) {
+        mFillJobCount++;
+        mFillLaptimeUSec += laptime;
+    } else {
+        mCompositionJobCount++;
+        mCompositionLaptimeUSec += laptime;
+
+        mLaptimeHistory[mLaptimeHistoryIndex] = laptime;
+        mLaptimeHistoryIndex = (mLaptimeHistoryIndex + 1) % G2D_LAPTIME_HISTORY;
+        if (mLaptimeHistoryCount < G2D_LAPTIME_HISTORY)
+            mLaptimeHistoryCount++;
+    }
+}
+
+unsigned int AcrylicCompositorG2D::getLaptimePercentileUSec(unsigned int percentile)
+{
+    if (mLaptimeHistoryCount == 0)
+        return 0;
+
+    unsigned int laptimes[G2D_LAPTIME_HISTORY];
+    memcpy(laptimes, mLaptimeHistory, sizeof(laptimes[0]) * mLaptimeHistoryCount);
+
+    unsigned int nth = (mLaptimeHistoryCount - 1) * std::min(percentile, 100U) / 100;
+    std::nth_element(laptimes, laptimes + nth, laptimes + mLaptimeHistoryCount);
+
+    return laptimes[nth];
+}
+
 #define SBWC_BLOCK_WIDTH 32
 #define SBWC_BLOCK_HEIGHT 4
 #define SBWC_BLOCK_SIZE(bit) (SBWC_BLOCK_WIDTH * SBWC_BLOCK_HEIGHT * (bit) / 8)
@@ -609,7 +803,8 @@ static unsigned int sbwc_lossy_formats[] = {
     HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L80,
 };
 
-bool AcrylicCompositorG2D::prepareImage(AcrylicCanvas &layer, struct g2d_layer &image, uint32_t cmd[], int index)
+bool AcrylicCompositorG2D::prepareImageBuffer(AcrylicCanvas &layer, struct g2d_layer &image,
+                                              unsigned int num_bufs)
 {
     image.flags = 0;
 
@@ -621,11 +816,6 @@ bool AcrylicCompositorG2D::prepareImage(AcrylicCanvas &layer, struct g2d_layer &
     if (layer.isProtected())
         image.flags |= G2D_LAYERFLAG_SECURE;
 
-    g2d_fmt *g2dfmt = halfmt_to_g2dfmt(halfmt_to_g2dfmt_tbl, len_halfmt_to_g2dfmt_tbl, layer.getFormat());
-    if (!g2dfmt)
-        return false;
-
-    image.flags &= ~G2D_LAYERFLAG_MFC_STRIDE;
     for (size_t i = 0; i < ARRSIZE(mfc_stride_formats); i++) {
         if (layer.getFormat() == mfc_stride_formats[i]) {
             image.flags |= G2D_LAYERFLAG_MFC_STRIDE;
@@ -636,15 +826,15 @@ bool AcrylicCompositorG2D::prepareImage(AcrylicCanvas &layer, struct g2d_layer &
     if (layer.getBufferType() == AcrylicCanvas::MT_EMPTY) {
         image.buffer_type = G2D_BUFTYPE_EMPTY;
     } else {
-        if (layer.getBufferCount() < g2dfmt->num_bufs) {
+        if (layer.getBufferCount() < num_bufs) {
             ALOGE("HAL Format %#x requires %d buffers but %d buffers are given",
-                    layer.getFormat(), g2dfmt->num_bufs, layer.getBufferCount());
+                    layer.getFormat(), num_bufs, layer.getBufferCount());
             return false;
         }
 
         if (layer.getBufferType() == AcrylicCanvas::MT_DMABUF) {
             image.buffer_type = G2D_BUFTYPE_DMABUF;
-            for (unsigned int i = 0; i < g2dfmt->num_bufs; i++) {
+            for (unsigned int i = 0; i < num_bufs; i++) {
                 image.buffer[i].dmabuf.fd = layer.getDmabuf(i);
                 image.buffer[i].dmabuf.offset = layer.getOffset(i);
                 image.buffer[i].length = layer.getBufferLength(i);
@@ -653,14 +843,26 @@ bool AcrylicCompositorG2D::prepareImage(AcrylicCanvas &layer, struct g2d_layer &
             LOGASSERT(layer.getBufferType() == AcrylicCanvas::MT_USERPTR,
                       "Unknown buffer type %d", layer.getBufferType());
             image.buffer_type = G2D_BUFTYPE_USERPTR;
-            for (unsigned int i = 0; i < g2dfmt->num_bufs; i++) {
+            for (unsigned int i = 0; i < num_bufs; i++) {
                 image.buffer[i].userptr = layer.getUserptr(i);
                 image.buffer[i].length = layer.getBufferLength(i);
             }
         }
     }
 
-    image.num_buffers = g2dfmt->num_bufs;
+    image.num_buffers = num_bufs;
+
+    return true;
+}
+
+bool AcrylicCompositorG2D::prepareImage(AcrylicCanvas &layer, struct g2d_layer &image, uint32_t cmd[], int index)
+{
+    g2d_fmt *g2dfmt = halfmt_to_g2dfmt(halfmt_to_g2dfmt_tbl, *index_halfmt_to_g2dfmt_tbl, layer.getFormat());
+    if (!g2dfmt)
+        return false;
+
+    if (!prepareImageBuffer(layer, image, g2dfmt->num_bufs))
+        return false;
 
     hw2d_coord_t xy = layer.getImageDimension();
 
@@ -961,6 +1163,7 @@ bool AcrylicCompositorG2D::reallocLayer(unsigned int layercount)
         delete [] mTask.commands.source[i];
 
     mMaxSourceCount = 0;
+    mCommandCached = false;
 
     mTask.source = new g2d_layer[layercount];
     if (!mTask.source) {
@@ -1036,7 +1239,7 @@ bool AcrylicCompositorG2D::executeG2D(int fence[], unsigned int num_fences, bool
 
     bool hasBackground = hasBackgroundColor();
 
-    g2d_fmt *g2dfmt = halfmt_to_g2dfmt(halfmt_to_g2dfmt_tbl, len_halfmt_to_g2dfmt_tbl, getCanvas().getFormat());
+    g2d_fmt *g2dfmt = halfmt_to_g2dfmt(halfmt_to_g2dfmt_tbl, *index_halfmt_to_g2dfmt_tbl, getCanvas().getFormat());
     if (g2dfmt && (g2dfmt->g2dfmt & G2D_DATAFORMAT_SBWC))
         hasBackground = true;
 
@@ -1054,9 +1257,20 @@ bool AcrylicCompositorG2D::executeG2D(int fence[], unsigned int num_fences, bool
 
     sortLayers();
 
+    bool fillOnly = isFillOnly();
+    mLastFillOnly = fillOnly;
+
+    bool reuseCommands = canReuseCommands(layercount, hasBackground);
+    mCommandCached = false;
+
     mTask.flags = 0;
 
-    if (!prepareImage(getCanvas(), mTask.target, mTask.commands.target, -1)) {
+    if (reuseCommands) {
+        if (!prepareImageBuffer(getCanvas(), mTask.target, mTask.target.num_buffers)) {
+            ALOGE("Failed to configure the target image");
+            return false;
+        }
+    } else if (!prepareImage(getCanvas(), mTask.target, mTask.commands.target, -1)) {
         ALOGE("Failed to configure the target image");
         return false;
     }
@@ -1068,7 +1282,8 @@ bool AcrylicCompositorG2D::executeG2D(int fence[], unsigned int num_fences, bool
 
     if (hasBackground) {
         baseidx++;
-        prepareSolidLayer(getCanvas(), mTask.source[0], mTask.commands.source[0]);
+        if (!reuseCommands)
+            prepareSolidLayer(getCanvas(), mTask.source[0], mTask.commands.source[0]);
     }
 
     mTask.commands.target[G2DSFR_DST_YCBCRMODE] = 0;
@@ -1079,16 +1294,34 @@ bool AcrylicCompositorG2D::executeG2D(int fence[], unsigned int num_fences, bool
 
     mTask.commands.target[G2DSFR_DST_YCBCRMODE] |= (G2D_LAYER_YCBCRMODE_OFFX | G2D_LAYER_YCBCRMODE_OFFY);
 
+    mHdrWriter.resetLayers();
+
     for (unsigned int i = baseidx; i < layercount; i++) {
         AcrylicLayer &layer = *getLayer(i - baseidx);
 
-        if (!prepareSource(layer, mTask.source[i],
-                           mTask.commands.source[i], getCanvas().getImageDimension(),
-                           i, i - baseidx)) {
-            ALOGE("Failed to configure source layer %u", i - baseidx);
-            return false;
+        if (reuseCommands) {
+            // Only the buffers are changed. HDR and CSC are configured again below.
+            if (!layer.isSolidColor() &&
+                !prepareImageBuffer(layer, mTask.source[i], mTask.source[i].num_buffers)) {
+                ALOGE("Failed to configure source layer %u", i - baseidx);
+                return false;
+            }
+            mTask.commands.source[i][G2DSFR_SRC_COMMAND] = mCachedSource[i].command;
+            mTask.commands.source[i][G2DSFR_SRC_YCBCRMODE] = 0;
+            mTask.commands.source[i][G2DSFR_SRC_HDRMODE] = 0;
+        } else {
+            if (!prepareSource(layer, mTask.source[i],
+                               mTask.commands.source[i], getCanvas().getImageDimension(),
+                               i, i - baseidx)) {
+                ALOGE("Failed to configure source layer %u", i - baseidx);
+                return false;
+            }
+            mCachedSource[i].command = mTask.commands.source[i][G2DSFR_SRC_COMMAND];
         }
 
+        if (fillOnly)
+            continue;
+
         if (!cscMatrixWriter.configure(mTask.commands.source[i][G2DSFR_IMG_COLORMODE],
                                        layer.getDataspace(),
                                        &mTask.commands.source[i][G2DSFR_SRC_YCBCRMODE])) {
@@ -1107,11 +1340,13 @@ bool AcrylicCompositorG2D::executeG2D(int fence[], unsigned int num_fences, bool
         mHdrWriter.setLayerOpaqueData(i, layer.getLayerData(), layer.getLayerDataLength());
     }
 
-    mHdrWriter.setTargetInfo(getCanvas().getDataspace(), getTargetDisplayInfo());
-    mHdrWriter.setTargetDisplayLuminance(getMinTargetDisplayLuminance(), getMaxTargetDisplayLuminance());
+    if (!fillOnly) {
+        mHdrWriter.setTargetInfo(getCanvas().getDataspace(), getTargetDisplayInfo());
+        mHdrWriter.setTargetDisplayLuminance(getMinTargetDisplayLuminance(), getMaxTargetDisplayLuminance());
 
-    mHdrWriter.getCommands();
-    mHdrWriter.getLayerHdrMode(mTask);
+        mHdrWriter.getCommands();
+        mHdrWriter.getLayerHdrMode(mTask);
+    }
 
     mTask.num_source = layercount;
 
@@ -1123,7 +1358,7 @@ bool AcrylicCompositorG2D::executeG2D(int fence[], unsigned int num_fences, bool
 
     mTask.commands.num_extra_regs = cscMatrixWriter.getRegisterCount() +
                                     mHdrWriter.getCommandCount();
-    if (mUsePolyPhaseFilter)
+    if (mUsePolyPhaseFilter && !fillOnly)
         mTask.commands.num_extra_regs += getFilterCoefficientCount(mTask.commands.source, layercount);
 
     mTask.commands.extra = reinterpret_cast<g2d_reg *>(alloca(sizeof(g2d_reg) * mTask.commands.num_extra_regs));
@@ -1132,7 +1367,8 @@ bool AcrylicCompositorG2D::executeG2D(int fence[], unsigned int num_fences, bool
 
     regs += cscMatrixWriter.write(regs);
 
-    regs += updateFilterCoefficients(layercount, regs);
+    if (!fillOnly)
+        regs += updateFilterCoefficients(layercount, regs);
 
     mHdrWriter.write(regs);
 
@@ -1152,6 +1388,11 @@ bool AcrylicCompositorG2D::executeG2D(int fence[], unsigned int num_fences, bool
         return false;
     }
 
+    storeCommandCache(layercount, hasBackground);
+
+    if (!nonblocking)
+        accountLaptime(mTask.laptime_in_usec, fillOnly);
+
     getCanvas().clearSettingModified();
     getCanvas().setFence(-1);
 
@@ -1183,7 +1424,10 @@ bool AcrylicCompositorG2D::execute(int fence[], unsigned int num_fences)
 
 bool AcrylicCompositorG2D::execute(int *handle)
 {
-    if (!executeG2D(NULL, 0, handle ? true : false)) {
+    if (handle != NULL)
+        return execute(NULL, 0, handle);
+
+    if (!executeG2D(NULL, 0, false)) {
         // Clearing all acquire fences because their buffers are expired.
         // The clients should configure everything again to start new execution
         for (unsigned int i = 0; i < layerCount(); i++)
@@ -1193,19 +1437,215 @@ bool AcrylicCompositorG2D::execute(int *handle)
         return false;
     }
 
+    return true;
+}
+
+bool AcrylicCompositorG2D::execute(int fence[], unsigned int num_fences, int *handle)
+{
+    reapJobs();
+
+    // The oldest slot is reused. Wait for its job not to lose track of it.
+    G2DJob &job = mJobs[mNextJob];
+    if ((job.fence >= 0) && !waitJob(job)) {
+        close(job.fence);
+        job.fence = -1;
+    }
+
+    // The target release fence is always requested to track the job
+    unsigned int layercount = layerCount();
+    unsigned int count = layercount + 1;
+    int *fences = reinterpret_cast<int *>(alloca(sizeof(int) * count));
+
+    if (!execute(fences, count))
+        return false;
+
+    for (unsigned int i = 0; i < num_fences; i++) {
+        if (i < layercount)
+            fence[i] = fences[i];
+        else if ((i == layercount) && (fences[layercount] >= 0))
+            fence[i] = dup(fences[layercount]);
+        else
+            fence[i] = -1;
+    }
+
+    for (unsigned int i = num_fences; i < layercount; i++) {
+        if (fences[i] >= 0)
+            close(fences[i]);
+    }
+
+    job.handle = mNextJobHandle++;
+    if (mNextJobHandle <= 0)
+        mNextJobHandle = 1;
+    job.fence = fences[layercount];
+    job.submitTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    job.queueDelay = 0;
+    job.laptime = 0;
+    job.fillOnly = mLastFillOnly;
+
+    mNextJob = (mNextJob + 1) % G2D_MAX_INFLIGHT_JOBS;
+
     if (handle != NULL)
-        *handle = 1; /* dummy handle */
+        *handle = job.handle;
+
+    return true;
+}
+
+AcrylicCompositorG2D::G2DJob *AcrylicCompositorG2D::findJob(int handle)
+{
+    if (handle <= 0)
+        return nullptr;
+
+    for (auto &job : mJobs) {
+        if (job.handle == handle)
+            return &job;
+    }
+
+    return nullptr;
+}
+
+#define G2D_JOB_TIMEOUT_MS 1000
+
+static int64_t getFenceSignalTime(int fence)
+{
+    struct sync_file_info info;
+    memset(&info, 0, sizeof(info));
+
+    if ((ioctl(fence, SYNC_IOC_FILE_INFO, &info) < 0) || (info.num_fences == 0))
+        return -1;
+
+    struct sync_fence_info *fence_info = reinterpret_cast<struct sync_fence_info *>(
+            alloca(sizeof(*fence_info) * info.num_fences));
+    memset(fence_info, 0, sizeof(*fence_info) * info.num_fences);
+    info.sync_fence_info = reinterpret_cast<uint64_t>(fence_info);
+
+    if (ioctl(fence, SYNC_IOC_FILE_INFO, &info) < 0)
+        return -1;
+
+    int64_t timestamp = 0;
+    for (unsigned int i = 0; i < info.num_fences; i++)
+        timestamp = std::max(timestamp, static_cast<int64_t>(fence_info[i].timestamp_ns));
+
+    return timestamp;
+}
+
+bool AcrylicCompositorG2D::waitJob(G2DJob &job)
+{
+    if (job.fence < 0)
+        return true;
+
+    struct pollfd fds = {job.fence, POLLIN, 0};
+    int ret = poll(&fds, 1, G2D_JOB_TIMEOUT_MS);
+    if (ret <= 0) {
+        if (ret == 0)
+            ALOGE("Timed out waiting for G2D job %d", job.handle);
+        else
+            ALOGERR("Failed to wait for G2D job %d", job.handle);
+        return false;
+    }
+
+    // HW starts the job when the previous one is done if they are queued
+    int64_t signalTime = getFenceSignalTime(job.fence);
+    if (signalTime < 0)
+        signalTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    int64_t startTime = std::max(job.submitTime, mLastSignalTime);
+    job.queueDelay = static_cast<unsigned int>((startTime - job.submitTime) / 1000);
+    if (signalTime > startTime)
+        job.laptime = static_cast<unsigned int>((signalTime - startTime) / 1000);
+    mLastSignalTime = std::max(mLastSignalTime, signalTime);
+    accountLaptime(job.laptime, job.fillOnly);
+
+    close(job.fence);
+    job.fence = -1;
 
     return true;
 }
 
-bool AcrylicCompositorG2D::waitExecution(int __unused handle)
+// Collects the completed jobs without blocking to keep the laptime history fresh
+void AcrylicCompositorG2D::reapJobs()
+{
+    for (unsigned int i = 0; i < G2D_MAX_INFLIGHT_JOBS; i++) {
+        // The oldest job first, the jobs are completed in order
+        G2DJob &job = mJobs[(mNextJob + i) % G2D_MAX_INFLIGHT_JOBS];
+        if (job.fence < 0)
+            continue;
+
+        struct pollfd fds = {job.fence, POLLIN, 0};
+        if (poll(&fds, 1, 0) <= 0)
+            break;
+
+        waitJob(job);
+    }
+}
+
+bool AcrylicCompositorG2D::waitExecution(int handle)
+{
+    ALOGD_TEST("Waiting for execution of G2D job %d", handle);
+
+    G2DJob *job = findJob(handle);
+    if (!job) {
+        ALOGE("Unknown G2D job handle %d", handle);
+        return false;
+    }
+
+    return waitJob(*job);
+}
+
+unsigned int AcrylicCompositorG2D::getLaptimeUSec(int handle)
 {
-    ALOGD_TEST("Waiting for execution of m2m1shot2 G2D completed by handle %d", handle);
+    G2DJob *job = findJob(handle);
+    if (!job || (job->fence >= 0))
+        return 0;
+
+    return job->laptime;
+}
+
+bool AcrylicCompositorG2D::getJobTiming(int handle, unsigned int *queue_usec, unsigned int *exec_usec)
+{
+    G2DJob *job = findJob(handle);
+    if (!job || (job->fence >= 0))
+        return false;
+
+    *queue_usec = job->queueDelay;
+    *exec_usec = job->laptime;
 
     return true;
 }
 
+enum {
+    G2D_PERF_SCALE_NONE,
+    G2D_PERF_SCALE_UP,
+    G2D_PERF_SCALE_DOWN,     // down to 1/2
+    G2D_PERF_SCALE_DOWN_2X,  // further down than 1/2
+    G2D_PERF_SCALE_BUCKETS,
+};
+
+/*
+ * Weight to the read bandwidth of a layer by the scaling involved, multiplied by 16
+ * to avoid multiplication with a real number. Scaling reads the neighbouring lines
+ * needed by the filter, which is 1.125 of the source on average.
+ */
+static const uint32_t g2d_perf_read_weight[G2D_PERF_SCALE_BUCKETS] = {
+    16, // G2D_PERF_SCALE_NONE
+    18, // G2D_PERF_SCALE_UP
+    18, // G2D_PERF_SCALE_DOWN
+    18, // G2D_PERF_SCALE_DOWN_2X
+};
+
+static unsigned int getPerfScaleBucket(uint32_t src_hori, uint32_t src_vert,
+                                       uint32_t dst_hori, uint32_t dst_vert)
+{
+    if ((src_hori == dst_hori) && (src_vert == dst_vert))
+        return G2D_PERF_SCALE_NONE;
+
+    uint64_t src = static_cast<uint64_t>(src_hori) * src_vert;
+    uint64_t dst = static_cast<uint64_t>(dst_hori) * dst_vert;
+
+    if (src <= dst)
+        return G2D_PERF_SCALE_UP;
+
+    return (src > dst * 4) ? G2D_PERF_SCALE_DOWN_2X : G2D_PERF_SCALE_DOWN;
+}
+
 bool AcrylicCompositorG2D::requestPerformanceQoS(AcrylicPerformanceRequest *request)
 {
     g2d_performance data;
@@ -1238,7 +1678,6 @@ bool AcrylicCompositorG2D::requestPerformanceQoS(AcrylicPerformanceRequest *requ
         for (int idx = 0; idx < frame->getLayerCount(); idx++) {
             AcrylicPerformanceRequestLayer *layer = &(frame->mLayers[idx]);
             uint64_t layer_bw, pixelcount;
-            int32_t is_scaling;
             uint32_t src_hori = layer->mSourceRect.size.hori;
             uint32_t src_vert = layer->mSourceRect.size.vert;
             uint32_t dst_hori = layer->mTargetRect.size.hori;
@@ -1273,28 +1712,16 @@ bool AcrylicCompositorG2D::requestPerformanceQoS(AcrylicPerformanceRequest *requ
             // src_yuv420_8b is used when calculating write bandwidth
             if (bpp == 12) src_yuv420_8b = true;
 
-            layer_bw = pixelcount * bpp;
-            // Below is checking if scaling is involved.
-            // Comparisons are replaced by additions to avoid branches.
             if (!!(layer->mTransform & HAL_TRANSFORM_ROT_90)) {
                 src_rotate = true;
                 data.frame[i].layer[idx].layer_attr |= G2D_PERF_LAYER_ROTATE;
-
-                is_scaling = src_hori - dst_vert;
-                is_scaling += src_vert - dst_hori;
-            } else {
-                is_scaling = src_hori - dst_hori;
-                is_scaling += src_vert - dst_vert;
-            }
-            // Weight to the bandwidth when scaling is involved is 1.125.
-            // It is multiplied by 16 to avoid multiplication with a real number.
-            // We also get benefit from shift instead of multiplication.
-            if (is_scaling == 0) {
-                layer_bw <<= 4; // layer_bw * 16
-            } else {
-                layer_bw = (layer_bw << 4) + (layer_bw << 1); // layer_bw * 18
+                std::swap(dst_hori, dst_vert);
             }
 
+            layer_bw = pixelcount * bpp;
+            layer_bw *= g2d_perf_read_weight[getPerfScaleBucket(src_hori, src_vert,
+                                                                dst_hori, dst_vert)];
+
             bandwidth += layer_bw;
             ALOGD_TEST("        LAYER[%d]: BW %llu FMT %#x(%u) (%dx%d)@(%dx%d)on(%dx%d) --> (%dx%d)@(%dx%d) TRFM %#x",
                     idx, static_cast<unsigned long long>(layer_bw), layer->mPixFormat, bpp,
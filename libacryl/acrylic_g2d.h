@@ -19,6 +19,7 @@
 #define __HARDWARE_EXYNOS_HW2DCOMPOSITOR_G2D_H__
 
 #include <memory>
+#include <vector>
 
 #include <hardware/exynos/acryl.h>
 
@@ -29,9 +30,105 @@
 #include "acrylic_internal.h"
 #include "acrylic_device.h"
 
+/*
+ * The HDR plugin generates the tone mapping coefficients from the metadata of
+ * the layers and the target. The commands it generated are kept with the
+ * metadata and reused until any of the metadata changes.
+ */
 class G2DHdrWriter {
+    struct LayerInfo {
+        bool valid = false;
+        int dataspace = 0;
+        unsigned int min_luminance = 0;
+        unsigned int max_luminance = 0;
+        unsigned int pixfmt = 0;
+        bool alpha_premult = false;
+        void *data = nullptr;
+        size_t len = 0;
+        uint32_t data_hash = 0;
+
+        bool operator==(const LayerInfo &o) const {
+            return (valid == o.valid) && (dataspace == o.dataspace) &&
+                   (min_luminance == o.min_luminance) && (max_luminance == o.max_luminance) &&
+                   (pixfmt == o.pixfmt) && (alpha_premult == o.alpha_premult) &&
+                   (len == o.len) && (data_hash == o.data_hash);
+        }
+    };
+
+    struct TargetInfo {
+        int dataspace = 0;
+        void *data = nullptr;
+        unsigned int min_luminance = 0;
+        unsigned int max_luminance = 0;
+
+        bool operator==(const TargetInfo &o) const {
+            return (dataspace == o.dataspace) && (data == o.data) &&
+                   (min_luminance == o.min_luminance) && (max_luminance == o.max_luminance);
+        }
+    };
+
     std::unique_ptr<IG2DHdr10CommandWriter> mWriter;
     g2d_commandlist *mCmds = nullptr;
+
+    // metadata of the current job
+    std::vector<LayerInfo> mLayers;
+    TargetInfo mTarget;
+
+    // metadata and commands of the last generated commands
+    bool mCacheValid = false;
+    std::vector<LayerInfo> mCachedLayers;
+    TargetInfo mCachedTarget;
+    std::vector<g2d_reg> mCachedHdrMode;
+    std::vector<g2d_reg> mCachedCommands;
+    g2d_commandlist mCachedCmds{};
+
+    LayerInfo &layerInfo(int layer_index) {
+        if (mLayers.size() <= static_cast<size_t>(layer_index))
+            mLayers.resize(layer_index + 1);
+        mLayers[layer_index].valid = true;
+        return mLayers[layer_index];
+    }
+
+    static uint32_t hashData(const void *data, size_t len) {
+        // FNV-1a
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        uint32_t hash = 2166136261U;
+        for (size_t i = 0; i < len; i++)
+            hash = (hash ^ p[i]) * 16777619U;
+        return hash;
+    }
+
+    void generateCommands() {
+        for (size_t i = 0; i < mLayers.size(); i++) {
+            LayerInfo &info = mLayers[i];
+            if (!info.valid)
+                continue;
+            mWriter->setLayerStaticMetadata(i, info.dataspace, info.min_luminance, info.max_luminance);
+            mWriter->setLayerImageInfo(i, info.pixfmt, info.alpha_premult);
+            mWriter->setLayerOpaqueData(i, info.data, info.len);
+        }
+        mWriter->setTargetInfo(mTarget.dataspace, mTarget.data);
+        mWriter->setTargetDisplayLuminance(mTarget.min_luminance, mTarget.max_luminance);
+
+        g2d_commandlist *cmds = mWriter->getCommands();
+
+        mCacheValid = false;
+        if (!cmds)
+            return;
+
+        mCachedHdrMode.assign(cmds->layer_hdr_mode, cmds->layer_hdr_mode + cmds->layer_count);
+        mCachedCommands.assign(cmds->commands, cmds->commands + cmds->command_count);
+        mWriter->putCommands(cmds);
+
+        mCachedCmds.layer_hdr_mode = mCachedHdrMode.data();
+        mCachedCmds.commands = mCachedCommands.data();
+        mCachedCmds.layer_count = mCachedHdrMode.size();
+        mCachedCmds.command_count = mCachedCommands.size();
+
+        mCachedLayers = mLayers;
+        mCachedTarget = mTarget;
+        mCacheValid = true;
+    }
 public:
     G2DHdrWriter() {
 #ifdef LIBACRYL_G2D_HDR_PLUGIN
@@ -43,26 +140,47 @@ public:
         putCommands();
     }
 
+    void resetLayers() {
+        mLayers.clear();
+    }
+
     bool setLayerStaticMetadata(int layer_index, int dataspace, unsigned int min_luminance, unsigned int max_luminance) {
-        return mWriter ? mWriter->setLayerStaticMetadata(layer_index, dataspace, min_luminance, max_luminance) : true;
+        if (mWriter) {
+            LayerInfo &info = layerInfo(layer_index);
+            info.dataspace = dataspace;
+            info.min_luminance = min_luminance;
+            info.max_luminance = max_luminance;
+        }
+        return true;
     }
 
     bool setLayerImageInfo(int layer_index, unsigned int pixfmt, bool alpha_premult) {
-        return mWriter ? mWriter->setLayerImageInfo(layer_index, pixfmt, alpha_premult) : true;
+        if (mWriter) {
+            LayerInfo &info = layerInfo(layer_index);
+            info.pixfmt = pixfmt;
+            info.alpha_premult = alpha_premult;
+        }
+        return true;
     }
 
     void setLayerOpaqueData(int layer_index, void *data, size_t len) {
-        if (mWriter)
-            mWriter->setLayerOpaqueData(layer_index, data, len);
+        if (mWriter) {
+            LayerInfo &info = layerInfo(layer_index);
+            info.data = data;
+            info.len = data ? len : 0;
+            info.data_hash = data ? hashData(data, len) : 0;
+        }
     }
 
     bool setTargetInfo(int dataspace, void *data) {
-        return mWriter ? mWriter->setTargetInfo(dataspace, data) : true;
+        mTarget.dataspace = dataspace;
+        mTarget.data = data;
+        return true;
     }
 
     void setTargetDisplayLuminance(unsigned int min, unsigned int max) {
-        if (mWriter)
-		mWriter->setTargetDisplayLuminance(min, max);
+        mTarget.min_luminance = min;
+        mTarget.max_luminance = max;
     }
 
     void getLayerHdrMode(g2d_task &task) {
@@ -98,15 +216,18 @@ public:
     }
 
     void getCommands() {
-        if (!mCmds && mWriter)
-            mCmds = mWriter->getCommands();
+        if (mCmds || !mWriter)
+            return;
+
+        if (!mCacheValid || !(mTarget == mCachedTarget) || (mLayers != mCachedLayers))
+            generateCommands();
+
+        if (mCacheValid)
+            mCmds = &mCachedCmds;
     }
 
     void putCommands() {
-        if (mWriter && mCmds) {
-            mWriter->putCommands(mCmds);
-            mCmds = nullptr;
-        }
+        mCmds = nullptr;
     }
 };
 
@@ -118,8 +239,12 @@ public:
     virtual ~AcrylicCompositorG2D();
     virtual bool execute(int fence[], unsigned int num_fences);
     virtual bool execute(int *handle = NULL);
+    virtual bool execute(int fence[], unsigned int num_fences, int *handle);
     virtual bool waitExecution(int handle);
-    virtual unsigned int getLaptimeUSec() { return mTask.laptime_in_usec; }
+    virtual unsigned int getLaptimeUSec() { return mLaptimeUSec; }
+    virtual unsigned int getLaptimeUSec(int handle);
+    virtual bool getJobTiming(int handle, unsigned int *queue_usec, unsigned int *exec_usec);
+    virtual unsigned int getLaptimePercentileUSec(unsigned int percentile);
     /*
      * Return -1 on failure in configuring the give priority or the priority is invalid.
      * Return 0 when the priority is configured successfully without any side effect.
@@ -132,12 +257,21 @@ private:
     int ioctlG2D(void);
     bool executeG2D(int fence[], unsigned int num_fences, bool nonblocking);
     bool prepareImage(AcrylicCanvas &layer, struct g2d_layer &image, uint32_t cmd[], int index);
+    bool prepareImageBuffer(AcrylicCanvas &layer, struct g2d_layer &image, unsigned int num_bufs);
     bool prepareSource(AcrylicLayer &layer, struct g2d_layer &image, uint32_t cmd[], hw2d_coord_t target_size,
                        unsigned int index, unsigned int image_index);
     bool prepareSolidLayer(AcrylicCanvas &canvas, struct g2d_layer &image, uint32_t cmd[]);
     bool prepareSolidLayer(AcrylicLayer &layer, struct g2d_layer &image, uint32_t cmd[], hw2d_coord_t target_size, unsigned int index);
     bool reallocLayer(unsigned int layercount);
     unsigned int updateFilterCoefficients(unsigned int layercount, g2d_reg regs[]);
+    struct G2DJob;
+    G2DJob *findJob(int handle);
+    bool waitJob(G2DJob &job);
+    void reapJobs();
+    bool canReuseCommands(unsigned int layercount, bool hasBackground);
+    void storeCommandCache(unsigned int layercount, bool hasBackground);
+    bool isFillOnly();
+    void accountLaptime(unsigned int laptime, bool fillOnly);
 
     AcrylicDevice mDev;
     g2d_task	  mTask;
@@ -146,9 +280,74 @@ private:
     int mPriority;
     unsigned int mVersion;
     bool mUsePolyPhaseFilter;
+    unsigned int mLaptimeUSec;
+
+    /*
+     * Jobs of solid colors only, like clearing a region or dimming, skip CSC,
+     * HDR and filter coefficients. Their laptimes are accounted separately so
+     * that they do not hide the cost of the image compositions.
+     */
+    bool mLastFillOnly;
+    unsigned int mFillJobCount;
+    uint64_t mFillLaptimeUSec;
+    unsigned int mCompositionJobCount;
+    uint64_t mCompositionLaptimeUSec;
+
+    /* Execution times of the recent composition jobs for getLaptimePercentileUSec() */
+    enum { G2D_LAPTIME_HISTORY = 32 };
+    unsigned int mLaptimeHistory[G2D_LAPTIME_HISTORY];
+    unsigned int mLaptimeHistoryCount;
+    unsigned int mLaptimeHistoryIndex;
+
+    /*
+     * Encoded filter coefficient registers of each source slot. They are
+     * encoded again only when the coefficient sets chosen for the slot change.
+     */
+    struct FilterCoefCache {
+        uint32_t key; // coefficient set indices of the slot, 0 if nothing is encoded
+        std::vector<g2d_reg> regs;
+    };
+    std::vector<FilterCoefCache> mFilterCoefCache;
+
+    /*
+     * Jobs submitted by the asynchronous execute(). The driver copies the
+     * task on submission, so mTask is free for the next job right away.
+     * The kernel does not report the laptime of a non-blocking task, so it
+     * is measured from the signal time of the target release fence.
+     */
+    enum { G2D_MAX_INFLIGHT_JOBS = 4 };
+    struct G2DJob {
+        int handle;
+        int fence;          // target release fence, -1 once the job is waited
+        int64_t submitTime; // CLOCK_MONOTONIC in nsec
+        unsigned int queueDelay; // from the submission to the completion of the previous job
+        unsigned int laptime;
+        bool fillOnly;
+    };
+    G2DJob mJobs[G2D_MAX_INFLIGHT_JOBS];
+    unsigned int mNextJob;
+    int mNextJobHandle;
+    int64_t mLastSignalTime;
+
+    /*
+     * The commands of the last successful task. They are reused with only the
+     * buffer descriptors updated if nothing but the buffers are changed.
+     */
+    struct CachedSource {
+        AcrylicLayer *layer;
+        hw2d_rect_t imageRect;
+        hw2d_rect_t targetRect;
+        uint32_t transform;
+        uint32_t command; // G2DSFR_SRC_COMMAND before HDR mode is applied
+    };
+    bool mCommandCached;
+    unsigned int mCachedLayerCount;
+    bool mCachedBackground;
+    uint16_t mCachedBackgroundColor[4];
+    CachedSource mCachedSource[G2D_MAX_IMAGES];
 
     g2d_fmt *halfmt_to_g2dfmt_tbl;
-    size_t len_halfmt_to_g2dfmt_tbl;
+    const HalFormatIndex *index_halfmt_to_g2dfmt_tbl;
 };
 
 #endif //__HARDWARE_EXYNOS_HW2DCOMPOSITOR_G2D_H__
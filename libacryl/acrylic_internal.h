@@ -112,6 +112,57 @@ static inline bool area_is_zero(hw2d_rect_t rect)
     return (rect.size.hori == 0) && (rect.size.vert == 0);
 }
 
+/*
+ * Index of a table of HAL pixel formats for the lookup in a constant time.
+ * The formats are hashed to a slot with linear probing. The first entry of a
+ * format in the table is found like the linear search.
+ */
+class HalFormatIndex {
+public:
+    template <typename T, typename KeyFn>
+    HalFormatIndex(const T table[], size_t count, KeyFn key)
+    {
+        for (auto &slot : mSlots)
+            slot.index = -1;
+
+        LOGASSERT(count < NUM_SLOTS / 2, "Too many HAL formats %zu to index", count);
+
+        for (size_t i = 0; (i < count) && (i < NUM_SLOTS / 2); i++) {
+            uint32_t fmt = key(table[i]);
+            unsigned int s = hash(fmt);
+
+            while ((mSlots[s].index >= 0) && (mSlots[s].fmt != fmt))
+                s = (s + 1) % NUM_SLOTS;
+
+            if (mSlots[s].index < 0) {
+                mSlots[s].fmt = fmt;
+                mSlots[s].index = static_cast<int>(i);
+            }
+        }
+    }
+
+    // Return the index of @fmt in the table or -1 if @fmt is not found
+    int find(uint32_t fmt) const
+    {
+        for (unsigned int s = hash(fmt); mSlots[s].index >= 0; s = (s + 1) % NUM_SLOTS) {
+            if (mSlots[s].fmt == fmt)
+                return mSlots[s].index;
+        }
+
+        return -1;
+    }
+
+private:
+    static const unsigned int NUM_SLOTS = 128;
+
+    static unsigned int hash(uint32_t fmt) { return (fmt * 2654435761U) >> 25; }
+
+    struct {
+        uint32_t fmt;
+        int index;
+    } mSlots[NUM_SLOTS];
+};
+
 uint32_t halfmt_to_v4l2(uint32_t halfmt);
 uint32_t halfmt_to_v4l2_deprecated(uint32_t halfmt);
 unsigned int halfmt_buf_count(uint32_t fmt);
@@ -24,10 +24,14 @@
 
 AcrylicCanvas::AcrylicCanvas(Acrylic *compositor, canvas_type_t type)
     : mCompositor(compositor), mPixFormat(0), mNumBuffers(0), mFence(-1), mAttributes(ATTR_NONE),
-      mSettingFlags(0), mCanvasType(type)
+      mSettingFlags(0), mSolidColor(0), mCanvasType(type)
 {
     // Initialize the image size to the possible smallest size
     mImageDimension = compositor->getCapabilities().supportedMinSrcDimension();
+
+    for (auto &entry: mValidatedBuffers)
+        entry.num_buffers = 0;
+    mNextValidatedBuffer = 0;
 }
 
 AcrylicCanvas::~AcrylicCanvas()
@@ -110,11 +114,14 @@ bool AcrylicCanvas::setImageBuffer(int a, int r, int g, int b, uint32_t attr)
     mMemoryType = MT_EMPTY;
     mNumBuffers = 0;
 
-    mAttributes = (attr & ATTR_ALL_MASK) | ATTR_SOLIDCOLOR;
+    setAttributes((attr & ATTR_ALL_MASK) | ATTR_SOLIDCOLOR);
 
     set(SETTING_BUFFER | SETTING_BUFFER_MODIFIED);
 
-    mSolidColor  = ((a & 0xFF) << 24) | ((r & 0xFF) << 16) | ((g & 0xFF) << 8) | ((b & 0xFF));
+    uint32_t color = ((a & 0xFF) << 24) | ((r & 0xFF) << 16) | ((g & 0xFF) << 8) | ((b & 0xFF));
+    if (mSolidColor != color)
+        set(SETTING_COMPOSIT_MODIFIED);
+    mSolidColor = color;
 
     return true;
 }
@@ -130,25 +137,29 @@ bool AcrylicCanvas::setImageBuffer(int fd[MAX_HW2D_PLANES], size_t len[MAX_HW2D_
         return false;
     }
 
-    const HW2DCapability &cap = getCompositor()->getCapabilities();
-    unsigned long alignmask = static_cast<unsigned long>(cap.supportedBaseAlign()) - 1;
-
     if (num_buffers > MAX_HW2D_PLANES) {
         ALOGE("Too many buffers %d are set passed to setImageBuffer(dmabuf)", num_buffers);
         return false;
     }
 
-    for (int i = 0; i < num_buffers; i++) {
-        if ((offset[i] < 0) || (static_cast<size_t>(offset[i]) >= len[i])) {
-            ALOGE("Too large offset %ld for length %zu of buffer[%d]", offset[i], len[i], i);
-            return false;
+    if (!isValidatedBuffer(fd, len, offset, num_buffers)) {
+        const HW2DCapability &cap = getCompositor()->getCapabilities();
+        unsigned long alignmask = static_cast<unsigned long>(cap.supportedBaseAlign()) - 1;
+
+        for (int i = 0; i < num_buffers; i++) {
+            if ((offset[i] < 0) || (static_cast<size_t>(offset[i]) >= len[i])) {
+                ALOGE("Too large offset %ld for length %zu of buffer[%d]", offset[i], len[i], i);
+                return false;
+            }
+
+            if ((offset[i] & alignmask) != 0) {
+                ALOGE("Alignment of offset %#lx of buffer[%d] violates the alignment of %#lx",
+                        offset[i], i, alignmask + 1);
+                return false;
+            }
         }
 
-        if ((offset[i] & alignmask) != 0) {
-            ALOGE("Alignment of offset %#lx of buffer[%d] violates the alignment of %#lx",
-                    offset[i], i, alignmask + 1);
-            return false;
-        }
+        addValidatedBuffer(fd, len, offset, num_buffers);
     }
 
     for (int i = 0; i < num_buffers; i++) {
@@ -167,7 +178,7 @@ bool AcrylicCanvas::setImageBuffer(int fd[MAX_HW2D_PLANES], size_t len[MAX_HW2D_
     mMemoryType = MT_DMABUF;
     mNumBuffers = num_buffers;
 
-    mAttributes = attr & ATTR_ALL_MASK;
+    setAttributes(attr & ATTR_ALL_MASK);
     ALOGD_TEST("Configured buffer: fence %d, type %d, count %d, attr %#x (type: %s)",
                mFence, mMemoryType, mNumBuffers, mAttributes, canvasTypeName(mCanvasType));
 
@@ -176,6 +187,41 @@ bool AcrylicCanvas::setImageBuffer(int fd[MAX_HW2D_PLANES], size_t len[MAX_HW2D_
     return true;
 }
 
+bool AcrylicCanvas::isValidatedBuffer(int fd[MAX_HW2D_PLANES], size_t len[MAX_HW2D_PLANES],
+                                      off_t offset[MAX_HW2D_PLANES], int num_buffers)
+{
+    for (auto &entry: mValidatedBuffers) {
+        if (entry.num_buffers != num_buffers)
+            continue;
+
+        int i;
+        for (i = 0; i < num_buffers; i++) {
+            if ((entry.fd[i] != fd[i]) || (entry.len[i] != len[i]) || (entry.offset[i] != offset[i]))
+                break;
+        }
+
+        if (i == num_buffers)
+            return true;
+    }
+
+    return false;
+}
+
+void AcrylicCanvas::addValidatedBuffer(int fd[MAX_HW2D_PLANES], size_t len[MAX_HW2D_PLANES],
+                                       off_t offset[MAX_HW2D_PLANES], int num_buffers)
+{
+    ValidatedBuffer &entry = mValidatedBuffers[mNextValidatedBuffer];
+
+    for (int i = 0; i < num_buffers; i++) {
+        entry.fd[i] = fd[i];
+        entry.len[i] = len[i];
+        entry.offset[i] = offset[i];
+    }
+    entry.num_buffers = num_buffers;
+
+    mNextValidatedBuffer = (mNextValidatedBuffer + 1) % NUM_VALIDATED_BUFFERS;
+}
+
 bool AcrylicCanvas::setImageBuffer(void *addr[MAX_HW2D_PLANES], size_t len[MAX_HW2D_PLANES],
                                    int num_buffers, uint32_t attr)
 {
@@ -219,7 +265,7 @@ bool AcrylicCanvas::setImageBuffer(void *addr[MAX_HW2D_PLANES], size_t len[MAX_H
     mMemoryType = MT_USERPTR;
     mNumBuffers = num_buffers;
 
-    mAttributes = attr & ATTR_ALL_MASK;
+    setAttributes(attr & ATTR_ALL_MASK);
 
     ALOGD_TEST("Configured buffer: fence %d, type %d, count %d, attr %#x (type: %s)",
                mFence, mMemoryType, mNumBuffers, mAttributes, canvasTypeName(mCanvasType));
@@ -248,7 +294,7 @@ bool AcrylicCanvas::setImageOTFBuffer(uint32_t attr)
     mMemoryType = MT_EMPTY;
     mNumBuffers = 0;
 
-    mAttributes = (attr & ATTR_ALL_MASK) | ATTR_OTF;
+    setAttributes((attr & ATTR_ALL_MASK) | ATTR_OTF);
 
     set(SETTING_BUFFER | SETTING_BUFFER_MODIFIED);
 
@@ -357,11 +403,18 @@ bool AcrylicLayer::setCompositMode(uint32_t mode, uint8_t alpha, int z_order)
         return false;
     }
 
+    if ((mBlendingMode != mode) || (mZOrder != z_order) || (mPlaneAlpha != alpha))
+        set(SETTING_COMPOSIT_MODIFIED);
+
     mBlendingMode = mode;
 
+    bool reordered = (mZOrder != z_order);
     mZOrder = z_order;
     mPlaneAlpha = alpha;
 
+    if (reordered && getCompositor())
+        getCompositor()->reorderLayer(this);
+
     ALOGD_TEST("Configured compositing mode: mode %d, z-order %d, alpha %d",
                mBlendingMode, mZOrder, mPlaneAlpha);
 
@@ -20,30 +20,16 @@
 
 #include "acrylic_internal.h"
 
-AcrylicPerformanceRequest::AcrylicPerformanceRequest()
-    : mNumFrames(0), mNumAllocFrames(0), mFrames(NULL)
+AcrylicPerformanceRequest::AcrylicPerformanceRequest() : mNumFrames(0)
 {
 }
 
-AcrylicPerformanceRequest::~AcrylicPerformanceRequest()
-{
-    delete [] mFrames;
-}
-
 bool AcrylicPerformanceRequest::reset(int num_frames)
 {
-    if (num_frames == 0) {
-        delete [] mFrames;
-        mFrames = NULL;
-    } else if (num_frames > mNumAllocFrames) {
-        delete [] mFrames;
-        mFrames = new AcrylicPerformanceRequestFrame[num_frames];
-        if (mFrames == NULL) {
-            ALOGE("Failed to allocate PerformanceRequestFrame[%d]", num_frames);
-            return false;
-        }
-
-        mNumAllocFrames = num_frames;
+    if ((num_frames < 0) || (num_frames > ACRYLIC_PERF_MAX_FRAMES)) {
+        ALOGE("Too many PerformanceRequestFrames %d (max %d)", num_frames, ACRYLIC_PERF_MAX_FRAMES);
+        mNumFrames = 0;
+        return false;
     }
 
     mNumFrames = num_frames;
@@ -52,32 +38,23 @@ bool AcrylicPerformanceRequest::reset(int num_frames)
 }
 
 AcrylicPerformanceRequestFrame::AcrylicPerformanceRequestFrame()
-    : mNumLayers(0), mNumAllocLayers(0), mFrameRate(60),
-      mHasBackgroundLayer(false), mLayers(NULL)
-{
-}
-
-
-AcrylicPerformanceRequestFrame::~AcrylicPerformanceRequestFrame()
+    : mNumLayers(0), mFrameRate(60), mTargetPixFormat(0), mTargetDimension{0, 0},
+      mHasBackgroundLayer(false)
 {
-    delete [] mLayers;
 }
 
 bool AcrylicPerformanceRequestFrame::reset(int num_layers)
 {
-    if (num_layers == 0) {
-        delete [] mLayers;
-        mLayers = NULL;
-    } else if (num_layers > mNumAllocLayers) {
-        mLayers = new AcrylicPerformanceRequestLayer[num_layers];
-        if (mLayers == NULL) {
-            ALOGE("Failed to allocate PerformanceRequestLayer[%d]", num_layers);
-            return false;
-        }
-
-        mNumAllocLayers = num_layers;
+    if ((num_layers < 0) || (num_layers > ACRYLIC_PERF_MAX_LAYERS)) {
+        ALOGE("Too many PerformanceRequestLayers %d (max %d)", num_layers, ACRYLIC_PERF_MAX_LAYERS);
+        mNumLayers = 0;
+        return false;
     }
 
+    // Attributes are only set when they are present
+    for (int i = 0; i < num_layers; i++)
+        mLayers[i].mAttribute = 0;
+
     mNumLayers = num_layers;
 
     return true;
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "acrylic_sw.h"
+
+#include <exynos_format.h> // hardware/smasung_slsi/exynos/include
+#include <hardware/hwcomposer2.h>
+#include <linux/dma-buf.h>
+#include <log/log.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <system/graphics.h>
+#include <utils/Timers.h>
+#include <utils/Trace.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <cstring>
+
+#define SW_FENCE_TIMEOUT_MS 1000
+
+AcrylicCompositorSW::AcrylicCompositorSW(const HW2DCapability &capability)
+    : Acrylic(capability), mLaptimeUSec(0)
+{
+    ALOGD_TEST("Created a new Acrylic for software composition on %p", this);
+}
+
+AcrylicCompositorSW::~AcrylicCompositorSW()
+{
+    ALOGD_TEST("Deleting Acrylic for software composition on %p", this);
+}
+
+static bool isSupportedTargetFormat(uint32_t fmt)
+{
+    return (fmt == HAL_PIXEL_FORMAT_RGBA_8888) || (fmt == HAL_PIXEL_FORMAT_RGBX_8888);
+}
+
+static bool isNV12(uint32_t fmt)
+{
+    return (fmt == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP) ||
+           (fmt == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M);
+}
+
+static bool isPremultiplied(uint32_t mode)
+{
+    return (mode == HWC_BLENDING_PREMULT) || (mode == HWC2_BLEND_MODE_PREMULTIPLIED);
+}
+
+static bool isCoverage(uint32_t mode)
+{
+    return (mode == HWC_BLENDING_COVERAGE) || (mode == HWC2_BLEND_MODE_COVERAGE);
+}
+
+bool AcrylicCompositorSW::validateLayers()
+{
+    if (!validateAllLayers())
+        return false;
+
+    AcrylicCanvas &canvas = getCanvas();
+
+    if (!isSupportedTargetFormat(canvas.getFormat()) || canvas.isCompressed() ||
+            canvas.isOTF() || canvas.isProtected()) {
+        ALOGE("Unsupported target image of format %#x, attributes %#x", canvas.getFormat(),
+              canvas.isCompressed() | (canvas.isOTF() << 1) | (canvas.isProtected() << 2));
+        return false;
+    }
+
+    if (layerCount() > getCapabilities().maxLayerCount()) {
+        ALOGE("Too many layers %u (max %u)", layerCount(), getCapabilities().maxLayerCount());
+        return false;
+    }
+
+    for (unsigned int i = 0; i < layerCount(); i++) {
+        AcrylicLayer *layer = getLayer(i);
+
+        if (!!(layer->getTransform() & HAL_TRANSFORM_ROT_90)) {
+            ALOGE("Rotation of layer %u is not supported", i);
+            return false;
+        }
+
+        if (layer->isSolidColor())
+            continue;
+
+        if (!getCapabilities().isFormatSupported(layer->getFormat())) {
+            ALOGE("Unsupported format %#x of layer %u", layer->getFormat(), i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool AcrylicCompositorSW::waitFence(AcrylicCanvas &canvas)
+{
+    int fence = canvas.getFence();
+
+    if (fence < 0)
+        return true;
+
+    struct pollfd fds = {fence, POLLIN, 0};
+    int ret = poll(&fds, 1, SW_FENCE_TIMEOUT_MS);
+    if (ret <= 0) {
+        if (ret == 0)
+            ALOGE("Timed out waiting for fence %d", fence);
+        else
+            ALOGERR("Failed to wait for fence %d", fence);
+        return false;
+    }
+
+    canvas.setFence(-1);
+
+    return true;
+}
+
+static void syncDmabuf(int fd, bool write, bool start)
+{
+    struct dma_buf_sync sync;
+
+    sync.flags = start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END;
+    sync.flags |= write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ;
+
+    if (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+        ALOGERR("Failed to sync dmabuf %d", fd);
+}
+
+bool AcrylicCompositorSW::mapImage(AcrylicCanvas &canvas, MappedImage &image, bool write)
+{
+    memset(&image, 0, sizeof(image));
+
+    image.num_buffers = canvas.getBufferCount();
+    image.stride = canvas.getImageDimension().hori;
+
+    for (unsigned int i = 0; i < image.num_buffers; i++) {
+        image.fd[i] = -1;
+
+        if (canvas.getBufferType() == AcrylicCanvas::MT_USERPTR) {
+            image.plane[i] = static_cast<uint8_t *>(canvas.getUserptr(i));
+            continue;
+        }
+
+        if (canvas.getBufferType() != AcrylicCanvas::MT_DMABUF) {
+            ALOGE("Unsupported buffer type %d", canvas.getBufferType());
+            unmapImage(image, write);
+            return false;
+        }
+
+        image.len[i] = canvas.getBufferLength(i) + canvas.getOffset(i);
+        image.addr[i] = mmap(NULL, image.len[i], write ? PROT_READ | PROT_WRITE : PROT_READ,
+                             MAP_SHARED, canvas.getDmabuf(i), 0);
+        if (image.addr[i] == MAP_FAILED) {
+            ALOGERR("Failed to map buffer %u (fd %d, len %zu)", i, canvas.getDmabuf(i), image.len[i]);
+            image.addr[i] = NULL;
+            unmapImage(image, write);
+            return false;
+        }
+
+        image.fd[i] = canvas.getDmabuf(i);
+        image.plane[i] = static_cast<uint8_t *>(image.addr[i]) + canvas.getOffset(i);
+        syncDmabuf(image.fd[i], write, true);
+    }
+
+    // The chroma of single buffer NV12 follows the luma without padding
+    if (isNV12(canvas.getFormat()) && (image.num_buffers == 1)) {
+        hw2d_coord_t xy = canvas.getImageDimension();
+        image.plane[1] = image.plane[0] + xy.hori * xy.vert;
+    }
+
+    return true;
+}
+
+void AcrylicCompositorSW::unmapImage(MappedImage &image, bool write)
+{
+    for (unsigned int i = 0; i < image.num_buffers; i++) {
+        if (!image.addr[i])
+            continue;
+
+        syncDmabuf(image.fd[i], write, false);
+        munmap(image.addr[i], image.len[i]);
+        image.addr[i] = NULL;
+    }
+}
+
+// (a * b) / 255 with rounding
+static inline uint32_t mul255(uint32_t a, uint32_t b)
+{
+    uint32_t t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t packRGBA(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+static inline uint32_t clamp255(int32_t v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+struct YCbCrCoefficients {
+    int32_t y, y_offset, cr_r, cb_g, cr_g, cb_b; // in 8-bit fraction
+};
+
+static const YCbCrCoefficients *getYCbCrCoefficients(int dataspace)
+{
+    static const YCbCrCoefficients bt601_limited = {298, 16, 409, 100, 208, 516};
+    static const YCbCrCoefficients bt601_full = {256, 0, 359, 88, 183, 454};
+    static const YCbCrCoefficients bt709_limited = {298, 16, 459, 55, 136, 541};
+    static const YCbCrCoefficients bt709_full = {256, 0, 403, 48, 120, 475};
+
+    // Depricated legacy dataspace definitions
+    if (dataspace == HAL_DATASPACE_JFIF)
+        return &bt601_full;
+    if ((dataspace == HAL_DATASPACE_BT601_525) || (dataspace == HAL_DATASPACE_BT601_625))
+        return &bt601_limited;
+
+    bool full = (dataspace & HAL_DATASPACE_RANGE_MASK) == HAL_DATASPACE_RANGE_FULL;
+    int standard = dataspace & HAL_DATASPACE_STANDARD_MASK;
+
+    // Unspecified standard should be treated as BT709
+    if ((standard == HAL_DATASPACE_STANDARD_BT709) || (standard == HAL_DATASPACE_STANDARD_UNSPECIFIED))
+        return full ? &bt709_full : &bt709_limited;
+
+    return full ? &bt601_full : &bt601_limited;
+}
+
+void AcrylicCompositorSW::fetchRow(AcrylicLayer &layer, MappedImage &image, uint32_t y, uint32_t row[])
+{
+    uint32_t fmt = layer.getFormat();
+    size_t width = mColumns.size();
+
+    if (layer.isSolidColor()) {
+        uint32_t color = layer.getSolidColor();
+        uint32_t pixel = packRGBA((color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF,
+                                  color >> 24);
+        for (size_t x = 0; x < width; x++)
+            row[x] = pixel;
+    } else if ((fmt == HAL_PIXEL_FORMAT_RGBA_8888) || (fmt == HAL_PIXEL_FORMAT_RGBX_8888)) {
+        const uint32_t *src = reinterpret_cast<uint32_t *>(image.plane[0]) + y * image.stride;
+        uint32_t opaque = (fmt == HAL_PIXEL_FORMAT_RGBX_8888) ? 0xFF000000 : 0;
+        for (size_t x = 0; x < width; x++)
+            row[x] = src[mColumns[x]] | opaque;
+    } else if (fmt == HAL_PIXEL_FORMAT_BGRA_8888) {
+        const uint32_t *src = reinterpret_cast<uint32_t *>(image.plane[0]) + y * image.stride;
+        for (size_t x = 0; x < width; x++) {
+            uint32_t p = src[mColumns[x]];
+            row[x] = (p & 0xFF00FF00) | ((p >> 16) & 0xFF) | ((p & 0xFF) << 16);
+        }
+    } else if (fmt == HAL_PIXEL_FORMAT_RGB_565) {
+        const uint16_t *src = reinterpret_cast<uint16_t *>(image.plane[0]) + y * image.stride;
+        for (size_t x = 0; x < width; x++) {
+            uint32_t p = src[mColumns[x]];
+            uint32_t r = (p >> 11) & 0x1F, g = (p >> 5) & 0x3F, b = p & 0x1F;
+            row[x] = packRGBA((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 0xFF);
+        }
+    } else { // NV12
+        const YCbCrCoefficients *coef = getYCbCrCoefficients(layer.getDataspace());
+        const uint8_t *luma = image.plane[0] + y * image.stride;
+        const uint8_t *chroma = image.plane[1] + (y / 2) * image.stride;
+        for (size_t x = 0; x < width; x++) {
+            uint32_t sx = mColumns[x];
+            int32_t l = coef->y * (luma[sx] - coef->y_offset) + 128;
+            int32_t cb = chroma[sx & ~1] - 128;
+            int32_t cr = chroma[sx | 1] - 128;
+            row[x] = packRGBA(clamp255((l + coef->cr_r * cr) >> 8),
+                              clamp255((l - coef->cb_g * cb - coef->cr_g * cr) >> 8),
+                              clamp255((l + coef->cb_b * cb) >> 8), 0xFF);
+        }
+    }
+
+    uint32_t mode = layer.getCompositingMode();
+    uint32_t plane_alpha = layer.getPlaneAlpha();
+
+    if (isCoverage(mode)) {
+        for (size_t x = 0; x < width; x++) {
+            uint32_t a = mul255(row[x] >> 24, plane_alpha);
+            row[x] = packRGBA(mul255(row[x] & 0xFF, a), mul255((row[x] >> 8) & 0xFF, a),
+                              mul255((row[x] >> 16) & 0xFF, a), a);
+        }
+    } else if (isPremultiplied(mode) && (plane_alpha != 0xFF)) {
+        for (size_t x = 0; x < width; x++)
+            row[x] = packRGBA(mul255(row[x] & 0xFF, plane_alpha),
+                              mul255((row[x] >> 8) & 0xFF, plane_alpha),
+                              mul255((row[x] >> 16) & 0xFF, plane_alpha),
+                              mul255(row[x] >> 24, plane_alpha));
+    }
+}
+
+// dst = src + dst * (1 - src alpha) on premultiplied RGBA8888 pixels
+static void blendRow(uint32_t *dst, const uint32_t *src, size_t width)
+{
+    size_t x = 0;
+
+#ifdef __ARM_NEON
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t *>(src + x));
+        uint8x8x4_t d = vld4_u8(reinterpret_cast<uint8_t *>(dst + x));
+        uint8x8_t inv_alpha = vmvn_u8(s.val[3]);
+
+        for (int c = 0; c < 4; c++) {
+            uint16x8_t t = vmull_u8(d.val[c], inv_alpha);
+            d.val[c] = vqadd_u8(s.val[c], vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8));
+        }
+
+        vst4_u8(reinterpret_cast<uint8_t *>(dst + x), d);
+    }
+#endif
+
+    for (; x < width; x++) {
+        uint32_t s = src[x], d = dst[x];
+        uint32_t inv_alpha = 255 - (s >> 24);
+        uint32_t out = 0;
+
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t c = ((s >> shift) & 0xFF) + mul255((d >> shift) & 0xFF, inv_alpha);
+            out |= ((c > 255) ? 255 : c) << shift;
+        }
+
+        dst[x] = out;
+    }
+}
+
+void AcrylicCompositorSW::fillTarget(MappedImage &target)
+{
+    uint16_t r, g, b, a;
+    getBackgroundColor(&r, &g, &b, &a);
+
+    uint32_t pixel = packRGBA(r >> 8, g >> 8, b >> 8, a >> 8);
+    hw2d_coord_t xy = getCanvas().getImageDimension();
+
+    for (int32_t y = 0; y < xy.vert; y++) {
+        uint32_t *dst = reinterpret_cast<uint32_t *>(target.plane[0]) + y * target.stride;
+        for (int32_t x = 0; x < xy.hori; x++)
+            dst[x] = pixel;
+    }
+}
+
+void AcrylicCompositorSW::composeLayer(AcrylicLayer &layer, MappedImage &image, MappedImage &target)
+{
+    hw2d_rect_t ir = layer.getImageRect();
+    hw2d_rect_t tr = layer.getTargetRect();
+    uint32_t transform = layer.getTransform();
+
+    if (area_is_zero(tr)) {
+        tr.pos = {0, 0};
+        tr.size = getCanvas().getImageDimension();
+    }
+
+    // Nearest sampling at the center of each target pixel
+    mColumns.resize(tr.size.hori);
+    for (int32_t x = 0; x < tr.size.hori; x++) {
+        int32_t sx = ((2 * x + 1) * ir.size.hori) / (2 * tr.size.hori);
+        if (!!(transform & HAL_TRANSFORM_FLIP_H))
+            sx = ir.size.hori - 1 - sx;
+        mColumns[x] = ir.pos.hori + sx;
+    }
+
+    mRow.resize(tr.size.hori);
+
+    bool copy = !isPremultiplied(layer.getCompositingMode()) &&
+                !isCoverage(layer.getCompositingMode());
+
+    for (int32_t y = 0; y < tr.size.vert; y++) {
+        int32_t sy = ((2 * y + 1) * ir.size.vert) / (2 * tr.size.vert);
+        if (!!(transform & HAL_TRANSFORM_FLIP_V))
+            sy = ir.size.vert - 1 - sy;
+
+        uint32_t *dst = reinterpret_cast<uint32_t *>(target.plane[0]) +
+                        (tr.pos.vert + y) * target.stride + tr.pos.hori;
+
+        if (copy) {
+            fetchRow(layer, image, ir.pos.vert + sy, dst);
+        } else {
+            fetchRow(layer, image, ir.pos.vert + sy, mRow.data());
+            blendRow(dst, mRow.data(), mRow.size());
+        }
+    }
+}
+
+bool AcrylicCompositorSW::executeSW()
+{
+    ATRACE_CALL();
+
+    if (!validateLayers())
+        return false;
+
+    sortLayers();
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    if (!waitFence(getCanvas()))
+        return false;
+
+    for (unsigned int i = 0; i < layerCount(); i++) {
+        if (!waitFence(*getLayer(i)))
+            return false;
+    }
+
+    MappedImage target;
+    if (!mapImage(getCanvas(), target, true))
+        return false;
+
+    if (hasBackgroundColor())
+        fillTarget(target);
+
+    bool success = true;
+
+    for (unsigned int i = 0; i < layerCount(); i++) {
+        AcrylicLayer *layer = getLayer(i);
+        MappedImage image;
+
+        if (layer->isSolidColor()) {
+            memset(&image, 0, sizeof(image));
+        } else if (!mapImage(*layer, image, false)) {
+            ALOGE("Failed to map the image of layer %u", i);
+            success = false;
+            break;
+        }
+
+        composeLayer(*layer, image, target);
+
+        unmapImage(image, false);
+    }
+
+    unmapImage(target, true);
+
+    if (!success)
+        return false;
+
+    mLaptimeUSec = static_cast<unsigned int>((systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1000);
+
+    getCanvas().clearSettingModified();
+    for (unsigned int i = 0; i < layerCount(); i++)
+        getLayer(i)->clearSettingModified();
+
+    return true;
+}
+
+bool AcrylicCompositorSW::execute(int fence[], unsigned int num_fences)
+{
+    bool success = executeSW();
+
+    // The images are ready to be reused when the composition returns
+    for (unsigned int i = 0; i < num_fences; i++)
+        fence[i] = -1;
+
+    if (!success) {
+        for (unsigned int i = 0; i < layerCount(); i++)
+            getLayer(i)->setFence(-1);
+        getCanvas().setFence(-1);
+    }
+
+    return success;
+}
+
+bool AcrylicCompositorSW::execute(int *handle)
+{
+    if (handle != NULL)
+        *handle = -1;
+
+    return execute(NULL, 0);
+}
+
+bool AcrylicCompositorSW::waitExecution(int __unused handle)
+{
+    // The composition is always complete when execute() returns
+    return true;
+}
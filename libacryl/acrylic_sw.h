@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HARDWARE_EXYNOS_HW2DCOMPOSITOR_SW_H__
+#define __HARDWARE_EXYNOS_HW2DCOMPOSITOR_SW_H__
+
+#include <vector>
+
+#include <hardware/exynos/acryl.h>
+
+#include "acrylic_internal.h"
+
+/*
+ * Compositor on the CPU for the simple cases that are cheaper to compose than
+ * waking the GPU up when G2D is not available: no rotation, nearest sampling,
+ * RGB and NV12 sources and RGBA8888 targets. It composes in the caller's context
+ * so all the release fences it returns are -1.
+ */
+class AcrylicCompositorSW: public Acrylic {
+public:
+    AcrylicCompositorSW(const HW2DCapability &capability);
+    virtual ~AcrylicCompositorSW();
+    virtual bool execute(int fence[], unsigned int num_fences);
+    virtual bool execute(int *handle = NULL);
+    virtual bool waitExecution(int handle);
+    virtual unsigned int getLaptimeUSec() { return mLaptimeUSec; }
+private:
+    struct MappedImage {
+        uint8_t *plane[MAX_HW2D_PLANES];
+        void *addr[MAX_HW2D_PLANES];
+        size_t len[MAX_HW2D_PLANES];
+        int fd[MAX_HW2D_PLANES];
+        unsigned int num_buffers;
+        uint32_t stride; // in pixels
+    };
+
+    bool executeSW();
+    bool validateLayers();
+    bool waitFence(AcrylicCanvas &canvas);
+    bool mapImage(AcrylicCanvas &canvas, MappedImage &image, bool write);
+    void unmapImage(MappedImage &image, bool write);
+    void fillTarget(MappedImage &target);
+    void composeLayer(AcrylicLayer &layer, MappedImage &image, MappedImage &target);
+    void fetchRow(AcrylicLayer &layer, MappedImage &image, uint32_t y, uint32_t row[]);
+
+    // source x coordinates of each pixel in the target area of a layer
+    std::vector<uint32_t> mColumns;
+    // premultiplied RGBA8888 pixels of a layer on a target row
+    std::vector<uint32_t> mRow;
+    unsigned int mLaptimeUSec;
+};
+
+#endif //__HARDWARE_EXYNOS_HW2DCOMPOSITOR_SW_H__
@@ -471,6 +471,8 @@ public:
      *                            it is not applied to HW yet.
      * - SETTING_DIMENSION_MODIFIED: Image dimension information is configured by users
      *                               and it is not applied to HW yet.
+     * - SETTING_COMPOSIT_MODIFIED: Compositing mode, solid color or buffer attributes are
+     *                              changed and they are not applied to HW yet.
      */
     enum setting_check_t {
         SETTING_TYPE = 1,
@@ -480,7 +482,9 @@ public:
         SETTING_TYPE_MODIFIED = 16,
         SETTING_BUFFER_MODIFIED = 32,
         SETTING_DIMENSION_MODIFIED = 64,
-        SETTIMG_MODIFIED_MASK = SETTING_TYPE_MODIFIED | SETTING_BUFFER_MODIFIED | SETTING_DIMENSION_MODIFIED,
+        SETTING_COMPOSIT_MODIFIED = 128,
+        SETTIMG_MODIFIED_MASK = SETTING_TYPE_MODIFIED | SETTING_BUFFER_MODIFIED |
+                                SETTING_DIMENSION_MODIFIED | SETTING_COMPOSIT_MODIFIED,
     };
 
     /*
@@ -648,7 +652,8 @@ public:
     {
         unset(SETTING_TYPE_MODIFIED |
               SETTING_BUFFER_MODIFIED |
-              SETTING_DIMENSION_MODIFIED);
+              SETTING_DIMENSION_MODIFIED |
+              SETTING_COMPOSIT_MODIFIED);
     }
     /*
      * Obtain the flags that indicates the configuration status
@@ -674,12 +679,40 @@ protected:
     void unset(uint32_t flag) { mSettingFlags &= ~flag; }
     void set(uint32_t flag) { mSettingFlags |= flag; }
 private:
+    /*
+     * Buffer attributes like compression change the commands to HW while
+     * the other buffer information does not.
+     */
+    void setAttributes(uint32_t attr)
+    {
+        if (mAttributes != attr)
+            set(SETTING_COMPOSIT_MODIFIED);
+        mAttributes = attr;
+    }
+
     /*
      * called when Acrylic is being destroyed to inform AcrylicCanvas
      * that no Acrylic has a reference to it.
      */
     void disconnectLayer() { mCompositor = NULL; }
 
+    /*
+     * The dmabuf configurations that passed the validation of setImageBuffer().
+     * Users like HWC repeat a few buffers of a swapchain in the steady state.
+     */
+    static const int NUM_VALIDATED_BUFFERS = 4;
+    struct ValidatedBuffer {
+        int num_buffers; // 0 if the entry is empty
+        int fd[MAX_HW2D_PLANES];
+        size_t len[MAX_HW2D_PLANES];
+        off_t offset[MAX_HW2D_PLANES];
+    } mValidatedBuffers[NUM_VALIDATED_BUFFERS];
+    int mNextValidatedBuffer;
+    bool isValidatedBuffer(int fd[MAX_HW2D_PLANES], size_t len[MAX_HW2D_PLANES],
+                           off_t offset[MAX_HW2D_PLANES], int num_buffers);
+    void addValidatedBuffer(int fd[MAX_HW2D_PLANES], size_t len[MAX_HW2D_PLANES],
+                            off_t offset[MAX_HW2D_PLANES], int num_buffers);
+
     hw2d_coord_t mImageDimension;
     uint32_t mPixFormat;
     int mDataSpace;
@@ -1121,6 +1154,21 @@ public:
      * they sshould release the handle with releaseHandle().
      */
     virtual bool execute(int *handle = NULL) = 0;
+    /*
+     * Run HW 2D asynchronously with both of the release fences and a handle.
+     * The release fences are filled to @fence as the first version of execute()
+     * does and the handle of the job is stored to @handle. More than one job
+     * can be in flight at the same time. Users can wait for a job with
+     * waitExecution() and obtain the execution time of the job with
+     * getLaptimeUSec(handle) after the wait. The default implementation does
+     * not track jobs and stores -1 to @handle.
+     */
+    virtual bool execute(int fence[], unsigned int num_fences, int *handle)
+    {
+        if (handle != NULL)
+            *handle = -1;
+        return execute(fence, num_fences);
+    }
     /*
      * Release @handle informed by execute()
      */
@@ -1135,6 +1183,35 @@ public:
      * It is only vaild when the last call to execute() succeeded.
      */
     virtual unsigned int getLaptimeUSec() { return 0; }
+    /*
+     * Return the execution time of the job identified by @handle in micro
+     * seconds. It is only valid after waitExecution() on @handle succeeded.
+     */
+    virtual unsigned int getLaptimeUSec(int __attribute__((__unused__)) handle)
+    {
+        return getLaptimeUSec();
+    }
+    /*
+     * Obtain the time the job identified by @handle waited for the earlier jobs
+     * in the H/W queue(@queue_usec) and its execution time(@exec_usec) in micro
+     * seconds. It is only valid after the job is completed. It returns false if
+     * the implementation does not track the job or the job is not completed.
+     */
+    virtual bool getJobTiming(int __attribute__((__unused__)) handle,
+                              unsigned int __attribute__((__unused__)) *queue_usec,
+                              unsigned int __attribute__((__unused__)) *exec_usec)
+    {
+        return false;
+    }
+    /*
+     * Return the @percentile-th percentile of the execution times of the recent
+     * completed jobs in micro seconds. It returns 0 if no job is completed yet
+     * or the implementation does not sample the execution times.
+     */
+    virtual unsigned int getLaptimePercentileUSec(unsigned int __attribute__((__unused__)) percentile)
+    {
+        return 0;
+    }
     /*
      * Configure the priority of the image processing tasks requested
      * to this compositor object. The default priority is -1 and the
@@ -1162,6 +1239,11 @@ public:
      * Called when an AcrylicLayer is being destroyed
      */
     void removeLayer(AcrylicLayer *layer);
+    /*
+     * Called when the z-order of an AcrylicLayer is changed. The layers are
+     * sorted again by the next sortLayers() only if @layer is out of order.
+     */
+    void reorderLayer(AcrylicLayer *layer);
     /*
      * Obtains the instance AcrylicCanvas of the taret image. It is called by
      * the implementations of Acrylic and the test modules of Acrylic. The other
@@ -1182,6 +1264,10 @@ protected:
      */
     virtual void removeTransitData(AcrylicLayer __attribute__((__unused__)) *layer) { }
     bool validateAllLayers();
+    /*
+     * Orders the layers by z-order. The layers are kept sorted on insertion
+     * and sortLayers() does nothing unless a z-order is changed out of order.
+     */
     void sortLayers();
     AcrylicLayer *getLayer(unsigned int index)
     {
@@ -1201,6 +1287,7 @@ protected:
     void *getTargetDisplayInfo() { return mTargetDisplayInfo; }
 private:
     std::vector<AcrylicLayer *> mLayers;
+    bool mLayersSorted;
     const HW2DCapability &mCapability;
     struct {
         uint16_t R;
@@ -1215,6 +1302,13 @@ private:
     AcrylicCanvas mCanvas;
 };
 
+/*
+ * Capacity of a performance request. It is large enough for the layers and the
+ * frames that the 2D hardware accepts at once so that a request never allocates.
+ */
+#define ACRYLIC_PERF_MAX_LAYERS 16
+#define ACRYLIC_PERF_MAX_FRAMES 4
+
 struct AcrylicPerformanceRequestLayer {
     hw2d_coord_t    mSourceDimension;
     uint32_t        mPixFormat;
@@ -1226,15 +1320,13 @@ struct AcrylicPerformanceRequestLayer {
 
 struct AcrylicPerformanceRequestFrame {
     int             mNumLayers;
-    int             mNumAllocLayers;
     int             mFrameRate;
     uint32_t        mTargetPixFormat;
     hw2d_coord_t    mTargetDimension;
     bool            mHasBackgroundLayer;
-    struct AcrylicPerformanceRequestLayer *mLayers;
+    struct AcrylicPerformanceRequestLayer mLayers[ACRYLIC_PERF_MAX_LAYERS];
 
     AcrylicPerformanceRequestFrame();
-    ~AcrylicPerformanceRequestFrame();
 
     bool reset(int num_layers = 0);
 
@@ -1280,7 +1372,6 @@ struct AcrylicPerformanceRequestFrame {
 class AcrylicPerformanceRequest {
 public:
     AcrylicPerformanceRequest();
-    ~AcrylicPerformanceRequest();
 
     bool reset(int num_frames = 0);
 
@@ -1289,8 +1380,7 @@ public:
 
 private:
     int mNumFrames;
-    int mNumAllocFrames;
-    AcrylicPerformanceRequestFrame *mFrames;
+    AcrylicPerformanceRequestFrame mFrames[ACRYLIC_PERF_MAX_FRAMES];
 };
 
 #endif /*__HARDWARE_EXYNOS_ACRYLIC_H__*/
@@ -380,6 +380,47 @@ int exynos_gsc_config_blend_exclusive(
 int exynos_gsc_wait_frame_done_exclusive
 (void *handle);
 
+/* frames that exynos_gsc_run_async() keeps queued to a G-scaler at most */
+#define GSC_M2M_MAX_QUEUED 4
+
+/*
+ * Called by exynos_gsc_dequeue_done() and exynos_gsc_wait_frame_done_exclusive()
+ * for each finished frame. @result is 0 on success and negative if the frame
+ * failed or was dropped by exynos_gsc_stop_exclusive().
+ */
+typedef void (*exynos_gsc_done_callback)(void *data, int frame_id, int result);
+
+int exynos_gsc_set_done_callback
+(void *handle, exynos_gsc_done_callback callback, void *data);
+
+/*
+ * Queues a frame like exynos_gsc_run_exclusive() without waiting for the
+ * previous frames. It blocks only when GSC_M2M_MAX_QUEUED frames are already
+ * queued. The release fences of @src_img and @dst_img are set as
+ * exynos_gsc_run_exclusive() does. Only the M2M mode of G-scaler is supported.
+ *
+ * \return
+ *   the id of the frame given to the done callback, or -1 on failure
+ */
+int exynos_gsc_run_async
+(void *handle, exynos_mpp_img *src_img, exynos_mpp_img *dst_img);
+
+/*
+ * Returns the fd to poll() for POLLIN that tells a queued frame is finished.
+ * The fd is owned by the handle.
+ */
+int exynos_gsc_get_done_fd
+(void *handle);
+
+/*
+ * Dequeues the finished frames without blocking.
+ *
+ * \return
+ *   the number of the frames dequeued, or -1 on failure
+ */
+int exynos_gsc_dequeue_done
+(void *handle);
+
 /*
 *api for GSC stop.
 It stops the GSC OUT streaming.
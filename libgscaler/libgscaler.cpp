@@ -156,6 +156,10 @@ int exynos_gsc_set_csc_property(
         Exynos_gsc_Out();
         return ret;
     }
+    if ((gsc->eq_auto != eq_auto) || (gsc->range_full != range_full) ||
+        (gsc->v4l2_colorspace != v4l2_colorspace))
+        gsc->src_info.dirty |= GSC_DIRTY_CSC;
+
     gsc->eq_auto = eq_auto;
     gsc->range_full = range_full;
     gsc->v4l2_colorspace = v4l2_colorspace;
@@ -165,6 +169,27 @@ int exynos_gsc_set_csc_property(
     return 0;
 }
 
+/* returns GSC_DIRTY_* of the changes from @info */
+static unsigned int gsc_format_changes(GscInfo *info,
+    unsigned int width, unsigned int height,
+    unsigned int crop_left, unsigned int crop_top,
+    unsigned int crop_width, unsigned int crop_height,
+    unsigned int v4l2_colorformat, unsigned int cacheable, unsigned int mode_drm)
+{
+    unsigned int dirty = 0;
+
+    if ((info->width != width) || (info->height != height) ||
+        (info->v4l2_colorformat != v4l2_colorformat) ||
+        (info->cacheable != cacheable) || (info->mode_drm != mode_drm))
+        dirty |= GSC_DIRTY_FORMAT;
+
+    if ((info->crop_left != crop_left) || (info->crop_top != crop_top) ||
+        (info->crop_width != crop_width) || (info->crop_height != crop_height))
+        dirty |= GSC_DIRTY_CROP;
+
+    return dirty;
+}
+
 int exynos_gsc_set_src_format(
     void        *handle,
     unsigned int width,
@@ -184,6 +209,10 @@ int exynos_gsc_set_src_format(
         ALOGE("%s::handle == NULL() fail", __func__);
         return -1;
     }
+    gsc->src_info.dirty |= gsc_format_changes(&gsc->src_info, width, height,
+                                              crop_left, crop_top, crop_width, crop_height,
+                                              v4l2_colorformat, cacheable, mode_drm);
+
     gsc->src_info.width            = width;
     gsc->src_info.height           = height;
     gsc->src_info.crop_left        = crop_left;
@@ -193,7 +222,6 @@ int exynos_gsc_set_src_format(
     gsc->src_info.v4l2_colorformat = v4l2_colorformat;
     gsc->src_info.cacheable        = cacheable;
     gsc->src_info.mode_drm         = mode_drm;
-    gsc->src_info.dirty            = true;
 
     Exynos_gsc_Out();
 
@@ -220,6 +248,10 @@ int exynos_gsc_set_dst_format(
         return -1;
     }
 
+    gsc->dst_info.dirty |= gsc_format_changes(&gsc->dst_info, width, height,
+                                              crop_left, crop_top, crop_width, crop_height,
+                                              v4l2_colorformat, cacheable, mode_drm);
+
     gsc->dst_info.width            = width;
     gsc->dst_info.height           = height;
     gsc->dst_info.crop_left        = crop_left;
@@ -227,7 +259,6 @@ int exynos_gsc_set_dst_format(
     gsc->dst_info.crop_width       = crop_width;
     gsc->dst_info.crop_height      = crop_height;
     gsc->dst_info.v4l2_colorformat = v4l2_colorformat;
-    gsc->dst_info.dirty            = true;
     gsc->dst_info.cacheable        = cacheable;
     gsc->dst_info.mode_drm         = mode_drm;
 
@@ -259,6 +290,11 @@ int exynos_gsc_set_rotation(
     if(new_rotation < 0)
         new_rotation = -new_rotation;
 
+    if ((gsc->dst_info.rotation != new_rotation) ||
+        (gsc->dst_info.flip_horizontal != flip_horizontal) ||
+        (gsc->dst_info.flip_vertical != flip_vertical))
+        gsc->dst_info.dirty |= GSC_DIRTY_ROTATION;
+
     gsc->dst_info.rotation        = new_rotation;
     gsc->dst_info.flip_horizontal = flip_horizontal;
     gsc->dst_info.flip_vertical   = flip_vertical;
@@ -538,6 +574,75 @@ int exynos_gsc_wait_frame_done_exclusive(void *handle)
     return ret;
 }
 
+int exynos_gsc_set_done_callback(void *handle,
+    exynos_gsc_done_callback callback, void *data)
+{
+    CGscaler* gsc = GetGscaler(handle);
+    if (gsc == NULL) {
+        ALOGE("%s::handle == NULL() fail", __func__);
+        return -1;
+    }
+
+    gsc->done_callback = callback;
+    gsc->done_callback_data = data;
+
+    return 0;
+}
+
+int exynos_gsc_run_async(void *handle,
+    exynos_mpp_img *src_img, exynos_mpp_img *dst_img)
+{
+    Exynos_gsc_In();
+
+    CGscaler* gsc = GetGscaler(handle);
+    if (gsc == NULL) {
+        ALOGE("%s::handle == NULL() fail", __func__);
+        return -1;
+    }
+
+    if ((gsc->gsc_id >= HW_SCAL0) || (gsc->mode != GSC_M2M_MODE)) {
+        ALOGE("%s::only M2M mode of G-scaler is supported", __func__);
+        return -1;
+    }
+
+    int ret = gsc->m_gsc_m2m_run(handle, src_img, dst_img, true);
+
+    Exynos_gsc_Out();
+
+    return ret;
+}
+
+int exynos_gsc_get_done_fd(void *handle)
+{
+    CGscaler* gsc = GetGscaler(handle);
+    if (gsc == NULL) {
+        ALOGE("%s::handle == NULL() fail", __func__);
+        return -1;
+    }
+
+    return gsc->gsc_fd;
+}
+
+int exynos_gsc_dequeue_done(void *handle)
+{
+    Exynos_gsc_In();
+
+    CGscaler* gsc = GetGscaler(handle);
+    if (gsc == NULL) {
+        ALOGE("%s::handle == NULL() fail", __func__);
+        return -1;
+    }
+
+    if ((gsc->gsc_id >= HW_SCAL0) || (gsc->mode != GSC_M2M_MODE))
+        return 0;
+
+    int ret = gsc->m_gsc_m2m_dequeue(handle, false, GSC_M2M_MAX_QUEUED);
+
+    Exynos_gsc_Out();
+
+    return ret;
+}
+
 int exynos_gsc_stop_exclusive(void *handle)
 {
     Exynos_gsc_In();
@@ -28,6 +28,10 @@
 
 #include <cstdio>
 #include <cerrno>
+#include <climits>
+#include <cstdarg>
+#include <mutex>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -56,179 +60,366 @@
 
 #define V4L2_BUF_FLAG_USE_SYNC          0x00008000
 
-static int v4l2_pixfmt_to_yuvinfo(unsigned int v4l2_pixel_format, unsigned int * bpp, unsigned int * planes)
+/*
+ * One component stored in a plane: the bytes of a sample, the subsampling as
+ * shifts of the width and the height, and the alignment of a row in bytes and
+ * of the number of rows.
+ */
+struct gsc_plane_comp {
+    unsigned char plane;
+    unsigned char bytes;
+    unsigned char x_shift;
+    unsigned char y_shift;
+    unsigned char row_align;
+    unsigned char rows_align;
+};
+
+struct gsc_format_desc {
+    unsigned int v4l2_format;
+    bool yuv;
+    unsigned int bpp;     /* bits per pixel of a frame */
+    unsigned int planes;  /* planes in memory */
+    unsigned int comps;   /* 0 if the layout is not known to the library */
+    struct gsc_plane_comp comp[3];
+};
+
+#define GSC_FMT_RGB(fmt, bytes) \
+    { fmt, false, (bytes) * 8, 1, 1, { { 0, bytes, 0, 0, 1, 1 } } }
+
+static constexpr struct gsc_format_desc gsc_formats[] = {
+    GSC_FMT_RGB(V4L2_PIX_FMT_RGB32, 4),
+    GSC_FMT_RGB(V4L2_PIX_FMT_BGR32, 4),
+    GSC_FMT_RGB(V4L2_PIX_FMT_RGB24, 3),
+    GSC_FMT_RGB(V4L2_PIX_FMT_RGB565, 2),
+    GSC_FMT_RGB(V4L2_PIX_FMT_RGB555X, 2),
+    GSC_FMT_RGB(V4L2_PIX_FMT_RGB444, 2),
+    { V4L2_PIX_FMT_YUYV, true, 16, 1, 1, { { 0, 2, 0, 0, 1, 1 } } },
+    { V4L2_PIX_FMT_YVYU, true, 16, 1, 1, { { 0, 2, 0, 0, 1, 1 } } },
+    { V4L2_PIX_FMT_UYVY, true, 16, 1, 1, { { 0, 2, 0, 0, 1, 1 } } },
+    { V4L2_PIX_FMT_VYUY, true, 16, 1, 1, { { 0, 2, 0, 0, 1, 1 } } },
+    { V4L2_PIX_FMT_NV16, true, 16, 1, 2, { { 0, 1, 0, 0, 1, 1 }, { 0, 2, 1, 0, 1, 1 } } },
+    { V4L2_PIX_FMT_NV61, true, 16, 1, 2, { { 0, 1, 0, 0, 1, 1 }, { 0, 2, 1, 0, 1, 1 } } },
+    { V4L2_PIX_FMT_YUV422P, true, 16, 1, 3,
+        { { 0, 1, 0, 0, 1, 1 }, { 0, 1, 1, 0, 1, 1 }, { 0, 1, 1, 0, 1, 1 } } },
+    { V4L2_PIX_FMT_NV12, true, 12, 1, 2, { { 0, 1, 0, 0, 1, 1 }, { 0, 2, 1, 1, 1, 1 } } },
+    { V4L2_PIX_FMT_NV21, true, 12, 1, 2, { { 0, 1, 0, 0, 1, 1 }, { 0, 2, 1, 1, 1, 1 } } },
+    { V4L2_PIX_FMT_YUV420, true, 12, 1, 3,
+        { { 0, 1, 0, 0, 1, 1 }, { 0, 1, 1, 1, 1, 1 }, { 0, 1, 1, 1, 1, 1 } } },
+    { V4L2_PIX_FMT_YVU420, true, 12, 1, 3,
+        { { 0, 1, 0, 0, 16, 1 }, { 0, 1, 1, 1, 16, 1 }, { 0, 1, 1, 1, 16, 1 } } },
+    { V4L2_PIX_FMT_NV12M, true, 12, 2, 2, { { 0, 1, 0, 0, 1, 1 }, { 1, 2, 1, 1, 1, 1 } } },
+    { V4L2_PIX_FMT_NV21M, true, 12, 2, 2, { { 0, 1, 0, 0, 1, 1 }, { 1, 2, 1, 1, 1, 1 } } },
+    { V4L2_PIX_FMT_NV12MT_16X16, true, 12, 2, 2,
+        { { 0, 1, 0, 0, 16, 16 }, { 1, 2, 1, 1, 16, 8 } } },
+    { V4L2_PIX_FMT_YUV420M, true, 12, 3, 3,
+        { { 0, 1, 0, 0, 1, 1 }, { 1, 1, 1, 1, 1, 1 }, { 2, 1, 1, 1, 1, 1 } } },
+    { V4L2_PIX_FMT_YVU420M, true, 12, 3, 3,
+        { { 0, 1, 0, 0, 16, 1 }, { 1, 1, 1, 1, 16, 1 }, { 2, 1, 1, 1, 16, 1 } } },
+    /* the layouts of the formats below are left to the driver */
+    { V4L2_PIX_FMT_NV12N, true, 12, 1, 0, {} },
+    { V4L2_PIX_FMT_NV12NT, true, 12, 1, 0, {} },
+    { V4L2_PIX_FMT_YUV420N, true, 12, 1, 0, {} },
+    { V4L2_PIX_FMT_NV12MT, true, 12, 2, 0, {} },
+};
+
+#undef GSC_FMT_RGB
+
+static const struct gsc_format_desc *gsc_find_format(unsigned int v4l2_pixel_format)
 {
-    switch (v4l2_pixel_format) {
-    case V4L2_PIX_FMT_NV12:
-    case V4L2_PIX_FMT_NV21:
-    case V4L2_PIX_FMT_NV12N:
-    case V4L2_PIX_FMT_NV12NT:
-    case V4L2_PIX_FMT_YUV420:
-    case V4L2_PIX_FMT_YVU420:
-    case V4L2_PIX_FMT_YUV420N:
-        *bpp    = 12;
-        *planes = 1;
-        break;
+    for (const auto &desc : gsc_formats)
+        if (desc.v4l2_format == v4l2_pixel_format)
+            return &desc;
 
-    case V4L2_PIX_FMT_NV12M:
-    case V4L2_PIX_FMT_NV21M:
-    case V4L2_PIX_FMT_NV12MT:
-    case V4L2_PIX_FMT_NV12MT_16X16:
-        *bpp    = 12;
-        *planes = 2;
-        break;
+    return NULL;
+}
 
-    case V4L2_PIX_FMT_YUV420M:
-    case V4L2_PIX_FMT_YVU420M:
-        *bpp    = 12;
-        *planes = 3;
-        break;
+static int gsc_get_yuv_bpp(unsigned int v4l2_pixel_format)
+{
+    const struct gsc_format_desc *desc = gsc_find_format(v4l2_pixel_format);
 
-    case V4L2_PIX_FMT_YUYV:
-    case V4L2_PIX_FMT_YVYU:
-    case V4L2_PIX_FMT_UYVY:
-    case V4L2_PIX_FMT_VYUY:
-    case V4L2_PIX_FMT_NV16:
-    case V4L2_PIX_FMT_NV61:
-        *bpp    = 16;
-        *planes = 1;
-        break;
-        break;
-    default:
-        return -1;
-        break;
+    return (desc && desc->yuv) ? static_cast<int>(desc->bpp) : -1;
+}
+
+static int gsc_get_yuv_planes(unsigned int v4l2_pixel_format)
+{
+    const struct gsc_format_desc *desc = gsc_find_format(v4l2_pixel_format);
+
+    return (desc && desc->yuv) ? static_cast<int>(desc->planes) : -1;
+}
+
+#define GSC_MAX_CTRLS 8
+
+struct gsc_ctrl {
+    __u32 id;
+    __s32 value;
+    const char *name;
+};
+
+/*
+ * Set @ctrls with a VIDIOC_S_EXT_CTRLS. They are set one by one if the driver
+ * does not take them at once so that the failed control is reported.
+ */
+static bool gsc_s_ctrls(int fd, const gsc_ctrl ctrls[], unsigned int count, const char *func)
+{
+    if (count <= GSC_MAX_CTRLS) {
+        struct v4l2_ext_control ext_ctrl[GSC_MAX_CTRLS];
+        struct v4l2_ext_controls ext_ctrls;
+
+        memset(ext_ctrl, 0, sizeof(ext_ctrl));
+        memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+
+        for (unsigned int i = 0; i < count; i++) {
+            ext_ctrl[i].id = ctrls[i].id;
+            ext_ctrl[i].value = ctrls[i].value;
+        }
+        ext_ctrls.count = count;
+        ext_ctrls.controls = ext_ctrl;
+
+        if (ioctl(fd, VIDIOC_S_EXT_CTRLS, &ext_ctrls) == 0)
+            return true;
     }
 
-    return 0;
+    for (unsigned int i = 0; i < count; i++) {
+        struct v4l2_control ctrl;
+
+        ctrl.id = ctrls[i].id;
+        ctrl.value = ctrls[i].value;
+        if (ioctl(fd, VIDIOC_S_CTRL, &ctrl) < 0) {
+            ALOGE("%s::exynos_v4l2_s_ctrl(%s: %d) fail", func, ctrls[i].name, ctrls[i].value);
+            return false;
+        }
+    }
+
+    return true;
 }
 
-static int gsc_get_yuv_bpp(unsigned int v4l2_pixel_format)
+#define VIDEODEV_MAX 255
+#define VIDEODEV_NAME_LEN 64
+
+/*
+ * Names of /dev/video0 .. /dev/video(probed - 1) read from sysfs, empty for
+ * the nodes that are not video devices. A lookup searches the names probed so
+ * far and probes only the nodes beyond them.
+ */
+static struct {
+    std::mutex lock;
+    char name[VIDEODEV_MAX + 1][VIDEODEV_NAME_LEN];
+    int probed;
+} video_nodes;
+
+static void probe_video_node(int i)
 {
-    unsigned int bpp, planes;
+    char filename[64];
+    char *name = video_nodes.name[i];
+    struct stat s;
+    FILE *stream_fd;
+
+    name[0] = '\0';
 
-    if (v4l2_pixfmt_to_yuvinfo(v4l2_pixel_format, &bpp, &planes) < 0)
-        bpp = -1;
+    /* video device node */
+    snprintf(filename, sizeof(filename), "/dev/video%d", i);
 
-    return bpp;
+    /* if the node is video device */
+    if ((lstat(filename, &s) != 0) || !S_ISCHR(s.st_mode) ||
+            ((int)((unsigned short)(s.st_rdev) >> 8) != 81))
+        return;
+
+    ALOGD("try node: %s", filename);
+
+    /* open sysfs entry */
+    snprintf(filename, sizeof(filename), "/sys/class/video4linux/video%d/name", i);
+    stream_fd = fopen(filename, "r");
+    if (stream_fd == NULL) {
+        ALOGE("failed to open sysfs entry for videodev (%d - %s)", errno, strerror(errno));
+        return;
+    }
+
+    /* read sysfs entry for device name */
+    if (fgets(name, VIDEODEV_NAME_LEN, stream_fd) == NULL) {
+        ALOGE("failed to read sysfs entry for videodev");
+        name[0] = '\0';
+    }
+    fclose(stream_fd);
 }
 
-static int gsc_get_yuv_planes(unsigned int v4l2_pixel_format)
+static bool video_node_matches(int i, const char *devname)
+{
+    const char *name = video_nodes.name[i];
+
+    return (name[0] != '\0') && (strncmp(name, devname, strlen(devname)) == 0);
+}
+
+static int find_video_node(const char *devname)
 {
-    unsigned int bpp, planes;
+    std::lock_guard<std::mutex> lock(video_nodes.lock);
+
+    for (int i = 0; i < video_nodes.probed; i++) {
+        if (video_node_matches(i, devname))
+            return i;
+    }
 
-    if (v4l2_pixfmt_to_yuvinfo(v4l2_pixel_format, &bpp, &planes) < 0)
-        planes = -1;
+    while (video_nodes.probed <= VIDEODEV_MAX) {
+        int i = video_nodes.probed++;
 
-    return planes;
+        probe_video_node(i);
+        if (video_node_matches(i, devname))
+            return i;
+    }
+
+    /* probe again next time since the device may be registered later */
+    video_nodes.probed = 0;
+
+    return -1;
 }
 
-#define VIDEODEV_MAX 255
 static int exynos_v4l2_open_devname(const char *devname, int oflag, ...)
 {
-    bool found = false;
     int fd = -1;
-    struct stat s;
+    mode_t mode = 0;
     va_list ap;
-    FILE *stream_fd;
-    char filename[64], name[64];
-    int i = 0;
-
-    do {
-        if (i > VIDEODEV_MAX)
-            break;
-
-        /* video device node */
-        snprintf(filename, sizeof(filename), "/dev/video%d", i);
+    char filename[64];
 
-        /* if the node is video device */
-        if ((lstat(filename, &s) == 0) && S_ISCHR(s.st_mode) &&
-                ((int)((unsigned short)(s.st_rdev) >> 8) == 81)) {
-            ALOGD("try node: %s", filename);
-            /* open sysfs entry */
-            snprintf(filename, sizeof(filename), "/sys/class/video4linux/video%d/name", i);
-            if (S_ISLNK(s.st_mode)) {
-                ALOGE("symbolic link detected");
-                return -1;
-            }
-            stream_fd = fopen(filename, "r");
-            if (stream_fd == NULL) {
-                ALOGE("failed to open sysfs entry for videodev (%d - %s)", errno, strerror(errno));
-                i++;
-                continue;   /* try next */
-            }
+    if (oflag & O_CREAT) {
+        va_start(ap, oflag);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
 
-            /* read sysfs entry for device name */
-            char *p = fgets(name, sizeof(name), stream_fd);
-            fclose(stream_fd);
-
-            /* check read size */
-            if (p == NULL) {
-                ALOGE("failed to read sysfs entry for videodev");
-            } else {
-                /* matched */
-                if (strncmp(name, devname, strlen(devname)) == 0) {
-                    ALOGI("node found for device %s: /dev/video%d", devname, i);
-                    found = true;
-                    break;
-                }
-            }
+    /* the cached node is probed again if it is not opened */
+    for (int retry = 0; (fd < 0) && (retry < 2); retry++) {
+        int i = find_video_node(devname);
+        if (i < 0) {
+            ALOGE("no video device found");
+            break;
         }
-        i++;
-    } while (found == false);
 
-    if (found) {
+        ALOGI("node found for device %s: /dev/video%d", devname, i);
+
         snprintf(filename, sizeof(filename), "/dev/video%d", i);
-        va_start(ap, oflag);
-        fd = open(filename, oflag, ap);
-        va_end(ap);
+        fd = open(filename, oflag, mode);
 
-        if (fd > 0)
+        if (fd > 0) {
             ALOGI("open video device %s", filename);
-        else
+        } else {
             ALOGE("failed to open video device %s", filename);
-    } else {
-        ALOGE("no video device found");
+            std::lock_guard<std::mutex> lock(video_nodes.lock);
+            video_nodes.probed = 0;
+        }
     }
 
     return fd;
 }
 
-int CGscaler::m_gsc_m2m_create(int dev)
+/*
+ * The M2M nodes of G-scaler in this process. A node that turned out to be
+ * missing is not opened again, and the users tell m_gsc_find_and_create()
+ * which node is the least loaded by this process.
+ */
+static struct {
+    std::mutex lock;
+    bool probed[NUM_OF_GSC_HW];
+    bool present[NUM_OF_GSC_HW];
+    unsigned int users[NUM_OF_GSC_HW];
+} gsc_nodes;
+
+static int gsc_m2m_node_num(int dev)
 {
-    Exynos_gsc_In();
-
-    int          fd = 0;
-    int          video_node_num;
-    char         node[32];
-
     switch(dev) {
     case 0:
-        video_node_num = NODE_NUM_GSC_0;
-        break;
+        return NODE_NUM_GSC_0;
     case 1:
-        video_node_num = NODE_NUM_GSC_1;
-        break;
+        return NODE_NUM_GSC_1;
 #ifndef USES_ONLY_GSC0_GSC1
     case 2:
-        video_node_num = NODE_NUM_GSC_2;
-        break;
+        return NODE_NUM_GSC_2;
     case 3:
-        video_node_num = NODE_NUM_GSC_3;
-        break;
+        return NODE_NUM_GSC_3;
 #endif
     default:
+        return -1;
+    }
+}
+
+static void gsc_m2m_node_probed(int dev, int fd, int err)
+{
+    std::lock_guard<std::mutex> lock(gsc_nodes.lock);
+
+    if (fd >= 0)
+        gsc_nodes.users[dev]++;
+
+    if (gsc_nodes.probed[dev])
+        return;
+
+    gsc_nodes.probed[dev] = true;
+    gsc_nodes.present[dev] = true;
+
+    if (fd < 0) {
+        /* busy nodes are tried again */
+        gsc_nodes.present[dev] = (err != ENOENT) && (err != ENODEV) && (err != ENXIO);
+        gsc_nodes.probed[dev] = !gsc_nodes.present[dev];
+        return;
+    }
+
+    struct v4l2_capability cap;
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+        __u32 caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+        if (!(caps & V4L2_CAP_VIDEO_M2M_MPLANE)) {
+            ALOGE("%s::gsc%d is not a M2M device (caps %#x)", __func__, dev, caps);
+            gsc_nodes.present[dev] = false;
+        }
+    }
+}
+
+static void gsc_m2m_node_release(int dev)
+{
+    if ((dev < 0) || (dev >= NUM_OF_GSC_HW))
+        return;
+
+    std::lock_guard<std::mutex> lock(gsc_nodes.lock);
+
+    if (gsc_nodes.users[dev] > 0)
+        gsc_nodes.users[dev]--;
+}
+
+int CGscaler::m_gsc_m2m_create(int dev)
+{
+    Exynos_gsc_In();
+
+    int          fd = 0;
+    int          video_node_num;
+    char         node[32];
+
+    video_node_num = gsc_m2m_node_num(dev);
+    if (video_node_num < 0) {
         ALOGE("%s::unexpected dev(%d) fail", __func__, dev);
         return -1;
-        break;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(gsc_nodes.lock);
+        if (gsc_nodes.probed[dev] && !gsc_nodes.present[dev]) {
+            ALOGE("%s::gsc%d is not available", __func__, dev);
+            return -1;
+        }
     }
 
     snprintf(node, sizeof(node), "%s%d", PFX_NODE_GSC, video_node_num);
     fd = open(node, O_RDWR);
+    gsc_m2m_node_probed(dev, fd, errno);
     if (fd < 0) {
         ALOGE("%s::exynos_v4l2_open(%s) fail", __func__, node);
         return -1;
     }
 
+    {
+        std::lock_guard<std::mutex> lock(gsc_nodes.lock);
+        if (!gsc_nodes.present[dev]) {
+            gsc_nodes.users[dev]--;
+            close(fd);
+            return -1;
+        }
+    }
+
     Exynos_gsc_Out();
 
     return fd;
@@ -238,6 +429,8 @@ bool CGscaler::m_gsc_find_and_create(void *handle)
 {
     Exynos_gsc_In();
 
+    int          candidates[NUM_OF_GSC_HW];
+    int          nr_candidates;
     int          i                 = 0;
     bool         flag_find_new_gsc = false;
     unsigned int total_sleep_time  = 0;
@@ -248,16 +441,35 @@ bool CGscaler::m_gsc_find_and_create(void *handle)
     }
 
     do {
-        for (i = 0; i < NUM_OF_GSC_HW; i++) {
+        nr_candidates = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(gsc_nodes.lock);
+
+            for (i = 0; i < NUM_OF_GSC_HW; i++) {
 #ifndef USES_ONLY_GSC0_GSC1
-            if (i == 0 || i == 3)
+                if (i == 0 || i == 3)
 #else
-            if (i == 0)
+                if (i == 0 || i >= 2)
 #endif
-                continue;
+                    continue;
+
+                if (gsc_nodes.probed[i] && !gsc_nodes.present[i])
+                    continue;
 
-            gsc->gsc_id = i;
-            gsc->gsc_fd = gsc->m_gsc_m2m_create(i);
+                /* the least used node first, keeping the order of the same users */
+                int k = nr_candidates++;
+                while ((k > 0) && (gsc_nodes.users[candidates[k - 1]] > gsc_nodes.users[i])) {
+                    candidates[k] = candidates[k - 1];
+                    k--;
+                }
+                candidates[k] = i;
+            }
+        }
+
+        for (int c = 0; c < nr_candidates; c++) {
+            gsc->gsc_id = candidates[c];
+            gsc->gsc_fd = gsc->m_gsc_m2m_create(candidates[c]);
             if (gsc->gsc_fd < 0) {
                 gsc->gsc_fd = 0;
                 continue;
@@ -306,8 +518,10 @@ bool CGscaler::m_gsc_m2m_destroy(void *handle)
         return ret;
     }
 
-    if (0 < gsc->gsc_fd)
+    if (0 < gsc->gsc_fd) {
         close(gsc->gsc_fd);
+        gsc_m2m_node_release(gsc->gsc_id);
+    }
     gsc->gsc_fd = 0;
 
     Exynos_gsc_Out();
@@ -344,21 +558,8 @@ int CGscaler::m_gsc_m2m_stop(void *handle)
      * also, if we only failed to turn on one of the streams, we'll turn
      * the other one off correctly.
      */
-    if (gsc->src_info.stream_on == true) {
-        if (ioctl(gsc->gsc_fd, VIDIOC_STREAMOFF, &gsc->src_info.buf.buf_type) < 0) {
-            ALOGE("%s::exynos_v4l2_streamoff(src) fail", __func__);
-            ret = -1;
-        }
-        gsc->src_info.stream_on = false;
-    }
-
-    if (gsc->dst_info.stream_on == true) {
-        if (ioctl(gsc->gsc_fd, VIDIOC_STREAMOFF, &gsc->dst_info.buf.buf_type) < 0) {
-            ALOGE("%s::exynos_v4l2_streamoff(dst) fail", __func__);
-            ret = -1;
-        }
-        gsc->dst_info.stream_on = false;
-    }
+    if (gsc->m_gsc_m2m_streamoff(handle) < 0)
+        ret = -1;
 
     /* Secure DRM support by GScaler is removed out */
 
@@ -395,11 +596,77 @@ int CGscaler::m_gsc_m2m_stop(void *handle)
     return ret;
 }
 
-int CGscaler::m_gsc_m2m_run_core(void *handle)
+int CGscaler::m_gsc_m2m_streamoff(void *handle)
+{
+    int ret = 0;
+    CGscaler* gsc = GetGscaler(handle);
+    if (gsc == NULL) {
+        ALOGE("%s::handle == NULL() fail", __func__);
+        return -1;
+    }
+
+    if (gsc->src_info.stream_on == true) {
+        if (ioctl(gsc->gsc_fd, VIDIOC_STREAMOFF, &gsc->src_info.buf.buf_type) < 0) {
+            ALOGE("%s::exynos_v4l2_streamoff(src) fail", __func__);
+            ret = -1;
+        }
+        gsc->src_info.stream_on = false;
+    }
+
+    if (gsc->dst_info.stream_on == true) {
+        if (ioctl(gsc->gsc_fd, VIDIOC_STREAMOFF, &gsc->dst_info.buf.buf_type) < 0) {
+            ALOGE("%s::exynos_v4l2_streamoff(dst) fail", __func__);
+            ret = -1;
+        }
+        gsc->dst_info.stream_on = false;
+    }
+
+    gsc->m_gsc_m2m_drop_queued();
+
+    return ret;
+}
+
+bool CGscaler::m_gsc_set_csc(void)
+{
+    const gsc_ctrl ctrls[] = {
+        {V4L2_CID_CSC_EQ_MODE, static_cast<__s32>(eq_auto), "V4L2_CID_CSC_EQ_MODE"},
+        {V4L2_CID_CSC_EQ, static_cast<__s32>(v4l2_colorspace), "V4L2_CID_CSC_EQ"},
+        {V4L2_CID_CSC_RANGE, static_cast<__s32>(range_full), "V4L2_CID_CSC_RANGE"},
+    };
+
+    return gsc_s_ctrls(gsc_fd, ctrls, sizeof(ctrls) / sizeof(ctrls[0]), __func__);
+}
+
+/* applies the changes of @dirty but GSC_DIRTY_FORMAT without stopping streaming */
+bool CGscaler::m_gsc_m2m_update_live(void *handle, unsigned int dirty)
+{
+    CGscaler* gsc = GetGscaler(handle);
+    if (gsc == NULL) {
+        ALOGE("%s::handle == NULL() fail", __func__);
+        return false;
+    }
+
+    if ((gsc->src_info.dirty & GSC_DIRTY_CROP) && !m_gsc_set_crop(gsc->gsc_fd, &gsc->src_info))
+        return false;
+
+    if ((gsc->dst_info.dirty & GSC_DIRTY_CROP) && !m_gsc_set_crop(gsc->gsc_fd, &gsc->dst_info))
+        return false;
+
+    if ((dirty & GSC_DIRTY_ROTATION) && !m_gsc_set_rotation(gsc->gsc_fd, &gsc->dst_info))
+        return false;
+
+    if ((dirty & GSC_DIRTY_CSC) && !gsc->m_gsc_set_csc())
+        return false;
+
+    return true;
+}
+
+int CGscaler::m_gsc_m2m_run_core(void *handle, bool async)
 {
     Exynos_gsc_In();
 
     unsigned int rotate, hflip, vflip;
+    unsigned int dirty;
     bool is_dirty;
     bool is_drm;
     CGscaler* gsc = GetGscaler(handle);
@@ -408,7 +675,8 @@ int CGscaler::m_gsc_m2m_run_core(void *handle)
         return -1;
     }
 
-    is_dirty = gsc->src_info.dirty || gsc->dst_info.dirty;
+    dirty = gsc->src_info.dirty | gsc->dst_info.dirty;
+    is_dirty = dirty != 0;
     is_drm = gsc->src_info.mode_drm;
 
     if (is_dirty && (gsc->src_info.mode_drm != gsc->dst_info.mode_drm)) {
@@ -442,76 +710,82 @@ int CGscaler::m_gsc_m2m_run_core(void *handle)
         return -1;
     }
 
-    /* dequeue buffers from previous work if necessary */
+    /*
+     * dequeue buffers from previous work if necessary. The asynchronous run
+     * only waits for the oldest frame when no buffer is free.
+     */
     if (gsc->src_info.stream_on == true) {
-        if (gsc->m_gsc_m2m_wait_frame_done(handle) < 0) {
-            ALOGE("%s::exynos_gsc_m2m_wait_frame_done fail", __func__);
-            return -1;
+        if (!async || is_dirty) {
+            if (gsc->m_gsc_m2m_wait_frame_done(handle) < 0) {
+                ALOGE("%s::exynos_gsc_m2m_wait_frame_done fail", __func__);
+                return -1;
+            }
+        } else if ((gsc->src_info.buf.queued >= gsc->src_info.buf.count) ||
+                   (gsc->dst_info.buf.queued >= gsc->dst_info.buf.count)) {
+            if (gsc->m_gsc_m2m_dequeue(handle, true, 1) < 0) {
+                ALOGE("%s::m_gsc_m2m_dequeue fail", __func__);
+                return -1;
+            }
         }
     }
 
     /*
-     * need to set the content protection flag before doing reqbufs
-     * in set_format
+     * crop, rotation and csc are changed while streaming if the driver allows.
+     * Otherwise, streaming is restarted to set them with the format.
      */
-    if (is_dirty && gsc->allow_drm && is_drm) {
-        struct v4l2_control ctrl;
-
-        ctrl.id = V4L2_CID_CONTENT_PROTECTION;
-        ctrl.value = is_drm;
-        if (ioctl(gsc->gsc_fd,VIDIOC_S_CTRL, &ctrl) < 0) {
-            ALOGE("%s::exynos_v4l2_s_ctrl() fail", __func__);
-            return -1;
+    if (gsc->src_info.stream_on && is_dirty && !(dirty & GSC_DIRTY_FORMAT)) {
+        if (!gsc->no_live_update && gsc->m_gsc_m2m_update_live(handle, dirty)) {
+            gsc->src_info.dirty = 0;
+            gsc->dst_info.dirty = 0;
+        } else {
+            gsc->no_live_update = true;
+            dirty |= GSC_DIRTY_FORMAT;
         }
     }
 
-    /*
-     * from this point on, we have to ensure to call stop to clean up
-     * whatever state we have set.
-     */
+    if (gsc->src_info.stream_on && (dirty & GSC_DIRTY_FORMAT)) {
+        if (gsc->m_gsc_m2m_streamoff(handle) < 0)
+            goto done;
+    }
+
+    if (gsc->src_info.stream_on == false) {
+        /*
+         * need to set the content protection flag before doing reqbufs
+         * in set_format
+         */
+        if (gsc->allow_drm && is_drm) {
+            struct v4l2_control ctrl;
+
+            ctrl.id = V4L2_CID_CONTENT_PROTECTION;
+            ctrl.value = is_drm;
+            if (ioctl(gsc->gsc_fd,VIDIOC_S_CTRL, &ctrl) < 0) {
+                ALOGE("%s::exynos_v4l2_s_ctrl() fail", __func__);
+                return -1;
+            }
+        }
+
+        /*
+         * from this point on, we have to ensure to call stop to clean up
+         * whatever state we have set.
+         */
 
-    if (gsc->src_info.dirty) {
         if (CGscaler::m_gsc_set_format(gsc->gsc_fd, &gsc->src_info) == false) {
             ALOGE("%s::m_gsc_set_format(src) fail", __func__);
             goto done;
         }
-        gsc->src_info.dirty = false;
-    }
+        gsc->src_info.dirty = 0;
 
-    if (gsc->dst_info.dirty) {
         if (CGscaler::m_gsc_set_format(gsc->gsc_fd, &gsc->dst_info) == false) {
             ALOGE("%s::m_gsc_set_format(dst) fail", __func__);
             goto done;
         }
-        gsc->dst_info.dirty = false;
-    }
-
-    /*
-     * set up csc equation property
-     */
-    if (is_dirty) {
-        struct v4l2_control ctrl;
-
-        ctrl.id = V4L2_CID_CSC_EQ_MODE;
-        ctrl.value = gsc->eq_auto;
-        if (ioctl(gsc->gsc_fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-            ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CSC_EQ_MODE) fail", __func__);
-            return -1;
-        }
-
-        ctrl.id = V4L2_CID_CSC_EQ;
-        ctrl.value = gsc->v4l2_colorspace;
-        if (ioctl(gsc->gsc_fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-            ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CSC_EQ) fail", __func__);
-            return -1;
-        }
+        gsc->dst_info.dirty = 0;
 
-        ctrl.id = V4L2_CID_CSC_RANGE;
-        ctrl.value = gsc->range_full;
-        if (ioctl(gsc->gsc_fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-            ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CSC_RANGE) fail", __func__);
-            return -1;
-        }
+        /*
+         * set up csc equation property
+         */
+        if (!gsc->m_gsc_set_csc())
+            goto done;
     }
 
     /* if we are enabling drm, make sure to enable hw protection.
@@ -647,25 +921,105 @@ int CGscaler::m_gsc_m2m_wait_frame_done(void *handle)
         return -1;
     }
 
-    if (gsc->src_info.buf.buffer_queued) {
-        if (ioctl(gsc->gsc_fd, VIDIOC_DQBUF, &gsc->src_info.buf.buffer) < 0) {
-            ALOGE("%s::exynos_v4l2_dqbuf(src) fail", __func__);
-            return -1;
-        }
-        gsc->src_info.buf.buffer_queued = false;
+    if (gsc->m_gsc_m2m_dequeue(handle, true, GSC_M2M_MAX_QUEUED) < 0)
+        return -1;
+
+    Exynos_gsc_Out();
+
+    return 0;
+}
+
+int CGscaler::m_gsc_dqbuf(int fd, GscInfo *info, bool *error)
+{
+    struct v4l2_buffer buffer;
+    struct v4l2_plane planes[NUM_OF_GSC_PLANES];
+
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+
+    buffer.type     = info->buf.buf_type;
+    buffer.memory   = info->buf.mem_type;
+    buffer.m.planes = planes;
+    buffer.length   = info->format.fmt.pix_mp.num_planes;
+
+    if (ioctl(fd, VIDIOC_DQBUF, &buffer) < 0)
+        return -1;
+
+    info->buf.queued--;
+    if (error)
+        *error = !!(buffer.flags & V4L2_BUF_FLAG_ERROR);
+
+    return buffer.index;
+}
+
+/*
+ * Dequeues up to @max_frames finished frames in the order of queueing.
+ * If @block is false, only the frames already finished are dequeued.
+ */
+int CGscaler::m_gsc_m2m_dequeue(void *handle, bool block, unsigned int max_frames)
+{
+    CGscaler* gsc = GetGscaler(handle);
+    if (gsc == NULL) {
+        ALOGE("%s::handle == NULL() fail", __func__);
+        return -1;
     }
 
-    if (gsc->dst_info.buf.buffer_queued) {
-        if (ioctl(gsc->gsc_fd, VIDIOC_DQBUF, &gsc->dst_info.buf.buffer) < 0) {
-            ALOGE("%s::exynos_v4l2_dqbuf(dst) fail", __func__);
-            return -1;
+    int frames = 0;
+
+    while ((static_cast<unsigned int>(frames) < max_frames) &&
+           ((gsc->src_info.buf.queued > 0) || (gsc->dst_info.buf.queued > 0))) {
+        if (!block) {
+            struct pollfd pfd = {gsc->gsc_fd, POLLIN, 0};
+
+            if (poll(&pfd, 1, 0) <= 0)
+                break;
+        }
+
+        bool src_error = false, dst_error = false;
+
+        if (gsc->src_info.buf.queued > 0) {
+            if (m_gsc_dqbuf(gsc->gsc_fd, &gsc->src_info, &src_error) < 0) {
+                ALOGE("%s::exynos_v4l2_dqbuf(src) fail", __func__);
+                return -1;
+            }
+        }
+
+        if (gsc->dst_info.buf.queued > 0) {
+            int index = m_gsc_dqbuf(gsc->gsc_fd, &gsc->dst_info, &dst_error);
+            if (index < 0) {
+                ALOGE("%s::exynos_v4l2_dqbuf(dst) fail", __func__);
+                return -1;
+            }
+
+            if (gsc->done_callback && (index < GSC_M2M_MAX_QUEUED))
+                gsc->done_callback(gsc->done_callback_data, gsc->frame_id[index],
+                                   (src_error || dst_error) ? -EIO : 0);
         }
-        gsc->dst_info.buf.buffer_queued = false;
+
+        frames++;
     }
 
-    Exynos_gsc_Out();
+    return frames;
+}
 
-    return 0;
+/* tells the done callback that the frames still queued are dropped by STREAMOFF */
+void CGscaler::m_gsc_m2m_drop_queued(void)
+{
+    unsigned int count = dst_info.buf.count;
+
+    if (done_callback && (count > 0)) {
+        unsigned int queued = dst_info.buf.queued;
+        unsigned int index = (dst_info.buf.next_index + count - queued) % count;
+
+        for (; queued > 0; queued--, index = (index + 1) % count)
+            if (index < GSC_M2M_MAX_QUEUED)
+                done_callback(done_callback_data, frame_id[index], -ECANCELED);
+    }
+
+    src_info.buf.queued = 0;
+    src_info.buf.next_index = 0;
+    dst_info.buf.queued = 0;
+    dst_info.buf.next_index = 0;
 }
 
 bool CGscaler::m_gsc_set_format(int fd, GscInfo *info)
@@ -681,28 +1035,10 @@ bool CGscaler::m_gsc_set_format(int fd, GscInfo *info)
         return false;
     }
 
-    struct v4l2_control ctrl;
-
-    ctrl.id = V4L2_CID_ROTATE;
-    ctrl.value = info->rotation;
-    if (ioctl(fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_ROTATE) fail", __func__);
-        return false;
-    }
-
-    ctrl.id = V4L2_CID_VFLIP;
-    ctrl.value = info->flip_horizontal;
-    if (ioctl(fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_VFLIP) fail", __func__);
+    if (!m_gsc_set_rotation(fd, info))
         return false;
-    }
 
-    ctrl.id = V4L2_CID_HFLIP;
-    ctrl.value = info->flip_vertical;
-    if (ioctl(fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_HFLIP) fail", __func__);
-        return false;
-    }
+    struct v4l2_control ctrl;
 
     info->format.type = info->buf.buf_type;
     info->format.fmt.pix_mp.width       = info->width;
@@ -716,16 +1052,11 @@ bool CGscaler::m_gsc_set_format(int fd, GscInfo *info)
         return false;
     }
 
-    info->crop.type     = info->buf.buf_type;
-    info->crop.c.left   = info->crop_left;
-    info->crop.c.top    = info->crop_top;
-    info->crop.c.width  = info->crop_width;
-    info->crop.c.height = info->crop_height;
-
-    if (ioctl(fd, VIDIOC_S_CROP, &info->crop) < 0) {
-        ALOGE("%s::exynos_v4l2_s_crop() fail", __func__);
+    if (!m_gsc_set_crop(fd, info))
         return false;
-    }
+
+    /* computed once here instead of for every frame queued */
+    m_gsc_cached_plane_size(info, info->v4l2_colorformat, info->width, info->height);
 
     ctrl.id = V4L2_CID_CACHEABLE;
     ctrl.value = info->cacheable;
@@ -734,69 +1065,77 @@ bool CGscaler::m_gsc_set_format(int fd, GscInfo *info)
         return false;
     }
 
-    req_buf.count  = 1;
+    /* more than one to queue the frames of exynos_gsc_run_async() */
+    req_buf.count  = GSC_M2M_MAX_QUEUED;
     req_buf.type   = info->buf.buf_type;
     req_buf.memory = info->buf.mem_type;
     if (ioctl(fd, VIDIOC_REQBUFS, &req_buf) < 0) {
         ALOGE("%s::exynos_v4l2_reqbufs() fail", __func__);
         return false;
     }
+    info->buf.count = (req_buf.count > 0) ? req_buf.count : 1;
+    info->buf.next_index = 0;
 
     Exynos_gsc_Out();
 
     return true;
 }
 
+bool CGscaler::m_gsc_set_crop(int fd, GscInfo *info)
+{
+    info->crop.type     = info->buf.buf_type;
+    info->crop.c.left   = info->crop_left;
+    info->crop.c.top    = info->crop_top;
+    info->crop.c.width  = info->crop_width;
+    info->crop.c.height = info->crop_height;
+
+    if (ioctl(fd, VIDIOC_S_CROP, &info->crop) < 0) {
+        ALOGE("%s::exynos_v4l2_s_crop() fail", __func__);
+        return false;
+    }
+
+    return true;
+}
+
+bool CGscaler::m_gsc_set_rotation(int fd, GscInfo *info)
+{
+    const gsc_ctrl ctrls[] = {
+        {V4L2_CID_ROTATE, static_cast<__s32>(info->rotation), "V4L2_CID_ROTATE"},
+        {V4L2_CID_VFLIP, static_cast<__s32>(info->flip_horizontal), "V4L2_CID_VFLIP"},
+        {V4L2_CID_HFLIP, static_cast<__s32>(info->flip_vertical), "V4L2_CID_HFLIP"},
+    };
+
+    return gsc_s_ctrls(fd, ctrls, sizeof(ctrls) / sizeof(ctrls[0]), __func__);
+}
+
 unsigned int CGscaler::m_gsc_get_plane_count(int v4l_pixel_format)
 {
-    int plane_count = 0;
-
-    switch (v4l_pixel_format) {
-    case V4L2_PIX_FMT_RGB32:
-    case V4L2_PIX_FMT_BGR32:
-    case V4L2_PIX_FMT_RGB24:
-    case V4L2_PIX_FMT_RGB565:
-    case V4L2_PIX_FMT_RGB555X:
-    case V4L2_PIX_FMT_RGB444:
-    case V4L2_PIX_FMT_YUYV:
-    case V4L2_PIX_FMT_UYVY:
-    case V4L2_PIX_FMT_NV16:
-    case V4L2_PIX_FMT_NV61:
-    case V4L2_PIX_FMT_YVU420:
-    case V4L2_PIX_FMT_YUV420:
-    case V4L2_PIX_FMT_NV12:
-    case V4L2_PIX_FMT_NV21:
-    case V4L2_PIX_FMT_YUV422P:
-        plane_count = 1;
-        break;
-    case V4L2_PIX_FMT_NV12M:
-    case V4L2_PIX_FMT_NV12MT_16X16:
-    case V4L2_PIX_FMT_NV21M:
-        plane_count = 2;
-        break;
-    case V4L2_PIX_FMT_YVU420M:
-    case V4L2_PIX_FMT_YUV420M:
-        plane_count = 3;
-        break;
-    default:
+    const struct gsc_format_desc *desc = gsc_find_format(v4l_pixel_format);
+
+    if (!desc || desc->comps == 0) {
         ALOGE("%s::unmatched v4l_pixel_format color_space(0x%x)\n",
              __func__, v4l_pixel_format);
-        plane_count = -1;
-        break;
+        return -1;
     }
 
-    return plane_count;
+    return desc->planes;
 }
 
 bool CGscaler::m_gsc_set_addr(int fd, GscInfo *info)
 {
     unsigned int i;
-    unsigned int plane_size[NUM_OF_GSC_PLANES];
+    static const unsigned int no_size[NUM_OF_GSC_PLANES] = {0, };
+    const unsigned int *plane_size = m_gsc_cached_plane_size(info,
+        info->v4l2_colorformat, info->width, info->height);
+
+    /* the driver takes the sizes of dma-bufs if they are not known */
+    if (plane_size == NULL)
+        plane_size = no_size;
 
-    CGscaler::m_gsc_get_plane_size(plane_size, info->width,
-                         info->height, info->v4l2_colorformat);
+    if (info->buf.count == 0)
+        info->buf.count = 1;
 
-    info->buf.buffer.index    = 0;
+    info->buf.buffer.index    = info->buf.next_index;
     info->buf.buffer.flags    = V4L2_BUF_FLAG_USE_SYNC;
     info->buf.buffer.type     = info->buf.buf_type;
     info->buf.buffer.memory   = info->buf.mem_type;
@@ -818,7 +1157,8 @@ bool CGscaler::m_gsc_set_addr(int fd, GscInfo *info)
         ALOGE("%s::exynos_v4l2_qbuf() fail", __func__);
         return false;
     }
-    info->buf.buffer_queued = true;
+    info->buf.queued++;
+    info->buf.next_index = (info->buf.next_index + 1) % info->buf.count;
 
     info->releaseFenceFd = info->buf.buffer.reserved;
 
@@ -831,83 +1171,44 @@ unsigned int CGscaler::m_gsc_get_plane_size(
     unsigned int  height,
     int           v4l_pixel_format)
 {
-    switch (v4l_pixel_format) {
-    /* 1 plane */
-    case V4L2_PIX_FMT_RGB32:
-    case V4L2_PIX_FMT_BGR32:
-        plane_size[0] = width * height * 4;
-        plane_size[1] = 0;
-        plane_size[2] = 0;
-        break;
-    case V4L2_PIX_FMT_RGB24:
-        plane_size[0] = width * height * 3;
-        plane_size[1] = 0;
-        plane_size[2] = 0;
-        break;
-    case V4L2_PIX_FMT_RGB565:
-    case V4L2_PIX_FMT_RGB555X:
-    case V4L2_PIX_FMT_RGB444:
-    case V4L2_PIX_FMT_YUYV:
-    case V4L2_PIX_FMT_UYVY:
-        plane_size[0] = width * height * 2;
-        plane_size[1] = 0;
-        plane_size[2] = 0;
-        break;
-    /* 2 planes */
-    case V4L2_PIX_FMT_NV12M:
-    case V4L2_PIX_FMT_NV21M:
-        plane_size[0] = width * height;
-        plane_size[1] = width * (height / 2);
-        plane_size[2] = 0;
-        break;
-    case V4L2_PIX_FMT_NV12:
-    case V4L2_PIX_FMT_NV21:
-        plane_size[0] = width * height * 3 / 2;
-        plane_size[1] = 0;
-        plane_size[2] = 0;
-	break;
-    case V4L2_PIX_FMT_NV16:
-    case V4L2_PIX_FMT_NV61:
-    case V4L2_PIX_FMT_YUV422P:
-        plane_size[0] = width * height * 2;
-        plane_size[1] = 0;
-        plane_size[2] = 0;
-        break;
-    case V4L2_PIX_FMT_NV12MT_16X16:
-        plane_size[0] = ALIGN(width, 16) * ALIGN(height, 16);
-        plane_size[1] = ALIGN(width, 16) * ALIGN(height / 2, 8);
-        plane_size[2] = 0;
-        break;
-    /* 3 planes */
-    case V4L2_PIX_FMT_YUV420M:
-        plane_size[0] = width * height;
-        plane_size[1] = (width / 2) * (height / 2);
-        plane_size[2] = (width / 2) * (height / 2);
-        break;
-    case V4L2_PIX_FMT_YVU420:
-        plane_size[0] = ALIGN(width, 16) * height + ALIGN(width / 2, 16) * height;
-        plane_size[1] = 0;
-        plane_size[2] = 0;
-        break;
-    case V4L2_PIX_FMT_YUV420:
-        plane_size[0] = width * height * 3 / 2;
-        plane_size[1] = 0;
-        plane_size[2] = 0;
-        break;
-    case V4L2_PIX_FMT_YVU420M:
-        plane_size[0] = ALIGN(width, 16) * height;
-        plane_size[1] = ALIGN(width / 2, 16) * (height / 2);
-        plane_size[2] = plane_size[1];
-        break;
-    default:
+    const struct gsc_format_desc *desc = gsc_find_format(v4l_pixel_format);
+
+    for (unsigned int i = 0; i < NUM_OF_GSC_PLANES; i++)
+        plane_size[i] = 0;
+
+    if (!desc || desc->comps == 0) {
         ALOGE("%s::unmatched v4l_pixel_format color_space(0x%x)\n",
              __func__, v4l_pixel_format);
         return -1;
     }
 
+    for (unsigned int i = 0; i < desc->comps; i++) {
+        const struct gsc_plane_comp &comp = desc->comp[i];
+        unsigned int row = ALIGN((width >> comp.x_shift) * comp.bytes, comp.row_align);
+
+        plane_size[comp.plane] += row * ALIGN(height >> comp.y_shift, comp.rows_align);
+    }
+
     return 0;
 }
 
+const unsigned int *CGscaler::m_gsc_cached_plane_size(GscInfo *info,
+    int v4l_pixel_format, unsigned int width, unsigned int height)
+{
+    GscInfo::PlaneSizeCache &cache = info->plane_size;
+
+    if (cache.valid && cache.v4l2_colorformat == static_cast<unsigned int>(v4l_pixel_format) &&
+        cache.width == width && cache.height == height)
+        return cache.size;
+
+    cache.valid = m_gsc_get_plane_size(cache.size, width, height, v4l_pixel_format) == 0;
+    cache.v4l2_colorformat = v4l_pixel_format;
+    cache.width = width;
+    cache.height = height;
+
+    return cache.valid ? cache.size : NULL;
+}
+
 int CGscaler::m_gsc_m2m_config(void *handle,
     exynos_mpp_img *src_img, exynos_mpp_img *dst_img)
 {
@@ -1112,68 +1413,20 @@ int CGscaler::m_gsc_out_config(void *handle,
     }
 
     /*set GSC ctrls */
-    struct v4l2_control ctrl;
-
-    ctrl.id = V4L2_CID_ROTATE;
-    ctrl.value = rotate;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s:: exynos_v4l2_s_ctrl (V4L2_CID_ROTATE: %d) failed",
-            __func__,  rotate);
+    const gsc_ctrl ctrls[] = {
+        {V4L2_CID_ROTATE, static_cast<__s32>(rotate), "V4L2_CID_ROTATE"},
+        {V4L2_CID_HFLIP, static_cast<__s32>(vflip), "V4L2_CID_HFLIP"},
+        {V4L2_CID_VFLIP, static_cast<__s32>(hflip), "V4L2_CID_VFLIP"},
+        {V4L2_CID_CACHEABLE, 1, "V4L2_CID_CACHEABLE"},
+        {V4L2_CID_CONTENT_PROTECTION, static_cast<__s32>(gsc->src_img.drmMode),
+            "V4L2_CID_CONTENT_PROTECTION"},
+        {V4L2_CID_CSC_EQ_MODE, static_cast<__s32>(gsc->eq_auto), "V4L2_CID_CSC_EQ_MODE"},
+        {V4L2_CID_CSC_EQ, static_cast<__s32>(gsc->v4l2_colorspace), "V4L2_CID_CSC_EQ"},
+        {V4L2_CID_CSC_RANGE, static_cast<__s32>(gsc->range_full), "V4L2_CID_CSC_RANGE"},
+    };
+
+    if (!gsc_s_ctrls(gsc->mdev.gsc_vd_entity->fd, ctrls, sizeof(ctrls) / sizeof(ctrls[0]), __func__))
         return -1;
-    }
-
-    ctrl.id = V4L2_CID_HFLIP;
-    ctrl.value = vflip;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s:: exynos_v4l2_s_ctrl (V4L2_CID_HFLIP: %d) failed",
-            __func__,  vflip);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_VFLIP;
-    ctrl.value = hflip;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s:: exynos_v4l2_s_ctrl (V4L2_CID_VFLIP: %d) failed",
-            __func__,  hflip);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_CACHEABLE;
-    ctrl.value = 1;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s:: exynos_v4l2_s_ctrl (V4L2_CID_CACHEABLE: 1) failed",
-            __func__);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_CONTENT_PROTECTION;
-    ctrl.value = gsc->src_img.drmMode;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CONTENT_PROTECTION) fail",
-            __func__);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_CSC_EQ_MODE;
-    ctrl.value = gsc->eq_auto;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CSC_EQ_MODE) fail", __func__);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_CSC_EQ;
-    ctrl.value = gsc->v4l2_colorspace;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CSC_EQ) fail", __func__);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_CSC_RANGE;
-    ctrl.value = gsc->range_full;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CSC_RANGE) fail", __func__);
-        return -1;
-    }
 
       /* set src format  :GSC video dev*/
     fmt.type  = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
@@ -1257,55 +1510,18 @@ int CGscaler::m_gsc_cap_config(void *handle,
     }
 
     /*set GSC ctrls */
-    struct v4l2_control ctrl;
-
-    ctrl.id = V4L2_CID_ROTATE;
-    ctrl.value = rotate;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s:: exynos_v4l2_s_ctrl (V4L2_CID_ROTATE: %d) failed",
-            __func__,  rotate);
+    const gsc_ctrl ctrls[] = {
+        {V4L2_CID_ROTATE, static_cast<__s32>(rotate), "V4L2_CID_ROTATE"},
+        {V4L2_CID_HFLIP, static_cast<__s32>(vflip), "V4L2_CID_HFLIP"},
+        {V4L2_CID_VFLIP, static_cast<__s32>(hflip), "V4L2_CID_VFLIP"},
+        {V4L2_CID_CACHEABLE, 1, "V4L2_CID_CACHEABLE"},
+        {V4L2_CID_CONTENT_PROTECTION, static_cast<__s32>(gsc->src_img.drmMode),
+            "V4L2_CID_CONTENT_PROTECTION"},
+        {V4L2_CID_CSC_RANGE, static_cast<__s32>(gsc->range_full), "V4L2_CID_CSC_RANGE"},
+    };
+
+    if (!gsc_s_ctrls(gsc->mdev.gsc_vd_entity->fd, ctrls, sizeof(ctrls) / sizeof(ctrls[0]), __func__))
         return -1;
-    }
-
-    ctrl.id = V4L2_CID_HFLIP;
-    ctrl.value = vflip;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s:: exynos_v4l2_s_ctrl (V4L2_CID_HFLIP: %d) failed",
-            __func__,  vflip);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_VFLIP;
-    ctrl.value = hflip;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s:: exynos_v4l2_s_ctrl (V4L2_CID_VFLIP: %d) failed",
-            __func__,  hflip);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_CACHEABLE;
-    ctrl.value = 1;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s:: exynos_v4l2_s_ctrl (V4L2_CID_CACHEABLE: 1) failed",
-            __func__);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_CONTENT_PROTECTION;
-    ctrl.value = gsc->src_img.drmMode;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CONTENT_PROTECTION) fail",
-            __func__);
-        return -1;
-    }
-
-    ctrl.id = V4L2_CID_CSC_RANGE;
-    ctrl.value = gsc->range_full;
-    if (ioctl(gsc->mdev.gsc_vd_entity->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
-        ALOGE("%s::exynos_v4l2_s_ctrl(V4L2_CID_CSC_RANGE: %d) fail",
-            __func__, gsc->range_full);
-        return -1;
-    }
       /* set format: source pad of Decon-TV sub-dev*/
     sd_fmt.pad   = DECON_TV_WB_PAD;
     sd_fmt.which = V4L2_SUBDEV_FORMAT_ACTIVE;
@@ -1424,7 +1640,7 @@ void CGscaler::rotateValueHAL2GSC(unsigned int transform,
 }
 
 int CGscaler::m_gsc_m2m_run(void *handle,
-    exynos_mpp_img *src_img, exynos_mpp_img *dst_img)
+    exynos_mpp_img *src_img, exynos_mpp_img *dst_img, bool async)
 {
     Exynos_gsc_In();
 
@@ -1458,12 +1674,16 @@ int CGscaler::m_gsc_m2m_run(void *handle,
         return -1;
     }
 
-    ret = gsc->m_gsc_m2m_run_core(handle);
+    ret = gsc->m_gsc_m2m_run_core(handle, async);
      if (ret < 0) {
         ALOGE("%s::fail: m_gsc_m2m_run_core", __func__);
         return -1;
     }
 
+    int frame = gsc->next_frame_id++ & INT_MAX;
+    if (gsc->dst_info.buf.buffer.index < GSC_M2M_MAX_QUEUED)
+        gsc->frame_id[gsc->dst_info.buf.buffer.index] = frame;
+
     if (src_img->acquireFenceFd >= 0) {
         close(src_img->acquireFenceFd);
         src_img->acquireFenceFd = -1;
@@ -1479,7 +1699,7 @@ int CGscaler::m_gsc_m2m_run(void *handle,
 
     Exynos_gsc_Out();
 
-    return 0;
+    return async ? frame : 0;
 }
 
 int CGscaler::m_gsc_out_run(void *handle, exynos_mpp_img *src_img)
@@ -1489,7 +1709,7 @@ int CGscaler::m_gsc_out_run(void *handle, exynos_mpp_img *src_img)
     int32_t      src_color_space;
     int32_t      src_planes;
     unsigned int i;
-    unsigned int plane_size[NUM_OF_GSC_PLANES];
+    const unsigned int *plane_size;
     int ret = 0;
     unsigned int dq_retry_cnt = 0;
 
@@ -1553,8 +1773,9 @@ int CGscaler::m_gsc_out_run(void *handle, exynos_mpp_img *src_img)
     gsc->src_info.buf.addr[1] = (void*)src_img->uaddr;
     gsc->src_info.buf.addr[2] = (void*)src_img->vaddr;
 
-    if (CGscaler::tmp_get_plane_size(src_color_space, plane_size,
-        gsc->src_img.fw,  gsc->src_img.fh, src_planes) != true) {
+    plane_size = m_gsc_cached_plane_size(&gsc->src_info, src_color_space,
+        gsc->src_img.fw, gsc->src_img.fh);
+    if (plane_size == NULL) {
         ALOGE("%s:get_plane_size:fail", __func__);
         return -1;
     }
@@ -1595,7 +1816,7 @@ int CGscaler::m_gsc_cap_run(void *handle, exynos_mpp_img *dst_img)
     int32_t      dst_color_space;
     int32_t      dst_planes;
     unsigned int i;
-    unsigned int plane_size[NUM_OF_GSC_PLANES];
+    const unsigned int *plane_size;
     CGscaler* gsc = GetGscaler(handle);
     if (gsc == NULL) {
         ALOGE("%s::handle == NULL() fail", __func__);
@@ -1647,8 +1868,9 @@ int CGscaler::m_gsc_cap_run(void *handle, exynos_mpp_img *dst_img)
     gsc->dst_info.buf.addr[1] = (void*)dst_img->uaddr;
     gsc->dst_info.buf.addr[2] = (void*)dst_img->vaddr;
 
-    if (CGscaler::tmp_get_plane_size(dst_color_space, plane_size,
-        gsc->dst_img.fw,  gsc->dst_img.fh, dst_planes) != true) {
+    plane_size = m_gsc_cached_plane_size(&gsc->dst_info, dst_color_space,
+        gsc->dst_img.fw, gsc->dst_img.fh);
+    if (plane_size == NULL) {
         ALOGE("%s:get_plane_size:fail", __func__);
         return -1;
     }
@@ -1684,68 +1906,6 @@ int CGscaler::m_gsc_cap_run(void *handle, exynos_mpp_img *dst_img)
     return 0;
 }
 
-bool CGscaler::tmp_get_plane_size(int V4L2_PIX,
-    unsigned int * size, unsigned int width, unsigned int height, int src_planes)
-{
-    unsigned int frame_ratio = 1;
-    int src_bpp    = gsc_get_yuv_bpp(V4L2_PIX);
-    unsigned int frame_size = width * height;
-
-    src_planes = (src_planes == -1) ? 1 : src_planes;
-    frame_ratio = 8 * (src_planes -1) / (src_bpp - 8);
-
-    switch (src_planes) {
-    case 1:
-        switch (V4L2_PIX) {
-        case V4L2_PIX_FMT_BGR32:
-        case V4L2_PIX_FMT_RGB32:
-            size[0] = frame_size << 2;
-            break;
-	case V4L2_PIX_FMT_RGB565:
-        case V4L2_PIX_FMT_NV16:
-        case V4L2_PIX_FMT_NV61:
-        case V4L2_PIX_FMT_YUYV:
-        case V4L2_PIX_FMT_UYVY:
-        case V4L2_PIX_FMT_VYUY:
-        case V4L2_PIX_FMT_YVYU:
-            size[0] = frame_size << 1;
-            break;
-        case V4L2_PIX_FMT_YUV420:
-        case V4L2_PIX_FMT_NV12:
-        case V4L2_PIX_FMT_NV21:
-        case V4L2_PIX_FMT_NV21M:
-            size[0] = (frame_size * 3) >> 1;
-            break;
-        case V4L2_PIX_FMT_YVU420:
-            size[0] = frame_size + (ALIGN((width >> 1), 16) * ((height >> 1) * 2));
-            break;
-        default:
-            ALOGE("%s::invalid color type (%x)", __func__, V4L2_PIX);
-            return false;
-            break;
-        }
-        size[1] = 0;
-        size[2] = 0;
-        break;
-    case 2:
-        size[0] = frame_size;
-        size[1] = frame_size / frame_ratio;
-        size[2] = 0;
-        break;
-    case 3:
-        size[0] = frame_size;
-        size[1] = frame_size / frame_ratio;
-        size[2] = frame_size / frame_ratio;
-        break;
-    default:
-        ALOGE("%s::invalid color foarmt", __func__);
-        return false;
-        break;
-    }
-
-    return true;
-}
-
 int CGscaler::ConfigMpp(void *handle, exynos_mpp_img *src,
 					exynos_mpp_img *dst)
 {
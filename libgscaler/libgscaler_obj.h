@@ -90,6 +90,12 @@ extern "C" {
 #define MAX_GSC_WAITING_TIME_FOR_TRYLOCK (16000) // 16msec
 #define GSC_WAITING_TIME_FOR_TRYLOCK      (8000) //  8msec
 
+/* the changes of the configuration to apply at the next run */
+#define GSC_DIRTY_FORMAT    (1 << 0) /* size, format, cacheable or drm that restarts streaming */
+#define GSC_DIRTY_CROP      (1 << 1)
+#define GSC_DIRTY_ROTATION  (1 << 2)
+#define GSC_DIRTY_CSC       (1 << 3)
+
 typedef struct GscalerInfo {
     unsigned int width;
     unsigned int height;
@@ -107,7 +113,14 @@ typedef struct GscalerInfo {
     int acquireFenceFd;
     int releaseFenceFd;
     bool stream_on;
-    bool dirty;
+    unsigned int dirty;  /* GSC_DIRTY_* */
+    struct PlaneSizeCache {
+        bool valid;
+        unsigned int v4l2_colorformat;
+        unsigned int width;
+        unsigned int height;
+        unsigned int size[NUM_OF_GSC_PLANES];
+    }plane_size;  /* of the image last queued */
     struct v4l2_format format;
     struct v4l2_crop crop;
     struct Buffer_Info {
@@ -115,7 +128,9 @@ typedef struct GscalerInfo {
         enum v4l2_buf_type buf_type;
         void *addr[NUM_OF_GSC_PLANES];
         struct v4l2_plane planes[NUM_OF_GSC_PLANES];
-        bool buffer_queued;
+        unsigned int queued;      /* buffers owned by the driver */
+        unsigned int count;       /* buffers allocated by VIDIOC_REQBUFS */
+        unsigned int next_index;  /* index of the buffer to queue next */
         struct v4l2_buffer buffer;
         int buf_idx;
     }buf;
@@ -146,11 +161,20 @@ public:
     unsigned int range_full;        /* 0: narrow, 1: full */
     unsigned int v4l2_colorspace;   /* 1: 601, 3: 709, see csc.h or videodev2.h */
     void *scaler;
+    exynos_gsc_done_callback done_callback;
+    void *done_callback_data;
+    int frame_id[GSC_M2M_MAX_QUEUED]; /* of the queued dst buffer index */
+    int next_frame_id;
+    bool no_live_update; /* the driver rejected a change while streaming */
 
     void __InitMembers(int __mode, int __out_mode, int __gsc_id,int __allow_drm)
     {
         memset(&mdev, 0, sizeof(mdev));
         scaler = NULL;
+        done_callback = NULL;
+        done_callback_data = NULL;
+        next_frame_id = 0;
+        no_live_update = false;
 
         mode = __mode;
         out_mode = __out_mode;
@@ -217,8 +241,12 @@ public:
     int m_gsc_out_stop(void *handle);
     int m_gsc_cap_stop(void *handle);
     int m_gsc_m2m_stop(void *handle);
-    int m_gsc_m2m_run_core(void *handle);
+    int m_gsc_m2m_streamoff(void *handle);
+    bool m_gsc_m2m_update_live(void *handle, unsigned int dirty);
+    int m_gsc_m2m_run_core(void *handle, bool async = false);
     int m_gsc_m2m_wait_frame_done(void *handle);
+    int m_gsc_m2m_dequeue(void *handle, bool block, unsigned int max_frames);
+    void m_gsc_m2m_drop_queued(void);
     int m_gsc_m2m_config(void *handle,
         exynos_mpp_img *src_img, exynos_mpp_img *dst_img);
     int m_gsc_out_config(void *handle,
@@ -226,15 +254,21 @@ public:
     int m_gsc_cap_config(void *handle,
         exynos_mpp_img *src_img, exynos_mpp_img *dst_img);
     int m_gsc_m2m_run(void *handle,
-        exynos_mpp_img *src_img, exynos_mpp_img *dst_img);
+        exynos_mpp_img *src_img, exynos_mpp_img *dst_img, bool async = false);
     int m_gsc_out_run(void *handle, exynos_mpp_img *src_img);
     int m_gsc_cap_run(void *handle, exynos_mpp_img *dst_img);
     static bool m_gsc_set_format(int fd, GscInfo *info);
+    static bool m_gsc_set_crop(int fd, GscInfo *info);
+    static bool m_gsc_set_rotation(int fd, GscInfo *info);
+    bool m_gsc_set_csc(void);
     static unsigned int m_gsc_get_plane_count(int v4l_pixel_format);
     static bool m_gsc_set_addr(int fd, GscInfo *info);
+    static int m_gsc_dqbuf(int fd, GscInfo *info, bool *error);
     static unsigned int m_gsc_get_plane_size(
         unsigned int *plane_size, unsigned int width,
         unsigned int height, int v4l_pixel_format);
+    static const unsigned int *m_gsc_cached_plane_size(GscInfo *info,
+        int v4l_pixel_format, unsigned int width, unsigned int height);
     static bool m_gsc_check_src_size(unsigned int *w, unsigned int *h,
         unsigned int *crop_x, unsigned int *crop_y,
         unsigned int *crop_w, unsigned int *crop_h,
@@ -246,8 +280,6 @@ public:
     static int m_gsc_multiple_of_n(int number, int N);
     static void rotateValueHAL2GSC(unsigned int transform,
         unsigned int *rotate, unsigned int *hflip, unsigned int *vflip);
-    static bool tmp_get_plane_size(int V4L2_PIX,
-        unsigned int * size, unsigned int width, unsigned int height, int src_planes);
 };
 
 inline CGscaler *GetGscaler(void* handle)
@@ -27,6 +27,7 @@ LOCAL_C_INCLUDES += \
 
 LOCAL_SRC_FILES := \
 	libdrmresource/utils/worker.cpp \
+	libdrmresource/utils/threadpolicy.cpp \
 	libdrmresource/drm/resourcemanager.cpp \
 	libdrmresource/drm/drmdevice.cpp \
 	libdrmresource/drm/drmconnector.cpp \
@@ -100,6 +101,8 @@ LOCAL_C_INCLUDES += \
 LOCAL_SRC_FILES := \
 	libhwchelper/ExynosHWCHelper.cpp \
 	ExynosHWCDebug.cpp \
+	ExynosHWCRecorder.cpp \
+	ExynosHWCTrace.cpp \
 	libdevice/ExynosDisplay.cpp \
 	libdevice/ExynosDevice.cpp \
 	libdevice/ExynosLayer.cpp \
@@ -238,7 +241,8 @@ LOCAL_C_INCLUDES += \
 	$(TOP)/hardware/google/graphics/$(TARGET_BOARD_PLATFORM)/libhwc2.1/libdevice \
 	$(TOP)/hardware/google/graphics/$(TARGET_BOARD_PLATFORM)/libhwc2.1/libresource \
 	$(TOP)/hardware/google/graphics/common/libhwc2.1/libhwcService \
-	$(TOP)/hardware/google/graphics/common/libhwc2.1/libdisplayinterface
+	$(TOP)/hardware/google/graphics/common/libhwc2.1/libdisplayinterface \
+	$(TOP)/hardware/google/graphics/common/libhwc2.1/libdrmresource/include
 
 LOCAL_SRC_FILES := \
 	ExynosHWC.cpp
@@ -251,3 +255,52 @@ LOCAL_MODULE_TAGS := optional
 
 include $(TOP)/hardware/google/graphics/common/BoardConfigCFlags.mk
 include $(BUILD_SHARED_LIBRARY)
+
+################################################################################
+
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils libhardware libvendorgraphicbuffer
+LOCAL_HEADER_LIBRARIES := libgralloc_headers
+LOCAL_PROPRIETARY_MODULE := true
+
+LOCAL_C_INCLUDES += \
+	$(TOP)/hardware/google/graphics/common/libhwc2.1 \
+	$(TOP)/hardware/google/graphics/common/libhwc2.1/libdrmresource/include
+
+LOCAL_CFLAGS := -DLOG_TAG=\"hwcreplay\"
+
+LOCAL_SRC_FILES := \
+	hwcreplay/hwcreplay.cpp
+
+LOCAL_MODULE := hwcreplay
+LOCAL_LICENSE_KINDS := SPDX-license-identifier-Apache-2.0
+LOCAL_LICENSE_CONDITIONS := notice
+LOCAL_NOTICE_FILE := $(LOCAL_PATH)/NOTICE
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+################################################################################
+
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils libhardware libvendorgraphicbuffer
+LOCAL_HEADER_LIBRARIES := libgralloc_headers google_hal_headers
+LOCAL_PROPRIETARY_MODULE := true
+
+LOCAL_C_INCLUDES += \
+	$(TOP)/hardware/google/graphics/common/include
+
+LOCAL_CFLAGS := -Werror
+
+LOCAL_SRC_FILES := \
+	test/resource_benchmark_test.cpp
+
+LOCAL_MODULE := hwc_resource_benchmark
+LOCAL_LICENSE_KINDS := SPDX-license-identifier-Apache-2.0
+LOCAL_LICENSE_CONDITIONS := notice
+LOCAL_NOTICE_FILE := $(LOCAL_PATH)/NOTICE
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_NATIVE_TEST)
@@ -23,6 +23,8 @@
 
 #include "ExynosHWC.h"
 #include "ExynosHWCModule.h"
+#include "ExynosHWCRecorder.h"
+#include "ExynosHWCTrace.h"
 #include "ExynosHWCService.h"
 #include "ExynosDisplay.h"
 #include "ExynosLayer.h"
@@ -204,6 +206,7 @@ void exynos_dump(hwc2_device_t *dev, uint32_t *outSize, char *outBuffer)
 
 int32_t exynos_acceptDisplayChanges(hwc2_device_t *dev, hwc2_display_t display)
 {
+    HWC_RECORD(HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES, display, 0, nullptr, 0);
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -225,8 +228,12 @@ int32_t exynos_createLayer(hwc2_device_t *dev,
 
     if (exynosDevice) {
         ExynosDisplay *exynosDisplay = checkDisplay(exynosDevice, display);
-        if (exynosDisplay)
-            return exynosDisplay->createLayer(outLayer);
+        if (exynosDisplay) {
+            int32_t ret = exynosDisplay->createLayer(outLayer);
+            if (ret == HWC2_ERROR_NONE)
+                HWC_RECORD(HWC2_FUNCTION_CREATE_LAYER, display, *outLayer, nullptr, 0);
+            return ret;
+        }
     }
 
     return HWC2_ERROR_BAD_DISPLAY;
@@ -253,6 +260,7 @@ int32_t exynos_createVirtualDisplay(hwc2_device_t *dev, uint32_t width, uint32_t
 int32_t exynos_destroyLayer(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer)
 {
+    HWC_RECORD(HWC2_FUNCTION_DESTROY_LAYER, display, layer, nullptr, 0);
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -510,6 +518,7 @@ int32_t exynos_getReleaseFences(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_presentDisplay(hwc2_device_t *dev, hwc2_display_t display,
         int32_t* outRetireFence)
 {
+    HWC_RECORD(HWC2_FUNCTION_PRESENT_DISPLAY, display, 0, nullptr, 0);
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -566,6 +575,7 @@ int32_t exynos_registerCallback(hwc2_device_t* dev,
 int32_t exynos_setActiveConfig(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_config_t config)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_ACTIVE_CONFIG, display, 0, &config, sizeof(config));
     HDEBUGLOGD(eDebugDisplayConfig, "%s, %d",__func__, config);
 
     ExynosDevice *exynosDevice = checkDevice(dev);
@@ -583,6 +593,7 @@ int32_t exynos_setClientTarget(hwc2_device_t *dev, hwc2_display_t display,
         buffer_handle_t target, int32_t acquireFence,
         int32_t /*android_dataspace_t*/ dataspace, hwc_region_t __unused damage)
 {
+    HWC_RECORD_BUFFER(HWC2_FUNCTION_SET_CLIENT_TARGET, display, 0, target, acquireFence, dataspace);
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -599,6 +610,7 @@ int32_t exynos_setColorMode(hwc2_device_t *dev, hwc2_display_t display, int32_t
     if (mode < 0)
         return HWC2_ERROR_BAD_PARAMETER;
 
+    HWC_RECORD(HWC2_FUNCTION_SET_COLOR_MODE, display, 0, &mode, sizeof(mode));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -616,6 +628,17 @@ int32_t exynos_setColorTransform(hwc2_device_t *dev, hwc2_display_t display,
     if (matrix == nullptr)
         return HWC2_ERROR_BAD_PARAMETER;
 
+    if (ExynosHWCRecorder::isEnabled()) {
+        struct {
+            float matrix[16];
+            int32_t hint;
+        } payload;
+        memcpy(payload.matrix, matrix, sizeof(payload.matrix));
+        payload.hint = hint;
+        ExynosHWCRecorder::getInstance().record(HWC2_FUNCTION_SET_COLOR_TRANSFORM, display, 0,
+                &payload, sizeof(payload));
+    }
+
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -647,6 +670,7 @@ int32_t exynos_setCursorPosition(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerBlendMode(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, int32_t /*hwc2_blend_mode_t*/ mode)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_BLEND_MODE, display, layer, &mode, sizeof(mode));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -664,12 +688,13 @@ int32_t exynos_setLayerBlendMode(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerBuffer(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, buffer_handle_t buffer, int32_t acquireFence)
 {
+    HWC_RECORD_BUFFER(HWC2_FUNCTION_SET_LAYER_BUFFER, display, layer, buffer, acquireFence, -1);
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
         ExynosDisplay *exynosDisplay = checkDisplay(exynosDevice, display);
         if (exynosDisplay) {
-            Mutex::Autolock lock(exynosDisplay->mDisplayMutex);
+            TimedMutex::Autolock lock(exynosDisplay->mDisplayMutex);
             ExynosLayer *exynosLayer = checkLayer(exynosDisplay, layer);
             if (exynosLayer)
                 return exynosLayer->setLayerBuffer(buffer, acquireFence);
@@ -682,6 +707,7 @@ int32_t exynos_setLayerBuffer(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerColor(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, hwc_color_t color)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_COLOR, display, layer, &color, sizeof(color));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -699,6 +725,7 @@ int32_t exynos_setLayerColor(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerCompositionType(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, int32_t /*hwc2_composition_t*/ type)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE, display, layer, &type, sizeof(type));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -715,12 +742,13 @@ int32_t exynos_setLayerCompositionType(hwc2_device_t *dev, hwc2_display_t displa
 
 int32_t exynos_setLayerDataspace(hwc2_device_t *dev, hwc2_display_t display, hwc2_layer_t layer, int32_t dataspace)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_DATASPACE, display, layer, &dataspace, sizeof(dataspace));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
         ExynosDisplay *exynosDisplay = checkDisplay(exynosDevice, display);
         if (exynosDisplay) {
-            Mutex::Autolock lock(exynosDisplay->mDisplayMutex);
+            TimedMutex::Autolock lock(exynosDisplay->mDisplayMutex);
             ExynosLayer *exynosLayer = checkLayer(exynosDisplay, layer);
             if (exynosLayer)
                 return exynosLayer->setLayerDataspace(dataspace);
@@ -733,6 +761,7 @@ int32_t exynos_setLayerDataspace(hwc2_device_t *dev, hwc2_display_t display, hwc
 int32_t exynos_setLayerDisplayFrame(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, hwc_rect_t frame)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME, display, layer, &frame, sizeof(frame));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -750,6 +779,7 @@ int32_t exynos_setLayerDisplayFrame(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerPlaneAlpha(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, float alpha)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA, display, layer, &alpha, sizeof(alpha));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -774,6 +804,7 @@ int32_t exynos_setLayerSidebandStream(hwc2_device_t __unused *dev, hwc2_display_
 int32_t exynos_setLayerSourceCrop(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, hwc_frect_t crop)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_SOURCE_CROP, display, layer, &crop, sizeof(crop));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -791,6 +822,7 @@ int32_t exynos_setLayerSourceCrop(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerSurfaceDamage(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, hwc_region_t damage)
 {
+    HWC_RECORD_REGION(HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE, display, layer, damage);
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -808,6 +840,7 @@ int32_t exynos_setLayerSurfaceDamage(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerTransform(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, int32_t /*hwc_transform_t*/ transform)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_TRANSFORM, display, layer, &transform, sizeof(transform));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -825,6 +858,7 @@ int32_t exynos_setLayerTransform(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerVisibleRegion(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, hwc_region_t visible)
 {
+    HWC_RECORD_REGION(HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION, display, layer, visible);
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -842,6 +876,7 @@ int32_t exynos_setLayerVisibleRegion(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setLayerZOrder(hwc2_device_t *dev, hwc2_display_t display,
         hwc2_layer_t layer, uint32_t z)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_LAYER_Z_ORDER, display, layer, &z, sizeof(z));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -876,6 +911,7 @@ int32_t exynos_setPowerMode(hwc2_device_t *dev, hwc2_display_t display,
     if (mode < 0)
         return HWC2_ERROR_BAD_PARAMETER;
 
+    HWC_RECORD(HWC2_FUNCTION_SET_POWER_MODE, display, 0, &mode, sizeof(mode));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -891,6 +927,7 @@ int32_t exynos_setPowerMode(hwc2_device_t *dev, hwc2_display_t display,
 int32_t exynos_setVsyncEnabled(hwc2_device_t *dev, hwc2_display_t display,
         int32_t /*hwc2_vsync_t*/ enabled)
 {
+    HWC_RECORD(HWC2_FUNCTION_SET_VSYNC_ENABLED, display, 0, &enabled, sizeof(enabled));
     ExynosDevice *exynosDevice = checkDevice(dev);
 
     if (exynosDevice) {
@@ -913,6 +950,11 @@ int32_t exynos_validateDisplay(hwc2_device_t *dev, hwc2_display_t display,
             return HWC2_ERROR_BAD_DISPLAY;
         int32_t ret = exynosDisplay->validateDisplay(outNumTypes, outNumRequests);
         exynosDisplay->mHWCRenderingState = RENDERING_STATE_VALIDATED;
+        if (ExynosHWCRecorder::isEnabled()) {
+            uint32_t counts[2] = {*outNumTypes, *outNumRequests};
+            ExynosHWCRecorder::getInstance().record(HWC2_FUNCTION_VALIDATE_DISPLAY, display, 0,
+                    counts, sizeof(counts));
+        }
         return ret;
     }
 
@@ -1319,6 +1361,8 @@ int exynos_open(const struct hw_module_t *module, const char *name,
 
     dev->device = new ExynosDeviceModule;
     g_exynosDevice = dev->device;
+    ExynosHWCRecorder::getInstance().init();
+    ExynosHWCTrace::init();
 
     dev->base.common.tag = HARDWARE_DEVICE_TAG;
     dev->base.common.version = HWC_DEVICE_API_VERSION_2_0;
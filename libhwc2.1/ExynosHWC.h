@@ -41,8 +41,11 @@ enum {
     HWC_CTL_DISPLAY_MODE = 110,
     HWC_CTL_SKIP_RESOURCE_ASSIGN = 111,
     HWC_CTL_SKIP_VALIDATE = 112,
+    HWC_CTL_PARALLEL_VALIDATE = 113,
     HWC_CTL_DUMP_MID_BUF = 200,
     HWC_CTL_CAPTURE_READBACK = 201,
+    /* Reads back every Nth frame of the primary display to files, 0 stops */
+    HWC_CTL_READBACK_STREAM = 202,
     HWC_CTL_ENABLE_COMPOSITION_CROP = 300,
     HWC_CTL_ENABLE_EXYNOSCOMPOSITION_OPT = 301,
     HWC_CTL_ENABLE_CLIENTCOMPOSITION_OPT = 302,
@@ -53,6 +56,11 @@ enum {
     HWC_CTL_ENABLE_FENCE_TRACER = 307,
     HWC_CTL_DO_FENCE_FILE_DUMP = 308,
     HWC_CTL_SYS_FENCE_LOGGING = 309,
+    HWC_CTL_MERGE_M2M_LAYERS = 310,
+    /* Composition of low fps layers, see low_fps_layer_strategy_t */
+    HWC_CTL_LOW_FPS_LAYER_STRATEGY = 311,
+    HWC_CTL_MINIMAL_DOZE_COMPOSITION = 312,
+    HWC_CTL_GROUP_LAYERS_BY_OVERLAP = 313,
 };
 
 class ExynosDevice;
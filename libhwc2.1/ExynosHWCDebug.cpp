@@ -15,15 +15,120 @@
  */
 #include "ExynosHWCDebug.h"
 #include "ExynosDisplay.h"
+#include <cutils/properties.h>
 #include <sync/sync.h>
+#include <system/thread_defs.h>
+
+#include <atomic>
+#include <mutex>
+
 #include "exynos_sync.h"
+#include "worker.h"
 
 uint32_t mErrLogSize = 0;
 uint32_t mFenceLogSize = 0;
 
-int32_t saveErrorLog(const String8 &errString, ExynosDisplay *display)
+namespace {
+
+/*
+ * saveErrorLog() runs on the composition thread, so it only stores a compact
+ * record in a lock-free ring. ErrorLogWorker writes the records to
+ * hwc_error_log.txt in the same text format at a low priority.
+ */
+constexpr size_t kErrorLogRecordNum = 128;
+constexpr size_t kErrorLogMsgLen = 240;
+constexpr int64_t kErrorLogFlushPeriodNs = 500000000;
+
+struct ErrorLogRecord {
+    /* index + 1 when the record is complete, 0 while it is being written */
+    std::atomic<uint64_t> seq{0};
+    struct timeval tv;
+    uint64_t errorFrameCount;
+    char displayName[32];
+    char msg[kErrorLogMsgLen];
+};
+
+class ErrorLogWorker : public Worker {
+    public:
+        ErrorLogWorker()
+              : Worker("hwc-errlog", ThreadRole::BACKGROUND),
+                mMaxPerSec(property_get_int32("vendor.display.errlog.max_per_sec", 0)) {
+            InitWorker();
+        }
+        ~ErrorLogWorker() {
+            /* Stop Routine() before this object is gone */
+            Exit();
+            flush();
+        }
+
+        int32_t push(const String8 &errString, ExynosDisplay *display);
+        /* Write the pending records, returns the size of the log file */
+        int32_t flush();
+
+    protected:
+        void Routine() override;
+
+    private:
+        bool rateLimited(time_t sec);
+        int32_t writeRecords(const String8 &saveString);
+
+        ErrorLogRecord mRecords[kErrorLogRecordNum];
+        std::atomic<uint64_t> mWriteIndex{0};
+        std::atomic<uint64_t> mDropped{0};
+        /* 0 means no rate limit */
+        const int32_t mMaxPerSec;
+        std::atomic<int64_t> mRateWindowSec{0};
+        std::atomic<uint32_t> mRateWindowCount{0};
+
+        /* Only for the readers of the ring */
+        std::mutex mFlushMutex;
+        uint64_t mReadIndex = 0;
+};
+
+bool ErrorLogWorker::rateLimited(time_t sec)
+{
+    if (mMaxPerSec <= 0)
+        return false;
+
+    int64_t windowSec = mRateWindowSec.load(std::memory_order_relaxed);
+    if ((windowSec != sec) &&
+        mRateWindowSec.compare_exchange_strong(windowSec, sec, std::memory_order_relaxed))
+        mRateWindowCount.store(0, std::memory_order_relaxed);
+
+    return mRateWindowCount.fetch_add(1, std::memory_order_relaxed) >= (uint32_t)mMaxPerSec;
+}
+
+int32_t ErrorLogWorker::push(const String8 &errString, ExynosDisplay *display)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    if (rateLimited(tv.tv_sec)) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    uint64_t index = mWriteIndex.fetch_add(1, std::memory_order_relaxed);
+    ErrorLogRecord &record = mRecords[index % kErrorLogRecordNum];
+
+    record.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.tv = tv;
+    if (display != NULL) {
+        strlcpy(record.displayName, display->mDisplayName.string(), sizeof(record.displayName));
+        record.errorFrameCount = display->mErrorFrameCount;
+    } else {
+        record.displayName[0] = '\0';
+        record.errorFrameCount = 0;
+    }
+    strlcpy(record.msg, errString.string(), sizeof(record.msg));
+    record.seq.store(index + 1, std::memory_order_release);
+
+    return NO_ERROR;
+}
+
+int32_t ErrorLogWorker::writeRecords(const String8 &saveString)
 {
-    int32_t ret = NO_ERROR;
     if (mErrLogSize >= ERR_LOG_SIZE)
         return -1;
 
@@ -43,39 +148,111 @@ int32_t saveErrorLog(const String8 &errString, ExynosDisplay *display)
 
     mErrLogSize = ftell(pFile);
     if (mErrLogSize >= ERR_LOG_SIZE) {
-        if (pFile != NULL)
-            fclose(pFile);
+        fclose(pFile);
         return -1;
     }
 
+    fwrite(saveString.string(), 1, saveString.size(), pFile);
+    mErrLogSize = (uint32_t)ftell(pFile);
+    fclose(pFile);
+
+    return mErrLogSize;
+}
+
+int32_t ErrorLogWorker::flush()
+{
+    std::lock_guard<std::mutex> lock(mFlushMutex);
+
     String8 saveString;
-    struct timeval tv;
-    struct tm* localTime;
-    gettimeofday(&tv, NULL);
-    localTime = (struct tm*)localtime((time_t*)&tv.tv_sec);
+    uint64_t writeIndex = mWriteIndex.load(std::memory_order_acquire);
+    uint64_t dropped = mDropped.exchange(0, std::memory_order_relaxed);
 
-    if (display != NULL) {
-        saveString.appendFormat("%02d-%02d %02d:%02d:%02d.%03lu(%lu) %s %" PRIu64 ": %s\n",
-                localTime->tm_mon+1, localTime->tm_mday,
-                localTime->tm_hour, localTime->tm_min,
-                localTime->tm_sec, tv.tv_usec/1000, ((tv.tv_sec * 1000) + (tv.tv_usec / 1000)),
-                display->mDisplayName.string(), display->mErrorFrameCount,
-                errString.string());
-    } else {
-        saveString.appendFormat("%02d-%02d %02d:%02d:%02d.%03lu(%lu) : %s\n",
-                localTime->tm_mon+1, localTime->tm_mday,
-                localTime->tm_hour, localTime->tm_min,
-                localTime->tm_sec, tv.tv_usec/1000, ((tv.tv_sec * 1000) + (tv.tv_usec / 1000)),
-                errString.string());
+    /* Records overwritten before they were read */
+    if (writeIndex - mReadIndex > kErrorLogRecordNum) {
+        dropped += writeIndex - mReadIndex - kErrorLogRecordNum;
+        mReadIndex = writeIndex - kErrorLogRecordNum;
     }
 
-    if (pFile != NULL) {
-        fwrite(saveString.string(), 1, saveString.size(), pFile);
-        mErrLogSize = (uint32_t)ftell(pFile);
-        ret = mErrLogSize;
-        fclose(pFile);
+    for (; mReadIndex < writeIndex; mReadIndex++) {
+        ErrorLogRecord &record = mRecords[mReadIndex % kErrorLogRecordNum];
+        if (record.seq.load(std::memory_order_acquire) != mReadIndex + 1) {
+            /* Still being written, read it next time */
+            if (mWriteIndex.load(std::memory_order_relaxed) - mReadIndex <= kErrorLogRecordNum)
+                break;
+            dropped++;
+            continue;
+        }
+
+        ErrorLogRecord copy;
+        copy.tv = record.tv;
+        copy.errorFrameCount = record.errorFrameCount;
+        memcpy(copy.displayName, record.displayName, sizeof(copy.displayName));
+        memcpy(copy.msg, record.msg, sizeof(copy.msg));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (record.seq.load(std::memory_order_relaxed) != mReadIndex + 1) {
+            dropped++;
+            continue;
+        }
+        copy.displayName[sizeof(copy.displayName) - 1] = '\0';
+        copy.msg[sizeof(copy.msg) - 1] = '\0';
+
+        struct tm localTime;
+        localtime_r(&copy.tv.tv_sec, &localTime);
+        if (copy.displayName[0] != '\0') {
+            saveString.appendFormat("%02d-%02d %02d:%02d:%02d.%03lu(%lu) %s %" PRIu64 ": %s\n",
+                    localTime.tm_mon+1, localTime.tm_mday,
+                    localTime.tm_hour, localTime.tm_min,
+                    localTime.tm_sec, copy.tv.tv_usec/1000,
+                    ((copy.tv.tv_sec * 1000) + (copy.tv.tv_usec / 1000)),
+                    copy.displayName, copy.errorFrameCount, copy.msg);
+        } else {
+            saveString.appendFormat("%02d-%02d %02d:%02d:%02d.%03lu(%lu) : %s\n",
+                    localTime.tm_mon+1, localTime.tm_mday,
+                    localTime.tm_hour, localTime.tm_min,
+                    localTime.tm_sec, copy.tv.tv_usec/1000,
+                    ((copy.tv.tv_sec * 1000) + (copy.tv.tv_usec / 1000)), copy.msg);
+        }
     }
-    return ret;
+
+    if (dropped)
+        saveString.appendFormat("%" PRIu64 " error log(s) dropped\n", dropped);
+
+    if (saveString.size() == 0)
+        return mErrLogSize;
+
+    return writeRecords(saveString);
+}
+
+void ErrorLogWorker::Routine()
+{
+    Lock();
+    int ret = WaitForSignalOrExitLocked(kErrorLogFlushPeriodNs);
+    Unlock();
+    if (ret == -EINTR)
+        return;
+
+    flush();
+}
+
+ErrorLogWorker &errorLogWorker()
+{
+    static ErrorLogWorker worker;
+    return worker;
+}
+
+} // namespace
+
+int32_t saveErrorLog(const String8 &errString, ExynosDisplay *display)
+{
+    if (mErrLogSize >= ERR_LOG_SIZE)
+        return -1;
+
+    return errorLogWorker().push(errString, display);
+}
+
+int32_t flushErrorLog()
+{
+    return errorLogWorker().flush();
 }
 
 int32_t saveFenceTrace(ExynosDisplay *display) {
@@ -106,7 +283,6 @@ int32_t saveFenceTrace(ExynosDisplay *display) {
     }
 
     String8 saveString;
-    struct timeval tv;
 
     ExynosDevice *device = display->mDevice;
     hwc_fence_info_t* _info = device->mFenceInfo;
@@ -147,22 +323,18 @@ int32_t saveFenceTrace(ExynosDisplay *display) {
             case FENCE_FROM:
                 saveString.appendFormat("Last state : from %d, %d\n",
                         info.from.type, info.from.ip);
-                tv = info.from.time;
                 break;
             case FENCE_TO:
                 saveString.appendFormat("Last state : to %d, %d\n",
                         info.to.type, info.to.ip);
-                tv = info.to.time;
                 break;
             case FENCE_DUP:
                 saveString.appendFormat("Last state : dup %d, %d\n",
                         info.dup.type, info.dup.ip);
-                tv = info.dup.time;
                 break;
             case FENCE_CLOSE:
                 saveString.appendFormat("Last state : Close %d, %d\n",
                         info.close.type, info.close.ip);
-                tv = info.close.time;
                 break;
                 break;
             default:
@@ -170,19 +342,16 @@ int32_t saveFenceTrace(ExynosDisplay *display) {
                 break;
             }
 
-            struct tm* localTime = (struct tm*)localtime((time_t*)&tv.tv_sec);
-
             saveString.appendFormat("from : %d, %d (cur : %d), to : %d, %d (cur : %d), hwc_dup : %d, %d (cur : %d), hwc_close : %d, %d (cur : %d)\n",
                     info.from.type, info.from.ip, info.from.curFlag,
                     info.to.type, info.to.ip, info.to.curFlag,
                     info.dup.type, info.dup.ip, info.dup.curFlag,
                     info.close.type, info.close.ip, info.close.curFlag);
-            saveString.appendFormat("usage : %d, time:%02d-%02d %02d:%02d:%02d.%03lu(%lu)", info.usage,
-                    localTime->tm_mon+1, localTime->tm_mday,
-                    localTime->tm_hour, localTime->tm_min,
-                    localTime->tm_sec, tv.tv_usec/1000,
-                    ((tv.tv_sec * 1000) + (tv.tv_usec / 1000)));
+            saveString.appendFormat("usage : %d", info.usage);
         }
+
+        saveString.appendFormat("\n-- Recent fence events\n");
+        dumpFenceEvents(saveString);
     }
 
     if (pFile != NULL) {
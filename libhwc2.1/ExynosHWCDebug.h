@@ -63,11 +63,15 @@ inline int hwcCheckFenceDebug(ExynosDisplay *display, uint32_t fence_type, uint3
         return fence;
 }
 
+/* Queues the error for a background write to hwc_error_log.txt, it never blocks on I/O */
 int32_t saveErrorLog(const android::String8 &errString, ExynosDisplay *display = NULL);
+/* Writes the queued errors now, returns the size of the log file */
+int32_t flushErrorLog();
 int32_t saveFenceTrace(ExynosDisplay *display);
 
 #if defined(DISABLE_HWC_DEBUG)
 #define HDEBUGLOGD(...)
+#define HDEBUGLOGD_IF(...)
 #define HDEBUGLOGV(type,...) \
         ALOGV(__VA_ARGS__);
 #define HDEBUGLOGE(type,...) \
@@ -78,6 +82,12 @@ int32_t saveFenceTrace(ExynosDisplay *display);
         if (hwcCheckDebugMessages(type)) \
             ALOGD(__VA_ARGS__); \
     }
+/* For loops that checked the debug flag once with hwcCheckDebugMessages() */
+#define HDEBUGLOGD_IF(debug, ...) \
+    {\
+        if (debug) \
+            ALOGD(__VA_ARGS__); \
+    }
 #define HDEBUGLOGV(type, ...) \
         ALOGV(__VA_ARGS__);
 #define HDEBUGLOGE(type, ...) \
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ExynosHWCRecorder.h"
+
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <string.h>
+#include <utils/Timers.h>
+
+#include "VendorGraphicBuffer.h"
+
+using namespace android;
+using namespace vendor::graphics;
+
+std::atomic<bool> ExynosHWCRecorder::sEnabled(false);
+
+void ExynosHWCRecorder::init()
+{
+    if (!property_get_bool("vendor.display.hwc_record", false))
+        return;
+
+    mFile = fopen(HWC_RECORD_PATH, "w");
+    if (mFile == nullptr) {
+        ALOGE("%s:: failed to open %s: %s", __func__, HWC_RECORD_PATH, strerror(errno));
+        return;
+    }
+
+    hwc_record_file_header header = {HWC_RECORD_MAGIC, HWC_RECORD_VERSION};
+    fwrite(&header, sizeof(header), 1, mFile);
+
+    mPending.reserve(kWriteSize * 2);
+    mWriting.reserve(kWriteSize * 2);
+    InitWorker();
+    sEnabled = true;
+    ALOGI("%s:: recording HWC2 calls to %s", __func__, HWC_RECORD_PATH);
+}
+
+ExynosHWCRecorder::~ExynosHWCRecorder()
+{
+    sEnabled = false;
+    Exit();
+    if (mFile) {
+        writePending();
+        fclose(mFile);
+    }
+}
+
+void ExynosHWCRecorder::record(int32_t descriptor, hwc2_display_t display, hwc2_layer_t layer,
+        const void *payload, uint32_t size)
+{
+    hwc_record_header header = {
+        .descriptor = descriptor,
+        .size = payload ? size : 0,
+        .timestamp = (uint64_t)systemTime(SYSTEM_TIME_MONOTONIC),
+        .display = display,
+        .layer = layer,
+    };
+
+    Lock();
+    const uint8_t *h = reinterpret_cast<const uint8_t *>(&header);
+    mPending.insert(mPending.end(), h, h + sizeof(header));
+    if (header.size) {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(payload);
+        mPending.insert(mPending.end(), p, p + header.size);
+    }
+    bool write = mPending.size() >= kWriteSize;
+    Unlock();
+
+    if (write)
+        Signal();
+}
+
+void ExynosHWCRecorder::recordBuffer(int32_t descriptor, hwc2_display_t display,
+        hwc2_layer_t layer, buffer_handle_t buffer, int32_t acquireFence, int32_t dataspace)
+{
+    hwc_record_buffer info = {};
+
+    if (buffer != nullptr) {
+        VendorGraphicBufferMeta gmeta(buffer);
+        info.id = (uint64_t)(uintptr_t)buffer;
+        info.stride = gmeta.stride;
+        info.vstride = gmeta.vstride;
+        info.format = gmeta.format;
+        info.usage = gmeta.producer_usage;
+    }
+    info.dataspace = dataspace;
+    info.hasAcquireFence = (acquireFence >= 0);
+
+    record(descriptor, display, layer, &info, sizeof(info));
+}
+
+void ExynosHWCRecorder::recordRegion(int32_t descriptor, hwc2_display_t display,
+        hwc2_layer_t layer, const hwc_region_t &region)
+{
+    uint32_t size = (region.rects != nullptr) ? region.numRects * sizeof(hwc_rect_t) : 0;
+    record(descriptor, display, layer, region.rects, size);
+}
+
+void ExynosHWCRecorder::writePending()
+{
+    Lock();
+    mWriting.swap(mPending);
+    Unlock();
+
+    if (!mWriting.empty()) {
+        if (fwrite(mWriting.data(), 1, mWriting.size(), mFile) != mWriting.size())
+            ALOGE("%s:: failed to write %zu bytes", __func__, mWriting.size());
+        fflush(mFile);
+        mWriting.clear();
+    }
+}
+
+void ExynosHWCRecorder::Routine()
+{
+    Lock();
+    int ret = WaitForSignalOrExitLocked(kWritePeriodNs);
+    Unlock();
+    if (ret == -EINTR)
+        return;
+
+    writePending();
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HWC_RECORDER_H
+#define HWC_RECORDER_H
+
+#include <hardware/hwcomposer2.h>
+#include <stdint.h>
+#include <system/thread_defs.h>
+
+#include <atomic>
+#include <vector>
+
+#include "worker.h"
+
+/*
+ * Binary recording of the HWC2 calls, replayed by hwcreplay.
+ *
+ * File: hwc_record_file_header, then hwc_record_header records each followed
+ * by `size` bytes of payload. The payload depends on the descriptor:
+ *   buffers (setLayerBuffer, setClientTarget): hwc_record_buffer
+ *   regions (setLayerSurfaceDamage, setLayerVisibleRegion): hwc_rect_t array
+ *   validateDisplay: two uint32_t, numTypes and numRequests
+ *   setColorTransform: 16 floats and int32_t hint
+ *   others: the argument as passed to the HWC2 function
+ * createLayer stores the created layer in hwc_record_header.layer.
+ */
+#define HWC_RECORD_MAGIC    0x52435748 /* "HWCR" */
+#define HWC_RECORD_VERSION  1
+#define HWC_RECORD_PATH     "/data/vendor/log/hwc/hwc_record.bin"
+
+struct hwc_record_file_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct hwc_record_header {
+    int32_t descriptor; /* hwc2_function_descriptor_t */
+    uint32_t size;
+    uint64_t timestamp; /* CLOCK_MONOTONIC ns */
+    uint64_t display;
+    uint64_t layer;
+};
+
+/* Metadata of a buffer, pixels are not recorded */
+struct hwc_record_buffer {
+    uint64_t id;        /* Identifies the buffer within a recording, 0 for no buffer */
+    uint32_t stride;
+    uint32_t vstride;
+    int32_t format;
+    int32_t dataspace;
+    uint64_t usage;
+    int32_t hasAcquireFence;
+    uint32_t reserved;
+};
+
+/* Records are appended by the HWC2 entry points and written to the file by the worker */
+class ExynosHWCRecorder : public android::Worker {
+    public:
+        static ExynosHWCRecorder& getInstance() {
+            static ExynosHWCRecorder instance;
+            return instance;
+        }
+        static bool isEnabled() { return sEnabled.load(std::memory_order_relaxed); }
+
+        /* Starts recording if vendor.display.hwc_record is set */
+        void init();
+        void record(int32_t descriptor, hwc2_display_t display, hwc2_layer_t layer,
+                const void *payload, uint32_t size);
+        void recordBuffer(int32_t descriptor, hwc2_display_t display, hwc2_layer_t layer,
+                buffer_handle_t buffer, int32_t acquireFence, int32_t dataspace);
+        void recordRegion(int32_t descriptor, hwc2_display_t display, hwc2_layer_t layer,
+                const hwc_region_t &region);
+
+    protected:
+        void Routine() override;
+
+    private:
+        ExynosHWCRecorder() : Worker("hwc-recorder", ThreadRole::BACKGROUND) {};
+        ~ExynosHWCRecorder();
+
+        void writePending();
+
+        static std::atomic<bool> sEnabled;
+        /* The worker is signaled to write the records once this much is pending */
+        static constexpr size_t kWriteSize = 64 * 1024;
+        static constexpr int64_t kWritePeriodNs = 1000000000;
+        std::vector<uint8_t> mPending;
+        std::vector<uint8_t> mWriting;
+        FILE *mFile = nullptr;
+};
+
+#define HWC_RECORD(descriptor, display, layer, payload, size) \
+    { \
+        if (ExynosHWCRecorder::isEnabled()) \
+            ExynosHWCRecorder::getInstance().record(descriptor, display, layer, payload, size); \
+    }
+
+#define HWC_RECORD_BUFFER(descriptor, display, layer, buffer, fence, dataspace) \
+    { \
+        if (ExynosHWCRecorder::isEnabled()) \
+            ExynosHWCRecorder::getInstance().recordBuffer(descriptor, display, layer, \
+                    buffer, fence, dataspace); \
+    }
+
+#define HWC_RECORD_REGION(descriptor, display, layer, region) \
+    { \
+        if (ExynosHWCRecorder::isEnabled()) \
+            ExynosHWCRecorder::getInstance().recordRegion(descriptor, display, layer, region); \
+    }
+
+#endif
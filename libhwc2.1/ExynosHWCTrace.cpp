@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ExynosHWCTrace.h"
+
+#include <cutils/properties.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <log/log.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Timers.h>
+
+#include <mutex>
+#include <vector>
+
+namespace {
+
+/* Events kept per thread, the oldest ones are overwritten */
+constexpr uint32_t kRingSize = 4096;
+
+const char *const kCategoryNames[] = {
+    "validate", "assign", "commit", "fence", "m2m", "fb-cache",
+};
+
+/*
+ * Written only by its thread. The exporter reads head with acquire to see
+ * the events written before it.
+ */
+struct TraceRing {
+    pid_t tid;
+    std::atomic<uint32_t> head{0};
+    hwc_trace_event events[kRingSize];
+};
+
+/* Rings of all threads that ever traced, they live as long as the process */
+std::mutex sRingsMutex;
+std::vector<TraceRing *> sRings;
+
+TraceRing *getThreadRing()
+{
+    static thread_local TraceRing *ring = nullptr;
+
+    if (ring == nullptr) {
+        ring = new TraceRing();
+        ring->tid = gettid();
+        std::lock_guard<std::mutex> lock(sRingsMutex);
+        sRings.push_back(ring);
+    }
+
+    return ring;
+}
+
+const char *getCategoryName(uint32_t category)
+{
+    for (uint32_t i = 0; i < sizeof(kCategoryNames) / sizeof(kCategoryNames[0]); i++) {
+        if (category & (1 << i))
+            return kCategoryNames[i];
+    }
+    return "hwc";
+}
+
+} // namespace
+
+std::atomic<uint32_t> ExynosHWCTrace::sCategories(0);
+
+void ExynosHWCTrace::init()
+{
+    uint32_t categories = property_get_int32("vendor.display.hwc_trace", 0) & HWC_TRACE_CATEGORIES;
+    sCategories.store(categories, std::memory_order_relaxed);
+
+    if (categories != 0)
+        ALOGI("%s:: tracing categories 0x%x", __func__, categories);
+}
+
+void ExynosHWCTrace::record(uint32_t category, const char *name, bool begin)
+{
+    TraceRing *ring = getThreadRing();
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    hwc_trace_event &event = ring->events[head % kRingSize];
+
+    event.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    event.name = name;
+    event.category = category;
+    event.begin = begin ? 1 : 0;
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+int32_t ExynosHWCTrace::exportTo(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == nullptr) {
+        ALOGE("%s:: failed to open %s: %s", __func__, path, strerror(errno));
+        return -errno;
+    }
+
+    std::vector<TraceRing *> rings;
+    {
+        std::lock_guard<std::mutex> lock(sRingsMutex);
+        rings = sRings;
+    }
+
+    pid_t pid = getpid();
+    bool first = true;
+
+    fprintf(file, "{\"traceEvents\":[");
+    for (TraceRing *ring : rings) {
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+        uint32_t count = (head < kRingSize) ? head : kRingSize;
+
+        for (uint32_t i = head - count; i != head; i++) {
+            const hwc_trace_event &event = ring->events[i % kRingSize];
+            fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+                    "\"ts\":%" PRIu64 ".%03" PRIu64 ",\"pid\":%d,\"tid\":%d}",
+                    first ? "" : ",", event.name, getCategoryName(event.category),
+                    event.begin ? 'B' : 'E', event.timestamp / 1000, event.timestamp % 1000,
+                    pid, ring->tid);
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HWC_TRACE_H
+#define HWC_TRACE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+/*
+ * Trace points of the HWC hot paths.
+ *
+ * The categories not in HWC_TRACE_CATEGORIES are compiled out and cost
+ * nothing. The compiled categories are recorded if they are also set in
+ * vendor.display.hwc_trace. Each thread appends begin/end events to its own
+ * ring without any lock. dumpsys SurfaceFlinger exports the rings to
+ * HWC_TRACE_PATH in the JSON trace event format that Perfetto UI opens.
+ */
+enum {
+    eHwcTraceValidate   = 0x00000001,
+    eHwcTraceAssign     = 0x00000002,
+    eHwcTraceCommit     = 0x00000004,
+    eHwcTraceFence      = 0x00000008,
+    eHwcTraceM2M        = 0x00000010,
+    eHwcTraceFbCache    = 0x00000020,
+    eHwcTraceAll        = 0x0000003f,
+};
+
+#ifndef HWC_TRACE_CATEGORIES
+#if defined(DISABLE_HWC_DEBUG)
+#define HWC_TRACE_CATEGORIES 0
+#else
+#define HWC_TRACE_CATEGORIES eHwcTraceAll
+#endif
+#endif
+
+#define HWC_TRACE_PATH  "/data/vendor/log/hwc/hwc_trace.json"
+
+struct hwc_trace_event {
+    uint64_t timestamp; /* CLOCK_MONOTONIC ns */
+    const char *name;   /* string literal or __func__ */
+    uint32_t category;
+    uint32_t begin;     /* 1 on the begin of a scope, 0 on the end */
+};
+
+class ExynosHWCTrace {
+    public:
+        /* Enables the categories in vendor.display.hwc_trace */
+        static void init();
+        static bool isEnabled(uint32_t category) {
+            return (sCategories.load(std::memory_order_relaxed) & category) != 0;
+        }
+        static void record(uint32_t category, const char *name, bool begin);
+        /*
+         * Writes the events of all threads to @path. The rings are not
+         * stopped, the events being overwritten during export may be torn.
+         */
+        static int32_t exportTo(const char *path);
+
+    private:
+        static std::atomic<uint32_t> sCategories;
+};
+
+template <bool Enabled>
+class HwcTraceScope {
+    public:
+        HwcTraceScope(uint32_t category, const char *name)
+              : mCategory(category), mName(name) {
+            mActive = ExynosHWCTrace::isEnabled(category);
+            if (mActive)
+                ExynosHWCTrace::record(mCategory, mName, true);
+        }
+        ~HwcTraceScope() {
+            if (mActive)
+                ExynosHWCTrace::record(mCategory, mName, false);
+        }
+
+    private:
+        uint32_t mCategory;
+        const char *mName;
+        bool mActive;
+};
+
+template <>
+class HwcTraceScope<false> {
+    public:
+        HwcTraceScope(uint32_t, const char *) {}
+};
+
+#define HWC_TRACE_CONCAT_(a, b) a##b
+#define HWC_TRACE_CONCAT(a, b) HWC_TRACE_CONCAT_(a, b)
+
+/* Traces the enclosing scope, @name should outlive the process like a literal */
+#define HWC_TRACE(category, name) \
+    HwcTraceScope<((HWC_TRACE_CATEGORIES) & (category)) != 0> \
+        HWC_TRACE_CONCAT(__hwcTraceScope, __LINE__)(category, name)
+#define HWC_TRACE_FUNC(category) HWC_TRACE(category, __func__)
+
+#endif
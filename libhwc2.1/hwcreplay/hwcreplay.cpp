@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a recording of vendor.display.hwc_record through the HWC2 entry
+ * points of the composer HAL and reports the time spent per call.
+ * SurfaceFlinger and the composer service must be stopped.
+ *
+ * usage: hwcreplay [-t] [recording]
+ *   -t: keep the recorded intervals between the calls
+ */
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer2.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "ExynosHWCRecorder.h"
+#include "VendorGraphicBuffer.h"
+
+using namespace vendor::graphics;
+
+namespace {
+
+struct CallStats {
+    uint64_t count = 0;
+    uint64_t cpuNs = 0;
+    uint64_t wallNs = 0;
+    uint64_t maxWallNs = 0;
+};
+
+struct ReplayBuffer {
+    hwc_record_buffer info;
+    buffer_handle_t handle = nullptr;
+};
+
+uint64_t now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+class Replayer {
+    public:
+        explicit Replayer(hwc2_device_t *device) : mDevice(device) {}
+        ~Replayer();
+
+        bool replay(const std::vector<uint8_t> &data, bool keepTiming);
+        void report();
+
+    private:
+        template <typename PFN>
+        PFN getFunction(hwc2_function_descriptor_t descriptor) {
+            return reinterpret_cast<PFN>(mDevice->getFunction(mDevice, descriptor));
+        }
+        void dispatch(const hwc_record_header &header, const uint8_t *payload);
+        hwc2_layer_t layer(const hwc_record_header &header);
+        buffer_handle_t buffer(const hwc_record_buffer &info);
+        void closeReleaseFences(hwc2_display_t display);
+
+        hwc2_device_t *mDevice;
+        /* key: (recorded display, recorded layer) */
+        std::map<std::pair<uint64_t, uint64_t>, hwc2_layer_t> mLayers;
+        std::map<uint64_t, ReplayBuffer> mBuffers;
+        std::map<int32_t, CallStats> mStats;
+};
+
+Replayer::~Replayer()
+{
+    VendorGraphicBufferAllocator& gAllocator(VendorGraphicBufferAllocator::get());
+    for (auto &it : mBuffers)
+        gAllocator.free(it.second.handle);
+}
+
+hwc2_layer_t Replayer::layer(const hwc_record_header &header)
+{
+    auto it = mLayers.find({header.display, header.layer});
+    return (it != mLayers.end()) ? it->second : 0;
+}
+
+buffer_handle_t Replayer::buffer(const hwc_record_buffer &info)
+{
+    if (info.id == 0)
+        return nullptr;
+
+    auto it = mBuffers.find(info.id);
+    if (it != mBuffers.end()) {
+        const hwc_record_buffer &cached = it->second.info;
+        if ((cached.stride == info.stride) && (cached.vstride == info.vstride) &&
+            (cached.format == info.format) && (cached.usage == info.usage))
+            return it->second.handle;
+        /* The recorded handle was reused for another buffer */
+        VendorGraphicBufferAllocator::get().free(it->second.handle);
+        mBuffers.erase(it);
+    }
+
+    ReplayBuffer replayBuffer;
+    uint32_t stride = 0;
+    replayBuffer.info = info;
+    if (VendorGraphicBufferAllocator::get().allocate(info.stride, info.vstride, info.format, 1,
+                info.usage, &replayBuffer.handle, &stride, "hwcreplay") != 0) {
+        fprintf(stderr, "failed to allocate %ux%u format %d usage 0x%" PRIx64 "\n",
+                info.stride, info.vstride, info.format, info.usage);
+        return nullptr;
+    }
+    mBuffers[info.id] = replayBuffer;
+    return replayBuffer.handle;
+}
+
+void Replayer::closeReleaseFences(hwc2_display_t display)
+{
+    auto getReleaseFences = getFunction<HWC2_PFN_GET_RELEASE_FENCES>(
+            HWC2_FUNCTION_GET_RELEASE_FENCES);
+    uint32_t num = 0;
+    if (getReleaseFences(mDevice, display, &num, nullptr, nullptr) != HWC2_ERROR_NONE || !num)
+        return;
+
+    std::vector<hwc2_layer_t> layers(num);
+    std::vector<int32_t> fences(num, -1);
+    getReleaseFences(mDevice, display, &num, layers.data(), fences.data());
+    for (int32_t fence : fences) {
+        if (fence >= 0)
+            close(fence);
+    }
+}
+
+void Replayer::dispatch(const hwc_record_header &header, const uint8_t *payload)
+{
+    hwc2_display_t display = header.display;
+    int32_t i32 = 0;
+    if (header.size >= sizeof(i32))
+        memcpy(&i32, payload, sizeof(i32));
+
+    switch (header.descriptor) {
+        case HWC2_FUNCTION_CREATE_LAYER: {
+            hwc2_layer_t created = 0;
+            if (getFunction<HWC2_PFN_CREATE_LAYER>(HWC2_FUNCTION_CREATE_LAYER)(
+                        mDevice, display, &created) == HWC2_ERROR_NONE)
+                mLayers[{header.display, header.layer}] = created;
+        } break;
+        case HWC2_FUNCTION_DESTROY_LAYER:
+            getFunction<HWC2_PFN_DESTROY_LAYER>(HWC2_FUNCTION_DESTROY_LAYER)(
+                    mDevice, display, layer(header));
+            mLayers.erase({header.display, header.layer});
+            break;
+        case HWC2_FUNCTION_SET_LAYER_BUFFER: {
+            hwc_record_buffer info;
+            memcpy(&info, payload, sizeof(info));
+            getFunction<HWC2_PFN_SET_LAYER_BUFFER>(HWC2_FUNCTION_SET_LAYER_BUFFER)(
+                    mDevice, display, layer(header), buffer(info), -1);
+        } break;
+        case HWC2_FUNCTION_SET_CLIENT_TARGET: {
+            hwc_record_buffer info;
+            memcpy(&info, payload, sizeof(info));
+            hwc_region_t damage = {0, nullptr};
+            getFunction<HWC2_PFN_SET_CLIENT_TARGET>(HWC2_FUNCTION_SET_CLIENT_TARGET)(
+                    mDevice, display, buffer(info), -1, info.dataspace, damage);
+        } break;
+        case HWC2_FUNCTION_SET_LAYER_BLEND_MODE:
+            getFunction<HWC2_PFN_SET_LAYER_BLEND_MODE>(HWC2_FUNCTION_SET_LAYER_BLEND_MODE)(
+                    mDevice, display, layer(header), i32);
+            break;
+        case HWC2_FUNCTION_SET_LAYER_COLOR: {
+            hwc_color_t color;
+            memcpy(&color, payload, sizeof(color));
+            getFunction<HWC2_PFN_SET_LAYER_COLOR>(HWC2_FUNCTION_SET_LAYER_COLOR)(
+                    mDevice, display, layer(header), color);
+        } break;
+        case HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE:
+            getFunction<HWC2_PFN_SET_LAYER_COMPOSITION_TYPE>(
+                    HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE)(mDevice, display, layer(header), i32);
+            break;
+        case HWC2_FUNCTION_SET_LAYER_DATASPACE:
+            getFunction<HWC2_PFN_SET_LAYER_DATASPACE>(HWC2_FUNCTION_SET_LAYER_DATASPACE)(
+                    mDevice, display, layer(header), i32);
+            break;
+        case HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME: {
+            hwc_rect_t frame;
+            memcpy(&frame, payload, sizeof(frame));
+            getFunction<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME)(
+                    mDevice, display, layer(header), frame);
+        } break;
+        case HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA: {
+            float alpha;
+            memcpy(&alpha, payload, sizeof(alpha));
+            getFunction<HWC2_PFN_SET_LAYER_PLANE_ALPHA>(HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA)(
+                    mDevice, display, layer(header), alpha);
+        } break;
+        case HWC2_FUNCTION_SET_LAYER_SOURCE_CROP: {
+            hwc_frect_t crop;
+            memcpy(&crop, payload, sizeof(crop));
+            getFunction<HWC2_PFN_SET_LAYER_SOURCE_CROP>(HWC2_FUNCTION_SET_LAYER_SOURCE_CROP)(
+                    mDevice, display, layer(header), crop);
+        } break;
+        case HWC2_FUNCTION_SET_LAYER_TRANSFORM:
+            getFunction<HWC2_PFN_SET_LAYER_TRANSFORM>(HWC2_FUNCTION_SET_LAYER_TRANSFORM)(
+                    mDevice, display, layer(header), i32);
+            break;
+        case HWC2_FUNCTION_SET_LAYER_Z_ORDER:
+            getFunction<HWC2_PFN_SET_LAYER_Z_ORDER>(HWC2_FUNCTION_SET_LAYER_Z_ORDER)(
+                    mDevice, display, layer(header), (uint32_t)i32);
+            break;
+        case HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE:
+        case HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION: {
+            std::vector<hwc_rect_t> rects(header.size / sizeof(hwc_rect_t));
+            if (!rects.empty())
+                memcpy(rects.data(), payload, rects.size() * sizeof(hwc_rect_t));
+            hwc_region_t region = {rects.size(), rects.empty() ? nullptr : rects.data()};
+            if (header.descriptor == HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE)
+                getFunction<HWC2_PFN_SET_LAYER_SURFACE_DAMAGE>(
+                        HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE)(mDevice, display, layer(header),
+                        region);
+            else
+                getFunction<HWC2_PFN_SET_LAYER_VISIBLE_REGION>(
+                        HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION)(mDevice, display, layer(header),
+                        region);
+        } break;
+        case HWC2_FUNCTION_VALIDATE_DISPLAY: {
+            uint32_t numTypes = 0, numRequests = 0;
+            getFunction<HWC2_PFN_VALIDATE_DISPLAY>(HWC2_FUNCTION_VALIDATE_DISPLAY)(
+                    mDevice, display, &numTypes, &numRequests);
+        } break;
+        case HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES:
+            getFunction<HWC2_PFN_ACCEPT_DISPLAY_CHANGES>(HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES)(
+                    mDevice, display);
+            break;
+        case HWC2_FUNCTION_PRESENT_DISPLAY: {
+            int32_t retireFence = -1;
+            getFunction<HWC2_PFN_PRESENT_DISPLAY>(HWC2_FUNCTION_PRESENT_DISPLAY)(
+                    mDevice, display, &retireFence);
+            if (retireFence >= 0)
+                close(retireFence);
+        } break;
+        case HWC2_FUNCTION_SET_POWER_MODE:
+            getFunction<HWC2_PFN_SET_POWER_MODE>(HWC2_FUNCTION_SET_POWER_MODE)(
+                    mDevice, display, i32);
+            break;
+        case HWC2_FUNCTION_SET_VSYNC_ENABLED:
+            getFunction<HWC2_PFN_SET_VSYNC_ENABLED>(HWC2_FUNCTION_SET_VSYNC_ENABLED)(
+                    mDevice, display, i32);
+            break;
+        case HWC2_FUNCTION_SET_ACTIVE_CONFIG:
+            getFunction<HWC2_PFN_SET_ACTIVE_CONFIG>(HWC2_FUNCTION_SET_ACTIVE_CONFIG)(
+                    mDevice, display, (hwc2_config_t)i32);
+            break;
+        case HWC2_FUNCTION_SET_COLOR_MODE:
+            getFunction<HWC2_PFN_SET_COLOR_MODE>(HWC2_FUNCTION_SET_COLOR_MODE)(
+                    mDevice, display, i32);
+            break;
+        case HWC2_FUNCTION_SET_COLOR_TRANSFORM: {
+            float matrix[16];
+            int32_t hint;
+            memcpy(matrix, payload, sizeof(matrix));
+            memcpy(&hint, payload + sizeof(matrix), sizeof(hint));
+            getFunction<HWC2_PFN_SET_COLOR_TRANSFORM>(HWC2_FUNCTION_SET_COLOR_TRANSFORM)(
+                    mDevice, display, matrix, hint);
+        } break;
+        default:
+            fprintf(stderr, "unknown descriptor %d\n", header.descriptor);
+            break;
+    }
+}
+
+bool Replayer::replay(const std::vector<uint8_t> &data, bool keepTiming)
+{
+    hwc_record_file_header fileHeader;
+    if (data.size() < sizeof(fileHeader))
+        return false;
+    memcpy(&fileHeader, data.data(), sizeof(fileHeader));
+    if ((fileHeader.magic != HWC_RECORD_MAGIC) || (fileHeader.version != HWC_RECORD_VERSION)) {
+        fprintf(stderr, "not a recording of version %d\n", HWC_RECORD_VERSION);
+        return false;
+    }
+
+    uint64_t firstRecorded = 0, firstReplayed = now(CLOCK_MONOTONIC);
+    size_t offset = sizeof(fileHeader);
+    while (offset + sizeof(hwc_record_header) <= data.size()) {
+        hwc_record_header header;
+        memcpy(&header, data.data() + offset, sizeof(header));
+        offset += sizeof(header);
+        if (offset + header.size > data.size()) {
+            fprintf(stderr, "truncated record at %zu\n", offset);
+            break;
+        }
+        const uint8_t *payload = data.data() + offset;
+        offset += header.size;
+
+        if (keepTiming) {
+            if (firstRecorded == 0)
+                firstRecorded = header.timestamp;
+            uint64_t target = firstReplayed + (header.timestamp - firstRecorded);
+            uint64_t current = now(CLOCK_MONOTONIC);
+            if (target > current)
+                usleep((target - current) / 1000);
+        }
+
+        uint64_t cpuStart = now(CLOCK_THREAD_CPUTIME_ID);
+        uint64_t wallStart = now(CLOCK_MONOTONIC);
+        dispatch(header, payload);
+        uint64_t wall = now(CLOCK_MONOTONIC) - wallStart;
+        CallStats &stats = mStats[header.descriptor];
+        stats.count++;
+        stats.cpuNs += now(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+        stats.wallNs += wall;
+        stats.maxWallNs = std::max(stats.maxWallNs, wall);
+
+        /* Not timed, SurfaceFlinger takes the release fences after every present */
+        if (header.descriptor == HWC2_FUNCTION_PRESENT_DISPLAY)
+            closeReleaseFences(header.display);
+    }
+
+    return true;
+}
+
+void Replayer::report()
+{
+    printf("%-32s %10s %12s %12s %12s\n", "call", "count", "cpu avg(us)", "wall avg(us)",
+            "wall max(us)");
+    for (auto &it : mStats) {
+        const CallStats &stats = it.second;
+        printf("%-32s %10" PRIu64 " %12.1f %12.1f %12.1f\n",
+                getFunctionDescriptorName(static_cast<hwc2_function_descriptor_t>(it.first)),
+                stats.count, stats.cpuNs / 1000.0 / stats.count,
+                stats.wallNs / 1000.0 / stats.count, stats.maxWallNs / 1000.0);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool keepTiming = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t")) != -1) {
+        if (opt == 't')
+            keepTiming = true;
+    }
+    const char *path = (optind < argc) ? argv[optind] : HWC_RECORD_PATH;
+
+    FILE *file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[64 * 1024];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.insert(data.end(), chunk, chunk + read);
+    fclose(file);
+
+    const hw_module_t *module = nullptr;
+    hwc2_device_t *device = nullptr;
+    if (hw_get_module(HWC_HARDWARE_MODULE_ID, &module) || hwc2_open(module, &device)) {
+        fprintf(stderr, "failed to open the composer HAL\n");
+        return 1;
+    }
+
+    int ret = 0;
+    {
+        Replayer replayer(device);
+        if (replayer.replay(data, keepTiming))
+            replayer.report();
+        else
+            ret = 1;
+    }
+    hwc2_close(device);
+
+    return ret;
+}
@@ -23,10 +23,14 @@
 #include "ExynosVirtualDisplayModule.h"
 #include "ExynosHWCDebug.h"
 #include "ExynosHWCHelper.h"
+#include "ExynosHWCTrace.h"
 #include "ExynosDeviceDrmInterface.h"
 #include <unistd.h>
 #include <sync/sync.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <system/thread_defs.h>
 #include "VendorGraphicBuffer.h"
 
 using namespace vendor::graphics;
@@ -63,6 +67,8 @@ ExynosDevice::ExynosDevice()
     mVsyncDisplayId(getDisplayId(HWC_DISPLAY_PRIMARY, 0)),
     mTimestamp(0),
     mDisplayMode(0),
+    mDRWakeFd(-1),
+    mDRIdleThresholdMs(DYNAMIC_RECOMP_IDLE_THRESHOLD_MS),
     mInterfaceType(INTERFACE_TYPE_FB),
     mIsInTUI(false)
 {
@@ -76,8 +82,9 @@ ExynosDevice::ExynosDevice()
     exynosHWCControl.dumpMidBuf = false;
     exynosHWCControl.displayMode = DISPLAY_MODE_NUM;
     exynosHWCControl.setDDIScaler = false;
-    exynosHWCControl.skipWinConfig = false;
+    exynosHWCControl.skipWinConfig = true;
     exynosHWCControl.skipValidate = true;
+    exynosHWCControl.parallelValidate = false;
     exynosHWCControl.doFenceFileDump = false;
     exynosHWCControl.fenceTracer = 0;
     exynosHWCControl.sysFenceLogging = false;
@@ -130,8 +137,20 @@ ExynosDevice::ExynosDevice()
 
     memset(mCallbackInfos, 0, sizeof(mCallbackInfos));
 
+    mDRWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mDRWakeFd < 0)
+        ALOGE("Failed to create dynamic recomposition eventfd: %s", strerror(errno));
+    mDRIdleThresholdMs = property_get_int32("vendor.display.dynamic_recomp.idle_ms",
+            DYNAMIC_RECOMP_IDLE_THRESHOLD_MS);
+    if (mDRIdleThresholdMs == 0)
+        mDRIdleThresholdMs = DYNAMIC_RECOMP_IDLE_THRESHOLD_MS;
+
     dynamicRecompositionThreadCreate();
 
+    /* Only safe when the composer client can validate displays concurrently */
+    exynosHWCControl.parallelValidate =
+            property_get_bool("vendor.display.parallel_validate", false);
+
     hwcDebug = 0;
     for (uint32_t i = 0; i < FENCE_IP_ALL; i++)
         hwcFenceDebug[i] = 0;
@@ -143,7 +162,8 @@ ExynosDevice::ExynosDevice()
 
     String8 saveString;
     saveString.appendFormat("ExynosDevice is initialized");
-    uint32_t errFileSize = saveErrorLog(saveString);
+    saveErrorLog(saveString);
+    uint32_t errFileSize = flushErrorLog();
     ALOGI("Initial errlog size: %d bytes\n", errFileSize);
 
     /*
@@ -202,8 +222,12 @@ ExynosDevice::~ExynosDevice() {
 
     ExynosDisplay *primary_display = getDisplay(getDisplayId(HWC_DISPLAY_PRIMARY,0));
 
-    mDRLoopStatus = false;
-    mDRThread.join();
+    dynamicRecompositionThreadStop();
+    if (mDRWakeFd >= 0)
+        close(mDRWakeFd);
+
+    /* The writer uses the display until it exits */
+    mReadbackStreamWriter.Exit();
 
     delete primary_display;
 }
@@ -261,8 +285,7 @@ void ExynosDevice::checkDynamicRecompositionThread()
             if (mDisplays[i]->mDREnable)
                 return;
         }
-        mDRLoopStatus = false;
-        mDRThread.join();
+        dynamicRecompositionThreadStop();
     }
 }
 
@@ -274,36 +297,88 @@ void ExynosDevice::dynamicRecompositionThreadCreate()
     }
 }
 
+void ExynosDevice::dynamicRecompositionThreadStop()
+{
+    mDRLoopStatus = false;
+    if (mDRWakeFd >= 0) {
+        uint64_t wake = 1;
+        if (write(mDRWakeFd, &wake, sizeof(wake)) != sizeof(wake))
+            ALOGE("Failed to wake up dynamic recomposition thread: %s", strerror(errno));
+    }
+    if (mDRThread.joinable())
+        mDRThread.join();
+}
+
 void *ExynosDevice::dynamicRecompositionThreadLoop(void *data)
 {
     ExynosDevice *dev = (ExynosDevice *)data;
-    ExynosDisplay *display[dev->mDisplays.size()];
-    uint64_t event_cnt[dev->mDisplays.size()];
+    uint32_t displayNum = dev->mDisplays.size();
+    ExynosDisplay *display[displayNum];
+
+    ApplyThreadPolicy(ThreadRole::RECOMPOSITION);
+    struct epoll_event events[displayNum + 1];
+    struct epoll_event ev;
 
-    for (uint32_t i = 0; i < dev->mDisplays.size(); i++) {
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        ALOGE("%s: Failed to create epoll: %s", __func__, strerror(errno));
+        return NULL;
+    }
+
+    /*
+     * Each display arms its timerfd on present, so the thread only wakes up
+     * once a display has really been idle for mDRIdleThresholdMs.
+     */
+    for (uint32_t i = 0; i < displayNum; i++) {
         display[i] = dev->mDisplays[i];
-        event_cnt[i] = 0;
+        if (display[i]->mDRTimerFd < 0)
+            continue;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, display[i]->mDRTimerFd, &ev) < 0)
+            ALOGE("%s: Failed to add display[%d] timer: %s", __func__, i, strerror(errno));
     }
+    ev.events = EPOLLIN;
+    ev.data.u32 = displayNum;
+    if ((dev->mDRWakeFd >= 0) && (epoll_ctl(epollFd, EPOLL_CTL_ADD, dev->mDRWakeFd, &ev) < 0))
+        ALOGE("%s: Failed to add wake fd: %s", __func__, strerror(errno));
+
     android_atomic_inc(&(dev->mDRThreadStatus));
 
     while (dev->mDRLoopStatus) {
         uint32_t result = 0;
-        for (uint32_t i = 0; i < dev->mDisplays.size(); i++)
-            event_cnt[i] = display[i]->mUpdateEventCnt;
+        int nfds = epoll_wait(epollFd, events, displayNum + 1, -1);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("%s: epoll_wait failed: %s", __func__, strerror(errno));
+            break;
+        }
 
-        /*
-         * If there is no update for more than 100ms, favor the 3D composition mode.
-         * If all other conditions are met, mode will be switched to 3D composition.
-         */
-        usleep(100000);
-        for (uint32_t i = 0; i < dev->mDisplays.size(); i++) {
+        for (int n = 0; n < nfds; n++) {
+            uint32_t i = events[n].data.u32;
+            uint64_t expirations = 0;
+            if (i == displayNum) {
+                read(dev->mDRWakeFd, &expirations, sizeof(expirations));
+                continue;
+            }
+            /* The timer was re-armed by a present after it fired */
+            if (read(display[i]->mDRTimerFd, &expirations, sizeof(expirations)) !=
+                    sizeof(expirations))
+                continue;
+
+            /*
+             * If there is no update for the idle threshold, favor the 3D composition mode.
+             * If all other conditions are met, mode will be switched to 3D composition.
+             */
             if (display[i]->mDREnable &&
-                display[i]->mPlugState == true &&
-                event_cnt[i] == display[i]->mUpdateEventCnt) {
+                display[i]->mPlugState == true) {
                 if (display[i]->checkDynamicReCompMode() == DEVICE_2_CLIENT) {
                     display[i]->mUpdateEventCnt = 0;
                     display[i]->setGeometryChanged(GEOMETRY_DISPLAY_DYNAMIC_RECOMPOSITION);
                     result = 1;
+                } else if (display[i]->needDynamicReCompRecheck()) {
+                    display[i]->armDynamicReCompTimer();
                 }
             }
         }
@@ -311,6 +386,7 @@ void *ExynosDevice::dynamicRecompositionThreadLoop(void *data)
             dev->invalidate();
     }
 
+    close(epollFd);
     android_atomic_dec(&(dev->mDRThreadStatus));
 
     return NULL;
@@ -388,6 +464,7 @@ void ExynosDevice::dump(uint32_t *outSize, char *outBuffer) {
             localTime->tm_sec, updateTimeInfo.lastPresentTime.tv_usec/1000);
 
     result.appendFormat("\n");
+    mDeviceInterface->dump(result);
     mResourceManager->dump(result);
 
     for (size_t i = 0;i < mDisplays.size(); i++) {
@@ -396,6 +473,12 @@ void ExynosDevice::dump(uint32_t *outSize, char *outBuffer) {
             display->dump(result);
     }
 
+    /* dump() is called twice per dumpsys, export only on the size query */
+    if ((outBuffer == NULL) && ExynosHWCTrace::isEnabled(eHwcTraceAll)) {
+        if (ExynosHWCTrace::exportTo(HWC_TRACE_PATH) == 0)
+            result.appendFormat("\nHWC trace exported to %s\n", HWC_TRACE_PATH);
+    }
+
     if (outBuffer == NULL) {
         *outSize = (uint32_t)result.length();
     } else {
@@ -551,6 +634,12 @@ void ExynosDevice::setHWCControl(uint32_t display, uint32_t ctrl, int32_t val)
             setGeometryChanged(GEOMETRY_DEVICE_CONFIG_CHANGED);
             invalidate();
             break;
+        case HWC_CTL_PARALLEL_VALIDATE:
+            ALOGI("%s::HWC_CTL_PARALLEL_VALIDATE on/off=%d", __func__, val);
+            exynosHWCControl.parallelValidate = (unsigned int)val;
+            setGeometryChanged(GEOMETRY_DEVICE_CONFIG_CHANGED);
+            invalidate();
+            break;
         case HWC_CTL_DUMP_MID_BUF:
             ALOGI("%s::HWC_CTL_DUMP_MID_BUF on/off=%d", __func__, val);
             exynosHWCControl.dumpMidBuf = (unsigned int)val;
@@ -560,6 +649,10 @@ void ExynosDevice::setHWCControl(uint32_t display, uint32_t ctrl, int32_t val)
         case HWC_CTL_CAPTURE_READBACK:
             captureScreenWithReadback(HWC_DISPLAY_PRIMARY);
             break;
+        case HWC_CTL_READBACK_STREAM:
+            ALOGI("%s::HWC_CTL_READBACK_STREAM interval=%d", __func__, val);
+            setReadbackStream(HWC_DISPLAY_PRIMARY, (uint32_t)val);
+            break;
         case HWC_CTL_DISPLAY_MODE:
             ALOGI("%s::HWC_CTL_DISPLAY_MODE mode=%d", __func__, val);
             setDisplayMode((uint32_t)val);
@@ -599,6 +692,10 @@ void ExynosDevice::setHWCControl(uint32_t display, uint32_t ctrl, int32_t val)
         case HWC_CTL_USE_MAX_G2D_SRC:
         case HWC_CTL_ENABLE_HANDLE_LOW_FPS:
         case HWC_CTL_ENABLE_EARLY_START_MPP:
+        case HWC_CTL_MERGE_M2M_LAYERS:
+        case HWC_CTL_LOW_FPS_LAYER_STRATEGY:
+        case HWC_CTL_MINIMAL_DOZE_COMPOSITION:
+        case HWC_CTL_GROUP_LAYERS_BY_OVERLAP:
             exynosDisplay = (ExynosDisplay*)getDisplay(display);
             if (exynosDisplay == NULL) {
                 for (uint32_t i = 0; i < mDisplays.size(); i++) {
@@ -748,6 +845,12 @@ bool ExynosDevice::canSkipValidate()
 
 bool ExynosDevice::validateFences(ExynosDisplay *display) {
 
+    if (++mFenceCount.auditFrames >= FENCE_AUDIT_INTERVAL) {
+        mFenceCount.auditFrames = 0;
+        if (!auditFenceCount(display))
+            ALOGW("%s:: fence counters were corrected", __func__);
+    }
+
     if (!validateFencePerFrame(display)) {
         String8 errString;
         errString.appendFormat("You should doubt fence leak!\n");
@@ -839,15 +942,10 @@ int32_t ExynosDevice::captureReadbackClass::allocBuffer(
     return NO_ERROR;
 }
 
-void  ExynosDevice::captureReadbackClass::saveToFile(const String8 &fileName)
+static void saveReadbackBuffer(buffer_handle_t buffer, const String8 &fileName)
 {
-    if (mBuffer == nullptr) {
-        ALOGE("%s:: buffer is null", __func__);
-        return;
-    }
-
     char filePath[MAX_DEV_NAME] = {0};
-    VendorGraphicBufferMeta gmeta(mBuffer);
+    VendorGraphicBufferMeta gmeta(buffer);
 
     snprintf(filePath, MAX_DEV_NAME,
             "%s/%s", WRITEBACK_CAPTURE_PATH, fileName.string());
@@ -864,11 +962,22 @@ void  ExynosDevice::captureReadbackClass::saveToFile(const String8 &fileName)
         } else {
             ALOGE("Fail to mmap");
         }
+        fclose(fp);
     } else {
         ALOGE("Fail to open %s", filePath);
     }
 }
 
+void  ExynosDevice::captureReadbackClass::saveToFile(const String8 &fileName)
+{
+    if (mBuffer == nullptr) {
+        ALOGE("%s:: buffer is null", __func__);
+        return;
+    }
+
+    saveReadbackBuffer(mBuffer, fileName);
+}
+
 void ExynosDevice::signalReadbackDone()
 {
     if (mIsWaitingReadbackReqDone) {
@@ -947,6 +1056,87 @@ void ExynosDevice::captureScreenWithReadback(uint32_t displayType)
     captureClass.saveToFile(fileName);
 }
 
+void ExynosDevice::setReadbackStream(uint32_t displayType, uint32_t interval)
+{
+    ExynosDisplay *display = getDisplay(displayType);
+    if (display == nullptr) {
+        ALOGE("There is no display(%d)", displayType);
+        return;
+    }
+
+    mReadbackStreamWriter.setDisplay(nullptr);
+    display->mReadbackStream.stop();
+    if (interval == 0)
+        return;
+
+    int32_t outFormat;
+    int32_t outDataspace;
+    int32_t ret = 0;
+    if ((ret = display->getReadbackBufferAttributes(
+                &outFormat, &outDataspace)) != HWC2_ERROR_NONE) {
+        ALOGE("getReadbackBufferAttributes fail, ret(%d)", ret);
+        return;
+    }
+
+    if ((ret = display->mReadbackStream.start(outFormat, display->mXres, display->mYres,
+                    interval, kReadbackStreamBufferNum)) != NO_ERROR) {
+        ALOGE("failed to start readback stream, ret(%d)", ret);
+        return;
+    }
+    mReadbackStreamWriter.setDisplay(display);
+}
+
+ExynosDevice::ReadbackStreamWriter::ReadbackStreamWriter()
+      : Worker("ReadbackStreamWriter", ThreadRole::BACKGROUND) {}
+
+ExynosDevice::ReadbackStreamWriter::~ReadbackStreamWriter()
+{
+    Exit();
+}
+
+void ExynosDevice::ReadbackStreamWriter::setDisplay(ExynosDisplay *display)
+{
+    if (!mInitialized && (display != nullptr)) {
+        InitWorker();
+        mInitialized = true;
+    }
+
+    Lock();
+    mDisplay = display;
+    Signal();
+    Unlock();
+}
+
+void ExynosDevice::ReadbackStreamWriter::Routine()
+{
+    Lock();
+    ExynosDisplay *display = mDisplay;
+    if ((display == nullptr) && (WaitForSignalOrExitLocked() == -EINTR)) {
+        Unlock();
+        return;
+    }
+    Unlock();
+    if (display == nullptr)
+        return;
+
+    ReadbackStream::Frame frame;
+    if (!display->mReadbackStream.acquireFrame(&frame, kAcquireTimeoutNs))
+        return;
+
+    if (sync_wait(frame.fence, 1000) < 0)
+        ALOGE("sync wait error, fence(%d)", frame.fence);
+    hwcFdClose(frame.fence);
+
+    VendorGraphicBufferMeta gmeta(frame.buffer);
+    String8 fileName;
+    fileName.appendFormat("stream_format%d_%dx%d_%" PRIu64 "_frame%" PRIu64 ".raw",
+            gmeta.format, gmeta.stride, gmeta.vstride, (uint64_t)frame.timestamp,
+            frame.frameNum);
+    saveReadbackBuffer(frame.buffer, fileName);
+
+    display->mReadbackStream.releaseFrame(frame.buffer);
+}
+
 int32_t ExynosDevice::setDisplayDeviceMode(int32_t display_id, int32_t mode)
 {
     int32_t ret = HWC2_ERROR_NONE;
@@ -37,6 +37,7 @@
 #include "ExynosHWC.h"
 #include "ExynosHWCHelper.h"
 #include "ExynosHWCModule.h"
+#include "worker.h"
 
 #define MAX_DEV_NAME 128
 #define ERROR_LOG_PATH0 "/data/vendor/log/hwc"
@@ -80,11 +81,14 @@ typedef struct exynos_hwc_control {
     uint32_t useDynamicRecomp;
     uint32_t skipWinConfig;
     uint32_t skipValidate;
+    uint32_t parallelValidate;
     uint32_t doFenceFileDump;
     uint32_t fenceTracer;
     uint32_t sysFenceLogging;
 } exynos_hwc_control_t;
 
+#define DYNAMIC_RECOMP_IDLE_THRESHOLD_MS 100
+
 typedef struct update_time_info {
     struct timeval lastUeventTime;
     struct timeval lastEnableVsyncTime;
@@ -109,12 +113,13 @@ enum {
     GEOMETRY_LAYER_DRM_CHANGED              = 1ULL << 12,
     GEOMETRY_LAYER_IGNORE_CHANGED           = 1ULL << 13,
     GEOMETRY_LAYER_UNKNOWN_CHANGED          = 1ULL << 14,
-    /* 1ULL << 14 */
-    /* 1ULL << 15 */
+    GEOMETRY_LAYER_COLOR_TRANSFORM_CHANGED  = 1ULL << 15,
     /* 1ULL << 16 */
     /* 1ULL << 17 */
     /* 1ULL << 18 */
     /* 1ULL << 19 */
+    /* All bits that can be set by ExynosLayer */
+    GEOMETRY_LAYER_CHANGED_MASK             = (1ULL << 20) - 1,
     GEOMETRY_DISPLAY_LAYER_ADDED            = 1ULL << 20,
     GEOMETRY_DISPLAY_LAYER_REMOVED          = 1ULL << 21,
     GEOMETRY_DISPLAY_CONFIG_CHANGED         = 1ULL << 22,
@@ -136,8 +141,15 @@ enum {
     GEOMETRY_DEVICE_CONFIG_CHANGED          = 1ULL << 38,
     GEOMETRY_DEVICE_DISP_MODE_CHAGED        = 1ULL << 39,
     GEOMETRY_DEVICE_SCENARIO_CHANGED        = 1ULL << 40,
+    GEOMETRY_DEVICE_SHARED_MPP_CONFLICT     = 1ULL << 41,
 
     GEOMETRY_ERROR_CASE                     = 1ULL << 63,
+    /* Bits that aren't scoped to the display that set them */
+    GEOMETRY_DEVICE_CHANGED_MASK            = ~((1ULL << 32) - 1),
+    /* Bits that invalidate the resource assignment of every display */
+    GEOMETRY_CROSS_DISPLAY_MASK             = GEOMETRY_DEVICE_CHANGED_MASK |
+                                              GEOMETRY_DISPLAY_POWER_ON |
+                                              GEOMETRY_DISPLAY_POWER_OFF,
 };
 
 class ExynosDevice;
@@ -172,6 +184,10 @@ class ExynosDevice {
         std::thread mDRThread;
         volatile int32_t mDRThreadStatus;
         std::atomic<bool> mDRLoopStatus;
+        /* eventfd to wake up the dynamic recomposition thread when it stops */
+        int mDRWakeFd;
+        /* A display idle for this long is checked for DEVICE_2_CLIENT switch */
+        uint32_t mDRIdleThresholdMs;
         bool mPrimaryBlank;
 
         /**
@@ -201,6 +217,7 @@ class ExynosDevice {
 
         // Variable for fence tracer
         hwc_fence_info mFenceInfo[MAX_FD_NUM];
+        hwc_fence_count_t mFenceCount;
 
         /**
          * This will be initialized with differnt class
@@ -222,6 +239,7 @@ class ExynosDevice {
          */
 
         void dynamicRecompositionThreadCreate();
+        void dynamicRecompositionThreadStop();
         static void* dynamicRecompositionThreadLoop(void *data);
 
 
@@ -307,6 +325,8 @@ class ExynosDevice {
                 ExynosDevice* mDevice = nullptr;
         };
         void captureScreenWithReadback(uint32_t displayType);
+        /* Saves every Nth frame of the display to WRITEBACK_CAPTURE_PATH, 0 stops */
+        void setReadbackStream(uint32_t displayType, uint32_t interval);
         void cleanupCaptureScreen(void *buffer);
         void signalReadbackDone();
         void clearWaitingReadbackReqDone() {
@@ -321,6 +341,24 @@ class ExynosDevice {
         Mutex mCaptureMutex;
         Condition mCaptureCondition;
         std::atomic<bool> mIsWaitingReadbackReqDone = false;
+
+        /* Consumer of ReadbackStream of a display, it waits and writes the frames */
+        class ReadbackStreamWriter : public Worker {
+            public:
+                ReadbackStreamWriter();
+                ~ReadbackStreamWriter() override;
+                void setDisplay(ExynosDisplay *display);
+
+            protected:
+                void Routine() override;
+
+            private:
+                static constexpr nsecs_t kAcquireTimeoutNs = 100000000;
+                bool mInitialized = false;
+                ExynosDisplay *mDisplay = nullptr;
+        };
+        static constexpr uint32_t kReadbackStreamBufferNum = 3;
+        ReadbackStreamWriter mReadbackStreamWriter;
         void setVBlankOffDelay(int vblankOffDelay);
 
     public:
@@ -340,7 +378,8 @@ class ExynosDevice {
 
     private:
         bool mLbeSupported;
-        bool mIsInTUI;
+        /* Set by the DRM event thread, read by validateDisplay() and presentDisplay() */
+        std::atomic<bool> mIsInTUI;
 };
 
 #endif //_EXYNOSDEVICE_H
@@ -25,11 +25,15 @@
 #include <processgroup/processgroup.h>
 #include <sync/sync.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
 #include <utils/CallStack.h>
 
+#include <algorithm>
 #include <map>
+#include <mutex>
 
 #include "ExynosExternalDisplay.h"
+#include "ExynosHWCTrace.h"
 #include "ExynosLayer.h"
 #include "exynos_format.h"
 
@@ -56,10 +60,14 @@ constexpr float nsecsPerSec = std::chrono::nanoseconds(1s).count();
 constexpr int64_t nsecsIdleHintTimeout = std::chrono::nanoseconds(100ms).count();
 
 ExynosDisplay::PowerHalHintWorker::PowerHalHintWorker()
-      : Worker("DisplayHints", HAL_PRIORITY_URGENT_DISPLAY),
+      : Worker("DisplayHints", ThreadRole::DISPLAY_URGENT),
         mNeedUpdateRefreshRateHint(false),
         mPrevRefreshRate(0),
         mPendingPrevRefreshRate(0),
+        mContentFps(0),
+        mPrevContentFps(0),
+        mRefreshRateVote(0),
+        mPrevRefreshRateVote(0),
         mIdleHintIsEnabled(false),
         mIdleHintDeadlineTime(0),
         mIdleHintSupportIsChecked(false),
@@ -67,6 +75,7 @@ ExynosDisplay::PowerHalHintWorker::PowerHalHintWorker()
         mPowerModeState(HWC2_POWER_MODE_OFF),
         mVsyncPeriod(16666666),
         mPowerHalExtAidl(nullptr) {
+    mPredictiveIdleHint = property_get_bool("vendor.display.idle_hint.predictive", true);
     InitWorker();
 }
 
@@ -240,6 +249,55 @@ int32_t ExynosDisplay::PowerHalHintWorker::updateRefreshRateHintInternal(
     return ret;
 }
 
+/*
+ * Sends "<prefix><fps>FPS" hints: the cadence of the content on screen
+ * (CONTENT_) and HWC's own refresh rate vote (VOTE_), so that power HAL can
+ * pick a matching refresh rate, e.g. for 24fps video in a 120Hz UI.
+ */
+int32_t ExynosDisplay::PowerHalHintWorker::updateFpsHintInternal(
+        hwc2_power_mode_t powerMode, const std::string& prefix, uint32_t fps,
+        uint32_t& prevFps, std::map<uint32_t, bool>& supportMap) {
+    int32_t ret = NO_ERROR;
+    if (powerMode != HWC2_POWER_MODE_ON)
+        fps = 0;
+
+    if (fps == prevFps)
+        return NO_ERROR;
+
+    if (fps) {
+        std::string hintStr = prefix + std::to_string(fps) + "FPS";
+        const auto its = supportMap.find(fps);
+        if (its == supportMap.end()) {
+            ret = checkPowerHalExtHintSupport(hintStr);
+            if (ret == NO_ERROR || ret == -EOPNOTSUPP) {
+                supportMap[fps] = (ret == NO_ERROR);
+                ALOGI("cache fps hint %s: %d", hintStr.c_str(), !ret);
+            } else {
+                return ret;
+            }
+        } else if (!its->second) {
+            ret = -EOPNOTSUPP;
+        }
+
+        if (ret == NO_ERROR) {
+            ret = sendPowerHalExtHint(hintStr, true);
+            if (ret != NO_ERROR)
+                return ret;
+        }
+    }
+
+    /* The new hint is enabled first, same as the refresh rate hints */
+    if (prevFps) {
+        std::string prevHintStr = prefix + std::to_string(prevFps) + "FPS";
+        int32_t rc = sendPowerHalExtHint(prevHintStr, false);
+        if (rc != NO_ERROR && rc != -ENOTCONN)
+            return rc;
+    }
+
+    prevFps = (ret == NO_ERROR) ? fps : 0;
+    return ret;
+}
+
 int32_t ExynosDisplay::PowerHalHintWorker::checkIdleHintSupport(void) {
     int32_t ret = NO_ERROR;
     Lock();
@@ -279,16 +337,22 @@ int32_t ExynosDisplay::PowerHalHintWorker::updateIdleHint(uint64_t deadlineTime)
         ret = sendPowerHalExtHint("DISPLAY_IDLE", enableIdleHint);
         if (ret == NO_ERROR) {
             mIdleHintIsEnabled = enableIdleHint;
+            if (enableIdleHint && mIdleCallback)
+                mIdleCallback();
         }
     }
     return ret;
 }
 
 void ExynosDisplay::PowerHalHintWorker::signalRefreshRate(hwc2_power_mode_t powerMode,
-                                                          uint32_t vsyncPeriod) {
+                                                          uint32_t vsyncPeriod,
+                                                          uint32_t contentFps,
+                                                          uint32_t refreshRateVote) {
     Lock();
     mPowerModeState = powerMode;
     mVsyncPeriod = vsyncPeriod;
+    mContentFps = contentFps;
+    mRefreshRateVote = refreshRateVote;
     mNeedUpdateRefreshRateHint = true;
     Unlock();
 
@@ -304,12 +368,51 @@ void ExynosDisplay::PowerHalHintWorker::signalIdle() {
         return;
     }
 
-    mIdleHintDeadlineTime = systemTime(SYSTEM_TIME_MONOTONIC) + nsecsIdleHintTimeout;
+    uint64_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    updatePresentIntervalLocked(now);
+    /*
+     * If the next present is unlikely to land within the timeout, don't wait
+     * for the timeout before sending the idle hint.
+     */
+    mIdleHintDeadlineTime = now + (isNextPresentUnlikelyLocked() ? 0 : nsecsIdleHintTimeout);
     Unlock();
 
     Signal();
 }
 
+void ExynosDisplay::PowerHalHintWorker::updatePresentIntervalLocked(uint64_t now) {
+    if (mLastPresentTime && (now > mLastPresentTime)) {
+        uint64_t intervalMs = ns2ms(now - mLastPresentTime);
+        size_t bucket = 0;
+        while ((bucket < kPresentIntervalBucketNum - 1) &&
+               (intervalMs > kPresentIntervalBucketMs[bucket]))
+            bucket++;
+
+        /* Decay old samples so the distribution follows the current content */
+        for (size_t i = 0; i < kPresentIntervalBucketNum; i++)
+            mPresentIntervalHistogram[i] *= kPresentIntervalDecay;
+        mPresentIntervalHistogram[bucket] += 1.0f;
+        if (mPresentIntervalSamples < kPredictiveIdleMinSamples)
+            mPresentIntervalSamples++;
+    }
+    mLastPresentTime = now;
+}
+
+bool ExynosDisplay::PowerHalHintWorker::isNextPresentUnlikelyLocked() {
+    if (!mPredictiveIdleHint || (mPresentIntervalSamples < kPredictiveIdleMinSamples))
+        return false;
+
+    float total = 0, withinTimeout = 0;
+    for (size_t i = 0; i < kPresentIntervalBucketNum; i++) {
+        total += mPresentIntervalHistogram[i];
+        if ((i < kPresentIntervalBucketNum - 1) &&
+            (ms2ns(kPresentIntervalBucketMs[i]) <= nsecsIdleHintTimeout))
+            withinTimeout += mPresentIntervalHistogram[i];
+    }
+
+    return (total > 0) && (withinTimeout / total < kPredictiveIdleProbability);
+}
+
 void ExynosDisplay::PowerHalHintWorker::Routine() {
     Lock();
     int ret = 0;
@@ -334,6 +437,8 @@ void ExynosDisplay::PowerHalHintWorker::Routine() {
     uint64_t deadlineTime = mIdleHintDeadlineTime;
     hwc2_power_mode_t powerMode = mPowerModeState;
     uint32_t vsyncPeriod = mVsyncPeriod;
+    uint32_t contentFps = mContentFps;
+    uint32_t refreshRateVote = mRefreshRateVote;
 
     /*
      * Clear the flags here instead of clearing them after calling the hint
@@ -345,10 +450,23 @@ void ExynosDisplay::PowerHalHintWorker::Routine() {
     mNeedUpdateRefreshRateHint = false;
     Unlock();
 
+    /*
+     * Power HAL ext has no call taking several modes, so the refresh rate and
+     * idle hints can't share a transaction. They are at least sent from the
+     * same wakeup, and never from the present path.
+     */
     updateIdleHint(deadlineTime);
 
     if (needUpdateRefreshRateHint) {
         int32_t rc = updateRefreshRateHintInternal(powerMode, vsyncPeriod);
+        int32_t contentRc = updateFpsHintInternal(powerMode, "CONTENT_", contentFps,
+                                                  mPrevContentFps, mContentFpsHintSupportMap);
+        int32_t voteRc = updateFpsHintInternal(powerMode, "VOTE_", refreshRateVote,
+                                               mPrevRefreshRateVote, mRefreshRateVoteHintSupportMap);
+        if (rc == NO_ERROR || rc == -EOPNOTSUPP)
+            rc = contentRc;
+        if (rc == NO_ERROR || rc == -EOPNOTSUPP)
+            rc = voteRc;
         if (rc != NO_ERROR && rc != -EOPNOTSUPP) {
             Lock();
             if (mPowerModeState == HWC2_POWER_MODE_ON) {
@@ -360,35 +478,78 @@ void ExynosDisplay::PowerHalHintWorker::Routine() {
     }
 }
 
-int ExynosSortedLayer::compare(ExynosLayer * const *lhs, ExynosLayer *const *rhs)
+size_t ExynosSortedLayer::getInsertPosition(const ExynosLayer *item) const
+{
+    /* After the layers with the same z-order */
+    auto it = std::upper_bound(mLayers.begin(), mLayers.end(), item,
+            [](const ExynosLayer *lhs, const ExynosLayer *rhs) {
+                return lhs->mZOrder < rhs->mZOrder;
+            });
+    return it - mLayers.begin();
+}
+
+void ExynosSortedLayer::updateIndices(size_t from, size_t to)
 {
-    ExynosLayer *left = *((ExynosLayer**)(lhs));
-    ExynosLayer *right = *((ExynosLayer**)(rhs));
-    return left->mZOrder > right->mZOrder;
+    for (size_t i = from; (i < to) && (i < mLayers.size()); i++)
+        mLayers[i]->mIndexInDisplay = i;
+}
+
+void ExynosSortedLayer::add(ExynosLayer *item)
+{
+    size_t pos = getInsertPosition(item);
+    mLayers.insert(mLayers.begin() + pos, item);
+    updateIndices(pos, mLayers.size());
+}
+
+ssize_t ExynosSortedLayer::indexOf(const ExynosLayer *item) const
+{
+    ssize_t index = item->mIndexInDisplay;
+    if ((index < 0) || ((size_t)index >= mLayers.size()) || (mLayers[index] != item))
+        return -1;
+    return index;
 }
 
 ssize_t ExynosSortedLayer::remove(const ExynosLayer *item)
 {
-    for (size_t i = 0; i < size(); i++)
-    {
-        if (array()[i] == item)
-        {
-            removeAt(i);
-            return i;
-        }
-    }
-    return -1;
+    ssize_t index = indexOf(item);
+    if (index >= 0)
+        removeAt(index);
+    return index;
 }
 
-status_t ExynosSortedLayer::vector_sort()
+void ExynosSortedLayer::removeAt(size_t index)
 {
-    return sort(compare);
+    mLayers[index]->mIndexInDisplay = -1;
+    mLayers.erase(mLayers.begin() + index);
+    updateIndices(index, mLayers.size());
+}
+
+void ExynosSortedLayer::clear()
+{
+    for (auto layer : mLayers)
+        layer->mIndexInDisplay = -1;
+    mLayers.clear();
+}
+
+void ExynosSortedLayer::updateZOrder(ExynosLayer *item)
+{
+    ssize_t index = indexOf(item);
+    if (index < 0)
+        return;
+
+    mLayers.erase(mLayers.begin() + index);
+    size_t pos = getInsertPosition(item);
+    mLayers.insert(mLayers.begin() + pos, item);
+    updateIndices(min((size_t)index, pos), max((size_t)index, pos) + 1);
 }
 
 ExynosLowFpsLayerInfo::ExynosLowFpsLayerInfo()
     : mHasLowFpsLayer(false),
     mFirstIndex(-1),
-    mLastIndex(-1)
+    mLastIndex(-1),
+    mStrategy(LOW_FPS_COMPOSE_CLIENT),
+    mComposedFrames(0),
+    mReusedFrames(0)
 {
 }
 
@@ -399,6 +560,16 @@ void ExynosLowFpsLayerInfo::initializeInfos()
     mLastIndex = -1;
 }
 
+void ExynosLowFpsLayerInfo::dump(String8& result)
+{
+    result.appendFormat("Low fps layers: %s", mHasLowFpsLayer ? "" : "none, ");
+    if (mHasLowFpsLayer)
+        result.appendFormat("[%d, %d] ", mFirstIndex, mLastIndex);
+    result.appendFormat("strategy: %s, G2D composed: %" PRIu64 ", reused: %" PRIu64 "\n",
+            (mStrategy == LOW_FPS_COMPOSE_EXYNOS) ? "exynos" : "client",
+            mComposedFrames, mReusedFrames);
+}
+
 int32_t ExynosLowFpsLayerInfo::addLowFpsLayer(uint32_t layerIndex)
 {
     if (mHasLowFpsLayer == false) {
@@ -592,6 +763,7 @@ ExynosDisplay::ExynosDisplay(uint32_t index, ExynosDevice *device)
         mDynamicReCompMode(NO_MODE_SWITCH),
         mDREnable(false),
         mDRDefault(false),
+        mDRTimerFd(-1),
         mLastFpsTime(0),
         mFrameCount(0),
         mLastFrameCount(0),
@@ -622,17 +794,23 @@ ExynosDisplay::ExynosDisplay(uint32_t index, ExynosDevice *device)
         mMaxBrightness(0),
         mVsyncPeriodChangeConstraints{systemTime(SYSTEM_TIME_MONOTONIC), 0},
         mVsyncAppliedTimeLine{false, 0, systemTime(SYSTEM_TIME_MONOTONIC)},
-        mConfigRequestState(hwc_request_state_t::SET_CONFIG_STATE_NONE) {
+        mConfigRequestState(hwc_request_state_t::SET_CONFIG_STATE_NONE),
+        mColorUpdateWorker(this),
+        mEarlyValidateEpoch(0),
+        mEarlyValidateWorker(this) {
     mDisplayControl.enableCompositionCrop = true;
     mDisplayControl.enableExynosCompositionOptimization = true;
     mDisplayControl.enableClientCompositionOptimization = true;
     mDisplayControl.useMaxG2DSrc = false;
     mDisplayControl.handleLowFpsLayers = false;
     mDisplayControl.earlyStartMPP = true;
+    mDisplayControl.mergeM2mLayers = false;
+    mDisplayControl.groupLayersByOverlap = false;
     mDisplayControl.adjustDisplayFrame = false;
     mDisplayControl.cursorSupport = false;
 
     mDisplayConfigs.clear();
+    std::atomic_store(&mDisplayConfigTable, std::shared_ptr<const display_config_table_t>());
 
     mPowerModeState = HWC2_POWER_MODE_OFF;
     mVsyncState = HWC2_VSYNC_DISABLE;
@@ -655,14 +833,238 @@ ExynosDisplay::ExynosDisplay(uint32_t index, ExynosDevice *device)
 
     mLowFpsLayerInfo.initializeInfos();
 
+    mDRTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (mDRTimerFd < 0)
+        ALOGE("Failed to create dynamic recomposition timer: %s", strerror(errno));
+
+    mPsrMode = property_get_int32(
+            ("vendor.display." + std::to_string(mIndex) + ".psr_mode").c_str(), PSR_NONE);
+    if ((mPsrMode < PSR_NONE) || (mPsrMode >= PSR_MAX))
+        mPsrMode = PSR_NONE;
+    if (mPsrMode != PSR_NONE)
+        mPowerHalHint.setIdleCallback([this]() { enterSelfRefresh(); });
+
+    mMaxWinUpdateRegions = property_get_int32("vendor.display.win_update.max_regions", 1);
+    if ((mMaxWinUpdateRegions == 0) || (mMaxWinUpdateRegions > MAX_WIN_UPDATE_REGIONS))
+        mMaxWinUpdateRegions = 1;
+
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get(("vendor.display." + std::to_string(mIndex) + ".client_target_scale").c_str(),
+                     value, nullptr) > 0) {
+        mClientTargetScale = std::atof(value);
+        if ((mClientTargetScale < 0.5f) || (mClientTargetScale > 1.0f))
+            mClientTargetScale = 1.0f;
+    }
+
     mUseDpu = true;
     mBrightnessState.reset();
 
+    mAsyncColorUpdate = property_get_bool(
+            ("vendor.display." + std::to_string(mIndex) + ".async_color_update").c_str(), false);
+    if (mAsyncColorUpdate)
+        mColorUpdateWorker.init();
+
+    mEarlyValidate = property_get_bool(
+            ("vendor.display." + std::to_string(mIndex) + ".early_validate").c_str(), false);
+    if (mEarlyValidate)
+        mEarlyValidateWorker.init();
+
     return;
 }
 
 ExynosDisplay::~ExynosDisplay()
 {
+    if (mAsyncColorUpdate)
+        mColorUpdateWorker.Exit();
+    if (mEarlyValidate)
+        mEarlyValidateWorker.Exit();
+    if (mDRTimerFd >= 0)
+        close(mDRTimerFd);
+}
+
+ExynosDisplay::ColorUpdateWorker::ColorUpdateWorker(ExynosDisplay *display)
+      : Worker("DisplayColorUpdate", ThreadRole::DISPLAY_URGENT),
+        mDisplay(display),
+        mPending(false),
+        mRunning(false) {}
+
+void ExynosDisplay::ColorUpdateWorker::request() {
+    Lock();
+    mPending = true;
+    Signal();
+    Unlock();
+}
+
+void ExynosDisplay::ColorUpdateWorker::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return !mPending && !mRunning; });
+}
+
+bool ExynosDisplay::ColorUpdateWorker::isRunning() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return mPending || mRunning;
+}
+
+void ExynosDisplay::ColorUpdateWorker::Routine() {
+    Lock();
+    if (!mPending && WaitForSignalOrExitLocked() == -EINTR) {
+        Unlock();
+        return;
+    }
+    if (!mPending) {
+        Unlock();
+        return;
+    }
+    mPending = false;
+    mRunning = true;
+    Unlock();
+
+    ATRACE_NAME("asyncColorUpdate");
+    int32_t ret = mDisplay->updateColorConversionInfo();
+    if (ret != NO_ERROR)
+        ALOGE("%s:: updateColorConversionInfo() fail, ret(%d)", __func__, ret);
+
+    Lock();
+    mRunning = false;
+    Signal();
+    Unlock();
+}
+
+ExynosDisplay::EarlyValidateWorker::EarlyValidateWorker(ExynosDisplay *display)
+      : Worker("DisplayEarlyValidate", ThreadRole::DISPLAY_URGENT),
+        mDisplay(display),
+        mCurrent(nullptr) {}
+
+void ExynosDisplay::EarlyValidateWorker::request(ExynosLayer *layer, uint32_t epoch) {
+    Lock();
+    auto it = std::find_if(mPending.begin(), mPending.end(),
+                           [layer](const auto &pending) { return pending.first == layer; });
+    if (it != mPending.end())
+        it->second = epoch;
+    else
+        mPending.emplace_back(layer, epoch);
+    Signal();
+    Unlock();
+}
+
+void ExynosDisplay::EarlyValidateWorker::cancel() {
+    Lock();
+    mPending.clear();
+    Unlock();
+}
+
+void ExynosDisplay::EarlyValidateWorker::forget(ExynosLayer *layer) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    mPending.erase(std::remove_if(mPending.begin(), mPending.end(),
+                                  [layer](const auto &pending) { return pending.first == layer; }),
+                   mPending.end());
+    cond_.wait(lock, [this, layer] { return mCurrent != layer; });
+}
+
+void ExynosDisplay::EarlyValidateWorker::Routine() {
+    Lock();
+    if (mPending.empty() && WaitForSignalOrExitLocked() == -EINTR) {
+        Unlock();
+        return;
+    }
+    if (mPending.empty()) {
+        Unlock();
+        return;
+    }
+    ExynosLayer *layer = mPending.front().first;
+    uint32_t epoch = mPending.front().second;
+    mPending.erase(mPending.begin());
+    mCurrent = layer;
+    Unlock();
+
+    mDisplay->earlyValidateLayer(layer, epoch);
+
+    Lock();
+    mCurrent = nullptr;
+    Signal();
+    Unlock();
+}
+
+void ExynosDisplay::requestEarlyValidation(ExynosLayer *layer) {
+    layer->mEarlyValidated = false;
+    if (mEarlyValidate)
+        mEarlyValidateWorker.request(layer, mEarlyValidateEpoch);
+}
+
+void ExynosDisplay::cancelEarlyValidation(bool dropResults) {
+    if (!mEarlyValidate)
+        return;
+
+    mEarlyValidateEpoch++;
+    mEarlyValidateWorker.cancel();
+
+    if (dropResults) {
+        for (size_t i = 0; i < mLayers.size(); i++)
+            mLayers[i]->mEarlyValidated = false;
+    }
+}
+
+/*
+ * Runs the per-layer part of validateDisplay() while SurfaceFlinger is still
+ * sending the setters of other layers. The MPP check goes into the cache of
+ * updateSupportedMPPFlag(), which uses it only if the key is unchanged at
+ * validate time. Both locks are held as in validateDisplay(), so a setter
+ * waits for one layer at most.
+ */
+void ExynosDisplay::earlyValidateLayer(ExynosLayer *layer, uint32_t epoch) {
+    ATRACE_CALL();
+    TimedMutex::Autolock lock(mDisplayMutex);
+
+    /* Validated or presented since the request, or updated again */
+    if ((epoch != mEarlyValidateEpoch) || layer->mEarlyValidated || mPauseDisplay)
+        return;
+    if ((layer->mLayerBuffer == NULL) || (layer->mLayerFlag & EXYNOS_HWC_IGNORE_LAYER))
+        return;
+
+    if (layer->doPreProcess() < 0)
+        return;
+    layer->mEarlyValidated = true;
+
+    exynos_image src_img;
+    exynos_image dst_img;
+    layer->setSrcExynosImage(&src_img);
+    layer->setDstExynosImage(&dst_img);
+    dst_img.format = DEFAULT_MPP_DST_FORMAT;
+
+    /* Other layers keep the state of the last validate */
+    bool hasHdrLayer = mHasHdrLayer || layer->mIsHdrLayer;
+    bool hasDrmLayer = mHasDrmLayer ||
+            (getDrmMode(layer->getBufferMeta(layer->mLayerBuffer)->producerUsage) != NO_DRM);
+    mpp_supported_key_t key = mResourceManager->getSupportedMPPKey(this, src_img, dst_img,
+            hasHdrLayer, hasDrmLayer);
+
+    TimedMutex::Autolock assignLock(mResourceManager->mAssignMutex);
+    mResourceManager->prepareSupportedMPPFlag(this, layer, src_img, dst_img, key);
+}
+
+/*
+ * Updates the color pipeline for the frame being validated. In the async
+ * mode a deferrable change is computed by mColorUpdateWorker: the frame
+ * keeps the previous color state if the result isn't ready at present and
+ * the new LUTs are committed with the next frame.
+ */
+int32_t ExynosDisplay::requestColorConversionInfo(bool deferrable) {
+    /* Doze frames keep the color state of the first one */
+    if (mMinimalDozeComposition && (mGeometryChanged == 0))
+        return NO_ERROR;
+
+    if (!mAsyncColorUpdate)
+        return updateColorConversionInfo();
+
+    /* a change is late by one frame at most */
+    mColorUpdateWorker.waitIdle();
+
+    /* new planes would need the DPP settings of this frame */
+    if (!deferrable || mGeometryChanged != 0 || !canDeferColorUpdate())
+        return updateColorConversionInfo();
+
+    mColorUpdateWorker.request();
+    return NO_ERROR;
 }
 
 /**
@@ -716,6 +1118,7 @@ void ExynosDisplay::initDisplay() {
 
     mDpuData.reset();
     mLastDpuData.reset();
+    mLastDpuDataHash = 0;
 
     if (mDisplayControl.earlyStartMPP == true) {
         for (size_t i = 0; i < mLayers.size(); i++) {
@@ -747,19 +1150,26 @@ void ExynosDisplay::initDisplay() {
  */
 int32_t ExynosDisplay::destroyLayer(hwc2_layer_t outLayer) {
 
-    Mutex::Autolock lock(mDRMutex);
     ExynosLayer *layer = (ExynosLayer *)outLayer;
 
     if (layer == nullptr) {
         return HWC2_ERROR_BAD_LAYER;
     }
 
+    /* The worker takes mDisplayMutex, mDRMutex isn't held while waiting for it */
+    if (mEarlyValidate)
+        mEarlyValidateWorker.forget(layer);
+
+    Mutex::Autolock lock(mDRMutex);
+
     if (mLayers.remove(layer) < 0) {
         auto it = std::find(mIgnoreLayers.begin(), mIgnoreLayers.end(), layer);
         if (it == mIgnoreLayers.end()) {
             ALOGE("%s:: There is no layer", __func__);
         } else {
             mIgnoreLayers.erase(it);
+            if (mBackgroundLayer == layer)
+                mBackgroundLayer = nullptr;
         }
     } else {
         setGeometryChanged(GEOMETRY_DISPLAY_LAYER_REMOVED);
@@ -793,16 +1203,13 @@ void ExynosDisplay::destroyLayers() {
         it = mIgnoreLayers.erase(it);
         delete layer;
     }
+    mBackgroundLayer = nullptr;
 }
 
 ExynosLayer *ExynosDisplay::checkLayer(hwc2_layer_t addr) {
     ExynosLayer *temp = (ExynosLayer *)addr;
-    if (!mLayers.isEmpty()) {
-        for (size_t i = 0; i < mLayers.size(); i++) {
-            if (mLayers[i] == temp)
-                return mLayers[i];
-        }
-    }
+    if ((temp != NULL) && (mLayers.indexOf(temp) >= 0))
+        return temp;
 
     if (mIgnoreLayers.size()) {
         auto it = std::find(mIgnoreLayers.begin(), mIgnoreLayers.end(), temp);
@@ -817,7 +1224,7 @@ void ExynosDisplay::checkIgnoreLayers() {
     for (auto it = mIgnoreLayers.begin(); it != mIgnoreLayers.end();) {
         ExynosLayer *layer = *it;
         if ((layer->mLayerFlag & EXYNOS_HWC_IGNORE_LAYER) == 0) {
-            mLayers.push_back(layer);
+            mLayers.add(layer);
             it = mIgnoreLayers.erase(it);
         } else {
             it++;
@@ -847,6 +1254,35 @@ void ExynosDisplay::checkIgnoreLayers() {
     }
 }
 
+/*
+ * The background layer was moved back to mLayers by checkIgnoreLayers(),
+ * it leaves them again if it is still eligible in this frame. Otherwise it
+ * goes through the resource manager and takes a colormap window.
+ */
+void ExynosDisplay::checkBackgroundColorLayer() {
+    ExynosLayer *prevLayer = mBackgroundLayer;
+    mBackgroundLayer = nullptr;
+
+    if ((mLayers.size() > 0) && mDisplayInterface->supportBackgroundColor() &&
+        mResourceManager->isBackgroundColorLayer(this, mLayers[0])) {
+        ExynosLayer *layer = mLayers[0];
+        layer->resetValidateData();
+        layer->mValidateCompositionType = layer->mCompositionType;
+        layer->mReleaseFence = -1;
+        mBackgroundColor = layer->mColor;
+        mBackgroundLayer = layer;
+        mIgnoreLayers.push_back(layer);
+        mLayers.removeAt(0);
+    }
+
+    if (prevLayer != mBackgroundLayer) {
+        DISPLAY_LOGD(eDebugResourceManager, "background color layer %p -> %p", prevLayer,
+                     mBackgroundLayer);
+        setGeometryChanged(mBackgroundLayer ? GEOMETRY_DISPLAY_LAYER_REMOVED
+                                            : GEOMETRY_DISPLAY_LAYER_ADDED);
+    }
+}
+
 /**
  * @return void
  */
@@ -857,8 +1293,6 @@ void ExynosDisplay::doPreProcessing() {
     bool hasClientLayer = false;
 
     for (size_t i=0; i < mLayers.size(); i++) {
-        buffer_handle_t handle = mLayers[i]->mLayerBuffer;
-        VendorGraphicBufferMeta gmeta(handle);
         if (mLayers[i]->mCompositionType == HWC2_COMPOSITION_CLIENT) {
             hasClientLayer = true;
         }
@@ -911,12 +1345,55 @@ void ExynosDisplay::doPreProcessing() {
 /**
  * @return int
  */
+/*
+ * Display local part of resource assignment
+ */
+int32_t ExynosDisplay::preProcessLayers()
+{
+    int32_t ret = 0;
+    mHasHdrLayer = false;
+    mHasDrmLayer = false;
+
+    for (uint32_t i = 0; i < mLayers.size(); i++) {
+        ExynosLayer *layer = mLayers[i];
+        bool earlyValidated = layer->mEarlyValidated;
+        layer->mEarlyValidated = false;
+        if (!earlyValidated && ((ret = layer->doPreProcess()) < 0)) {
+            HWC_LOGE(this, "%s:: doPreProcess() error, display(%d), layer %d", __func__, mType, i);
+            return ret;
+        }
+        /* mIsHdrLayer is known after preprocess */
+        if (layer->mIsHdrLayer) mHasHdrLayer = true;
+        if ((layer->mLayerBuffer != NULL) &&
+            (getDrmMode(layer->getBufferMeta(layer->mLayerBuffer)->producerUsage) != NO_DRM))
+            mHasDrmLayer = true;
+    }
+
+    // Re-align layer priority for max overlay resources
+    uint32_t mNumMaxPriorityLayers = 0;
+    for (int i = (mLayers.size()-1); i >= 0; i--) {
+        ExynosLayer *layer = mLayers[i];
+        HDEBUGLOGD(eDebugResourceManager, "Priority align: i:%d, layer priority:%d, Max:%d, mNumMaxPriorityAllowed:%d", i,
+                layer->mOverlayPriority, mNumMaxPriorityLayers, mNumMaxPriorityAllowed);
+        if (layer->mOverlayPriority == ePriorityMax) {
+            if (mNumMaxPriorityLayers >= mNumMaxPriorityAllowed) {
+                layer->mOverlayPriority = ePriorityHigh;
+            }
+            mNumMaxPriorityLayers++;
+        }
+    }
+
+    return NO_ERROR;
+}
+
 int ExynosDisplay::checkLayerFps() {
     mLowFpsLayerInfo.initializeInfos();
 
     if (mDisplayControl.handleLowFpsLayers == false)
         return NO_ERROR;
 
+    mLowFpsLayerInfo.mStrategy = mDisplayControl.lowFpsLayerStrategy;
+
     for (size_t i=0; i < mLayers.size(); i++) {
          if ((mLayers[i]->mOverlayPriority < ePriorityHigh) &&
              (mLayers[i]->getFps() < LOW_FPS_THRESHOLD)) {
@@ -936,6 +1413,109 @@ int ExynosDisplay::checkLayerFps() {
     return NO_ERROR;
 }
 
+/*
+ * Layers that are still updating must agree on a cadence, otherwise the
+ * content cadence is unknown. Static layers don't constrain it.
+ */
+void ExynosDisplay::updateContentFps() {
+    uint32_t contentFps = 0;
+
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        if (mLayers[i]->getFps() < LOW_FPS_THRESHOLD)
+            continue;
+        uint32_t layerFps = mLayers[i]->getContentFps();
+        if ((layerFps == 0) || (contentFps && (contentFps != layerFps))) {
+            contentFps = 0;
+            break;
+        }
+        contentFps = layerFps;
+    }
+
+    if (contentFps != mContentFps) {
+        DISPLAY_LOGD(eDebugDisplayConfig, "content fps %d -> %d", mContentFps, contentFps);
+        mContentFps = contentFps;
+        ATRACE_INT("ContentFps", contentFps);
+        updateRefreshRateHint();
+    }
+}
+
+/*
+ * HWC's own refresh rate vote: the lowest refresh rate in the active config
+ * group that is a multiple of every updating layer's cadence. Static layers,
+ * including the ones skipStaticLayers keeps out of composition, and layers
+ * without damage don't need any refresh.
+ */
+void ExynosDisplay::updateRefreshRateVote() {
+    uint64_t screenArea = (uint64_t)mXres * mYres;
+    uint64_t staticArea = 0;
+    uint32_t cadences[ExynosLayer::kCadenceNum];
+    size_t cadenceNum = 0;
+    String8 reason;
+
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        ExynosLayer *layer = mLayers[i];
+        uint64_t area = (uint64_t)WIDTH(layer->mDisplayFrame) * HEIGHT(layer->mDisplayFrame);
+        bool noDamage = (layer->mDamageNum == 1) &&
+            (layer->mDamageRects[0].left == 0) && (layer->mDamageRects[0].top == 0) &&
+            (layer->mDamageRects[0].right == 0) && (layer->mDamageRects[0].bottom == 0);
+        if ((layer->getFps() < LOW_FPS_THRESHOLD) || noDamage) {
+            staticArea += area;
+            continue;
+        }
+
+        uint32_t cadence = layer->getContentFps();
+        if (cadence == 0) {
+            reason.appendFormat("layer %zu updates at %u fps without cadence", i,
+                    layer->getFps());
+            cadenceNum = 0;
+            break;
+        }
+        if (std::find(cadences, cadences + cadenceNum, cadence) == cadences + cadenceNum)
+            cadences[cadenceNum++] = cadence;
+    }
+
+    uint32_t vote = 0;
+    if (reason.isEmpty()) {
+        const auto active = mDisplayConfigs.find(mActiveConfig);
+        for (const auto &it : mDisplayConfigs) {
+            const displayConfigs_t &config = it.second;
+            if ((active == mDisplayConfigs.end()) || (config.vsyncPeriod == 0) ||
+                (config.groupId != active->second.groupId))
+                continue;
+            uint32_t rate = static_cast<uint32_t>(round(nsecsPerSec / config.vsyncPeriod));
+            bool match = true;
+            for (size_t c = 0; c < cadenceNum; c++)
+                match &= ((rate % cadences[c]) == 0);
+            if (match && ((vote == 0) || (rate < vote)))
+                vote = rate;
+        }
+
+        if (cadenceNum == 0) {
+            reason.appendFormat("all layers static");
+        } else {
+            reason.appendFormat("cadence");
+            for (size_t c = 0; c < cadenceNum; c++)
+                reason.appendFormat(" %u", cadences[c]);
+            if (vote == 0)
+                reason.appendFormat(", no matching config");
+        }
+    }
+    if (screenArea)
+        reason.appendFormat(", static %" PRIu64 "%%", std::min(staticArea * 100 / screenArea,
+                    (uint64_t)100));
+
+    if (vote != mRefreshRateVote.refreshRate) {
+        DISPLAY_LOGD(eDebugDisplayConfig, "refresh rate vote %d -> %d (%s)",
+                mRefreshRateVote.refreshRate, vote, reason.string());
+        mRefreshRateVote.refreshRate = vote;
+        mRefreshRateVote.reason = reason;
+        ATRACE_INT("RefreshRateVote", vote);
+        updateRefreshRateHint();
+    } else {
+        mRefreshRateVote.reason = reason;
+    }
+}
+
 /**
  * @return int
  */
@@ -1053,6 +1633,27 @@ int ExynosDisplay::checkDynamicReCompMode() {
     return 0;
 }
 
+void ExynosDisplay::armDynamicReCompTimer() {
+    if ((mDRTimerFd < 0) || !exynosHWCControl.useDynamicRecomp || !mDREnable)
+        return;
+
+    struct itimerspec idle = {};
+    idle.it_value.tv_sec = mDevice->mDRIdleThresholdMs / 1000;
+    idle.it_value.tv_nsec = (mDevice->mDRIdleThresholdMs % 1000) * 1000000;
+    if (timerfd_settime(mDRTimerFd, 0, &idle, NULL) < 0)
+        DISPLAY_LOGE("%s: Failed to arm timer: %s", __func__, strerror(errno));
+}
+
+/*
+ * checkDynamicReCompMode() holds off a switch for a while after the previous
+ * one, so an idle display inside that window has to be checked again.
+ */
+bool ExynosDisplay::needDynamicReCompRecheck() {
+    Mutex::Autolock lock(mDRMutex);
+    return (mDynamicReCompMode != DEVICE_2_CLIENT) &&
+        ((systemTime(SYSTEM_TIME_MONOTONIC) - mLastModeSwitchTimeStamp) < (VSYNC_INTERVAL * 15));
+}
+
 /**
  * @return int
  */
@@ -1100,11 +1701,15 @@ int ExynosDisplay::handleStaticLayers(ExynosCompositionInfo& compositionInfo)
 
     /* Store configuration of client target configuration */
     if (compositionInfo.mSkipFlag == false) {
+        config.target_unchanged = isClientTargetUnchanged(compositionInfo, config);
         compositionInfo.mLastWinConfigData = config;
         DISPLAY_LOGD(eDebugSkipStaicLayer, "config[%d] is stored",
                 compositionInfo.mWindowIndex);
     } else {
         for (size_t i = (size_t)compositionInfo.mFirstIndex; i <= (size_t)compositionInfo.mLastIndex; i++) {
+            /* Device layers between the static client layers are still presented */
+            if (compositionInfo.mSkipSrcInfo.deviceLayer[i - compositionInfo.mFirstIndex])
+                continue;
             if ((mLayers[i]->mExynosCompositionType == HWC2_COMPOSITION_CLIENT) &&
                 (mLayers[i]->mAcquireFence >= 0))
                 fence_close(mLayers[i]->mAcquireFence, this, FENCE_TYPE_SRC_ACQUIRE, FENCE_IP_ALL);
@@ -1117,10 +1722,12 @@ int ExynosDisplay::handleStaticLayers(ExynosCompositionInfo& compositionInfo)
                     FENCE_TYPE_SRC_ACQUIRE, FENCE_IP_ALL);
 
             config = compositionInfo.mLastWinConfigData;
+            config.target_unchanged = false;
             /* Assigned otfMPP for client target can be changed */
             config.assignedMPP = compositionInfo.mOtfMPP;
             /* acq_fence was closed by DPU driver in the previous frame */
             config.acq_fence = -1;
+            config.updateHash();
         } else {
             /* Check target buffer is same with previous frame */
             if (!std::equal(config.fd_idma, config.fd_idma+3, compositionInfo.mLastWinConfigData.fd_idma)) {
@@ -1149,6 +1756,17 @@ int ExynosDisplay::handleStaticLayers(ExynosCompositionInfo& compositionInfo)
     return NO_ERROR;
 }
 
+/*
+ * High priority layers stay on the device even inside the client composition
+ * range, splitting the client layers into several regions. They aren't part
+ * of the client target, so they don't prevent reusing it.
+ */
+bool ExynosDisplay::isSkipStaticDeviceLayer(ExynosLayer *layer)
+{
+    return (layer->mOverlayPriority >= ePriorityHigh) &&
+        (layer->mValidateCompositionType == HWC2_COMPOSITION_DEVICE);
+}
+
 bool ExynosDisplay::skipStaticLayerChanged(ExynosCompositionInfo& compositionInfo)
 {
     if ((int)compositionInfo.mSkipSrcInfo.srcNum !=
@@ -1163,7 +1781,24 @@ bool ExynosDisplay::skipStaticLayerChanged(ExynosCompositionInfo& compositionInf
     for (size_t i = (size_t)compositionInfo.mFirstIndex; i <= (size_t)compositionInfo.mLastIndex; i++) {
         ExynosLayer *layer = mLayers[i];
         size_t index = i - compositionInfo.mFirstIndex;
-        if ((layer->mLayerBuffer == NULL) ||
+        bool deviceLayer = isSkipStaticDeviceLayer(layer);
+        if (compositionInfo.mSkipSrcInfo.deviceLayer[index] != deviceLayer) {
+            isChanged = true;
+            DISPLAY_LOGD(eDebugSkipStaicLayer, "layer[%zu] composition is changed (device %d -> %d)",
+                    i, compositionInfo.mSkipSrcInfo.deviceLayer[index], deviceLayer);
+            break;
+        } else if (deviceLayer) {
+            /* Its buffer may change, but it must not move over the client target */
+            if ((compositionInfo.mSkipSrcInfo.dstInfo[index].x != layer->mDstImg.x) ||
+                (compositionInfo.mSkipSrcInfo.dstInfo[index].y != layer->mDstImg.y) ||
+                (compositionInfo.mSkipSrcInfo.dstInfo[index].w != layer->mDstImg.w) ||
+                (compositionInfo.mSkipSrcInfo.dstInfo[index].h != layer->mDstImg.h)) {
+                isChanged = true;
+                DISPLAY_LOGD(eDebugSkipStaicLayer, "device layer[%zu] dst info is changed", i);
+                break;
+            }
+            continue;
+        } else if ((layer->mLayerBuffer == NULL) ||
             (compositionInfo.mSkipSrcInfo.srcInfo[index].bufferHandle != layer->mLayerBuffer))
         {
             isChanged = true;
@@ -1212,6 +1847,40 @@ bool ExynosDisplay::skipStaticLayerChanged(ExynosCompositionInfo& compositionInf
     return isChanged;
 }
 
+/*
+ * SurfaceFlinger can hand over the client target it presented last time when
+ * no client composited layer changed. Only the same buffer with the same window
+ * configuration counts, a buffer being scanned out can't have been redrawn.
+ */
+bool ExynosDisplay::isClientTargetUnchanged(const ExynosCompositionInfo& compositionInfo,
+        const exynos_win_config_data& config)
+{
+    const exynos_win_config_data &lastConfig = compositionInfo.mLastWinConfigData;
+
+    if ((compositionInfo.mType != COMPOSITION_CLIENT) ||
+        (compositionInfo.mTargetBuffer == NULL) ||
+        (config.state != config.WIN_STATE_BUFFER) ||
+        (lastConfig.state != lastConfig.WIN_STATE_BUFFER) ||
+        (mGeometryChanged != 0))
+        return false;
+
+    if ((config.buffer_id != lastConfig.buffer_id) ||
+        (config.attr_hash != lastConfig.attr_hash) ||
+        (config.geometry_hash != lastConfig.geometry_hash))
+        return false;
+
+    for (int32_t i = compositionInfo.mFirstIndex; i <= compositionInfo.mLastIndex; i++) {
+        ExynosLayer *layer = mLayers[i];
+        if ((layer->mValidateCompositionType == HWC2_COMPOSITION_CLIENT) &&
+            (layer->mLayerBuffer != layer->mLastLayerBuffer))
+            return false;
+    }
+
+    DISPLAY_LOGD(eDebugSkipStaicLayer, "client target is unchanged, buffer_id(%" PRIu64 ")",
+            config.buffer_id);
+    return true;
+}
+
 /**
  * @param compositionType
  * @return int
@@ -1253,6 +1922,8 @@ int ExynosDisplay::skipStaticLayers(ExynosCompositionInfo& compositionInfo)
             ExynosLayer *layer = mLayers[i];
             if (layer->mValidateCompositionType == COMPOSITION_CLIENT) {
                 layer->mOverlayInfo |= eSkipStaticLayer;
+            } else if (compositionInfo.mSkipSrcInfo.deviceLayer[i - compositionInfo.mFirstIndex]) {
+                continue;
             } else {
                 compositionInfo.mSkipStaticInitFlag = false;
                 if (layer->mOverlayPriority < ePriorityHigh) {
@@ -1284,6 +1955,7 @@ int ExynosDisplay::skipStaticLayers(ExynosCompositionInfo& compositionInfo)
         size_t index = i - compositionInfo.mFirstIndex;
         compositionInfo.mSkipSrcInfo.srcInfo[index] = layer->mSrcImg;
         compositionInfo.mSkipSrcInfo.dstInfo[index] = layer->mDstImg;
+        compositionInfo.mSkipSrcInfo.deviceLayer[index] = isSkipStaticDeviceLayer(layer);
         DISPLAY_LOGD(eDebugSkipStaicLayer, "mSkipSrcInfo.srcInfo[%zu] is initialized, %p",
                 index, layer->mSrcImg.bufferHandle);
     }
@@ -1352,6 +2024,7 @@ bool ExynosDisplay::validateExynosCompositionLayer()
  * @return int
  */
 int ExynosDisplay::doExynosComposition() {
+    StageLatencyStats::ScopedTimer timer(mStageStats, FRAME_STAGE_EXYNOS_COMPOSITION);
     int ret = NO_ERROR;
     exynos_image src_img;
     exynos_image dst_img;
@@ -1381,11 +2054,21 @@ int ExynosDisplay::doExynosComposition() {
             return -EINVAL;
         }
 
+        uint64_t dstContentHit = mExynosCompositionInfo.mM2mMPP->mDstContentHit;
         if ((ret = mExynosCompositionInfo.mM2mMPP->doPostProcessing(mExynosCompositionInfo.mSrcImg,
                 mExynosCompositionInfo.mDstImg)) != NO_ERROR) {
             DISPLAY_LOGE("exynosComposition doPostProcessing fail ret(%d)", ret);
             return ret;
         }
+        if ((mLowFpsLayerInfo.mHasLowFpsLayer) &&
+            (mLowFpsLayerInfo.mStrategy == LOW_FPS_COMPOSE_EXYNOS) &&
+            (mExynosCompositionInfo.mFirstIndex <= mLowFpsLayerInfo.mFirstIndex) &&
+            (mLowFpsLayerInfo.mLastIndex <= mExynosCompositionInfo.mLastIndex)) {
+            if (mExynosCompositionInfo.mM2mMPP->mDstContentHit != dstContentHit)
+                mLowFpsLayerInfo.mReusedFrames++;
+            else
+                mLowFpsLayerInfo.mComposedFrames++;
+        }
 
         for (int32_t i = mExynosCompositionInfo.mFirstIndex; i <= mExynosCompositionInfo.mLastIndex; i++) {
             /* break when only framebuffer target is assigned on ExynosCompositor */
@@ -1529,18 +2212,24 @@ int32_t ExynosDisplay::configureHandle(ExynosLayer &layer, int fence_fd, exynos_
         return ret;
     }
 
-    VendorGraphicBufferMeta gmeta(handle);
+    /* Layer buffers come from the per-layer cache, M2M destination buffers are parsed here */
+    ExynosLayer::BufferMeta dstMeta;
+    const ExynosLayer::BufferMeta *bufferMeta = &dstMeta;
+    if (handle == layer.mLayerBuffer)
+        bufferMeta = layer.getBufferMeta(handle);
+    else
+        ExynosLayer::parseBufferMeta(handle, dstMeta);
 
     if (!layer.mPreprocessedInfo.mUsePrivateFormat)
-        cfg.format = gmeta.format;
+        cfg.format = bufferMeta->format;
     else
         cfg.format = layer.mPreprocessedInfo.mPrivateFormat;
 
-    cfg.buffer_id = gmeta.unique_id;
-    cfg.fd_idma[0] = gmeta.fd;
-    cfg.fd_idma[1] = gmeta.fd1;
-    cfg.fd_idma[2] = gmeta.fd2;
-    cfg.protection = (getDrmMode(gmeta.producer_usage) == SECURE_DRM) ? 1 : 0;
+    cfg.buffer_id = bufferMeta->uniqueId;
+    cfg.fd_idma[0] = bufferMeta->fd;
+    cfg.fd_idma[1] = bufferMeta->fd1;
+    cfg.fd_idma[2] = bufferMeta->fd2;
+    cfg.protection = (getDrmMode(bufferMeta->producerUsage) == SECURE_DRM) ? 1 : 0;
 
     exynos_image src_img = layer.mSrcImg;
 
@@ -1588,11 +2277,12 @@ int32_t ExynosDisplay::configureHandle(ExynosLayer &layer, int fence_fd, exynos_
                 return -EINVAL;
             }
             if (layer.mBufferHasMetaParcel) {
-                VendorGraphicBufferMeta layer_buffer_gmeta(layer.mLayerBuffer);
-                if (layer_buffer_gmeta.flags & VendorGraphicBufferMeta::PRIV_FLAGS_USES_2PRIVATE_DATA)
-                    cfg.fd_idma[parcelFdIndex] = layer_buffer_gmeta.fd1;
-                else if (layer_buffer_gmeta.flags & VendorGraphicBufferMeta::PRIV_FLAGS_USES_3PRIVATE_DATA)
-                    cfg.fd_idma[parcelFdIndex] = layer_buffer_gmeta.fd2;
+                const ExynosLayer::BufferMeta *layerBufferMeta =
+                        layer.getBufferMeta(layer.mLayerBuffer);
+                if (layerBufferMeta->flags & VendorGraphicBufferMeta::PRIV_FLAGS_USES_2PRIVATE_DATA)
+                    cfg.fd_idma[parcelFdIndex] = layerBufferMeta->fd1;
+                else if (layerBufferMeta->flags & VendorGraphicBufferMeta::PRIV_FLAGS_USES_3PRIVATE_DATA)
+                    cfg.fd_idma[parcelFdIndex] = layerBufferMeta->fd2;
             } else {
                 cfg.fd_idma[parcelFdIndex] = layer.mMetaParcelFd;
             }
@@ -1636,10 +2326,10 @@ int32_t ExynosDisplay::configureHandle(ExynosLayer &layer, int fence_fd, exynos_
 
             if (layer.mBufferHasMetaParcel == false) {
                 uint32_t parcelFdIndex =
-                        getBufferNumOfFormat(gmeta.format, getCompressionType(handle));
+                        getBufferNumOfFormat(bufferMeta->format, getCompressionType(handle));
                 if (parcelFdIndex == 0) {
                     DISPLAY_LOGE("%s:: failed to get parcelFdIndex for srcImg with format: %d",
-                                 __func__, gmeta.format);
+                                 __func__, bufferMeta->format);
                     return -EINVAL;
                 }
 
@@ -1652,8 +2342,8 @@ int32_t ExynosDisplay::configureHandle(ExynosLayer &layer, int fence_fd, exynos_
              * and uses 0.0001nit unit for min luminance
              * Conversion is required
              */
-            luminanceMin = src_img.metaParcel.sHdrStaticInfo.sType1.mMinDisplayLuminance;
-            luminanceMax = src_img.metaParcel.sHdrStaticInfo.sType1.mMaxDisplayLuminance/10000;
+            luminanceMin = src_img.getMetaParcel().sHdrStaticInfo.sType1.mMinDisplayLuminance;
+            luminanceMax = src_img.getMetaParcel().sHdrStaticInfo.sType1.mMaxDisplayLuminance/10000;
             DISPLAY_LOGD(eDebugMPP, "HWC2: DPP luminance min %d, max %d", luminanceMin, luminanceMax);
         } else {
             cfg.hdr_enable = true;
@@ -1709,12 +2399,12 @@ int32_t ExynosDisplay::configureHandle(ExynosLayer &layer, int fence_fd, exynos_
         cfg.src.h = pixel_align_down(cfg.src.h, srcCropHeightAlign);
     }
 
-    uint64_t bufSize = gmeta.size * formatToBpp(gmeta.format);
+    uint64_t bufSize = bufferMeta->size * formatToBpp(bufferMeta->format);
     uint64_t srcSize = cfg.src.f_w * cfg.src.f_h * formatToBpp(cfg.format);
 
-    if (!isFormatLossy(gmeta.format) && (bufSize < srcSize)) {
+    if (!isFormatLossy(bufferMeta->format) && (bufSize < srcSize)) {
         DISPLAY_LOGE("%s:: buffer size is smaller than source size, buf(size: %d, format: %d), src(w: %d, h: %d, format: %d)",
-                __func__, gmeta.size, gmeta.format, cfg.src.f_w, cfg.src.f_h, cfg.format);
+                __func__, bufferMeta->size, bufferMeta->format, cfg.src.f_w, cfg.src.f_h, cfg.format);
         return -EINVAL;
     }
 
@@ -1728,6 +2418,7 @@ int32_t ExynosDisplay::configureOverlay(ExynosLayer *layer, exynos_win_config_da
     if(layer != NULL) {
         if ((ret = configureHandle(*layer, layer->mAcquireFence, cfg)) != NO_ERROR)
             return ret;
+        cfg.updateHash();
 
         /* This will be closed by setReleaseFences() using config.acq_fence */
         layer->mAcquireFence = -1;
@@ -1762,6 +2453,7 @@ int32_t ExynosDisplay::configureOverlay(ExynosCompositionInfo &compositionInfo)
                         FENCE_TYPE_SRC_ACQUIRE, FENCE_IP_FB);
             }
             config.state = config.WIN_STATE_DISABLED;
+            config.updateHash();
             return NO_ERROR;
         } else {
             HWC_LOGE(this, "%s:: ExynosCompositionInfo(%d) has invalid data, handle(%p)",
@@ -1799,8 +2491,14 @@ int32_t ExynosDisplay::configureOverlay(ExynosCompositionInfo &compositionInfo)
             HWC_LOGE(this, "unknown composition type: %d", compositionInfo.mType);
     }
 
+    /* The composition crop is in panel coordinates, the scaled target has none */
+    uint32_t srcWidth = mXres, srcHeight = mYres;
+    if (compositionInfo.mType == COMPOSITION_CLIENT)
+        getClientTargetSize(srcWidth, srcHeight);
+
     bool useCompositionCrop = true;
     if ((mDisplayControl.enableCompositionCrop) &&
+        (srcWidth == mXres) && (srcHeight == mYres) &&
         (compositionInfo.mHasCompositionLayer) &&
         (compositionInfo.mFirstIndex >= 0) &&
         (compositionInfo.mLastIndex >= 0)) {
@@ -1899,8 +2597,8 @@ int32_t ExynosDisplay::configureOverlay(ExynosCompositionInfo &compositionInfo)
     if (useCompositionCrop == false) {
         config.src.x = 0;
         config.src.y = 0;
-        config.src.w = mXres;
-        config.src.h = mYres;
+        config.src.w = srcWidth;
+        config.src.h = srcHeight;
         config.dst.x = 0;
         config.dst.y = 0;
         config.dst.w = mXres;
@@ -1915,6 +2613,8 @@ int32_t ExynosDisplay::configureOverlay(ExynosCompositionInfo &compositionInfo)
     config.dataspace = compositionInfo.mSrcImg.dataSpace;
     config.hdr_enable = true;
 
+    config.updateHash();
+
     /* This will be closed by setReleaseFences() using config.acq_fence */
     compositionInfo.mAcquireFence = -1;
     DISPLAY_LOGD(eDebugSkipStaicLayer, "Configure composition target[%d], config[%d]!!!!",
@@ -2166,6 +2866,106 @@ int32_t ExynosDisplay::validateWinConfigData()
         return -EINVAL;
 }
 
+int32_t ExynosDisplay::testAssignedWindows(ExynosLayer* &demoteLayer)
+{
+    int32_t ret = NO_ERROR;
+    demoteLayer = NULL;
+
+    if ((mDisplayControl.testWinConfig == false) ||
+        (mPowerModeState == HWC2_POWER_MODE_OFF) ||
+        (mDevice->isInTUI()))
+        return NO_ERROR;
+
+    /*
+     * Buffers of composition targets and M2M destinations are not
+     * ready before presentDisplay
+     */
+    if (mClientCompositionInfo.mHasCompositionLayer ||
+        mExynosCompositionInfo.mHasCompositionLayer)
+        return NO_ERROR;
+
+    exynos_dpu_data dpuData;
+    dpuData.init(mMaxWindowNum);
+
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        ExynosLayer *layer = mLayers[i];
+        if ((layer->mValidateCompositionType != HWC2_COMPOSITION_DEVICE) ||
+            (layer->mOtfMPP == NULL))
+            continue;
+        if ((layer->mM2mMPP != NULL) ||
+            (layer->mWindowIndex >= dpuData.configs.size()))
+            return NO_ERROR;
+        if ((ret = configureHandle(*layer, -1, dpuData.configs[layer->mWindowIndex])) != NO_ERROR)
+            return NO_ERROR;
+    }
+
+    /* Buffers and fences don't affect the result */
+    size_t key = 0;
+    for (auto &config : dpuData.configs) {
+        hash_combine(key, static_cast<int32_t>(config.state));
+        if (config.state == config.WIN_STATE_DISABLED)
+            continue;
+        hash_combine(key, config.assignedMPP);
+        hash_combine(key, config.format);
+        hash_combine(key, config.compression);
+        hash_combine(key, config.protection);
+        hash_combine(key, config.transform);
+        hash_combine(key, config.blending);
+        hash_combine(key, config.plane_alpha);
+        hash_combine(key, static_cast<int32_t>(config.dataspace));
+        hash_combine(key, config.hdr_enable);
+        hash_combine(key, config.src.x);
+        hash_combine(key, config.src.y);
+        hash_combine(key, config.src.w);
+        hash_combine(key, config.src.h);
+        hash_combine(key, config.src.f_w);
+        hash_combine(key, config.src.f_h);
+        hash_combine(key, config.dst.x);
+        hash_combine(key, config.dst.y);
+        hash_combine(key, config.dst.w);
+        hash_combine(key, config.dst.h);
+        hash_combine(key, config.dst.f_w);
+        hash_combine(key, config.dst.f_h);
+    }
+
+    auto it = mTestWinConfigResults.find(key);
+    if (it != mTestWinConfigResults.end()) {
+        ret = it->second;
+    } else {
+        ret = mDisplayInterface->testWinConfigData(dpuData);
+        if (mTestWinConfigResults.size() >= MAX_TEST_WIN_CONFIG_RESULTS)
+            mTestWinConfigResults.clear();
+        mTestWinConfigResults[key] = ret;
+    }
+
+    if (ret == NO_ERROR)
+        return NO_ERROR;
+
+    /*
+     * TEST_ONLY commit doesn't report which plane was rejected.
+     * Demote the largest source that doesn't have high priority.
+     */
+    uint32_t maxArea = 0;
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        ExynosLayer *layer = mLayers[i];
+        if ((layer->mValidateCompositionType != HWC2_COMPOSITION_DEVICE) ||
+            (layer->mOtfMPP == NULL) ||
+            (layer->mOverlayPriority >= ePriorityHigh))
+            continue;
+        uint32_t area = WIDTH(layer->mPreprocessedInfo.sourceCrop) *
+            HEIGHT(layer->mPreprocessedInfo.sourceCrop);
+        if ((demoteLayer == NULL) || (area > maxArea)) {
+            demoteLayer = layer;
+            maxArea = area;
+        }
+    }
+
+    DISPLAY_LOGD(eDebugResourceManager, "TEST_ONLY commit failed (%d), demote layer(%p)",
+            ret, demoteLayer);
+
+    return ret;
+}
+
 /**
  * @return int
  */
@@ -2182,25 +2982,27 @@ bool ExynosDisplay::checkConfigChanged(const exynos_dpu_data &lastConfigsData, c
     if ((mDevice->checkNonInternalConnection()) && (mType == HWC_DISPLAY_PRIMARY))
         return true;
 
+    /* Display state outside of the window configs still has to be committed */
+    if (newConfigsData.enable_readback || mDisplayInterface->hasPendingDisplayUpdate())
+        return true;
+
     for (size_t i = 0; i < lastConfigsData.configs.size(); i++) {
-        if ((lastConfigsData.configs[i].state != newConfigsData.configs[i].state) ||
-            (lastConfigsData.configs[i].fd_idma[0] != newConfigsData.configs[i].fd_idma[0]) ||
-            (lastConfigsData.configs[i].fd_idma[1] != newConfigsData.configs[i].fd_idma[1]) ||
-            (lastConfigsData.configs[i].fd_idma[2] != newConfigsData.configs[i].fd_idma[2]) ||
-            (lastConfigsData.configs[i].dst.x != newConfigsData.configs[i].dst.x) ||
-            (lastConfigsData.configs[i].dst.y != newConfigsData.configs[i].dst.y) ||
-            (lastConfigsData.configs[i].dst.w != newConfigsData.configs[i].dst.w) ||
-            (lastConfigsData.configs[i].dst.h != newConfigsData.configs[i].dst.h) ||
-            (lastConfigsData.configs[i].src.x != newConfigsData.configs[i].src.x) ||
-            (lastConfigsData.configs[i].src.y != newConfigsData.configs[i].src.y) ||
-            (lastConfigsData.configs[i].src.w != newConfigsData.configs[i].src.w) ||
-            (lastConfigsData.configs[i].src.h != newConfigsData.configs[i].src.h) ||
-            (lastConfigsData.configs[i].format != newConfigsData.configs[i].format) ||
-            (lastConfigsData.configs[i].blending != newConfigsData.configs[i].blending) ||
-            (lastConfigsData.configs[i].plane_alpha != newConfigsData.configs[i].plane_alpha))
+        if ((lastConfigsData.configs[i].attr_hash != newConfigsData.configs[i].attr_hash) ||
+            (lastConfigsData.configs[i].geometry_hash != newConfigsData.configs[i].geometry_hash))
+            return true;
+        /* The same buffer with a pending acquire fence is being redrawn (front buffer rendering) */
+        if (fence_valid(newConfigsData.configs[i].acq_fence) &&
+            (sync_wait(newConfigsData.configs[i].acq_fence, 0) < 0))
             return true;
     }
 
+    if ((lastConfigsData.enable_win_update != newConfigsData.enable_win_update) ||
+        (lastConfigsData.win_update_region.x != newConfigsData.win_update_region.x) ||
+        (lastConfigsData.win_update_region.y != newConfigsData.win_update_region.y) ||
+        (lastConfigsData.win_update_region.w != newConfigsData.win_update_region.w) ||
+        (lastConfigsData.win_update_region.h != newConfigsData.win_update_region.h))
+        return true;
+
     /* To cover buffer payload changed case */
     for (size_t i = 0; i < mLayers.size(); i++) {
         if(mLayers[i]->mLastLayerBuffer != mLayers[i]->mLayerBuffer)
@@ -2210,32 +3012,42 @@ bool ExynosDisplay::checkConfigChanged(const exynos_dpu_data &lastConfigsData, c
     return false;
 }
 
+/* Hash of a whole frame, combined from the hashes kept in each window config */
+size_t ExynosDisplay::getDpuDataHash(const exynos_dpu_data &dpuData)
+{
+    size_t hash = 0;
+    for (auto &config : dpuData.configs) {
+        hash_combine(hash, config.attr_hash);
+        hash_combine(hash, config.geometry_hash);
+    }
+    hash_combine(hash, dpuData.enable_win_update);
+    if (dpuData.enable_win_update) {
+        hash_combine(hash, dpuData.win_update_region.x);
+        hash_combine(hash, dpuData.win_update_region.y);
+        hash_combine(hash, dpuData.win_update_region.w);
+        hash_combine(hash, dpuData.win_update_region.h);
+    }
+
+    /* 0 means there is no last frame to compare with */
+    return hash ? hash : 1;
+}
+
 int ExynosDisplay::checkConfigDstChanged(const exynos_dpu_data &lastConfigsData, const exynos_dpu_data &newConfigsData, uint32_t index)
 {
-    if ((lastConfigsData.configs[index].state != newConfigsData.configs[index].state) ||
-        (lastConfigsData.configs[index].fd_idma[0] != newConfigsData.configs[index].fd_idma[0]) ||
-        (lastConfigsData.configs[index].fd_idma[1] != newConfigsData.configs[index].fd_idma[1]) ||
-        (lastConfigsData.configs[index].fd_idma[2] != newConfigsData.configs[index].fd_idma[2]) ||
-        (lastConfigsData.configs[index].format != newConfigsData.configs[index].format) ||
-        (lastConfigsData.configs[index].blending != newConfigsData.configs[index].blending) ||
-        (lastConfigsData.configs[index].plane_alpha != newConfigsData.configs[index].plane_alpha)) {
+    const exynos_win_config_data &lastConfig = lastConfigsData.configs[index];
+    const exynos_win_config_data &newConfig = newConfigsData.configs[index];
+
+    if (lastConfig.attr_hash != newConfig.attr_hash) {
         DISPLAY_LOGD(eDebugWindowUpdate, "damage region is skip, but other configuration except dst was changed");
         DISPLAY_LOGD(eDebugWindowUpdate, "\tstate[%d, %d], fd[%d, %d], format[0x%8x, 0x%8x], blending[%d, %d], plane_alpha[%f, %f]",
-                lastConfigsData.configs[index].state, newConfigsData.configs[index].state,
-                lastConfigsData.configs[index].fd_idma[0], newConfigsData.configs[index].fd_idma[0],
-                lastConfigsData.configs[index].format, newConfigsData.configs[index].format,
-                lastConfigsData.configs[index].blending, newConfigsData.configs[index].blending,
-                lastConfigsData.configs[index].plane_alpha, newConfigsData.configs[index].plane_alpha);
+                lastConfig.state, newConfig.state,
+                lastConfig.fd_idma[0], newConfig.fd_idma[0],
+                lastConfig.format, newConfig.format,
+                lastConfig.blending, newConfig.blending,
+                lastConfig.plane_alpha, newConfig.plane_alpha);
         return -1;
     }
-    if ((lastConfigsData.configs[index].dst.x != newConfigsData.configs[index].dst.x) ||
-        (lastConfigsData.configs[index].dst.y != newConfigsData.configs[index].dst.y) ||
-        (lastConfigsData.configs[index].dst.w != newConfigsData.configs[index].dst.w) ||
-        (lastConfigsData.configs[index].dst.h != newConfigsData.configs[index].dst.h) ||
-        (lastConfigsData.configs[index].src.x != newConfigsData.configs[index].src.x) ||
-        (lastConfigsData.configs[index].src.y != newConfigsData.configs[index].src.y) ||
-        (lastConfigsData.configs[index].src.w != newConfigsData.configs[index].src.w) ||
-        (lastConfigsData.configs[index].src.h != newConfigsData.configs[index].src.h))
+    if (lastConfig.geometry_hash != newConfig.geometry_hash)
         return 1;
 
     else
@@ -2252,7 +3064,9 @@ int ExynosDisplay::deliverWinConfigData() {
     int ret = NO_ERROR;
     struct timeval tv_s, tv_e;
     long timediff;
+    size_t dpuDataHash;
 
+    mDpuDataCommitted = false;
     ret = validateWinConfigData();
     if (ret != NO_ERROR) {
         errString.appendFormat("Invalid WIN_CONFIG\n");
@@ -2264,8 +3078,16 @@ int ExynosDisplay::deliverWinConfigData() {
         dumpConfig(mDpuData.configs[i]);
     }
 
-    if (checkConfigChanged(mDpuData, mLastDpuData) == false) {
+    /*
+     * Most frames differ somewhere, the frame hash rejects them before looking at each window.
+     * A repeated frame isn't committed, the previous retire fence is returned and
+     * layers get no release fence since none of their buffers is replaced.
+     */
+    dpuDataHash = getDpuDataHash(mDpuData);
+    if ((dpuDataHash == mLastDpuDataHash) &&
+        (checkConfigChanged(mDpuData, mLastDpuData) == false)) {
         DISPLAY_LOGD(eDebugWinConfig, "Winconfig : same");
+        updateSelfRefresh(false, systemTime(SYSTEM_TIME_MONOTONIC), 0);
 #ifndef DISABLE_FENCE
         if (mLastRetireFence > 0) {
             mDpuData.retire_fence =
@@ -2302,11 +3124,20 @@ int ExynosDisplay::deliverWinConfigData() {
                     FENCE_TYPE_SRC_ACQUIRE, FENCE_IP_DPP, FENCE_TO);
         }
 
-        if ((ret = mDisplayInterface->deliverWinConfigData()) < 0) {
+        nsecs_t deliverStart = systemTime(SYSTEM_TIME_MONOTONIC);
+        ret = mDisplayInterface->deliverWinConfigData();
+        nsecs_t deliverEnd = systemTime(SYSTEM_TIME_MONOTONIC);
+        mStageStats.record(FRAME_STAGE_DELIVER_WIN_CONFIG, deliverEnd - deliverStart);
+        if (ret < 0) {
             errString.appendFormat("interface's deliverWinConfigData() failed: %s ret(%d)\n", strerror(errno), ret);
             goto err;
         } else {
-            mLastDpuData = mDpuData;
+            updateSelfRefresh(true, deliverEnd, deliverEnd - deliverStart);
+            if (mPowerOnStats.waitFirstCommit)
+                mPowerOnStats.record(POWER_ON_STAGE_FIRST_COMMIT);
+            mDpuDataCommitted = true;
+            mLastDpuDataHash = dpuDataHash;
+            updateCommittedBandwidth();
         }
 
         for (size_t i = 0; i < mDpuData.configs.size(); i++) {
@@ -2330,11 +3161,65 @@ err:
 /**
  * @return int
  */
+/* Takes the ownership of fence */
+int32_t ExynosDisplay::addSharedReleaseFence(int32_t fence, hwc_fdebug_ip_type ip) {
+    if (fence < 0)
+        return -1;
+    mSharedReleaseFences.push_back({fence, ip, 0});
+    return (int32_t)mSharedReleaseFences.size() - 1;
+}
+
+void ExynosDisplay::shareReleaseFence(ExynosLayer *layer, int32_t sharedFence) {
+    layer->mReleaseFence = -1;
+    layer->mSharedReleaseFence = sharedFence;
+    if (sharedFence >= 0)
+        mSharedReleaseFences[sharedFence].refCount++;
+}
+
+/*
+ * The last layer that takes a shared fence gets the fd itself,
+ * the others get a dup of it.
+ */
+int32_t ExynosDisplay::takeReleaseFence(ExynosLayer *layer) {
+    int32_t fence = layer->mReleaseFence;
+    layer->mReleaseFence = -1;
+
+    if (layer->mSharedReleaseFence < 0)
+        return fence;
+
+    SharedReleaseFence &shared = mSharedReleaseFences[layer->mSharedReleaseFence];
+    layer->mSharedReleaseFence = -1;
+    if (shared.refCount > 1) {
+        shared.refCount--;
+        return hwcCheckFenceDebug(this, FENCE_TYPE_SRC_RELEASE, shared.ip,
+                hwc_dup(shared.fence, this, FENCE_TYPE_SRC_RELEASE, shared.ip));
+    }
+    fence = hwcCheckFenceDebug(this, FENCE_TYPE_SRC_RELEASE, shared.ip, shared.fence);
+    shared.fence = -1;
+    shared.refCount = 0;
+    return fence;
+}
+
+void ExynosDisplay::clearSharedReleaseFences() {
+    for (size_t i = 0; i < mLayers.size(); i++)
+        mLayers[i]->mSharedReleaseFence = -1;
+    for (auto &shared : mSharedReleaseFences) {
+        if (shared.fence >= 0)
+            fence_close(shared.fence, this, FENCE_TYPE_SRC_RELEASE, shared.ip);
+    }
+    mSharedReleaseFences.clear();
+}
+
 int ExynosDisplay::setReleaseFences() {
+    HWC_TRACE_FUNC(eHwcTraceFence);
+    StageLatencyStats::ScopedTimer timer(mStageStats, FRAME_STAGE_RELEASE_FENCES);
 
     int release_fd = -1;
     String8 errString;
 
+    /* Fences of a frame that getReleaseFences() didn't take */
+    clearSharedReleaseFences();
+
     /*
      * Close release fence for client target buffer
      * SurfaceFlinger doesn't get release fence for client target buffer
@@ -2344,6 +3229,7 @@ int ExynosDisplay::setReleaseFences() {
         (mClientCompositionInfo.mWindowIndex < (int32_t)mDpuData.configs.size())) {
 
         exynos_win_config_data &config = mDpuData.configs[mClientCompositionInfo.mWindowIndex];
+        int32_t sharedFence = -1;
 
         for (int i = mClientCompositionInfo.mFirstIndex; i <= mClientCompositionInfo.mLastIndex; i++) {
             if (mLayers[i]->mExynosCompositionType != HWC2_COMPOSITION_CLIENT) {
@@ -2354,13 +3240,17 @@ int ExynosDisplay::setReleaseFences() {
                     continue;
                 }
             }
-            if (mType == HWC_DISPLAY_VIRTUAL)
+            if ((mType == HWC_DISPLAY_VIRTUAL) || (mLayers[i]->mLayerBuffer == NULL)) {
                 mLayers[i]->mReleaseFence = -1;
-            else
-                mLayers[i]->mReleaseFence =
-                    hwcCheckFenceDebug(this, FENCE_TYPE_SRC_RELEASE, FENCE_IP_DPP,
-                            hwc_dup(config.rel_fence, this,
-                                FENCE_TYPE_SRC_RELEASE, FENCE_IP_DPP));
+                continue;
+            }
+            /* All client composition layers are released with the client target */
+            if (sharedFence < 0) {
+                sharedFence = addSharedReleaseFence(config.rel_fence, FENCE_IP_DPP);
+                if (sharedFence >= 0)
+                    config.rel_fence = -1;
+            }
+            shareReleaseFence(mLayers[i], sharedFence);
         }
         config.rel_fence = fence_close(config.rel_fence, this,
                    FENCE_TYPE_SRC_RELEASE, FENCE_IP_FB);
@@ -2461,6 +3351,7 @@ int ExynosDisplay::setReleaseFences() {
             goto err;
         }
         exynos_win_config_data &config = mDpuData.configs[mExynosCompositionInfo.mWindowIndex];
+        int32_t sharedFence = -1;
         for (int i = mExynosCompositionInfo.mFirstIndex; i <= mExynosCompositionInfo.mLastIndex; i++) {
             /* break when only framebuffer target is assigned on ExynosCompositor */
             if (i == -1)
@@ -2475,9 +3366,11 @@ int ExynosDisplay::setReleaseFences() {
                 mLayers[i]->mReleaseFence =
                     mExynosCompositionInfo.mM2mMPP->getSrcReleaseFence(i-mExynosCompositionInfo.mFirstIndex);
             else {
-                mLayers[i]->mReleaseFence =
-                    hwc_dup(config.rel_fence,
-                            this, FENCE_TYPE_SRC_RELEASE, FENCE_IP_LAYER);
+                /* config.rel_fence is also the acquire fence of the next m2m dst */
+                if (sharedFence < 0)
+                    sharedFence = addSharedReleaseFence(hwc_dup(config.rel_fence,
+                                this, FENCE_TYPE_SRC_RELEASE, FENCE_IP_LAYER), FENCE_IP_LAYER);
+                shareReleaseFence(mLayers[i], sharedFence);
             }
 
             DISPLAY_LOGD(eDebugFence, "exynos composition layer[%d].releaseFencefd(%d)",
@@ -2555,7 +3448,7 @@ int32_t ExynosDisplay::createLayer(hwc2_layer_t* outLayer) {
     /* TODO : Implementation here */
     ExynosLayer *layer = new ExynosLayer(this);
 
-    /* TODO : Sort sequence should be added to somewhere */
+    /* Kept in z-order, setLayerZOrder() moves it later */
     mLayers.add((ExynosLayer*)layer);
 
     /* TODO : Set z-order to max, check outLayer address? */
@@ -2569,7 +3462,6 @@ int32_t ExynosDisplay::createLayer(hwc2_layer_t* outLayer) {
 
 int32_t ExynosDisplay::getActiveConfig(hwc2_config_t* outConfig)
 {
-    Mutex::Autolock lock(mDisplayMutex);
     return getActiveConfigInternal(outConfig);
 }
 
@@ -2682,9 +3574,12 @@ int32_t ExynosDisplay::getClientTargetSupport(uint32_t width, uint32_t height,
                                               int32_t /*android_pixel_format_t*/ format,
                                               int32_t /*android_dataspace_t*/ dataspace)
 {
-    if (width != mXres)
+    uint32_t targetWidth, targetHeight;
+    getClientTargetSize(targetWidth, targetHeight);
+
+    if ((width != mXres) && (width != targetWidth))
         return HWC2_ERROR_UNSUPPORTED;
-    if (height != mYres)
+    if ((height != mYres) && (height != targetHeight))
         return HWC2_ERROR_UNSUPPORTED;
     if (format != HAL_PIXEL_FORMAT_RGBA_8888)
         return HWC2_ERROR_UNSUPPORTED;
@@ -2704,29 +3599,36 @@ int32_t ExynosDisplay::getDisplayAttribute(
         hwc2_config_t config,
         int32_t /*hwc2_attribute_t*/ attribute, int32_t* outValue) {
 
+    auto table = getDisplayConfigTable();
+    const auto &displayConfigs = table ? table->attributes : mDisplayConfigs;
+    const auto its = displayConfigs.find(config);
+    if (its == displayConfigs.end())
+        return HWC2_ERROR_BAD_CONFIG;
+    const displayConfigs_t &displayConfig = its->second;
+
     switch (attribute) {
     case HWC2_ATTRIBUTE_VSYNC_PERIOD:
-        *outValue = mDisplayConfigs[config].vsyncPeriod;
+        *outValue = displayConfig.vsyncPeriod;
         break;
 
     case HWC2_ATTRIBUTE_WIDTH:
-        *outValue = mDisplayConfigs[config].width;
+        *outValue = displayConfig.width;
         break;
 
     case HWC2_ATTRIBUTE_HEIGHT:
-        *outValue = mDisplayConfigs[config].height;
+        *outValue = displayConfig.height;
         break;
 
     case HWC2_ATTRIBUTE_DPI_X:
-        *outValue = mDisplayConfigs[config].Xdpi;
+        *outValue = displayConfig.Xdpi;
         break;
 
     case HWC2_ATTRIBUTE_DPI_Y:
-        *outValue = mDisplayConfigs[config].Ydpi;
+        *outValue = displayConfig.Ydpi;
         break;
 
     case HWC2_ATTRIBUTE_CONFIG_GROUP:
-        *outValue = mDisplayConfigs[config].groupId;
+        *outValue = displayConfig.groupId;
         break;
 
     default:
@@ -2743,6 +3645,18 @@ int32_t ExynosDisplay::getDisplayConfigs(
     return mDisplayInterface->getDisplayConfigs(outNumConfigs, outConfigs);
 }
 
+void ExynosDisplay::publishDisplayConfigs(const std::vector<hwc2_config_t> &configs)
+{
+    auto table = std::make_shared<display_config_table_t>();
+    auto prevTable = getDisplayConfigTable();
+
+    table->generation = prevTable ? prevTable->generation + 1 : 1;
+    table->configs = configs;
+    table->attributes = mDisplayConfigs;
+    std::atomic_store(&mDisplayConfigTable,
+                      std::shared_ptr<const display_config_table_t>(std::move(table)));
+}
+
 int32_t ExynosDisplay::getDisplayName(uint32_t* outSize, char* outName)
 {
     if (outName == NULL) {
@@ -2847,7 +3761,7 @@ int32_t ExynosDisplay::getReleaseFences(
         uint32_t* outNumElements,
         hwc2_layer_t* outLayers, int32_t* outFences) {
 
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
     if (outLayers == NULL || outFences == NULL)
     {
         uint32_t deviceLayerNum = 0;
@@ -2857,12 +3771,11 @@ int32_t ExynosDisplay::getReleaseFences(
         uint32_t deviceLayerNum = 0;
         for (size_t i = 0; i < mLayers.size(); i++) {
             outLayers[deviceLayerNum] = (hwc2_layer_t)mLayers[i];
-            outFences[deviceLayerNum] = mLayers[i]->mReleaseFence;
             /*
              * layer's release fence will be closed by caller of this function.
              * HWC should not close this fence after this function is returned.
              */
-            mLayers[i]->mReleaseFence = -1;
+            outFences[deviceLayerNum] = takeReleaseFence(mLayers[i]);
 
             DISPLAY_LOGD(eDebugHWC, "[%zu] layer deviceLayerNum(%d), release fence: %d", i, deviceLayerNum, outFences[deviceLayerNum]);
             deviceLayerNum++;
@@ -2895,13 +3808,23 @@ int32_t ExynosDisplay::canSkipValidate() {
     if (mRenderingState == RENDERING_STATE_NONE)
         return SKIP_ERR_FIRST_FRAME;
 
-    if (mDevice->mGeometryChanged != 0) {
+    /*
+     * Layer and display bits of other displays are validated by their own frames,
+     * only the bits set for the whole device are shared.
+     */
+    if ((mGeometryChanged != 0) ||
+        (mDevice->mGeometryChanged & GEOMETRY_DEVICE_CHANGED_MASK)) {
         /* validateDisplay() should be called */
         return SKIP_ERR_GEOMETRY_CHAGNED;
     } else {
+        /*
+         * Client layers are composed into the client target by SurfaceFlinger
+         * only if their composition type is still client from the last validation.
+         */
         for (uint32_t i = 0; i < mLayers.size(); i++) {
-            if (getLayerCompositionTypeForValidationType(i) ==
-                    HWC2_COMPOSITION_CLIENT) {
+            if ((getLayerCompositionTypeForValidationType(i) ==
+                    HWC2_COMPOSITION_CLIENT) &&
+                (mLayers[i]->mCompositionType != HWC2_COMPOSITION_CLIENT)) {
                 return SKIP_ERR_HAS_CLIENT_COMP;
             }
         }
@@ -2928,6 +3851,7 @@ int32_t ExynosDisplay::canSkipValidate() {
 int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
 
     ATRACE_CALL();
+    HWC_TRACE_FUNC(eHwcTraceCommit);
     gettimeofday(&updateTimeInfo.lastPresentTime, NULL);
 
     int ret = HWC2_ERROR_NONE;
@@ -2941,7 +3865,10 @@ int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
         setTaskProfileDone = true;
     }
 
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
+    nsecs_t presentStart = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    cancelEarlyValidation(true);
 
     if (mPauseDisplay || mDevice->isInTUI()) {
         closeFencesForSkipFrame(RENDERING_STATE_PRESENTED);
@@ -2950,6 +3877,8 @@ int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
         return ret;
     }
 
+    armDynamicReCompTimer();
+
     /*
      * buffer handle, dataspace were set by setClientTarget() after validateDisplay
      * ExynosImage should be set again according to changed handle and dataspace
@@ -2961,8 +3890,12 @@ int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
     mClientCompositionInfo.setExynosMidImage(dst_img);
 
     funcReturnCallback presentRetCallback([&]() {
-        if (ret != HWC2_ERROR_NOT_VALIDATED)
+        if (ret != HWC2_ERROR_NOT_VALIDATED) {
             presentPostProcessing();
+            mStageStats.recordFrame(mValidateDuration +
+                    (systemTime(SYSTEM_TIME_MONOTONIC) - presentStart), mVsyncPeriod);
+            mValidateDuration = 0;
+        }
     });
 
     if (mSkipFrame) {
@@ -3014,7 +3947,7 @@ int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
 
         updateBrightnessState();
 
-        if (updateColorConversionInfo() != NO_ERROR) {
+        if (requestColorConversionInfo() != NO_ERROR) {
             ALOGE("%s:: updateColorConversionInfo() fail, ret(%d)",
                     __func__, ret);
         }
@@ -3126,6 +4059,16 @@ int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
     mPowerHalHint.signalIdle();
 
     handleWindowUpdate();
+    updateWindowUpdateStats();
+
+    /* A readback requested through setReadbackBuffer() takes this frame */
+    if (mDisplayControl.readbackSupport && !mDpuData.enable_readback) {
+        buffer_handle_t target = mReadbackStream.getTarget();
+        if (target != nullptr) {
+            setReadbackBufferInternal(target, -1, true);
+            mDpuData.enable_readback = true;
+        }
+    }
 
     setDisplayWinConfigData();
 
@@ -3134,6 +4077,8 @@ int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
         if (mDpuData.retire_fence > 0)
             fence_close(mDpuData.retire_fence, this, FENCE_TYPE_RETIRE, FENCE_IP_DPP);
         mDpuData.retire_fence = -1;
+    } else {
+        mResourceManager->updateUtilizationStats(this);
     }
 
     setReleaseFences();
@@ -3201,6 +4146,10 @@ int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
         printDebugInfos(errString);
     }
 
+    /* Keep the committed frame as the last one, the other slot is reused for the next frame */
+    if (mDpuDataCommitted)
+        mLastDpuData.swap(mDpuData);
+    mDpuDataCommitted = false;
     mDpuData.reset();
 
     mRenderingState = RENDERING_STATE_PRESENTED;
@@ -3210,6 +4159,9 @@ int32_t ExynosDisplay::presentDisplay(int32_t* outRetireFence) {
         updateInternalDisplayConfigVariables(mDesiredConfig, false);
     }
 
+    if (mDumpSnapshotRequested)
+        publishDumpSnapshot();
+
     return ret;
 err:
     printDebugInfos(errString);
@@ -3220,6 +4172,7 @@ err:
     setGeometryChanged(GEOMETRY_ERROR_CASE);
 
     mLastDpuData.reset();
+    mLastDpuDataHash = 0;
 
     mClientCompositionInfo.mSkipStaticInitFlag = false;
     mExynosCompositionInfo.mSkipStaticInitFlag = false;
@@ -3246,9 +4199,14 @@ not_validated:
 
 int32_t ExynosDisplay::presentPostProcessing()
 {
-    setReadbackBufferInternal(NULL, -1, false);
-    if (mDpuData.enable_readback)
+    if (mReadbackStream.hasTarget()) {
+        int32_t fence = -1;
+        getReadbackBufferFence(&fence);
+        mReadbackStream.onPresented(fence);
+    } else if (mDpuData.enable_readback) {
         mDevice->signalReadbackDone();
+    }
+    setReadbackBufferInternal(NULL, -1, false);
     mDpuData.enable_readback = false;
 
     for (auto it : mIgnoreLayers) {
@@ -3266,7 +4224,7 @@ int32_t ExynosDisplay::presentPostProcessing()
 
 int32_t ExynosDisplay::setActiveConfig(hwc2_config_t config)
 {
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
     DISPLAY_LOGD(eDebugDisplayConfig, "%s:: config(%d)", __func__, config);
     return setActiveConfigInternal(config, false);
 }
@@ -3279,8 +4237,8 @@ int32_t ExynosDisplay::setActiveConfigInternal(hwc2_config_t config, bool force)
         return HWC2_ERROR_NONE;
     }
 
-    DISPLAY_LOGD(eDebugDisplayConfig, "(current %d) : %dx%d, %dms, %d Xdpi, %d Ydpi", mActiveConfig,
-            mXres, mYres, mVsyncPeriod, mXdpi, mYdpi);
+    DISPLAY_LOGD(eDebugDisplayConfig, "(current %d) : %dx%d, %dms, %d Xdpi, %d Ydpi",
+            mActiveConfig.load(), mXres, mYres, mVsyncPeriod.load(), mXdpi, mYdpi);
     DISPLAY_LOGD(eDebugDisplayConfig, "(requested %d) : %dx%d, %dms, %d Xdpi, %d Ydpi", config,
             mDisplayConfigs[config].width, mDisplayConfigs[config].height, mDisplayConfigs[config].vsyncPeriod,
             mDisplayConfigs[config].Xdpi, mDisplayConfigs[config].Ydpi);
@@ -3358,10 +4316,15 @@ int32_t ExynosDisplay::setColorTransform(
     if ((hint < HAL_COLOR_TRANSFORM_IDENTITY) ||
         (hint > HAL_COLOR_TRANSFORM_CORRECT_TRITANOPIA))
         return HWC2_ERROR_BAD_PARAMETER;
+    /* Nothing to apply, so no layer has to fall back to the client */
+    if ((hint == HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX) && isIdentityColorMatrix(matrix))
+        hint = HAL_COLOR_TRANSFORM_IDENTITY;
     ALOGI("%s:: %d, %d", __func__, mColorTransformHint, hint);
     if (mColorTransformHint != hint)
         setGeometryChanged(GEOMETRY_DISPLAY_COLOR_TRANSFORM_CHANGED);
     mColorTransformHint = hint;
+    /* The matrix may change with the same hint, next frame has to be committed */
+    mLastDpuDataHash = 0;
 #ifdef HWC_SUPPORT_COLOR_TRANSFORM
     int ret = mDisplayInterface->setColorTransform(matrix, hint);
     if (ret < 0)
@@ -3383,8 +4346,10 @@ int32_t ExynosDisplay::setColorMode(int32_t /*android_color_mode_t*/ mode)
     }
 
     ALOGI("%s:: %d, %d", __func__, mColorMode, mode);
-    if (mColorMode != mode)
+    if (mColorMode != mode) {
         setGeometryChanged(GEOMETRY_DISPLAY_COLOR_MODE_CHANGED);
+        mLastDpuDataHash = 0;
+    }
     mColorMode = (android_color_mode_t)mode;
     return HWC2_ERROR_NONE;
 }
@@ -3403,6 +4368,7 @@ int32_t ExynosDisplay::setColorModeWithRenderIntent(int32_t /*android_color_mode
 {
     ALOGI("%s:: mode(%d), intent(%d)", __func__, mode, intent);
 
+    mLastDpuDataHash = 0;
     return mDisplayInterface->setColorModeWithRenderIntent(mode, intent);
 }
 
@@ -3512,7 +4478,6 @@ int32_t ExynosDisplay::getDisplayConnectionType(uint32_t* outType)
 
 int32_t ExynosDisplay::getDisplayVsyncPeriod(hwc2_vsync_period_t* __unused outVsyncPeriod)
 {
-    Mutex::Autolock lock(mDisplayMutex);
     return getDisplayVsyncPeriodInternal(outVsyncPeriod);
 }
 
@@ -3520,7 +4485,7 @@ int32_t ExynosDisplay::getConfigAppliedTime(const uint64_t desiredTime,
         const uint64_t actualChangeTime,
         int64_t &appliedTime, int64_t &refreshTime)
 {
-    uint32_t transientDuration = mDisplayInterface->getConfigChangeDuration();
+    uint32_t transientDuration = mDisplayInterface->getConfigSwitchDuration(mDesiredConfig);
     appliedTime = actualChangeTime;
     while (desiredTime > appliedTime) {
         DISPLAY_LOGD(eDebugDisplayConfig, "desired time(%" PRId64 ") > applied time(%" PRId64 ")", desiredTime, appliedTime);;
@@ -3537,7 +4502,7 @@ int32_t ExynosDisplay::setActiveConfigWithConstraints(hwc2_config_t config,
         hwc_vsync_period_change_timeline_t* outTimeline)
 {
     ATRACE_CALL();
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
 
     DISPLAY_LOGD(eDebugDisplayConfig, "%s:: config(%d), seamless(%d), "
             "desiredTime(%" PRId64, ")",
@@ -3565,7 +4530,7 @@ int32_t ExynosDisplay::setActiveConfigWithConstraints(hwc2_config_t config,
     }
 
     DISPLAY_LOGD(eDebugDisplayConfig, "%s : %dx%d, %dms, %d Xdpi, %d Ydpi", __func__,
-            mXres, mYres, mVsyncPeriod, mXdpi, mYdpi);
+            mXres, mYres, mVsyncPeriod.load(), mXdpi, mYdpi);
 
     if (mConfigRequestState == hwc_request_state_t::SET_CONFIG_STATE_REQUESTED) {
         DISPLAY_LOGI("%s, previous request config is processing", __func__);
@@ -3587,7 +4552,7 @@ int32_t ExynosDisplay::setActiveConfigWithConstraints(hwc2_config_t config,
 
     DISPLAY_LOGD(eDebugDisplayConfig, "requested config : %d(%d)->%d(%d), "
             "desired %" PRId64 ", newVsyncAppliedTimeNanos : %" PRId64 "",
-            mActiveConfig, mDisplayConfigs[mActiveConfig].vsyncPeriod,
+            mActiveConfig.load(), mDisplayConfigs[mActiveConfig].vsyncPeriod,
             config, mDisplayConfigs[config].vsyncPeriod,
             mVsyncPeriodChangeConstraints.desiredTimeNanos,
             outTimeline->newVsyncAppliedTimeNanos);
@@ -3640,6 +4605,21 @@ int32_t ExynosDisplay::getClientTargetProperty(hwc_client_target_property_t* out
     return HWC2_ERROR_NONE;
 }
 
+/*
+ * The client target property of HWC2 has no size, the reduced client target
+ * size is given to SurfaceFlinger by its max graphics size and has to match
+ * the size that is returned here.
+ */
+void ExynosDisplay::getClientTargetSize(uint32_t &width, uint32_t &height)
+{
+    width = mXres;
+    height = mYres;
+    if (mClientTargetScale < 1.0f) {
+        width = pixel_align_down((uint32_t)(mXres * mClientTargetScale), 2);
+        height = pixel_align_down((uint32_t)(mYres * mClientTargetScale), 2);
+    }
+}
+
 bool ExynosDisplay::isBadConfig(hwc2_config_t config)
 {
     /* Check invalid config */
@@ -3693,9 +4673,24 @@ uint32_t ExynosDisplay::getBtsRefreshRate() const {
     return static_cast<uint32_t>(round(nsecsPerSec / mBtsVsyncPeriod * 0.1f) * 10);
 }
 
+void ExynosDisplay::updateCommittedBandwidth() {
+    const uint32_t refreshRate = getBtsRefreshRate();
+    uint64_t bandwidth = 0;
+
+    for (auto &config : mDpuData.configs) {
+        if ((config.state != config.WIN_STATE_BUFFER) &&
+            (config.state != config.WIN_STATE_CURSOR))
+            continue;
+        bandwidth += getReadBandwidthKBps(config.src.w, config.src.h, config.format,
+                                          config.compression, refreshRate);
+    }
+    mCommittedBandwidthKBps = bandwidth;
+}
+
 void ExynosDisplay::updateRefreshRateHint() {
     if (mVsyncPeriod) {
-        mPowerHalHint.signalRefreshRate(mPowerModeState, mVsyncPeriod);
+        mPowerHalHint.signalRefreshRate(mPowerModeState, mVsyncPeriod, mContentFps,
+                                        mRefreshRateVote.refreshRate);
     }
 }
 
@@ -3704,7 +4699,7 @@ int32_t ExynosDisplay::resetConfigRequestStateLocked() {
     mVsyncPeriod = getDisplayVsyncPeriodFromConfig(mActiveConfig);
     updateBtsVsyncPeriod(mVsyncPeriod, true);
     DISPLAY_LOGD(eDebugDisplayConfig,"Update mVsyncPeriod %d",
-            mVsyncPeriod);
+            mVsyncPeriod.load());
 
     updateRefreshRateHint();
 
@@ -3783,7 +4778,7 @@ int32_t ExynosDisplay::getDisplayVsyncPeriodInternal(hwc2_vsync_period_t* outVsy
     } else {
         *outVsyncPeriod = mVsyncPeriod;
         DISPLAY_LOGD(eDebugDisplayInterfaceConfig, "period is mVsyncPeriod: %d",
-                mVsyncPeriod);
+                mVsyncPeriod.load());
     }
     return HWC2_ERROR_NONE;
 }
@@ -3839,6 +4834,10 @@ int ExynosDisplay::clearDisplay(bool needModeClear) {
     mClientCompositionInfo.mSkipFlag = false;
 
     mLastDpuData.reset();
+    mLastDpuDataHash = 0;
+    mEstimatedBandwidthKBps = 0;
+    mCommittedBandwidthKBps = 0;
+    mCompressedDstSavedKBps = 0;
 
     /* Update last retire fence */
     mLastRetireFence = fence_close(mLastRetireFence, this, FENCE_TYPE_RETIRE, FENCE_IP_DPP);
@@ -3849,7 +4848,7 @@ int ExynosDisplay::clearDisplay(bool needModeClear) {
 
 int32_t ExynosDisplay::setPowerMode(
         int32_t /*hwc2_power_mode_t*/ mode) {
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
 
     if (!mDisplayInterface->isDozeModeAvailable() &&
         (mode == HWC2_POWER_MODE_DOZE || mode == HWC2_POWER_MODE_DOZE_SUSPEND)) {
@@ -3860,6 +4859,12 @@ int32_t ExynosDisplay::setPowerMode(
         mDevice->mPrimaryBlank = true;
         clearDisplay(true);
         ALOGV("HWC2: Clear display (power off)");
+        /* The panel is off, it is not counted as self refresh residency */
+        Mutex::Autolock psrLock(mSelfRefreshMutex);
+        if (mSelfRefresh.active)
+            mSelfRefresh.residency += systemTime(SYSTEM_TIME_MONOTONIC) - mSelfRefresh.entryTime;
+        mSelfRefresh.active = false;
+        mSelfRefresh.lastCommitTime = 0;
     } else {
         mDevice->mPrimaryBlank = false;
     }
@@ -3879,6 +4884,7 @@ int32_t ExynosDisplay::setPowerMode(
     ALOGD("%s:: mode(%d))", __func__, mode);
 
     mPowerModeState = (hwc2_power_mode_t)mode;
+    updateMinimalDozeComposition();
 
     if (mode == HWC_POWER_MODE_OFF) {
         /* It should be called from validate() when the screen is on */
@@ -3897,7 +4903,7 @@ int32_t ExynosDisplay::setPowerMode(
 
 int32_t ExynosDisplay::setVsyncEnabled(
         int32_t /*hwc2_vsync_t*/ enabled) {
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
     return setVsyncEnabledInternal(enabled);
 }
 
@@ -3935,12 +4941,30 @@ int32_t ExynosDisplay::validateDisplay(
         uint32_t* outNumTypes, uint32_t* outNumRequests) {
 
     ATRACE_CALL();
+    HWC_TRACE_FUNC(eHwcTraceValidate);
     gettimeofday(&updateTimeInfo.lastValidateTime, NULL);
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
 
     if (mPauseDisplay)
         return HWC2_ERROR_NONE;
 
+    /*
+     * Frames are dropped by presentDisplay() during TUI. Resources are not
+     * re-assigned for them so that the assignment, framebuffers and M2M
+     * outputs of the last frame before TUI are reused when TUI ends.
+     * Geometry changes during TUI are kept to be validated then.
+     */
+    if (mDevice->isInTUI()) {
+        *outNumTypes = 0;
+        *outNumRequests = 0;
+        return HWC2_ERROR_NONE;
+    }
+
+    cancelEarlyValidation(false);
+
+    StageLatencyStats::ScopedTimer validateTimer(mStageStats, FRAME_STAGE_VALIDATE,
+            &mValidateDuration);
+
     int ret = NO_ERROR;
     bool validateError = false;
     mUpdateEventCnt++;
@@ -3948,10 +4972,9 @@ int32_t ExynosDisplay::validateDisplay(
     mLastUpdateTimeStamp = systemTime(SYSTEM_TIME_MONOTONIC);
 
     checkIgnoreLayers();
+    checkBackgroundColorLayer();
     if (mLayers.size() == 0)
         DISPLAY_LOGI("%s:: validateDisplay layer size is 0", __func__);
-    else
-        mLayers.vector_sort();
 
     // Reset current frame flags for Fence Tracer
     resetFenceCurFlag(this);
@@ -3960,6 +4983,8 @@ int32_t ExynosDisplay::validateDisplay(
 
     doPreProcessing();
     checkLayerFps();
+    updateContentFps();
+    updateRefreshRateVote();
     if (exynosHWCControl.useDynamicRecomp == true && mDREnable)
         checkDynamicReCompMode();
 
@@ -3969,6 +4994,32 @@ int32_t ExynosDisplay::validateDisplay(
         mDevice->dynamicRecompositionThreadCreate();
     }
 
+    /*
+     * Count down client composition holds before geometry is checked.
+     * Layers rejected by TEST_ONLY commit are checked again after geometry change.
+     */
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        mLayers[i]->updateClientHold();
+        if (mLayers[i]->mGeometryChanged != 0)
+            mLayers[i]->mTestFailedMPPFlag = 0;
+    }
+
+    /*
+     * In parallel validate mode layers are preprocessed before taking
+     * mAssignMutex so that other displays can validate meanwhile.
+     */
+    mLayersPreProcessed = false;
+    if (exynosHWCControl.parallelValidate && (mDevice->mGeometryChanged != 0)) {
+        if ((ret = preProcessLayers()) != NO_ERROR) {
+            DISPLAY_LOGE("%s:: preProcessLayers() fail, ret(%d)", __func__, ret);
+        } else {
+            mLayersPreProcessed = true;
+        }
+    }
+
+    std::unique_lock<TimedMutex> assignLock(mResourceManager->mAssignMutex);
+    bool testAssignment = (mDevice->mGeometryChanged != 0);
+    nsecs_t assignStart = systemTime(SYSTEM_TIME_MONOTONIC);
     if ((ret = mResourceManager->assignResource(this)) != NO_ERROR) {
         validateError = true;
         HWC_LOGE(this, "%s:: assignResource() fail, display(%d), ret(%d)", __func__, mDisplayId, ret);
@@ -3977,11 +5028,26 @@ int32_t ExynosDisplay::validateDisplay(
                 __func__, mDisplayId, ret);
         printDebugInfos(errString);
         mDisplayInterface->setForcePanic();
+    } else if (testAssignment) {
+        ExynosLayer *demoteLayer = NULL;
+        if ((testAssignedWindows(demoteLayer) != NO_ERROR) && (demoteLayer != NULL)) {
+            /* Assign resources once more without the rejected otfMPP */
+            demoteLayer->mTestFailedMPPFlag |= demoteLayer->mOtfMPP->mLogicalType;
+            demoteLayer->setGeometryChanged(GEOMETRY_LAYER_UNKNOWN_CHANGED);
+            if ((ret = mResourceManager->assignResource(this)) != NO_ERROR) {
+                validateError = true;
+                HWC_LOGE(this, "%s:: assignResource() fail after TEST_ONLY commit, display(%d), ret(%d)",
+                        __func__, mDisplayId, ret);
+            }
+        }
     }
+    if (!validateError)
+        mResourceManager->updateFallbackStats(this);
+    mStageStats.record(FRAME_STAGE_ASSIGN_RESOURCE, systemTime(SYSTEM_TIME_MONOTONIC) - assignStart);
 
     updateBrightnessState();
 
-    if ((ret = updateColorConversionInfo()) != NO_ERROR) {
+    if ((ret = requestColorConversionInfo()) != NO_ERROR) {
         validateError = true;
         DISPLAY_LOGE("%s:: updateColorConversionInfo() fail, ret(%d)",
                 __func__, ret);
@@ -4014,6 +5080,7 @@ int32_t ExynosDisplay::validateDisplay(
         HWC_LOGE(NULL,"%s:: deliverPerformanceInfo() error (%d)",
                 __func__, ret);
     }
+    assignLock.unlock();
 
     if ((validateError == false) && (mDisplayControl.earlyStartMPP == true)) {
         if ((ret = startPostProcessing()) != NO_ERROR)
@@ -4021,6 +5088,7 @@ int32_t ExynosDisplay::validateDisplay(
     }
 
     if (validateError) {
+        assignLock.lock();
         setGeometryChanged(GEOMETRY_ERROR_CASE);
         mClientCompositionInfo.mSkipStaticInitFlag = false;
         mExynosCompositionInfo.mSkipStaticInitFlag = false;
@@ -4035,6 +5103,7 @@ int32_t ExynosDisplay::validateDisplay(
         }
         mResourceManager->assignCompositionTarget(this, COMPOSITION_CLIENT);
         mResourceManager->assignWindow(this);
+        assignLock.unlock();
     }
 
     int32_t displayRequests = 0;
@@ -4136,30 +5205,108 @@ void ExynosDisplay::dumpConfig(const exynos_win_config_data &c)
     }
 }
 
-void ExynosDisplay::dump(String8& result)
+struct ExynosDisplay::DumpSnapshot {
+    /* Display information and the composition infos */
+    String8 header;
+    std::vector<ExynosLayer::DumpSnapshot> layers;
+    std::vector<ExynosLayer::DumpSnapshot> ignoreLayers;
+};
+
+void ExynosDisplay::publishDumpSnapshot()
 {
-    Mutex::Autolock lock(mDisplayMutex);
+    auto snapshot = std::make_shared<DumpSnapshot>();
+    String8& result = snapshot->header;
+
     result.appendFormat("[%s] display information size: %d x %d, vsyncState: %d, colorMode: %d, colorTransformHint: %d\n",
             mDisplayName.string(),
             mXres, mYres, mVsyncState, mColorMode, mColorTransformHint);
     mClientCompositionInfo.dump(result);
     mExynosCompositionInfo.dump(result);
+    mLowFpsLayerInfo.dump(result);
+
+    result.appendFormat("PanelGammaSource (%d)\n", GetCurrentPanelGammaSource());
+    result.appendFormat("Content fps: %u, refresh rate vote: %u Hz (%s)\n",
+            mContentFps, mRefreshRateVote.refreshRate, mRefreshRateVote.reason.string());
+    result.appendFormat("Bandwidth: estimated %" PRIu64 " KB/s, committed %" PRIu64 " KB/s, "
+            "saved by compressed M2M dst %" PRIu64 " KB/s\n",
+            mEstimatedBandwidthKBps, mCommittedBandwidthKBps, mCompressedDstSavedKBps);
+    result.appendFormat("Window update: last %u region(s) %.1f%%, average %.1f%%, "
+            "partial %" PRIu64 " / %" PRIu64 " frames\n\n",
+            mWindowUpdateStats.lastRegionNum, mWindowUpdateStats.lastAreaPermille / 10.0f,
+            mWindowUpdateStats.frames ?
+                mWindowUpdateStats.areaPermilleSum / 10.0f / mWindowUpdateStats.frames : 100.0f,
+            mWindowUpdateStats.partialFrames, mWindowUpdateStats.frames);
+    if (mPsrMode != PSR_NONE) {
+        Mutex::Autolock lock(mSelfRefreshMutex);
+        uint64_t exits = mSelfRefresh.entries - (mSelfRefresh.active ? 1 : 0);
+        nsecs_t residency = mSelfRefresh.residency + (mSelfRefresh.active ?
+                systemTime(SYSTEM_TIME_MONOTONIC) - mSelfRefresh.entryTime : 0);
+        result.appendFormat("Self refresh: %s, entries %" PRIu64 ", residency %" PRId64 " ms, "
+                "exit latency average %" PRId64 " us, max %" PRId64 " us\n\n",
+                mSelfRefresh.active ? "active" : "inactive", mSelfRefresh.entries,
+                ns2ms(residency), exits ? ns2us(mSelfRefresh.exitLatencySum / (nsecs_t)exits) : 0,
+                ns2us(mSelfRefresh.exitLatencyMax));
+    }
+    if (mPowerOnStats.count)
+        mPowerOnStats.dump(result);
+
+    snapshot->layers.resize(mLayers.size());
+    for (uint32_t i = 0; i < mLayers.size(); i++)
+        mLayers[i]->takeDumpSnapshot(snapshot->layers[i]);
+    snapshot->ignoreLayers.resize(mIgnoreLayers.size());
+    for (uint32_t i = 0; i < mIgnoreLayers.size(); i++)
+        mIgnoreLayers[i]->takeDumpSnapshot(snapshot->ignoreLayers[i]);
+
+    std::atomic_store(&mDumpSnapshot, std::shared_ptr<const DumpSnapshot>(std::move(snapshot)));
+
+    Mutex::Autolock lock(mDumpSnapshotMutex);
+    mDumpSnapshotRequested = false;
+    mDumpSnapshotCondition.broadcast();
+}
+
+void ExynosDisplay::dump(String8& result)
+{
+    {
+        Mutex::Autolock lock(mDumpSnapshotMutex);
+        mDumpSnapshotRequested = true;
+        nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + kDumpSnapshotTimeoutNs;
+        while (mDumpSnapshotRequested) {
+            nsecs_t remaining = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+            if ((remaining <= 0) ||
+                (mDumpSnapshotCondition.waitRelative(mDumpSnapshotMutex, remaining) == TIMED_OUT))
+                break;
+        }
+    }
+
+    /* No frame is presented, the display mutex is not contended */
+    if (mDumpSnapshotRequested) {
+        TimedMutex::Autolock lock(mDisplayMutex);
+        publishDumpSnapshot();
+    }
 
-    result.appendFormat("PanelGammaSource (%d)\n\n", GetCurrentPanelGammaSource());
+    std::shared_ptr<const DumpSnapshot> snapshot = std::atomic_load(&mDumpSnapshot);
+    result.append(snapshot->header);
+    mDisplayMutex.dump(result, "Display");
+    mDisplayInterface->dump(result);
+    std::string workers;
+    mPowerHalHint.DumpWakeupStats(workers);
+    mColorUpdateWorker.DumpWakeupStats(workers);
+    mDisplayInterface->dumpWorkerWakeups(workers);
+    result.appendFormat("Worker wakeups:\n%s", workers.c_str());
+    if (mReadbackStream.isEnabled())
+        mReadbackStream.dump(result);
+    mStageStats.dump(result);
+    result.appendFormat("\n");
 
-    if (mLayers.size()) {
+    if (snapshot->layers.size()) {
         result.appendFormat("============================== dump layers ===========================================\n");
-        for (uint32_t i = 0; i < mLayers.size(); i++) {
-            ExynosLayer *layer = mLayers[i];
-            layer->dump(result);
-        }
+        for (auto &layer : snapshot->layers)
+            ExynosLayer::dump(layer, result);
     }
-    if (mIgnoreLayers.size()) {
+    if (snapshot->ignoreLayers.size()) {
         result.appendFormat("\n============================== dump ignore layers ===========================================\n");
-        for (uint32_t i = 0; i < mIgnoreLayers.size(); i++) {
-            ExynosLayer *layer = mIgnoreLayers[i];
-            layer->dump(result);
-        }
+        for (auto &layer : snapshot->ignoreLayers)
+            ExynosLayer::dump(layer, result);
     }
     result.appendFormat("\n");
 }
@@ -4231,6 +5378,11 @@ int32_t ExynosDisplay::setCompositionTargetExynosImage(uint32_t targetType, exyn
     src_img->y = 0;
     src_img->w = mXres;
     src_img->h = mYres;
+    if (targetType == COMPOSITION_CLIENT) {
+        getClientTargetSize(src_img->w, src_img->h);
+        src_img->fullWidth = src_img->w;
+        src_img->fullHeight = src_img->h;
+    }
 
     if (compositionInfo.mTargetBuffer != NULL) {
         src_img->bufferHandle = compositionInfo.mTargetBuffer;
@@ -4729,6 +5881,57 @@ bool ExynosDisplay::windowUpdateExceptions()
     return false;
 }
 
+static inline int64_t getRectArea(const hwc_rect &rect)
+{
+    if ((rect.right <= rect.left) || (rect.bottom <= rect.top))
+        return 0;
+    return (int64_t)(rect.right - rect.left) * (rect.bottom - rect.top);
+}
+
+/*
+ * Merge partial regions until no two of them overlap and at most maxNum are left.
+ * The pair adding the least area is merged first, so unrelated damage far
+ * apart (e.g. cursor and clock) stays split while the DPU can take it.
+ */
+static void mergeWinUpdateRegions(std::vector<hwc_rect> &regions, uint32_t maxNum)
+{
+    while (regions.size() > 1) {
+        size_t first = 0, second = 0;
+        int64_t minCost = INT64_MAX;
+        bool overlapped = false;
+
+        for (size_t i = 0; i < regions.size(); i++) {
+            for (size_t j = i + 1; j < regions.size(); j++) {
+                hwc_rect overlap = {max(regions[i].left, regions[j].left),
+                                    max(regions[i].top, regions[j].top),
+                                    min(regions[i].right, regions[j].right),
+                                    min(regions[i].bottom, regions[j].bottom)};
+                int64_t overlapArea = getRectArea(overlap);
+                int64_t cost = getRectArea(expand(regions[i], regions[j])) -
+                    getRectArea(regions[i]) - getRectArea(regions[j]) + overlapArea;
+                /* Overlapping regions have to be merged before anything else */
+                if ((overlapArea > 0) && !overlapped) {
+                    overlapped = true;
+                    minCost = INT64_MAX;
+                }
+                if ((overlapArea > 0) != overlapped)
+                    continue;
+                if (cost < minCost) {
+                    minCost = cost;
+                    first = i;
+                    second = j;
+                }
+            }
+        }
+
+        if (!overlapped && (regions.size() <= maxNum) && (minCost > 0))
+            break;
+
+        regions[first] = expand(regions[first], regions[second]);
+        regions.erase(regions.begin() + second);
+    }
+}
+
 int ExynosDisplay::handleWindowUpdate()
 {
     int ret = NO_ERROR;
@@ -4736,6 +5939,7 @@ int ExynosDisplay::handleWindowUpdate()
     unsigned int excp;
 
     mDpuData.enable_win_update = false;
+    mDpuData.win_update_region_num = 0;
     /* Init with full size */
     mDpuData.win_update_region.x = 0;
     mDpuData.win_update_region.w = mXres;
@@ -4762,15 +5966,14 @@ int ExynosDisplay::handleWindowUpdate()
     if (windowUpdateExceptions())
         return 0;
 
-    hwc_rect mergedRect = {(int)mXres, (int)mYres, 0, 0};
+    std::vector<hwc_rect> regions;
     hwc_rect damageRect = {(int)mXres, (int)mYres, 0, 0};
 
     for (size_t i = 0; i < mLayers.size(); i++) {
-        excp = getLayerRegion(mLayers[i], &damageRect, eDamageRegionByDamage);
+        excp = getLayerRegion(mLayers[i], &damageRect, eDamageRegionByDamage, &regions);
         if (excp == eDamageRegionPartial) {
             DISPLAY_LOGD(eDebugWindowUpdate, "layer(%zu) partial : %d, %d, %d, %d", i,
                     damageRect.left, damageRect.top, damageRect.right, damageRect.bottom);
-            mergedRect = expand(mergedRect, damageRect);
         }
         else if (excp == eDamageRegionSkip) {
             int32_t windowIndex = mLayers[i]->mWindowIndex;
@@ -4783,11 +5986,11 @@ int ExynosDisplay::handleWindowUpdate()
                 damageRect.bottom = mLayers[i]->mDisplayFrame.bottom;
                 DISPLAY_LOGD(eDebugWindowUpdate, "Skip layer (origin) : %d, %d, %d, %d",
                         damageRect.left, damageRect.top, damageRect.right, damageRect.bottom);
-                mergedRect = expand(mergedRect, damageRect);
+                regions.push_back(damageRect);
                 hwc_rect prevDst = {mLastDpuData.configs[i].dst.x, mLastDpuData.configs[i].dst.y,
                     mLastDpuData.configs[i].dst.x + (int)mLastDpuData.configs[i].dst.w,
                     mLastDpuData.configs[i].dst.y + (int)mLastDpuData.configs[i].dst.h};
-                mergedRect = expand(mergedRect, prevDst);
+                regions.push_back(prevDst);
             } else {
                 DISPLAY_LOGD(eDebugWindowUpdate, "layer(%zu) skip", i);
                 continue;
@@ -4800,7 +6003,7 @@ int ExynosDisplay::handleWindowUpdate()
             damageRect.bottom = mLayers[i]->mDisplayFrame.bottom;
             DISPLAY_LOGD(eDebugWindowUpdate, "Full layer update : %d, %d, %d, %d", mLayers[i]->mDisplayFrame.left,
                     mLayers[i]->mDisplayFrame.top, mLayers[i]->mDisplayFrame.right, mLayers[i]->mDisplayFrame.bottom);
-            mergedRect = expand(mergedRect, damageRect);
+            regions.push_back(damageRect);
         }
         else {
             DISPLAY_LOGD(eDebugWindowUpdate, "Partial canceled, Skip reason (layer %zu) : %d", i, excp);
@@ -4808,22 +6011,32 @@ int ExynosDisplay::handleWindowUpdate()
         }
     }
 
-    if (mergedRect.left == (int32_t)mXres && mergedRect.right == 0 &&
-        mergedRect.top == (int32_t)mYres && mergedRect.bottom == 0) {
+    /* Clip to the display, damage outside of it doesn't need an update */
+    for (auto it = regions.begin(); it != regions.end();) {
+        adjustRect(*it, mXres, mYres);
+        if (getRectArea(*it) == 0)
+            it = regions.erase(it);
+        else
+            it++;
+    }
+
+    if (regions.empty()) {
         DISPLAY_LOGD(eDebugWindowUpdate, "Partial canceled, All layer skiped" );
         return 0;
     }
 
-    DISPLAY_LOGD(eDebugWindowUpdate, "Partial(origin) : %d, %d, %d, %d",
-            mergedRect.left, mergedRect.top, mergedRect.right, mergedRect.bottom);
+    mergeWinUpdateRegions(regions, mMaxWinUpdateRegions);
+
+    hwc_rect mergedRect = regions[0];
+    for (size_t i = 1; i < regions.size(); i++)
+        mergedRect = expand(mergedRect, regions[i]);
 
-    if (mergedRect.left < 0) mergedRect.left = 0;
-    if (mergedRect.right > (int32_t)mXres) mergedRect.right = mXres;
-    if (mergedRect.top < 0) mergedRect.top = 0;
-    if (mergedRect.bottom > (int32_t)mYres) mergedRect.bottom = mYres;
+    DISPLAY_LOGD(eDebugWindowUpdate, "Partial(origin) : %d, %d, %d, %d, regions(%zu)",
+            mergedRect.left, mergedRect.top, mergedRect.right, mergedRect.bottom, regions.size());
 
     if (mergedRect.left == 0 && mergedRect.right == (int32_t)mXres &&
-        mergedRect.top == 0 && mergedRect.bottom == (int32_t)mYres) {
+        mergedRect.top == 0 && mergedRect.bottom == (int32_t)mYres &&
+        regions.size() == 1) {
         DISPLAY_LOGD(eDebugWindowUpdate, "Partial : Full size");
         mDpuData.enable_win_update = true;
         mDpuData.win_update_region.x = 0;
@@ -4840,11 +6053,387 @@ int ExynosDisplay::handleWindowUpdate()
     mDpuData.win_update_region.y = mergedRect.top;
     mDpuData.win_update_region.h = HEIGHT(mergedRect);
 
+    mDpuData.win_update_region_num = regions.size();
+    for (size_t i = 0; i < regions.size(); i++) {
+        struct decon_frame &region = mDpuData.win_update_regions[i];
+        region.x = regions[i].left;
+        region.y = regions[i].top;
+        region.w = WIDTH(regions[i]);
+        region.h = HEIGHT(regions[i]);
+        DISPLAY_LOGD(eDebugWindowUpdate, "Partial region[%zu] : %d, %d, %d, %d", i,
+                regions[i].left, regions[i].top, regions[i].right, regions[i].bottom);
+    }
+
     DISPLAY_LOGD(eDebugWindowUpdate, "window update end ------------------");
     return 0;
 }
 
-unsigned int ExynosDisplay::getLayerRegion(ExynosLayer *layer, hwc_rect *rect_area, uint32_t regionType) {
+/*
+ * The supported MPPs of every layer are checked again when doze frames
+ * start or stop excluding M2M MPPs.
+ */
+void ExynosDisplay::updateMinimalDozeComposition()
+{
+    bool minimal = mDisplayControl.minimalDozeComposition &&
+            ((mPowerModeState == HWC2_POWER_MODE_DOZE) ||
+             (mPowerModeState == HWC2_POWER_MODE_DOZE_SUSPEND));
+    if (minimal == mMinimalDozeComposition)
+        return;
+
+    mMinimalDozeComposition = minimal;
+    for (size_t i = 0; i < mLayers.size(); i++)
+        mLayers[i]->setGeometryChanged(GEOMETRY_LAYER_UNKNOWN_CHANGED);
+    setGeometryChanged(GEOMETRY_DISPLAY_FORCE_VALIDATE);
+}
+
+void ExynosDisplay::PowerOnStats::start()
+{
+    for (auto &stage : stages)
+        stage = 0;
+    stageStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    waitFirstCommit = false;
+    count++;
+}
+
+/* Records the time since the previous stage ended */
+void ExynosDisplay::PowerOnStats::record(power_on_stage_t stage)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    stages[stage] = now - stageStart;
+    stageStart = now;
+    waitFirstCommit = (stage < POWER_ON_STAGE_FIRST_COMMIT);
+    if (stage == POWER_ON_STAGE_FIRST_COMMIT) {
+        nsecs_t total = 0;
+        for (auto duration : stages)
+            total += duration;
+        maxTotal = max(maxTotal, total);
+    }
+}
+
+void ExynosDisplay::PowerOnStats::dump(String8 &result) const
+{
+    static constexpr const char *kStageNames[POWER_ON_STAGE_MAX] = {
+            "apply config", "panel on", "first power on", "first commit"};
+    nsecs_t total = 0;
+    result.appendFormat("Power on (usec, count %" PRIu64 "):", count);
+    for (size_t i = 0; i < POWER_ON_STAGE_MAX; i++) {
+        result.appendFormat(" %s %" PRId64 ",", kStageNames[i], ns2us(stages[i]));
+        total += stages[i];
+    }
+    result.appendFormat(" total %" PRId64 ", max %" PRId64 "%s\n\n", ns2us(total),
+            ns2us(maxTotal), waitFirstCommit ? " (waiting for the first commit)" : "");
+}
+
+void ExynosDisplay::enterSelfRefresh()
+{
+    {
+        Mutex::Autolock lock(mSelfRefreshMutex);
+        /* Nothing was committed yet or the panel is already static */
+        if (mSelfRefresh.active || (mSelfRefresh.lastCommitTime == 0))
+            return;
+        mSelfRefresh.active = true;
+        mSelfRefresh.entryTime = systemTime(SYSTEM_TIME_MONOTONIC);
+        mSelfRefresh.entries++;
+    }
+    ATRACE_INT("SelfRefresh", 1);
+    mDisplayInterface->onSelfRefreshChanged(true);
+}
+
+/* Called with mDisplayMutex held for every frame that reaches the display */
+void ExynosDisplay::updateSelfRefresh(bool committed, nsecs_t now, nsecs_t commitDuration)
+{
+    if (mPsrMode == PSR_NONE)
+        return;
+
+    if (!committed) {
+        bool idle;
+        {
+            Mutex::Autolock lock(mSelfRefreshMutex);
+            idle = (mSelfRefresh.lastCommitTime != 0) &&
+                    ((now - mSelfRefresh.lastCommitTime) >= kSelfRefreshEntryNs);
+        }
+        if (idle)
+            enterSelfRefresh();
+        return;
+    }
+
+    bool exited = false;
+    {
+        Mutex::Autolock lock(mSelfRefreshMutex);
+        mSelfRefresh.lastCommitTime = now;
+        if (mSelfRefresh.active) {
+            mSelfRefresh.active = false;
+            mSelfRefresh.residency += (now - commitDuration) - mSelfRefresh.entryTime;
+            mSelfRefresh.exitLatencySum += commitDuration;
+            mSelfRefresh.exitLatencyMax = max(mSelfRefresh.exitLatencyMax, commitDuration);
+            exited = true;
+        }
+    }
+    if (exited) {
+        ATRACE_INT("SelfRefresh", 0);
+        mDisplayInterface->onSelfRefreshChanged(false);
+    }
+}
+
+void ExynosDisplay::updateWindowUpdateStats()
+{
+    uint64_t fullArea = (uint64_t)mXres * mYres;
+    uint64_t area = fullArea;
+    uint32_t regionNum = 1;
+
+    if (mDpuData.enable_win_update && (mDpuData.win_update_region_num > 0)) {
+        area = 0;
+        regionNum = mDpuData.win_update_region_num;
+        for (uint32_t i = 0; i < regionNum; i++)
+            area += (uint64_t)mDpuData.win_update_regions[i].w * mDpuData.win_update_regions[i].h;
+    }
+
+    mWindowUpdateStats.frames++;
+    if (area < fullArea)
+        mWindowUpdateStats.partialFrames++;
+    mWindowUpdateStats.lastRegionNum = regionNum;
+    mWindowUpdateStats.lastAreaPermille = fullArea ? (uint32_t)(area * 1000 / fullArea) : 1000;
+    mWindowUpdateStats.areaPermilleSum += mWindowUpdateStats.lastAreaPermille;
+}
+
+static const char *kFrameStageNames[FRAME_STAGE_MAX] = {
+    "validate", "assignResource", "exynosComposition", "deliverWinConfig", "releaseFences",
+};
+
+void StageLatencyStats::record(frame_stage_t stage, nsecs_t duration)
+{
+    if ((stage >= FRAME_STAGE_MAX) || (duration < 0))
+        return;
+
+    Stage &s = mStages[stage];
+    uint64_t ns = (uint64_t)duration;
+    uint64_t us = ns / 1000;
+    size_t bucket = 0;
+    while ((bucket < kBucketNum - 1) && (us > kBucketBoundUs[bucket]))
+        bucket++;
+
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.sumNs.fetch_add(ns, std::memory_order_relaxed);
+    s.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = s.maxNs.load(std::memory_order_relaxed);
+    while ((ns > max) &&
+           !s.maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed));
+}
+
+void StageLatencyStats::recordFrame(nsecs_t duration, nsecs_t budget)
+{
+    mFrames.fetch_add(1, std::memory_order_relaxed);
+    if ((budget > 0) && (duration > budget))
+        mOverBudgetFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void StageLatencyStats::dump(String8 &result) const
+{
+    result.appendFormat("Stage latency (usec buckets <=");
+    for (size_t i = 0; i < kBucketNum - 1; i++)
+        result.appendFormat(" %u", kBucketBoundUs[i]);
+    result.appendFormat(" >%u)\n", kBucketBoundUs[kBucketNum - 2]);
+
+    for (size_t i = 0; i < FRAME_STAGE_MAX; i++) {
+        const Stage &s = mStages[i];
+        uint64_t count = s.count.load(std::memory_order_relaxed);
+        uint64_t sum = s.sumNs.load(std::memory_order_relaxed);
+        result.appendFormat("\t%-18s count %" PRIu64 ", avg %" PRIu64 " us, max %" PRIu64 " us,",
+                kFrameStageNames[i], count, count ? sum / count / 1000 : 0,
+                s.maxNs.load(std::memory_order_relaxed) / 1000);
+        for (size_t j = 0; j < kBucketNum; j++)
+            result.appendFormat(" %" PRIu64, s.buckets[j].load(std::memory_order_relaxed));
+        result.appendFormat("\n");
+    }
+    result.appendFormat("\tframes %" PRIu64 ", over vsync budget %" PRIu64 "\n",
+            mFrames.load(std::memory_order_relaxed),
+            mOverBudgetFrames.load(std::memory_order_relaxed));
+}
+
+void StageLatencyStats::serialize(std::vector<uint64_t> &out) const
+{
+    out.clear();
+    out.reserve(3 + FRAME_STAGE_MAX * (3 + kBucketNum) + 2);
+    out.push_back(kSerializeVersion);
+    out.push_back(FRAME_STAGE_MAX);
+    out.push_back(kBucketNum);
+    for (size_t i = 0; i < FRAME_STAGE_MAX; i++) {
+        const Stage &s = mStages[i];
+        out.push_back(s.count.load(std::memory_order_relaxed));
+        out.push_back(s.sumNs.load(std::memory_order_relaxed));
+        out.push_back(s.maxNs.load(std::memory_order_relaxed));
+        for (size_t j = 0; j < kBucketNum; j++)
+            out.push_back(s.buckets[j].load(std::memory_order_relaxed));
+    }
+    out.push_back(mFrames.load(std::memory_order_relaxed));
+    out.push_back(mOverBudgetFrames.load(std::memory_order_relaxed));
+}
+
+int32_t ReadbackStream::start(uint32_t format, uint32_t width, uint32_t height,
+        uint32_t interval, uint32_t bufferNum)
+{
+    if (interval == 0)
+        return -EINVAL;
+
+    stop();
+
+    VendorGraphicBufferAllocator& gAllocator(VendorGraphicBufferAllocator::get());
+    uint64_t usage = static_cast<uint64_t>(GRALLOC1_CONSUMER_USAGE_HWCOMPOSER |
+            GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN);
+    std::vector<Slot> slots(std::clamp(bufferNum, 1u, kMaxBufferNum));
+    for (auto &slot : slots) {
+        uint32_t stride = 0;
+        status_t error = gAllocator.allocate(width, height, format, 1, usage, &slot.buffer,
+                &stride, "HWC");
+        if ((error == NO_ERROR) && (slot.buffer != nullptr))
+            continue;
+
+        ALOGE("%s:: failed to allocate readback buffer(%dx%d): %d", __func__,
+                width, height, error);
+        for (auto &allocated : slots) {
+            if (allocated.buffer != nullptr)
+                VendorGraphicBufferMapper::get().freeBuffer(allocated.buffer);
+        }
+        return (error != NO_ERROR) ? static_cast<int32_t>(error) : -ENOMEM;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    mSlots = std::move(slots);
+    mFrameNum = 0;
+    mCapturedFrames = 0;
+    mDroppedFrames = 0;
+    mInterval = interval;
+    return NO_ERROR;
+}
+
+void ReadbackStream::stop()
+{
+    VendorGraphicBufferMapper& gMapper(VendorGraphicBufferMapper::get());
+
+    mInterval = 0;
+    Mutex::Autolock lock(mMutex);
+    for (auto &slot : mSlots) {
+        switch (slot.state) {
+            case SLOT_QUEUED:
+                hwcFdClose(slot.frame.fence);
+                [[fallthrough]];
+            case SLOT_FREE:
+                gMapper.freeBuffer(slot.buffer);
+                break;
+            case SLOT_TARGET:
+            case SLOT_HELD:
+                mOrphans.push_back(slot.buffer);
+                break;
+        }
+    }
+    mSlots.clear();
+    mQueue.clear();
+    mCondition.broadcast();
+}
+
+buffer_handle_t ReadbackStream::getTarget()
+{
+    uint32_t interval = mInterval.load(std::memory_order_relaxed);
+    if (interval == 0)
+        return nullptr;
+
+    Mutex::Autolock lock(mMutex);
+    if ((mFrameNum++ % interval) != 0)
+        return nullptr;
+
+    for (auto &slot : mSlots) {
+        if (slot.state == SLOT_FREE) {
+            slot.state = SLOT_TARGET;
+            slot.frame.frameNum = mFrameNum - 1;
+            mTargetBuffer = slot.buffer;
+            return slot.buffer;
+        }
+    }
+    mDroppedFrames++;
+    return nullptr;
+}
+
+void ReadbackStream::onPresented(int32_t fence)
+{
+    Mutex::Autolock lock(mMutex);
+    buffer_handle_t target = mTargetBuffer;
+    mTargetBuffer = nullptr;
+
+    for (size_t i = 0; i < mSlots.size(); i++) {
+        Slot &slot = mSlots[i];
+        if ((slot.buffer != target) || (slot.state != SLOT_TARGET))
+            continue;
+
+        if (fence < 0) {
+            slot.state = SLOT_FREE;
+            mDroppedFrames++;
+            return;
+        }
+        slot.state = SLOT_QUEUED;
+        slot.frame.buffer = slot.buffer;
+        slot.frame.fence = fence;
+        slot.frame.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+        mQueue.push_back(i);
+        mCapturedFrames++;
+        mCondition.signal();
+        return;
+    }
+
+    /* The stream was stopped while the frame was presented */
+    if (fence >= 0)
+        hwcFdClose(fence);
+    releaseFrameLocked(target);
+}
+
+bool ReadbackStream::acquireFrame(Frame *outFrame, nsecs_t timeout)
+{
+    Mutex::Autolock lock(mMutex);
+    if (mQueue.empty())
+        mCondition.waitRelative(mMutex, timeout);
+    if (mQueue.empty())
+        return false;
+
+    Slot &slot = mSlots[mQueue.front()];
+    mQueue.erase(mQueue.begin());
+    slot.state = SLOT_HELD;
+    *outFrame = slot.frame;
+    slot.frame.fence = -1;
+    return true;
+}
+
+void ReadbackStream::releaseFrame(buffer_handle_t buffer)
+{
+    Mutex::Autolock lock(mMutex);
+    releaseFrameLocked(buffer);
+}
+
+void ReadbackStream::releaseFrameLocked(buffer_handle_t buffer)
+{
+    for (auto &slot : mSlots) {
+        if ((slot.buffer == buffer) && (slot.state == SLOT_HELD)) {
+            slot.state = SLOT_FREE;
+            return;
+        }
+    }
+
+    auto it = std::find(mOrphans.begin(), mOrphans.end(), buffer);
+    if (it != mOrphans.end()) {
+        VendorGraphicBufferMapper::get().freeBuffer(buffer);
+        mOrphans.erase(it);
+    }
+}
+
+void ReadbackStream::dump(String8 &result) const
+{
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("Readback stream: interval %u, buffers %zu, queued %zu, "
+            "captured %" PRIu64 ", dropped %" PRIu64 "\n",
+            mInterval.load(std::memory_order_relaxed), mSlots.size(), mQueue.size(),
+            mCapturedFrames, mDroppedFrames);
+}
+
+unsigned int ExynosDisplay::getLayerRegion(ExynosLayer *layer, hwc_rect *rect_area, uint32_t regionType,
+        std::vector<hwc_rect> *damageRects) {
 
     android::Vector <hwc_rect_t> hwcRects;
     size_t numRects = 0;
@@ -4890,6 +6479,8 @@ unsigned int ExynosDisplay::getLayerRegion(ExynosLayer *layer, hwc_rect *rect_ar
             adjustRect(rect, INT_MAX, INT_MAX);
             /* Get sums of rects */
             *rect_area = expand(*rect_area, rect);
+            if (damageRects != nullptr)
+                damageRects->push_back(rect);
         }
         return eDamageRegionPartial;
         break;
@@ -4993,6 +6584,7 @@ void ExynosDisplay::closeFences()
                     FENCE_TYPE_SRC_RELEASE, FENCE_IP_DPP);
         mDpuData.configs[i].rel_fence = -1;
     }
+    clearSharedReleaseFences();
     for (size_t i = 0; i < mLayers.size(); i++) {
         if (mLayers[i]->mReleaseFence > 0) {
             fence_close(mLayers[i]->mReleaseFence, this,
@@ -5064,6 +6656,23 @@ void ExynosDisplay::setHWCControl(uint32_t ctrl, int32_t val)
         case HWC_CTL_ENABLE_EARLY_START_MPP:
             mDisplayControl.earlyStartMPP = (unsigned int)val;
             break;
+        case HWC_CTL_MERGE_M2M_LAYERS:
+            mDisplayControl.mergeM2mLayers = (unsigned int)val;
+            break;
+        case HWC_CTL_GROUP_LAYERS_BY_OVERLAP:
+            mDisplayControl.groupLayersByOverlap = (unsigned int)val;
+            break;
+        case HWC_CTL_MINIMAL_DOZE_COMPOSITION:
+            mDisplayControl.minimalDozeComposition = (unsigned int)val;
+            updateMinimalDozeComposition();
+            break;
+        case HWC_CTL_LOW_FPS_LAYER_STRATEGY:
+            if (val > LOW_FPS_COMPOSE_EXYNOS) {
+                ALOGE("%s: invalid low fps layer strategy (%d)", __func__, val);
+                break;
+            }
+            mDisplayControl.lowFpsLayerStrategy = (low_fps_layer_strategy_t)val;
+            break;
         default:
             ALOGE("%s: unsupported HWC_CTL (%d)", __func__, ctrl);
             break;
@@ -5159,7 +6768,7 @@ int32_t ExynosDisplay::getReadbackBufferAttributes(int32_t* /*android_pixel_form
 int32_t ExynosDisplay::setReadbackBuffer(buffer_handle_t buffer,
         int32_t releaseFence, bool requestedService)
 {
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
     int32_t ret = NO_ERROR;
 
     if (buffer == nullptr)
@@ -20,9 +20,15 @@
 #include <android/hardware/graphics/composer/2.4/types.h>
 #include <hardware/hwcomposer2.h>
 #include <system/graphics.h>
+#include <utils/Condition.h>
 #include <utils/KeyedVector.h>
 #include <utils/Vector.h>
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
 #include "ExynosDisplayInterface.h"
 #include "ExynosHWC.h"
 #include "ExynosHWCDebug.h"
@@ -36,6 +42,7 @@
 
 #define LOW_FPS_THRESHOLD     5
 #define MAX_BRIGHTNESS_LEN 5
+#define MAX_TEST_WIN_CONFIG_RESULTS 32
 
 using ::android::hardware::graphics::composer::V2_4::VsyncPeriodNanos;
 
@@ -131,6 +138,11 @@ struct ExynosFrameInfo
     uint32_t srcNum;
     exynos_image srcInfo[NUM_SKIP_STATIC_LAYER];
     exynos_image dstInfo[NUM_SKIP_STATIC_LAYER];
+    /*
+     * Device composited layer between static client layers.
+     * Only its destination has to stay the same for the client target to be reused.
+     */
+    bool deviceLayer[NUM_SKIP_STATIC_LAYER];
 };
 
 struct exynos_readback_info
@@ -159,35 +171,81 @@ struct exynos_win_config_data
         WIN_STATE_CURSOR,
     } state = WIN_STATE_DISABLED;
 
-    uint32_t color = 0;
-    const ExynosLayer* layer = nullptr;
-    uint64_t buffer_id = 0;
+    /* Read for every window on each commit, kept in the first two cache lines */
+    int format = 0;
     int fd_idma[3] = {-1, -1, -1};
     int acq_fence = -1;
     int rel_fence = -1;
+    uint64_t buffer_id = 0;
+    ExynosMPP* assignedMPP = NULL;
+    const ExynosLayer* layer = nullptr;
+    /*
+     * Set by updateHash() once the config is written, frames are compared with these.
+     * geometry_hash covers src/dst, attr_hash everything else that is committed.
+     */
+    size_t attr_hash = 0;
+    size_t geometry_hash = 0;
+    struct decon_frame src = {0, 0, 0, 0, 0, 0};
+    struct decon_frame dst = {0, 0, 0, 0, 0, 0};
     float plane_alpha = 1;
     int32_t blending = HWC2_BLEND_MODE_NONE;
-    ExynosMPP* assignedMPP = NULL;
-    int format = 0;
     uint32_t transform = 0;
     android_dataspace dataspace = HAL_DATASPACE_UNKNOWN;
+    bool protection = false;
+    bool compression = false;
     bool hdr_enable = false;
+    bool needColorTransform = false;
+    /*
+     * Client target whose buffer and covered layers didn't change since the last frame,
+     * the framebuffer already scanned out is kept. Not part of the hashes.
+     */
+    bool target_unchanged = false;
+
+    /* Color layers, HDR and DPU restrictions */
+    uint32_t color = 0;
     enum dpp_comp_src comp_src = DPP_COMP_SRC_NONE;
     uint32_t min_luminance = 0;
     uint32_t max_luminance = 0;
     struct decon_win_rect block_area = { 0, 0, 0, 0};
     struct decon_win_rect transparent_area = {0, 0, 0, 0};
     struct decon_win_rect opaque_area = {0, 0, 0, 0};
-    struct decon_frame src = {0, 0, 0, 0, 0, 0};
-    struct decon_frame dst = {0, 0, 0, 0, 0, 0};
-    bool protection = false;
-    bool compression = false;
-    bool needColorTransform = false;
 
     void reset(){
         *this = {};
     };
+    void updateHash() {
+        attr_hash = 0;
+        geometry_hash = 0;
+        hash_combine(attr_hash, static_cast<int32_t>(state));
+        if (state == WIN_STATE_DISABLED)
+            return;
+        hash_combine(attr_hash, buffer_id);
+        hash_combine(attr_hash, fd_idma[0]);
+        hash_combine(attr_hash, fd_idma[1]);
+        hash_combine(attr_hash, fd_idma[2]);
+        hash_combine(attr_hash, color);
+        hash_combine(attr_hash, assignedMPP);
+        hash_combine(attr_hash, format);
+        hash_combine(attr_hash, transform);
+        hash_combine(attr_hash, blending);
+        hash_combine(attr_hash, plane_alpha);
+        hash_combine(attr_hash, static_cast<int32_t>(dataspace));
+        hash_combine(attr_hash, hdr_enable);
+        hash_combine(attr_hash, compression);
+        hash_combine(attr_hash, protection);
+        hash_combine(geometry_hash, src.x);
+        hash_combine(geometry_hash, src.y);
+        hash_combine(geometry_hash, src.w);
+        hash_combine(geometry_hash, src.h);
+        hash_combine(geometry_hash, dst.x);
+        hash_combine(geometry_hash, dst.y);
+        hash_combine(geometry_hash, dst.w);
+        hash_combine(geometry_hash, dst.h);
+    };
 };
+
+#define MAX_WIN_UPDATE_REGIONS 4
+
 struct exynos_dpu_data
 {
     int retire_fence = -1;
@@ -195,6 +253,9 @@ struct exynos_dpu_data
     bool enable_win_update = false;
     std::atomic<bool> enable_readback = false;
     struct decon_frame win_update_region = {0, 0, 0, 0, 0, 0};
+    /* Disjoint partial regions, win_update_region is their bounding box */
+    uint32_t win_update_region_num = 0;
+    struct decon_frame win_update_regions[MAX_WIN_UPDATE_REGIONS] = {};
     struct exynos_readback_info readback_info;
 
     void init(uint32_t configNum) {
@@ -224,8 +285,31 @@ struct exynos_dpu_data
         configs = configs_data.configs;
         return *this;
     };
+    /*
+     * Exchange the state of a frame without copying configs.
+     * Readback requests are not per-frame, they stay where they are.
+     */
+    void swap(exynos_dpu_data &other) {
+        std::swap(retire_fence, other.retire_fence);
+        configs.swap(other.configs);
+        std::swap(enable_win_update, other.enable_win_update);
+        std::swap(win_update_region, other.win_update_region);
+        std::swap(win_update_region_num, other.win_update_region_num);
+        std::swap(win_update_regions, other.win_update_regions);
+    };
 };
 
+/*
+ * How consecutive low fps layers are composed into one window.
+ * LOW_FPS_COMPOSE_EXYNOS composes them with the exynos composition M2M MPP, its
+ * destination buffer pool keeps the composed surface and is reused without G2D
+ * work until one of the layers changes.
+ */
+typedef enum low_fps_layer_strategy {
+    LOW_FPS_COMPOSE_CLIENT = 0,
+    LOW_FPS_COMPOSE_EXYNOS,
+} low_fps_layer_strategy_t;
+
 class ExynosLowFpsLayerInfo
 {
     public:
@@ -233,17 +317,42 @@ class ExynosLowFpsLayerInfo
         bool mHasLowFpsLayer;
         int32_t mFirstIndex;
         int32_t mLastIndex;
+        low_fps_layer_strategy_t mStrategy;
+        /* Frames the low fps layers were composed by G2D, or reused the composed surface */
+        uint64_t mComposedFrames;
+        uint64_t mReusedFrames;
 
         void initializeInfos();
         int32_t addLowFpsLayer(uint32_t layerIndex);
+        void dump(String8& result);
 };
 
-class ExynosSortedLayer : public Vector <ExynosLayer*>
+/*
+ * Layers of a display in ascending z-order, layers with the same z-order
+ * keep their insertion order. The position of each layer is cached in
+ * ExynosLayer::mIndexInDisplay, so finding a layer doesn't search the list.
+ */
+class ExynosSortedLayer
 {
     public:
+        size_t size() const { return mLayers.size(); };
+        bool isEmpty() const { return mLayers.empty(); };
+        ExynosLayer* operator[](size_t index) const { return mLayers[index]; };
+        std::vector<ExynosLayer*>::const_iterator begin() const { return mLayers.begin(); };
+        std::vector<ExynosLayer*>::const_iterator end() const { return mLayers.end(); };
+
+        void add(ExynosLayer *item);
         ssize_t remove(const ExynosLayer *item);
-        status_t vector_sort();
-        static int compare(ExynosLayer * const *lhs, ExynosLayer *const *rhs);
+        void removeAt(size_t index);
+        void clear();
+        /* Move a layer to the position of its new z-order */
+        void updateZOrder(ExynosLayer *item);
+        /* Index of item, -1 if it isn't in the list */
+        ssize_t indexOf(const ExynosLayer *item) const;
+    private:
+        size_t getInsertPosition(const ExynosLayer *item) const;
+        void updateIndices(size_t from, size_t to);
+        std::vector<ExynosLayer*> mLayers;
 };
 
 class ExynosCompositionInfo : public ExynosMPPSource {
@@ -305,6 +414,15 @@ typedef struct displayConfigs {
     uint32_t groupId;
 } displayConfigs_t;
 
+/* Configs of a display, never modified once it is published */
+typedef struct display_config_table {
+    /* Incremented each time the configs are rebuilt */
+    uint64_t generation = 0;
+    /* Config ids in the order getDisplayConfigs() returns them */
+    std::vector<hwc2_config_t> configs;
+    std::unordered_map<uint32_t, displayConfigs_t> attributes;
+} display_config_table_t;
+
 struct DisplayControl {
     /** Composition crop en/disable **/
     bool enableCompositionCrop;
@@ -318,6 +436,12 @@ struct DisplayControl {
     bool handleLowFpsLayers;
     /** start m2mMPP before persentDisplay **/
     bool earlyStartMPP;
+    /** Merge adjacent per-layer G2D jobs into exynos composition **/
+    bool mergeM2mLayers;
+    /** Move client layers that overlap nothing below them out of the range **/
+    bool groupLayersByOverlap;
+    /** Composition of low fps layers when handleLowFpsLayers is set **/
+    low_fps_layer_strategy_t lowFpsLayerStrategy = LOW_FPS_COMPOSE_CLIENT;
     /** Adjust display size of the layer having high priority */
     bool adjustDisplayFrame;
     /** setCursorPosition support **/
@@ -328,6 +452,16 @@ struct DisplayControl {
     bool forceReserveMPP = false;
     /** Skip M2MMPP processing **/
     bool skipM2mProcessing = true;
+    /** Check window configs with TEST_ONLY commit in validateDisplay **/
+    bool testWinConfig = false;
+    /** Deliver window configs to the display in a commit thread **/
+    bool asyncCommit = false;
+    /** Number of queued commits before presentDisplay waits, with asyncCommit **/
+    uint32_t commitQueueDepth = 1;
+    /** Hold asynchronous commits until just before the vsync they can make **/
+    bool lateLatch = false;
+    /** Compose doze frames with OTF MPPs only and keep the color state **/
+    bool minimalDozeComposition = true;
 };
 
 typedef struct brightnessState {
@@ -387,6 +521,148 @@ typedef struct brightnessState {
     }
 } brightnessState_t;
 
+/* Composition stages timed by StageLatencyStats */
+enum frame_stage_t {
+    FRAME_STAGE_VALIDATE = 0,
+    FRAME_STAGE_ASSIGN_RESOURCE,
+    FRAME_STAGE_EXYNOS_COMPOSITION,
+    FRAME_STAGE_DELIVER_WIN_CONFIG,
+    FRAME_STAGE_RELEASE_FENCES,
+    FRAME_STAGE_MAX,
+};
+
+/* Stages of the power on sequence timed by PowerOnStats */
+enum power_on_stage_t {
+    POWER_ON_STAGE_APPLY_CONFIG = 0,
+    POWER_ON_STAGE_PANEL_ON,
+    POWER_ON_STAGE_FIRST_POWER_ON,
+    /* From the end of setPowerMode() to the first committed frame */
+    POWER_ON_STAGE_FIRST_COMMIT,
+    POWER_ON_STAGE_MAX,
+};
+
+/*
+ * Always-on latency histograms of the composition stages of a display.
+ * Counters are relaxed atomics so that readers don't take mDisplayMutex.
+ */
+class StageLatencyStats {
+    public:
+        /* Upper bounds of the buckets in usec, the last bucket holds anything longer */
+        static constexpr uint32_t kBucketBoundUs[] = {250, 500, 1000, 2000, 4000, 8000,
+                                                      16000, 33000};
+        static constexpr size_t kBucketNum =
+                sizeof(kBucketBoundUs) / sizeof(kBucketBoundUs[0]) + 1;
+        static constexpr uint64_t kSerializeVersion = 1;
+
+        void record(frame_stage_t stage, nsecs_t duration);
+        /* duration: time spent in HWC for the frame, budget: vsync period */
+        void recordFrame(nsecs_t duration, nsecs_t budget);
+        void dump(String8 &result) const;
+        /*
+         * Layout: version, FRAME_STAGE_MAX, kBucketNum,
+         * then per stage: count, sum(ns), max(ns), kBucketNum buckets,
+         * then frames, frames over budget.
+         */
+        void serialize(std::vector<uint64_t> &out) const;
+
+        class ScopedTimer {
+            public:
+                ScopedTimer(StageLatencyStats &stats, frame_stage_t stage,
+                        nsecs_t *outDuration = nullptr)
+                    : mStats(stats), mStage(stage), mOutDuration(outDuration),
+                      mStart(systemTime(SYSTEM_TIME_MONOTONIC)) {}
+                ~ScopedTimer() {
+                    nsecs_t duration = systemTime(SYSTEM_TIME_MONOTONIC) - mStart;
+                    mStats.record(mStage, duration);
+                    if (mOutDuration) *mOutDuration = duration;
+                }
+            private:
+                StageLatencyStats &mStats;
+                const frame_stage_t mStage;
+                nsecs_t *mOutDuration;
+                const nsecs_t mStart;
+        };
+
+    private:
+        struct Stage {
+            std::atomic<uint64_t> count{0};
+            std::atomic<uint64_t> sumNs{0};
+            std::atomic<uint64_t> maxNs{0};
+            std::atomic<uint64_t> buckets[kBucketNum] = {};
+        };
+        Stage mStages[FRAME_STAGE_MAX];
+        std::atomic<uint64_t> mFrames{0};
+        std::atomic<uint64_t> mOverBudgetFrames{0};
+};
+
+/*
+ * Readback of every Nth presented frame into a pool of buffers.
+ * presentDisplay() takes a free buffer as the writeback target and queues it
+ * with the readback fence. Consumers take the queued frames with acquireFrame()
+ * and give the buffers back with releaseFrame(). A frame is dropped when every
+ * buffer is queued or held, so presentDisplay() never waits for a consumer.
+ */
+class ReadbackStream {
+    public:
+        struct Frame {
+            buffer_handle_t buffer = nullptr;
+            /* Signaled when the buffer is written, owned by the consumer */
+            int32_t fence = -1;
+            nsecs_t timestamp = 0;
+            uint64_t frameNum = 0;
+        };
+        static constexpr uint32_t kMaxBufferNum = 8;
+
+        ~ReadbackStream() { stop(); }
+
+        int32_t start(uint32_t format, uint32_t width, uint32_t height,
+                uint32_t interval, uint32_t bufferNum);
+        /* Buffers held by consumers are freed when they are released */
+        void stop();
+        bool isEnabled() const { return mInterval.load(std::memory_order_relaxed) != 0; }
+
+        /* Called by presentDisplay() */
+        buffer_handle_t getTarget();
+        bool hasTarget() const { return mTargetBuffer != nullptr; }
+        /* fence is -1 if the frame was not read back */
+        void onPresented(int32_t fence);
+
+        /* Returns false if no frame is queued within timeout */
+        bool acquireFrame(Frame *outFrame, nsecs_t timeout);
+        void releaseFrame(buffer_handle_t buffer);
+
+        void dump(String8 &result) const;
+
+    private:
+        void releaseFrameLocked(buffer_handle_t buffer);
+
+        enum slot_state_t {
+            SLOT_FREE,
+            SLOT_TARGET,
+            SLOT_QUEUED,
+            SLOT_HELD,
+        };
+        struct Slot {
+            buffer_handle_t buffer = nullptr;
+            slot_state_t state = SLOT_FREE;
+            Frame frame;
+        };
+
+        mutable Mutex mMutex;
+        Condition mCondition;
+        std::vector<Slot> mSlots;
+        /* Buffers of a stopped stream that consumers still hold */
+        std::vector<buffer_handle_t> mOrphans;
+        /* Queued slots, the oldest first */
+        std::vector<size_t> mQueue;
+        /* Written by presentDisplay() only */
+        buffer_handle_t mTargetBuffer = nullptr;
+        std::atomic<uint32_t> mInterval = 0;
+        uint64_t mFrameNum = 0;
+        uint64_t mCapturedFrames = 0;
+        uint64_t mDroppedFrames = 0;
+};
+
 class ExynosDisplay {
     public:
         uint32_t mDisplayId;
@@ -397,9 +673,19 @@ class ExynosDisplay {
         uint32_t mYres;
         uint32_t mXdpi;
         uint32_t mYdpi;
-        uint32_t mVsyncPeriod;
+        /* Read without mDisplayMutex by getDisplayVsyncPeriod() */
+        std::atomic<uint32_t> mVsyncPeriod;
         uint32_t mBtsVsyncPeriod;
 
+        /*
+         * DPU read bandwidth of the last frame in KB/s, estimated by the resource manager
+         * when resources are assigned and computed from the window configs when committed
+         */
+        uint64_t mEstimatedBandwidthKBps = 0;
+        uint64_t mCommittedBandwidthKBps = 0;
+        /* Part of the estimation saved by compressed M2M outputs */
+        uint64_t mCompressedDstSavedKBps = 0;
+
         int                     mPanelType;
         int                     mPsrMode;
 
@@ -412,7 +698,7 @@ class ExynosDisplay {
 
         String8 mDisplayName;
 
-        Mutex mDisplayMutex;
+        TimedMutex mDisplayMutex;
 
         /** State variables */
         bool mPlugState;
@@ -430,6 +716,24 @@ class ExynosDisplay {
         ExynosSortedLayer mLayers;
         std::vector<ExynosLayer*> mIgnoreLayers;
 
+        /*
+         * Bottom-most full-screen solid color layer that is programmed as
+         * the CRTC background color. It is kept in mIgnoreLayers.
+         */
+        ExynosLayer *mBackgroundLayer = nullptr;
+        hwc_color_t mBackgroundColor = {0, 0, 0, 0xff};
+
+        /*
+         * Release fences that several layers share, the fds of the layers
+         * are made from them in getReleaseFences()
+         */
+        struct SharedReleaseFence {
+            int32_t fence;
+            hwc_fdebug_ip_type ip;
+            uint32_t refCount;
+        };
+        std::vector<SharedReleaseFence> mSharedReleaseFences;
+
         ExynosResourceManager *mResourceManager;
 
         /**
@@ -474,6 +778,8 @@ class ExynosDisplay {
         bool mDREnable;
         bool mDRDefault;
         Mutex mDRMutex;
+        /* one-shot timer armed on present, fires when the display goes idle */
+        int mDRTimerFd;
 
         nsecs_t  mLastFpsTime;
         uint64_t mFrameCount;
@@ -497,6 +803,11 @@ class ExynosDisplay {
          */
         exynos_dpu_data mLastDpuData;
 
+        /**
+         * Results of testAssignedWindows(), key is hash of window configs.
+         */
+        std::unordered_map<size_t, int32_t> mTestWinConfigResults;
+
         /**
          * Restore release fenc from DECON.
          */
@@ -515,6 +826,11 @@ class ExynosDisplay {
         uint32_t mNumMaxPriorityAllowed;
         int32_t mCursorIndex;
 
+        /* Result of preProcessLayers(), consumed by the resource manager */
+        bool mLayersPreProcessed = false;
+        bool mHasHdrLayer = false;
+        bool mHasDrmLayer = false;
+
         int32_t mColorTransformHint;
 
         ExynosLowFpsLayerInfo mLowFpsLayerInfo;
@@ -535,7 +851,13 @@ class ExynosDisplay {
         int32_t mDeviceXres;
         int32_t mDeviceYres;
         ResolutionInfo mResolutionInfo;
-        std::map<uint32_t, displayConfigs_t> mDisplayConfigs;
+        std::unordered_map<uint32_t, displayConfigs_t> mDisplayConfigs;
+        /*
+         * Copy of mDisplayConfigs that getDisplayConfigs() and
+         * getDisplayAttribute() read without mDisplayMutex.
+         * It is replaced as a whole by publishDisplayConfigs().
+         */
+        std::shared_ptr<const display_config_table_t> mDisplayConfigTable;
 
         // WCG
         android_color_mode_t mColorMode;
@@ -552,12 +874,13 @@ class ExynosDisplay {
         hwc_request_state_t mConfigRequestState;
         hwc2_config_t mDesiredConfig;
 
-        hwc2_config_t mActiveConfig = UINT_MAX;
+        /* Read without mDisplayMutex by getActiveConfig() */
+        std::atomic<hwc2_config_t> mActiveConfig = UINT_MAX;
 
         void initDisplay();
 
         int getId();
-        Mutex& getDisplayMutex() {return mDisplayMutex; };
+        TimedMutex& getDisplayMutex() {return mDisplayMutex; };
 
         int32_t setCompositionTargetExynosImage(uint32_t targetType, exynos_image *src_img, exynos_image *dst_img);
         int32_t initializeValidateInfos();
@@ -580,11 +903,32 @@ class ExynosDisplay {
         ExynosLayer *checkLayer(hwc2_layer_t addr);
 
         void checkIgnoreLayers();
+        void checkBackgroundColorLayer();
         virtual void doPreProcessing();
+        int32_t preProcessLayers();
+
+        /*
+         * Early validation: the setters of a layer queue it for
+         * mEarlyValidateWorker, which preprocesses it and checks its
+         * supported MPPs before validateDisplay(). Opt-in per display by
+         * vendor.display.<index>.early_validate.
+         */
+        /* Called by the layer setters, before the layer state changes */
+        void requestEarlyValidation(ExynosLayer *layer);
+        /*
+         * Drops the queued layers, called at validate and present. Present
+         * also drops the results that no validate consumed.
+         */
+        void cancelEarlyValidation(bool dropResults);
+        void earlyValidateLayer(ExynosLayer *layer, uint32_t epoch);
 
         int checkLayerFps();
+        void updateContentFps();
+        void updateRefreshRateVote();
 
         int checkDynamicReCompMode();
+        void armDynamicReCompTimer();
+        bool needDynamicReCompRecheck();
 
         int handleDynamicReCompMode();
 
@@ -595,6 +939,8 @@ class ExynosDisplay {
          */
         int skipStaticLayers(ExynosCompositionInfo& compositionInfo);
         int handleStaticLayers(ExynosCompositionInfo& compositionInfo);
+        bool isClientTargetUnchanged(const ExynosCompositionInfo& compositionInfo,
+                const exynos_win_config_data& config);
 
         int doPostProcessing();
 
@@ -611,9 +957,20 @@ class ExynosDisplay {
 
         virtual int32_t validateWinConfigData();
 
+        /**
+         * Check whether the kernel accepts the assigned windows before
+         * presentDisplay. If it does not, demoteLayer is set to the layer
+         * that should not use its otfMPP.
+         */
+        int32_t testAssignedWindows(ExynosLayer* &demoteLayer);
+
         virtual int deliverWinConfigData();
 
         virtual int setReleaseFences();
+        int32_t addSharedReleaseFence(int32_t fence, hwc_fdebug_ip_type ip);
+        void shareReleaseFence(ExynosLayer *layer, int32_t sharedFence);
+        int32_t takeReleaseFence(ExynosLayer *layer);
+        void clearSharedReleaseFences();
 
         virtual bool checkFrameValidation();
 
@@ -680,6 +1037,17 @@ class ExynosDisplay {
                 uint32_t* outNumConfigs,
                 hwc2_config_t* outConfigs);
 
+        /* Publishes mDisplayConfigs with the config ids in @configs order */
+        void publishDisplayConfigs(const std::vector<hwc2_config_t> &configs);
+        std::shared_ptr<const display_config_table_t> getDisplayConfigTable() const {
+            return std::atomic_load(&mDisplayConfigTable);
+        }
+        /* Changes if the configs changed, 0 before they are published */
+        uint64_t getDisplayConfigsGeneration() const {
+            auto table = getDisplayConfigTable();
+            return table ? table->generation : 0;
+        }
+
         /* getDisplayName(..., outSize, outName)
          * Descriptor: HWC2_FUNCTION_GET_DISPLAY_NAME
          * HWC2_PFN_GET_DISPLAY_NAME
@@ -1040,6 +1408,8 @@ class ExynosDisplay {
          *       display
          */
         int32_t getClientTargetProperty(hwc_client_target_property_t* outClientTargetProperty);
+        /* Size of the client target buffer with mClientTargetScale applied */
+        void getClientTargetSize(uint32_t &width, uint32_t &height);
 
         /* setActiveConfig MISCs */
         bool isBadConfig(hwc2_config_t config);
@@ -1058,6 +1428,7 @@ class ExynosDisplay {
                 int64_t &appliedTime, int64_t &refreshTime);
         void updateBtsVsyncPeriod(uint32_t vsync_period, bool forceUpdate = false);
         uint32_t getBtsRefreshRate() const;
+        void updateCommittedBandwidth();
 
         /* TODO : TBD */
         int32_t setCursorPositionAsync(uint32_t x_pos, uint32_t y_pos);
@@ -1079,9 +1450,11 @@ class ExynosDisplay {
         void printConfig(exynos_win_config_data &c);
 
         unsigned int getLayerRegion(ExynosLayer *layer,
-                hwc_rect *rect_area, uint32_t regionType);
+                hwc_rect *rect_area, uint32_t regionType,
+                std::vector<hwc_rect> *damageRects = nullptr);
 
         int handleWindowUpdate();
+        void updateWindowUpdateStats();
         bool windowUpdateExceptions();
 
         /* For debugging */
@@ -1093,6 +1466,7 @@ class ExynosDisplay {
 
         bool checkConfigChanged(const exynos_dpu_data &lastConfigsData,
                 const exynos_dpu_data &newConfigsData);
+        size_t getDpuDataHash(const exynos_dpu_data &dpuData);
         int checkConfigDstChanged(const exynos_dpu_data &lastConfigData,
                 const exynos_dpu_data &newConfigData, uint32_t index);
 
@@ -1110,6 +1484,17 @@ class ExynosDisplay {
         void increaseMPPDstBufIndex();
         virtual void initDisplayInterface(uint32_t interfaceType);
         virtual int32_t updateColorConversionInfo() { return NO_ERROR; };
+        /*
+         * Called on the display thread before updateColorConversionInfo()
+         * is handed to mColorUpdateWorker. Returns true only if the pending
+         * change may reach the panel one frame late (e.g. brightness ramps,
+         * not HDR on/off); the scene must be captured by then because the
+         * next frame's layer updates may race with the worker.
+         */
+        virtual bool canDeferColorUpdate() { return false; }
+        int32_t requestColorConversionInfo(bool deferrable = true);
+        /* The color state must not be read while this returns true */
+        bool isColorUpdateRunning() { return mColorUpdateWorker.isRunning(); }
         virtual int32_t updatePresentColorConversionInfo() { return NO_ERROR; };
         virtual bool checkRrCompensationEnabled() { return false; };
         virtual int32_t getColorAdjustedDbv(uint32_t &) { return NO_ERROR; }
@@ -1129,8 +1514,18 @@ class ExynosDisplay {
 
         virtual bool isLhbmSupported() { return false; }
         virtual int32_t setLhbmState(bool __unused enabled) { return NO_ERROR; }
+        /*
+         * Called once the LHBM state is committed, with the retire fence of
+         * the commit (or -1). The fence signals when the panel shows it and
+         * is owned by the callback.
+         */
+        using LhbmCallback = std::function<void(int32_t status, int fence)>;
+        virtual int32_t setLhbmStateAsync(bool __unused enabled,
+                                          LhbmCallback __unused callback) {
+            return HWC2_ERROR_UNSUPPORTED;
+        }
         virtual bool getLhbmState() { return false; };
-        virtual void notifyLhbmState(bool __unused enabled) {}
+        virtual void notifyLhbmState(bool __unused enabled, int __unused fence = -1) {}
         virtual void setWakeupDisplay() {}
 
         /* getDisplayPreAssignBit support mIndex up to 1.
@@ -1148,6 +1543,94 @@ class ExynosDisplay {
 
         void updateRefreshRateHint();
 
+        /* Cadence shared by the updating layers, 0 if unknown or mixed */
+        uint32_t mContentFps = 0;
+
+        /* Refresh rate HWC would pick for the current content, 0 if none */
+        struct RefreshRateVote {
+            uint32_t refreshRate = 0;
+            String8 reason;
+        } mRefreshRateVote;
+
+        /* getDpuDataHash() of mLastDpuData, 0 if the next frame has to be committed */
+        size_t mLastDpuDataHash = 0;
+        /* mDpuData was committed, it becomes mLastDpuData at the end of present */
+        bool mDpuDataCommitted = false;
+
+        /* Partial regions the DPU takes in one frame */
+        uint32_t mMaxWinUpdateRegions = 1;
+
+        /*
+         * Client composition is rendered at this fraction of the panel
+         * resolution and upscaled to the panel by the DPP channel.
+         */
+        float mClientTargetScale = 1.0f;
+
+        /* Updated area in per-mille of the panel, full updates count as 1000 */
+        struct WindowUpdateStats {
+            uint64_t frames = 0;
+            uint64_t partialFrames = 0;
+            uint64_t areaPermilleSum = 0;
+            uint32_t lastAreaPermille = 1000;
+            uint32_t lastRegionNum = 0;
+        } mWindowUpdateStats;
+
+        /*
+         * Panel self refresh policy, for mPsrMode other than PSR_NONE.
+         * The panel is treated as static once the idle hint fires, or a
+         * repeated frame comes kSelfRefreshEntryNs after the last commit.
+         * Repeated frames are not committed, the next committed frame exits.
+         */
+        struct SelfRefreshStats {
+            bool active = false;
+            nsecs_t entryTime = 0;
+            nsecs_t lastCommitTime = 0;
+            uint64_t entries = 0;
+            nsecs_t residency = 0;
+            /* Duration of the commit of the frames that exited */
+            nsecs_t exitLatencySum = 0;
+            nsecs_t exitLatencyMax = 0;
+        } mSelfRefresh;
+        Mutex mSelfRefreshMutex;
+        static constexpr nsecs_t kSelfRefreshEntryNs = 100000000;
+        void enterSelfRefresh();
+        void updateSelfRefresh(bool committed, nsecs_t now, nsecs_t commitDuration);
+
+        /* Breakdown of the last power on, updated with mDisplayMutex held */
+        struct PowerOnStats {
+            nsecs_t stages[POWER_ON_STAGE_MAX] = {};
+            nsecs_t stageStart = 0;
+            bool waitFirstCommit = false;
+            uint64_t count = 0;
+            nsecs_t maxTotal = 0;
+            void start();
+            void record(power_on_stage_t stage);
+            void dump(String8 &result) const;
+        } mPowerOnStats;
+
+        /* DisplayControl::minimalDozeComposition in effect for the current frames */
+        bool mMinimalDozeComposition = false;
+
+        StageLatencyStats mStageStats;
+        /* Duration of the last validateDisplay(), added to the frame time by presentDisplay() */
+        nsecs_t mValidateDuration = 0;
+
+        /*
+         * dump() formats a snapshot of the display and its layers instead of
+         * holding mDisplayMutex while it formats. The snapshot is published
+         * by the presentDisplay() that follows a dump request, and by dump()
+         * itself if no frame comes within kDumpSnapshotTimeoutNs.
+         */
+        struct DumpSnapshot;
+        static constexpr nsecs_t kDumpSnapshotTimeoutNs = 50000000;
+        /* Accessed with std::atomic_load() and std::atomic_store() */
+        std::shared_ptr<const DumpSnapshot> mDumpSnapshot;
+        std::atomic<bool> mDumpSnapshotRequested = false;
+        Mutex mDumpSnapshotMutex;
+        Condition mDumpSnapshotCondition;
+        /* Called with mDisplayMutex held */
+        void publishDumpSnapshot();
+
     public:
         /**
          * This will be initialized with differnt class
@@ -1156,6 +1639,10 @@ class ExynosDisplay {
          */
         std::unique_ptr<ExynosDisplayInterface> mDisplayInterface;
 
+        const StageLatencyStats& getStageStats() const { return mStageStats; }
+
+        ReadbackStream mReadbackStream;
+
         const brightnessState_t& getBrightnessState() const { return mBrightnessState; }
         void updateForMipiSync(brightnessState_t::MipiSyncType type) {
             if (type == brightnessState_t::MIPI_SYNC_GHBM_ON ||
@@ -1164,16 +1651,20 @@ class ExynosDisplay {
             }
         }
         float getBrightnessValue() const { return mBrightnessState.brightness_value; }
+        bool isMinimalDozeComposition() const { return mMinimalDozeComposition; }
+        /* Called when the power mode or DisplayControl::minimalDozeComposition changes */
+        void updateMinimalDozeComposition();
         void requestLhbm(bool on) {
             mReqLhbm = on;
             mDevice->invalidate();
         }
 
     private:
+        bool isSkipStaticDeviceLayer(ExynosLayer *layer);
         bool skipStaticLayerChanged(ExynosCompositionInfo& compositionInfo);
 
         inline uint32_t getDisplayVsyncPeriodFromConfig(hwc2_config_t config) {
-            int32_t vsync_period;
+            int32_t vsync_period = 0;
             getDisplayAttribute(config, HWC2_ATTRIBUTE_VSYNC_PERIOD, &vsync_period);
             assert(vsync_period > 0);
             return static_cast<uint32_t>(vsync_period);
@@ -1199,8 +1690,11 @@ class ExynosDisplay {
         public:
             PowerHalHintWorker();
 
-            void signalRefreshRate(hwc2_power_mode_t powerMode, uint32_t vsyncPeriod);
+            void signalRefreshRate(hwc2_power_mode_t powerMode, uint32_t vsyncPeriod,
+                                   uint32_t contentFps = 0, uint32_t refreshRateVote = 0);
             void signalIdle();
+            /* Called from the worker thread when the idle hint is enabled */
+            void setIdleCallback(std::function<void()> callback) { mIdleCallback = callback; }
 
         protected:
             void Routine() override;
@@ -1215,9 +1709,17 @@ class ExynosDisplay {
                                                   uint32_t vsyncPeriod);
             int32_t sendRefreshRateHint(int refreshRate, bool enabled);
 
+            int32_t updateFpsHintInternal(hwc2_power_mode_t powerMode,
+                                          const std::string& prefix, uint32_t fps,
+                                          uint32_t& prevFps,
+                                          std::map<uint32_t, bool>& supportMap);
+
             int32_t checkIdleHintSupport();
             int32_t updateIdleHint(uint64_t deadlineTime);
 
+            void updatePresentIntervalLocked(uint64_t now);
+            bool isNextPresentUnlikelyLocked();
+
             bool mNeedUpdateRefreshRateHint;
 
             // previous refresh rate
@@ -1229,8 +1731,19 @@ class ExynosDisplay {
             // support list of refresh rate hints
             std::map<int, bool> mRefreshRateHintSupportMap;
 
+            // detected content cadence and the one whose hint is enabled
+            uint32_t mContentFps;
+            uint32_t mPrevContentFps;
+            std::map<uint32_t, bool> mContentFpsHintSupportMap;
+
+            // refresh rate voted by HWC and the one whose hint is enabled
+            uint32_t mRefreshRateVote;
+            uint32_t mPrevRefreshRateVote;
+            std::map<uint32_t, bool> mRefreshRateVoteHintSupportMap;
+
             bool mIdleHintIsEnabled;
             uint64_t mIdleHintDeadlineTime;
+            std::function<void()> mIdleCallback;
 
             // whether idle hint support is checked
             bool mIdleHintSupportIsChecked;
@@ -1238,6 +1751,23 @@ class ExynosDisplay {
             // whether idle hint is supported
             bool mIdleHintIsSupported;
 
+            /*
+             * Predictive idle hint: decaying histogram of the intervals
+             * between presents. The last bucket holds anything longer.
+             */
+            static constexpr uint32_t kPresentIntervalBucketMs[] = {8, 16, 33, 50, 100, 200,
+                                                                    500, 0};
+            static constexpr size_t kPresentIntervalBucketNum =
+                    sizeof(kPresentIntervalBucketMs) / sizeof(kPresentIntervalBucketMs[0]);
+            static constexpr float kPresentIntervalDecay = 0.9f;
+            static constexpr uint32_t kPredictiveIdleMinSamples = 16;
+            // send the idle hint at once below this chance of a present within the timeout
+            static constexpr float kPredictiveIdleProbability = 0.1f;
+            bool mPredictiveIdleHint;
+            uint64_t mLastPresentTime = 0;
+            uint32_t mPresentIntervalSamples = 0;
+            float mPresentIntervalHistogram[kPresentIntervalBucketNum] = {};
+
             hwc2_power_mode_t mPowerModeState;
             uint32_t mVsyncPeriod;
 
@@ -1247,6 +1777,56 @@ class ExynosDisplay {
         };
 
         PowerHalHintWorker mPowerHalHint;
+
+        /*
+         * Computes the color pipeline of validateDisplay() off the display
+         * thread. Opt-in per display by vendor.display.<index>.async_color_update.
+         */
+        class ColorUpdateWorker : public Worker {
+        public:
+            explicit ColorUpdateWorker(ExynosDisplay *display);
+
+            void init() { InitWorker(); }
+            void request();
+            void waitIdle();
+            bool isRunning();
+
+        protected:
+            void Routine() override;
+
+        private:
+            ExynosDisplay *mDisplay;
+            bool mPending;
+            bool mRunning;
+        };
+
+        bool mAsyncColorUpdate;
+        ColorUpdateWorker mColorUpdateWorker;
+
+        class EarlyValidateWorker : public Worker {
+        public:
+            explicit EarlyValidateWorker(ExynosDisplay *display);
+
+            void init() { InitWorker(); }
+            void request(ExynosLayer *layer, uint32_t epoch);
+            void cancel();
+            /* Returns once the worker no longer uses the layer */
+            void forget(ExynosLayer *layer);
+
+        protected:
+            void Routine() override;
+
+        private:
+            ExynosDisplay *mDisplay;
+            /* Layers in the order of their first setter, with the epoch of the request */
+            std::vector<std::pair<ExynosLayer *, uint32_t>> mPending;
+            ExynosLayer *mCurrent;
+        };
+
+        bool mEarlyValidate;
+        /* Bumped by cancelEarlyValidation(), older requests are dropped */
+        std::atomic<uint32_t> mEarlyValidateEpoch;
+        EarlyValidateWorker mEarlyValidateWorker;
 };
 
 #endif //_EXYNOSDISPLAY_H
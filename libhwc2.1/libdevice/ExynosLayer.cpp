@@ -26,6 +26,14 @@
 
 #include "VendorVideoAPI.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string_view>
+
+/* Source of ExynosLayer::mBufferGeneration */
+static std::atomic<uint64_t> sBufferGeneration(0);
+
 /**
  * ExynosLayer implementation
  */
@@ -39,6 +47,11 @@ ExynosLayer::ExynosLayer(ExynosDisplay* display)
         mValidateExynosCompositionType(HWC2_COMPOSITION_INVALID),
         mOverlayInfo(0x0),
         mSupportedMPPFlag(0x0),
+        mTestFailedMPPFlag(0x0),
+        mCapacityRejectedMPPFlag(0x0),
+        mSupportedMPPGeneration(0),
+        mSupportedMPPFlagCache(0x0),
+        mEarlyValidated(false),
         mFps(0),
         mOverlayPriority(ePriorityLow),
         mGeometryChanged(0x0),
@@ -47,17 +60,31 @@ ExynosLayer::ExynosLayer(ExynosDisplay* display)
         mAcquireFence(-1),
         mPrevAcquireFence(-1),
         mReleaseFence(-1),
+        mSharedReleaseFence(-1),
         mFrameCount(0),
         mLastFrameCount(0),
         mLastFpsTime(0),
+        mLastBufferTime(0),
+        mBufferIntervalEwma(0),
+        mCadenceHistogram{},
+        mContentFps(0),
         mLastLayerBuffer(NULL),
+        mBufferGeneration(0),
         mLayerBuffer(NULL),
+        mBufferMetaHits(0),
+        mBufferMetaMisses(0),
         mDamageNum(0),
         mBlending(HWC2_BLEND_MODE_NONE),
         mPlaneAlpha(1.0),
         mTransform(0),
         mZOrder(0),
+        mIndexInDisplay(-1),
         mDataSpace(HAL_DATASPACE_UNKNOWN),
+        mClientHoldFrames(0),
+        mClientHoldLength(0),
+        mFramesSinceReturn(UINT32_MAX),
+        mCompositionFlipCnt(0),
+        mLastValidateCompositionType(HWC2_COMPOSITION_INVALID),
         mLayerFlag(0x0),
         mIsHdrLayer(false),
         mBufferHasMetaParcel(false),
@@ -75,6 +102,8 @@ ExynosLayer::ExynosLayer(ExynosDisplay* display)
 }
 
 ExynosLayer::~ExynosLayer() {
+    clearBufferMetaCache();
+
     if (mMetaParcel != NULL) {
         munmap(mMetaParcel, sizeof(ExynosVideoMeta));
         mMetaParcel = NULL;
@@ -96,10 +125,11 @@ ExynosLayer::~ExynosLayer() {
 uint32_t ExynosLayer::checkFps() {
     uint32_t frameDiff;
     bool wasLowFps = (mFps < LOW_FPS_THRESHOLD) ? true:false;
+    nsecs_t now = systemTime();
     if (mLastLayerBuffer != mLayerBuffer) {
         mFrameCount++;
+        updateContentFps(now);
     }
-    nsecs_t now = systemTime();
     nsecs_t diff = now - mLastFpsTime;
     if (mFrameCount >= mLastFrameCount)
         frameDiff = (mFrameCount - mLastFrameCount);
@@ -127,6 +157,64 @@ uint32_t ExynosLayer::getFps() {
     return mFps;
 }
 
+/*
+ * Called on every buffer update. The EWMA smooths pulldown patterns
+ * (e.g. 24fps on 60Hz alternating 2 and 3 vsyncs) onto the source cadence,
+ * and the histogram needs a few consistent updates before reporting it.
+ */
+void ExynosLayer::updateContentFps(nsecs_t now) {
+    /* An update after a long pause restarts the estimation */
+    constexpr nsecs_t kMaxBufferInterval = ms2ns(200);
+    /* Each update moves the EWMA by 1/kEwmaWeight of its error */
+    constexpr nsecs_t kEwmaWeight = 4;
+    /* Histogram weight added per update, bins decay by 1/kCadenceDecay */
+    constexpr uint32_t kCadenceHit = 16;
+    constexpr uint32_t kCadenceDecay = 8;
+    /* A cadence is reported once it owns this many hits worth of weight */
+    constexpr uint32_t kCadenceDetectWeight = kCadenceHit * 3;
+    /* How far the estimated fps may be from a cadence, in percent */
+    constexpr uint32_t kCadenceTolerance = 8;
+
+    nsecs_t interval = now - mLastBufferTime;
+    mLastBufferTime = now;
+
+    if ((interval <= 0) || (interval > kMaxBufferInterval)) {
+        mBufferIntervalEwma = 0;
+        memset(mCadenceHistogram, 0, sizeof(mCadenceHistogram));
+        mContentFps = 0;
+        return;
+    }
+
+    if (mBufferIntervalEwma == 0)
+        mBufferIntervalEwma = interval;
+    else
+        mBufferIntervalEwma += (interval - mBufferIntervalEwma) / kEwmaWeight;
+
+    uint32_t estimatedFps = static_cast<uint32_t>(s2ns(1) / mBufferIntervalEwma);
+    size_t best = kCadenceNum;
+    uint32_t bestDiff = UINT_MAX;
+    for (size_t i = 0; i < kCadenceNum; i++) {
+        uint32_t diff = (estimatedFps > kCadenceFps[i]) ? estimatedFps - kCadenceFps[i]
+                                                        : kCadenceFps[i] - estimatedFps;
+        if ((diff * 100 <= kCadenceFps[i] * kCadenceTolerance) && (diff < bestDiff)) {
+            best = i;
+            bestDiff = diff;
+        }
+    }
+
+    size_t dominant = 0;
+    for (size_t i = 0; i < kCadenceNum; i++) {
+        mCadenceHistogram[i] -= mCadenceHistogram[i] / kCadenceDecay;
+        if (i == best)
+            mCadenceHistogram[i] += kCadenceHit;
+        if (mCadenceHistogram[i] > mCadenceHistogram[dominant])
+            dominant = i;
+    }
+
+    mContentFps = (mCadenceHistogram[dominant] >= kCadenceDetectWeight) ?
+        kCadenceFps[dominant] : 0;
+}
+
 int32_t ExynosLayer::doPreProcess()
 {
     overlay_priority priority = ePriorityLow;
@@ -153,12 +241,13 @@ int32_t ExynosLayer::doPreProcess()
         return NO_ERROR;
     }
 
-    VendorGraphicBufferMeta gmeta(mLayerBuffer);
+    BufferMeta *bufferMeta = lookupBufferMeta(mLayerBuffer);
+    const int format = bufferMeta->format;
 
     mPreprocessedInfo.mUsePrivateFormat = false;
-    mPreprocessedInfo.mPrivateFormat = gmeta.format;
+    mPreprocessedInfo.mPrivateFormat = format;
 
-    if (isFormatYUV(gmeta.format)) {
+    if (isFormatYUV(format)) {
         mPreprocessedInfo.sourceCrop.top = (int)mSourceCrop.top;
         mPreprocessedInfo.sourceCrop.left = (int)mSourceCrop.left;
         mPreprocessedInfo.sourceCrop.bottom = (int)(mSourceCrop.bottom + 0.9);
@@ -166,63 +255,58 @@ int32_t ExynosLayer::doPreProcess()
         mPreprocessedInfo.preProcessed = true;
     }
 
-    if (isFormatYUV(gmeta.format)) {
-
-        ExynosVideoMeta *metaData = NULL;
-        int priv_fd = -1;
-
-        if (gmeta.flags & VendorGraphicBufferMeta::PRIV_FLAGS_USES_2PRIVATE_DATA)
-            priv_fd = gmeta.fd1;
-        else if (gmeta.flags & VendorGraphicBufferMeta::PRIV_FLAGS_USES_3PRIVATE_DATA)
-            priv_fd = gmeta.fd2;
-
-        if (priv_fd >= 0) {
-
-            metaData = (ExynosVideoMeta*)mmap(0, sizeof(ExynosVideoMeta), PROT_READ|PROT_WRITE, MAP_SHARED, priv_fd, 0);
-
-            if (metaData == NULL) {
-                HWC_LOGE(mDisplay, "Layer's metadata is NULL!!");
-            } else if (metaData == MAP_FAILED) {
-                HWC_LOGE(mDisplay, "Layer's metadata map failed!!");
-            } else {
-                mBufferHasMetaParcel = true;
-                if ((metaData->eType & VIDEO_INFO_TYPE_HDR_STATIC) ||
-                        (metaData->eType & VIDEO_INFO_TYPE_HDR_DYNAMIC)) {
-                    if (allocMetaParcel() == NO_ERROR) {
-                        mMetaParcel->eType = metaData->eType;
-                        if (metaData->eType & VIDEO_INFO_TYPE_HDR_STATIC) {
-                            mMetaParcel->sHdrStaticInfo = metaData->sHdrStaticInfo;
-                            HDEBUGLOGD(eDebugLayer, "HWC2: Static metadata min(%d), max(%d)",
-                                    mMetaParcel->sHdrStaticInfo.sType1.mMinDisplayLuminance,
-                                    mMetaParcel->sHdrStaticInfo.sType1.mMaxDisplayLuminance);
-                        }
-                        if (metaData->eType & VIDEO_INFO_TYPE_HDR_DYNAMIC) {
-                            /* Reserved field for dynamic meta data */
-                            /* Currently It's not be used not only HWC but also OMX */
-                            mMetaParcel->sHdrDynamicInfo = metaData->sHdrDynamicInfo;
-                            HDEBUGLOGD(eDebugLayer, "HWC2: Layer has dynamic metadata");
-                        }
+    if (isFormatYUV(format)) {
+
+        /* Stays mapped while the buffer is cached, the producer updates it in place */
+        ExynosVideoMeta *metaData = getVideoMeta(*bufferMeta);
+        if (metaData != NULL) {
+            mBufferHasMetaParcel = true;
+            if ((metaData->eType & VIDEO_INFO_TYPE_HDR_STATIC) ||
+                    (metaData->eType & VIDEO_INFO_TYPE_HDR_DYNAMIC)) {
+                if (allocMetaParcel() == NO_ERROR) {
+                    bool changed = (mMetaParcel->eType != metaData->eType);
+                    mMetaParcel->eType = metaData->eType;
+                    if ((metaData->eType & VIDEO_INFO_TYPE_HDR_STATIC) &&
+                        memcmp(&mMetaParcel->sHdrStaticInfo, &metaData->sHdrStaticInfo,
+                               sizeof(mMetaParcel->sHdrStaticInfo))) {
+                        mMetaParcel->sHdrStaticInfo = metaData->sHdrStaticInfo;
+                        mPerFrameMetadata.clear();
+                        changed = true;
+                        HDEBUGLOGD(eDebugLayer, "HWC2: Static metadata min(%d), max(%d)",
+                                mMetaParcel->sHdrStaticInfo.sType1.mMinDisplayLuminance,
+                                mMetaParcel->sHdrStaticInfo.sType1.mMaxDisplayLuminance);
                     }
-                }
-                if (metaData->eType & VIDEO_INFO_TYPE_INTERLACED) {
-                    mPreprocessedInfo.interlacedType = metaData->data.dec.nInterlacedType;
-                    if (mPreprocessedInfo.interlacedType == V4L2_FIELD_INTERLACED_BT) {
-                        if ((int)mSourceCrop.left < (int)(gmeta.stride)) {
-                            mPreprocessedInfo.sourceCrop.left = (int)mSourceCrop.left + gmeta.stride;
-                            mPreprocessedInfo.sourceCrop.right = (int)mSourceCrop.right + gmeta.stride;
-                        }
+                    if ((metaData->eType & VIDEO_INFO_TYPE_HDR_DYNAMIC) &&
+                        memcmp(&mMetaParcel->sHdrDynamicInfo, &metaData->sHdrDynamicInfo,
+                               sizeof(mMetaParcel->sHdrDynamicInfo))) {
+                        /* Reserved field for dynamic meta data */
+                        /* Currently It's not be used not only HWC but also OMX */
+                        mMetaParcel->sHdrDynamicInfo = metaData->sHdrDynamicInfo;
+                        mPerFrameMetadataBlobs.clear();
+                        changed = true;
+                        HDEBUGLOGD(eDebugLayer, "HWC2: Layer has dynamic metadata");
                     }
-                    if (mPreprocessedInfo.interlacedType == V4L2_FIELD_INTERLACED_TB ||
-                            mPreprocessedInfo.interlacedType == V4L2_FIELD_INTERLACED_BT) {
-                        mPreprocessedInfo.sourceCrop.top = (int)(mSourceCrop.top)/2;
-                        mPreprocessedInfo.sourceCrop.bottom = (int)(mSourceCrop.bottom)/2;
+                    if (changed || (mMetaParcelRef == nullptr))
+                        publishMetaParcel();
+                }
+            }
+            if (metaData->eType & VIDEO_INFO_TYPE_INTERLACED) {
+                mPreprocessedInfo.interlacedType = metaData->data.dec.nInterlacedType;
+                if (mPreprocessedInfo.interlacedType == V4L2_FIELD_INTERLACED_BT) {
+                    if ((int)mSourceCrop.left < bufferMeta->stride) {
+                        mPreprocessedInfo.sourceCrop.left = (int)mSourceCrop.left + bufferMeta->stride;
+                        mPreprocessedInfo.sourceCrop.right = (int)mSourceCrop.right + bufferMeta->stride;
                     }
                 }
-                if (metaData->eType & VIDEO_INFO_TYPE_CHECK_PIXEL_FORMAT) {
-                    mPreprocessedInfo.mUsePrivateFormat = true;
-                    mPreprocessedInfo.mPrivateFormat = metaData->nPixelFormat;
+                if (mPreprocessedInfo.interlacedType == V4L2_FIELD_INTERLACED_TB ||
+                        mPreprocessedInfo.interlacedType == V4L2_FIELD_INTERLACED_BT) {
+                    mPreprocessedInfo.sourceCrop.top = (int)(mSourceCrop.top)/2;
+                    mPreprocessedInfo.sourceCrop.bottom = (int)(mSourceCrop.bottom)/2;
                 }
-                munmap(metaData, sizeof(ExynosVideoMeta));
+            }
+            if (metaData->eType & VIDEO_INFO_TYPE_CHECK_PIXEL_FORMAT) {
+                mPreprocessedInfo.mUsePrivateFormat = true;
+                mPreprocessedInfo.mPrivateFormat = metaData->nPixelFormat;
             }
         }
         mPreprocessedInfo.preProcessed = true;
@@ -233,7 +317,7 @@ int32_t ExynosLayer::doPreProcess()
     setSrcExynosImage(&src_img);
     setDstExynosImage(&dst_img);
     ExynosMPP *exynosMPPVG = nullptr;
-    if (isFormatYUV(gmeta.format)) {
+    if (isFormatYUV(format)) {
         auto otfMPPs = ExynosResourceManager::getOtfMPPs();
         auto mpp_it = std::find_if(otfMPPs.begin(), otfMPPs.end(),
                 [&src_img](auto m) { return m->isSrcFormatSupported(src_img); });
@@ -243,7 +327,7 @@ int32_t ExynosLayer::doPreProcess()
     /* Set HDR Flag */
     if(hasHdrInfo(src_img)) mIsHdrLayer = true;
 
-    if (isFormatYUV(gmeta.format) && exynosMPPVG) {
+    if (isFormatYUV(format) && exynosMPPVG) {
         /*
          * layer's sourceCrop should be aligned
          */
@@ -322,14 +406,14 @@ int32_t ExynosLayer::doPreProcess()
         mPreprocessedInfo.preProcessed = true;
     }
 
-    if (getDrmMode(mLayerBuffer) != NO_DRM) {
+    if (getDrmMode(bufferMeta->producerUsage) != NO_DRM) {
         priority = ePriorityMax;
     } else if (mIsHdrLayer) {
-        if (isFormatRgb(gmeta.format))
+        if (isFormatRgb(format))
             priority = ePriorityMax;
         else
             priority = ePriorityHigh;
-    } else if (isFormatYUV(gmeta.format)) {
+    } else if (isFormatYUV(format)) {
         priority = ePriorityHigh;
     } else if ((mDisplay->mDisplayControl.cursorSupport == true) &&
                (mCompositionType == HWC2_COMPOSITION_CURSOR)) {
@@ -352,6 +436,7 @@ int32_t ExynosLayer::setCursorPosition(int32_t x, int32_t y) {
 
 int32_t ExynosLayer::setLayerBuffer(buffer_handle_t buffer, int32_t acquireFence) {
 
+    mDisplay->requestEarlyValidation(this);
     /* TODO : Exception here ? */
     //TODO mGeometryChanged  here
 
@@ -365,19 +450,27 @@ int32_t ExynosLayer::setLayerBuffer(buffer_handle_t buffer, int32_t acquireFence
             return HWC2_ERROR_BAD_LAYER;
     }
 
-    VendorGraphicBufferMeta gmeta(mLayerBuffer);
-    internal_format = gmeta.format;
-
+    const BufferMeta *bufferMeta = NULL;
     if ((mLayerBuffer == NULL) || (buffer == NULL))
         setGeometryChanged(GEOMETRY_LAYER_UNKNOWN_CHANGED);
     else {
-        if (getDrmMode(VendorGraphicBufferMeta::get_producer_usage(mLayerBuffer)) != getDrmMode(gmeta.producer_usage))
+        /* Compare the previous buffer with the new one */
+        bufferMeta = lookupBufferMeta(mLayerBuffer);
+        const uint64_t prevUsage = bufferMeta->producerUsage;
+        const int prevFormat = bufferMeta->format;
+        bufferMeta = lookupBufferMeta(buffer);
+        if (getDrmMode(prevUsage) != getDrmMode(bufferMeta->producerUsage))
             setGeometryChanged(GEOMETRY_LAYER_DRM_CHANGED);
-        if (VendorGraphicBufferMeta::get_format(mLayerBuffer) != gmeta.format)
+        if (prevFormat != bufferMeta->format)
             setGeometryChanged(GEOMETRY_LAYER_FORMAT_CHANGED);
     }
+    if ((buffer != NULL) && (bufferMeta == NULL))
+        bufferMeta = lookupBufferMeta(buffer);
+    if (bufferMeta != NULL)
+        internal_format = bufferMeta->format;
 
     mLayerBuffer = buffer;
+    mBufferGeneration = ++sBufferGeneration;
     mPrevAcquireFence =
             fence_close(mPrevAcquireFence, mDisplay, FENCE_TYPE_SRC_ACQUIRE, FENCE_IP_UNDEFINED);
     mAcquireFence = fence_close(mAcquireFence, mDisplay, FENCE_TYPE_SRC_ACQUIRE, FENCE_IP_UNDEFINED);
@@ -394,7 +487,7 @@ int32_t ExynosLayer::setLayerBuffer(buffer_handle_t buffer, int32_t acquireFence
         fence_close(mAcquireFence);
     mAcquireFence = -1;
 #endif
-    bool compressed = isAFBCCompressed(mLayerBuffer);
+    bool compressed = (bufferMeta != NULL) ? bufferMeta->compressed : false;
     if (mCompressed != compressed)
         setGeometryChanged(GEOMETRY_LAYER_COMPRESSED_CHANGED);
     mCompressed = compressed;
@@ -404,7 +497,7 @@ int32_t ExynosLayer::setLayerBuffer(buffer_handle_t buffer, int32_t acquireFence
          * HAL_DATASPACE_V0_JFIF = HAL_DATASPACE_STANDARD_BT601_625 |
          * HAL_DATASPACE_TRANSFER_SMPTE_170M | HAL_DATASPACE_RANGE_FULL,
          */
-        if (gmeta.format == HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL)
+        if (internal_format == HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL)
             setLayerDataspace(HAL_DATASPACE_V0_JFIF);
     } else {
         setLayerDataspace(HAL_DATASPACE_UNKNOWN);
@@ -438,6 +531,7 @@ int32_t ExynosLayer::setLayerSurfaceDamage(hwc_region_t damage) {
 
 int32_t ExynosLayer::setLayerBlendMode(int32_t /*hwc2_blend_mode_t*/ mode) {
 
+    mDisplay->requestEarlyValidation(this);
     //TODO mGeometryChanged  here
     if (mode < 0)
         return HWC2_ERROR_BAD_PARAMETER;
@@ -456,6 +550,7 @@ int32_t ExynosLayer::setLayerColor(hwc_color_t color) {
 
 int32_t ExynosLayer::setLayerCompositionType(int32_t /*hwc2_composition_t*/ type) {
 
+    mDisplay->requestEarlyValidation(this);
     if (type < 0)
         return HWC2_ERROR_BAD_PARAMETER;
 
@@ -477,8 +572,9 @@ int32_t ExynosLayer::setLayerCompositionType(int32_t /*hwc2_composition_t*/ type
 }
 
 int32_t ExynosLayer::setLayerDataspace(int32_t /*android_dataspace_t*/ dataspace) {
+    mDisplay->requestEarlyValidation(this);
     android_dataspace currentDataSpace = (android_dataspace_t)dataspace;
-    if ((mLayerBuffer != NULL) && (VendorGraphicBufferMeta::get_format(mLayerBuffer) == HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL))
+    if ((mLayerBuffer != NULL) && (getBufferMeta(mLayerBuffer)->format == HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL))
         currentDataSpace = HAL_DATASPACE_V0_JFIF;
     else {
         /* Change legacy dataspace */
@@ -517,6 +613,7 @@ int32_t ExynosLayer::setLayerDataspace(int32_t /*android_dataspace_t*/ dataspace
 
 int32_t ExynosLayer::setLayerDisplayFrame(hwc_rect_t frame) {
 
+    mDisplay->requestEarlyValidation(this);
     if ((frame.left != mDisplayFrame.left) ||
         (frame.top != mDisplayFrame.top) ||
         (frame.right != mDisplayFrame.right) ||
@@ -529,6 +626,7 @@ int32_t ExynosLayer::setLayerDisplayFrame(hwc_rect_t frame) {
 
 int32_t ExynosLayer::setLayerPlaneAlpha(float alpha) {
 
+    mDisplay->requestEarlyValidation(this);
     if (alpha < 0.0)
         return HWC2_ERROR_BAD_LAYER;
 
@@ -551,6 +649,7 @@ int32_t ExynosLayer::setLayerSidebandStream(const native_handle_t* __unused stre
 
 int32_t ExynosLayer::setLayerSourceCrop(hwc_frect_t crop) {
 
+    mDisplay->requestEarlyValidation(this);
     if ((crop.left != mSourceCrop.left) ||
         (crop.top != mSourceCrop.top) ||
         (crop.right != mSourceCrop.right) ||
@@ -564,6 +663,7 @@ int32_t ExynosLayer::setLayerSourceCrop(hwc_frect_t crop) {
 
 int32_t ExynosLayer::setLayerTransform(int32_t /*hwc_transform_t*/ transform) {
 
+    mDisplay->requestEarlyValidation(this);
     if (mTransform != transform) {
         setGeometryChanged(GEOMETRY_LAYER_TRANSFORM_CHANGED);
         mTransform = transform;
@@ -580,9 +680,11 @@ int32_t ExynosLayer::setLayerVisibleRegion(hwc_region_t visible) {
 }
 
 int32_t ExynosLayer::setLayerZOrder(uint32_t z) {
+    mDisplay->requestEarlyValidation(this);
     if (mZOrder != z) {
         setGeometryChanged(GEOMETRY_LAYER_ZORDER_CHANGED);
         mZOrder = z;
+        mDisplay->mLayers.updateZOrder(this);
     }
     return HWC2_ERROR_NONE;
 }
@@ -590,8 +692,29 @@ int32_t ExynosLayer::setLayerZOrder(uint32_t z) {
 int32_t ExynosLayer::setLayerPerFrameMetadata(uint32_t numElements,
         const int32_t* /*hw2_per_frame_metadata_key_t*/ keys, const float* metadata)
 {
+    mDisplay->requestEarlyValidation(this);
     if (allocMetaParcel() != NO_ERROR)
         return -1;
+
+    if ((mMetaParcel->eType & VIDEO_INFO_TYPE_HDR_STATIC) &&
+        (mPerFrameMetadata.keys.size() == numElements) &&
+        std::equal(keys, keys + numElements, mPerFrameMetadata.keys.begin()) &&
+        std::equal(metadata, metadata + numElements, mPerFrameMetadata.values.begin()))
+        return NO_ERROR;
+
+    mPerFrameMetadata.clear();
+    int32_t ret = convertPerFrameMetadata(numElements, keys, metadata);
+    publishMetaParcel();
+    if (ret == NO_ERROR) {
+        mPerFrameMetadata.keys.assign(keys, keys + numElements);
+        mPerFrameMetadata.values.assign(metadata, metadata + numElements);
+    }
+    return ret;
+}
+
+int32_t ExynosLayer::convertPerFrameMetadata(uint32_t numElements,
+        const int32_t* /*hw2_per_frame_metadata_key_t*/ keys, const float* metadata)
+{
     unsigned int multipliedVal = 50000;
     mMetaParcel->eType =
         static_cast<ExynosVideoInfoType>(mMetaParcel->eType | VIDEO_INFO_TYPE_HDR_STATIC);
@@ -658,6 +781,34 @@ int32_t ExynosLayer::setLayerPerFrameMetadata(uint32_t numElements,
 
 int32_t ExynosLayer::setLayerPerFrameMetadataBlobs(uint32_t numElements, const int32_t* keys, const uint32_t* sizes,
         const uint8_t* metadata)
+{
+    mDisplay->requestEarlyValidation(this);
+    size_t length = 0;
+    for (uint32_t i = 0; i < numElements; i++)
+        length += sizes[i];
+
+    if ((mMetaParcel != NULL) &&
+        (mPerFrameMetadataBlobs.keys.size() == numElements) &&
+        std::equal(keys, keys + numElements, mPerFrameMetadataBlobs.keys.begin()) &&
+        std::equal(sizes, sizes + numElements, mPerFrameMetadataBlobs.sizes.begin()) &&
+        (mPerFrameMetadataBlobs.blobs.size() == length) &&
+        std::equal(metadata, metadata + length, mPerFrameMetadataBlobs.blobs.begin()))
+        return HWC2_ERROR_NONE;
+
+    mPerFrameMetadataBlobs.clear();
+    int32_t ret = convertPerFrameMetadataBlobs(numElements, keys, sizes, metadata);
+    if (mMetaParcel != NULL)
+        publishMetaParcel();
+    if (ret == HWC2_ERROR_NONE) {
+        mPerFrameMetadataBlobs.keys.assign(keys, keys + numElements);
+        mPerFrameMetadataBlobs.sizes.assign(sizes, sizes + numElements);
+        mPerFrameMetadataBlobs.blobs.assign(metadata, metadata + length);
+    }
+    return ret;
+}
+
+int32_t ExynosLayer::convertPerFrameMetadataBlobs(uint32_t numElements, const int32_t* keys,
+        const uint32_t* sizes, const uint8_t* metadata)
 {
     const uint8_t *metadata_start = metadata;
     for (uint32_t i = 0; i < numElements; i++) {
@@ -684,7 +835,15 @@ int32_t ExynosLayer::setLayerPerFrameMetadataBlobs(uint32_t numElements, const i
 
 int32_t ExynosLayer::setLayerColorTransform(const float* matrix)
 {
-    mLayerColorTransform.enable = true;
+    mDisplay->requestEarlyValidation(this);
+    /*
+     * SurfaceFlinger clears the transform with the identity matrix, which
+     * shouldn't restrict the layer to the channels with a matrix block
+     */
+    bool enable = !isIdentityColorMatrix(matrix);
+    if (enable != mLayerColorTransform.enable)
+        setGeometryChanged(GEOMETRY_LAYER_COLOR_TRANSFORM_CHANGED);
+    mLayerColorTransform.enable = enable;
     for (uint32_t i = 0; i < TRANSFORM_MAT_SIZE; i++)
     {
         mLayerColorTransform.mat[i] = matrix[i];
@@ -706,7 +865,147 @@ void ExynosLayer::resetValidateData()
     mOtfMPP = NULL;
     mM2mMPP = NULL;
     mOverlayInfo = 0x0;
+    mCapacityRejectedMPPFlag = 0x0;
     mWindowIndex = 0;
+    mLastAssignSignature = layer_assign_signature_t();
+}
+
+static bool isScaleChanged(const layer_assign_signature_t &prev,
+                           const layer_assign_signature_t &cur)
+{
+    if (prev.transform != cur.transform)
+        return true;
+
+    float prevRatio[2] = {(float)WIDTH(prev.sourceCrop) / std::max(WIDTH(prev.displayFrame), 1),
+                          (float)HEIGHT(prev.sourceCrop) / std::max(HEIGHT(prev.displayFrame), 1)};
+    float curRatio[2] = {(float)WIDTH(cur.sourceCrop) / std::max(WIDTH(cur.displayFrame), 1),
+                         (float)HEIGHT(cur.sourceCrop) / std::max(HEIGHT(cur.displayFrame), 1)};
+    for (uint32_t i = 0; i < 2; i++) {
+        if (std::fabs(curRatio[i] - prevRatio[i]) >
+            (prevRatio[i] / COMPOSITION_HYSTERESIS_SCALE_MARGIN))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Called once per frame before resource assignment.
+ * The hold counts down only while the layer is stable.
+ */
+void ExynosLayer::updateClientHold()
+{
+    if (mFramesSinceReturn < UINT32_MAX)
+        mFramesSinceReturn++;
+
+    if (mClientHoldFrames == 0)
+        return;
+
+    layer_assign_signature_t signature = getAssignSignature();
+    if (isDrm() || (mOverlayPriority >= ePriorityHigh) ||
+        isScaleChanged(mHoldSignature, signature))
+        mClientHoldFrames = 0;
+    else if (signature != mHoldLastSignature)
+        mClientHoldFrames = mClientHoldLength;
+    else
+        mClientHoldFrames--;
+    mHoldLastSignature = signature;
+
+    /* Assign the layer again */
+    if (mClientHoldFrames == 0)
+        setGeometryChanged(GEOMETRY_LAYER_UNKNOWN_CHANGED);
+}
+
+/*
+ * Called after resource assignment.
+ * A layer that falls back again soon after it returned to device composition
+ * is held twice as long.
+ */
+void ExynosLayer::updateCompositionFlip()
+{
+    bool wasClient = (mLastValidateCompositionType == HWC2_COMPOSITION_CLIENT);
+    bool isClient = (mValidateCompositionType == HWC2_COMPOSITION_CLIENT);
+
+    if ((mLastValidateCompositionType != HWC2_COMPOSITION_INVALID) &&
+        (mValidateCompositionType != HWC2_COMPOSITION_INVALID) &&
+        (wasClient != isClient)) {
+        mCompositionFlipCnt++;
+        if (!isClient) {
+            mFramesSinceReturn = 0;
+        } else if ((mCompositionType != HWC2_COMPOSITION_CLIENT) &&
+                   (mOverlayInfo & (eMPPUnsupported | eInsufficientMPP | eInsufficientWindow)) &&
+                   !isDrm() && (mOverlayPriority < ePriorityHigh)) {
+            if (mFramesSinceReturn < mClientHoldLength)
+                mClientHoldLength = std::min(mClientHoldLength * 2,
+                                             (uint32_t)COMPOSITION_HYSTERESIS_MAX_FRAMES);
+            else
+                mClientHoldLength = COMPOSITION_HYSTERESIS_FRAMES;
+            mClientHoldFrames = mClientHoldLength;
+            mHoldSignature = getAssignSignature();
+            mHoldLastSignature = mHoldSignature;
+        }
+    }
+    mLastValidateCompositionType = mValidateCompositionType;
+}
+
+layer_assign_signature_t ExynosLayer::getAssignSignature()
+{
+    layer_assign_signature_t signature;
+
+    signature.compositionType = mCompositionType;
+    if (mLayerBuffer != NULL) {
+        const BufferMeta *bufferMeta = getBufferMeta(mLayerBuffer);
+        signature.format = bufferMeta->format;
+        signature.drmMode = getDrmMode(bufferMeta->producerUsage);
+        signature.stride = bufferMeta->stride;
+        signature.vstride = bufferMeta->vstride;
+    }
+    signature.compressed = mCompressed;
+    signature.hasMetaParcel = (mMetaParcel != NULL);
+    signature.lowFps = (mFps < LOW_FPS_THRESHOLD);
+    signature.needColorTransform = mLayerColorTransform.enable;
+    signature.sourceCrop = mSourceCrop;
+    signature.displayFrame = mDisplayFrame;
+    signature.transform = mTransform;
+    signature.dataSpace = mDataSpace;
+    signature.blending = mBlending;
+    signature.planeAlpha = mPlaneAlpha;
+    signature.zOrder = mZOrder;
+
+    return signature;
+}
+
+template <typename T>
+static void hash_combine_bytes(size_t &seed, const T &value) {
+    hash_combine(seed, std::string_view(reinterpret_cast<const char *>(&value), sizeof(value)));
+}
+
+size_t ExynosLayer::getColorDataHash() const
+{
+    size_t hash = 0;
+
+    hash_combine(hash, static_cast<int32_t>(mDataSpace));
+    hash_combine(hash, mIsHdrLayer);
+    hash_combine(hash, mLayerColorTransform.enable);
+    if (mLayerColorTransform.enable)
+        hash_combine_bytes(hash, mLayerColorTransform.mat);
+
+    if (mMetaParcelRef != nullptr)
+        hash_combine(hash, mMetaParcelHash);
+
+    return hash;
+}
+
+/* Called after every modification of mMetaParcel, exynos_image keeps the old copy */
+void ExynosLayer::publishMetaParcel()
+{
+    mMetaParcelRef = std::make_shared<const ExynosVideoMeta>(*mMetaParcel);
+
+    mMetaParcelHash = 0;
+    hash_combine(mMetaParcelHash, static_cast<int32_t>(mMetaParcelRef->eType));
+    if (mMetaParcelRef->eType & VIDEO_INFO_TYPE_HDR_STATIC)
+        hash_combine_bytes(mMetaParcelHash, mMetaParcelRef->sHdrStaticInfo);
+    if (mMetaParcelRef->eType & VIDEO_INFO_TYPE_HDR_DYNAMIC)
+        hash_combine_bytes(mMetaParcelHash, mMetaParcelRef->sHdrDynamicInfo);
 }
 
 int32_t ExynosLayer::setSrcExynosImage(exynos_image *src_img)
@@ -749,22 +1048,22 @@ int32_t ExynosLayer::setSrcExynosImage(exynos_image *src_img)
         src_img->usageFlags = 0x0;
         src_img->bufferHandle = handle;
     } else {
-        VendorGraphicBufferMeta gmeta(handle);
+        const BufferMeta *bufferMeta = getBufferMeta(handle);
 
         if ((mPreprocessedInfo.interlacedType == V4L2_FIELD_INTERLACED_TB) ||
             (mPreprocessedInfo.interlacedType == V4L2_FIELD_INTERLACED_BT))
         {
-            src_img->fullWidth = (gmeta.stride * 2);
-            src_img->fullHeight = pixel_align_down((gmeta.vstride / 2), 2);
+            src_img->fullWidth = (bufferMeta->stride * 2);
+            src_img->fullHeight = pixel_align_down((bufferMeta->vstride / 2), 2);
         } else {
-            src_img->fullWidth = gmeta.stride;
-            src_img->fullHeight = gmeta.vstride;
+            src_img->fullWidth = bufferMeta->stride;
+            src_img->fullHeight = bufferMeta->vstride;
         }
         if (!mPreprocessedInfo.mUsePrivateFormat)
-            src_img->format = gmeta.format;
+            src_img->format = bufferMeta->format;
         else
             src_img->format = mPreprocessedInfo.mPrivateFormat;
-        src_img->usageFlags = gmeta.producer_usage;
+        src_img->usageFlags = bufferMeta->producerUsage;
         src_img->bufferHandle = handle;
     }
     src_img->x = (int)mPreprocessedInfo.sourceCrop.left;
@@ -792,12 +1091,11 @@ int32_t ExynosLayer::setSrcExynosImage(exynos_image *src_img)
     src_img->compressed = mCompressed;
     src_img->planeAlpha = mPlaneAlpha;
     src_img->zOrder = mZOrder;
-    /* Copy HDR metadata */
-    memset(&(src_img->metaParcel), 0, sizeof(src_img->metaParcel));
+    /* Share HDR metadata */
+    src_img->metaParcel = mMetaParcelRef;
     src_img->metaType = VIDEO_INFO_TYPE_INVALID;
-    if (mMetaParcel != NULL) {
-        memcpy(&(src_img->metaParcel), mMetaParcel, sizeof(src_img->metaParcel));
-        src_img->metaType = mMetaParcel->eType;
+    if (mMetaParcelRef != nullptr) {
+        src_img->metaType = mMetaParcelRef->eType;
         src_img->hasMetaParcel = true;
     } else {
         src_img->hasMetaParcel = false;
@@ -861,12 +1159,11 @@ int32_t ExynosLayer::setDstExynosImage(exynos_image *dst_img)
     dst_img->planeAlpha = mPlaneAlpha;
     dst_img->zOrder = mZOrder;
 
-    /* Copy HDR metadata */
-    memset(&(dst_img->metaParcel), 0, sizeof(dst_img->metaParcel));
+    /* Share HDR metadata */
+    dst_img->metaParcel = mMetaParcelRef;
     dst_img->metaType = VIDEO_INFO_TYPE_INVALID;
-    if (mMetaParcel != NULL) {
-        memcpy(&(dst_img->metaParcel), mMetaParcel, sizeof(dst_img->metaParcel));
-        dst_img->metaType = mMetaParcel->eType;
+    if (mMetaParcelRef != nullptr) {
+        dst_img->metaType = mMetaParcelRef->eType;
         dst_img->hasMetaParcel = true;
     } else {
         dst_img->hasMetaParcel = false;
@@ -901,92 +1198,151 @@ void ExynosLayer::setSrcAcquireFence() {
     }
 }
 
-void ExynosLayer::dump(String8& result)
+void ExynosLayer::takeDumpSnapshot(DumpSnapshot &snapshot)
 {
-    int format = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
-    int32_t fd, fd1, fd2;
+    snapshot.layerBuffer = mLayerBuffer;
     if (mLayerBuffer != NULL)
     {
         VendorGraphicBufferMeta gmeta(mLayerBuffer);
-        format = gmeta.format;
-        fd = gmeta.fd;
-        fd1 = gmeta.fd1;
-        fd2 = gmeta.fd2;
+        snapshot.format = gmeta.format;
+        snapshot.fd[0] = gmeta.fd;
+        snapshot.fd[1] = gmeta.fd1;
+        snapshot.fd[2] = gmeta.fd2;
     } else {
-        format = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
-        fd = -1;
-        fd1 = -1;
-        fd2 = -1;
+        snapshot.format = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
+        snapshot.fd[0] = -1;
+        snapshot.fd[1] = -1;
+        snapshot.fd[2] = -1;
     }
 
+    snapshot.zOrder = mZOrder;
+    snapshot.overlayPriority = mOverlayPriority;
+    snapshot.compositionType = mCompositionType;
+    snapshot.color = mColor;
+    snapshot.compressed = mCompressed;
+    snapshot.dataSpace = mDataSpace;
+    snapshot.colorTransform = mLayerColorTransform.enable;
+    snapshot.blending = mBlending;
+    snapshot.planeAlpha = mPlaneAlpha;
+    snapshot.fps = mFps;
+    snapshot.contentFps = mContentFps;
+    snapshot.metaHits = mBufferMetaHits;
+    snapshot.metaMisses = mBufferMetaMisses;
+    snapshot.sourceCrop = mPreprocessedInfo.sourceCrop;
+    snapshot.displayFrame = mPreprocessedInfo.displayFrame;
+    snapshot.transform = mTransform;
+    snapshot.windowIndex = mWindowIndex;
+    snapshot.exynosCompositionType = mExynosCompositionType;
+    snapshot.validateCompositionType = mValidateCompositionType;
+    snapshot.overlayInfo = mOverlayInfo;
+    snapshot.supportedMPPFlag = mSupportedMPPFlag;
+    snapshot.compositionFlipCnt = mCompositionFlipCnt;
+    snapshot.clientHoldFrames = mClientHoldFrames;
+
+    snapshot.otfMPPFlags.clear();
+    snapshot.m2mMPPFlags.clear();
+    if ((mDisplay != NULL) && (mDisplay->mResourceManager != NULL)) {
+        ExynosResourceManager *resourceManager = mDisplay->mResourceManager;
+        for (uint32_t i = 0; i < resourceManager->getOtfMPPSize(); i++) {
+            ExynosMPP *mpp = resourceManager->getOtfMPP(i);
+            snapshot.otfMPPFlags.emplace_back(mpp->mName.string(),
+                    mCheckMPPFlag[mpp->mLogicalType]);
+        }
+        for (uint32_t i = 0; i < resourceManager->getM2mMPPSize(); i++) {
+            ExynosMPP *mpp = resourceManager->getM2mMPP(i);
+            snapshot.m2mMPPFlags.emplace_back(mpp->mName.string(),
+                    mCheckMPPFlag[mpp->mLogicalType]);
+        }
+    }
+
+    snapshot.acquireFence = mAcquireFence;
+    snapshot.otfMPP = (mOtfMPP != NULL) ? mOtfMPP->mName.string() : NULL;
+    snapshot.m2mMPP = (mM2mMPP != NULL) ? mM2mMPP->mName.string() : NULL;
+    snapshot.midImg = mMidImg;
+}
+
+void ExynosLayer::dump(const DumpSnapshot &snapshot, String8& result)
+{
     {
         TableBuilder tb;
-        tb.add("zOrder", mZOrder)
-          .add("priority", mOverlayPriority);
-        if (mCompositionType == HWC2_COMPOSITION_SOLID_COLOR) {
-            tb.add("color", std::vector<uint64_t>({mColor.r, mColor.g, mColor.b, mColor.a}), true);
+        tb.add("zOrder", snapshot.zOrder)
+          .add("priority", snapshot.overlayPriority);
+        if (snapshot.compositionType == HWC2_COMPOSITION_SOLID_COLOR) {
+            tb.add("color", std::vector<uint64_t>({snapshot.color.r, snapshot.color.g,
+                                                   snapshot.color.b, snapshot.color.a}), true);
         } else {
-            tb.add("handle", mLayerBuffer)
-              .add("fd", std::vector<int>({fd, fd1, fd2}))
-              .add("AFBC", static_cast<bool>(mCompressed));
+            tb.add("handle", snapshot.layerBuffer)
+              .add("fd", std::vector<int>({snapshot.fd[0], snapshot.fd[1], snapshot.fd[2]}))
+              .add("AFBC", snapshot.compressed);
         }
-        tb.add("format", getFormatStr(format, mCompressed ? AFBC : 0).string())
-          .add("dataSpace", mDataSpace, true)
-          .add("colorTr", mLayerColorTransform.enable)
-          .add("blend", mBlending, true)
-          .add("planeAlpha", mPlaneAlpha)
-          .add("fps", mFps);
+        tb.add("format", getFormatStr(snapshot.format, snapshot.compressed ? AFBC : 0).string())
+          .add("dataSpace", snapshot.dataSpace, true)
+          .add("colorTr", snapshot.colorTransform)
+          .add("blend", snapshot.blending, true)
+          .add("planeAlpha", snapshot.planeAlpha)
+          .add("fps", snapshot.fps)
+          .add("contentFps", snapshot.contentFps)
+          .add("metaCacheHit", snapshot.metaHits)
+          .add("metaCacheMiss", snapshot.metaMisses);
         result.append(tb.build().c_str());
     }
 
     result.append(TableBuilder()
                           .add("sourceCrop",
-                               std::vector<double>({mPreprocessedInfo.sourceCrop.left,
-                                                    mPreprocessedInfo.sourceCrop.top,
-                                                    mPreprocessedInfo.sourceCrop.right,
-                                                    mPreprocessedInfo.sourceCrop.bottom}))
+                               std::vector<double>({snapshot.sourceCrop.left,
+                                                    snapshot.sourceCrop.top,
+                                                    snapshot.sourceCrop.right,
+                                                    snapshot.sourceCrop.bottom}))
                           .add("dispFrame",
-                               std::vector<int>({mPreprocessedInfo.displayFrame.left,
-                                                 mPreprocessedInfo.displayFrame.top,
-                                                 mPreprocessedInfo.displayFrame.right,
-                                                 mPreprocessedInfo.displayFrame.bottom}))
-                          .add("tr", mTransform, true)
-                          .add("windowIndex", mWindowIndex)
-                          .add("type", mCompositionType)
-                          .add("exynosType", mExynosCompositionType)
-                          .add("validateType", mValidateCompositionType)
-                          .add("overlayInfo", mOverlayInfo, true)
-                          .add("supportedMPPFlag", mSupportedMPPFlag, true)
+                               std::vector<int>({snapshot.displayFrame.left,
+                                                 snapshot.displayFrame.top,
+                                                 snapshot.displayFrame.right,
+                                                 snapshot.displayFrame.bottom}))
+                          .add("tr", snapshot.transform, true)
+                          .add("windowIndex", snapshot.windowIndex)
+                          .add("type", snapshot.compositionType)
+                          .add("exynosType", snapshot.exynosCompositionType)
+                          .add("validateType", snapshot.validateCompositionType)
+                          .add("overlayInfo", snapshot.overlayInfo, true)
+                          .add("supportedMPPFlag", snapshot.supportedMPPFlag, true)
+                          .add("flips", snapshot.compositionFlipCnt)
+                          .add("clientHold", snapshot.clientHoldFrames)
                           .build()
                           .c_str());
 
-    if ((mDisplay != NULL) && (mDisplay->mResourceManager != NULL)) {
+    if (!snapshot.otfMPPFlags.empty() || !snapshot.m2mMPPFlags.empty()) {
         result.appendFormat("MPPFlags for otfMPP\n");
-        for (uint32_t i = 0; i < mDisplay->mResourceManager->getOtfMPPSize(); i++) {
-            result.appendFormat("[%s: 0x%" PRIx64 "] ", mDisplay->mResourceManager->getOtfMPP(i)->mName.string(),
-                    mCheckMPPFlag[mDisplay->mResourceManager->getOtfMPP(i)->mLogicalType]);
-        }
+        for (auto &flag : snapshot.otfMPPFlags)
+            result.appendFormat("[%s: 0x%" PRIx64 "] ", flag.first, flag.second);
         result.appendFormat("\n");
         result.appendFormat("MPPFlags for m2mMPP\n");
-        for (uint32_t i = 0; i < mDisplay->mResourceManager->getM2mMPPSize(); i++) {
-            result.appendFormat("[%s: 0x%" PRIx64 "] ", mDisplay->mResourceManager->getM2mMPP(i)->mName.string(),
-                    mCheckMPPFlag[mDisplay->mResourceManager->getM2mMPP(i)->mLogicalType]);
+        for (uint32_t i = 0; i < snapshot.m2mMPPFlags.size(); i++) {
+            result.appendFormat("[%s: 0x%" PRIx64 "] ", snapshot.m2mMPPFlags[i].first,
+                    snapshot.m2mMPPFlags[i].second);
             if ((i!=0) && (i%4==0)) result.appendFormat("\n");
         }
         result.appendFormat("\n");
     }
-    result.appendFormat("acquireFence: %d\n", mAcquireFence);
-    if ((mOtfMPP == NULL) && (mM2mMPP == NULL))
+    result.appendFormat("acquireFence: %d\n", snapshot.acquireFence);
+    if ((snapshot.otfMPP == NULL) && (snapshot.m2mMPP == NULL))
         result.appendFormat("\tresource is not assigned.\n");
-    if (mOtfMPP != NULL)
-        result.appendFormat("\tassignedMPP: %s\n", mOtfMPP->mName.string());
-    if (mM2mMPP != NULL)
-        result.appendFormat("\tassignedM2mMPP: %s\n", mM2mMPP->mName.string());
+    if (snapshot.otfMPP != NULL)
+        result.appendFormat("\tassignedMPP: %s\n", snapshot.otfMPP);
+    if (snapshot.m2mMPP != NULL)
+        result.appendFormat("\tassignedM2mMPP: %s\n", snapshot.m2mMPP);
     result.appendFormat("\tdump midImg\n");
-    dumpExynosImage(result, mMidImg);
+    exynos_image midImg = snapshot.midImg;
+    dumpExynosImage(result, midImg);
 
 }
 
+void ExynosLayer::dump(String8& result)
+{
+    DumpSnapshot snapshot;
+    takeDumpSnapshot(snapshot);
+    dump(snapshot, result);
+}
+
 void ExynosLayer::printLayer()
 {
     int format = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
@@ -1009,7 +1365,8 @@ void ExynosLayer::printLayer()
             mLayerBuffer, fd, fd1, fd2, mAcquireFence, mTransform, mCompressed, mDataSpace, getFormatStr(format, mCompressed? AFBC : 0).string());
     result.appendFormat("\tblend: 0x%4x, planeAlpha: %3.1f, zOrder: %d, color[0x%2x, 0x%2x, 0x%2x, 0x%2x]\n",
             mBlending, mPlaneAlpha, mZOrder, mColor.r, mColor.g, mColor.b, mColor.a);
-    result.appendFormat("\tfps: %2d, priority: %d, windowIndex: %d\n", mFps, mOverlayPriority, mWindowIndex);
+    result.appendFormat("\tfps: %2d, contentFps: %3d, priority: %d, windowIndex: %d\n",
+            mFps, mContentFps, mOverlayPriority, mWindowIndex);
     result.appendFormat("\tsourceCrop[%7.1f,%7.1f,%7.1f,%7.1f], dispFrame[%5d,%5d,%5d,%5d]\n",
             mSourceCrop.left, mSourceCrop.top, mSourceCrop.right, mSourceCrop.bottom,
             mDisplayFrame.left, mDisplayFrame.top, mDisplayFrame.right, mDisplayFrame.bottom);
@@ -1087,6 +1444,103 @@ int ExynosLayer::allocMetaParcel()
     return NO_ERROR;
 }
 
+const ExynosLayer::BufferMeta* ExynosLayer::getBufferMeta(buffer_handle_t handle)
+{
+    return lookupBufferMeta(handle);
+}
+
+ExynosLayer::BufferMeta* ExynosLayer::lookupBufferMeta(buffer_handle_t handle)
+{
+    /* The handle pointer can be reused by a new buffer, so the id must match too */
+    uint64_t bufferId = VendorGraphicBufferMeta::get_buffer_id(handle);
+    size_t index = kBufferMetaCacheSize - 1;
+    bool hit = false;
+    for (size_t i = 0; i < kBufferMetaCacheSize; i++) {
+        if ((mBufferMetaCache[i].handle == handle) &&
+            (mBufferMetaCache[i].bufferId == bufferId)) {
+            index = i;
+            hit = true;
+            break;
+        }
+    }
+
+    /* Move the entry to the front, the least recently used one is evicted on a miss */
+    BufferMeta entry = mBufferMetaCache[index];
+    for (size_t i = index; i > 0; i--)
+        mBufferMetaCache[i] = mBufferMetaCache[i - 1];
+
+    if (hit) {
+        mBufferMetaHits++;
+        mBufferMetaCache[0] = entry;
+        return &mBufferMetaCache[0];
+    }
+
+    mBufferMetaMisses++;
+    if (entry.videoMeta != NULL)
+        munmap(entry.videoMeta, sizeof(ExynosVideoMeta));
+
+    BufferMeta &meta = mBufferMetaCache[0];
+    parseBufferMeta(handle, meta);
+
+    return &meta;
+}
+
+void ExynosLayer::parseBufferMeta(buffer_handle_t handle, BufferMeta &meta)
+{
+    VendorGraphicBufferMeta gmeta(handle);
+    meta = BufferMeta();
+    meta.handle = handle;
+    meta.bufferId = VendorGraphicBufferMeta::get_buffer_id(handle);
+    meta.uniqueId = gmeta.unique_id;
+    meta.format = gmeta.format;
+    meta.stride = gmeta.stride;
+    meta.vstride = gmeta.vstride;
+    meta.size = gmeta.size;
+    meta.flags = gmeta.flags;
+    meta.fd = gmeta.fd;
+    meta.fd1 = gmeta.fd1;
+    meta.fd2 = gmeta.fd2;
+    meta.producerUsage = gmeta.producer_usage;
+    meta.compressed = VendorGraphicBufferMeta::is_afbc(handle);
+}
+
+ExynosVideoMeta* ExynosLayer::getVideoMeta(BufferMeta &meta)
+{
+    if (meta.videoMeta != NULL)
+        return meta.videoMeta;
+
+    int priv_fd = -1;
+    if (meta.flags & VendorGraphicBufferMeta::PRIV_FLAGS_USES_2PRIVATE_DATA)
+        priv_fd = meta.fd1;
+    else if (meta.flags & VendorGraphicBufferMeta::PRIV_FLAGS_USES_3PRIVATE_DATA)
+        priv_fd = meta.fd2;
+
+    if (priv_fd < 0)
+        return NULL;
+
+    ExynosVideoMeta *metaData =
+        (ExynosVideoMeta*)mmap(0, sizeof(ExynosVideoMeta), PROT_READ|PROT_WRITE, MAP_SHARED, priv_fd, 0);
+    if (metaData == NULL) {
+        HWC_LOGE(mDisplay, "Layer's metadata is NULL!!");
+        return NULL;
+    } else if (metaData == MAP_FAILED) {
+        HWC_LOGE(mDisplay, "Layer's metadata map failed!!");
+        return NULL;
+    }
+
+    meta.videoMeta = metaData;
+    return metaData;
+}
+
+void ExynosLayer::clearBufferMetaCache()
+{
+    for (auto &meta : mBufferMetaCache) {
+        if (meta.videoMeta != NULL)
+            munmap(meta.videoMeta, sizeof(ExynosVideoMeta));
+        meta = BufferMeta();
+    }
+}
+
 bool ExynosLayer::isDimLayer()
 {
     if (mLayerFlag & EXYNOS_HWC_DIM_LAYER)
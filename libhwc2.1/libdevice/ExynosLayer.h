@@ -23,7 +23,10 @@
 #include <utils/Timers.h>
 
 #include <array>
+#include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "ExynosDisplay.h"
 #include "ExynosHWC.h"
@@ -36,6 +39,14 @@
 #define HWC2_HDR10_PLUS_SEI 12
 #endif
 
+/* Stable frames before a layer that fell back to client composition is assigned again */
+#ifndef COMPOSITION_HYSTERESIS_FRAMES
+#define COMPOSITION_HYSTERESIS_FRAMES 4
+#endif
+#define COMPOSITION_HYSTERESIS_MAX_FRAMES 64
+/* The hold ends at once if the scaling ratio changes by more than 1/N */
+#define COMPOSITION_HYSTERESIS_SCALE_MARGIN 8
+
 using namespace android;
 using namespace vendor::graphics;
 
@@ -114,12 +125,40 @@ class ExynosLayer : public ExynosMPPSource {
          */
         uint32_t mSupportedMPPFlag;
 
+        /**
+         * OTF MPP types rejected by TEST_ONLY commit in validateDisplay()
+         * It is excluded from mSupportedMPPFlag until the next validateDisplay()
+         */
+        uint32_t mTestFailedMPPFlag;
+
+        /**
+         * M2M MPP types that supported the layer but had no capacity left
+         * in the last resource assignment
+         */
+        uint32_t mCapacityRejectedMPPFlag;
+
         /**
          * TODO : Should be defined..
          */
         /* Key is logical type of MPP */
         std::unordered_map<uint32_t, uint64_t> mCheckMPPFlag;
 
+        /**
+         * Inputs and results of the last MPP check of updateSupportedMPPFlag(),
+         * they are used again while the inputs and the restrictions are the same
+         */
+        mpp_supported_key_t mSupportedMPPKey;
+        uint64_t mSupportedMPPGeneration;
+        uint32_t mSupportedMPPFlagCache;
+        std::unordered_map<uint32_t, uint64_t> mCheckMPPFlagCache;
+
+        /**
+         * Set when early validation preprocessed the layer after its last
+         * setter, validateDisplay() then skips doPreProcess() once.
+         * Protected by mDisplayMutex.
+         */
+        bool mEarlyValidated;
+
         /**
          * Update rate for using client composition.
          */
@@ -155,21 +194,69 @@ class ExynosLayer : public ExynosMPPSource {
          * Release fence
          */
         int32_t mReleaseFence;
+        /* Index of ExynosDisplay::mSharedReleaseFences that gives mReleaseFence, -1 if none */
+        int32_t mSharedReleaseFence;
 
         uint32_t mFrameCount;
         uint32_t mLastFrameCount;
         nsecs_t mLastFpsTime;
 
+        /**
+         * Content cadence estimation.
+         * EWMA of the interval between buffer updates, and a decaying
+         * histogram of the cadence each update lands on.
+         * mContentFps is the dominant cadence, 0 if there is none.
+         */
+        static constexpr uint32_t kCadenceFps[] = {24, 30, 48, 60, 90, 120};
+        static constexpr size_t kCadenceNum = sizeof(kCadenceFps) / sizeof(kCadenceFps[0]);
+        nsecs_t mLastBufferTime;
+        nsecs_t mBufferIntervalEwma;
+        uint32_t mCadenceHistogram[kCadenceNum];
+        uint32_t mContentFps;
+
         /**
          * Previous buffer's handle
          */
         buffer_handle_t mLastLayerBuffer;
 
+        /**
+         * Changed by every setLayerBuffer(), unique across layers.
+         * M2M outputs made from another generation are stale.
+         */
+        uint64_t mBufferGeneration;
+
         /**
          * Display buffer handle
          */
         buffer_handle_t mLayerBuffer;
 
+        /**
+         * Handle data of a buffer, parsed once while the buffer is in the cache
+         */
+        struct BufferMeta {
+            buffer_handle_t handle = NULL;
+            uint64_t bufferId = 0;
+            uint64_t uniqueId = 0;
+            int format = 0;
+            int stride = 0;
+            int vstride = 0;
+            int size = 0;
+            int flags = 0;
+            int fd = -1;
+            int fd1 = -1;
+            int fd2 = -1;
+            uint64_t producerUsage = 0;
+            bool compressed = false;
+            /* Mapped private data of video buffers, NULL until it is needed */
+            ExynosVideoMeta *videoMeta = NULL;
+        };
+        /* Enough for a triple buffered swapchain and the buffer being replaced */
+        static constexpr size_t kBufferMetaCacheSize = 4;
+        /* Most recently used first */
+        BufferMeta mBufferMetaCache[kBufferMetaCacheSize];
+        uint64_t mBufferMetaHits;
+        uint64_t mBufferMetaMisses;
+
         /**
          * Surface Damage
          */
@@ -211,6 +298,12 @@ class ExynosLayer : public ExynosMPPSource {
          */
         uint32_t mZOrder;
 
+        /**
+         * Position in ExynosDisplay::mLayers, -1 if the layer isn't there
+         * (e.g. ignored layers). Maintained by ExynosSortedLayer.
+         */
+        int32_t mIndexInDisplay;
+
         /**
          * Color
          */
@@ -222,6 +315,26 @@ class ExynosLayer : public ExynosMPPSource {
 
         pre_processed_layer_info mPreprocessedInfo;
 
+        /**
+         * Signature of the layer when resource was assigned last time.
+         * It is invalidated by resetValidateData()
+         */
+        layer_assign_signature_t mLastAssignSignature;
+
+        /**
+         * Device/client composition hysteresis.
+         * A layer that fell back to client composition because of MPP capability
+         * or capacity stays there until mClientHoldFrames stable frames passed
+         * or its scaling ratio changed by more than the margin.
+         */
+        uint32_t mClientHoldFrames;
+        uint32_t mClientHoldLength;
+        uint32_t mFramesSinceReturn;
+        uint64_t mCompositionFlipCnt;
+        int32_t mLastValidateCompositionType;
+        layer_assign_signature_t mHoldSignature;
+        layer_assign_signature_t mHoldLastSignature;
+
         /**
          * user defined flag
          */
@@ -251,6 +364,16 @@ class ExynosLayer : public ExynosMPPSource {
 
         uint32_t getFps();
 
+        void updateContentFps(nsecs_t now);
+        uint32_t getContentFps() { return mContentFps; };
+
+        /*
+         * Parsed metadata of handle, cached per buffer id.
+         * The returned entry is valid until the next call.
+         */
+        const BufferMeta* getBufferMeta(buffer_handle_t handle);
+        static void parseBufferMeta(buffer_handle_t handle, BufferMeta &meta);
+
         int32_t doPreProcess();
 
         /* setCursorPosition(..., x, y)
@@ -416,6 +539,52 @@ class ExynosLayer : public ExynosMPPSource {
                 bool __unused mandatory, uint32_t __unused valueLength, const uint8_t* __unused value);
 
         void resetValidateData();
+        layer_assign_signature_t getAssignSignature();
+        void updateAssignSignature() { mLastAssignSignature = getAssignSignature(); };
+        void updateClientHold();
+        void updateCompositionFlip();
+        bool isAssignSignatureChanged() { return getAssignSignature() != mLastAssignSignature; };
+        /**
+         * Copy of the state printed by dump(), taken at the end of a frame so
+         * that it is formatted without holding the display mutex
+         */
+        struct DumpSnapshot {
+            uint32_t zOrder;
+            overlay_priority overlayPriority;
+            int32_t compositionType;
+            hwc_color_t color;
+            buffer_handle_t layerBuffer;
+            int fd[3];
+            int format;
+            bool compressed;
+            android_dataspace dataSpace;
+            bool colorTransform;
+            int32_t blending;
+            float planeAlpha;
+            uint32_t fps;
+            uint32_t contentFps;
+            uint64_t metaHits;
+            uint64_t metaMisses;
+            hwc_frect_t sourceCrop;
+            hwc_rect_t displayFrame;
+            int32_t transform;
+            uint32_t windowIndex;
+            int32_t exynosCompositionType;
+            int32_t validateCompositionType;
+            uint32_t overlayInfo;
+            uint32_t supportedMPPFlag;
+            uint64_t compositionFlipCnt;
+            uint32_t clientHoldFrames;
+            /* MPP names are valid as long as the resource manager */
+            std::vector<std::pair<const char*, uint64_t>> otfMPPFlags;
+            std::vector<std::pair<const char*, uint64_t>> m2mMPPFlags;
+            int32_t acquireFence;
+            const char *otfMPP;
+            const char *m2mMPP;
+            exynos_image midImg;
+        };
+        void takeDumpSnapshot(DumpSnapshot &snapshot);
+        static void dump(const DumpSnapshot &snapshot, String8& result);
         virtual void dump(String8& result);
         void printLayer();
         int32_t setSrcExynosImage(exynos_image *src_img);
@@ -438,10 +607,48 @@ class ExynosLayer : public ExynosMPPSource {
         void clearGeometryChanged() {mGeometryChanged = 0;};
         bool isDimLayer();
         const ExynosVideoMeta* getMetaParcel() { return mMetaParcel; };
+        /*
+         * Hash of the data that programs the DPP color pipeline of the
+         * layer (dataspace, color transform and HDR metadata)
+         */
+        size_t getColorDataHash() const;
 
     private:
         ExynosVideoMeta *mMetaParcel;
+        /*
+         * Copy of mMetaParcel handed to exynos_image, replaced by
+         * publishMetaParcel() whenever mMetaParcel is modified
+         */
+        std::shared_ptr<const ExynosVideoMeta> mMetaParcelRef;
+        /* Hash of the HDR part of mMetaParcelRef */
+        size_t mMetaParcelHash = 0;
+        /*
+         * Last input of setLayerPerFrameMetadata(Blobs), SurfaceFlinger
+         * sends the same metadata every frame
+         */
+        struct PerFrameMetadataInput {
+            std::vector<int32_t> keys;
+            std::vector<float> values;
+            std::vector<uint32_t> sizes;
+            std::vector<uint8_t> blobs;
+            void clear() {
+                keys.clear();
+                values.clear();
+                sizes.clear();
+                blobs.clear();
+            }
+        };
+        PerFrameMetadataInput mPerFrameMetadata;
+        PerFrameMetadataInput mPerFrameMetadataBlobs;
         int allocMetaParcel();
+        void publishMetaParcel();
+        int32_t convertPerFrameMetadata(uint32_t numElements, const int32_t* keys,
+                const float* metadata);
+        int32_t convertPerFrameMetadataBlobs(uint32_t numElements, const int32_t* keys,
+                const uint32_t* sizes, const uint8_t* metadata);
+        BufferMeta* lookupBufferMeta(buffer_handle_t handle);
+        ExynosVideoMeta* getVideoMeta(BufferMeta &meta);
+        void clearBufferMetaCache();
 };
 
 #endif //_EXYNOSLAYER_H
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <cutils/properties.h>
 #include <drm/drm_mode.h>
 #include "ExynosDeviceDrmInterface.h"
 #include "ExynosDisplayDrmInterface.h"
@@ -84,6 +85,10 @@ void ExynosDeviceDrmInterface::init(ExynosDevice *exynosDevice)
 
     updateRestrictions();
 
+    /* Displays with DisplayControl::asyncCommit share one atomic commit per present round */
+    mCommitCoordinator.init(mDrmDevice,
+            property_get_bool("vendor.display.combined_commit", false));
+
     mExynosDrmEventHandler.init(mExynosDevice, mDrmDevice);
     mDrmDevice->event_listener()->RegisterHotplugHandler(static_cast<DrmEventHandler *>(&mExynosDrmEventHandler));
     mDrmDevice->event_listener()->RegisterTUIHandler(static_cast<DrmTUIEventHandler *>(&mExynosDrmEventHandler));
@@ -99,9 +104,22 @@ int32_t ExynosDeviceDrmInterface::initDisplayInterface(
 {
     ExynosDisplayDrmInterface *displayInterface =
         static_cast<ExynosDisplayDrmInterface*>(dispInterface.get());
+    mCommitCoordinator.registerDisplay(displayInterface);
     return displayInterface->initDrmDevice(mDrmDevice);
 }
 
+void ExynosDeviceDrmInterface::dump(String8 &result)
+{
+    if (mDrmDevice == NULL)
+        return;
+    result.appendFormat("DrmDevice init time: %" PRId64 " us\n",
+            ns2us(mDrmDevice->init_time_ns()));
+    mCommitCoordinator.dump(result);
+    std::string workers;
+    mDrmDevice->event_listener()->DumpWakeupStats(workers);
+    result.appendFormat("Worker wakeups:\n%s", workers.c_str());
+}
+
 void ExynosDeviceDrmInterface::updateRestrictions()
 {
     int32_t ret = 0;
@@ -126,6 +144,15 @@ void ExynosDeviceDrmInterface::updateRestrictions()
             res = (struct dpp_ch_restriction *)blob->data;
             set_dpp_ch_restriction(mDPUInfo.dpuInfo.dpp_chs[channelId], *res);
             drmModeFreePropertyBlob(blob);
+
+            /* Compressed formats the plane doesn't take in any modifier aren't supported */
+            if (plane->has_in_formats()) {
+                auto &attr = mDPUInfo.dpuInfo.dpp_chs[channelId].attr;
+                if (!plane->supports_modifier_class(DrmPlane::MODIFIER_AFBC))
+                    attr &= ~(1UL << DPP_ATTR_AFBC);
+                if (!plane->supports_modifier_class(DrmPlane::MODIFIER_SAMSUNG))
+                    attr &= ~(1UL << DPP_ATTR_SBWC);
+            }
         } else {
             ALOGI("plane[%d] There is no hw restriction information", channelId);
             ret = HWC2_ERROR_UNSUPPORTED;
@@ -240,8 +267,14 @@ void ExynosDeviceDrmInterface::ExynosDrmEventHandler::HandleTUIEvent()
     } else {
         /* Received TUI Exit event */
         if (mExynosDevice->isInTUI()) {
-            mExynosDevice->invalidate();
+            /* The kernel state was changed by TUI */
+            ExynosDisplayDrmInterface::clearCommittedProperties();
+            /*
+             * Leave TUI before the refresh, the frame requested by it
+             * re-commits the assignment kept during TUI in one commit.
+             */
             mExynosDevice->exitFromTUI();
+            mExynosDevice->invalidate();
             ALOGV("%s:: DRM device out TUI", __func__);
         }
     }
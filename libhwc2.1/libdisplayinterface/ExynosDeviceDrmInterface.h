@@ -19,6 +19,7 @@
 
 #include "resourcemanager.h"
 #include "ExynosDeviceInterface.h"
+#include "ExynosDisplayDrmInterface.h"
 
 using namespace android;
 
@@ -31,6 +32,7 @@ class ExynosDeviceDrmInterface : public ExynosDeviceInterface {
         virtual int32_t initDisplayInterface(
                 std::unique_ptr<ExynosDisplayInterface> &dispInterface) override;
         virtual void updateRestrictions() override;
+        virtual void dump(String8 &result) override;
     protected:
         class ExynosDrmEventHandler: public DrmEventHandler, public DrmTUIEventHandler {
             public:
@@ -42,8 +44,9 @@ class ExynosDeviceDrmInterface : public ExynosDeviceInterface {
 		DrmDevice *mDrmDevice;
         };
         ResourceManager mDrmResourceManager;
-        DrmDevice *mDrmDevice;
+        DrmDevice *mDrmDevice = NULL;
         ExynosDrmEventHandler mExynosDrmEventHandler;
+        DrmCommitCoordinator mCommitCoordinator;
 };
 
 #endif //_EXYNOSDEVICEDRMINTERFACE_H
@@ -84,6 +84,7 @@ class ExynosDeviceInterface {
         /* Fill mDPUInfo according to interface type */
         virtual void updateRestrictions() = 0;
         virtual bool getUseQuery() { return mUseQuery; };
+        virtual void dump(String8 __unused &result) {};
         ExynosDevice* getExynosDevice() {return mExynosDevice;};
     protected:
         /* Make dpu restrictions using mDPUInfo */
@@ -21,14 +21,22 @@
 #include <cutils/properties.h>
 #include <drm.h>
 #include <drm/drm_fourcc.h>
+#include <fcntl.h>
+#include <sync/sync.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <xf86drm.h>
 
 #include <algorithm>
 #include <numeric>
+#include <string_view>
 
 #include "ExynosHWCDebug.h"
+#include "ExynosHWCTrace.h"
 #include "ExynosHWCHelper.h"
+#include "ExynosLayer.h"
 
 using namespace std::chrono_literals;
 
@@ -53,6 +61,16 @@ struct _drmModeAtomicReq {
     drmModeAtomicReqItemPtr items;
 };
 
+/* sw_sync interface of the kernel, it is not exported as uapi */
+struct sw_sync_create_fence_data {
+    uint32_t value;
+    char name[32];
+    int32_t fence;
+};
+#define SW_SYNC_IOC_MAGIC 'W'
+#define SW_SYNC_IOC_CREATE_FENCE _IOWR(SW_SYNC_IOC_MAGIC, 0, struct sw_sync_create_fence_data)
+#define SW_SYNC_IOC_INC _IOW(SW_SYNC_IOC_MAGIC, 1, uint32_t)
+
 using namespace vendor::graphics;
 
 extern struct exynos_hwc_control exynosHWCControl;
@@ -71,22 +89,63 @@ FramebufferManager::~FramebufferManager()
 void FramebufferManager::init(int drmFd)
 {
     mDrmFd = drmFd;
+    mMaxSecureBuffers = property_get_int32("vendor.display.secure_fb_cache_size",
+                                           kDefaultMaxSecureBuffers);
     mRmFBThreadRunning = true;
     mRmFBThread = std::thread(&FramebufferManager::removeFBsThreadRoutine, this);
     pthread_setname_np(mRmFBThread.native_handle(), "RemoveFBsThread");
 }
 
-uint32_t FramebufferManager::getBufHandleFromFd(int fd)
+Mutex FramebufferManager::sBufHandleMutex;
+std::unordered_map<FramebufferManager::BufHandleKey, FramebufferManager::BufHandleRef,
+                   FramebufferManager::BufHandleKeyHash>
+        FramebufferManager::sBufHandles;
+
+// Returns a GEM handle of the dma-buf and takes a reference of it. inode is
+// set to 0 if the handle is not cached, then the caller should release the
+// handle with putBufHandle() as well.
+uint32_t FramebufferManager::getBufHandleFromFd(int fd, ino_t &inode)
 {
     uint32_t gem_handle = 0;
+    struct stat st;
+
+    inode = 0;
+    if (fstat(fd, &st) == 0) inode = st.st_ino;
+
+    Mutex::Autolock lock(sBufHandleMutex);
+    if (inode != 0) {
+        if (auto it = sBufHandles.find({mDrmFd, inode}); it != sBufHandles.end()) {
+            it->second.refCount++;
+            return it->second.handle;
+        }
+    }
 
     int ret = drmPrimeFDToHandle(mDrmFd, fd, &gem_handle);
     if (ret) {
         ALOGE("drmPrimeFDToHandle failed with fd %d error %d (%s)", fd, ret, strerror(errno));
+        inode = 0;
+        return 0;
     }
+
+    if (inode != 0) sBufHandles[{mDrmFd, inode}] = {gem_handle, 1};
     return gem_handle;
 }
 
+void FramebufferManager::putBufHandle(int drmFd, ino_t inode, uint32_t handle)
+{
+    if (handle == 0) return;
+
+    Mutex::Autolock lock(sBufHandleMutex);
+    if (inode != 0) {
+        auto it = sBufHandles.find({drmFd, inode});
+        if ((it != sBufHandles.end()) && (it->second.handle == handle)) {
+            if (--it->second.refCount > 0) return;
+            sBufHandles.erase(it);
+        }
+    }
+    freeBufHandle(drmFd, handle);
+}
+
 int FramebufferManager::addFB2WithModifiers(uint32_t width, uint32_t height, uint32_t pixel_format,
                                             const BufHandles handles, const uint32_t pitches[4],
                                             const uint32_t offsets[4], const uint64_t modifier[4],
@@ -111,13 +170,66 @@ void FramebufferManager::cleanup(const ExynosLayer *layer) {
 
     Mutex::Autolock lock(mMutex);
     if (auto it = mCachedLayerBuffers.find(layer); it != mCachedLayerBuffers.end()) {
-        mCleanBuffers.splice(mCleanBuffers.end(), std::move(it->second));
+        mCleanBuffers.splice(mCleanBuffers.end(), std::move(it->second.buffers));
         mCachedLayerBuffers.erase(it);
     }
 }
 
+uint32_t FramebufferManager::findCachedFbId(const ExynosLayer *layer,
+                                            const Framebuffer::BufferDesc &desc) {
+    Mutex::Autolock lock(mMutex);
+    auto &cache = markInuseLayerLocked(layer);
+    if (const auto it = cache.bufferIndex.find(desc); it != cache.bufferIndex.end()) {
+        cache.buffers.splice(cache.buffers.begin(), cache.buffers, it->second);
+        return (*it->second)->fbId;
+    }
+
+    // The buffer could be registered already by another layer
+    const auto it = mSharedBuffers.find(desc);
+    if (it == mSharedBuffers.end()) return 0;
+
+    auto buffer = it->second.lock();
+    if (buffer == nullptr) {
+        mSharedBuffers.erase(it);
+        return 0;
+    }
+
+    uint32_t fbId = buffer->fbId;
+    addCachedBufferLocked(cache, std::move(buffer));
+    return fbId;
+}
+
+void FramebufferManager::addCachedBufferLocked(LayerFBCache &cache,
+                                               std::shared_ptr<Framebuffer> buffer) {
+    auto &cachedBuffers = cache.buffers;
+    // evict the least recently used framebuffer instead of the whole list
+    if (cachedBuffers.size() >= MAX_CACHED_BUFFERS_PER_LAYER) {
+        auto lru = std::prev(cachedBuffers.end());
+        if (!(*lru)->isSolidColor) cache.bufferIndex.erase((*lru)->bufferDesc);
+        mCleanBuffers.splice(mCleanBuffers.end(), cachedBuffers, lru);
+    }
+
+    cachedBuffers.push_front(std::move(buffer));
+    if (!cachedBuffers.front()->isSolidColor) {
+        cache.bufferIndex[cachedBuffers.front()->bufferDesc] = cachedBuffers.begin();
+        mSharedBuffers[cachedBuffers.front()->bufferDesc] = cachedBuffers.front();
+    }
+}
+
+void FramebufferManager::pruneSharedBuffersLocked() {
+    if (mSharedBuffers.size() <= MAX_CACHED_LAYERS * MAX_CACHED_BUFFERS_PER_LAYER) return;
+
+    for (auto it = mSharedBuffers.begin(); it != mSharedBuffers.end();) {
+        if (it->second.expired())
+            it = mSharedBuffers.erase(it);
+        else
+            ++it;
+    }
+}
+
 void FramebufferManager::removeFBsThreadRoutine()
 {
+    ApplyThreadPolicy(ThreadRole::CLEANUP);
     FBList cleanupBuffers;
     while (true) {
         {
@@ -135,6 +247,7 @@ void FramebufferManager::removeFBsThreadRoutine()
 
 int32_t FramebufferManager::getBuffer(const exynos_win_config_data &config, uint32_t &fbId) {
     ATRACE_CALL();
+    HWC_TRACE_FUNC(eHwcTraceFbCache);
     int ret = NO_ERROR;
     int drmFormat = DRM_FORMAT_UNDEFINED;
     uint32_t bpp = 0;
@@ -143,11 +256,12 @@ int32_t FramebufferManager::getBuffer(const exynos_win_config_data &config, uint
     uint64_t modifiers[HWC_DRM_BO_MAX_PLANES] = {0};
     uint32_t bufferNum, planeNum = 0;
     BufHandles handles = {0};
+    std::array<ino_t, HWC_DRM_BO_MAX_PLANES> handleInodes = {0};
     uint32_t bufWidth, bufHeight = 0;
 
     if (config.protection) modifiers[0] |= DRM_FORMAT_MOD_PROTECTION;
 
-    if (config.state == config.WIN_STATE_BUFFER) {
+    if ((config.state == config.WIN_STATE_BUFFER) || (config.state == config.WIN_STATE_CURSOR)) {
         bufWidth = config.src.f_w;
         bufHeight = config.src.f_h;
         uint32_t compressType = 0;
@@ -179,10 +293,13 @@ int32_t FramebufferManager::getBuffer(const exynos_win_config_data &config, uint
             return -EINVAL;
         }
 
-        fbId = findCachedFbId(config.layer,
-                              [bufferDesc = Framebuffer::BufferDesc{config.buffer_id, drmFormat}](
-                                      auto &buffer) { return buffer->bufferDesc == bufferDesc; });
+        fbId = findCachedFbId(config.layer, Framebuffer::BufferDesc{config.buffer_id, drmFormat});
         if (fbId != 0) {
+            if (config.protection && !isFramebuffer(config.layer)) {
+                Mutex::Autolock lock(mMutex);
+                touchSecureBufferLocked(fbId);
+            }
+            updateLastClientTarget(config);
             return NO_ERROR;
         }
 
@@ -212,8 +329,11 @@ int32_t FramebufferManager::getBuffer(const exynos_win_config_data &config, uint
         for (uint32_t bufferIndex = 0; bufferIndex < bufferNum; bufferIndex++) {
             pitches[bufferIndex] = config.src.f_w * bpp;
             modifiers[bufferIndex] = modifiers[0];
-            handles[bufferIndex] = getBufHandleFromFd(config.fd_idma[bufferIndex]);
+            handles[bufferIndex] =
+                    getBufHandleFromFd(config.fd_idma[bufferIndex], handleInodes[bufferIndex]);
             if (handles[bufferIndex] == 0) {
+                for (uint32_t i = 0; i < bufferIndex; i++)
+                    putBufHandle(mDrmFd, handleInodes[i], handles[i]);
                 return -ENOMEM;
             }
         }
@@ -239,7 +359,9 @@ int32_t FramebufferManager::getBuffer(const exynos_win_config_data &config, uint
         pitches[0] = config.dst.w * bpp;
         fbId = findCachedFbId(config.layer,
                               [colorDesc = Framebuffer::SolidColorDesc{bufWidth, bufHeight}](
-                                      auto &buffer) { return buffer->colorDesc == colorDesc; });
+                                      auto &buffer) {
+                                  return buffer->isSolidColor && buffer->colorDesc == colorDesc;
+                              });
         if (fbId != 0) {
             return NO_ERROR;
         }
@@ -251,11 +373,11 @@ int32_t FramebufferManager::getBuffer(const exynos_win_config_data &config, uint
     ret = addFB2WithModifiers(bufWidth, bufHeight, drmFormat, handles, pitches, offsets, modifiers,
                               &fbId, modifiers[0] ? DRM_MODE_FB_MODIFIERS : 0);
 
-    for (uint32_t bufferIndex = 0; bufferIndex < bufferNum; bufferIndex++) {
-        freeBufHandle(handles[bufferIndex]);
-    }
-
     if (ret) {
+        for (uint32_t bufferIndex = 0; bufferIndex < bufferNum; bufferIndex++) {
+            putBufHandle(mDrmFd, handleInodes[bufferIndex], handles[bufferIndex]);
+        }
+
         ALOGE("%s:: Failed to add FB, fb_id(%d), ret(%d), f_w: %d, f_h: %d, dst.w: %d, dst.h: %d, "
               "format: %d %4.4s, buf_handles[%d, %d, %d, %d], "
               "pitches[%d, %d, %d, %d], offsets[%d, %d, %d, %d], modifiers[%#" PRIx64 ", %#" PRIx64
@@ -267,38 +389,107 @@ int32_t FramebufferManager::getBuffer(const exynos_win_config_data &config, uint
         return ret;
     }
 
+    bool needPreRegister = false;
     if (config.layer || config.buffer_id) {
         Mutex::Autolock lock(mMutex);
-        auto &cachedBuffers = mCachedLayerBuffers[config.layer];
-        if (cachedBuffers.size() > MAX_CACHED_BUFFERS_PER_LAYER) {
-            ALOGW("FBManager: cached buffers size %zu exceeds limitation while adding fbId %d",
-                  cachedBuffers.size(), fbId);
-            printExynosLayer(config.layer);
-            mCleanBuffers.splice(mCleanBuffers.end(), cachedBuffers);
-        }
+        auto &cache = mCachedLayerBuffers[config.layer];
 
         if (config.state == config.WIN_STATE_COLOR) {
-            cachedBuffers.emplace_front(
-                    new Framebuffer(mDrmFd, fbId,
-                                    Framebuffer::SolidColorDesc{bufWidth, bufHeight}));
+            addCachedBufferLocked(cache,
+                                  std::make_shared<Framebuffer>(mDrmFd, fbId,
+                                                                Framebuffer::SolidColorDesc{
+                                                                        bufWidth, bufHeight}));
         } else {
-            cachedBuffers.emplace_front(
-                    new Framebuffer(mDrmFd, fbId,
-                                    Framebuffer::BufferDesc{config.buffer_id, drmFormat}));
+            auto framebuffer =
+                    std::make_shared<Framebuffer>(mDrmFd, fbId,
+                                                  Framebuffer::BufferDesc{config.buffer_id,
+                                                                          drmFormat});
+            framebuffer->handleNum = bufferNum;
+            framebuffer->handles = handles;
+            framebuffer->handleInodes = handleInodes;
+            if (config.protection && !isFramebuffer(config.layer)) {
+                /* The first protected buffer of the layer, register its queue */
+                needPreRegister = cache.buffers.empty();
+                addSecureBufferLocked(framebuffer);
+            }
+            addCachedBufferLocked(cache, std::move(framebuffer));
             mHasSecureFramebuffer |= (isFramebuffer(config.layer) && config.protection);
         }
     } else {
         ALOGW("FBManager: possible leakage fbId %d was created", fbId);
+        for (uint32_t bufferIndex = 0; bufferIndex < bufferNum; bufferIndex++) {
+            putBufHandle(mDrmFd, handleInodes[bufferIndex], handles[bufferIndex]);
+        }
     }
+    updateLastClientTarget(config);
+    if (needPreRegister)
+        preRegisterSecureBuffers(config);
 
     return 0;
 }
 
+void FramebufferManager::addSecureBufferLocked(const std::shared_ptr<Framebuffer> &buffer) {
+    if (mMaxSecureBuffers == 0) return;
+
+    if (mSecureBuffers.size() >= mMaxSecureBuffers)
+        mCleanBuffers.splice(mCleanBuffers.end(), mSecureBuffers, std::prev(mSecureBuffers.end()));
+    mSecureBuffers.push_front(buffer);
+}
+
+void FramebufferManager::touchSecureBufferLocked(uint32_t fbId) {
+    auto it = std::find_if(mSecureBuffers.begin(), mSecureBuffers.end(),
+                           [fbId](const auto &buffer) { return buffer->fbId == fbId; });
+    if (it != mSecureBuffers.end())
+        mSecureBuffers.splice(mSecureBuffers.begin(), mSecureBuffers, it);
+}
+
+// HWC2 doesn't see the buffer queue of the decoder, the buffers the layer has
+// presented so far (ExynosLayer::mBufferMetaCache) are the known part of it.
+void FramebufferManager::preRegisterSecureBuffers(const exynos_win_config_data &config) {
+    ATRACE_CALL();
+    for (auto &meta : config.layer->mBufferMetaCache) {
+        if ((meta.handle == NULL) || (meta.uniqueId == config.buffer_id) ||
+            (meta.format != config.format) ||
+            (getDrmMode(meta.producerUsage) != SECURE_DRM))
+            continue;
+
+        exynos_win_config_data bufferConfig = config;
+        bufferConfig.buffer_id = meta.uniqueId;
+        bufferConfig.fd_idma[0] = meta.fd;
+        bufferConfig.fd_idma[1] = meta.fd1;
+        bufferConfig.fd_idma[2] = meta.fd2;
+        uint32_t fbId = 0;
+        if (getBuffer(bufferConfig, fbId) != NO_ERROR) {
+            ALOGW("%s:: Failed to pre-register buffer(%" PRIu64 ")", __func__, meta.uniqueId);
+            break;
+        }
+    }
+}
+
+void FramebufferManager::updateLastClientTarget(const exynos_win_config_data &config) {
+    if (!isFramebuffer(config.layer) || (config.state != config.WIN_STATE_BUFFER)) return;
+
+    Mutex::Autolock lock(mMutex);
+    /* the framebuffer just found or added is the most recently used one */
+    auto &cachedBuffers = mCachedLayerBuffers[config.layer].buffers;
+    if (!cachedBuffers.empty()) mLastClientTarget = cachedBuffers.front();
+}
+
+uint32_t FramebufferManager::getLastClientTargetFbId(uint64_t bufferId) {
+    Mutex::Autolock lock(mMutex);
+    if ((mLastClientTarget == nullptr) || (mLastClientTarget->bufferDesc.bufferId != bufferId))
+        return 0;
+    markInuseLayerLocked(nullptr);
+    return mLastClientTarget->fbId;
+}
+
 void FramebufferManager::flip(bool hasSecureFrameBuffer) {
     bool needCleanup = false;
     {
         Mutex::Autolock lock(mMutex);
+        mFlipCount++;
         destroyUnusedLayersLocked();
+        pruneSharedBuffersLocked();
         if (!hasSecureFrameBuffer) {
             destroyFramebufferLocked();
         }
@@ -310,14 +501,69 @@ void FramebufferManager::flip(bool hasSecureFrameBuffer) {
     }
 }
 
-void FramebufferManager::releaseAll()
+void FramebufferManager::releaseAll(bool underPressure)
 {
     Mutex::Autolock lock(mMutex);
+    if (underPressure)
+        mEvictCounts[EVICT_RELEASE_ALL]++;
     mCachedLayerBuffers.clear();
     mCleanBuffers.clear();
+    mSharedBuffers.clear();
+    mSecureBuffers.clear();
+    mLastClientTarget.reset();
 }
 
-void FramebufferManager::freeBufHandle(uint32_t handle) {
+// The evicted framebuffers are not on screen and not in a queued commit:
+// those frames marked their layers with the current mFlipCount and use the
+// newest buffers of each layer. They are removed here rather than by
+// mRmFBThread, the retry needs the memory back.
+size_t FramebufferManager::evictUnderPressure(size_t keepBuffers)
+{
+    ATRACE_CALL();
+    FBList evicted;
+    size_t freed = 0;
+    {
+        Mutex::Autolock lock(mMutex);
+        for (auto layer = mCachedLayerBuffers.begin(); layer != mCachedLayerBuffers.end();) {
+            auto &cache = layer->second;
+            size_t evictedNum = evicted.size();
+            if (cache.lastUsedFlip + kColdLayerFrames <= mFlipCount) {
+                evicted.splice(evicted.end(), std::move(cache.buffers));
+                mEvictCounts[EVICT_COLD_LAYER] += evicted.size() - evictedNum;
+                layer = mCachedLayerBuffers.erase(layer);
+                continue;
+            }
+            while (cache.buffers.size() > keepBuffers) {
+                auto lru = std::prev(cache.buffers.end());
+                if (!(*lru)->isSolidColor) cache.bufferIndex.erase((*lru)->bufferDesc);
+                evicted.splice(evicted.end(), cache.buffers, lru);
+            }
+            mEvictCounts[EVICT_OUTSIDE_WINDOW] += evicted.size() - evictedNum;
+            ++layer;
+        }
+        /* mSecureBuffers and mLastClientTarget keep theirs */
+        for (auto &buffer : evicted) {
+            if (buffer.use_count() == 1) freed++;
+        }
+    }
+
+    ALOGW("FBManager: evicted %zu framebuffers under memory pressure, %zu freed",
+          evicted.size(), freed);
+    evicted.clear();
+
+    return freed;
+}
+
+void FramebufferManager::dump(String8 &result)
+{
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("FBManager: cached layers(%zu), evictions cold layer(%" PRIu64
+                        "), outside window(%" PRIu64 "), release all(%" PRIu64 ")\n",
+                        mCachedLayerBuffers.size(), mEvictCounts[EVICT_COLD_LAYER],
+                        mEvictCounts[EVICT_OUTSIDE_WINDOW], mEvictCounts[EVICT_RELEASE_ALL]);
+}
+
+void FramebufferManager::freeBufHandle(int drmFd, uint32_t handle) {
     if (handle == 0) {
         return;
     }
@@ -325,16 +571,20 @@ void FramebufferManager::freeBufHandle(uint32_t handle) {
     struct drm_gem_close gem_close {
         .handle = handle
     };
-    int ret = drmIoctl(mDrmFd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+    int ret = drmIoctl(drmFd, DRM_IOCTL_GEM_CLOSE, &gem_close);
     if (ret) {
         ALOGE("Failed to close gem handle 0x%x with error %d\n", handle, ret);
     }
 }
 
-void FramebufferManager::markInuseLayerLocked(const ExynosLayer *layer) {
+FramebufferManager::LayerFBCache &FramebufferManager::markInuseLayerLocked(
+        const ExynosLayer *layer) {
     if (mCacheShrinkPending) {
         mCachedLayersInuse.insert(layer);
     }
+    auto &cache = mCachedLayerBuffers[layer];
+    cache.lastUsedFlip = mFlipCount;
+    return cache;
 }
 
 void FramebufferManager::destroyUnusedLayersLocked() {
@@ -348,7 +598,7 @@ void FramebufferManager::destroyUnusedLayersLocked() {
 
     for (auto layer = mCachedLayerBuffers.begin(); layer != mCachedLayerBuffers.end();) {
         if (mCachedLayersInuse.find(layer->first) == mCachedLayersInuse.end()) {
-            mCleanBuffers.splice(mCleanBuffers.end(), std::move(layer->second));
+            mCleanBuffers.splice(mCleanBuffers.end(), std::move(layer->second.buffers));
             layer = mCachedLayerBuffers.erase(layer);
         } else {
             ++layer;
@@ -367,7 +617,9 @@ void FramebufferManager::destroyFramebufferLocked() {
 
     for (auto &layer : mCachedLayerBuffers) {
         if (isFramebuffer(layer.first)) {
-            mCleanBuffers.splice(mCleanBuffers.end(), std::move(layer.second));
+            mCleanBuffers.splice(mCleanBuffers.end(), std::move(layer.second.buffers));
+            layer.second.bufferIndex.clear();
+            mLastClientTarget.reset();
             return;
         }
     }
@@ -385,16 +637,30 @@ ExynosDisplayDrmInterface::ExynosDisplayDrmInterface(ExynosDisplay *exynosDispla
 
 ExynosDisplayDrmInterface::~ExynosDisplayDrmInterface()
 {
-    if (mActiveModeState.blob_id)
-        mDrmDevice->DestroyPropertyBlob(mActiveModeState.blob_id);
-    if (mActiveModeState.old_blob_id)
-        mDrmDevice->DestroyPropertyBlob(mActiveModeState.old_blob_id);
-    if (mDesiredModeState.blob_id)
-        mDrmDevice->DestroyPropertyBlob(mDesiredModeState.blob_id);
-    if (mDesiredModeState.old_blob_id)
-        mDrmDevice->DestroyPropertyBlob(mDesiredModeState.old_blob_id);
+    for (uint32_t blobId : {mActiveModeState.blob_id, mActiveModeState.old_blob_id,
+            mDesiredModeState.blob_id, mDesiredModeState.old_blob_id}) {
+        if (blobId && !isCachedModeBlob(blobId))
+            mDrmDevice->DestroyPropertyBlob(blobId);
+    }
+    for (auto &modeBlob : mModeBlobs)
+        mDrmDevice->DestroyPropertyBlob(modeBlob.second);
+    for (auto &colorBlob : mColorBlobs)
+        mDrmDevice->DestroyPropertyBlob(colorBlob.blobId);
     if (mPartialRegionState.blob_id)
         mDrmDevice->DestroyPropertyBlob(mPartialRegionState.blob_id);
+
+    if (mCommitThreadRunning) {
+        {
+            Mutex::Autolock lock(mCommitMutex);
+            mCommitThreadRunning = false;
+        }
+        mCommitQueued.signal();
+        mCommitThread.join();
+    }
+    if (mCommitTimeline >= 0)
+        close(mCommitTimeline);
+    if (mCommitCoordinator != nullptr)
+        mCommitCoordinator->unregisterDisplay(this);
 }
 
 void ExynosDisplayDrmInterface::init(ExynosDisplay *exynosDisplay)
@@ -407,16 +673,17 @@ void ExynosDisplayDrmInterface::init(ExynosDisplay *exynosDisplay)
 
 void ExynosDisplayDrmInterface::parseEnums(const DrmProperty &property,
         const std::vector<std::pair<uint32_t, const char *>> &enums,
-        std::unordered_map<uint32_t, uint64_t> &out_enums)
+        DrmPropertyMap &out_enums)
 {
     uint64_t value;
     int ret;
     for (auto &e : enums) {
         std::tie(value, ret) = property.GetEnumValueWithName(e.second);
-        if (ret == NO_ERROR)
-            out_enums[e.first] = value;
-        else
+        if (ret != NO_ERROR)
             ALOGE("Fail to find enum value with name %s", e.second);
+        else if (!out_enums.set(e.first, value))
+            ALOGE("Fail to add enum %s, hal value(0x%x) is out of table range",
+                    e.second, e.first);
     }
 }
 
@@ -499,6 +766,46 @@ void ExynosDisplayDrmInterface::parseRangeEnums(const DrmProperty &property)
     }
 }
 
+void ExynosDisplayDrmInterface::buildDataspaceEnums()
+{
+    const size_t numStandard = mStandardEnums.tableSize();
+    const size_t numTransfer = mTransferEnums.tableSize();
+    const size_t numRange = mRangeEnums.tableSize();
+
+    mDataspaceEnums.assign(numStandard * numTransfer * numRange, DataspaceEnums());
+    for (auto &s : mStandardEnums) {
+        for (auto &t : mTransferEnums) {
+            for (auto &r : mRangeEnums) {
+                size_t idx = (mStandardEnums.index(s.first) * numTransfer +
+                              mTransferEnums.index(t.first)) * numRange +
+                        mRangeEnums.index(r.first);
+                mDataspaceEnums[idx] = {true, s.second, t.second, r.second};
+            }
+        }
+    }
+}
+
+int32_t ExynosDisplayDrmInterface::dataspaceToDrmEnums(const int32_t dataspace,
+        uint64_t &standard, uint64_t &transfer, uint64_t &range) const
+{
+    const uint32_t s = mStandardEnums.index(dataspace & HAL_DATASPACE_STANDARD_MASK);
+    const uint32_t t = mTransferEnums.index(dataspace & HAL_DATASPACE_TRANSFER_MASK);
+    const uint32_t r = mRangeEnums.index(dataspace & HAL_DATASPACE_RANGE_MASK);
+    const size_t numTransfer = mTransferEnums.tableSize();
+    const size_t numRange = mRangeEnums.tableSize();
+
+    if ((t < numTransfer) && (r < numRange)) {
+        size_t idx = (s * numTransfer + t) * numRange + r;
+        if ((idx < mDataspaceEnums.size()) && mDataspaceEnums[idx].valid) {
+            standard = mDataspaceEnums[idx].standard;
+            transfer = mDataspaceEnums[idx].transfer;
+            range = mDataspaceEnums[idx].range;
+            return NO_ERROR;
+        }
+    }
+    return -EINVAL;
+}
+
 void ExynosDisplayDrmInterface::parseColorModeEnums(const DrmProperty &property)
 {
     const std::vector<std::pair<uint32_t, const char *>> colorModeEnums = {
@@ -591,6 +898,7 @@ int32_t ExynosDisplayDrmInterface::initDrmDevice(DrmDevice *drmDevice)
         parseStandardEnums(plane->standard_property());
         parseTransferEnums(plane->transfer_property());
         parseRangeEnums(plane->range_property());
+        buildDataspaceEnums();
     }
 
     chosePreferredConfig();
@@ -606,11 +914,13 @@ int32_t ExynosDisplayDrmInterface::initDrmDevice(DrmDevice *drmDevice)
 void ExynosDisplayDrmInterface::Callback(
         int display, int64_t timestamp)
 {
-    Mutex::Autolock lock(mExynosDisplay->getDisplayMutex());
+    TimedMutex::Autolock lock(mExynosDisplay->getDisplayMutex());
     bool configApplied = mVsyncCallback.Callback(display, timestamp);
 
     if (configApplied) {
         if (mVsyncCallback.getDesiredVsyncPeriod()) {
+            /* The period is measured from the previous vsync, which was the first one */
+            learnConfigSwitchDuration(timestamp - mVsyncCallback.getVsyncPeriod());
             mExynosDisplay->resetConfigRequestStateLocked();
             mDrmConnector->set_active_mode(mActiveModeState.mode);
             mVsyncCallback.resetDesiredVsyncPeriod();
@@ -729,6 +1039,12 @@ int32_t ExynosDisplayDrmInterface::setPowerMode(int32_t mode)
         dpms_value = DRM_MODE_DPMS_ON;
     }
 
+    waitForPendingCommit();
+    updateCursorPlane({});
+
+    /* Planes and crtc could be reset by the kernel while power mode is changed */
+    clearCommittedProperties();
+
     const DrmProperty &prop = mDrmConnector->dpms_property();
     if ((ret = drmModeConnectorSetProperty(mDrmDevice->fd(), mDrmConnector->id(), prop.id(),
             dpms_value)) != NO_ERROR) {
@@ -786,6 +1102,21 @@ int32_t ExynosDisplayDrmInterface::chosePreferredConfig()
     return err;
 }
 
+int32_t ExynosDisplayDrmInterface::preparePreferredConfig()
+{
+    uint32_t num_configs = 0;
+    int32_t err = getDisplayConfigs(&num_configs, NULL);
+    if (err != HWC2_ERROR_NONE || !num_configs)
+        return err;
+
+    const DrmMode *mode = mDrmConnector->FindMode(mDrmConnector->get_preferred_mode_id());
+    if (mode == nullptr)
+        return NO_ERROR;
+    /* The blob is kept in mModeBlobs for the first setActiveConfig() */
+    uint32_t modeBlob = 0;
+    return createModeBlob(*mode, modeBlob);
+}
+
 int32_t ExynosDisplayDrmInterface::getDisplayConfigs(
         uint32_t* outNumConfigs,
         hwc2_config_t* outConfigs)
@@ -801,60 +1132,76 @@ int32_t ExynosDisplayDrmInterface::getDisplayConfigs(
         else
             mExynosDisplay->mPlugState = false;
 
-        dumpDisplayConfigs();
-
-        mExynosDisplay->mDisplayConfigs.clear();
-
-        uint32_t mm_width = mDrmConnector->mm_width();
-        uint32_t mm_height = mDrmConnector->mm_height();
-
-        /* key: (width<<32 | height) */
-        std::map<uint64_t, uint32_t> groupIds;
-        uint32_t groupId = 0;
-
-        for (const DrmMode &mode : mDrmConnector->modes()) {
-            displayConfigs_t configs;
-            configs.vsyncPeriod = nsecsPerSec/ mode.v_refresh();
-            configs.width = mode.h_display();
-            configs.height = mode.v_display();
-            uint64_t key = ((uint64_t)configs.width<<32) | configs.height;
-            auto it = groupIds.find(key);
-            if (it != groupIds.end()) {
-                configs.groupId = it->second;
-            } else {
-                groupIds.insert(std::make_pair(key, groupId));
-                groupId++;
-            }
-
-            // Dots per 1000 inches
-            configs.Xdpi = mm_width ? (mode.h_display() * kUmPerInch) / mm_width : -1;
-            // Dots per 1000 inches
-            configs.Ydpi = mm_height ? (mode.v_display() * kUmPerInch) / mm_height : -1;
-            mExynosDisplay->mDisplayConfigs.insert(std::make_pair(mode.id(), configs));
-            ALOGD("config group(%d), w(%d), h(%d), vsync(%d), xdpi(%d), ydpi(%d)",
-                    configs.groupId, configs.width, configs.height,
-                    configs.vsyncPeriod, configs.Xdpi, configs.Ydpi);
+        /* The configs are built again only if UpdateModes() changed the modes */
+        if ((mExynosDisplay->getDisplayConfigTable() == nullptr) ||
+            (mModesGeneration != mDrmConnector->modes_generation())) {
+            mModesGeneration = mDrmConnector->modes_generation();
+            updateModeBlobs();
+            dumpDisplayConfigs();
+            buildDisplayConfigs();
         }
-    }
 
-    uint32_t num_modes = static_cast<uint32_t>(mDrmConnector->modes().size());
-    if (!outConfigs) {
-        *outNumConfigs = num_modes;
+        *outNumConfigs = mExynosDisplay->getDisplayConfigTable()->configs.size();
         return HWC2_ERROR_NONE;
     }
 
+    auto table = mExynosDisplay->getDisplayConfigTable();
     uint32_t idx = 0;
 
-    for (const DrmMode &mode : mDrmConnector->modes()) {
-        if (idx >= *outNumConfigs)
-            break;
-        outConfigs[idx++] = mode.id();
+    if (table != nullptr) {
+        for (hwc2_config_t config : table->configs) {
+            if (idx >= *outNumConfigs)
+                break;
+            outConfigs[idx++] = config;
+        }
     }
     *outNumConfigs = idx;
 
     return 0;
 }
 
+void ExynosDisplayDrmInterface::buildDisplayConfigs()
+{
+    std::vector<hwc2_config_t> configIds;
+
+    mExynosDisplay->mDisplayConfigs.clear();
+
+    uint32_t mm_width = mDrmConnector->mm_width();
+    uint32_t mm_height = mDrmConnector->mm_height();
+
+    /* key: (width<<32 | height) */
+    std::map<uint64_t, uint32_t> groupIds;
+    uint32_t groupId = 0;
+
+    for (const DrmMode &mode : mDrmConnector->modes()) {
+        displayConfigs_t configs;
+        configs.vsyncPeriod = mDrmConnector->vsync_period(mode.id());
+        configs.width = mode.h_display();
+        configs.height = mode.v_display();
+        uint64_t key = ((uint64_t)configs.width<<32) | configs.height;
+        auto it = groupIds.find(key);
+        if (it != groupIds.end()) {
+            configs.groupId = it->second;
+        } else {
+            configs.groupId = groupId;
+            groupIds.insert(std::make_pair(key, groupId));
+            groupId++;
+        }
+
+        // Dots per 1000 inches
+        configs.Xdpi = mm_width ? (mode.h_display() * kUmPerInch) / mm_width : -1;
+        // Dots per 1000 inches
+        configs.Ydpi = mm_height ? (mode.v_display() * kUmPerInch) / mm_height : -1;
+        mExynosDisplay->mDisplayConfigs.insert(std::make_pair(mode.id(), configs));
+        configIds.push_back(mode.id());
+        ALOGD("config group(%d), w(%d), h(%d), vsync(%d), xdpi(%d), ydpi(%d)",
+                configs.groupId, configs.width, configs.height,
+                configs.vsyncPeriod, configs.Xdpi, configs.Ydpi);
+    }
+
+    mExynosDisplay->publishDisplayConfigs(configIds);
+}
+
 void ExynosDisplayDrmInterface::dumpDisplayConfigs()
 {
     uint32_t num_modes = static_cast<uint32_t>(mDrmConnector->modes().size());
@@ -881,13 +1228,61 @@ int32_t ExynosDisplayDrmInterface::getConfigChangeDuration()
     return 2;
 };
 
+int32_t ExynosDisplayDrmInterface::getConfigSwitchDuration(hwc2_config_t config)
+{
+    /* The active mode is already the new one once the switch is committed */
+    uint32_t fromMode = mActiveModeState.mode.id();
+    if ((mVsyncCallback.getDesiredVsyncPeriod() != 0) && (mCommittedSwitch.toMode == config))
+        fromMode = mCommittedSwitch.fromMode;
+
+    auto it = mConfigSwitchDurations.find(std::make_pair(fromMode, config));
+    if (it != mConfigSwitchDurations.end())
+        return it->second;
+    return getConfigChangeDuration();
+}
+
+void ExynosDisplayDrmInterface::learnConfigSwitchDuration(int64_t firstVsync)
+{
+    ConfigSwitch committed = mCommittedSwitch;
+    mCommittedSwitch = {};
+    if ((committed.fromMode == 0) || (committed.fromPeriod <= 0) ||
+        (firstVsync <= committed.commitTime))
+        return;
+
+    /* Commit time is taken when the request is built, round to the closest vsync */
+    int32_t duration = static_cast<int32_t>(
+            (firstVsync - committed.commitTime + committed.fromPeriod / 2) / committed.fromPeriod);
+    if ((duration <= 0) || (duration > kMaxConfigSwitchDuration))
+        return;
+
+    auto key = std::make_pair(committed.fromMode, committed.toMode);
+    auto it = mConfigSwitchDurations.find(key);
+    /* Average with the previous switches, rounding towards the later vsync */
+    if (it != mConfigSwitchDurations.end())
+        duration = (it->second + duration + 1) / 2;
+    mConfigSwitchDurations[key] = duration;
+    HDEBUGLOGD(eDebugDisplayConfig, "%s:: mode %d -> %d takes %d vsyncs", __func__,
+            committed.fromMode, committed.toMode, duration);
+}
+
 int32_t ExynosDisplayDrmInterface::getVsyncAppliedTime(
         hwc2_config_t config, int64_t* actualChangeTime)
 {
     if (mDrmCrtc->adjusted_vblank_property().id() == 0) {
         uint64_t currentTime = systemTime(SYSTEM_TIME_MONOTONIC);
-        *actualChangeTime = currentTime +
-            (mExynosDisplay->mVsyncPeriod) * getConfigChangeDuration();
+        int32_t duration = getConfigSwitchDuration(config);
+        int64_t requestTime = currentTime;
+        /* A committed switch doesn't move with every vsync that passes */
+        if ((mVsyncCallback.getDesiredVsyncPeriod() != 0) && (mCommittedSwitch.toMode == config))
+            requestTime = mCommittedSwitch.commitTime;
+        *actualChangeTime = std::max<int64_t>(requestTime +
+                (mExynosDisplay->mVsyncPeriod) * duration, currentTime);
+        /* Align to the hardware vsync if its phase is known */
+        int64_t nextVsync;
+        if ((duration > 0) &&
+            (mDrmVSyncWorker.GetNextVsync(*actualChangeTime - (mExynosDisplay->mVsyncPeriod),
+                                          &nextVsync) == 0))
+            *actualChangeTime = std::max<int64_t>(nextVsync, currentTime);
         return HWC2_ERROR_NONE;
     }
 
@@ -936,6 +1331,11 @@ bool ExynosDisplayDrmInterface::supportDataspace(int32_t dataspace)
     return supportStandard && supportTransfer && supportRange;
 }
 
+bool ExynosDisplayDrmInterface::supportBackgroundColor()
+{
+    return (mDrmCrtc != NULL) && (mDrmCrtc->background_color_property().id() != 0);
+}
+
 int32_t ExynosDisplayDrmInterface::getColorModes(uint32_t *outNumModes, int32_t *outModes)
 {
     if (mDrmCrtc->color_mode_property().id() == 0) {
@@ -984,9 +1384,8 @@ int32_t ExynosDisplayDrmInterface::setActiveConfigWithConstraints(
         hwc2_config_t config, bool test)
 {
     ALOGD("%s:: %s config(%d)", __func__, mExynosDisplay->mDisplayName.string(), config);
-    auto mode = std::find_if(mDrmConnector->modes().begin(), mDrmConnector->modes().end(),
-            [config](DrmMode const &m) { return m.id() == config;});
-    if (mode == mDrmConnector->modes().end()) {
+    const DrmMode *mode = mDrmConnector->FindMode(config);
+    if (mode == nullptr) {
         HWC_LOGE(mExynosDisplay, "Could not find active mode for %d", config);
         return HWC2_ERROR_BAD_CONFIG;
     }
@@ -1034,6 +1433,8 @@ int32_t ExynosDisplayDrmInterface::setActiveConfigWithConstraints(
     return HWC2_ERROR_NONE;
 }
 int32_t ExynosDisplayDrmInterface::setActiveDrmMode(DrmMode const &mode) {
+    waitForPendingCommit();
+
     /* Don't skip when power was off */
     if (!(mExynosDisplay->mSkipFrame) &&
         (mActiveModeState.blob_id != 0) &&
@@ -1070,14 +1471,15 @@ int32_t ExynosDisplayDrmInterface::setActiveDrmMode(DrmMode const &mode) {
     mDrmConnector->set_active_mode(mode);
     mActiveModeState.setMode(mode, modeBlob, drmReq);
     mActiveModeState.needs_modeset = false;
+    /* Send all properties in the next commit after modeset */
+    clearCommittedProperties();
 
     return HWC2_ERROR_NONE;
 }
 
 int32_t ExynosDisplayDrmInterface::setActiveConfig(hwc2_config_t config) {
-    auto mode = std::find_if(mDrmConnector->modes().begin(), mDrmConnector->modes().end(),
-                             [config](DrmMode const &m) { return m.id() == config; });
-    if (mode == mDrmConnector->modes().end()) {
+    const DrmMode *mode = mDrmConnector->FindMode(config);
+    if (mode == nullptr) {
         HWC_LOGE(mExynosDisplay, "Could not find active mode for %d", config);
         return HWC2_ERROR_BAD_CONFIG;
     }
@@ -1094,6 +1496,14 @@ int32_t ExynosDisplayDrmInterface::setActiveConfig(hwc2_config_t config) {
 int32_t ExynosDisplayDrmInterface::createModeBlob(const DrmMode &mode,
         uint32_t &modeBlob)
 {
+    if (mode.id() != 0) {
+        auto it = mModeBlobs.find(mode.id());
+        if (it != mModeBlobs.end()) {
+            modeBlob = it->second;
+            return NO_ERROR;
+        }
+    }
+
     struct drm_mode_modeinfo drm_mode;
     memset(&drm_mode, 0, sizeof(drm_mode));
     mode.ToDrmModeModeInfo(&drm_mode);
@@ -1106,9 +1516,41 @@ int32_t ExynosDisplayDrmInterface::createModeBlob(const DrmMode &mode,
         return ret;
     }
 
+    if (mode.id() != 0)
+        mModeBlobs[mode.id()] = modeBlob;
+
     return NO_ERROR;
 }
 
+bool ExynosDisplayDrmInterface::isCachedModeBlob(uint32_t blobId)
+{
+    if (blobId == 0)
+        return false;
+    for (auto &modeBlob : mModeBlobs) {
+        if (modeBlob.second == blobId)
+            return true;
+    }
+    return false;
+}
+
+void ExynosDisplayDrmInterface::updateModeBlobs()
+{
+    for (auto it = mModeBlobs.begin(); it != mModeBlobs.end();) {
+        uint32_t modeId = it->first;
+        if (mDrmConnector->FindMode(modeId) != nullptr) {
+            ++it;
+            continue;
+        }
+        uint32_t blobId = it->second;
+        it = mModeBlobs.erase(it);
+        /* Blobs still used by mode states are destroyed when the mode is changed */
+        if ((blobId == mActiveModeState.blob_id) || (blobId == mActiveModeState.old_blob_id) ||
+            (blobId == mDesiredModeState.blob_id) || (blobId == mDesiredModeState.old_blob_id))
+            continue;
+        mDrmDevice->DestroyPropertyBlob(blobId);
+    }
+}
+
 int32_t ExynosDisplayDrmInterface::setDisplayMode(
         DrmModeAtomicReq &drmReq, const uint32_t modeBlob)
 {
@@ -1129,9 +1571,58 @@ int32_t ExynosDisplayDrmInterface::setDisplayMode(
     return NO_ERROR;
 }
 
+/*
+ * The cursor plane keeps its framebuffer and size, only its position is
+ * committed. The layer is placed by the next presentDisplay() as well, so
+ * positions that need a new crop are left to it.
+ */
 int32_t ExynosDisplayDrmInterface::setCursorPositionAsync(uint32_t x_pos, uint32_t y_pos)
 {
-    return 0;
+    ATRACE_CALL();
+    Mutex::Autolock lock(mCursorMutex);
+
+    if (mCursorPlane.planeId == 0)
+        return NO_ERROR;
+
+    const struct decon_frame &dst = mCursorPlane.dst;
+    if ((dst.w != mCursorPlane.src.w) || (dst.h != mCursorPlane.src.h) ||
+        ((x_pos + dst.w) > mExynosDisplay->mXres) ||
+        ((y_pos + dst.h) > mExynosDisplay->mYres))
+        return NO_ERROR;
+
+    if ((x_pos == (uint32_t)dst.x) && (y_pos == (uint32_t)dst.y))
+        return NO_ERROR;
+
+    /* A queued frame, e.g. one held for late latch, would move it back */
+    if (hasPendingCommit())
+        return NO_ERROR;
+
+    DrmPlane *plane = mDrmDevice->GetPlane(mCursorPlane.planeId);
+    if (plane == NULL)
+        return -EINVAL;
+
+    int ret = NO_ERROR;
+    DrmModeAtomicReq drmReq(this);
+    if (((ret = drmReq.atomicAddProperty(plane->id(), plane->crtc_x_property(), x_pos)) < 0) ||
+        ((ret = drmReq.atomicAddProperty(plane->id(), plane->crtc_y_property(), y_pos)) < 0))
+        return ret;
+
+    /* A commit in flight makes it fail with -EBUSY, the next frame has the position */
+    if ((ret = drmReq.commit(DRM_MODE_ATOMIC_NONBLOCK, false)) < 0) {
+        HDEBUGLOGD(eDebugDisplayInterfaceConfig, "%s: cursor is not moved, ret(%d)",
+                __func__, ret);
+        return ret;
+    }
+
+    mCursorPlane.dst.x = x_pos;
+    mCursorPlane.dst.y = y_pos;
+    return NO_ERROR;
+}
+
+void ExynosDisplayDrmInterface::updateCursorPlane(const CursorPlaneState &state)
+{
+    Mutex::Autolock lock(mCursorMutex);
+    mCursorPlane = state;
 }
 
 int32_t ExynosDisplayDrmInterface::updateHdrCapabilities()
@@ -1142,6 +1633,18 @@ int32_t ExynosDisplayDrmInterface::updateHdrCapabilities()
     mExynosDisplay->mMaxAverageLuminance = 0;
     mExynosDisplay->mMinLuminance = 0;
 
+    const uint64_t edidHash = mDrmConnector->edid_hash();
+    if (edidHash != 0) {
+        auto it = mHdrCapsCache.find(edidHash);
+        if (it != mHdrCapsCache.end()) {
+            mExynosDisplay->mHdrTypes = it->second.hdrTypes;
+            mExynosDisplay->mMaxLuminance = it->second.maxLuminance;
+            mExynosDisplay->mMaxAverageLuminance = it->second.maxAverageLuminance;
+            mExynosDisplay->mMinLuminance = it->second.minLuminance;
+            return 0;
+        }
+    }
+
     const DrmProperty &prop_max_luminance = mDrmConnector->max_luminance();
     const DrmProperty &prop_max_avg_luminance = mDrmConnector->max_avg_luminance();
     const DrmProperty &prop_min_luminance = mDrmConnector->min_luminance();
@@ -1224,6 +1727,14 @@ int32_t ExynosDisplayDrmInterface::updateHdrCapabilities()
             mExynosDisplay->mDisplayName.string(), mExynosDisplay->mHdrTypes.size(), mExynosDisplay->mMaxLuminance,
             mExynosDisplay->mMaxAverageLuminance, mExynosDisplay->mMinLuminance);
 
+    if (edidHash != 0) {
+        if (mHdrCapsCache.size() >= MAX_HDR_CAPS_CACHE)
+            mHdrCapsCache.clear();
+        mHdrCapsCache[edidHash] = {mExynosDisplay->mHdrTypes, mExynosDisplay->mMaxLuminance,
+                                   mExynosDisplay->mMaxAverageLuminance,
+                                   mExynosDisplay->mMinLuminance};
+    }
+
     return 0;
 }
 
@@ -1261,6 +1772,8 @@ int32_t ExynosDisplayDrmInterface::setupCommitFromDisplayConfig(
     if ((ret = drmReq.atomicAddProperty(plane->id(),
                     plane->fb_property(), fbId)) < 0)
         return ret;
+    drmReq.addPlaneEnable({plane->id(), plane->crtc_property().id(), mDrmCrtc->id(),
+                           plane->fb_property().id(), fbId});
     if ((ret = drmReq.atomicAddProperty(plane->id(),
                     plane->crtc_x_property(), config.dst.x)) < 0)
         return ret;
@@ -1325,7 +1838,8 @@ int32_t ExynosDisplayDrmInterface::setupCommitFromDisplayConfig(
             return ret;
     }
 
-    if (config.acq_fence >= 0) {
+    /* The unchanged client target is already on the screen, its fence has no work to wait */
+    if ((config.acq_fence >= 0) && !config.target_unchanged) {
         if ((ret = drmReq.atomicAddProperty(plane->id(),
                         plane->in_fence_fd_property(), config.acq_fence)) < 0)
             return ret;
@@ -1342,38 +1856,27 @@ int32_t ExynosDisplayDrmInterface::setupCommitFromDisplayConfig(
         }
     }
 
-    std::tie(drmEnum, ret) =
-        halToDrmEnum(config.dataspace & HAL_DATASPACE_STANDARD_MASK, mStandardEnums);
-    if (ret < 0) {
-        HWC_LOGE(mExynosDisplay, "Fail to convert standard(%d)",
-                config.dataspace & HAL_DATASPACE_STANDARD_MASK);
+    uint64_t standardEnum = 0, transferEnum = 0, rangeEnum = 0;
+    if ((ret = dataspaceToDrmEnums(config.dataspace, standardEnum,
+                    transferEnum, rangeEnum)) < 0) {
+        HWC_LOGE(mExynosDisplay, "Fail to convert dataspace(0x%x), "
+                "standard(%d), transfer(%d), range(%d)", config.dataspace,
+                config.dataspace & HAL_DATASPACE_STANDARD_MASK,
+                config.dataspace & HAL_DATASPACE_TRANSFER_MASK,
+                config.dataspace & HAL_DATASPACE_RANGE_MASK);
         return ret;
     }
     if ((ret = drmReq.atomicAddProperty(plane->id(),
                     plane->standard_property(),
-                    drmEnum, true)) < 0)
+                    standardEnum, true)) < 0)
         return ret;
 
-    std::tie(drmEnum, ret) =
-        halToDrmEnum(config.dataspace & HAL_DATASPACE_TRANSFER_MASK, mTransferEnums);
-    if (ret < 0) {
-        HWC_LOGE(mExynosDisplay, "Fail to convert transfer(%d)",
-                config.dataspace & HAL_DATASPACE_TRANSFER_MASK);
-        return ret;
-    }
     if ((ret = drmReq.atomicAddProperty(plane->id(),
-                    plane->transfer_property(), drmEnum, true)) < 0)
+                    plane->transfer_property(), transferEnum, true)) < 0)
         return ret;
 
-    std::tie(drmEnum, ret) =
-        halToDrmEnum(config.dataspace & HAL_DATASPACE_RANGE_MASK, mRangeEnums);
-    if (ret < 0) {
-        HWC_LOGE(mExynosDisplay, "Fail to convert range(%d)",
-                config.dataspace & HAL_DATASPACE_RANGE_MASK);
-        return ret;
-    }
     if ((ret = drmReq.atomicAddProperty(plane->id(),
-                    plane->range_property(), drmEnum, true)) < 0)
+                    plane->range_property(), rangeEnum, true)) < 0)
         return ret;
 
     if (hasHdrInfo(config.dataspace)) {
@@ -1395,19 +1898,33 @@ int32_t ExynosDisplayDrmInterface::setupPartialRegion(DrmModeAtomicReq &drmReq)
 
     int ret = NO_ERROR;
 
-    struct decon_frame &update_region = mExynosDisplay->mDpuData.win_update_region;
-    struct drm_clip_rect partial_rect = {
-        static_cast<unsigned short>(update_region.x),
-        static_cast<unsigned short>(update_region.y),
-        static_cast<unsigned short>(update_region.x + update_region.w),
-        static_cast<unsigned short>(update_region.y + update_region.h),
-    };
+    /*
+     * The blob is an array of clip rects. A single rect (the bounding box)
+     * is sent unless the display is configured to take several regions.
+     */
+    const exynos_dpu_data &dpuData = mExynosDisplay->mDpuData;
+    const struct decon_frame *update_regions = &dpuData.win_update_region;
+    uint32_t rect_num = 1;
+    if (dpuData.enable_win_update && (dpuData.win_update_region_num > 1)) {
+        update_regions = dpuData.win_update_regions;
+        rect_num = dpuData.win_update_region_num;
+    }
+
+    struct drm_clip_rect partial_rects[MAX_WIN_UPDATE_REGIONS];
+    for (uint32_t i = 0; i < rect_num; i++) {
+        partial_rects[i] = {
+            static_cast<unsigned short>(update_regions[i].x),
+            static_cast<unsigned short>(update_regions[i].y),
+            static_cast<unsigned short>(update_regions[i].x + update_regions[i].w),
+            static_cast<unsigned short>(update_regions[i].y + update_regions[i].h),
+        };
+    }
     if ((mPartialRegionState.blob_id == 0) ||
-         mPartialRegionState.isUpdated(partial_rect))
+         mPartialRegionState.isUpdated(partial_rects, rect_num))
     {
         uint32_t blob_id = 0;
-        ret = mDrmDevice->CreatePropertyBlob(&partial_rect,
-                sizeof(partial_rect),&blob_id);
+        ret = mDrmDevice->CreatePropertyBlob(partial_rects,
+                sizeof(partial_rects[0]) * rect_num, &blob_id);
         if (ret || (blob_id == 0)) {
             HWC_LOGE(mExynosDisplay, "Failed to create partial region "
                     "blob id=%d, ret=%d", blob_id, ret);
@@ -1415,18 +1932,20 @@ int32_t ExynosDisplayDrmInterface::setupPartialRegion(DrmModeAtomicReq &drmReq)
         }
 
         HDEBUGLOGD(eDebugWindowUpdate,
-                "%s: partial region updated [%d, %d, %d, %d] -> [%d, %d, %d, %d] blob(%d)",
+                "%s: partial region updated [%d, %d, %d, %d] -> [%d, %d, %d, %d] (%u rects) blob(%d)",
                 mExynosDisplay->mDisplayName.string(),
-                mPartialRegionState.partial_rect.x1,
-                mPartialRegionState.partial_rect.y1,
-                mPartialRegionState.partial_rect.x2,
-                mPartialRegionState.partial_rect.y2,
-                partial_rect.x1,
-                partial_rect.y1,
-                partial_rect.x2,
-                partial_rect.y2,
-                blob_id);
-        mPartialRegionState.partial_rect = partial_rect;
+                mPartialRegionState.partial_rects[0].x1,
+                mPartialRegionState.partial_rects[0].y1,
+                mPartialRegionState.partial_rects[0].x2,
+                mPartialRegionState.partial_rects[0].y2,
+                partial_rects[0].x1,
+                partial_rects[0].y1,
+                partial_rects[0].x2,
+                partial_rects[0].y2,
+                rect_num, blob_id);
+        memcpy(mPartialRegionState.partial_rects, partial_rects,
+                sizeof(partial_rects[0]) * rect_num);
+        mPartialRegionState.rect_num = rect_num;
 
         if (mPartialRegionState.blob_id)
             drmReq.addOldBlob(mPartialRegionState.blob_id);
@@ -1454,9 +1973,60 @@ int32_t ExynosDisplayDrmInterface::waitVBlank() {
     return ret;
 }
 
+int32_t ExynosDisplayDrmInterface::getColorBlob(DrmModeAtomicReq &drmReq, const void *data,
+        size_t size, uint32_t &blobId)
+{
+    size_t hash = std::hash<std::string_view>{}(
+            std::string_view(static_cast<const char *>(data), size));
+
+    for (auto it = mColorBlobs.begin(); it != mColorBlobs.end(); it++) {
+        if ((it->hash == hash) && (it->data.size() == size) &&
+            (memcmp(it->data.data(), data, size) == 0)) {
+            mColorBlobs.splice(mColorBlobs.begin(), mColorBlobs, it);
+            blobId = it->blobId;
+            return NO_ERROR;
+        }
+    }
+
+    blobId = 0;
+    int ret = mDrmDevice->CreatePropertyBlob(const_cast<void *>(data), size, &blobId);
+    if (ret) {
+        HWC_LOGE(mExynosDisplay, "Failed to create color property blob %d", ret);
+        return ret;
+    }
+
+    if (mColorBlobs.size() >= MAX_COLOR_BLOBS) {
+        /* Queued requests could use it, destroy it after this request is committed */
+        uint32_t oldBlobId = mColorBlobs.back().blobId;
+        mColorBlobs.pop_back();
+        drmReq.addOldBlob(oldBlobId);
+    }
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    mColorBlobs.push_front({hash, std::vector<uint8_t>(bytes, bytes + size), blobId});
+
+    return NO_ERROR;
+}
+
+bool ExynosDisplayDrmInterface::isCachedColorBlob(uint32_t blobId)
+{
+    if (blobId == 0)
+        return false;
+    for (auto &colorBlob : mColorBlobs) {
+        if (colorBlob.blobId == blobId)
+            return true;
+    }
+    return false;
+}
+
 int32_t ExynosDisplayDrmInterface::updateColorSettings(DrmModeAtomicReq &drmReq, uint64_t dqeEnabled) {
     int ret = NO_ERROR;
 
+    /* The color properties left out of the commit keep the previous LUTs */
+    if (mExynosDisplay->isColorUpdateRunning()) {
+        ATRACE_NAME("colorUpdateDeferred");
+        return ret;
+    }
+
     if (dqeEnabled) {
         if ((ret = setDisplayColorSetting(drmReq)) != 0) {
             HWC_LOGE(mExynosDisplay, "Failed to set display color setting");
@@ -1467,7 +2037,8 @@ int32_t ExynosDisplayDrmInterface::updateColorSettings(DrmModeAtomicReq &drmReq,
     for (size_t i = 0; i < mExynosDisplay->mDpuData.configs.size(); i++) {
         exynos_win_config_data& config = mExynosDisplay->mDpuData.configs[i];
         if ((config.state == config.WIN_STATE_BUFFER) ||
-            (config.state == config.WIN_STATE_COLOR)) {
+            (config.state == config.WIN_STATE_COLOR) ||
+            (config.state == config.WIN_STATE_CURSOR)) {
             int channelId = 0;
             if ((channelId = getDeconChannel(config.assignedMPP)) < 0) {
                 HWC_LOGE(mExynosDisplay, "%s:: Failed to get channel id (%d)",
@@ -1481,29 +2052,68 @@ int32_t ExynosDisplayDrmInterface::updateColorSettings(DrmModeAtomicReq &drmReq,
                 HWC_LOGE(mExynosDisplay, "Failed to set plane color setting, config[%zu]", i);
                 return ret;
             }
+            config.assignedMPP->mResidentColorHash =
+                    (config.layer != nullptr) ? config.layer->getColorDataHash() : 0;
         }
     }
 
     return ret;
 }
 
+bool ExynosDisplayDrmInterface::hasPendingDisplayUpdate()
+{
+    return mDesiredModeState.needs_modeset ||
+        mReadbackInfo.mNeedClearReadbackCommit ||
+        mBrightnessLevel.is_dirty() ||
+        mBrightnessCtrl.DimmingOn.is_dirty() ||
+        mBrightnessCtrl.HbmMode.is_dirty() ||
+        mBrightnessCtrl.LhbmOn.is_dirty();
+}
+
 int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
 {
+    HWC_TRACE_FUNC(eHwcTraceCommit);
     int ret = NO_ERROR;
-    DrmModeAtomicReq drmReq(this);
     std::unordered_map<uint32_t, uint32_t> planeEnableInfo;
     android::String8 result;
     bool hasSecureFrameBuffer = false;
+    std::unique_ptr<CommitJob> commitJob;
+    bool commitQueued = false;
+    int retireFence = -1;
+
+    /*
+     * FramebufferManager::flip() of a queued commit can destroy the secure
+     * framebuffer before it is committed, commit all queued requests first.
+     */
+    bool hasSecureClientTarget = false;
+    for (auto &config : mExynosDisplay->mDpuData.configs) {
+        hasSecureClientTarget |= (isFramebuffer(config.layer) && config.protection);
+    }
+    if (hasSecureClientTarget)
+        waitForPendingCommit();
+    else
+        waitForCommitQueue(std::max(mExynosDisplay->mDisplayControl.commitQueueDepth, 1U) - 1);
+
+    auto drmReqPtr = std::make_unique<DrmModeAtomicReq>(this);
+    DrmModeAtomicReq &drmReq = *drmReqPtr;
 
     funcReturnCallback retCallback([&]() {
-        if ((ret == NO_ERROR) && !drmReq.getError()) {
+        if (commitJob != nullptr) {
+            /* The request was not queued, keep the order of commit fences */
+            retireFence = hwcFdClose(retireFence);
+            queueCommitJob(std::move(commitJob));
+        } else if (commitQueued) {
+            /* Framebuffers are flipped by mCommitThread after commit */
+        } else if ((ret == NO_ERROR) && !drmReq.getError()) {
             mFBManager.flip(hasSecureFrameBuffer);
         } else if (ret == -ENOMEM) {
-            mFBManager.releaseAll();
+            mFBManager.releaseAll(true);
         }
     });
 
-    mFBManager.checkShrink();
+    /* Layers in use are collected until flip(), it should not overlap with a queued commit */
+    if (!hasPendingCommit())
+        mFBManager.checkShrink();
 
     bool needModesetForReadback = false;
     if (mExynosDisplay->mDpuData.enable_readback) {
@@ -1541,10 +2151,22 @@ int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
     if ((ret = setupPartialRegion(drmReq)) != NO_ERROR)
         return ret;
 
+    /* Modeset and mipi sync need blocking commits */
+    bool mipiSyncPending = mBrightnessCtrl.LhbmOn.is_dirty() ||
+        (mBrightnessCtrl.HbmMode.is_dirty() && mBrightnessState.dimSdrTransition() &&
+         mBrightnessState.instant_hbm);
+    if (!needModesetForReadback && !mDesiredModeState.needs_modeset && !mipiSyncPending &&
+        isAsyncCommitAvailable()) {
+        if ((retireFence = createCommitFence()) >= 0)
+            commitJob = std::make_unique<CommitJob>();
+    }
+
     uint64_t out_fences[mDrmDevice->crtcs().size()];
+    uint64_t *outFencePtr = (commitJob != nullptr) ?
+        &commitJob->outFence : &out_fences[mDrmCrtc->pipe()];
     if ((ret = drmReq.atomicAddProperty(mDrmCrtc->id(),
                     mDrmCrtc->out_fence_ptr_property(),
-                    (uint64_t)&out_fences[mDrmCrtc->pipe()], true)) < 0) {
+                    (uint64_t)outFencePtr, true)) < 0) {
         return ret;
     }
 
@@ -1565,10 +2187,30 @@ int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
         return ret;
     }
 
+    /*
+     * The background color of the CRTC is ARGB with 16 bits per component,
+     * it is opaque black when no layer is programmed as the background.
+     */
+    hwc_color_t bgColor = {0, 0, 0, 0xff};
+    if (mExynosDisplay->mBackgroundLayer != nullptr)
+        bgColor = mExynosDisplay->mBackgroundColor;
+    uint64_t background = ((uint64_t)bgColor.a * 0x101) << 48 |
+            ((uint64_t)bgColor.r * 0x101) << 32 |
+            ((uint64_t)bgColor.g * 0x101) << 16 |
+            ((uint64_t)bgColor.b * 0x101);
+    if ((ret = drmReq.atomicAddProperty(mDrmCrtc->id(),
+                    mDrmCrtc->background_color_property(), background, true)) < 0) {
+        HWC_LOGE(mExynosDisplay, "%s: Fail to set background color",
+                __func__);
+        return ret;
+    }
+
+    CursorPlaneState cursorPlane;
     for (size_t i = 0; i < mExynosDisplay->mDpuData.configs.size(); i++) {
         exynos_win_config_data& config = mExynosDisplay->mDpuData.configs[i];
         if ((config.state == config.WIN_STATE_BUFFER) ||
-            (config.state == config.WIN_STATE_COLOR)) {
+            (config.state == config.WIN_STATE_COLOR) ||
+            (config.state == config.WIN_STATE_CURSOR)) {
             int channelId = 0;
             if ((channelId = getDeconChannel(config.assignedMPP)) < 0) {
                 HWC_LOGE(mExynosDisplay, "%s:: Failed to get channel id (%d)",
@@ -1582,7 +2224,11 @@ int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
                 config.src.h = config.dst.h;
             }
             auto &plane = mDrmDevice->planes().at(channelId);
-            uint32_t fbId = 0;
+            if (config.state == config.WIN_STATE_CURSOR)
+                cursorPlane = {plane->id(), config.src, config.dst};
+            /* An unchanged client target keeps the framebuffer being scanned out */
+            uint32_t fbId = config.target_unchanged ?
+                mFBManager.getLastClientTargetFbId(config.buffer_id) : 0;
             if ((ret = setupCommitFromDisplayConfig(drmReq, config, i, plane, fbId)) < 0) {
                 HWC_LOGE(mExynosDisplay, "setupCommitFromDisplayConfig failed, config[%zu]", i);
                 return ret;
@@ -1715,10 +2361,34 @@ int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
         HWC_LOGE(mExynosDisplay, "failed to update color settings, ret=%d", ret);
         return ret;
     }
-    if ((ret = drmReq.commit(flags, true)) < 0) {
-        HWC_LOGE(mExynosDisplay, "%s:: Failed to commit pset ret=%d in deliverWinConfigData()\n",
-                __func__, ret);
-        return ret;
+
+    if (commitJob != nullptr) {
+        /* Acquire fences are closed by mCommitThread after commit */
+        for (auto &config : mExynosDisplay->mDpuData.configs) {
+            if (config.acq_fence < 0)
+                continue;
+            setFenceInfo(config.acq_fence, mExynosDisplay, FENCE_TYPE_SRC_ACQUIRE,
+                    FENCE_IP_DPP, FENCE_CLOSE);
+            commitJob->acqFences.push_back(config.acq_fence);
+            config.acq_fence = -1;
+        }
+        /* Following requests are built before this one is committed */
+        drmReqPtr->applyPendingProperties();
+        commitJob->drmReq = std::move(drmReqPtr);
+        commitJob->flags = flags;
+        commitJob->hasSecureFrameBuffer = hasSecureFrameBuffer;
+        queueCommitJob(std::move(commitJob));
+        commitQueued = true;
+    } else {
+        ret = drmReq.commit(flags, true);
+        if ((ret == -ENOMEM) && evictFramebuffersForRetry(drmReq))
+            ret = drmReq.commit(flags, true);
+        if (ret < 0) {
+            HWC_LOGE(mExynosDisplay, "%s:: Failed to commit pset ret=%d in deliverWinConfigData()\n",
+                    __func__, ret);
+            return ret;
+        }
+        retireFence = (int)out_fences[mDrmCrtc->pipe()];
     }
 
     if (mipi_sync) {
@@ -1738,7 +2408,8 @@ int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
 
         // frame compensation set/restore
         mExynosDisplay->updateForMipiSync(mipi_sync_action);
-        if ((ret = mExynosDisplay->updateColorConversionInfo()) != NO_ERROR) {
+        /* the compensated frame can't be late */
+        if ((ret = mExynosDisplay->requestColorConversionInfo(false)) != NO_ERROR) {
             HWC_LOGE(mExynosDisplay, "%s:: updateColorConversionInfo() fail, ret(%d)",
                     __func__, ret);
             return ret;
@@ -1756,11 +2427,17 @@ int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
         }
         if (mipi_sync_action == brightnessState_t::MIPI_SYNC_LHBM_ON ||
             mipi_sync_action == brightnessState_t::MIPI_SYNC_LHBM_OFF) {
-            mExynosDisplay->notifyLhbmState(mBrightnessCtrl.LhbmOn.get());
+            /* The frame is not shown yet, completion is reported by a copy of its fence */
+            int lhbmFence = (int)out_fences[mDrmCrtc->pipe()];
+            mExynosDisplay->notifyLhbmState(mBrightnessCtrl.LhbmOn.get(),
+                    (lhbmFence >= 0) ? fcntl(lhbmFence, F_DUPFD_CLOEXEC, 0) : -1);
         }
+        retireFence = (int)out_fences[mDrmCrtc->pipe()];
     }
 
-    mExynosDisplay->mDpuData.retire_fence = (int)out_fences[mDrmCrtc->pipe()];
+    updateCursorPlane(cursorPlane);
+
+    mExynosDisplay->mDpuData.retire_fence = retireFence;
     /*
      * [HACK] dup retire_fence for each layer's release fence
      * Do not use hwc_dup because hwc_dup increase usage count of fence treacer
@@ -1769,13 +2446,18 @@ int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
     for (auto &display_config : mExynosDisplay->mDpuData.configs) {
         if ((display_config.state == display_config.WIN_STATE_BUFFER) ||
             (display_config.state == display_config.WIN_STATE_CURSOR)) {
-            display_config.rel_fence =
-                dup((int)out_fences[mDrmCrtc->pipe()]);
+            display_config.rel_fence = dup(retireFence);
         }
     }
 
     if (mDesiredModeState.needs_modeset) {
+        mCommittedSwitch = {.fromMode = mActiveModeState.mode.id(),
+                            .toMode = mDesiredModeState.mode.id(),
+                            .commitTime = systemTime(SYSTEM_TIME_MONOTONIC),
+                            .fromPeriod = mExynosDisplay->mVsyncPeriod};
         mDesiredModeState.apply(mActiveModeState, drmReq);
+        /* Send all properties in the next commit after modeset */
+        clearCommittedProperties();
         mVsyncCallback.setDesiredVsyncPeriod(
                 nsecsPerSec/mActiveModeState.mode.v_refresh());
         /* Enable vsync to check vsync period */
@@ -1785,6 +2467,272 @@ int32_t ExynosDisplayDrmInterface::deliverWinConfigData()
     return NO_ERROR;
 }
 
+int32_t ExynosDisplayDrmInterface::testWinConfigData(exynos_dpu_data &dpuData)
+{
+    ATRACE_CALL();
+    int ret = NO_ERROR;
+    DrmModeAtomicReq drmReq(this);
+    std::unordered_map<uint32_t, uint32_t> planeEnableInfo;
+
+    for (size_t i = 0; i < dpuData.configs.size(); i++) {
+        exynos_win_config_data& config = dpuData.configs[i];
+        if ((config.state != config.WIN_STATE_BUFFER) &&
+            (config.state != config.WIN_STATE_COLOR) &&
+            (config.state != config.WIN_STATE_CURSOR))
+            continue;
+
+        int channelId = 0;
+        if ((channelId = getDeconChannel(config.assignedMPP)) < 0) {
+            HWC_LOGE(mExynosDisplay, "%s:: Failed to get channel id (%d)",
+                    __func__, channelId);
+            return -EINVAL;
+        }
+        /* src size should be set even in dim layer */
+        if (config.state == config.WIN_STATE_COLOR) {
+            config.src.w = config.dst.w;
+            config.src.h = config.dst.h;
+        }
+        auto &plane = mDrmDevice->planes().at(channelId);
+        uint32_t fbId = 0;
+        if ((ret = setupCommitFromDisplayConfig(drmReq, config, i, plane, fbId)) < 0) {
+            HWC_LOGE(mExynosDisplay, "setupCommitFromDisplayConfig failed, config[%zu]", i);
+            return ret;
+        }
+        planeEnableInfo[plane->id()] = 1;
+    }
+
+    /* Disable unused plane */
+    for (auto &plane : mDrmDevice->planes()) {
+        if (planeEnableInfo[plane->id()] == 1)
+            continue;
+        /* Don't disable planes that are reserved to other display */
+        ExynosMPP* exynosMPP = mExynosMPPsForPlane[plane->id()];
+        if ((exynosMPP != NULL) && (mExynosDisplay != NULL) &&
+            (exynosMPP->mAssignedState & MPP_ASSIGN_STATE_RESERVED) &&
+            (exynosMPP->mReservedDisplay != (int32_t)mExynosDisplay->mDisplayId))
+            continue;
+
+        if ((ret = drmReq.atomicAddProperty(plane->id(),
+                plane->crtc_property(), 0)) < 0)
+            return ret;
+
+        if ((ret = drmReq.atomicAddProperty(plane->id(),
+                plane->fb_property(), 0)) < 0)
+            return ret;
+    }
+
+    /*
+     * Commit the pset directly instead of DrmModeAtomicReq::commit().
+     * A rejected configuration is handled by the caller and should not be
+     * reported as a commit error.
+     */
+    ret = drmModeAtomicCommit(mDrmDevice->fd(), drmReq.pset(), DRM_MODE_ATOMIC_TEST_ONLY,
+            mDrmDevice);
+    if (ret < 0)
+        HDEBUGLOGD(eDebugDisplayInterfaceConfig, "%s:: TEST_ONLY commit failed, ret(%d)",
+                __func__, ret);
+
+    return ret;
+}
+
+bool ExynosDisplayDrmInterface::isAsyncCommitAvailable()
+{
+    if (!mExynosDisplay->mDisplayControl.asyncCommit || mCommitThreadFailed)
+        return false;
+    if (mCommitThreadRunning)
+        return true;
+
+    mCommitTimeline = open("/dev/sw_sync", O_RDWR | O_CLOEXEC);
+    if (mCommitTimeline < 0)
+        mCommitTimeline = open("/sys/kernel/debug/sync/sw_sync", O_RDWR | O_CLOEXEC);
+    if (mCommitTimeline < 0) {
+        ALOGW("%s:: sw_sync is not available(%s), commit synchronously",
+                mExynosDisplay->mDisplayName.string(), strerror(errno));
+        mCommitThreadFailed = true;
+        return false;
+    }
+
+    mCommitThreadRunning = true;
+    mCommitThread = std::thread(&ExynosDisplayDrmInterface::commitThreadRoutine, this);
+    pthread_setname_np(mCommitThread.native_handle(), "DrmCommitThread");
+    return true;
+}
+
+int ExynosDisplayDrmInterface::createCommitFence()
+{
+    struct sw_sync_create_fence_data data;
+    data.value = mCommitTimelineValue + 1;
+    data.fence = -1;
+    strlcpy(data.name, "hwc_commit", sizeof(data.name));
+    if (ioctl(mCommitTimeline, SW_SYNC_IOC_CREATE_FENCE, &data) < 0) {
+        HWC_LOGE(mExynosDisplay, "%s:: Failed to create fence(%s)", __func__, strerror(errno));
+        return -1;
+    }
+    mCommitTimelineValue = data.value;
+    return data.fence;
+}
+
+void ExynosDisplayDrmInterface::queueCommitJob(std::unique_ptr<CommitJob> job)
+{
+    {
+        Mutex::Autolock lock(mCommitMutex);
+        mCommitJobs.push_back(std::move(job));
+        ATRACE_INT("CommitQueue", static_cast<int32_t>(mCommitJobs.size()));
+    }
+    mCommitQueued.signal();
+}
+
+void ExynosDisplayDrmInterface::waitForCommitQueue(size_t maxQueued)
+{
+    if (!mCommitThreadRunning)
+        return;
+
+    Mutex::Autolock lock(mCommitMutex);
+    if (mCommitJobs.size() <= maxQueued)
+        return;
+
+    ATRACE_NAME("wait commit queue");
+    while (mCommitJobs.size() > maxQueued)
+        mCommitSubmitted.wait(mCommitMutex);
+}
+
+/*
+ * Framebuffers of the queued commits and the one on screen are within the
+ * newest commitQueueDepth + 2 buffers of their layer, they are kept.
+ */
+bool ExynosDisplayDrmInterface::evictFramebuffersForRetry(DrmModeAtomicReq &drmReq)
+{
+    size_t keepBuffers = std::max(mExynosDisplay->mDisplayControl.commitQueueDepth, 1U) + 2;
+    if (mFBManager.evictUnderPressure(keepBuffers) == 0)
+        return false;
+
+    drmReq.setError(NO_ERROR);
+    return true;
+}
+
+bool ExynosDisplayDrmInterface::hasPendingCommit()
+{
+    if (!mCommitThreadRunning)
+        return false;
+
+    Mutex::Autolock lock(mCommitMutex);
+    return !mCommitJobs.empty();
+}
+
+void ExynosDisplayDrmInterface::commitThreadRoutine()
+{
+    ApplyThreadPolicy(ThreadRole::COMMIT);
+    /* Commits of the display are handled in the queued order */
+    while (true) {
+        CommitJob *job = NULL;
+        {
+            Mutex::Autolock lock(mCommitMutex);
+            while (mCommitThreadRunning && mCommitJobs.empty())
+                mCommitQueued.wait(mCommitMutex);
+            if (mCommitJobs.empty())
+                break;
+            job = mCommitJobs.front().get();
+        }
+
+        /* drmReq is NULL if building the request was failed */
+        if (job->drmReq != nullptr) {
+            waitForLatchTime(*job);
+            auto commit = [&]() {
+                return ((mCommitCoordinator != nullptr) && mCommitCoordinator->isEnabled()) ?
+                    mCommitCoordinator->commit(this, *job->drmReq, job->flags) :
+                    job->drmReq->commit(job->flags, true);
+            };
+            int ret = commit();
+            if ((ret == -ENOMEM) && evictFramebuffersForRetry(*job->drmReq))
+                ret = commit();
+            if ((ret == NO_ERROR) && !job->drmReq->getError()) {
+                mFBManager.flip(job->hasSecureFrameBuffer);
+            } else {
+                HWC_LOGE(mExynosDisplay, "%s:: Failed to commit pset ret=%d", __func__, ret);
+                /* Properties were recorded when the request was queued */
+                clearCommittedProperties();
+                if (ret == -ENOMEM)
+                    mFBManager.releaseAll(true);
+            }
+            /* Old blobs are destroyed after commit */
+            job->drmReq.reset();
+        }
+        for (auto fence : job->acqFences)
+            hwcFdClose(fence);
+        int outFence = (int)job->outFence;
+
+        {
+            Mutex::Autolock lock(mCommitMutex);
+            mCommitJobs.pop_front();
+            ATRACE_INT("CommitQueue", static_cast<int32_t>(mCommitJobs.size()));
+        }
+        mCommitSubmitted.broadcast();
+
+        if (outFence >= 0) {
+            ATRACE_NAME("wait out fence");
+            if (sync_wait(outFence, 1000) < 0)
+                HWC_LOGE(mExynosDisplay, "%s:: out fence sync_wait error", __func__);
+            else if (job->targetVsync != 0)
+                updateLatchMargin(outFence, job->targetVsync);
+            hwcFdClose(outFence);
+        }
+
+        uint32_t inc = 1;
+        if (ioctl(mCommitTimeline, SW_SYNC_IOC_INC, &inc) < 0)
+            HWC_LOGE(mExynosDisplay, "%s:: Failed to signal fence(%s)", __func__, strerror(errno));
+    }
+}
+
+bool ExynosDisplayDrmInterface::canCombineCommit()
+{
+    return mCommitThreadRunning && mExynosDisplay->mPlugState &&
+        (mExynosDisplay->mPowerModeState != (hwc2_power_mode_t)HWC_POWER_MODE_OFF);
+}
+
+void ExynosDisplayDrmInterface::waitForLatchTime(CommitJob &job)
+{
+    job.targetVsync = 0;
+    if (!mExynosDisplay->mDisplayControl.lateLatch)
+        return;
+
+    /* The kernel waits for the fences anyway, holding the request only adds to it */
+    for (auto fence : job.acqFences) {
+        if (sync_wait(fence, 0) < 0)
+            return;
+    }
+
+    int64_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    int64_t nextVsync;
+    if (mDrmVSyncWorker.GetNextVsync(now + mLatchMargin, &nextVsync) != 0)
+        return;
+
+    ATRACE_NAME("late latch");
+    int64_t latchTime = nextVsync - mLatchMargin;
+    struct timespec ts = {.tv_sec = static_cast<time_t>(latchTime / nsecsPerSec),
+                          .tv_nsec = static_cast<long>(latchTime % nsecsPerSec)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    job.targetVsync = nextVsync;
+}
+
+/* The out fence signals when the frame is shown */
+void ExynosDisplayDrmInterface::updateLatchMargin(int outFence, int64_t targetVsync)
+{
+    int64_t signalTime = getFenceSignalTime(outFence);
+    if (signalTime <= 0)
+        return;
+
+    int64_t vsyncPeriod = mExynosDisplay->mVsyncPeriod;
+    if (signalTime > (targetVsync + vsyncPeriod / 2)) {
+        mLatchMargin = std::min(mLatchMargin * 2, vsyncPeriod);
+        HDEBUGLOGD(eDebugDisplayInterfaceConfig, "%s:: missed vsync, margin(%" PRId64 ")",
+                __func__, mLatchMargin);
+    } else {
+        mLatchMargin = std::max(mLatchMargin - (mLatchMargin / 32), kLateLatchMinMargin);
+    }
+    ATRACE_INT64("LateLatchMargin", mLatchMargin);
+}
+
 int32_t ExynosDisplayDrmInterface::clearDisplayMode(DrmModeAtomicReq &drmReq)
 {
     int ret = NO_ERROR;
@@ -1807,6 +2755,10 @@ int32_t ExynosDisplayDrmInterface::clearDisplayMode(DrmModeAtomicReq &drmReq)
 int32_t ExynosDisplayDrmInterface::clearDisplay(bool needModeClear)
 {
     int ret = NO_ERROR;
+
+    waitForPendingCommit();
+    updateCursorPlane({});
+
     DrmModeAtomicReq drmReq(this);
 
     /* Disable all planes */
@@ -1863,6 +2815,14 @@ int32_t ExynosDisplayDrmInterface::disableSelfRefresh(uint32_t disable)
     return 0;
 }
 
+/* Vsync interrupts are only kept on for SurfaceFlinger or a config switch in progress */
+void ExynosDisplayDrmInterface::onSelfRefreshChanged(bool active)
+{
+    if (active && !mVsyncCallback.getVSyncEnabled() &&
+        (mVsyncCallback.getDesiredVsyncPeriod() == 0))
+        mDrmVSyncWorker.VSyncControl(false);
+}
+
 int32_t ExynosDisplayDrmInterface::setForcePanic()
 {
     if (exynosHWCControl.forcePanic == 0)
@@ -1912,6 +2872,46 @@ ExynosDisplayDrmInterface::DrmModeAtomicReq::~DrmModeAtomicReq()
         HWC_LOGE(mDrmDisplayInterface->mExynosDisplay, "destroy blob error");
 }
 
+Mutex ExynosDisplayDrmInterface::sCommittedPropertiesMutex;
+std::unordered_map<uint64_t, uint64_t> ExynosDisplayDrmInterface::sCommittedProperties;
+
+void ExynosDisplayDrmInterface::clearCommittedProperties()
+{
+    Mutex::Autolock lock(sCommittedPropertiesMutex);
+    sCommittedProperties.clear();
+}
+
+bool ExynosDisplayDrmInterface::DrmModeAtomicReq::canSkipProperty(
+        const uint32_t id, const DrmProperty &property, uint64_t value)
+{
+    /*
+     * Connector properties can be changed by sysfs nodes as well, and fence
+     * properties should be set for every commit.
+     */
+    if (id == mDrmDisplayInterface->mDrmConnector->id())
+        return false;
+    /* Writeback properties are added only after the connector is loaded */
+    DrmConnector *writeback_conn =
+        mDrmDisplayInterface->mReadbackInfo.getWritebackConnector(false);
+    if ((writeback_conn != NULL) && (id == writeback_conn->id()))
+        return false;
+    /* Fence properties are device-wide properties shared by all objects */
+    if (property.id() == mDrmDisplayInterface->mDrmCrtc->out_fence_ptr_property().id())
+        return false;
+    const auto &planes = mDrmDisplayInterface->mDrmDevice->planes();
+    if (!planes.empty() && (property.id() == planes.front()->in_fence_fd_property().id()))
+        return false;
+
+    uint64_t key = getCommittedPropertyKey(id, property.id());
+    /* The property was added already, the previous value should be overwritten */
+    if (mPendingProperties.find(key) != mPendingProperties.end())
+        return false;
+
+    Mutex::Autolock lock(sCommittedPropertiesMutex);
+    auto it = sCommittedProperties.find(key);
+    return ((it != sCommittedProperties.end()) && (it->second == value));
+}
+
 int32_t ExynosDisplayDrmInterface::DrmModeAtomicReq::atomicAddProperty(
         const uint32_t id,
         const DrmProperty &property,
@@ -1924,6 +2924,11 @@ int32_t ExynosDisplayDrmInterface::DrmModeAtomicReq::atomicAddProperty(
     }
 
     if (property.id()) {
+        if (canSkipProperty(id, property, value)) {
+            mSkippedPropertyNum++;
+            return NO_ERROR;
+        }
+
         int ret = drmModeAtomicAddProperty(mPset, id,
                 property.id(), value);
         if (ret < 0) {
@@ -1931,6 +2936,7 @@ int32_t ExynosDisplayDrmInterface::DrmModeAtomicReq::atomicAddProperty(
                     __func__, property.id(), property.name().c_str(), id, ret);
             return ret;
         }
+        mPendingProperties[getCommittedPropertyKey(id, property.id())] = value;
     }
 
     return NO_ERROR;
@@ -2012,13 +3018,27 @@ String8& ExynosDisplayDrmInterface::DrmModeAtomicReq::dumpAtomicCommitInfo(
             result.appendFormat("property[%d] %s object_id: %d, property_id: %d, name: %s,  value: %" PRId64 ")\n",
                 i,  objectName.string(), mPset->items[i].object_id, mPset->items[i].property_id, property->name().c_str(), mPset->items[i].value);
     }
+
+    if (debugPrint)
+        ALOGD("sent properties: %d, skipped properties: %d", drmModeAtomicGetCursor(mPset),
+                mSkippedPropertyNum);
+    else
+        result.appendFormat("sent properties: %d, skipped properties: %d\n",
+                drmModeAtomicGetCursor(mPset), mSkippedPropertyNum);
     return result;
 }
 
+void ExynosDisplayDrmInterface::DrmModeAtomicReq::applyPendingProperties()
+{
+    Mutex::Autolock lock(sCommittedPropertiesMutex);
+    for (auto &property : mPendingProperties)
+        sCommittedProperties[property.first] = property.second;
+    mPendingProperties.clear();
+}
+
 int ExynosDisplayDrmInterface::DrmModeAtomicReq::commit(uint32_t flags, bool loggingForDebug)
 {
     ATRACE_NAME("drmModeAtomicCommit");
-    android::String8 result;
 
     /*
      * During kernel is in TUI, all atomic commits should be returned with error EPERM(-1).
@@ -2026,8 +3046,18 @@ int ExynosDisplayDrmInterface::DrmModeAtomicReq::commit(uint32_t flags, bool log
      */
     int ret = drmModeAtomicCommit(mDrmDisplayInterface->mDrmDevice->fd(),
             mPset, flags, mDrmDisplayInterface->mDrmDevice);
+    return handleCommitResult(ret, flags, loggingForDebug);
+}
+
+int ExynosDisplayDrmInterface::DrmModeAtomicReq::handleCommitResult(int ret, uint32_t flags,
+        bool loggingForDebug)
+{
+    android::String8 result;
+
     if (loggingForDebug)
         dumpAtomicCommitInfo(result, true);
+    if ((ret == 0) && !(flags & DRM_MODE_ATOMIC_TEST_ONLY))
+        applyPendingProperties();
     if ((ret == -EPERM) && mDrmDisplayInterface->mDrmDevice->event_listener()->IsDrmInTUI()) {
         ALOGV("skip atomic commit error handling as kernel is in TUI");
         ret = NO_ERROR;
@@ -2042,9 +3072,9 @@ int ExynosDisplayDrmInterface::DrmModeAtomicReq::commit(uint32_t flags, bool log
 std::tuple<uint64_t, int> ExynosDisplayDrmInterface::halToDrmEnum(
         const int32_t halData, const DrmPropertyMap &drmEnums)
 {
-    auto it = drmEnums.find(halData);
-    if (it != drmEnums.end()) {
-        return std::make_tuple(it->second, 0);
+    uint64_t drmEnum = 0;
+    if (drmEnums.get(halData, drmEnum)) {
+        return std::make_tuple(drmEnum, 0);
     } else {
         HWC_LOGE(NULL, "%s::Failed to find standard enum(%d)",
                 __func__, halData);
@@ -2154,7 +3184,13 @@ int32_t ExynosDisplayDrmInterface::clearWritebackCommit(DrmModeAtomicReq &drmReq
 void ExynosDisplayDrmInterface::DrmReadbackInfo::init(DrmDevice *drmDevice, uint32_t displayId)
 {
     mDrmDevice = drmDevice;
-    mWritebackConnector = mDrmDevice->AvailableWritebackConnector(displayId);
+    mDisplayId = displayId;
+}
+
+void ExynosDisplayDrmInterface::DrmReadbackInfo::loadWritebackConnector()
+{
+    mLoaded = true;
+    mWritebackConnector = mDrmDevice->AvailableWritebackConnector(mDisplayId);
     if (mWritebackConnector == NULL) {
         ALOGI("writeback is not supported");
         return;
@@ -2193,6 +3229,8 @@ void ExynosDisplayDrmInterface::DrmReadbackInfo::init(DrmDevice *drmDevice, uint
 
 void ExynosDisplayDrmInterface::DrmReadbackInfo::pickFormatDataspace()
 {
+    if (!mLoaded)
+        loadWritebackConnector();
     if (!mSupportedFormats.empty())
         mReadbackFormat = mSupportedFormats[0];
     auto it = std::find(mSupportedFormats.begin(),
@@ -2275,6 +3313,19 @@ int32_t ExynosDisplayDrmInterface::getDisplayIdentificationData(
 
     if (outPort == nullptr || outDataSize == nullptr) return HWC2_ERROR_BAD_PARAMETER;
 
+    /* EDID read by the last UpdateModes() */
+    const std::vector<uint8_t> &edid = mDrmConnector->edid();
+    if (!edid.empty()) {
+        if (outData) {
+            *outDataSize = std::min(*outDataSize, static_cast<uint32_t>(edid.size()));
+            memcpy(outData, edid.data(), *outDataSize);
+        } else {
+            *outDataSize = static_cast<uint32_t>(edid.size());
+        }
+        *outPort = mDrmConnector->id();
+        return HWC2_ERROR_NONE;
+    }
+
     drmModePropertyBlobPtr blob;
     int ret;
     uint64_t blobId;
@@ -2355,13 +3406,17 @@ void ExynosDisplayDrmInterface::getBrightnessInterfaceSupport() {
     mBrightnessState.reset();
     mBrightnessCtrl.reset();
 
-    mHbmModeFd = fopen(kHbmModeFileNode, "w+");
-    if (mHbmModeFd == NULL) ALOGE("%s open failed! %s", kHbmModeFileNode, strerror(errno));
+    int fd = open(kHbmModeFileNode, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) ALOGE("%s open failed! %s", kHbmModeFileNode, strerror(errno));
+    mBrightnessSysfsWorker.setFd(BrightnessSysfsWorker::NODE_HBM_MODE, fd);
 
-    mDimmingOnFd = fopen(kDimmingOnFileNode, "w+");
-    if (mDimmingOnFd == NULL) ALOGE("%s open failed! %s", kDimmingOnFileNode, strerror(errno));
+    fd = open(kDimmingOnFileNode, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) ALOGE("%s open failed! %s", kDimmingOnFileNode, strerror(errno));
+    mBrightnessSysfsWorker.setFd(BrightnessSysfsWorker::NODE_DIMMING_ON, fd);
 
-    if (mDimmingOnFd) {
+    mBrightnessSysfsWorker.init();
+
+    if (mBrightnessSysfsWorker.hasFd(BrightnessSysfsWorker::NODE_DIMMING_ON)) {
         mBrightnessDimmingUsage = static_cast<BrightnessDimmingUsage>(
                 property_get_int32("vendor.display.brightness.dimming.usage", 0));
         mHbmDimmingTimeUs =
@@ -2411,28 +3466,155 @@ int32_t ExynosDisplayDrmInterface::updateBrightness(bool syncFrame) {
     // this change will be part of next atomic call for frame update
     if (syncFrame) return NO_ERROR;
 
-    if (mDimmingOnFd && mBrightnessCtrl.DimmingOn.is_dirty()) {
-        writeFileNode(mDimmingOnFd, mBrightnessCtrl.DimmingOn.get());
+    /* The node of the display is opened by the display after this interface is initialized */
+    if (!mBrightnessSysfsWorker.hasFd(BrightnessSysfsWorker::NODE_BRIGHTNESS) &&
+        mExynosDisplay->mBrightnessFd) {
+        mBrightnessSysfsWorker.setFd(BrightnessSysfsWorker::NODE_BRIGHTNESS,
+                fcntl(fileno(mExynosDisplay->mBrightnessFd), F_DUPFD_CLOEXEC, 0));
+    }
+
+    if (mBrightnessSysfsWorker.hasFd(BrightnessSysfsWorker::NODE_DIMMING_ON) &&
+        mBrightnessCtrl.DimmingOn.is_dirty()) {
+        mBrightnessSysfsWorker.request(BrightnessSysfsWorker::NODE_DIMMING_ON,
+                mBrightnessCtrl.DimmingOn.get());
         mBrightnessCtrl.DimmingOn.clear_dirty();
     }
 
     if (mBrightnessCtrl.HbmMode.is_dirty() && !mBrightnessState.dimSdrTransition()) {
-        if (mHbmModeFd) {
-            writeFileNode(mHbmModeFd, mBrightnessCtrl.HbmMode.get());
+        if (mBrightnessSysfsWorker.hasFd(BrightnessSysfsWorker::NODE_HBM_MODE)) {
+            mBrightnessSysfsWorker.request(BrightnessSysfsWorker::NODE_HBM_MODE,
+                    mBrightnessCtrl.HbmMode.get());
             mBrightnessCtrl.HbmMode.clear_dirty();
         } else {
             ALOGW("Fail to set hbm_mode by sysfs");
         }
     }
 
-    if (mExynosDisplay->mBrightnessFd && mBrightnessLevel.is_dirty()) {
-        writeFileNode(mExynosDisplay->mBrightnessFd, mBrightnessLevel.get());
+    if (mBrightnessSysfsWorker.hasFd(BrightnessSysfsWorker::NODE_BRIGHTNESS) &&
+        mBrightnessLevel.is_dirty()) {
+        mBrightnessSysfsWorker.request(BrightnessSysfsWorker::NODE_BRIGHTNESS,
+                mBrightnessLevel.get());
         mBrightnessLevel.clear_dirty();
     }
 
     return HWC2_ERROR_NONE;
 }
 
+ExynosDisplayDrmInterface::BrightnessSysfsWorker::BrightnessSysfsWorker()
+      : Worker("BrightnessSysfs", ThreadRole::DISPLAY_URGENT) {}
+
+ExynosDisplayDrmInterface::BrightnessSysfsWorker::~BrightnessSysfsWorker()
+{
+    Exit();
+    for (auto &node : mNodes) {
+        if (node.fd >= 0)
+            close(node.fd);
+    }
+}
+
+void ExynosDisplayDrmInterface::BrightnessSysfsWorker::setFd(node_t node, int fd)
+{
+    Lock();
+    if (mNodes[node].fd >= 0)
+        close(mNodes[node].fd);
+    mNodes[node].fd = fd;
+    Unlock();
+}
+
+void ExynosDisplayDrmInterface::BrightnessSysfsWorker::request(node_t node, uint32_t value)
+{
+    Lock();
+    Node &n = mNodes[node];
+    if (n.pending)
+        n.coalesced++;
+    else
+        n.requestTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    n.pending = true;
+    n.value = value;
+    Signal();
+    Unlock();
+}
+
+void ExynosDisplayDrmInterface::BrightnessSysfsWorker::Routine()
+{
+    struct {
+        bool pending;
+        int fd;
+        uint32_t value;
+        nsecs_t requestTime;
+    } writes[NODE_MAX];
+
+    Lock();
+    bool pending = false;
+    for (auto &node : mNodes)
+        pending |= node.pending;
+    if (!pending && (WaitForSignalOrExitLocked() == -EINTR)) {
+        Unlock();
+        return;
+    }
+    for (size_t i = 0; i < NODE_MAX; i++) {
+        writes[i] = {mNodes[i].pending, mNodes[i].fd, mNodes[i].value, mNodes[i].requestTime};
+        mNodes[i].pending = false;
+    }
+    Unlock();
+
+    /* In the order of the nodes, dimming has to be set before the level changes */
+    for (size_t i = 0; i < NODE_MAX; i++) {
+        if (!writes[i].pending || (writes[i].fd < 0))
+            continue;
+
+        ATRACE_NAME("writeBrightnessSysfs");
+        char val[16];
+        int len = snprintf(val, sizeof(val), "%u", writes[i].value);
+        bool failed = (pwrite(writes[i].fd, val, len, 0) != len);
+        if (failed)
+            ALOGE("%s:: failed to write %u to node %zu: %s", __func__, writes[i].value, i,
+                    strerror(errno));
+        nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) - writes[i].requestTime;
+
+        Lock();
+        Node &node = mNodes[i];
+        node.writes++;
+        node.failures += failed;
+        node.latencySumNs += latency;
+        node.latencyMaxNs = std::max(node.latencyMaxNs, latency);
+        Unlock();
+    }
+}
+
+void ExynosDisplayDrmInterface::BrightnessSysfsWorker::dump(String8 &result)
+{
+    static constexpr const char *kNodeNames[NODE_MAX] = {"dimming_on", "hbm_mode",
+                                                          "brightness"};
+
+    Lock();
+    result.appendFormat("Brightness sysfs writes:\n");
+    for (size_t i = 0; i < NODE_MAX; i++) {
+        const Node &node = mNodes[i];
+        result.appendFormat("\t%-10s writes %" PRIu64 ", coalesced %" PRIu64
+                ", failed %" PRIu64 ", latency avg %" PRId64 " us, max %" PRId64 " us\n",
+                kNodeNames[i], node.writes, node.coalesced, node.failures,
+                node.writes ? ns2us(node.latencySumNs / (nsecs_t)node.writes) : 0,
+                ns2us(node.latencyMaxNs));
+    }
+    Unlock();
+}
+
+void ExynosDisplayDrmInterface::dump(String8 &result)
+{
+    mFBManager.dump(result);
+    if (mBrightntessIntfSupported)
+        mBrightnessSysfsWorker.dump(result);
+}
+
+void ExynosDisplayDrmInterface::dumpWorkerWakeups(std::string &result)
+{
+    mDrmVSyncWorker.DumpWakeupStats(result);
+    mDrmVSyncWorker.DumpHubStats(result);
+    if (mBrightntessIntfSupported)
+        mBrightnessSysfsWorker.DumpWakeupStats(result);
+}
+
 void ExynosDisplayDrmInterface::setupBrightnessConfig() {
     if (!mBrightntessIntfSupported) return;
 
@@ -2515,3 +3697,123 @@ void ExynosDisplayDrmInterface::setupBrightnessConfig() {
 
     return;
 }
+
+void DrmCommitCoordinator::init(DrmDevice *drmDevice, bool enabled)
+{
+    mDrmDevice = drmDevice;
+    mEnabled = enabled;
+}
+
+void DrmCommitCoordinator::registerDisplay(ExynosDisplayDrmInterface *display)
+{
+    Mutex::Autolock lock(mMutex);
+    mDisplays.push_back(display);
+    display->setCommitCoordinator(this);
+}
+
+void DrmCommitCoordinator::unregisterDisplay(ExynosDisplayDrmInterface *display)
+{
+    Mutex::Autolock lock(mMutex);
+    mDisplays.erase(std::remove(mDisplays.begin(), mDisplays.end(), display), mDisplays.end());
+    /* Requests of other displays shouldn't wait for this display anymore */
+    mCommitted.broadcast();
+}
+
+size_t DrmCommitCoordinator::numParticipantsLocked()
+{
+    size_t num = 0;
+    for (auto display : mDisplays) {
+        if (display->canCombineCommit())
+            num++;
+    }
+    return num;
+}
+
+int DrmCommitCoordinator::commit(ExynosDisplayDrmInterface *display,
+        ExynosDisplayDrmInterface::DrmModeAtomicReq &drmReq, uint32_t flags)
+{
+    Mutex::Autolock lock(mMutex);
+    PendingCommit pending = {&drmReq, flags};
+    mPending.push_back(&pending);
+
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + kGatherTimeoutNs;
+    while (!pending.done) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if ((mPending.size() >= numParticipantsLocked()) || (now >= deadline)) {
+            commitPendingLocked();
+            break;
+        }
+        ATRACE_NAME("gather commits");
+        mCommitted.waitRelative(mMutex, deadline - now);
+    }
+    HDEBUGLOGD(eDebugDisplayInterfaceConfig, "%s:: %s commit ret(%d)", __func__,
+            display->mExynosDisplay->mDisplayName.string(), pending.ret);
+    return pending.ret;
+}
+
+void DrmCommitCoordinator::commitPendingLocked()
+{
+    std::vector<PendingCommit *> pendings;
+    pendings.swap(mPending);
+
+    if (pendings.size() == 1) {
+        pendings[0]->ret = pendings[0]->drmReq->commit(pendings[0]->flags, true);
+        pendings[0]->done = true;
+        mSingleCommitCount++;
+        mCommitted.broadcast();
+        return;
+    }
+
+    ATRACE_NAME("drmModeAtomicCommit(combined)");
+    int ret = NO_ERROR;
+    uint32_t flags = 0;
+    bool nonblock = true;
+    drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
+    if (pset == NULL)
+        ret = -ENOMEM;
+    for (auto pending : pendings) {
+        if ((ret == NO_ERROR) && (drmModeAtomicMerge(pset, pending->drmReq->pset()) < 0))
+            ret = -ENOMEM;
+        flags |= pending->flags;
+        nonblock &= !!(pending->flags & DRM_MODE_ATOMIC_NONBLOCK);
+    }
+    /* A blocking request keeps the combined commit blocking */
+    if (!nonblock)
+        flags &= ~DRM_MODE_ATOMIC_NONBLOCK;
+    /*
+     * A display disables planes it doesn't use, a plane moving to another
+     * display in this round is enabled again as the last property wins.
+     */
+    for (auto pending : pendings) {
+        for (auto &enable : pending->drmReq->getPlaneEnables()) {
+            if (ret != NO_ERROR)
+                break;
+            if ((drmModeAtomicAddProperty(pset, enable.planeId, enable.crtcPropId,
+                            enable.crtcId) < 0) ||
+                (drmModeAtomicAddProperty(pset, enable.planeId, enable.fbPropId,
+                                          enable.fbId) < 0))
+                ret = -ENOMEM;
+        }
+    }
+    if (ret == NO_ERROR)
+        ret = drmModeAtomicCommit(mDrmDevice->fd(), pset, flags, mDrmDevice);
+    else
+        ALOGE("%s:: Failed to merge %zu requests", __func__, pendings.size());
+    if (pset != NULL)
+        drmModeAtomicFree(pset);
+
+    for (auto pending : pendings) {
+        pending->ret = pending->drmReq->handleCommitResult(ret, flags, true);
+        pending->done = true;
+    }
+    mCombinedCommitCount++;
+    mCommitted.broadcast();
+}
+
+void DrmCommitCoordinator::dump(String8 &result)
+{
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("Combined commit: %s, displays(%zu), combined(%" PRIu64
+            "), single(%" PRIu64 ")\n", mEnabled ? "enabled" : "disabled",
+            mDisplays.size(), mCombinedCommitCount, mSingleCommitCount);
+}
@@ -18,12 +18,17 @@
 #define _EXYNOSDISPLAYDRMINTERFACE_H
 
 #include <drm/samsung_drm.h>
+#include <sys/types.h>
 #include <utils/Condition.h>
 #include <utils/Mutex.h>
 #include <xf86drmMode.h>
 
 #include <list>
+#include <map>
+#include <memory>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "ExynosDisplay.h"
 #include "ExynosDisplayInterface.h"
@@ -32,6 +37,7 @@
 #include "drmconnector.h"
 #include "drmcrtc.h"
 #include "vsyncworker.h"
+#include "worker.h"
 
 /* Max plane number of buffer object */
 #define HWC_DRM_BO_MAX_PLANES 4
@@ -41,9 +47,62 @@
 #endif
 
 using namespace android;
-using DrmPropertyMap = std::unordered_map<uint32_t, uint64_t>;
+
+/*
+ * HAL value to DRM enum value table. HAL values are small, optionally
+ * shifted integers, so the table is a dense array indexed by
+ * (halValue >> shift) that is filled once at parse time.
+ */
+class DrmPropertyMap {
+    public:
+        static constexpr uint32_t kMaxEntries = 64;
+
+        explicit DrmPropertyMap(uint32_t shift = 0) : mShift(shift){};
+
+        uint32_t index(uint32_t halValue) const { return halValue >> mShift; }
+        bool set(uint32_t halValue, uint64_t drmValue) {
+            uint32_t idx = index(halValue);
+            if ((idx >= kMaxEntries) || ((idx << mShift) != halValue))
+                return false;
+            if (idx >= mTable.size())
+                mTable.resize(idx + 1);
+            if (!mTable[idx].valid)
+                mEntries.emplace_back(halValue, drmValue);
+            else
+                for (auto &e : mEntries)
+                    if (e.first == halValue) e.second = drmValue;
+            mTable[idx] = {true, drmValue};
+            return true;
+        }
+        bool get(uint32_t halValue, uint64_t &drmValue) const {
+            uint32_t idx = index(halValue);
+            if ((idx >= mTable.size()) || !mTable[idx].valid ||
+                ((idx << mShift) != halValue))
+                return false;
+            drmValue = mTable[idx].value;
+            return true;
+        }
+        size_t tableSize() const { return mTable.size(); }
+        /* Iterates the parsed (hal, drm) pairs in parse order */
+        std::vector<std::pair<uint32_t, uint64_t>>::const_iterator begin() const {
+            return mEntries.begin();
+        }
+        std::vector<std::pair<uint32_t, uint64_t>>::const_iterator end() const {
+            return mEntries.end();
+        }
+
+    private:
+        struct Entry {
+            bool valid = false;
+            uint64_t value = 0;
+        };
+        uint32_t mShift;
+        std::vector<Entry> mTable;
+        std::vector<std::pair<uint32_t, uint64_t>> mEntries;
+};
 
 class ExynosDevice;
+class DrmCommitCoordinator;
 
 using BufHandles = std::array<uint32_t, HWC_DRM_BO_MAX_PLANES>;
 class FramebufferManager {
@@ -58,6 +117,10 @@ class FramebufferManager {
         // layer. Those fbIds will be cleaned up once the layer was destroyed.
         int32_t getBuffer(const exynos_win_config_data &config, uint32_t &fbId);
 
+        // get the fbId of the client target returned by the last getBuffer() call if it was
+        // created for bufferId, otherwise 0. It lets an unchanged client target skip getBuffer().
+        uint32_t getLastClientTargetFbId(uint64_t bufferId);
+
         bool checkShrink();
 
         void cleanup(const ExynosLayer *layer);
@@ -69,8 +132,16 @@ class FramebufferManager {
         void flip(bool hasSecureFrameBuffer);
 
         // release all currently tracked buffers, this can be called for example when display is turned
-        // off
-        void releaseAll();
+        // off. underPressure counts it as the last step of the -ENOMEM eviction.
+        void releaseAll(bool underPressure = false);
+
+        // Frees the framebuffers of layers that were not presented for
+        // kColdLayerFrames and the framebuffers that are older than the
+        // newest keepBuffers of their layer, so that a commit that failed
+        // with -ENOMEM can be retried. Returns the number of freed framebuffers.
+        size_t evictUnderPressure(size_t keepBuffers);
+
+        void dump(String8 &result);
 
     private:
         // this struct should contain elements that can be used to identify framebuffer more easily
@@ -90,59 +161,157 @@ class FramebufferManager {
                 }
             };
 
+            struct BufferDescHash {
+                size_t operator()(const BufferDesc &desc) const {
+                    size_t seed = 0;
+                    hash_combine(seed, desc.bufferId);
+                    hash_combine(seed, desc.drmFormat);
+                    return seed;
+                }
+            };
+
             explicit Framebuffer(int fd, uint32_t fb, BufferDesc desc)
-                  : drmFd(fd), fbId(fb), bufferDesc(desc){};
+                  : drmFd(fd), fbId(fb), isSolidColor(false), bufferDesc(desc){};
             explicit Framebuffer(int fd, uint32_t fb, SolidColorDesc desc)
-                  : drmFd(fd), fbId(fb), colorDesc(desc){};
-            ~Framebuffer() { drmModeRmFB(drmFd, fbId); };
+                  : drmFd(fd), fbId(fb), isSolidColor(true), colorDesc(desc){};
+            ~Framebuffer() {
+                drmModeRmFB(drmFd, fbId);
+                for (uint32_t i = 0; i < handleNum; i++)
+                    putBufHandle(drmFd, handleInodes[i], handles[i]);
+            };
             int drmFd;
             uint32_t fbId;
+            bool isSolidColor;
+            // GEM handles referenced by this framebuffer, see getBufHandleFromFd()
+            uint32_t handleNum = 0;
+            BufHandles handles = {0};
+            std::array<ino_t, HWC_DRM_BO_MAX_PLANES> handleInodes = {0};
             union {
                 BufferDesc bufferDesc;
                 SolidColorDesc colorDesc;
             };
         };
-        using FBList = std::list<std::unique_ptr<Framebuffer>>;
+        // Framebuffers of the same buffer are shared by the layers presenting it
+        using FBList = std::list<std::shared_ptr<Framebuffer>>;
+
+        // Cached framebuffers of a layer. buffers is kept in LRU order (most
+        // recently used first) and bufferIndex maps the descriptor of each
+        // buffer framebuffer to its node in buffers.
+        struct LayerFBCache {
+            FBList buffers;
+            std::unordered_map<Framebuffer::BufferDesc, FBList::iterator,
+                               Framebuffer::BufferDescHash>
+                    bufferIndex;
+            // mFlipCount when the layer was presented last
+            uint64_t lastUsedFlip = 0;
+        };
+
+        enum EvictReason {
+            EVICT_COLD_LAYER,
+            EVICT_OUTSIDE_WINDOW,
+            EVICT_RELEASE_ALL,
+            EVICT_REASON_MAX,
+        };
 
         template <class UnaryPredicate>
         uint32_t findCachedFbId(const ExynosLayer *layer, UnaryPredicate predicate);
+        uint32_t findCachedFbId(const ExynosLayer *layer, const Framebuffer::BufferDesc &desc);
         int addFB2WithModifiers(uint32_t width, uint32_t height, uint32_t pixel_format,
                         const BufHandles handles, const uint32_t pitches[4],
                         const uint32_t offsets[4], const uint64_t modifier[4], uint32_t *buf_id,
                         uint32_t flags);
-        uint32_t getBufHandleFromFd(int fd);
-        void freeBufHandle(uint32_t handle);
+        uint32_t getBufHandleFromFd(int fd, ino_t &inode);
+        static void putBufHandle(int drmFd, ino_t inode, uint32_t handle);
+        static void freeBufHandle(int drmFd, uint32_t handle);
         void removeFBsThreadRoutine();
 
-        void markInuseLayerLocked(const ExynosLayer *layer) REQUIRES(mMutex);
+        void addCachedBufferLocked(LayerFBCache &cache, std::shared_ptr<Framebuffer> buffer)
+                REQUIRES(mMutex);
+        void pruneSharedBuffersLocked() REQUIRES(mMutex);
+        LayerFBCache &markInuseLayerLocked(const ExynosLayer *layer) REQUIRES(mMutex);
         void destroyUnusedLayersLocked() REQUIRES(mMutex);
         void destroyFramebufferLocked() REQUIRES(mMutex);
+        void updateLastClientTarget(const exynos_win_config_data &config);
+        void addSecureBufferLocked(const std::shared_ptr<Framebuffer> &buffer) REQUIRES(mMutex);
+        void touchSecureBufferLocked(uint32_t fbId) REQUIRES(mMutex);
+        void preRegisterSecureBuffers(const exynos_win_config_data &config);
 
         int mDrmFd = -1;
 
         // mCachedLayerBuffers map keep the relationship between Layer and
-        // FBList. The map entry will be deleted once the layer is destroyed.
-        std::map<const ExynosLayer *, FBList> mCachedLayerBuffers;
+        // LayerFBCache. The map entry will be deleted once the layer is destroyed.
+        std::unordered_map<const ExynosLayer *, LayerFBCache> mCachedLayerBuffers;
 
         // mCleanBuffers list keeps fbIds of destroyed layers. Those fbIds will
         // be destroyed in mRmFBThread thread.
         FBList mCleanBuffers;
 
+        // mSharedBuffers indexes buffer framebuffers cached by any layer, so
+        // that a buffer moved to another layer reuses its fbId. It doesn't own
+        // the framebuffers, expired entries are pruned in flip().
+        std::unordered_map<Framebuffer::BufferDesc, std::weak_ptr<Framebuffer>,
+                           Framebuffer::BufferDescHash>
+                mSharedBuffers;
+
         // mCacheShrinkPending is set when we want to clean up unused layers
         // in mCachedLayerBuffers. When the flag is set, mCachedLayersInuse will
         // keep in-use layers in this frame update. Those unused layers will be
         // freed at the end of the update.
         bool mCacheShrinkPending = false;
         bool mHasSecureFramebuffer = false;
+
+        // mSecureBuffers keeps framebuffers of protected layer buffers in LRU
+        // order, up to mMaxSecureBuffers (the number of buffers the TEE can
+        // protect). They outlive the layer caches, so that a protected video
+        // finds its buffers through mSharedBuffers across secure/non-secure
+        // transitions instead of importing them again.
+        FBList mSecureBuffers;
+        size_t mMaxSecureBuffers = kDefaultMaxSecureBuffers;
+
+        // Framebuffer of the last client target. It is kept even if evicted
+        // from the cache so that its fbId stays valid while it is reused.
+        std::shared_ptr<Framebuffer> mLastClientTarget;
         std::set<const ExynosLayer *> mCachedLayersInuse;
 
+        uint64_t mFlipCount = 0;
+        uint64_t mEvictCounts[EVICT_REASON_MAX] = {};
+
         std::thread mRmFBThread;
         bool mRmFBThreadRunning = false;
         Condition mFlipDone;
         Mutex mMutex;
 
+        // GEM handles imported from dma-bufs, keyed by drm fd and dma-buf
+        // inode. A handle is kept while any framebuffer still references it.
+        // PRIME import returns the same handle for the same drm fd, so the
+        // cache is shared by all FramebufferManagers.
+        struct BufHandleKey {
+            int drmFd;
+            ino_t inode;
+            bool operator==(const BufHandleKey &rhs) const {
+                return (drmFd == rhs.drmFd && inode == rhs.inode);
+            }
+        };
+        struct BufHandleKeyHash {
+            size_t operator()(const BufHandleKey &key) const {
+                size_t seed = 0;
+                hash_combine(seed, key.drmFd);
+                hash_combine(seed, key.inode);
+                return seed;
+            }
+        };
+        struct BufHandleRef {
+            uint32_t handle;
+            uint32_t refCount;
+        };
+        static Mutex sBufHandleMutex;
+        static std::unordered_map<BufHandleKey, BufHandleRef, BufHandleKeyHash> sBufHandles
+                GUARDED_BY(sBufHandleMutex);
+
         static constexpr size_t MAX_CACHED_LAYERS = 16;
         static constexpr size_t MAX_CACHED_BUFFERS_PER_LAYER = 32;
+        static constexpr size_t kDefaultMaxSecureBuffers = 16;
+        static constexpr uint64_t kColdLayerFrames = 4;
 };
 
 inline bool isFramebuffer(const ExynosLayer *layer) {
@@ -152,10 +321,12 @@ inline bool isFramebuffer(const ExynosLayer *layer) {
 template <class UnaryPredicate>
 uint32_t FramebufferManager::findCachedFbId(const ExynosLayer *layer, UnaryPredicate predicate) {
     Mutex::Autolock lock(mMutex);
-    markInuseLayerLocked(layer);
-    const auto &cachedBuffers = mCachedLayerBuffers[layer];
+    auto &cachedBuffers = markInuseLayerLocked(layer).buffers;
     const auto it = std::find_if(cachedBuffers.begin(), cachedBuffers.end(), predicate);
-    return (it != cachedBuffers.end()) ? (*it)->fbId : 0;
+    if (it == cachedBuffers.end()) return 0;
+
+    cachedBuffers.splice(cachedBuffers.begin(), cachedBuffers, it);
+    return (*it)->fbId;
 }
 
 class ExynosDisplayDrmInterface :
@@ -185,6 +356,9 @@ class ExynosDisplayDrmInterface :
                     mPset = mSavedPset;
                     mSavedPset = NULL;
                 }
+                uint32_t getSkippedPropertyNum() { return mSkippedPropertyNum; };
+                /* Record added properties as committed before commit() */
+                void applyPendingProperties();
 
                 void setError(int err) { mError = err; };
                 int getError() { return mError; };
@@ -193,7 +367,25 @@ class ExynosDisplayDrmInterface :
                         uint64_t value, bool optional = false);
                 String8& dumpAtomicCommitInfo(String8 &result, bool debugPrint = false);
                 int commit(uint32_t flags, bool loggingForDebug = false);
+                /* Result of committing mPset, alone or merged by DrmCommitCoordinator */
+                int handleCommitResult(int ret, uint32_t flags, bool loggingForDebug);
+                struct PlaneEnable {
+                    uint32_t planeId;
+                    uint32_t crtcPropId;
+                    uint32_t crtcId;
+                    uint32_t fbPropId;
+                    uint32_t fbId;
+                };
+                /* Planes attached to the crtc by this request */
+                void addPlaneEnable(const PlaneEnable &enable) {
+                    mPlaneEnables.push_back(enable);
+                };
+                const std::vector<PlaneEnable>& getPlaneEnables() { return mPlaneEnables; };
                 void addOldBlob(uint32_t blob_id) {
+                    /* Cached mode and color blobs are destroyed by the interface */
+                    if (mDrmDisplayInterface->isCachedModeBlob(blob_id) ||
+                        mDrmDisplayInterface->isCachedColorBlob(blob_id))
+                        return;
                     mOldBlobs.push_back(blob_id);
                 };
                 int destroyOldBlobs() {
@@ -215,6 +407,13 @@ class ExynosDisplayDrmInterface :
                 ExynosDisplayDrmInterface *mDrmDisplayInterface = NULL;
                 /* Destroy old blobs after commit */
                 std::vector<uint32_t> mOldBlobs;
+                /* Properties added to mPset, applied to committed properties after commit */
+                std::unordered_map<uint64_t, uint64_t> mPendingProperties;
+                /* Number of properties skipped because they are already committed */
+                uint32_t mSkippedPropertyNum = 0;
+                std::vector<PlaneEnable> mPlaneEnables;
+                bool canSkipProperty(const uint32_t id, const DrmProperty &property,
+                                     uint64_t value);
                 int drmFd() const { return mDrmDisplayInterface->mDrmDevice->fd(); }
         };
         class ExynosVsyncCallback {
@@ -255,18 +454,30 @@ class ExynosDisplayDrmInterface :
                 uint32_t* outNumConfigs,
                 hwc2_config_t* outConfigs);
         virtual void dumpDisplayConfigs();
+        /* Builds mDisplayConfigs from the connector modes and publishes them */
+        void buildDisplayConfigs();
+        virtual void dump(String8& result) override;
+        virtual void dumpWorkerWakeups(std::string& result) override;
         virtual bool supportDataspace(int32_t dataspace);
+        virtual bool supportBackgroundColor() override;
         virtual int32_t getColorModes(uint32_t* outNumModes, int32_t* outModes);
         virtual int32_t setColorMode(int32_t mode);
         virtual int32_t setActiveConfig(hwc2_config_t config);
         virtual int32_t setCursorPositionAsync(uint32_t x_pos, uint32_t y_pos);
         virtual int32_t updateHdrCapabilities();
+        virtual int32_t preparePreferredConfig();
         virtual int32_t deliverWinConfigData();
+        virtual bool hasPendingDisplayUpdate();
+        virtual int32_t testWinConfigData(exynos_dpu_data &dpuData);
         virtual int32_t clearDisplay(bool needModeClear = false);
         virtual int32_t disableSelfRefresh(uint32_t disable);
+        virtual void onSelfRefreshChanged(bool active);
         virtual int32_t setForcePanic();
         virtual int getDisplayFd() { return mDrmDevice->fd(); };
         virtual int32_t initDrmDevice(DrmDevice *drmDevice);
+        void setCommitCoordinator(DrmCommitCoordinator *coordinator) {
+            mCommitCoordinator = coordinator;
+        };
         virtual uint32_t getDrmDisplayId(uint32_t type, uint32_t index);
         virtual uint32_t getMaxWindowNum();
         virtual int32_t getReadbackBufferAttributes(int32_t* /*android_pixel_format_t*/ outFormat,
@@ -278,11 +489,20 @@ class ExynosDisplayDrmInterface :
         virtual int32_t getDisplayVsyncPeriod(
                 hwc2_vsync_period_t* outVsyncPeriod);
         virtual int32_t getConfigChangeDuration();
+        virtual int32_t getConfigSwitchDuration(hwc2_config_t config);
         virtual int32_t getVsyncAppliedTime(hwc2_config_t config,
                 int64_t* actualChangeTime);
         virtual int32_t setActiveConfigWithConstraints(
                 hwc2_config_t config, bool test = false);
 
+        /*
+         * Get a blob for color data (LUT, matrix, ...) from the color blob
+         * pool of the display. A blob with the same content is reused, so an
+         * unchanged property is skipped by DrmModeAtomicReq. The blob is
+         * owned by the pool and should not be destroyed by the caller.
+         */
+        int32_t getColorBlob(DrmModeAtomicReq &drmReq, const void *data, size_t size,
+                uint32_t &blobId);
         virtual int32_t setDisplayColorSetting(
                 ExynosDisplayDrmInterface::DrmModeAtomicReq &drmReq)
         { return NO_ERROR;};
@@ -323,7 +543,27 @@ class ExynosDisplayDrmInterface :
                 reset();
             };
         };
+        /*
+         * Refresh switch model. The number of vsyncs from the commit of a
+         * mode until its first vsync depends on the panel (sync_rr_switch,
+         * seamless or not), it is learned for each (from, to) mode pair when
+         * the vsync period of the new mode is observed.
+         */
+        struct ConfigSwitch {
+            uint32_t fromMode = 0;
+            uint32_t toMode = 0;
+            int64_t commitTime = 0;
+            int64_t fromPeriod = 0;
+        };
+        ConfigSwitch mCommittedSwitch;
+        std::map<std::pair<uint32_t, uint32_t>, int32_t> mConfigSwitchDurations;
+        void learnConfigSwitchDuration(int64_t firstVsync);
+        static constexpr int32_t kMaxConfigSwitchDuration = 8;
         int32_t createModeBlob(const DrmMode &mode, uint32_t &modeBlob);
+        bool isCachedModeBlob(uint32_t blobId);
+        bool isCachedColorBlob(uint32_t blobId);
+        /* Destroy blobs of the modes that are removed by UpdateModes() */
+        void updateModeBlobs();
         int32_t setDisplayMode(DrmModeAtomicReq &drmReq, const uint32_t modeBlob);
 	int32_t clearDisplayMode(DrmModeAtomicReq &drmReq);
         int32_t chosePreferredConfig();
@@ -348,6 +588,10 @@ class ExynosDisplayDrmInterface :
         void parseStandardEnums(const DrmProperty &property);
         void parseTransferEnums(const DrmProperty &property);
         void parseRangeEnums(const DrmProperty &property);
+        /* Combines standard/transfer/range tables, needs all three parsed */
+        void buildDataspaceEnums();
+        int32_t dataspaceToDrmEnums(const int32_t dataspace, uint64_t &standard,
+                uint64_t &transfer, uint64_t &range) const;
         void parseColorModeEnums(const DrmProperty &property);
 
         int32_t setupWritebackCommit(DrmModeAtomicReq &drmReq);
@@ -360,13 +604,20 @@ class ExynosDisplayDrmInterface :
 
     protected:
         struct PartialRegionState {
-            struct drm_clip_rect partial_rect = {0, 0, 0, 0};
+            struct drm_clip_rect partial_rects[MAX_WIN_UPDATE_REGIONS] = {};
+            uint32_t rect_num = 0;
             uint32_t blob_id = 0;
-            bool isUpdated(drm_clip_rect rect) {
-                return ((partial_rect.x1 != rect.x1) ||
-                        (partial_rect.y1 != rect.y1) ||
-                        (partial_rect.x2 != rect.x2) ||
-                        (partial_rect.y2 != rect.y2));
+            bool isUpdated(const drm_clip_rect *rects, uint32_t num) {
+                if (rect_num != num)
+                    return true;
+                for (uint32_t i = 0; i < num; i++) {
+                    if ((partial_rects[i].x1 != rects[i].x1) ||
+                        (partial_rects[i].y1 != rects[i].y1) ||
+                        (partial_rects[i].x2 != rects[i].x2) ||
+                        (partial_rects[i].y2 != rects[i].y2))
+                        return true;
+                }
+                return false;
             };
         };
 
@@ -381,7 +632,12 @@ class ExynosDisplayDrmInterface :
                     if (mFbId > 0)
                         drmModeRmFB(mDrmDevice->fd(), mFbId);
                 }
-                DrmConnector* getWritebackConnector() { return mWritebackConnector; };
+                /* Writeback connector is looked up at the first use */
+                DrmConnector* getWritebackConnector(bool load = true) {
+                    if (load && !mLoaded)
+                        loadWritebackConnector();
+                    return mWritebackConnector;
+                };
                 void setFbId(uint32_t fbId) {
                     if ((mDrmDevice != NULL) && (mOldFbId > 0))
                         drmModeRmFB(mDrmDevice->fd(), mOldFbId);
@@ -394,12 +650,29 @@ class ExynosDisplayDrmInterface :
                 uint32_t mReadbackFormat = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
                 bool mNeedClearReadbackCommit = false;
             private:
+                void loadWritebackConnector();
                 DrmDevice *mDrmDevice = NULL;
+                uint32_t mDisplayId = 0;
+                bool mLoaded = false;
                 DrmConnector *mWritebackConnector = NULL;
                 uint32_t mFbId = 0;
                 uint32_t mOldFbId = 0;
                 std::vector<uint32_t> mSupportedFormats;
         };
+        /*
+         * Cursor window of the last commit. setCursorPositionAsync() moves its
+         * plane with a commit of the plane position only, planeId 0 means there
+         * is no cursor on the screen.
+         */
+        struct CursorPlaneState {
+            uint32_t planeId = 0;
+            struct decon_frame src = {0, 0, 0, 0, 0, 0};
+            struct decon_frame dst = {0, 0, 0, 0, 0, 0};
+        };
+        Mutex mCursorMutex;
+        CursorPlaneState mCursorPlane GUARDED_BY(mCursorMutex);
+        void updateCursorPlane(const CursorPlaneState &state);
+
         DrmDevice *mDrmDevice;
         DrmCrtc *mDrmCrtc;
         DrmConnector *mDrmConnector;
@@ -408,17 +681,111 @@ class ExynosDisplayDrmInterface :
         ModeState mActiveModeState;
         ModeState mDesiredModeState;
         PartialRegionState mPartialRegionState;
+        /*
+         * Mode blobs created by createModeBlob(), key is DrmMode id.
+         * Modes from the connector have unique ids, mode id 0 is not cached.
+         */
+        std::unordered_map<uint32_t, uint32_t> mModeBlobs;
+        /* modes_generation() of the connector that the display configs were built for */
+        uint64_t mModesGeneration = 0;
+        /* HDR capabilities of the monitors seen, key is DrmConnector::edid_hash() */
+        struct HdrCaps {
+            std::vector<android_hdr_t> hdrTypes;
+            float maxLuminance;
+            float maxAverageLuminance;
+            float minLuminance;
+        };
+        static constexpr size_t MAX_HDR_CAPS_CACHE = 4;
+        std::unordered_map<uint64_t, HdrCaps> mHdrCapsCache;
+        /* Color blobs created by getColorBlob(), most recently used first */
+        struct ColorBlob {
+            size_t hash;
+            std::vector<uint8_t> data;
+            uint32_t blobId;
+        };
+        static constexpr size_t MAX_COLOR_BLOBS = 32;
+        std::list<ColorBlob> mColorBlobs;
         /* Mapping plane id to ExynosMPP, key is plane id */
         std::unordered_map<uint32_t, ExynosMPP*> mExynosMPPsForPlane;
 
         DrmPropertyMap mBlendEnums;
-        DrmPropertyMap mStandardEnums;
-        DrmPropertyMap mTransferEnums;
-        DrmPropertyMap mRangeEnums;
+        DrmPropertyMap mStandardEnums{HAL_DATASPACE_STANDARD_SHIFT};
+        DrmPropertyMap mTransferEnums{HAL_DATASPACE_TRANSFER_SHIFT};
+        DrmPropertyMap mRangeEnums{HAL_DATASPACE_RANGE_SHIFT};
         DrmPropertyMap mColorModeEnums;
 
+        /*
+         * Dense standard x transfer x range table so that a plane's
+         * dataspace is translated with a single lookup per frame.
+         */
+        struct DataspaceEnums {
+            bool valid = false;
+            uint64_t standard = 0;
+            uint64_t transfer = 0;
+            uint64_t range = 0;
+        };
+        std::vector<DataspaceEnums> mDataspaceEnums;
+
         DrmReadbackInfo mReadbackInfo;
 
+        /*
+         * Asynchronous commit (DisplayControl::asyncCommit)
+         * deliverWinConfigData() builds the request and queues it to
+         * mCommitThread. The retire fence is a sw_sync fence on
+         * mCommitTimeline, it is signaled after the out fence of the commit.
+         * The kernel accepts one nonblocking commit per crtc, following
+         * requests wait in mCommitJobs until the previous one is flipped.
+         * deliverWinConfigData() waits if DisplayControl::commitQueueDepth
+         * requests are already queued.
+         *
+         * With DisplayControl::lateLatch, mCommitThread holds a request whose
+         * acquire fences are signaled until mLatchMargin before the next vsync
+         * predicted by mDrmVSyncWorker. The margin doubles when the frame
+         * misses that vsync and shrinks slowly while frames make it.
+         */
+        struct CommitJob {
+            std::unique_ptr<DrmModeAtomicReq> drmReq;
+            uint32_t flags = 0;
+            /* Written by the kernel through OUT_FENCE_PTR */
+            uint64_t outFence = UINT64_MAX;
+            /* Acquire fences used by drmReq, closed after commit */
+            std::vector<int> acqFences;
+            bool hasSecureFrameBuffer = false;
+            /* Vsync the late latched request is committed for, 0 if not held */
+            int64_t targetVsync = 0;
+        };
+        bool isAsyncCommitAvailable();
+        int createCommitFence();
+        void queueCommitJob(std::unique_ptr<CommitJob> job);
+        void waitForCommitQueue(size_t maxQueued);
+        void waitForPendingCommit() { waitForCommitQueue(0); };
+        bool hasPendingCommit();
+        void commitThreadRoutine();
+        void waitForLatchTime(CommitJob &job);
+        /* Evicts cached framebuffers after -ENOMEM, true if the commit is worth a retry */
+        bool evictFramebuffersForRetry(DrmModeAtomicReq &drmReq);
+        void updateLatchMargin(int outFence, int64_t targetVsync);
+
+        std::thread mCommitThread;
+        bool mCommitThreadRunning = false;
+        bool mCommitThreadFailed = false;
+        std::list<std::unique_ptr<CommitJob>> mCommitJobs;
+        Mutex mCommitMutex;
+        Condition mCommitQueued;
+        Condition mCommitSubmitted;
+        int mCommitTimeline = -1;
+        uint32_t mCommitTimelineValue = 0;
+        int64_t mLatchMargin = kLateLatchInitialMargin;
+        /*
+         * Queued requests of displays sharing the device are merged into one
+         * atomic commit by mCommitCoordinator if it is enabled.
+         */
+        DrmCommitCoordinator *mCommitCoordinator = nullptr;
+        bool canCombineCommit();
+        friend class DrmCommitCoordinator;
+        static constexpr int64_t kLateLatchMinMargin = 1000000;
+        static constexpr int64_t kLateLatchInitialMargin = 4000000;
+
     private:
         DrmMode mDozeDrmMode;
 
@@ -426,8 +793,49 @@ class ExynosDisplayDrmInterface :
         void getBrightnessInterfaceSupport();
         void setupBrightnessConfig();
         void parseHbmModeEnums(const DrmProperty &property);
-        FILE *mHbmModeFd;
-        FILE *mDimmingOnFd;
+        /*
+         * Writes the brightness sysfs nodes off the calling thread through
+         * persistent fds. Only the latest value of a node is written, so the
+         * updates of a brightness ramp that come faster than the writes are
+         * coalesced. The latency is from the first coalesced request to the
+         * end of the write.
+         */
+        class BrightnessSysfsWorker : public Worker {
+            public:
+                enum node_t {
+                    NODE_DIMMING_ON,
+                    NODE_HBM_MODE,
+                    NODE_BRIGHTNESS,
+                    NODE_MAX,
+                };
+
+                BrightnessSysfsWorker();
+                ~BrightnessSysfsWorker() override;
+                void init() { InitWorker(); }
+                /* The worker owns fd */
+                void setFd(node_t node, int fd);
+                bool hasFd(node_t node) const { return mNodes[node].fd >= 0; }
+                void request(node_t node, uint32_t value);
+                void dump(String8 &result);
+
+            protected:
+                void Routine() override;
+
+            private:
+                struct Node {
+                    int fd = -1;
+                    bool pending = false;
+                    uint32_t value = 0;
+                    nsecs_t requestTime = 0;
+                    uint64_t writes = 0;
+                    uint64_t coalesced = 0;
+                    uint64_t failures = 0;
+                    nsecs_t latencySumNs = 0;
+                    nsecs_t latencyMaxNs = 0;
+                };
+                Node mNodes[NODE_MAX];
+        };
+        BrightnessSysfsWorker mBrightnessSysfsWorker;
         bool mBrightntessIntfSupported = false;
         float mBrightnessHbmMax = 1.0f;
         enum class PanelHbmType {
@@ -513,8 +921,67 @@ class ExynosDisplayDrmInterface :
         int32_t mHbmDimmingTimeUs;
         struct timeval mHbmDimmingStart;
 
+    public:
+        /*
+         * Forget the last committed property values, the next commits will
+         * send all properties. It should be called when the kernel state could
+         * be changed without atomic commits of HWC (power mode, TUI, etc).
+         */
+        static void clearCommittedProperties();
+
     private:
         int32_t getDisplayFakeEdid(uint8_t &outPort, uint32_t &outDataSize, uint8_t *outData);
+
+        static uint64_t getCommittedPropertyKey(uint32_t objectId, uint32_t propertyId) {
+            return (static_cast<uint64_t>(objectId) << 32) | propertyId;
+        }
+        /*
+         * Last committed values of crtc and plane properties, keyed by
+         * getCommittedPropertyKey(). Planes can move between displays, so it
+         * is shared by all displays.
+         */
+        static Mutex sCommittedPropertiesMutex;
+        static std::unordered_map<uint64_t, uint64_t> sCommittedProperties
+                GUARDED_BY(sCommittedPropertiesMutex);
+};
+
+/*
+ * Merges the requests committed by mCommitThread of each display in the same
+ * present round into one atomic commit, so that flips of mirrored or
+ * simultaneous displays land together and a plane moving between crtcs is
+ * handed off in one step. A request waits up to kGatherTimeoutNs for the
+ * requests of the other displays that can combine their commits.
+ */
+class DrmCommitCoordinator {
+    public:
+        void init(DrmDevice *drmDevice, bool enabled);
+        bool isEnabled() { return mEnabled; };
+        void registerDisplay(ExynosDisplayDrmInterface *display);
+        void unregisterDisplay(ExynosDisplayDrmInterface *display);
+        int commit(ExynosDisplayDrmInterface *display,
+                ExynosDisplayDrmInterface::DrmModeAtomicReq &drmReq, uint32_t flags);
+        void dump(String8 &result);
+
+        static constexpr nsecs_t kGatherTimeoutNs = 1000000;
+
+    private:
+        struct PendingCommit {
+            ExynosDisplayDrmInterface::DrmModeAtomicReq *drmReq;
+            uint32_t flags;
+            bool done = false;
+            int ret = NO_ERROR;
+        };
+        size_t numParticipantsLocked();
+        void commitPendingLocked();
+
+        DrmDevice *mDrmDevice = NULL;
+        bool mEnabled = false;
+        Mutex mMutex;
+        Condition mCommitted;
+        std::vector<ExynosDisplayDrmInterface *> mDisplays;
+        std::vector<PendingCommit *> mPending;
+        uint64_t mCombinedCommitCount = 0;
+        uint64_t mSingleCommitCount = 0;
 };
 
 #endif
@@ -18,11 +18,13 @@
 #define _EXYNOSDISPLAYINTERFACE_H
 
 #include <sys/types.h>
+#include <string>
 #include <hardware/hwcomposer2.h>
 #include <utils/Errors.h>
 #include "ExynosHWCHelper.h"
 
 class ExynosDisplay;
+struct exynos_dpu_data;
 
 using namespace android;
 class ExynosDisplayInterface {
@@ -39,7 +41,11 @@ class ExynosDisplayInterface {
                 uint32_t* outNumConfigs,
                 hwc2_config_t* outConfigs);
         virtual void dumpDisplayConfigs() {};
+        virtual void dump(String8& __unused result) {};
+        /* Appends wakeup statistics of the workers owned by the interface */
+        virtual void dumpWorkerWakeups(std::string& __unused result) {};
         virtual bool supportDataspace(int32_t __unused dataspace) { return true; };
+        virtual bool supportBackgroundColor() { return false; };
         virtual int32_t getColorModes(uint32_t* outNumModes, int32_t* outModes);
         virtual int32_t setColorMode(int32_t __unused mode) {return NO_ERROR;};
         virtual int32_t setActiveConfig(hwc2_config_t __unused config) {return NO_ERROR;};
@@ -48,12 +54,23 @@ class ExynosDisplayInterface {
         {return NO_ERROR;};
         virtual int32_t getDisplayVsyncPeriod(hwc2_vsync_period_t* outVsyncPeriod);
         virtual int32_t getConfigChangeDuration() {return 0;};
+        /* Vsyncs from the request of a switch to config until its first vsync */
+        virtual int32_t getConfigSwitchDuration(hwc2_config_t __unused config)
+        {return getConfigChangeDuration();};
         virtual int32_t setCursorPositionAsync(uint32_t __unused x_pos,
                 uint32_t __unused y_pos) {return NO_ERROR;};
         virtual int32_t updateHdrCapabilities();
+        /* Warm up the preferred config of a newly connected display before its first present */
+        virtual int32_t preparePreferredConfig() {return NO_ERROR;};
         virtual int32_t deliverWinConfigData() {return NO_ERROR;};
+        /* Display state waiting for the next commit, a repeated frame can't skip it */
+        virtual bool hasPendingDisplayUpdate() {return false;};
+        /* Check whether the kernel accepts dpuData without applying it */
+        virtual int32_t testWinConfigData(exynos_dpu_data __unused &dpuData) {return NO_ERROR;};
         virtual int32_t clearDisplay(bool __unused needModeClear = false) {return NO_ERROR;};
         virtual int32_t disableSelfRefresh(uint32_t __unused disable) {return NO_ERROR;};
+        /* The display entered or exited panel self refresh */
+        virtual void onSelfRefreshChanged(bool __unused active) {};
         virtual int32_t setForcePanic() {return NO_ERROR;};
         virtual int getDisplayFd() {return -1;};
         virtual uint32_t getMaxWindowNum() {return 0;};
@@ -22,8 +22,10 @@
 #include <errno.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <array>
 #include <sstream>
+#include <string_view>
 
 #include <log/log.h>
 #include <xf86drmMode.h>
@@ -218,16 +220,134 @@ std::string DrmConnector::name() const {
   }
 }
 
+void DrmConnector::UpdatePropertyValues(drmModeConnectorPtr c) {
+  for (uint32_t i = 0; i < (uint32_t)c->count_props; ++i) {
+    for (DrmProperty *prop : properties_) {
+      if (prop->id() == c->props[i]) {
+        prop->UpdateValue(c->prop_values[i]);
+        break;
+      }
+    }
+  }
+}
+
+void DrmConnector::UpdateEdid() {
+  edid_.clear();
+  edid_hash_ = 0;
+
+  if (edid_property_.id() == 0)
+    return;
+
+  auto [ret, blob_id] = edid_property_.value();
+  if (ret || blob_id == 0)
+    return;
+
+  drmModePropertyBlobPtr blob = drmModeGetPropertyBlob(drm_->fd(), blob_id);
+  if (!blob)
+    return;
+
+  const uint8_t *data = static_cast<const uint8_t *>(blob->data);
+  edid_.assign(data, data + blob->length);
+  drmModeFreePropertyBlob(blob);
+
+  edid_hash_ = std::hash<std::string_view>()(
+      std::string_view(reinterpret_cast<const char *>(edid_.data()),
+                       edid_.size()));
+  /* 0 means no EDID */
+  if (edid_hash_ == 0)
+    edid_hash_ = 1;
+}
+
+bool DrmConnector::RestoreCachedModes() {
+  auto it = std::find_if(mode_caches_.begin(), mode_caches_.end(),
+                         [this](const ModeCache &cache) {
+                           return cache.edid_hash == edid_hash_;
+                         });
+  if (it == mode_caches_.end())
+    return false;
+
+  /* Keep the most recently used monitor at the back */
+  std::rotate(it, it + 1, mode_caches_.end());
+  const ModeCache &cache = mode_caches_.back();
+  modes_ = cache.modes;
+  UpdateModeIndex();
+  preferred_mode_id_ = cache.preferred_mode_id;
+  mm_width_ = cache.mm_width;
+  mm_height_ = cache.mm_height;
+  return true;
+}
+
+void DrmConnector::CacheModes() {
+  if (edid_hash_ == 0 || modes_.empty())
+    return;
+
+  auto it = std::find_if(mode_caches_.begin(), mode_caches_.end(),
+                         [this](const ModeCache &cache) {
+                           return cache.edid_hash == edid_hash_;
+                         });
+  if (it != mode_caches_.end())
+    mode_caches_.erase(it);
+  else if (mode_caches_.size() >= kMaxModeCaches)
+    mode_caches_.erase(mode_caches_.begin());
+
+  mode_caches_.push_back(ModeCache{edid_hash_, modes_, preferred_mode_id_,
+                                   mm_width_, mm_height_});
+}
+
 int DrmConnector::UpdateModes() {
+  std::vector<uint32_t> prev_mode_ids;
+  for (const DrmMode &mode : modes_)
+    prev_mode_ids.push_back(mode.id());
+  uint32_t prev_preferred_mode_id = preferred_mode_id_;
+  uint32_t prev_mm_width = mm_width_;
+  uint32_t prev_mm_height = mm_height_;
+
+  int ret = FetchModes();
+
+  /* Modes that are kept or restored from the cache keep their ids */
+  bool changed = (modes_.size() != prev_mode_ids.size()) ||
+      (preferred_mode_id_ != prev_preferred_mode_id) ||
+      (mm_width_ != prev_mm_width) || (mm_height_ != prev_mm_height);
+  for (size_t i = 0; !changed && i < modes_.size(); i++)
+    changed = (modes_[i].id() != prev_mode_ids[i]);
+  if (changed)
+    modes_generation_++;
+
+  return ret;
+}
+
+int DrmConnector::FetchModes() {
   int fd = drm_->fd();
 
-  drmModeConnectorPtr c = drmModeGetConnector(fd, id_);
+  /*
+   * drmModeGetConnectorCurrent() doesn't probe the connector again, it only
+   * reports the state and the EDID the kernel already has. A replug of a
+   * monitor whose EDID was seen before reuses the modes parsed for it.
+   */
+  drmModeConnectorPtr c = drmModeGetConnectorCurrent(fd, id_);
+  if (c && c->connection == DRM_MODE_CONNECTED) {
+    UpdatePropertyValues(c);
+    UpdateEdid();
+    if (RestoreCachedModes()) {
+      state_ = c->connection;
+      drmModeFreeConnector(c);
+      return 0;
+    }
+  }
+  if (c)
+    drmModeFreeConnector(c);
+
+  c = drmModeGetConnector(fd, id_);
   if (!c) {
     ALOGE("Failed to get connector %d", id_);
     return -ENODEV;
   }
 
   state_ = c->connection;
+  mm_width_ = c->mmWidth;
+  mm_height_ = c->mmHeight;
+  UpdatePropertyValues(c);
+  UpdateEdid();
 
   bool preferred_mode_found = false;
   std::vector<DrmMode> new_modes;
@@ -252,13 +372,40 @@ int DrmConnector::UpdateModes() {
       preferred_mode_found = true;
     }
   }
+  drmModeFreeConnector(c);
   modes_.swap(new_modes);
+  UpdateModeIndex();
   if (!preferred_mode_found && modes_.size() != 0) {
     preferred_mode_id_ = modes_[0].id();
   }
+  if (state_ == DRM_MODE_CONNECTED)
+    CacheModes();
   return 0;
 }
 
+void DrmConnector::UpdateModeIndex() {
+  mode_index_.clear();
+  for (size_t i = 0; i < modes_.size(); i++) {
+    float refresh = modes_[i].v_refresh();
+    uint32_t period = (refresh > 0) ? static_cast<uint32_t>(1000000000 / refresh) : 0;
+    mode_index_.emplace(modes_[i].id(), ModeIndexEntry{i, period});
+  }
+}
+
+const DrmMode *DrmConnector::FindMode(uint32_t id) const {
+  auto it = mode_index_.find(id);
+  if (it == mode_index_.end())
+    return nullptr;
+  return &modes_[it->second.index];
+}
+
+uint32_t DrmConnector::vsync_period(uint32_t id) const {
+  auto it = mode_index_.find(id);
+  if (it == mode_index_.end())
+    return 0;
+  return it->second.vsync_period;
+}
+
 const DrmMode &DrmConnector::active_mode() const {
   return active_mode_;
 }
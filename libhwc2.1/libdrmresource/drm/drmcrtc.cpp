@@ -83,6 +83,8 @@ int DrmCrtc::Init() {
     ALOGI("Failed to get &dqe_enabled_property property");
   if (drm_->GetCrtcProperty(*this, "color mode", &color_mode_property_))
     ALOGI("Failed to get color mode property");
+  if (drm_->GetCrtcProperty(*this, "background color", &background_color_property_))
+    ALOGI("Failed to get background color property");
 
   properties_.push_back(&active_property_);
   properties_.push_back(&mode_property_);
@@ -103,6 +105,7 @@ int DrmCrtc::Init() {
   properties_.push_back(&max_disp_freq_property_);
   properties_.push_back(&dqe_enabled_property_);
   properties_.push_back(&color_mode_property_);
+  properties_.push_back(&background_color_property_);
 
   return 0;
 }
@@ -215,4 +218,8 @@ const DrmProperty &DrmCrtc::color_mode_property() const {
     return color_mode_property_;
 }
 
+const DrmProperty &DrmCrtc::background_color_property() const {
+    return background_color_property_;
+}
+
 }  // namespace android
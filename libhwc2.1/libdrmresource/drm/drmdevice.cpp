@@ -28,7 +28,9 @@
 #include <stdint.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include <algorithm>
 #include <cinttypes>
+#include <thread>
 
 #include <cutils/properties.h>
 #include <log/log.h>
@@ -44,9 +46,14 @@ DrmDevice::DrmDevice() : event_listener_(this) {
 
 DrmDevice::~DrmDevice() {
   event_listener_.Exit();
+  ClearPropertyRegistry();
 }
 
 std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
+  nsecs_t init_start = systemTime(SYSTEM_TIME_MONOTONIC);
+  /* Objects look up their properties by name only while they are initialized */
+  cache_properties_ = true;
+
   /* TODO: Use drmOpenControl here instead */
   fd_.Set(open(path, O_RDWR));
   if (fd() < 0) {
@@ -218,25 +225,45 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
     return std::make_tuple(-ENOENT, 0);
   }
 
-  for (uint32_t i = 0; i < plane_res->count_planes; ++i) {
-    drmModePlanePtr p = drmModeGetPlane(fd(), plane_res->planes[i]);
-    if (!p) {
-      ALOGE("Failed to get plane %d", plane_res->planes[i]);
-      ret = -ENODEV;
-      break;
-    }
+  /*
+   * Planes don't depend on each other, initialize them on a few threads.
+   * planes_ keeps the order of plane resources.
+   */
+  std::vector<std::unique_ptr<DrmPlane>> planes(plane_res->count_planes);
+  std::vector<int> plane_rets(plane_res->count_planes, 0);
+  auto init_planes = [&](uint32_t start, uint32_t step) {
+    for (uint32_t i = start; i < plane_res->count_planes; i += step) {
+      drmModePlanePtr p = drmModeGetPlane(fd(), plane_res->planes[i]);
+      if (!p) {
+        ALOGE("Failed to get plane %d", plane_res->planes[i]);
+        plane_rets[i] = -ENODEV;
+        continue;
+      }
 
-    std::unique_ptr<DrmPlane> plane(new DrmPlane(this, p));
+      std::unique_ptr<DrmPlane> plane(new DrmPlane(this, p));
 
-    drmModeFreePlane(p);
+      drmModeFreePlane(p);
 
-    ret = plane->Init();
-    if (ret) {
-      ALOGE("Init plane %d failed", plane_res->planes[i]);
-      break;
+      plane_rets[i] = plane->Init();
+      if (plane_rets[i]) {
+        ALOGE("Init plane %d failed", plane_res->planes[i]);
+        continue;
+      }
+      planes[i] = std::move(plane);
     }
+  };
+  uint32_t thread_num = std::min(plane_res->count_planes, kMaxPlaneInitThreads);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 1; t < thread_num; t++)
+    threads.emplace_back(init_planes, t, thread_num);
+  init_planes(0, std::max(thread_num, 1U));
+  for (auto &thread : threads)
+    thread.join();
 
-    planes_.emplace_back(std::move(plane));
+  for (uint32_t i = 0; i < plane_res->count_planes; ++i) {
+    if ((ret = plane_rets[i]) != 0)
+      break;
+    planes_.emplace_back(std::move(planes[i]));
   }
   drmModeFreePlaneResources(plane_res);
   if (ret)
@@ -258,6 +285,11 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
       ALOGI("Display %d has writeback attach to it", conn->display());
     }
   }
+
+  cache_properties_ = false;
+  ClearPropertyRegistry();
+  init_time_ns_ = systemTime(SYSTEM_TIME_MONOTONIC) - init_start;
+  ALOGI("DrmDevice init takes %" PRId64 " us", ns2us(init_time_ns_));
   return std::make_tuple(ret, displays_.size());
 }
 
@@ -473,29 +505,67 @@ DrmEventListener *DrmDevice::event_listener() {
 
 int DrmDevice::GetProperty(uint32_t obj_id, uint32_t obj_type,
                            const char *prop_name, DrmProperty *property) {
-  drmModeObjectPropertiesPtr props;
+  uint64_t key = (static_cast<uint64_t>(obj_type) << 32) | obj_id;
+  std::unique_lock<std::mutex> lock(property_registry_lock_);
+  auto obj = property_registry_.find(key);
+  if (obj == property_registry_.end()) {
+    /* Planes are initialized in parallel, query the kernel without the lock */
+    lock.unlock();
+    drmModeObjectPropertiesPtr props;
 
-  props = drmModeObjectGetProperties(fd(), obj_id, obj_type);
-  if (!props) {
-    ALOGE("Failed to get properties for %d/%x", obj_id, obj_type);
-    return -ENODEV;
-  }
+    props = drmModeObjectGetProperties(fd(), obj_id, obj_type);
+    if (!props) {
+      ALOGE("Failed to get properties for %d/%x", obj_id, obj_type);
+      return -ENODEV;
+    }
+
+    std::unordered_map<std::string, PropertyInfo> registry;
+    for (int i = 0; (size_t)i < props->count_props; ++i) {
+      drmModePropertyPtr p = drmModeGetProperty(fd(), props->props[i]);
+      if (!p)
+        continue;
+      if (!registry.emplace(p->name, PropertyInfo{p, props->prop_values[i]}).second)
+        drmModeFreeProperty(p);
+    }
+    drmModeFreeObjectProperties(props);
 
-  bool found = false;
-  for (int i = 0; !found && (size_t)i < props->count_props; ++i) {
-    drmModePropertyPtr p = drmModeGetProperty(fd(), props->props[i]);
-    if (!strcmp(p->name, prop_name)) {
-      property->Init(p, props->prop_values[i]);
-      found = true;
+    lock.lock();
+    obj = property_registry_.find(key);
+    if (obj == property_registry_.end()) {
+      obj = property_registry_.emplace(key, std::move(registry)).first;
+    } else {
+      for (auto &prop : registry)
+        drmModeFreeProperty(prop.second.property);
     }
-    drmModeFreeProperty(p);
   }
 
-  if (!found)
-      property->SetName(prop_name);
+  int ret = -ENOENT;
+  auto prop = obj->second.find(prop_name);
+  if (prop != obj->second.end()) {
+    property->Init(prop->second.property, prop->second.value);
+    ret = 0;
+  } else {
+    property->SetName(prop_name);
+  }
+
+  /* Values could be changed after initialization, don't keep them */
+  if (!cache_properties_)
+    ClearPropertyRegistryLocked();
+
+  return ret;
+}
+
+void DrmDevice::ClearPropertyRegistry() {
+  std::lock_guard<std::mutex> lock(property_registry_lock_);
+  ClearPropertyRegistryLocked();
+}
 
-  drmModeFreeObjectProperties(props);
-  return found ? 0 : -ENOENT;
+void DrmDevice::ClearPropertyRegistryLocked() {
+  for (auto &obj : property_registry_) {
+    for (auto &prop : obj.second)
+      drmModeFreeProperty(prop.second.property);
+  }
+  property_registry_.clear();
 }
 
 int DrmDevice::GetPlaneProperty(const DrmPlane &plane, const char *prop_name,
@@ -523,13 +593,12 @@ int DrmDevice::UpdateCrtcProperty(const DrmCrtc &crtc, DrmProperty *property) {
         return -ENODEV;
     }
     bool found = false;
+    /* Only the value is updated, property info is not needed */
     for (int i = 0; !found && (size_t)i < props->count_props; ++i) {
-        drmModePropertyPtr p = drmModeGetProperty(fd(), props->props[i]);
         if (props->props[i] == property->id()) {
             property->UpdateValue(props->prop_values[i]);
             found = true;
         }
-        drmModeFreeProperty(p);
     }
     drmModeFreeObjectProperties(props);
     return found ? 0 : -ENOENT;
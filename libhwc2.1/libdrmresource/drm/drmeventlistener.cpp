@@ -22,6 +22,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <linux/filter.h>
 #include <linux/netlink.h>
 #include <sys/socket.h>
 
@@ -32,8 +33,27 @@
 
 namespace android {
 
+/*
+ * DRM hotplug uevents are always sent as "change@<devpath>". Drop every other
+ * kernel uevent (USB, power supply add/remove, ...) in the socket before it
+ * wakes up the listener thread.
+ */
+static struct sock_filter kUEventFilter[] = {
+  /* "chan" */
+  BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x6368616e, 0, 5),
+  /* "ge" */
+  BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x6765, 0, 3),
+  /* "@" */
+  BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, '@', 0, 1),
+  BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+  BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
 DrmEventListener::DrmEventListener(DrmDevice *drm)
-    : Worker("drm-event-listener", HAL_PRIORITY_URGENT_DISPLAY), drm_(drm) {
+    : Worker("drm-event-listener", ThreadRole::DRM_EVENT), drm_(drm) {
 }
 
 int DrmEventListener::Init() {
@@ -51,7 +71,8 @@ int DrmEventListener::Init() {
   memset(&addr, 0, sizeof(addr));
   addr.nl_family = AF_NETLINK;
   addr.nl_pid = 0;
-  addr.nl_groups = 0xFFFFFFFF;
+  /* Only kernel uevents, userspace (udev style) rebroadcasts are not needed */
+  addr.nl_groups = kUEventKernelGroup;
 
   int ret = bind(uevent_fd_.get(), (struct sockaddr *)&addr, sizeof(addr));
   if (ret) {
@@ -59,6 +80,14 @@ int DrmEventListener::Init() {
     return -errno;
   }
 
+  struct sock_fprog filter = {
+    .len = sizeof(kUEventFilter) / sizeof(kUEventFilter[0]),
+    .filter = kUEventFilter,
+  };
+  if (setsockopt(uevent_fd_.get(), SOL_SOCKET, SO_ATTACH_FILTER, &filter,
+                 sizeof(filter)))
+    ALOGW("Failed to attach uevent filter: %s", strerror(errno));
+
   /* Open TUI Event File Descriptor */
   tuievent_fd_.Set(open(kTUIStatusPath, O_RDONLY));
   if (tuievent_fd_.get() < 0) {
@@ -149,6 +178,27 @@ void DrmEventListener::FlipHandler(int /* fd */, unsigned int /* sequence */,
   delete handler;
 }
 
+bool DrmEventListener::IsDrmHotplugUEvent(const char *buffer, int len) {
+  /* The header is "action@devpath", reject non-DRM devices before parsing */
+  if (strncmp(buffer, "change@", strlen("change@")) ||
+      !strstr(buffer, kUEventDrmDevpath))
+    return false;
+
+  bool drm_event = false, hotplug_event = false;
+  for (int i = 0; i < len;) {
+    const char *event = buffer + i;
+    if (!strcmp(event, "DEVTYPE=drm_minor")) {
+      drm_event = true;
+    } else if (!strcmp(event, "HOTPLUG=1")) {
+      hotplug_event = true;
+    }
+
+    i += strlen(event) + 1;
+  }
+
+  return drm_event && hotplug_event;
+}
+
 void DrmEventListener::UEventHandler() {
   char buffer[1024];
   int ret;
@@ -161,32 +211,25 @@ void DrmEventListener::UEventHandler() {
   else
     ALOGE("Failed to get monotonic clock on hotplug %d", ret);
 
-  ret = read(uevent_fd_.get(), &buffer, sizeof(buffer));
-  if (ret == 0) {
-      return;
-  } else if (ret < 0) {
-    ALOGE("Got error reading uevent %d", ret);
-    return;
+  /*
+   * Drain everything queued on the socket so a uevent storm costs one wakeup,
+   * and report at most one hotplug for it.
+   */
+  bool hotplug = false;
+  int flags = 0;
+  while ((ret = recv(uevent_fd_.get(), &buffer, sizeof(buffer) - 1, flags)) > 0) {
+    buffer[ret] = '\0';
+    if (!hotplug)
+      hotplug = IsDrmHotplugUEvent(buffer, ret);
+    flags = MSG_DONTWAIT;
   }
 
-  bool drm_event = false, hotplug_event = false;
-  for (int i = 0; i < ret;) {
-    char *event = buffer + i;
-    if (!strcmp(event, "DEVTYPE=drm_minor")) {
-      drm_event = true;
-    } else if (!strcmp(event, "HOTPLUG=1")) {
-      hotplug_event = true;
-    }
-
-    i += strlen(event) + 1;
+  if (ret < 0 && !(flags && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+    ALOGE("Got error reading uevent %d", ret);
   }
 
-  if (drm_event && hotplug_event) {
-    if (!hotplug_handler_)
-      return;
-
+  if (hotplug && hotplug_handler_)
     hotplug_handler_->HandleEvent(timestamp);
-  }
 }
 
 void DrmEventListener::TUIEventHandler() {
@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <cinttypes>
 
+#include <drm/drm_fourcc.h>
 #include <log/log.h>
 #include <xf86drmMode.h>
 
@@ -35,6 +36,82 @@ DrmPlane::DrmPlane(DrmDevice *drm, drmModePlanePtr p)
   }
 }
 
+DrmPlane::ModifierClass DrmPlane::GetModifierClass(uint64_t modifier) {
+  if (modifier == DRM_FORMAT_MOD_LINEAR)
+    return MODIFIER_LINEAR;
+
+  switch (modifier >> 56) {
+    case DRM_FORMAT_MOD_VENDOR_ARM:
+      return MODIFIER_AFBC;
+    case DRM_FORMAT_MOD_VENDOR_SAMSUNG:
+      return MODIFIER_SAMSUNG;
+    default:
+      return MODIFIER_OTHER;
+  }
+}
+
+int DrmPlane::ParseInFormats() {
+  constexpr uint32_t kAllClasses = (1U << MODIFIER_CLASS_MAX) - 1;
+  for (auto format : formats_)
+    format_modifier_classes_[format] = kAllClasses;
+  modifier_classes_ = kAllClasses;
+
+  DrmProperty in_formats;
+  if (drm_->GetPlaneProperty(*this, "IN_FORMATS", &in_formats))
+    return 0;
+
+  auto [ret, blob_id] = in_formats.value();
+  if (ret)
+    return ret;
+  drmModePropertyBlobPtr blob = drmModeGetPropertyBlob(drm_->fd(), blob_id);
+  if (!blob) {
+    ALOGE("Could not get IN_FORMATS blob for plane %u", id());
+    return -ENOENT;
+  }
+
+  auto *header = static_cast<const drm_format_modifier_blob *>(blob->data);
+  if ((blob->length < sizeof(*header)) ||
+      (header->formats_offset + header->count_formats * sizeof(uint32_t) > blob->length) ||
+      (header->modifiers_offset + header->count_modifiers * sizeof(drm_format_modifier) >
+       blob->length)) {
+    ALOGE("Invalid IN_FORMATS blob for plane %u", id());
+    drmModeFreePropertyBlob(blob);
+    return -EINVAL;
+  }
+
+  auto *base = static_cast<const uint8_t *>(blob->data);
+  auto *formats = reinterpret_cast<const uint32_t *>(base + header->formats_offset);
+  auto *modifiers =
+      reinterpret_cast<const drm_format_modifier *>(base + header->modifiers_offset);
+
+  format_modifier_classes_.clear();
+  modifier_classes_ = 0;
+  for (uint32_t i = 0; i < header->count_formats; i++)
+    format_modifier_classes_[formats[i]] = 0;
+  /* Each modifier lists the formats it applies to as a 64 bit window from offset */
+  for (uint32_t i = 0; i < header->count_modifiers; i++) {
+    uint32_t class_bit = 1U << GetModifierClass(modifiers[i].modifier);
+    for (uint32_t j = 0; j < 64; j++) {
+      uint32_t index = modifiers[i].offset + j;
+      if (!(modifiers[i].formats & (1ULL << j)) || (index >= header->count_formats))
+        continue;
+      format_modifier_classes_[formats[index]] |= class_bit;
+      modifier_classes_ |= class_bit;
+    }
+  }
+  has_in_formats_ = true;
+
+  drmModeFreePropertyBlob(blob);
+  return 0;
+}
+
+bool DrmPlane::supports(uint32_t format, uint64_t modifier) const {
+  auto it = format_modifier_classes_.find(format);
+  if (it == format_modifier_classes_.end())
+    return false;
+  return it->second & (1U << GetModifierClass(modifier));
+}
+
 int DrmPlane::Init() {
   DrmProperty p;
 
@@ -177,6 +254,9 @@ int DrmPlane::Init() {
   if (drm_->GetPlaneProperty(*this, "colormap", &colormap_))
       ALOGI("Could not get colormap property");
 
+  if (ParseInFormats())
+    ALOGI("Could not parse IN_FORMATS of plane %u", id());
+
   properties_.push_back(&crtc_property_);
   properties_.push_back(&fb_property_);
   properties_.push_back(&crtc_x_property_);
@@ -20,6 +20,7 @@
 
 #include "vsyncworker.h"
 
+#include <cutils/properties.h>
 #include <hardware/hardware.h>
 #include <log/log.h>
 #include <stdlib.h>
@@ -28,7 +29,10 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include <algorithm>
+#include <cmath>
 #include <map>
+#include <thread>
 
 #include "drmdevice.h"
 #include "worker.h"
@@ -37,11 +41,53 @@ using namespace std::chrono_literals;
 
 constexpr auto nsecsPerSec = std::chrono::nanoseconds(1s).count();
 constexpr auto hwVsyncPeriodTag = "HWVsyncPeriod";
+constexpr auto hwVsyncModelPeriodTag = "HWVsyncModelPeriod";
+
+/* Number of hardware timestamps the vsync model is fitted to */
+constexpr size_t kMaxVsyncSamples = 16;
+constexpr size_t kMinVsyncSamples = 3;
+/* A timestamp further than period / kVsyncJitterRatio off the model restarts it */
+constexpr int64_t kVsyncJitterRatio = 8;
+/* Don't extrapolate the model further than this past the last hardware vsync */
+constexpr auto kVsyncModelTimeoutNs = std::chrono::nanoseconds(5s).count();
+/* Longest delay of a vsync delivered by the lead of a parked worker */
+constexpr int32_t kVsyncHubWindowUs = 500;
 
 namespace android {
 
+VSyncHub &VSyncHub::GetInstance() {
+    static VSyncHub hub;
+    return hub;
+}
+
+VSyncHub::VSyncHub()
+    : workers_(std::make_shared<const std::vector<VSyncWorker *>>()) {
+    enabled_ = property_get_bool("vendor.display.vsync_hub.enabled", false);
+    window_ns_ = property_get_int32("vendor.display.vsync_hub.window_us", kVsyncHubWindowUs) *
+            1000LL;
+}
+
+void VSyncHub::Register(VSyncWorker *worker) {
+    std::lock_guard<std::mutex> lock(registration_lock_);
+    auto workers = std::make_shared<std::vector<VSyncWorker *>>(*std::atomic_load(&workers_));
+    workers->push_back(worker);
+    std::atomic_store(&workers_, std::shared_ptr<const std::vector<VSyncWorker *>>(workers));
+}
+
+void VSyncHub::Unregister(VSyncWorker *worker) {
+    {
+        std::lock_guard<std::mutex> lock(registration_lock_);
+        auto workers = std::make_shared<std::vector<VSyncWorker *>>(*std::atomic_load(&workers_));
+        workers->erase(std::remove(workers->begin(), workers->end(), worker), workers->end());
+        std::atomic_store(&workers_, std::shared_ptr<const std::vector<VSyncWorker *>>(workers));
+    }
+
+    /* Dispatches that loaded the previous list may still use the worker */
+    while (readers_ != 0) std::this_thread::yield();
+}
+
 VSyncWorker::VSyncWorker()
-    : Worker("vsync", 2, true),
+    : Worker("vsync", ThreadRole::VSYNC),
       drm_(NULL),
       display_(-1),
       enabled_(false),
@@ -49,19 +95,138 @@ VSyncWorker::VSyncWorker()
 }
 
 VSyncWorker::~VSyncWorker() {
+    VSyncHub &hub = VSyncHub::GetInstance();
+    if (hub.enabled() && drm_ != NULL) {
+        /* Routine() must not park other workers on this one anymore */
+        Exit();
+        ReleaseFollowers();
+        hub.Unregister(this);
+    }
 }
 
 int VSyncWorker::Init(DrmDevice *drm, int display) {
     drm_ = drm;
     display_ = display;
 
+    if (VSyncHub::GetInstance().enabled()) VSyncHub::GetInstance().Register(this);
+
     return InitWorker();
 }
 
+int64_t VSyncWorker::GetModeVsyncPeriod() {
+    DrmConnector *conn = drm_->GetConnectorForDisplay(display_);
+    if (!conn || conn->active_mode().v_refresh() == 0.0f) return 0;
+
+    return nsecsPerSec / conn->active_mode().v_refresh();
+}
+
+void VSyncWorker::ResetVsyncModelLocked() {
+    samples_.clear();
+    model_valid_ = false;
+    model_period_ = 0;
+    model_phase_ = 0;
+}
+
+/*
+ * Least squares fit of timestamp = phase + period * index over the sampled
+ * vsyncs. Indices count whole periods, so vsyncs missed by the worker don't
+ * skew the period.
+ */
+void VSyncWorker::FitVsyncModelLocked() {
+    if (samples_.size() < kMinVsyncSamples) {
+        model_valid_ = false;
+        return;
+    }
+
+    /* Work relative to the oldest sample to keep the doubles precise */
+    const VsyncSample &base = samples_.front();
+    double mean_index = 0, mean_time = 0;
+    for (const auto &sample : samples_) {
+        mean_index += sample.index - base.index;
+        mean_time += sample.timestamp - base.timestamp;
+    }
+    mean_index /= samples_.size();
+    mean_time /= samples_.size();
+
+    double covariance = 0, variance = 0;
+    for (const auto &sample : samples_) {
+        double di = (sample.index - base.index) - mean_index;
+        covariance += di * ((sample.timestamp - base.timestamp) - mean_time);
+        variance += di * di;
+    }
+    if (variance == 0) {
+        model_valid_ = false;
+        return;
+    }
+
+    model_period_ = covariance / variance;
+    /* Phase is the predicted timestamp of index 0, i.e. of samples_.front() */
+    model_phase_ = base.timestamp + mean_time - model_period_ * mean_index;
+    model_valid_ = true;
+
+    ATRACE_INT64(hwVsyncModelPeriodTag, static_cast<int64_t>(model_period_));
+}
+
+void VSyncWorker::AddVsyncSample(int64_t timestamp, int64_t mode_period) {
+    std::lock_guard<std::mutex> lock(model_lock_);
+
+    /* The refresh rate changed, the old period and phase are meaningless */
+    if (mode_period != model_mode_period_) {
+        ResetVsyncModelLocked();
+        model_mode_period_ = mode_period;
+    }
+
+    if (!samples_.empty()) {
+        const VsyncSample &last = samples_.back();
+        double period = model_valid_ ? model_period_ : mode_period;
+        int64_t delta = timestamp - last.timestamp;
+        int64_t periods = period > 0 ? std::llround(delta / period) : 0;
+
+        /*
+         * Timestamps that don't land on the period grid mean the panel moved
+         * (e.g. adjusted vblank or variable refresh), so restart the model from
+         * this vsync.
+         */
+        if (periods < 1 || std::abs(delta - periods * period) > period / kVsyncJitterRatio) {
+            ALOGV("vsync model reset, delta %" PRId64 "ns period %f", delta, period);
+            ResetVsyncModelLocked();
+            samples_.push_back({timestamp, 0});
+            return;
+        }
+
+        samples_.push_back({timestamp, last.index + periods});
+    } else {
+        samples_.push_back({timestamp, 0});
+    }
+
+    if (samples_.size() > kMaxVsyncSamples) samples_.pop_front();
+    FitVsyncModelLocked();
+}
+
+int VSyncWorker::GetNextVsync(int64_t after, int64_t *next) {
+    std::lock_guard<std::mutex> lock(model_lock_);
+    return PredictVsyncLocked(after, next);
+}
+
+int VSyncWorker::PredictVsyncLocked(int64_t after, int64_t *next) {
+    if (!model_valid_ || model_period_ <= 0) return -EAGAIN;
+    if (after - samples_.back().timestamp > kVsyncModelTimeoutNs) return -EAGAIN;
+
+    double periods = std::floor((after - model_phase_) / model_period_) + 1;
+    *next = static_cast<int64_t>(model_phase_ + periods * model_period_);
+    /* Guard against rounding of the prediction back onto 'after' */
+    if (*next <= after) *next += static_cast<int64_t>(model_period_);
+
+    return 0;
+}
+
+double VSyncWorker::GetModelPeriod() {
+    std::lock_guard<std::mutex> lock(model_lock_);
+    return model_valid_ ? model_period_ : 0;
+}
+
 void VSyncWorker::RegisterCallback(std::shared_ptr<VsyncCallback> callback) {
-    Lock();
-    callback_ = callback;
-    Unlock();
+    std::atomic_store(&callback_, callback);
 }
 
 void VSyncWorker::VSyncControl(bool enabled) {
@@ -88,6 +253,9 @@ void VSyncWorker::VSyncControl(bool enabled) {
  *  Thus, we must sleep until timestamp 687 to maintain phase with the last
  *  timestamp. But if we don't know last vblank timestamp, sleep one vblank
  *  then try to get vblank from driver again.
+ *
+ *  If the fitted hardware vsync model was built for the same period, its
+ *  prediction is used instead of last_timestamp_.
  */
 int VSyncWorker::GetPhasedVSync(int64_t frame_ns, int64_t &expect) {
     struct timespec now;
@@ -97,6 +265,11 @@ int VSyncWorker::GetPhasedVSync(int64_t frame_ns, int64_t &expect) {
     }
 
     int64_t current = now.tv_sec * nsecsPerSec + now.tv_nsec;
+    {
+        std::lock_guard<std::mutex> lock(model_lock_);
+        if (model_mode_period_ == frame_ns && PredictVsyncLocked(current, &expect) == 0)
+            return 0;
+    }
     if (last_timestamp_ < 0) {
         expect = current + frame_ns;
         return -EAGAIN;
@@ -122,24 +295,142 @@ int VSyncWorker::SyntheticWaitVBlank(int64_t &timestamp) {
     int ret = GetPhasedVSync(nsecsPerSec / refresh, phased_timestamp);
     if (ret && ret != -EAGAIN) return -1;
 
-    struct timespec vsync;
-    vsync.tv_sec = phased_timestamp / nsecsPerSec;
-    vsync.tv_nsec = phased_timestamp % nsecsPerSec;
-
-    int err;
-    do {
-        err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &vsync, nullptr);
-    } while (err == EINTR);
+    /* A synthetic vsync is only as good as the precision of its wakeup */
+    int err = WaitUntilOrExit(phased_timestamp);
     if (err || ret) return -1;
 
-    timestamp = (int64_t)vsync.tv_sec * nsecsPerSec + (int64_t)vsync.tv_nsec;
+    timestamp = phased_timestamp;
 
     return 0;
 }
 
+int VSyncWorker::QueryLastVBlank(int64_t *timestamp, uint32_t *sequence) {
+    DrmCrtc *crtc = drm_->GetCrtcForDisplay(display_);
+    if (!crtc) return -ENODEV;
+    uint32_t high_crtc = (crtc->pipe() << DRM_VBLANK_HIGH_CRTC_SHIFT);
+
+    /* A relative wait for 0 vblanks returns the last vblank without waiting */
+    drmVBlank vblank;
+    memset(&vblank, 0, sizeof(vblank));
+    vblank.request.type =
+            (drmVBlankSeqType)(DRM_VBLANK_RELATIVE | (high_crtc & DRM_VBLANK_HIGH_CRTC_MASK));
+    vblank.request.sequence = 0;
+
+    int ret = drmWaitVBlank(drm_->fd(), &vblank);
+    if (ret) return ret;
+
+    *timestamp = (int64_t)vblank.reply.tval_sec * nsecsPerSec +
+            (int64_t)vblank.reply.tval_usec * 1000;
+    *sequence = vblank.reply.sequence;
+    return 0;
+}
+
+bool VSyncWorker::ClaimSequence(uint32_t sequence) {
+    uint64_t last = last_sequence_.load();
+    do {
+        if (last != 0 && static_cast<int32_t>(sequence - static_cast<uint32_t>(last)) <= 0)
+            return false;
+    } while (!last_sequence_.compare_exchange_weak(last, (1ULL << 32) | sequence));
+
+    return true;
+}
+
+void VSyncWorker::Uncoalesce() {
+    /* Under the lock so that Routine() can't miss the signal */
+    Lock();
+    VSyncWorker *lead = lead_.exchange(nullptr);
+    Unlock();
+    if (lead) {
+        lead->num_followers_--;
+        Signal();
+    }
+}
+
+void VSyncWorker::ReleaseFollowers() {
+    if (num_followers_ == 0) return;
+
+    VSyncHub::GetInstance().ForEachWorker([this](VSyncWorker *worker) {
+        if (worker->lead_.load() == this) worker->Uncoalesce();
+    });
+}
+
+/*
+ * Delivers the vsyncs of the parked workers that came within the window
+ * before this one. A worker whose vsync isn't there anymore, e.g. after a
+ * refresh rate change, runs on its own again.
+ */
+void VSyncWorker::DispatchFollowers(int64_t timestamp) {
+    if (num_followers_ == 0) return;
+
+    int64_t window_ns = VSyncHub::GetInstance().window_ns();
+    VSyncHub::GetInstance().ForEachWorker([&](VSyncWorker *worker) {
+        if (worker->lead_.load() != this || !worker->enabled_) return;
+
+        int64_t follower_timestamp;
+        uint32_t sequence;
+        if (worker->QueryLastVBlank(&follower_timestamp, &sequence) ||
+            (timestamp - follower_timestamp < 0) || (timestamp - follower_timestamp > window_ns)) {
+            worker->Uncoalesce();
+            return;
+        }
+        if (!worker->ClaimSequence(sequence)) return;
+
+        worker->AddVsyncSample(follower_timestamp, worker->GetModeVsyncPeriod());
+        worker->coalesced_vsyncs_++;
+        std::shared_ptr<VsyncCallback> callback = std::atomic_load(&worker->callback_);
+        if (callback) callback->Callback(worker->display_, follower_timestamp);
+    });
+}
+
+/*
+ * Parks the workers with the same period whose next vsync is predicted
+ * within the window before this one. Leads and parked workers are not
+ * coalesced, so there are no chains.
+ */
+void VSyncWorker::CoalesceFollowers(int64_t timestamp) {
+    if (lead_.load() != nullptr) return;
+    double period = GetModelPeriod();
+    if (period <= 0) return;
+
+    int64_t window_ns = VSyncHub::GetInstance().window_ns();
+    VSyncHub::GetInstance().ForEachWorker([&](VSyncWorker *worker) {
+        if ((worker == this) || !worker->enabled_ || (worker->lead_.load() != nullptr) ||
+            (worker->num_followers_ != 0))
+            return;
+
+        double worker_period = worker->GetModelPeriod();
+        if ((worker_period <= 0) || (std::abs(worker_period - period) > period / kVsyncJitterRatio))
+            return;
+
+        int64_t next;
+        if (worker->GetNextVsync(timestamp - window_ns, &next) || (next > timestamp)) return;
+
+        VSyncWorker *expected = nullptr;
+        if (worker->lead_.compare_exchange_strong(expected, this)) {
+            num_followers_++;
+            ALOGV("display %d vsync is delivered by display %d", worker->display_, display_);
+        }
+    });
+}
+
+void VSyncWorker::DumpHubStats(std::string &out) const {
+    if (!VSyncHub::GetInstance().enabled()) return;
+
+    VSyncWorker *lead = lead_.load();
+    out.append("vsync hub: lead(" + std::to_string(lead ? lead->display_ : -1) +
+               "), followers(" + std::to_string(num_followers_.load()) +
+               "), coalesced vsyncs(" + std::to_string(coalesced_vsyncs_.load()) + ")\n");
+}
+
 void VSyncWorker::Routine() {
     int ret;
 
+    /*
+     * Parked workers can't wait for a lead that doesn't wake up. Released
+     * without the lock since Uncoalesce() takes the lock of the follower.
+     */
+    if (!enabled_ || (lead_.load() != nullptr)) ReleaseFollowers();
+
     Lock();
     if (!enabled_) {
         ret = WaitForSignalOrExitLocked();
@@ -148,9 +439,15 @@ void VSyncWorker::Routine() {
             return;
         }
     }
+    if (lead_.load() != nullptr) {
+        /* Woken up by Uncoalesce() or VSyncControl() */
+        WaitForSignalOrExitLocked();
+        Unlock();
+        return;
+    }
 
     int display = display_;
-    std::shared_ptr<VsyncCallback> callback(callback_);
+    std::shared_ptr<VsyncCallback> callback = std::atomic_load(&callback_);
     Unlock();
 
     DrmCrtc *crtc = drm_->GetCrtcForDisplay(display);
@@ -167,6 +464,7 @@ void VSyncWorker::Routine() {
     vblank.request.sequence = 1;
 
     int64_t timestamp;
+    bool claimed = true;
     ret = drmWaitVBlank(drm_->fd(), &vblank);
     if (ret) {
         if (SyntheticWaitVBlank(timestamp)) {
@@ -176,6 +474,13 @@ void VSyncWorker::Routine() {
     } else {
         timestamp = (int64_t)vblank.reply.tval_sec * nsecsPerSec +
                 (int64_t)vblank.reply.tval_usec * 1000;
+        AddVsyncSample(timestamp, GetModeVsyncPeriod());
+        if (VSyncHub::GetInstance().enabled()) {
+            /* A lead may have delivered it while this worker was being parked */
+            claimed = ClaimSequence(vblank.reply.sequence);
+            DispatchFollowers(timestamp);
+            CoalesceFollowers(timestamp);
+        }
     }
 
     /*
@@ -206,7 +511,7 @@ void VSyncWorker::Routine() {
      * the hook. However, in practice, callback_ is only updated once, so it's not
      * worth the overhead.
      */
-    if (callback) callback->Callback(display, timestamp);
+    if (callback && claimed) callback->Callback(display, timestamp);
 
     if (last_timestamp_ >= 0) {
         int64_t period = timestamp - last_timestamp_;
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <xf86drmMode.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace android {
@@ -53,10 +54,18 @@ class DrmConnector {
   std::string name() const;
 
   int UpdateModes();
+  /* Incremented by UpdateModes() when the modes, preferred mode or mm size change */
+  uint64_t modes_generation() const {
+    return modes_generation_;
+  }
 
   const std::vector<DrmMode> &modes() const {
     return modes_;
   }
+  /* Mode of modes() with the id, nullptr if there is none */
+  const DrmMode *FindMode(uint32_t id) const;
+  /* Vsync period in ns of the mode with the id, 0 if there is none */
+  uint32_t vsync_period(uint32_t id) const;
   const DrmMode &active_mode() const;
   void set_active_mode(const DrmMode &mode);
 
@@ -97,6 +106,15 @@ class DrmConnector {
     return preferred_mode_id_;
   }
 
+  /* EDID read by the last UpdateModes(), empty if the connector has none */
+  const std::vector<uint8_t> &edid() const {
+    return edid_;
+  }
+  /* Hash of edid(), 0 if there is no EDID */
+  uint64_t edid_hash() const {
+    return edid_hash_;
+  }
+
  private:
   DrmDevice *drm_;
 
@@ -136,6 +154,37 @@ class DrmConnector {
   std::vector<DrmEncoder *> possible_encoders_;
 
   uint32_t preferred_mode_id_;
+
+  void UpdatePropertyValues(drmModeConnectorPtr c);
+  void UpdateEdid();
+  void UpdateModeIndex();
+  bool RestoreCachedModes();
+  /* Reads the state and the modes of the connector, see UpdateModes() */
+  int FetchModes();
+  void CacheModes();
+
+  std::vector<uint8_t> edid_;
+  uint64_t edid_hash_ = 0;
+  uint64_t modes_generation_ = 0;
+
+  /* Rebuilt whenever modes_ changes */
+  struct ModeIndexEntry {
+    size_t index;
+    uint32_t vsync_period;
+  };
+  std::unordered_map<uint32_t, ModeIndexEntry> mode_index_;
+
+  /* Modes parsed for a monitor, key is the hash of its EDID */
+  struct ModeCache {
+    uint64_t edid_hash;
+    std::vector<DrmMode> modes;
+    uint32_t preferred_mode_id;
+    uint32_t mm_width;
+    uint32_t mm_height;
+  };
+  static constexpr size_t kMaxModeCaches = 4;
+  /* Most recently used last */
+  std::vector<ModeCache> mode_caches_;
 };
 }  // namespace android
 
@@ -63,6 +63,7 @@ class DrmCrtc {
   const DrmProperty &max_disp_freq_property() const;
   const DrmProperty &dqe_enabled_property() const;
   const DrmProperty &color_mode_property() const;
+  const DrmProperty &background_color_property() const;
 
   const std::vector<DrmProperty *> &properties() const {
       return properties_;
@@ -96,6 +97,7 @@ class DrmCrtc {
   DrmProperty max_disp_freq_property_;
   DrmProperty dqe_enabled_property_;
   DrmProperty color_mode_property_;
+  DrmProperty background_color_property_;
   std::vector<DrmProperty *> properties_;
 };
 }  // namespace android
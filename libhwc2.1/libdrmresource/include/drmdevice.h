@@ -24,8 +24,12 @@
 #include "drmplane.h"
 
 #include <map>
+#include <mutex>
+#include <string>
 #include <stdint.h>
 #include <tuple>
+#include <unordered_map>
+#include <utils/Timers.h>
 
 namespace android {
 
@@ -77,6 +81,10 @@ class DrmDevice {
   int CreatePropertyBlob(void *data, size_t length, uint32_t *blob_id);
   int DestroyPropertyBlob(uint32_t blob_id);
   bool HandlesDisplay(int display) const;
+  /* Wall time of Init() */
+  nsecs_t init_time_ns() const {
+    return init_time_ns_;
+  }
   void RegisterHotplugHandler(DrmEventHandler *handler) {
     event_listener_.RegisterHotplugHandler(handler);
   }
@@ -88,6 +96,8 @@ class DrmDevice {
 
   int CreateDisplayPipe(DrmConnector *connector);
   int AttachWriteback(DrmConnector *display_conn);
+  void ClearPropertyRegistry();
+  void ClearPropertyRegistryLocked();
 
   UniqueFd fd_;
   uint32_t mode_id_ = 0;
@@ -102,6 +112,22 @@ class DrmDevice {
   std::pair<uint32_t, uint32_t> min_resolution_;
   std::pair<uint32_t, uint32_t> max_resolution_;
   std::map<int, int> displays_;
+
+  /*
+   * Properties of each object by name, key is (obj_type << 32 | obj_id).
+   * Each object is queried once in Init() instead of once per property.
+   */
+  struct PropertyInfo {
+    drmModePropertyPtr property;
+    uint64_t value;
+  };
+  std::unordered_map<uint64_t, std::unordered_map<std::string, PropertyInfo>>
+      property_registry_;
+  std::mutex property_registry_lock_;
+  bool cache_properties_ = false;
+
+  static constexpr uint32_t kMaxPlaneInitThreads = 4;
+  nsecs_t init_time_ns_ = 0;
 };
 }  // namespace android
 
@@ -49,6 +49,8 @@ class DrmTUIEventHandler {
 class DrmEventListener : public Worker {
  static constexpr const char kTUIStatusPath[] = "/sys/devices/platform/exynos-drm/tui_status";
  static const uint32_t maxFds = 3;
+ static const uint32_t kUEventKernelGroup = 1;
+ static constexpr const char kUEventDrmDevpath[] = "/drm/";
  public:
   DrmEventListener(DrmDevice *drm);
   virtual ~DrmEventListener() {
@@ -71,6 +73,7 @@ class DrmEventListener : public Worker {
 
  private:
   void UEventHandler();
+  static bool IsDrmHotplugUEvent(const char *buffer, int len);
   void TUIEventHandler();
 
   UniqueFd epoll_fd_;
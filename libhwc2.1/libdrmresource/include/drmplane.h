@@ -22,6 +22,7 @@
 
 #include <stdint.h>
 #include <xf86drmMode.h>
+#include <unordered_map>
 #include <vector>
 
 namespace android {
@@ -30,6 +31,17 @@ class DrmDevice;
 
 class DrmPlane {
  public:
+  /* Modifiers are grouped by what the DPP channel needs to read them */
+  enum ModifierClass : uint32_t {
+    MODIFIER_LINEAR = 0,
+    MODIFIER_AFBC,
+    /* SBWC and colormap */
+    MODIFIER_SAMSUNG,
+    MODIFIER_OTHER,
+    MODIFIER_CLASS_MAX,
+  };
+  static ModifierClass GetModifierClass(uint64_t modifier);
+
   DrmPlane(DrmDevice *drm, drmModePlanePtr p);
   DrmPlane(const DrmPlane &) = delete;
   DrmPlane &operator=(const DrmPlane &) = delete;
@@ -76,6 +88,17 @@ class DrmPlane {
   const std::vector<uint32_t> &formats() const {
       return formats_;
   }
+  /*
+   * Parsed from IN_FORMATS. Without the property every modifier is
+   * reported as supported for the formats of the plane.
+   */
+  bool supports(uint32_t format, uint64_t modifier) const;
+  bool supports_modifier_class(ModifierClass modifier_class) const {
+      return modifier_classes_ & (1U << modifier_class);
+  }
+  bool has_in_formats() const {
+      return has_in_formats_;
+  }
 
  private:
   DrmDevice *drm_;
@@ -114,6 +137,13 @@ class DrmPlane {
 
   std::vector<DrmProperty *> properties_;
   std::vector<uint32_t> formats_;
+
+  int ParseInFormats();
+  bool has_in_formats_ = false;
+  /* Bitmask of ModifierClass by format */
+  std::unordered_map<uint32_t, uint32_t> format_modifier_classes_;
+  /* Union of format_modifier_classes_ */
+  uint32_t modifier_classes_ = 0;
 };
 }  // namespace android
 
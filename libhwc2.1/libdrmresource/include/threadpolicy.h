@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_THREAD_POLICY_H_
+#define ANDROID_THREAD_POLICY_H_
+
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * Roles of the HWC background threads. Each role has a scheduling policy,
+ * a timer slack and a cpu placement, see ApplyThreadPolicy().
+ */
+enum class ThreadRole {
+  VSYNC,          /* VSyncWorker, wakes up on every vsync */
+  DRM_EVENT,      /* DrmEventListener, page flip and hotplug events */
+  COMMIT,         /* Asynchronous atomic commit of a display */
+  DISPLAY_URGENT, /* Power hint, color update and brightness workers */
+  M2M_RESOURCE,   /* ExynosMPP resource release, M2M dst buffer allocation */
+  RECOMPOSITION,  /* Dynamic recomposition */
+  CLEANUP,        /* Framebuffer removal */
+  BACKGROUND,     /* Logging, recording and readback stream */
+  MAX,
+};
+
+enum class CpuPlacement {
+  ANY,
+  LITTLE, /* Cores with the lowest max frequency */
+  BIG,    /* All cores except the little cores */
+};
+
+struct ThreadPolicy {
+  bool is_rt;
+  /* SCHED_FIFO priority if is_rt, nice value otherwise */
+  int priority;
+  /* 0 keeps the slack inherited from the creating thread */
+  uint64_t timer_slack_ns;
+  CpuPlacement placement;
+};
+
+/*
+ * Returns the policy of the role. The defaults can be overridden with
+ * vendor.display.thread.<role>.{rt,priority,timer_slack_ns,cpus} where
+ * cpus is one of "any", "little" or "big".
+ */
+ThreadPolicy GetThreadPolicy(ThreadRole role);
+
+/* Applies the policy of the role to the calling thread */
+int ApplyThreadPolicy(ThreadRole role);
+
+const char *ThreadRoleName(ThreadRole role);
+}  // namespace android
+#endif
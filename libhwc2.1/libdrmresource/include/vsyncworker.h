@@ -21,7 +21,13 @@
 #include "worker.h"
 
 #include <stdint.h>
+#include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer.h>
@@ -34,22 +40,94 @@ class VsyncCallback {
      virtual void Callback(int display, int64_t timestamp) = 0;
 };
 
+class VSyncWorker;
+
+/*
+ * Optional hub of the vsync workers of all displays, enabled by
+ * vendor.display.vsync_hub.enabled. A worker whose hardware vsync comes at
+ * most vendor.display.vsync_hub.window_us before the vsync of another worker
+ * with the same period is parked. The later worker, its lead, delivers both
+ * vsyncs on one wakeup with the hardware timestamp of each display and feeds
+ * the vsync model of the parked worker.
+ * Workers are kept in a copy-on-write list that vsync dispatch reads without
+ * a lock. Unregister() waits for the dispatches that may still use the worker.
+ */
+class VSyncHub {
+ public:
+     static VSyncHub &GetInstance();
+
+     bool enabled() const {
+         return enabled_;
+     }
+     int64_t window_ns() const {
+         return window_ns_;
+     }
+
+     void Register(VSyncWorker *worker);
+     void Unregister(VSyncWorker *worker);
+
+     template <typename Fn>
+     void ForEachWorker(Fn fn) {
+         readers_++;
+         auto workers = std::atomic_load(&workers_);
+         for (VSyncWorker *worker : *workers) fn(worker);
+         readers_--;
+     }
+
+ private:
+     VSyncHub();
+
+     bool enabled_;
+     int64_t window_ns_;
+
+     std::mutex registration_lock_;
+     std::shared_ptr<const std::vector<VSyncWorker *>> workers_;
+     std::atomic<uint32_t> readers_{0};
+};
+
 class VSyncWorker : public Worker {
  public:
      VSyncWorker();
      ~VSyncWorker() override;
 
      int Init(DrmDevice *drm, int display);
+     /* Doesn't take the worker lock, the next vsync uses the new callback */
      void RegisterCallback(std::shared_ptr<VsyncCallback> callback);
 
      void VSyncControl(bool enabled);
 
+     /*
+      * Predicts the first hardware vsync strictly after 'after' from the
+      * period and phase fitted to the recent hardware timestamps. The model
+      * is kept while vsync is disabled so callers don't need to turn vsync
+      * on just to align to it. Returns -EAGAIN if no usable model exists.
+      */
+     int GetNextVsync(int64_t after, int64_t *next);
+
+     /* Appends a line of the VSyncHub state of the worker */
+     void DumpHubStats(std::string &out) const;
+
  protected:
      void Routine() override;
 
  private:
      int GetPhasedVSync(int64_t frame_ns, int64_t &expect);
      int SyntheticWaitVBlank(int64_t &timestamp);
+     int64_t GetModeVsyncPeriod();
+     void AddVsyncSample(int64_t timestamp, int64_t mode_period);
+     void ResetVsyncModelLocked();
+     void FitVsyncModelLocked();
+     int PredictVsyncLocked(int64_t after, int64_t *next);
+     double GetModelPeriod();
+
+     /* VSyncHub */
+     int QueryLastVBlank(int64_t *timestamp, uint32_t *sequence);
+     /* Returns false if the vsync of sequence was delivered already */
+     bool ClaimSequence(uint32_t sequence);
+     void DispatchFollowers(int64_t timestamp);
+     void CoalesceFollowers(int64_t timestamp);
+     void ReleaseFollowers();
+     void Uncoalesce();
 
      DrmDevice *drm_;
 
@@ -61,6 +139,26 @@ class VSyncWorker : public Worker {
      int display_;
      std::atomic_bool enabled_;
      int64_t last_timestamp_;
+
+     /* Worker that delivers the vsyncs of this parked worker */
+     std::atomic<VSyncWorker *> lead_{nullptr};
+     std::atomic<uint32_t> num_followers_{0};
+     /* (1 << 32) | sequence of the last delivered hardware vsync, 0 if none */
+     std::atomic<uint64_t> last_sequence_{0};
+     std::atomic<uint64_t> coalesced_vsyncs_{0};
+
+     struct VsyncSample {
+         int64_t timestamp;
+         /* number of vsync periods since the first sample of the model */
+         int64_t index;
+     };
+
+     std::mutex model_lock_;
+     std::deque<VsyncSample> samples_;
+     int64_t model_mode_period_ = 0;
+     bool model_valid_ = false;
+     double model_period_ = 0;
+     double model_phase_ = 0;
 };
 }  // namespace android
 
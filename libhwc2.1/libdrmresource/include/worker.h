@@ -21,10 +21,13 @@
 #include <stdlib.h>
 #include <string>
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
 
+#include "threadpolicy.h"
+
 namespace android {
 
 class Worker {
@@ -36,17 +39,18 @@ class Worker {
     mutex_.unlock();
   }
 
-  void Signal() {
-    cond_.notify_all();
-  }
+  void Signal();
   void Exit();
 
   bool initialized() const {
     return initialized_;
   }
 
+  /* Appends a line of wakeup counts and deadline lateness of the worker */
+  void DumpWakeupStats(std::string &out) const;
+
  protected:
-  Worker(const char *name, int priority, bool is_rt = false);
+  Worker(const char *name, ThreadRole role);
   virtual ~Worker();
 
   int InitWorker();
@@ -60,6 +64,16 @@ class Worker {
    */
   int WaitForSignalOrExitLocked(int64_t max_nanoseconds = -1);
 
+  /*
+   * Must be called without the lock. Sleeps on a timerfd until the absolute
+   * CLOCK_MONOTONIC deadline, which isn't deferred by the timer slack of the
+   * thread, for precision-critical workers. WaitForSignalOrExitLocked() waits
+   * are coarsened by the timer slack of the ThreadRole instead.
+   * Returns 0 at the deadline, -EAGAIN if woken up by Signal(), or -EINTR if
+   * interrupted by exit request.
+   */
+  int WaitUntilOrExit(int64_t deadline_ns);
+
   bool should_exit() const {
     return exit_;
   }
@@ -71,12 +85,21 @@ class Worker {
   void InternalRoutine();
 
   std::string name_;
-  int priority_;
+  ThreadRole role_;
 
   std::unique_ptr<std::thread> thread_;
-  bool is_rt_;
   bool exit_;
   bool initialized_;
+
+  /* WaitUntilOrExit() polls timer_fd_ and signal_fd_ written by Signal() */
+  int timer_fd_ = -1;
+  int signal_fd_ = -1;
+
+  std::atomic<uint64_t> signal_wakeups_{0};
+  std::atomic<uint64_t> timeout_wakeups_{0};
+  std::atomic<uint64_t> deadline_wakeups_{0};
+  std::atomic<int64_t> deadline_late_sum_ns_{0};
+  std::atomic<int64_t> deadline_late_max_ns_{0};
 };
 }  // namespace android
 #endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-thread-policy"
+
+#include "threadpolicy.h"
+
+#include <cutils/properties.h>
+#include <errno.h>
+#include <log/log.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <system/thread_defs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace android {
+
+namespace {
+
+/*
+ * Cleanup and logging threads must not preempt the vsync path, they stay at
+ * background priority on the little cores with a loose timer slack. Threads
+ * on the frame path avoid the little cores that are often busy.
+ * Indexed by ThreadRole.
+ */
+const ThreadPolicy kDefaultPolicies[] = {
+    /* VSYNC */ {true, 2, 0, CpuPlacement::BIG},
+    /* DRM_EVENT */ {false, HAL_PRIORITY_URGENT_DISPLAY, 0, CpuPlacement::BIG},
+    /* COMMIT */ {false, HAL_PRIORITY_URGENT_DISPLAY, 0, CpuPlacement::BIG},
+    /* DISPLAY_URGENT */ {false, HAL_PRIORITY_URGENT_DISPLAY, 0, CpuPlacement::ANY},
+    /* M2M_RESOURCE */ {false, ANDROID_PRIORITY_NORMAL, 0, CpuPlacement::ANY},
+    /* RECOMPOSITION */ {false, ANDROID_PRIORITY_BACKGROUND, 1000000, CpuPlacement::LITTLE},
+    /* CLEANUP */ {false, ANDROID_PRIORITY_BACKGROUND, 5000000, CpuPlacement::LITTLE},
+    /* BACKGROUND */ {false, ANDROID_PRIORITY_BACKGROUND, 5000000, CpuPlacement::LITTLE},
+};
+static_assert(sizeof(kDefaultPolicies) / sizeof(kDefaultPolicies[0]) ==
+                  static_cast<size_t>(ThreadRole::MAX),
+              "Every thread role needs a default policy");
+
+const char *const kRoleNames[] = {
+    "vsync", "drm_event", "commit", "display_urgent",
+    "m2m_resource", "recomposition", "cleanup", "background",
+};
+static_assert(sizeof(kRoleNames) / sizeof(kRoleNames[0]) ==
+                  static_cast<size_t>(ThreadRole::MAX),
+              "Every thread role needs a name");
+
+struct CpuClusters {
+  cpu_set_t little;
+  cpu_set_t big;
+  bool valid = false;
+};
+
+/* Little cores are the ones with the lowest cpuinfo_max_freq */
+const CpuClusters &GetCpuClusters() {
+  static CpuClusters clusters;
+  static std::once_flag once;
+
+  std::call_once(once, [] {
+    long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (num_cpus <= 0 || num_cpus > CPU_SETSIZE)
+      return;
+
+    uint64_t max_freqs[CPU_SETSIZE];
+    uint64_t min_max_freq = UINT64_MAX;
+    for (long cpu = 0; cpu < num_cpus; cpu++) {
+      std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                         "/cpufreq/cpuinfo_max_freq");
+      if (!(file >> max_freqs[cpu]))
+        return;
+      min_max_freq = std::min(min_max_freq, max_freqs[cpu]);
+    }
+
+    CPU_ZERO(&clusters.little);
+    CPU_ZERO(&clusters.big);
+    for (long cpu = 0; cpu < num_cpus; cpu++) {
+      if (max_freqs[cpu] == min_max_freq)
+        CPU_SET(cpu, &clusters.little);
+      else
+        CPU_SET(cpu, &clusters.big);
+    }
+    /* A single cluster has no little cores to avoid */
+    clusters.valid = CPU_COUNT(&clusters.big) > 0;
+  });
+
+  return clusters;
+}
+
+CpuPlacement ParsePlacement(const char *value, CpuPlacement def) {
+  if (!strcmp(value, "any"))
+    return CpuPlacement::ANY;
+  if (!strcmp(value, "little"))
+    return CpuPlacement::LITTLE;
+  if (!strcmp(value, "big"))
+    return CpuPlacement::BIG;
+  return def;
+}
+
+}  // namespace
+
+const char *ThreadRoleName(ThreadRole role) {
+  return kRoleNames[static_cast<int>(role)];
+}
+
+ThreadPolicy GetThreadPolicy(ThreadRole role) {
+  ThreadPolicy policy = kDefaultPolicies[static_cast<int>(role)];
+  std::string prefix = std::string("vendor.display.thread.") + ThreadRoleName(role);
+  char value[PROPERTY_VALUE_MAX];
+
+  policy.is_rt = property_get_bool((prefix + ".rt").c_str(), policy.is_rt);
+  policy.priority = property_get_int32((prefix + ".priority").c_str(), policy.priority);
+  policy.timer_slack_ns = property_get_int64((prefix + ".timer_slack_ns").c_str(),
+                                             policy.timer_slack_ns);
+  if (property_get((prefix + ".cpus").c_str(), value, "") > 0)
+    policy.placement = ParsePlacement(value, policy.placement);
+
+  return policy;
+}
+
+int ApplyThreadPolicy(ThreadRole role) {
+  ThreadPolicy policy = GetThreadPolicy(role);
+  int ret = 0;
+
+  if (policy.is_rt) {
+    struct sched_param param = {0};
+    param.sched_priority = policy.priority;
+    if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+      ret = -errno;
+  } else if (setpriority(PRIO_PROCESS, 0, policy.priority) < 0) {
+    ret = -errno;
+  }
+
+  if (policy.timer_slack_ns > 0 && prctl(PR_SET_TIMERSLACK, policy.timer_slack_ns) < 0)
+    ret = -errno;
+
+  const CpuClusters &clusters = GetCpuClusters();
+  if (policy.placement != CpuPlacement::ANY && clusters.valid) {
+    const cpu_set_t &cpus = (policy.placement == CpuPlacement::LITTLE) ? clusters.little
+                                                                       : clusters.big;
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+      ret = -errno;
+  }
+
+  if (ret < 0)
+    ALOGW("Failed to apply %s thread policy: %s", ThreadRoleName(role), strerror(-ret));
+
+  return ret;
+}
+}  // namespace android
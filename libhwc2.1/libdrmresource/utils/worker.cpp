@@ -16,17 +16,48 @@
 
 #include "worker.h"
 
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
 #include <sys/prctl.h>
-#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
 
 namespace android {
 
-Worker::Worker(const char *name, int priority, bool is_rt)
-    : name_(name), priority_(priority), is_rt_(is_rt), exit_(false), initialized_(false) {
+static constexpr int64_t kNsecsPerSec = 1000000000;
+
+static int64_t MonotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * kNsecsPerSec + ts.tv_nsec;
+}
+
+Worker::Worker(const char *name, ThreadRole role)
+    : name_(name), role_(role), exit_(false), initialized_(false) {
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  signal_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 }
 
 Worker::~Worker() {
   Exit();
+  if (timer_fd_ >= 0)
+    close(timer_fd_);
+  if (signal_fd_ >= 0)
+    close(signal_fd_);
+}
+
+void Worker::Signal() {
+  cond_.notify_all();
+  if (signal_fd_ >= 0) {
+    uint64_t value = 1;
+    (void)write(signal_fd_, &value, sizeof(value));
+  }
 }
 
 int Worker::InitWorker() {
@@ -47,7 +78,7 @@ void Worker::Exit() {
   exit_ = true;
   if (initialized()) {
     lk.unlock();
-    cond_.notify_all();
+    Signal();
     thread_->join();
     initialized_ = false;
   }
@@ -65,6 +96,10 @@ int Worker::WaitForSignalOrExitLocked(int64_t max_nanoseconds) {
              cond_.wait_for(lk, std::chrono::nanoseconds(max_nanoseconds))) {
     ret = -ETIMEDOUT;
   }
+  if (ret == -ETIMEDOUT)
+    timeout_wakeups_++;
+  else
+    signal_wakeups_++;
 
   // exit takes precedence on timeout
   if (should_exit())
@@ -76,15 +111,71 @@ int Worker::WaitForSignalOrExitLocked(int64_t max_nanoseconds) {
   return ret;
 }
 
-void Worker::InternalRoutine() {
-  if (is_rt_) {
-    struct sched_param param = { 0 };
-    param.sched_priority = priority_;
-    sched_setscheduler(0, SCHED_FIFO, &param);
+int Worker::WaitUntilOrExit(int64_t deadline_ns) {
+  if (should_exit())
+    return -EINTR;
+  if (timer_fd_ < 0 || signal_fd_ < 0)
+    return -ENODEV;
+
+  /* Signals sent before the wait are consumed like notify_all() before wait */
+  uint64_t value;
+  while (read(signal_fd_, &value, sizeof(value)) > 0)
+    ;
+
+  struct itimerspec its = {};
+  its.it_value.tv_sec = deadline_ns / kNsecsPerSec;
+  its.it_value.tv_nsec = deadline_ns % kNsecsPerSec;
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr) < 0)
+    return -errno;
+
+  struct pollfd fds[] = {
+      {.fd = timer_fd_, .events = POLLIN, .revents = 0},
+      {.fd = signal_fd_, .events = POLLIN, .revents = 0},
+  };
+  while (poll(fds, 2, -1) < 0) {
+    if (errno != EINTR)
+      return -errno;
+  }
+
+  int ret;
+  if (fds[0].revents & POLLIN) {
+    (void)read(timer_fd_, &value, sizeof(value));
+    int64_t late = std::max<int64_t>(MonotonicNs() - deadline_ns, 0);
+    deadline_wakeups_++;
+    deadline_late_sum_ns_ += late;
+    int64_t max = deadline_late_max_ns_;
+    while (late > max && !deadline_late_max_ns_.compare_exchange_weak(max, late))
+      ;
+    ret = 0;
   } else {
-    setpriority(PRIO_PROCESS, 0, priority_);
+    /* Disarm the timer so that it doesn't fire into the next wait */
+    its = {};
+    timerfd_settime(timer_fd_, 0, &its, nullptr);
+    signal_wakeups_++;
+    ret = -EAGAIN;
   }
 
+  if (should_exit())
+    ret = -EINTR;
+
+  return ret;
+}
+
+void Worker::DumpWakeupStats(std::string &out) const {
+  uint64_t deadlines = deadline_wakeups_;
+  char line[256];
+  snprintf(line, sizeof(line),
+           "\t%-20s signal %" PRIu64 ", timeout %" PRIu64 ", deadline %" PRIu64
+           ", late avg %" PRId64 " us, max %" PRId64 " us\n",
+           name_.c_str(), signal_wakeups_.load(), timeout_wakeups_.load(), deadlines,
+           deadlines ? deadline_late_sum_ns_ / static_cast<int64_t>(deadlines) / 1000 : 0,
+           deadline_late_max_ns_ / 1000);
+  out += line;
+}
+
+void Worker::InternalRoutine() {
+  ApplyThreadPolicy(role_);
+
   prctl(PR_SET_NAME, name_.c_str());
 
   std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
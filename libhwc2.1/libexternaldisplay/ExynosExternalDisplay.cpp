@@ -89,6 +89,10 @@ int ExynosExternalDisplay::openExternalDisplay()
         mLayers.clear();
     }
 
+    /* Modes of a monitor seen before come from the cache, warm the preferred mode blob */
+    if (mDisplayInterface->preparePreferredConfig() != NO_ERROR)
+        DISPLAY_LOGE("%s: failed to prepare the preferred config", __func__);
+
     DISPLAY_LOGD(eDebugExternalDisplay, "open fd for External Display(%d)", ret);
 
     return ret;
@@ -442,7 +446,7 @@ int32_t ExynosExternalDisplay::setPowerMode(
         int32_t /*hwc2_power_mode_t*/ mode) {
     Mutex::Autolock lock(mExternalMutex);
     {
-        Mutex::Autolock lock(mDisplayMutex);
+        TimedMutex::Autolock lock(mDisplayMutex);
 
         /* TODO state check routine should be added */
 
@@ -534,7 +538,7 @@ void ExynosExternalDisplay::handleHotplugEvent()
     {
         Mutex::Autolock lock(mExternalMutex);
         {
-            Mutex::Autolock lock(mDisplayMutex);
+            TimedMutex::Autolock lock(mDisplayMutex);
             mHpdStatus = hpd_temp;
             if (mHpdStatus) {
                 if (openExternalDisplay() < 0) {
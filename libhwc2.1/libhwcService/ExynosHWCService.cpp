@@ -298,6 +298,7 @@ int ExynosHWCService::setHWCCtl(uint32_t display, uint32_t ctrl, int32_t val)
     case HWC_CTL_SKIP_VALIDATE:
     case HWC_CTL_DUMP_MID_BUF:
     case HWC_CTL_CAPTURE_READBACK:
+    case HWC_CTL_READBACK_STREAM:
     case HWC_CTL_ENABLE_COMPOSITION_CROP:
     case HWC_CTL_ENABLE_EXYNOSCOMPOSITION_OPT:
     case HWC_CTL_ENABLE_CLIENTCOMPOSITION_OPT:
@@ -309,6 +310,10 @@ int ExynosHWCService::setHWCCtl(uint32_t display, uint32_t ctrl, int32_t val)
     case HWC_CTL_ENABLE_FENCE_TRACER:
     case HWC_CTL_SYS_FENCE_LOGGING:
     case HWC_CTL_DO_FENCE_FILE_DUMP:
+    case HWC_CTL_MERGE_M2M_LAYERS:
+    case HWC_CTL_LOW_FPS_LAYER_STRATEGY:
+    case HWC_CTL_MINIMAL_DOZE_COMPOSITION:
+    case HWC_CTL_GROUP_LAYERS_BY_OVERLAP:
         ALOGI("%s::%d on/off=%d", __func__, ctrl, val);
         mHWCCtx->device->setHWCControl(display, ctrl, val);
         break;
@@ -428,4 +433,31 @@ int32_t ExynosHWCService::setDisplayLhbm(int32_t display_id, uint32_t on) {
     return -EINVAL;
 }
 
+int32_t ExynosHWCService::getDisplayStageStats(int32_t display_id, std::vector<uint64_t> *stats) {
+    if (stats == nullptr) return -EINVAL;
+
+    auto display = mHWCCtx->device->getDisplay(display_id);
+
+    if (display != nullptr) {
+        display->getStageStats().serialize(*stats);
+        return NO_ERROR;
+    }
+
+    return -EINVAL;
+}
+
+int32_t ExynosHWCService::getFallbackStats(std::vector<uint64_t> *stats) {
+    if (stats == nullptr) return -EINVAL;
+
+    mHWCCtx->device->mResourceManager->serializeFallbackStats(*stats);
+    return NO_ERROR;
+}
+
+int32_t ExynosHWCService::getMPPUtilizationStats(std::vector<uint64_t> *stats) {
+    if (stats == nullptr) return -EINVAL;
+
+    mHWCCtx->device->mResourceManager->serializeUtilizationStats(*stats);
+    return NO_ERROR;
+}
+
 } //namespace android
@@ -74,6 +74,9 @@ public:
     virtual int32_t setPanelGammaTableSource(int32_t display_id, int32_t type, int32_t source);
     virtual int32_t setDisplayBrightness(int32_t display_id, float brightness);
     virtual int32_t setDisplayLhbm(int32_t display_id, uint32_t on);
+    virtual int32_t getDisplayStageStats(int32_t display_id, std::vector<uint64_t> *stats);
+    virtual int32_t getFallbackStats(std::vector<uint64_t> *stats);
+    virtual int32_t getMPPUtilizationStats(std::vector<uint64_t> *stats);
 
 private:
     friend class Singleton<ExynosHWCService>;
@@ -61,6 +61,9 @@ enum {
     SET_PANEL_GAMMA_TABLE_SOURCE = 1001,
     SET_DISPLAY_BRIGHTNESS = 1002,
     SET_DISPLAY_LHBM = 1003,
+    GET_DISPLAY_STAGE_STATS = 1004,
+    GET_FALLBACK_STATS = 1005,
+    GET_MPP_UTILIZATION_STATS = 1006,
 };
 
 class BpExynosHWCService : public BpInterface<IExynosHWCService> {
@@ -402,6 +405,49 @@ public:
         if (result) ALOGE("SET_DISPLAY_LHBM transact error(%d)", result);
         return result;
     }
+
+    virtual int32_t getDisplayStageStats(int32_t display_id, std::vector<uint64_t> *stats) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IExynosHWCService::getInterfaceDescriptor());
+        data.writeInt32(display_id);
+        int result = remote()->transact(GET_DISPLAY_STAGE_STATS, data, &reply);
+        if (result) {
+            ALOGE("GET_DISPLAY_STAGE_STATS transact error(%d)", result);
+            return result;
+        }
+        result = reply.readInt32();
+        if (result == NO_ERROR)
+            result = reply.readUint64Vector(stats);
+        return result;
+    }
+
+    virtual int32_t getFallbackStats(std::vector<uint64_t> *stats) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IExynosHWCService::getInterfaceDescriptor());
+        int result = remote()->transact(GET_FALLBACK_STATS, data, &reply);
+        if (result) {
+            ALOGE("GET_FALLBACK_STATS transact error(%d)", result);
+            return result;
+        }
+        result = reply.readInt32();
+        if (result == NO_ERROR)
+            result = reply.readUint64Vector(stats);
+        return result;
+    }
+
+    virtual int32_t getMPPUtilizationStats(std::vector<uint64_t> *stats) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IExynosHWCService::getInterfaceDescriptor());
+        int result = remote()->transact(GET_MPP_UTILIZATION_STATS, data, &reply);
+        if (result) {
+            ALOGE("GET_MPP_UTILIZATION_STATS transact error(%d)", result);
+            return result;
+        }
+        result = reply.readInt32();
+        if (result == NO_ERROR)
+            result = reply.readUint64Vector(stats);
+        return result;
+    }
 };
 
 IMPLEMENT_META_INTERFACE(ExynosHWCService, "android.hal.ExynosHWCService");
@@ -647,6 +693,37 @@ status_t BnExynosHWCService::onTransact(
             return NO_ERROR;
         } break;
 
+        case GET_DISPLAY_STAGE_STATS: {
+            CHECK_INTERFACE(IExynosHWCService, data, reply);
+            int32_t display_id = data.readInt32();
+            std::vector<uint64_t> stats;
+            int32_t error = getDisplayStageStats(display_id, &stats);
+            reply->writeInt32(error);
+            if (error == NO_ERROR)
+                reply->writeUint64Vector(stats);
+            return NO_ERROR;
+        } break;
+
+        case GET_FALLBACK_STATS: {
+            CHECK_INTERFACE(IExynosHWCService, data, reply);
+            std::vector<uint64_t> stats;
+            int32_t error = getFallbackStats(&stats);
+            reply->writeInt32(error);
+            if (error == NO_ERROR)
+                reply->writeUint64Vector(stats);
+            return NO_ERROR;
+        } break;
+
+        case GET_MPP_UTILIZATION_STATS: {
+            CHECK_INTERFACE(IExynosHWCService, data, reply);
+            std::vector<uint64_t> stats;
+            int32_t error = getMPPUtilizationStats(&stats);
+            reply->writeInt32(error);
+            if (error == NO_ERROR)
+                reply->writeUint64Vector(stats);
+            return NO_ERROR;
+        } break;
+
         default:
             return BBinder::onTransact(code, data, reply, flags);
     }
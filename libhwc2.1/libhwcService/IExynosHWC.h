@@ -71,6 +71,11 @@ public:
     */
     virtual int32_t setDisplayBrightness(int32_t display_id, float brightness) = 0;
     virtual int32_t setDisplayLhbm(int32_t display_id, uint32_t on) = 0;
+    /* Stage latency histograms of the display, see StageLatencyStats::serialize() */
+    virtual int32_t getDisplayStageStats(int32_t display_id, std::vector<uint64_t> *stats) = 0;
+    virtual int32_t getFallbackStats(std::vector<uint64_t> *stats) = 0;
+    /* Per-MPP utilization, see ExynosResourceManager::serializeUtilizationStats() */
+    virtual int32_t getMPPUtilizationStats(std::vector<uint64_t> *stats) = 0;
 };
 
 /* Native Interface */
@@ -15,15 +15,23 @@
  */
 #include "ExynosHWCHelper.h"
 
+#include <inttypes.h>
 #include <linux/videodev2.h>
 #include <linux/videodev2_exynos_media.h>
 #include <png.h>
 #include <sync/sync.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <utils/CallStack.h>
 #include <utils/Errors.h>
+#include <utils/Timers.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iomanip>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "ExynosHWC.h"
 #include "ExynosHWCDebug.h"
@@ -129,20 +137,48 @@ unsigned int isNarrowRgb(int format, android_dataspace data_space)
     }
 }
 
+/*
+ * Descriptors of exynos_format_desc grouped by HAL format, in table order.
+ * exynos_format_desc is not a literal type (String8), so the index is
+ * built once on the first lookup.
+ */
+static const std::unordered_map<int, std::vector<const format_description_t *>> &
+getHalFormatDescIndex() {
+    static const auto *index = [] {
+        auto *map = new std::unordered_map<int, std::vector<const format_description_t *>>();
+        for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++)
+            (*map)[exynos_format_desc[i].halFormat].push_back(&exynos_format_desc[i]);
+        return map;
+    }();
+    return *index;
+}
+
+/* Return the first descriptor of the HAL format regardless of compression */
+static const format_description_t *findHalFormatDesc(int format) {
+    const auto &index = getHalFormatDescIndex();
+    auto iter = index.find(format);
+    if ((iter == index.end()) || iter->second.empty())
+        return nullptr;
+    return iter->second.front();
+}
+
 const format_description_t* halFormatToExynosFormat(int inHalFormat, uint32_t inCompressType) {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++) {
-        const int descHalFormat = exynos_format_desc[i].halFormat;
-        uint32_t descCompressType = exynos_format_desc[i].getCompression();
+    const auto &index = getHalFormatDescIndex();
+    auto iter = index.find(inHalFormat);
+    if (iter == index.end())
+        return nullptr;
+
+    for (auto desc : iter->second) {
+        uint32_t descCompressType = desc->getCompression();
 
         // TODO: b/175381083, Skip checking SBWC compression type
         if (descCompressType == SBWC || descCompressType == SBWC_LOSSY) {
             descCompressType = COMP_ANY;
         }
 
-        if ((inHalFormat == descHalFormat) &&
-            ((inCompressType == COMP_ANY) || (descCompressType == COMP_ANY) ||
-             (inCompressType == descCompressType))) {
-            return &exynos_format_desc[i];
+        if ((inCompressType == COMP_ANY) || (descCompressType == COMP_ANY) ||
+            (inCompressType == descCompressType)) {
+            return desc;
         }
     }
     return nullptr;
@@ -150,10 +186,9 @@ const format_description_t* halFormatToExynosFormat(int inHalFormat, uint32_t in
 
 uint8_t formatToBpp(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format)
-            return exynos_format_desc[i].bpp;
-    }
+    auto desc = findHalFormatDesc(format);
+    if (desc != nullptr)
+        return desc->bpp;
 
     ALOGW("unrecognized pixel format %u", format);
     return 0;
@@ -171,15 +206,8 @@ uint8_t DpuFormatToBpp(decon_pixel_format format)
 
 bool isFormatRgb(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            if (exynos_format_desc[i].type & RGB)
-                return true;
-            else
-                return false;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && (desc->type & RGB);
 }
 
 bool isFormatYUV(int format)
@@ -191,83 +219,38 @@ bool isFormatYUV(int format)
 
 bool isFormatSBWC(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            if ((exynos_format_desc[i].type & SBWC) ||
-                    (exynos_format_desc[i].type & SBWC_LOSSY))
-                return true;
-            else
-                return false;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && ((desc->type & SBWC) || (desc->type & SBWC_LOSSY));
 }
 
 bool isFormatYUV420(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            if (exynos_format_desc[i].type & YUV420)
-                return true;
-            else
-                return false;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && (desc->type & YUV420);
 }
 
 bool isFormatYUV8_2(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            if ((exynos_format_desc[i].type & YUV420) &&
-                (exynos_format_desc[i].type & BIT8_2))
-                return true;
-            else
-                return false;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && (desc->type & YUV420) && (desc->type & BIT8_2);
 }
 
 bool isFormat10BitYUV420(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            if ((exynos_format_desc[i].type & YUV420) &&
-                (exynos_format_desc[i].type & BIT10))
-                return true;
-            else
-                return false;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && (desc->type & YUV420) && (desc->type & BIT10);
 }
 
 bool isFormatYUV422(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            if (exynos_format_desc[i].type & YUV422)
-                return true;
-            else
-                return false;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && (desc->type & YUV422);
 }
 
 bool isFormatP010(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            if (exynos_format_desc[i].type & P010)
-                return true;
-            else
-                return false;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && (desc->type & P010);
 }
 
 bool isFormatYCrCb(int format)
@@ -277,25 +260,14 @@ bool isFormatYCrCb(int format)
 
 bool isFormatLossy(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            if (exynos_format_desc[i].type & SBWC_LOSSY)
-                return true;
-            else
-                return false;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && (desc->type & SBWC_LOSSY);
 }
 
 bool formatHasAlphaChannel(int format)
 {
-    for (unsigned int i = 0; i < FORMAT_MAX_CNT; i++){
-        if (exynos_format_desc[i].halFormat == format) {
-            return exynos_format_desc[i].hasAlpha;
-        }
-    }
-    return false;
+    auto desc = findHalFormatDesc(format);
+    return (desc != nullptr) && desc->hasAlpha;
 }
 
 bool isAFBCCompressed(const buffer_handle_t handle) {
@@ -554,6 +526,16 @@ bool hasHdrInfo(android_dataspace dataSpace) {
     return hasHdrInfo(img);
 }
 
+/* matrix has TRANSFORM_MAT_SIZE elements */
+bool isIdentityColorMatrix(const float *matrix) {
+    for (uint32_t i = 0; i < TRANSFORM_MAT_SIZE; i++) {
+        float expected = ((i % 5) == 0) ? 1.0f : 0.0f;
+        if (matrix[i] != expected)
+            return false;
+    }
+    return true;
+}
+
 bool hasHdr10Plus(exynos_image &img) {
     /* TODO Check layer has hdr10 and dynamic metadata here */
     return (img.metaType & VIDEO_INFO_TYPE_HDR_DYNAMIC) ? true : false;
@@ -612,6 +594,19 @@ uint32_t getBytePerPixelOfPrimaryPlane(int format) {
         return 0;
 }
 
+uint64_t getReadBandwidthKBps(uint32_t w, uint32_t h, int format, bool compressed,
+                              uint32_t refreshRate) {
+    uint64_t bytes = (uint64_t)w * h * formatToBpp(format) / 8;
+
+    if (isFormatSBWC(format))
+        bytes = bytes * (isFormatLossy(format) ? BW_SBWC_LOSSY_RATIO_PERCENT :
+                BW_SBWC_RATIO_PERCENT) / 100;
+    else if (compressed)
+        bytes = bytes * BW_AFBC_RATIO_PERCENT / 100;
+
+    return bytes * refreshRate / 1000;
+}
+
 void setFenceName(int fenceFd, hwc_fence_type fenceType)
 {
     if (fenceFd >= 3)
@@ -625,105 +620,148 @@ void setFenceName(int fenceFd, hwc_fence_type fenceType)
     }
 }
 
+/* Plane lengths of a layout, indexed by plane_layout_t */
+typedef struct plane_layout_rule {
+    uint32_t (*yLength)(uint32_t width, uint32_t height);
+    uint32_t (*cbcrLength)(uint32_t width, uint32_t height);
+} plane_layout_rule_t;
+
+static const plane_layout_rule_t plane_layout_rules[] = {
+    /* PLANE_LAYOUT_DEFAULT */
+    {[](uint32_t w, uint32_t h) -> uint32_t {
+         return NV12M_Y_SIZE(w, h) + ((w % 128) == 0 ? 0 : 256);
+     },
+     [](uint32_t w, uint32_t h) -> uint32_t { return NV12M_CBCR_SIZE(w, h); }},
+    /* PLANE_LAYOUT_NV12M */
+    {[](uint32_t w, uint32_t h) -> uint32_t { return NV12M_Y_SIZE(w, h); },
+     [](uint32_t w, uint32_t h) -> uint32_t { return NV12M_CBCR_SIZE(w, h); }},
+    /* PLANE_LAYOUT_NV12M_S10B */
+    {[](uint32_t w, uint32_t h) -> uint32_t {
+         return NV12M_Y_SIZE(w, h) + NV12M_Y_2B_SIZE(w, h);
+     },
+     [](uint32_t w, uint32_t h) -> uint32_t {
+         return NV12M_CBCR_SIZE(w, h) + NV12M_CBCR_2B_SIZE(w, h);
+     }},
+    /* PLANE_LAYOUT_NV12N_S10B */
+    {[](uint32_t w, uint32_t h) -> uint32_t {
+         return NV12N_10B_Y_8B_SIZE(w, h) + NV12N_10B_Y_2B_SIZE(w, h);
+     },
+     [](uint32_t w, uint32_t h) -> uint32_t { return NV12M_CBCR_SIZE(w, h); }},
+    /* PLANE_LAYOUT_NV12N */
+    {[](uint32_t w, uint32_t h) -> uint32_t { return YUV420N_Y_SIZE(w, h); },
+     [](uint32_t w, uint32_t h) -> uint32_t { return NV12M_CBCR_SIZE(w, h); }},
+    /* PLANE_LAYOUT_P010M */
+    {[](uint32_t w, uint32_t h) -> uint32_t { return P010M_Y_SIZE(w, h); },
+     [](uint32_t w, uint32_t h) -> uint32_t { return P010M_CBCR_SIZE(w, h); }},
+    /* PLANE_LAYOUT_P010 */
+    {[](uint32_t w, uint32_t h) -> uint32_t { return P010_Y_SIZE(w, h); },
+     [](uint32_t w, uint32_t h) -> uint32_t { return P010_CBCR_SIZE(w, h); }},
+    /* PLANE_LAYOUT_GOOGLE_NV12 */
+    {[](uint32_t w, uint32_t h) -> uint32_t { return __ALIGN_UP(w, 64) * __ALIGN_UP(h, 8); },
+     [](uint32_t w, uint32_t h) -> uint32_t {
+         return __ALIGN_UP(w, 64) * __ALIGN_UP(h, 8) / 2;
+     }},
+    /* PLANE_LAYOUT_GOOGLE_P010 */
+    {[](uint32_t w, uint32_t h) -> uint32_t {
+         return 2 * __ALIGN_UP(w, 64) * __ALIGN_UP(h, 8);
+     },
+     [](uint32_t w, uint32_t h) -> uint32_t { return __ALIGN_UP(w, 64) * __ALIGN_UP(h, 8); }},
+    /* PLANE_LAYOUT_SBWC_8B */
+    {[](uint32_t w, uint32_t h) -> uint32_t {
+         return SBWC_8B_Y_SIZE(w, h) + SBWC_8B_Y_HEADER_SIZE(w, h);
+     },
+     [](uint32_t w, uint32_t h) -> uint32_t {
+         return SBWC_8B_CBCR_SIZE(w, h) + SBWC_8B_CBCR_HEADER_SIZE(w, h);
+     }},
+    /* PLANE_LAYOUT_SBWC_10B */
+    {[](uint32_t w, uint32_t h) -> uint32_t {
+         return SBWC_10B_Y_SIZE(w, h) + SBWC_10B_Y_HEADER_SIZE(w, h);
+     },
+     [](uint32_t w, uint32_t h) -> uint32_t {
+         return SBWC_10B_CBCR_SIZE(w, h) + SBWC_10B_CBCR_HEADER_SIZE(w, h);
+     }},
+};
+static_assert(sizeof(plane_layout_rules) / sizeof(plane_layout_rules[0]) == PLANE_LAYOUT_MAX,
+              "Every plane layout needs a rule");
+
+typedef struct plane_lengths {
+    int format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t yLength;
+    uint32_t cbcrLength;
+} plane_lengths_t;
+
+/*
+ * The same buffer is usually asked for its Y and then its CbCr length, and
+ * a buffer queue keeps the same geometry for many frames. The last lengths
+ * are kept per thread so the hit needs neither a lock nor the format lookup.
+ */
+static const plane_lengths_t &getPlaneLengths(uint32_t width, uint32_t height, int format)
+{
+    static thread_local plane_lengths_t cached = {HAL_PIXEL_FORMAT_EXYNOS_UNDEFINED, 0, 0, 0, 0};
+
+    if ((cached.format == format) && (cached.width == width) && (cached.height == height))
+        return cached;
+
+    auto desc = findHalFormatDesc(format);
+    plane_layout_t layout = (desc != nullptr) ? desc->layout : PLANE_LAYOUT_DEFAULT;
+    const plane_layout_rule_t &rule = plane_layout_rules[layout];
+
+    cached.format = format;
+    cached.width = width;
+    cached.height = height;
+    cached.yLength = rule.yLength(width, height);
+    cached.cbcrLength = rule.cbcrLength(width, height);
+    HDEBUGLOGD(eDebugMPP, "%s:: format(%d), %ux%u, layout(%d), Y(%u), CbCr(%u)", __func__,
+               format, width, height, layout, cached.yLength, cached.cbcrLength);
+
+    return cached;
+}
+
 uint32_t getExynosBufferYLength(uint32_t width, uint32_t height, int format)
 {
-    switch (format) {
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M:
-    case HAL_PIXEL_FORMAT_EXYNOS_YV12_M:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P_M:
-        return NV12M_Y_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B:
-        HDEBUGLOGD(eDebugMPP, "8bit size(Y) : %d, extra size : %d", NV12M_Y_SIZE(width, height), NV12M_Y_2B_SIZE(width, height));
-        return NV12M_Y_SIZE(width, height) + NV12M_Y_2B_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_S10B:
-        return NV12N_10B_Y_8B_SIZE(width, height) + NV12N_10B_Y_2B_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M:
-        HDEBUGLOGD(eDebugMPP, "size(Y) : %d", P010M_Y_SIZE(width, height));
-        return P010M_Y_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_YCBCR_P010:
-        HDEBUGLOGD(eDebugMPP, "size(Y) : %d", P010_Y_SIZE(width, height));
-        return P010_Y_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN:
-        return YUV420N_Y_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_GOOGLE_NV12_SP_10B:
-        return 2 * __ALIGN_UP(width, 64) * __ALIGN_UP(height, 8);
-    case HAL_PIXEL_FORMAT_GOOGLE_NV12_SP:
-        return __ALIGN_UP(width, 64) * __ALIGN_UP(height, 8);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC_L50:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC_L75:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC_L50:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC_L75:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_SBWC:
-        return SBWC_8B_Y_SIZE(width, height) +
-            SBWC_8B_Y_HEADER_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L40:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L60:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L80:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L40:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L60:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L80:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_10B_SBWC:
-        return SBWC_10B_Y_SIZE(width, height) +
-            SBWC_10B_Y_HEADER_SIZE(width, height);
-    }
-
-    return NV12M_Y_SIZE(width, height) + ((width % 128) == 0 ? 0 : 256);
+    return getPlaneLengths(width, height, format).yLength;
 }
 
 uint32_t getExynosBufferCbCrLength(uint32_t width, uint32_t height, int format)
 {
-    switch (format) {
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M:
-    case HAL_PIXEL_FORMAT_EXYNOS_YV12_M:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P_M:
-        return NV12M_CBCR_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B:
-        HDEBUGLOGD(eDebugMPP, "8bit size(CbCr) : %d, extra size : %d",NV12M_CBCR_SIZE(width, height), NV12M_CBCR_2B_SIZE(width, height));
-        return NV12M_CBCR_SIZE(width, height) + NV12M_CBCR_2B_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M:
-        HDEBUGLOGD(eDebugMPP, "size(CbCr) : %d", P010M_CBCR_SIZE(width, height));
-        return P010M_CBCR_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_YCBCR_P010:
-        HDEBUGLOGD(eDebugMPP, "size(CbCr) : %d", P010_CBCR_SIZE(width, height));
-        return P010_CBCR_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_GOOGLE_NV12_SP_10B:
-        return __ALIGN_UP(width, 64) * __ALIGN_UP(height, 8);
-    case HAL_PIXEL_FORMAT_GOOGLE_NV12_SP:
-        return __ALIGN_UP(width, 64) * __ALIGN_UP(height, 8) / 2;
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC_L50:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC_L75:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC_L50:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC_L75:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_SBWC:
-        return SBWC_8B_CBCR_SIZE(width, height) +
-            SBWC_8B_CBCR_HEADER_SIZE(width, height);
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L40:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L60:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L80:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L40:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L60:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L80:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_10B_SBWC:
-        return SBWC_10B_CBCR_SIZE(width, height) +
-            SBWC_10B_CBCR_HEADER_SIZE(width, height);
-    }
-
-    return NV12M_CBCR_SIZE(width, height);
+    return getPlaneLengths(width, height, format).cbcrLength;
+}
+
+#if !defined(DISABLE_HWC_DEBUG)
+/*
+ * The planes described by the layout rules must fit in what gralloc
+ * allocated, otherwise the HW reads or writes past the buffer.
+ * It is reported once per format not to flood the log.
+ */
+static void checkPlaneLayout(const VendorGraphicBufferMeta &gmeta, uint32_t bufferNumber,
+                             int format, uint32_t width, uint32_t height)
+{
+    auto desc = findHalFormatDesc(format);
+    if ((desc == nullptr) || (desc->layout == PLANE_LAYOUT_DEFAULT) || (desc->planeNum != 2))
+        return;
+
+    const plane_lengths_t &lengths = getPlaneLengths(width, height, format);
+    bool fits = (bufferNumber == 1)
+            ? ((uint64_t)lengths.yLength + lengths.cbcrLength <= (uint64_t)gmeta.size)
+            : ((lengths.yLength <= (uint64_t)gmeta.size) &&
+               (lengths.cbcrLength <= (uint64_t)gmeta.size1));
+    if (fits)
+        return;
+
+    static std::mutex reportedMutex;
+    static std::unordered_map<int, bool> reported;
+    std::lock_guard<std::mutex> lock(reportedMutex);
+    if (reported[format])
+        return;
+    reported[format] = true;
+
+    ALOGE("%s:: %s %ux%u layout Y(%u) CbCr(%u) exceeds gralloc size(%d) size1(%d)",
+          __func__, desc->name.string(), width, height, lengths.yLength, lengths.cbcrLength,
+          gmeta.size, gmeta.size1);
 }
+#endif
 
 int getBufLength(buffer_handle_t handle, uint32_t planerNum, size_t *length, int format, uint32_t width, uint32_t height)
 {
@@ -733,6 +771,10 @@ int getBufLength(buffer_handle_t handle, uint32_t planerNum, size_t *length, int
 
     VendorGraphicBufferMeta gmeta(handle);
 
+#if !defined(DISABLE_HWC_DEBUG)
+    checkPlaneLayout(gmeta, bufferNumber, format, width, height);
+#endif
+
     switch (bufferNumber) {
         case 1:
             length[0] = gmeta.size;
@@ -775,6 +817,22 @@ bool fence_valid(int fence) {
     return true;
 }
 
+int64_t getFenceSignalTime(int fence) {
+    struct sync_file_info *info = sync_file_info(fence);
+    if (info == NULL)
+        return -1;
+
+    int64_t timestamp = -1;
+    if (info->status == 1) {
+        struct sync_fence_info *fenceInfo = sync_get_fence_info(info);
+        for (uint32_t i = 0; i < info->num_fences; i++)
+            timestamp = std::max(timestamp, static_cast<int64_t>(fenceInfo[i].timestamp_ns));
+    }
+    sync_file_info_free(info);
+
+    return timestamp;
+}
+
 int hwcFdClose(int fd) {
     if (fd>= 3)
         close(fd);
@@ -822,6 +880,127 @@ struct tm* getLocalTime(struct timeval tv) {
     return (struct tm*)localtime((time_t*)&tv.tv_sec);
 }
 
+#ifndef DISABLE_FENCE_TRACE
+namespace {
+constexpr uint64_t kFenceEventRingSize = 256;
+constexpr size_t kMaxFenceEventRings = 32;
+
+/* Written only by its owner thread, read by dump paths */
+struct FenceEventRing {
+    pid_t tid;
+    std::atomic<uint64_t> head{0};
+    hwc_fence_event_t events[kFenceEventRingSize];
+};
+
+std::mutex sFenceEventRingMutex;
+std::vector<std::unique_ptr<FenceEventRing>> sFenceEventRings;
+
+FenceEventRing* getThreadFenceEventRing() {
+    thread_local FenceEventRing* ring = nullptr;
+    thread_local bool registered = false;
+
+    /* The lock is taken once per thread, rings are never freed */
+    if (!registered) {
+        registered = true;
+        std::lock_guard<std::mutex> lock(sFenceEventRingMutex);
+        if (sFenceEventRings.size() < kMaxFenceEventRings) {
+            sFenceEventRings.push_back(std::make_unique<FenceEventRing>());
+            ring = sFenceEventRings.back().get();
+            ring->tid = gettid();
+        } else {
+            ALOGW("Fence trace : too many threads, tid %d is not traced", gettid());
+        }
+    }
+    return ring;
+}
+
+void recordFenceEvent(uint32_t fd, uint32_t displayId, uint32_t direction,
+        hwc_fdebug_fence_type type, hwc_fdebug_ip_type ip) {
+    FenceEventRing* ring = getThreadFenceEventRing();
+    if (ring == nullptr) return;
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    hwc_fence_event_t& event = ring->events[head % kFenceEventRingSize];
+    event.timeNs = systemTime(SYSTEM_TIME_MONOTONIC);
+    event.fd = fd;
+    event.displayId = displayId;
+    event.direction = direction;
+    event.type = type;
+    event.ip = ip;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+} // namespace
+#endif
+
+void getFenceEvents(std::vector<hwc_fence_event_t>& events) {
+    events.clear();
+#ifndef DISABLE_FENCE_TRACE
+    std::lock_guard<std::mutex> lock(sFenceEventRingMutex);
+    for (auto& ring : sFenceEventRings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t count = std::min(head, kFenceEventRingSize);
+        size_t base = events.size();
+        for (uint64_t i = head - count; i < head; i++)
+            events.push_back(ring->events[i % kFenceEventRingSize]);
+
+        /* Drop the entries the owner thread overwrote while they were copied */
+        uint64_t newHead = ring->head.load(std::memory_order_acquire);
+        uint64_t firstValid = (newHead >= kFenceEventRingSize) ?
+            newHead - kFenceEventRingSize + 1 : 0;
+        if (firstValid > head - count) {
+            size_t overwritten = std::min(firstValid - (head - count), count);
+            events.erase(events.begin() + base, events.begin() + base + overwritten);
+        }
+    }
+    std::sort(events.begin(), events.end(),
+            [](const hwc_fence_event_t& a, const hwc_fence_event_t& b) {
+                return a.timeNs < b.timeNs;
+            });
+#endif
+}
+
+void dumpFenceEvents(String8& result, int32_t fd) {
+    std::vector<hwc_fence_event_t> events;
+    getFenceEvents(events);
+
+    /* Events are stamped with the monotonic clock, print them in wall time */
+    nsecs_t offset = systemTime(SYSTEM_TIME_REALTIME) - systemTime(SYSTEM_TIME_MONOTONIC);
+    for (const auto& event : events) {
+        if ((fd >= 0) && (event.fd != fd))
+            continue;
+        nsecs_t realTime = event.timeNs + offset;
+        struct timeval tv;
+        tv.tv_sec = realTime / 1000000000;
+        tv.tv_usec = (realTime % 1000000000) / 1000;
+        struct tm* localTime = getLocalTime(tv);
+        result.appendFormat("FD : %d, Display(%d), direction : %d, type(%d), ip(%d), "
+                "time:%02d-%02d %02d:%02d:%02d.%03lu(%lu)\n",
+                event.fd, event.displayId, event.direction, event.type, event.ip,
+                localTime->tm_mon+1, localTime->tm_mday,
+                localTime->tm_hour, localTime->tm_min,
+                localTime->tm_sec, tv.tv_usec/1000,
+                ((tv.tv_sec * 1000) + (tv.tv_usec / 1000)));
+    }
+}
+
+/* Adds (delta 1) or removes (delta -1) a fence of the table from the counters */
+static void countFence(ExynosDevice *device, const hwc_fence_info_t &info, int32_t delta) {
+    if (info.usage == 0)
+        return;
+    device->mFenceCount.live += delta;
+    if (!info.pendingAllowed && !info.leaking)
+        device->mFenceCount.unexpected[info.displayId] += delta;
+}
+
+static void touchFence(ExynosDevice *device, uint32_t fd) {
+    hwc_fence_info_t &info = device->mFenceInfo[fd];
+    if (!info.touched) {
+        info.touched = true;
+        device->mFenceCount.touched.push_back(fd);
+    }
+}
+
+#ifndef DISABLE_FENCE_TRACE
 void setFenceInfo(uint32_t fd, ExynosDisplay* display,
         hwc_fdebug_fence_type type, hwc_fdebug_ip_type ip,
         uint32_t direction, bool pendingAllowed) {
@@ -832,8 +1011,9 @@ void setFenceInfo(uint32_t fd, ExynosDisplay* display,
 
     ExynosDevice* device = display->mDevice;
     hwc_fence_info_t* info = &device->mFenceInfo[fd];
+    countFence(device, *info, -1);
+    touchFence(device, fd);
     info->displayId = display->mDisplayId;
-    struct timeval tv;
 
     // FIXME: sync_fence_info, sync_pt_info are deprecated
     //        HWC guys should fix this.
@@ -886,22 +1066,11 @@ void setFenceInfo(uint32_t fd, ExynosDisplay* display,
     if (trace != NULL) {
         trace->type = type;
         trace->ip = ip;
-        gettimeofday(&trace->time, NULL);
-        tv = trace->time;
         trace->curFlag = 1;
+        recordFenceEvent(fd, display->mDisplayId, direction, type, ip);
         FT_LOGW("FD : %d, direction : %d, type : %d, ip : %d", fd, direction, trace->type, trace->ip);
-    //  device->fenceTracing.appendFormat("FD : %d, From : %s\n", fd, info->trace.fromName);
     }
 
-#if 0 // To be used ?
-    struct tm* localTime = getLocalTime(tv);
-    device->fenceTracing.appendFormat("usage : %d, time:%02d-%02d %02d:%02d:%02d.%03lu(%lu)\n", info->usage,
-            localTime->tm_mon+1, localTime->tm_mday,
-            localTime->tm_hour, localTime->tm_min,
-            localTime->tm_sec, tv.tv_usec/1000,
-            ((tv.tv_sec * 1000) + (tv.tv_usec / 1000)));
-#endif
-
     // Fence's usage count shuld be zero at end of frame(present done).
     // This flag means usage count of the fence can be pended over frame.
     info->pendingAllowed = pendingAllowed;
@@ -910,12 +1079,12 @@ void setFenceInfo(uint32_t fd, ExynosDisplay* display,
         info->pendingAllowed = false;
 
     info->last_dir = direction;
+    countFence(device, *info, 1);
 }
+#endif
 
 void printLastFenceInfo(uint32_t fd, ExynosDisplay* display) {
 
-    struct timeval tv;
-
     if (!fence_valid(fd)) return;
     /* valid but fence will not be traced */
     if (fd >= MAX_FD_NUM) return;
@@ -948,7 +1117,6 @@ void printLastFenceInfo(uint32_t fd, ExynosDisplay* display) {
     if (trace != NULL) {
         FT_LOGD("Last state : %d, type(%d), ip(%d)",
                 info->last_dir, trace->type, trace->ip);
-        tv = info->from.time;
     }
 
     FT_LOGD("from : %d, %d (cur : %d), to : %d, %d (cur : %d), hwc_dup : %d, %d (cur : %d),hwc_close : %d, %d (cur : %d)",
@@ -957,13 +1125,9 @@ void printLastFenceInfo(uint32_t fd, ExynosDisplay* display) {
             info->dup.type, info->dup.ip, info->dup.curFlag,
             info->close.type, info->close.ip, info->close.curFlag);
 
-    struct tm* localTime = getLocalTime(tv);
-
-    FT_LOGD("usage : %d, time:%02d-%02d %02d:%02d:%02d.%03lu(%lu)", info->usage,
-            localTime->tm_mon+1, localTime->tm_mday,
-            localTime->tm_hour, localTime->tm_min,
-            localTime->tm_sec, tv.tv_usec/1000,
-            ((tv.tv_sec * 1000) + (tv.tv_usec / 1000)));
+    String8 events;
+    dumpFenceEvents(events, fd);
+    FT_LOGD("usage : %d\n%s", info->usage, events.string());
 }
 
 void dumpFenceInfo(ExynosDisplay *display, int32_t __unused depth) {
@@ -1022,7 +1186,10 @@ void dumpNCheckLeak(ExynosDisplay *display, int32_t __unused depth) {
         if ((info[i].usage >= 1 || info[i].usage <= -1) && (!info[i].pendingAllowed))
             // leak is occured in this frame first
             if (!info[i].leaking) {
+                countFence(device, info[i], -1);
                 info[i].leaking = true;
+                countFence(device, info[i], 1);
+                touchFence(device, i);
                 printLastFenceInfo(i, display);
             }
     }
@@ -1036,10 +1203,12 @@ void dumpNCheckLeak(ExynosDisplay *display, int32_t __unused depth) {
 }
 
 bool fenceWarn(ExynosDisplay *display, uint32_t threshold) {
+#ifdef DISABLE_FENCE_TRACE
+    return false;
+#endif
 
     uint32_t cnt = 0, r_cnt = 0;
     ExynosDevice* device = display->mDevice;
-    hwc_fence_info_t* info = device->mFenceInfo;
 
     // FIXME: sync_fence_info() is deprecated
     //        HWC guys should fix this.
@@ -1056,10 +1225,7 @@ bool fenceWarn(ExynosDisplay *display, uint32_t threshold) {
     }
 #endif
 
-    for (int i=0; i < MAX_FD_NUM; i++){
-        if(info[i].usage >= 1 || info[i].usage <= -1)
-        cnt++;
-    }
+    cnt = (uint32_t)max(device->mFenceCount.live, 0);
 
     if ((cnt>threshold) || (exynosHWCControl.fenceTracer > 0))
         dumpFenceInfo(display, 0);
@@ -1072,10 +1238,12 @@ bool fenceWarn(ExynosDisplay *display, uint32_t threshold) {
     return (cnt>threshold) ? true : false;
 }
 
+/* Only the fences that were changed since the last call have flags to reset */
 void resetFenceCurFlag(ExynosDisplay *display) {
     ExynosDevice* device = display->mDevice;
     hwc_fence_info_t* info = device->mFenceInfo;
-    for (int i=0; i < MAX_FD_NUM; i++){
+    for (uint32_t i : device->mFenceCount.touched) {
+        info[i].touched = false;
         if (info[i].usage == 0) {
             info[i].displayId = HWC_DISPLAY_PRIMARY;
             info[i].leaking = false;
@@ -1088,14 +1256,22 @@ void resetFenceCurFlag(ExynosDisplay *display) {
             info[i].curFlag = 0;
         }
     }
+    device->mFenceCount.touched.clear();
 }
 
 bool validateFencePerFrame(ExynosDisplay *display) {
+#ifdef DISABLE_FENCE_TRACE
+    return true;
+#endif
 
     ExynosDevice* device = display->mDevice;
     hwc_fence_info_t* info = device->mFenceInfo;
     bool ret = true;
 
+    auto count = device->mFenceCount.unexpected.find(display->mDisplayId);
+    if ((count == device->mFenceCount.unexpected.end()) || (count->second <= 0))
+        return true;
+
     for (int i=0; i < MAX_FD_NUM; i++){
         if (info[i].displayId != display->mDisplayId)
             continue;
@@ -1115,6 +1291,33 @@ bool validateFencePerFrame(ExynosDisplay *display) {
     return ret;
 }
 
+/*
+ * Counts the fences of the table again. Returns false if the counters had
+ * drifted, e.g. because of a fence that was changed without setFenceInfo().
+ */
+bool auditFenceCount(ExynosDisplay *display) {
+    ExynosDevice* device = display->mDevice;
+    hwc_fence_info_t* info = device->mFenceInfo;
+    hwc_fence_count_t &fenceCount = device->mFenceCount;
+    int32_t live = fenceCount.live;
+    auto unexpected = fenceCount.unexpected;
+
+    fenceCount.live = 0;
+    fenceCount.unexpected.clear();
+    for (int i=0; i < MAX_FD_NUM; i++)
+        countFence(device, info[i], 1);
+
+    for (auto &it : unexpected) {
+        if (it.second == 0)
+            continue;
+        auto count = fenceCount.unexpected.find(it.first);
+        if ((count == fenceCount.unexpected.end()) || (count->second != it.second))
+            return false;
+    }
+    return (live == fenceCount.live);
+}
+
+#ifndef DISABLE_FENCE_TRACE
 void setFenceName(uint32_t fd, ExynosDisplay *display,
         hwc_fdebug_fence_type type, hwc_fdebug_ip_type ip,
         uint32_t direction, bool pendingAllowed) {
@@ -1125,6 +1328,8 @@ void setFenceName(uint32_t fd, ExynosDisplay *display,
     if (fd >= MAX_FD_NUM) return;
 
     hwc_fence_info_t* info = &device->mFenceInfo[fd];
+    countFence(device, *info, -1);
+    touchFence(device, fd);
     info->displayId = display->mDisplayId;
     fenceTrace_t *trace = NULL;
 
@@ -1156,7 +1361,9 @@ void setFenceName(uint32_t fd, ExynosDisplay *display,
 
     if (info->usage == 0)
         info->pendingAllowed = false;
+    countFence(device, *info, 1);
 }
+#endif
 
 String8 getMPPStr(int typeId) {
     if (typeId < MPP_DPP_NUM){
@@ -1352,3 +1559,38 @@ int32_t load_png_image(const char* filepath, buffer_handle_t buffer) {
 
     return 0;
 }
+
+void TimedMutex::lock() {
+    nsecs_t waitNs = 0;
+    if (tryLock() != NO_ERROR) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        Mutex::lock();
+        waitNs = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    }
+
+    size_t bucket = 0;
+    while ((bucket < kWaitBucketNum - 1) && (waitNs >= us2ns(kWaitBucketUs[bucket]))) bucket++;
+    mWaitCount[bucket].fetch_add(1, std::memory_order_relaxed);
+    if (waitNs == 0) return;
+
+    mTotalWaitNs.fetch_add(waitNs, std::memory_order_relaxed);
+    uint64_t maxWaitNs = mMaxWaitNs.load(std::memory_order_relaxed);
+    while ((static_cast<uint64_t>(waitNs) > maxWaitNs) &&
+           !mMaxWaitNs.compare_exchange_weak(maxWaitNs, waitNs, std::memory_order_relaxed)) {
+    }
+}
+
+void TimedMutex::dump(String8 &result, const char *name) const {
+    result.appendFormat("%s lock wait (usec):", name);
+    for (size_t i = 0; i < kWaitBucketNum; i++) {
+        if (i < kWaitBucketNum - 1)
+            result.appendFormat(" <%" PRId64 ": %" PRIu64, kWaitBucketUs[i],
+                                mWaitCount[i].load(std::memory_order_relaxed));
+        else
+            result.appendFormat(" >=%" PRId64 ": %" PRIu64, kWaitBucketUs[i - 1],
+                                mWaitCount[i].load(std::memory_order_relaxed));
+    }
+    result.appendFormat(", total %" PRIu64 " usec, max %" PRIu64 " usec\n",
+                        mTotalWaitNs.load(std::memory_order_relaxed) / 1000,
+                        mMaxWaitNs.load(std::memory_order_relaxed) / 1000);
+}
@@ -16,13 +16,19 @@
 #ifndef _EXYNOSHWCHELPER_H
 #define _EXYNOSHWCHELPER_H
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <drm/drm_fourcc.h>
 #include <hardware/hwcomposer2.h>
+#include <utils/Mutex.h>
 #include <utils/String8.h>
+#include <utils/Timers.h>
 
 #include <optional>
 
@@ -36,9 +42,16 @@
 
 #define MAX_FENCE_NAME 64
 #define MAX_FENCE_THRESHOLD 500
+/* Frames between the full scans of the fence table that correct the counters */
+#define FENCE_AUDIT_INTERVAL 600
 #define MAX_FD_NUM      1024
 
 #define MAX_USE_FORMAT 27
+
+/* Typical size of compressed buffers in percent of the raw size, used for bandwidth estimation */
+#define BW_AFBC_RATIO_PERCENT       60
+#define BW_SBWC_RATIO_PERCENT       70
+#define BW_SBWC_LOSSY_RATIO_PERCENT 50
 #ifndef P010M_Y_SIZE
 #define P010M_Y_SIZE(w,h) (__ALIGN_UP((w), 16) * 2 * __ALIGN_UP((h), 16) + 256)
 #endif
@@ -114,6 +127,27 @@ typedef enum format_type {
 
 } format_type_t;
 
+/*
+ * Plane layout of the YUV formats, it selects the rules that
+ * getExynosBufferYLength() and getExynosBufferCbCrLength() apply.
+ * The alignment and padding numbers stay in exynos_format.h that is shared
+ * with gralloc. Formats without a layout use PLANE_LAYOUT_DEFAULT.
+ */
+typedef enum plane_layout {
+    PLANE_LAYOUT_DEFAULT = 0,   /* NV12M, Y padded if width is not 128 aligned */
+    PLANE_LAYOUT_NV12M,         /* 16x16 aligned, 256 bytes padding per plane */
+    PLANE_LAYOUT_NV12M_S10B,    /* NV12M followed by the 2-bit planes */
+    PLANE_LAYOUT_NV12N_S10B,    /* single buffer, 8-bit and 2-bit Y planes */
+    PLANE_LAYOUT_NV12N,         /* single buffer, NV12N aligned Y plane */
+    PLANE_LAYOUT_P010M,         /* 16x16 aligned, 16-bit samples, 256 bytes padding */
+    PLANE_LAYOUT_P010,          /* unaligned 16-bit samples */
+    PLANE_LAYOUT_GOOGLE_NV12,   /* 64x8 aligned 8-bit samples */
+    PLANE_LAYOUT_GOOGLE_P010,   /* 64x8 aligned 16-bit samples */
+    PLANE_LAYOUT_SBWC_8B,       /* SBWC payload followed by its header */
+    PLANE_LAYOUT_SBWC_10B,
+    PLANE_LAYOUT_MAX,
+} plane_layout_t;
+
 typedef struct format_description {
     inline uint32_t getFormat() const { return type & FORMAT_MASK; }
     inline uint32_t getBit() const { return type & BIT_MASK; }
@@ -128,6 +162,7 @@ typedef struct format_description {
     bool hasAlpha;
     String8 name;
     uint32_t reserved;
+    plane_layout_t layout;
 } format_description_t;
 
 constexpr int HAL_PIXEL_FORMAT_EXYNOS_UNDEFINED = 0;
@@ -154,27 +189,34 @@ const format_description_t exynos_format_desc[] = {
 
     /* YUV 420 */
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P_M, DECON_PIXEL_FORMAT_YUV420M, DRM_FORMAT_UNDEFINED,
-        3, 3, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_P_M"), 0},
+        3, 3, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_P_M"), 0,
+        PLANE_LAYOUT_NV12M},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M, DECON_PIXEL_FORMAT_NV12M, DRM_FORMAT_NV12,
-        2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SP_M"), 0},
+        2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SP_M"), 0,
+        PLANE_LAYOUT_NV12M},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_TILED, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_UNDEFINED,
         2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SP_M_TILED"), 0},
     {HAL_PIXEL_FORMAT_EXYNOS_YV12_M, DECON_PIXEL_FORMAT_YVU420M, DRM_FORMAT_UNDEFINED,
-        3, 3, 12, YUV420|BIT8, false, String8("EXYNOS_YV12_M"), 0},
+        3, 3, 12, YUV420|BIT8, false, String8("EXYNOS_YV12_M"), 0,
+        PLANE_LAYOUT_NV12M},
     {HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M, DECON_PIXEL_FORMAT_NV21M, DRM_FORMAT_NV21,
-        2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCrCb_420_SP_M"), 0},
+        2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCrCb_420_SP_M"), 0,
+        PLANE_LAYOUT_NV12M},
     {HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL, DECON_PIXEL_FORMAT_NV21M, DRM_FORMAT_NV21,
-        2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCrCb_420_SP_M_FULL"), 0},
+        2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCrCb_420_SP_M_FULL"), 0,
+        PLANE_LAYOUT_NV12M},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_UNDEFINED,
         3, 1, 0, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_P"), 0},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_UNDEFINED,
         2, 1, 0, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SP"), 0},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV, DECON_PIXEL_FORMAT_NV12M, DRM_FORMAT_NV12,
-        2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SP_M_PRIV"), 0},
+        2, 2, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SP_M_PRIV"), 0,
+        PLANE_LAYOUT_NV12M},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_PN, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_UNDEFINED,
         3, 1, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_PN"), 0},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN, DECON_PIXEL_FORMAT_NV12N, DRM_FORMAT_NV12,
-        2, 1, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SPN"), 0},
+        2, 1, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SPN"), 0,
+        PLANE_LAYOUT_NV12N},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_TILED, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_UNDEFINED,
         2, 1, 12, YUV420|BIT8, false, String8("EXYNOS_YCbCr_420_SPN_TILED"), 0},
     {HAL_PIXEL_FORMAT_YCrCb_420_SP, DECON_PIXEL_FORMAT_NV21, DRM_FORMAT_NV21,
@@ -182,18 +224,24 @@ const format_description_t exynos_format_desc[] = {
     {HAL_PIXEL_FORMAT_YV12, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_UNDEFINED,
         3, 1, 12, YUV420|BIT8, false, String8("YV12"), 0},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B, DECON_PIXEL_FORMAT_NV12M_S10B, DRM_FORMAT_UNDEFINED,
-        2, 2, 12, YUV420|BIT10|BIT8_2, false, String8("EXYNOS_YCbCr_420_SP_M_S10B"), 0},
+        2, 2, 12, YUV420|BIT10|BIT8_2, false, String8("EXYNOS_YCbCr_420_SP_M_S10B"), 0,
+        PLANE_LAYOUT_NV12M_S10B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_S10B, DECON_PIXEL_FORMAT_NV12N_10B, DRM_FORMAT_UNDEFINED,
-        2, 1, 12, YUV420|BIT10|BIT8_2, false, String8("EXYNOS_YCbCr_420_SPN_S10B"), 0},
+        2, 1, 12, YUV420|BIT10|BIT8_2, false, String8("EXYNOS_YCbCr_420_SPN_S10B"), 0,
+        PLANE_LAYOUT_NV12N_S10B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M, DECON_PIXEL_FORMAT_NV12M_P010, DRM_FORMAT_P010,
-        2, 2, 24, YUV420|BIT10|P010, false, String8("EXYNOS_YCbCr_P010_M"), 0},
+        2, 2, 24, YUV420|BIT10|P010, false, String8("EXYNOS_YCbCr_P010_M"), 0,
+        PLANE_LAYOUT_P010M},
     {HAL_PIXEL_FORMAT_YCBCR_P010, DECON_PIXEL_FORMAT_NV12_P010, DRM_FORMAT_P010,
-        2, 1, 24, YUV420|BIT10|P010, false, String8("EXYNOS_YCbCr_P010"), 0},
+        2, 1, 24, YUV420|BIT10|P010, false, String8("EXYNOS_YCbCr_P010"), 0,
+        PLANE_LAYOUT_P010},
 
     {HAL_PIXEL_FORMAT_GOOGLE_NV12_SP, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_NV12,
-        2, 1, 12, YUV420|BIT8, false, String8("GOOGLE_YCbCr_420_SP"), 0},
+        2, 1, 12, YUV420|BIT8, false, String8("GOOGLE_YCbCr_420_SP"), 0,
+        PLANE_LAYOUT_GOOGLE_NV12},
     {HAL_PIXEL_FORMAT_GOOGLE_NV12_SP_10B, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_P010,
-        2, 1, 24, YUV420|BIT10, false, String8("GOOGLE_YCbCr_P010"), 0},
+        2, 1, 24, YUV420|BIT10, false, String8("GOOGLE_YCbCr_P010"), 0,
+        PLANE_LAYOUT_GOOGLE_P010},
     {MALI_GRALLOC_FORMAT_INTERNAL_YUV420_8BIT_I, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_YUV420_8BIT,
         1, 1, 12, YUV420|BIT8|AFBC, false, String8("MALI_GRALLOC_FORMAT_INTERNAL_YUV420_8BIT_I"), 0},
     {MALI_GRALLOC_FORMAT_INTERNAL_YUV420_10BIT_I, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_YUV420_10BIT,
@@ -212,41 +260,57 @@ const format_description_t exynos_format_desc[] = {
     /* SBWC formats */
     /* NV12, YCbCr, Multi */
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC, DECON_PIXEL_FORMAT_NV12M_SBWC_8B, DRM_FORMAT_NV12,
-        2, 2, 12, YUV420|BIT8|SBWC, false, String8("EXYNOS_YCbCr_420_SP_M_SBWC"), 0},
+        2, 2, 12, YUV420|BIT8|SBWC, false, String8("EXYNOS_YCbCr_420_SP_M_SBWC"), 0,
+        PLANE_LAYOUT_SBWC_8B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC_L50, DECON_PIXEL_FORMAT_NV12M_SBWC_8B_L50, DRM_FORMAT_NV12,
-        2, 2, 12, YUV420|BIT8|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_SBWC_L50"), 0},
+        2, 2, 12, YUV420|BIT8|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_SBWC_L50"), 0,
+        PLANE_LAYOUT_SBWC_8B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_SBWC_L75, DECON_PIXEL_FORMAT_NV12M_SBWC_8B_L75, DRM_FORMAT_NV12,
-        2, 2, 12, YUV420|BIT8|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_SBWC_L75"), 0},
+        2, 2, 12, YUV420|BIT8|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_SBWC_L75"), 0,
+        PLANE_LAYOUT_SBWC_8B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC, DECON_PIXEL_FORMAT_NV12M_SBWC_10B, DRM_FORMAT_UNDEFINED,
-        2, 2, 12, YUV420|BIT10|SBWC, false, String8("EXYNOS_YCbCr_420_SP_M_10B_SBWC"), 0},
+        2, 2, 12, YUV420|BIT10|SBWC, false, String8("EXYNOS_YCbCr_420_SP_M_10B_SBWC"), 0,
+        PLANE_LAYOUT_SBWC_10B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L40, DECON_PIXEL_FORMAT_NV12M_SBWC_10B_L40, DRM_FORMAT_UNDEFINED,
-        2, 2, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_10B_SBWC_L40"), 0},
+        2, 2, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_10B_SBWC_L40"), 0,
+        PLANE_LAYOUT_SBWC_10B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L60, DECON_PIXEL_FORMAT_NV12M_SBWC_10B_L60, DRM_FORMAT_UNDEFINED,
-        2, 2, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_10B_SBWC_L60"), 0},
+        2, 2, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_10B_SBWC_L60"), 0,
+        PLANE_LAYOUT_SBWC_10B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_10B_SBWC_L80, DECON_PIXEL_FORMAT_NV12M_SBWC_10B_L80, DRM_FORMAT_UNDEFINED,
-        2, 2, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_10B_SBWC_L80"), 0},
+        2, 2, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SP_M_10B_SBWC_L80"), 0,
+        PLANE_LAYOUT_SBWC_10B},
 
     /* NV12, YCbCr, Single */
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC, DECON_PIXEL_FORMAT_NV12N_SBWC_8B, DRM_FORMAT_NV12,
-        2, 1, 12, YUV420|BIT8|SBWC, false, String8("EXYNOS_YCbCr_420_SPN_SBWC"), 0},
+        2, 1, 12, YUV420|BIT8|SBWC, false, String8("EXYNOS_YCbCr_420_SPN_SBWC"), 0,
+        PLANE_LAYOUT_SBWC_8B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC_L50, DECON_PIXEL_FORMAT_NV12N_SBWC_8B_L50, DRM_FORMAT_NV12,
-        2, 1, 12, YUV420|BIT8|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_SBWC_L50"), 0},
+        2, 1, 12, YUV420|BIT8|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_SBWC_L50"), 0,
+        PLANE_LAYOUT_SBWC_8B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_SBWC_L75, DECON_PIXEL_FORMAT_NV12N_SBWC_8B_L75, DRM_FORMAT_NV12,
-        2, 1, 12, YUV420|BIT8|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_SBWC_75"), 0},
+        2, 1, 12, YUV420|BIT8|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_SBWC_75"), 0,
+        PLANE_LAYOUT_SBWC_8B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC, DECON_PIXEL_FORMAT_NV12N_SBWC_10B, DRM_FORMAT_UNDEFINED,
-        2, 1, 12, YUV420|BIT10|SBWC, false, String8("EXYNOS_YCbCr_420_SPN_10B_SBWC"), 0},
+        2, 1, 12, YUV420|BIT10|SBWC, false, String8("EXYNOS_YCbCr_420_SPN_10B_SBWC"), 0,
+        PLANE_LAYOUT_SBWC_10B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L40, DECON_PIXEL_FORMAT_NV12N_SBWC_10B_L40, DRM_FORMAT_UNDEFINED,
-        2, 1, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_10B_SBWC_L40"), 0},
+        2, 1, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_10B_SBWC_L40"), 0,
+        PLANE_LAYOUT_SBWC_10B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L60, DECON_PIXEL_FORMAT_NV12N_SBWC_10B_L60, DRM_FORMAT_UNDEFINED,
-        2, 1, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_10B_SBWC_L60"), 0},
+        2, 1, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_10B_SBWC_L60"), 0,
+        PLANE_LAYOUT_SBWC_10B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_10B_SBWC_L80, DECON_PIXEL_FORMAT_NV12N_SBWC_10B_L80, DRM_FORMAT_UNDEFINED,
-        2, 1, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_10B_SBWC_L80"), 0},
+        2, 1, 12, YUV420|BIT10|SBWC_LOSSY, false, String8("EXYNOS_YCbCr_420_SPN_10B_SBWC_L80"), 0,
+        PLANE_LAYOUT_SBWC_10B},
 
     /* NV12, YCrCb */
     {HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_SBWC, DECON_PIXEL_FORMAT_NV21M_SBWC_8B, DRM_FORMAT_UNDEFINED,
-        2, 2, 12, YUV420|BIT8|SBWC, false, String8("EXYNOS_YCrCb_420_SP_M_SBWC"), 0},
+        2, 2, 12, YUV420|BIT8|SBWC, false, String8("EXYNOS_YCrCb_420_SP_M_SBWC"), 0,
+        PLANE_LAYOUT_SBWC_8B},
     {HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_10B_SBWC, DECON_PIXEL_FORMAT_NV21M_SBWC_10B, DRM_FORMAT_UNDEFINED,
-        2, 2, 12, YUV420|BIT10|SBWC, false, String8("EXYNOS_YCrbCb_420_SP_M_10B_SBWC"), 0},
+        2, 2, 12, YUV420|BIT10|SBWC, false, String8("EXYNOS_YCrbCb_420_SP_M_10B_SBWC"), 0,
+        PLANE_LAYOUT_SBWC_10B},
 
     {HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED, DECON_PIXEL_FORMAT_MAX, DRM_FORMAT_UNDEFINED,
         0, 0, 0, TYPE_UNDEF, false, String8("ImplDef"), 0}
@@ -328,6 +392,7 @@ enum {
     eReallocOnGoingForDDI         =     0x00020000,
     eInvalidDispFrame             =     0x00040000,
     eExceedMaxLayerNum            =     0x00080000,
+    eCompositionHysteresis        =     0x00100000,
     eResourceAssignFail           =     0x20000000,
     eMPPUnsupported               =     0x40000000,
     eUnknown                      =     0x80000000,
@@ -375,7 +440,8 @@ typedef struct exynos_image {
      * frameworks/native/include/media/hardware/VideoAPI.h
      * frameworks/native/include/media/hardware/HardwareAPI.h */
     bool hasMetaParcel = false;
-    ExynosVideoMeta metaParcel;
+    /* Shared with the layer, which replaces it when the metadata changes */
+    std::shared_ptr<const ExynosVideoMeta> metaParcel;
     ExynosVideoInfoType metaType = VIDEO_INFO_TYPE_INVALID;
     bool needColorTransform = false;
 
@@ -385,8 +451,58 @@ typedef struct exynos_image {
             return true;
         return false;
     };
+    /* Zero filled metadata if the image has none */
+    const ExynosVideoMeta &getMetaParcel() const
+    {
+        static const ExynosVideoMeta empty = {};
+        return (metaParcel != nullptr) ? *metaParcel : empty;
+    };
 } exynos_image_t;
 
+/*
+ * Layer attributes that can change the result of resource assignment.
+ * Buffer handle, fences and surface damage are not included.
+ */
+typedef struct layer_assign_signature
+{
+    int32_t compositionType = HWC2_COMPOSITION_INVALID;
+    uint32_t format = 0;
+    uint32_t drmMode = 0;
+    uint32_t stride = 0;
+    uint32_t vstride = 0;
+    bool compressed = false;
+    bool hasMetaParcel = false;
+    bool lowFps = false;
+    bool needColorTransform = false;
+    hwc_frect_t sourceCrop = {0, 0, 0, 0};
+    hwc_rect_t displayFrame = {0, 0, 0, 0};
+    int32_t transform = 0;
+    android_dataspace dataSpace = HAL_DATASPACE_UNKNOWN;
+    int32_t blending = HWC2_BLEND_MODE_NONE;
+    float planeAlpha = 0;
+    uint32_t zOrder = 0;
+
+    bool operator==(const layer_assign_signature &rhs) const {
+        return (compositionType == rhs.compositionType) && (format == rhs.format) &&
+                (drmMode == rhs.drmMode) && (stride == rhs.stride) &&
+                (vstride == rhs.vstride) && (compressed == rhs.compressed) &&
+                (hasMetaParcel == rhs.hasMetaParcel) && (lowFps == rhs.lowFps) &&
+                (needColorTransform == rhs.needColorTransform) &&
+                (sourceCrop.left == rhs.sourceCrop.left) &&
+                (sourceCrop.top == rhs.sourceCrop.top) &&
+                (sourceCrop.right == rhs.sourceCrop.right) &&
+                (sourceCrop.bottom == rhs.sourceCrop.bottom) &&
+                (displayFrame.left == rhs.displayFrame.left) &&
+                (displayFrame.top == rhs.displayFrame.top) &&
+                (displayFrame.right == rhs.displayFrame.right) &&
+                (displayFrame.bottom == rhs.displayFrame.bottom) &&
+                (transform == rhs.transform) && (dataSpace == rhs.dataSpace) &&
+                (blending == rhs.blending) && (planeAlpha == rhs.planeAlpha) &&
+                (zOrder == rhs.zOrder);
+    }
+    bool operator!=(const layer_assign_signature &rhs) const { return !(*this == rhs); }
+} layer_assign_signature_t;
+
 uint32_t getHWC1CompType(int32_t /*hwc2_composition_t*/ type);
 
 uint32_t getDrmMode(uint64_t flags);
@@ -429,6 +545,7 @@ bool isScaledDown(exynos_image &src, exynos_image &dst);
 bool hasHdrInfo(const exynos_image &img);
 bool hasHdrInfo(android_dataspace dataSpace);
 bool hasHdr10Plus(exynos_image &img);
+bool isIdentityColorMatrix(const float *matrix);
 
 void dumpExynosImage(uint32_t type, exynos_image &img);
 void dumpExynosImage(String8& result, exynos_image &img);
@@ -440,10 +557,15 @@ void adjustRect(hwc_rect_t &rect, int32_t width, int32_t height);
 uint32_t getBufferNumOfFormat(int format, uint32_t compressType);
 uint32_t getPlaneNumOfFormat(int format, uint32_t compressType);
 uint32_t getBytePerPixelOfPrimaryPlane(int format);
+/* Estimated read bandwidth in KB/s of a w x h area of format at refreshRate */
+uint64_t getReadBandwidthKBps(uint32_t w, uint32_t h, int format, bool compressed,
+                              uint32_t refreshRate);
 
 int fence_close(int fence, ExynosDisplay* display,
         hwc_fdebug_fence_type type, hwc_fdebug_ip_type ip);
 bool fence_valid(int fence);
+/* CLOCK_MONOTONIC time in ns when the fence was signaled, -1 if it is not signaled */
+int64_t getFenceSignalTime(int fence);
 
 int hwcFdClose(int fd);
 int hwc_dup(int fd, ExynosDisplay *display, hwc_fdebug_fence_type type, hwc_fdebug_ip_type ip,
@@ -474,6 +596,41 @@ inline T pixel_align(const T x, const uint32_t a) {
     return a ? ((x + a - 1) / a) * a : x;
 }
 
+template <typename T>
+inline void hash_combine(size_t &seed, const T &value) {
+    seed ^= std::hash<T>{}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+/*
+ * Mutex that keeps a histogram of how long lock() waited.
+ * It can be used with std::unique_lock. Locking it through
+ * Mutex::Autolock still works but is not counted.
+ */
+class TimedMutex : public Mutex {
+public:
+    /* Upper bounds of the wait time buckets in usec, the last bucket is unbounded */
+    static constexpr nsecs_t kWaitBucketUs[] = {1, 100, 500, 1000, 4000, 16000};
+    static constexpr size_t kWaitBucketNum = sizeof(kWaitBucketUs) / sizeof(kWaitBucketUs[0]) + 1;
+
+    class Autolock {
+    public:
+        explicit Autolock(TimedMutex &mutex) : mMutex(mutex) { mMutex.lock(); }
+        ~Autolock() { mMutex.unlock(); }
+
+    private:
+        TimedMutex &mMutex;
+    };
+
+    void lock();
+    bool try_lock() { return tryLock() == NO_ERROR; }
+    void dump(String8 &result, const char *name) const;
+
+private:
+    std::atomic<uint64_t> mWaitCount[kWaitBucketNum] = {};
+    std::atomic<uint64_t> mTotalWaitNs = 0;
+    std::atomic<uint64_t> mMaxWaitNs = 0;
+};
+
 uint32_t getExynosBufferYLength(uint32_t width, uint32_t height, int format);
 int getBufLength(buffer_handle_t handle, uint32_t planer_num, size_t *length, int format, uint32_t width, uint32_t height);
 
@@ -490,10 +647,22 @@ enum {
 typedef struct fenceTrace {
     hwc_fdebug_fence_type type;
     hwc_fdebug_ip_type ip;
-    struct timeval time;
     int32_t curFlag;
 } fenceTrace_t;
 
+/*
+ * Compact record of one fence event. Every thread appends these to its own
+ * lock-free ring, they are only decoded when fences are dumped.
+ */
+typedef struct hwc_fence_event {
+    uint64_t timeNs;
+    int32_t fd;
+    uint32_t displayId;
+    uint8_t direction;
+    uint8_t type;
+    uint8_t ip;
+} hwc_fence_event_t;
+
 typedef struct hwc_fence_info {
     uint32_t displayId;
     struct sync_fence_info_data* sync_data;
@@ -507,8 +676,24 @@ typedef struct hwc_fence_info {
     uint32_t last_dir;
     bool pendingAllowed = false;
     bool leaking = false;
+    /* Listed in hwc_fence_count::touched */
+    bool touched = false;
 } hwc_fence_info_t;
 
+/*
+ * Kept together with the fence table by setFenceInfo() and setFenceName()
+ * so that the per-frame checks don't scan the whole table
+ */
+typedef struct hwc_fence_count {
+    /* Fds whose usage is not zero */
+    int32_t live = 0;
+    /* Fds in use that may not stay over a frame, key is displayId */
+    std::unordered_map<uint32_t, int32_t> unexpected;
+    /* Fds changed since the last resetFenceCurFlag() */
+    std::vector<uint32_t> touched;
+    uint32_t auditFrames = 0;
+} hwc_fence_count_t;
+
 class funcReturnCallback {
     public:
         funcReturnCallback(const std::function<void(void)> cb) : mCb(cb) {}
@@ -518,12 +703,23 @@ class funcReturnCallback {
 };
 
 void setFenceName(int fenceFd, hwc_fence_type fenceType);
+#ifdef DISABLE_FENCE_TRACE
+inline void setFenceName(uint32_t __unused fd, ExynosDisplay __unused *display,
+        hwc_fdebug_fence_type __unused type, hwc_fdebug_ip_type __unused ip,
+        uint32_t __unused direction, bool __unused pendingAllowed = false) {}
+inline void setFenceInfo(uint32_t __unused fd, ExynosDisplay __unused *display,
+        hwc_fdebug_fence_type __unused type, hwc_fdebug_ip_type __unused ip,
+        uint32_t __unused direction, bool __unused pendingAllowed = false) {}
+#else
 void setFenceName(uint32_t fd, ExynosDisplay *display,
         hwc_fdebug_fence_type type, hwc_fdebug_ip_type ip,
         uint32_t direction, bool pendingAllowed = false);
 void setFenceInfo(uint32_t fd, ExynosDisplay *display,
         hwc_fdebug_fence_type type, hwc_fdebug_ip_type ip,
         uint32_t direction, bool pendingAllowed = false);
+#endif
+void getFenceEvents(std::vector<hwc_fence_event_t> &events);
+void dumpFenceEvents(String8 &result, int32_t fd = -1);
 void printFenceInfo(uint32_t fd, hwc_fence_info_t* info);
 void dumpFenceInfo(ExynosDisplay *display, int32_t __unused depth);
 bool fenceWarn(hwc_fence_info_t **info, uint32_t threshold);
@@ -531,6 +727,7 @@ void resetFenceCurFlag(ExynosDisplay *display);
 bool fenceWarn(ExynosDisplay *display, uint32_t threshold);
 void printLeakFds(ExynosDisplay *display);
 bool validateFencePerFrame(ExynosDisplay *display);
+bool auditFenceCount(ExynosDisplay *display);
 android_dataspace colorModeToDataspace(android_color_mode_t mode);
 bool hasPPC(uint32_t physicalType, uint32_t formatIndex, uint32_t rotIndex);
 
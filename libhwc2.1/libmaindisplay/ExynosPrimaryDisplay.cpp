@@ -29,6 +29,7 @@
 #include "ExynosHWCHelper.h"
 
 #include <linux/fb.h>
+#include <sync/sync.h>
 
 extern struct exynos_hwc_control exynosHWCControl;
 
@@ -135,6 +136,12 @@ ExynosPrimaryDisplay::ExynosPrimaryDisplay(uint32_t index, ExynosDevice *device)
 
     mWakeupDispFd = fopen(kWakeupDispFilePath, "w");
     if (mWakeupDispFd == nullptr) ALOGE("wake up display node open failed! %s", strerror(errno));
+
+    /* Read the panel gamma calibration at boot, away from the first power on */
+    mPanelGammaThread = std::thread([this]() {
+        std::lock_guard<std::mutex> lock(mPanelGammaMutex);
+        getPanelGammaCalibration(DisplayType::DISPLAY_PRIMARY);
+    });
 }
 
 ExynosPrimaryDisplay::~ExynosPrimaryDisplay()
@@ -149,6 +156,14 @@ ExynosPrimaryDisplay::~ExynosPrimaryDisplay()
         mLhbmFd = nullptr;
     }
 
+    if (mLhbmFence >= 0) {
+        close(mLhbmFence);
+        mLhbmFence = -1;
+    }
+
+    if (mPanelGammaThread.joinable())
+        mPanelGammaThread.join();
+
     if (mBrightnessFd) {
         fclose(mBrightnessFd);
         mBrightnessFd = nullptr;
@@ -229,7 +244,9 @@ int32_t ExynosPrimaryDisplay::applyPendingConfig() {
 int32_t ExynosPrimaryDisplay::setPowerOn() {
     ATRACE_CALL();
 
+    mPowerOnStats.start();
     int ret = applyPendingConfig();
+    mPowerOnStats.record(POWER_ON_STAGE_APPLY_CONFIG);
 
     if (mPowerModeState == HWC2_POWER_MODE_OFF) {
         // check the dynamic recomposition thread by following display
@@ -239,12 +256,15 @@ int32_t ExynosPrimaryDisplay::setPowerOn() {
         }
         setGeometryChanged(GEOMETRY_DISPLAY_POWER_ON);
     }
+    mPowerOnStats.record(POWER_ON_STAGE_PANEL_ON);
 
     mPowerModeState = HWC2_POWER_MODE_ON;
+    updateMinimalDozeComposition();
 
     if (mFirstPowerOn) {
         firstPowerOn();
     }
+    mPowerOnStats.record(POWER_ON_STAGE_FIRST_POWER_ON);
 
     return HWC2_ERROR_NONE;
 }
@@ -259,6 +279,7 @@ int32_t ExynosPrimaryDisplay::setPowerOff() {
 
     mDisplayInterface->setPowerMode(HWC2_POWER_MODE_OFF);
     mPowerModeState = HWC2_POWER_MODE_OFF;
+    updateMinimalDozeComposition();
 
     /* It should be called from validate() when the screen is on */
     mSkipFrame = true;
@@ -286,6 +307,7 @@ int32_t ExynosPrimaryDisplay::setPowerDoze(hwc2_power_mode_t mode) {
     }
 
     mPowerModeState = mode;
+    updateMinimalDozeComposition();
 
     ExynosDisplay::updateRefreshRateHint();
 
@@ -293,7 +315,7 @@ int32_t ExynosPrimaryDisplay::setPowerDoze(hwc2_power_mode_t mode) {
 }
 
 int32_t ExynosPrimaryDisplay::setPowerMode(int32_t mode) {
-    Mutex::Autolock lock(mDisplayMutex);
+    TimedMutex::Autolock lock(mDisplayMutex);
 
     if (mode == static_cast<int32_t>(ext_hwc2_power_mode_t::PAUSE)) {
         mode = HWC2_POWER_MODE_OFF;
@@ -335,8 +357,17 @@ int32_t ExynosPrimaryDisplay::setPowerMode(int32_t mode) {
     return HWC2_ERROR_NONE;
 }
 
+/*
+ * The calibration is written to the panel while the first frame is composed.
+ * The data was loaded by the constructor, so this thread only writes the node.
+ */
 void ExynosPrimaryDisplay::firstPowerOn() {
-    SetCurrentPanelGammaSource(DisplayType::DISPLAY_PRIMARY, PanelGammaSource::GAMMA_CALIBRATION);
+    if (mPanelGammaThread.joinable())
+        mPanelGammaThread.join();
+    mPanelGammaThread = std::thread([this]() {
+        SetCurrentPanelGammaSource(DisplayType::DISPLAY_PRIMARY,
+                                   PanelGammaSource::GAMMA_CALIBRATION);
+    });
     mFirstPowerOn = false;
 }
 
@@ -369,11 +400,16 @@ std::string ExynosPrimaryDisplay::getPanelSysfsPath(const DisplayType &type) {
     return iter->second;
 }
 
-int32_t ExynosPrimaryDisplay::SetCurrentPanelGammaSource(const DisplayType type,
-                                                         const PanelGammaSource &source) {
+/* Called with mPanelGammaMutex held, the data is kept once it is read */
+std::string ExynosPrimaryDisplay::getPanelGammaCalibration(const DisplayType type) {
+    auto cached = mPanelGammaCalibration.find(type);
+    if (cached != mPanelGammaCalibration.end()) {
+        return cached->second;
+    }
+
     std::string &&panel_sysfs_path = getPanelSysfsPath(type);
     if (panel_sysfs_path.empty()) {
-        return HWC2_ERROR_UNSUPPORTED;
+        return {};
     }
 
     std::ifstream ifs;
@@ -381,7 +417,7 @@ int32_t ExynosPrimaryDisplay::SetCurrentPanelGammaSource(const DisplayType type,
     ifs.open(path, std::ifstream::in);
     if (!ifs.is_open()) {
         ALOGW("Unable to access panel name path '%s' (%s)", path.c_str(), strerror(errno));
-        return HWC2_ERROR_UNSUPPORTED;
+        return {};
     }
     std::string panel_name;
     std::getline(ifs, panel_name);
@@ -391,12 +427,43 @@ int32_t ExynosPrimaryDisplay::SetCurrentPanelGammaSource(const DisplayType type,
     ifs.open(path, std::ifstream::in);
     if (!ifs.is_open()) {
         ALOGW("Unable to access panel id path '%s' (%s)", path.c_str(), strerror(errno));
-        return HWC2_ERROR_UNSUPPORTED;
+        return {};
     }
     std::string panel_id;
     std::getline(ifs, panel_id);
     ifs.close();
 
+    std::string gamma_cal_file(kDisplayCalFilePath);
+    gamma_cal_file.append(kPanelGammaCalFilePrefix)
+            .append(1, '_')
+            .append(panel_name)
+            .append(1, '_')
+            .append(panel_id)
+            .append(".cal");
+    if (access(gamma_cal_file.c_str(), R_OK)) {
+        ALOGI("Fail to access `%s` (%s), try golden gamma calibration", gamma_cal_file.c_str(),
+              strerror(errno));
+        gamma_cal_file = kDisplayCalFilePath;
+        gamma_cal_file.append(kPanelGammaCalFilePrefix)
+                .append(1, '_')
+                .append(panel_name)
+                .append(".cal");
+    }
+
+    std::string &&gamma_data = loadPanelGammaCalibration(gamma_cal_file);
+    if (!gamma_data.empty()) {
+        mPanelGammaCalibration[type] = gamma_data;
+    }
+    return gamma_data;
+}
+
+int32_t ExynosPrimaryDisplay::SetCurrentPanelGammaSource(const DisplayType type,
+                                                         const PanelGammaSource &source) {
+    std::string &&panel_sysfs_path = getPanelSysfsPath(type);
+    if (panel_sysfs_path.empty()) {
+        return HWC2_ERROR_UNSUPPORTED;
+    }
+
     std::string gamma_node = panel_sysfs_path + "gamma";
     if (access(gamma_node.c_str(), W_OK)) {
         ALOGW("Unable to access panel gamma calibration node '%s' (%s)", gamma_node.c_str(),
@@ -404,25 +471,10 @@ int32_t ExynosPrimaryDisplay::SetCurrentPanelGammaSource(const DisplayType type,
         return HWC2_ERROR_UNSUPPORTED;
     }
 
+    std::lock_guard<std::mutex> lock(mPanelGammaMutex);
     std::string &&gamma_data = "default";
     if (source == PanelGammaSource::GAMMA_CALIBRATION) {
-        std::string gamma_cal_file(kDisplayCalFilePath);
-        gamma_cal_file.append(kPanelGammaCalFilePrefix)
-                .append(1, '_')
-                .append(panel_name)
-                .append(1, '_')
-                .append(panel_id)
-                .append(".cal");
-        if (access(gamma_cal_file.c_str(), R_OK)) {
-            ALOGI("Fail to access `%s` (%s), try golden gamma calibration", gamma_cal_file.c_str(),
-                  strerror(errno));
-            gamma_cal_file = kDisplayCalFilePath;
-            gamma_cal_file.append(kPanelGammaCalFilePrefix)
-                    .append(1, '_')
-                    .append(panel_name)
-                    .append(".cal");
-        }
-        gamma_data = loadPanelGammaCalibration(gamma_cal_file);
+        gamma_data = getPanelGammaCalibration(type);
     }
 
     if (gamma_data.empty()) {
@@ -442,31 +494,79 @@ int32_t ExynosPrimaryDisplay::SetCurrentPanelGammaSource(const DisplayType type,
 }
 
 int32_t ExynosPrimaryDisplay::setLhbmState(bool enabled) {
-    requestLhbm(enabled);
-    ALOGI("setLhbmState =%d", enabled);
+    setLhbmStateAsync(enabled, nullptr);
 
     std::unique_lock<std::mutex> lk(lhbm_mutex_);
-    mLhbmChanged = false;
     if (!lhbm_cond_.wait_for(lk, std::chrono::milliseconds(1000),
                              [this] { return mLhbmChanged; })) {
         ALOGI("setLhbmState =%d timeout !", enabled);
         return TIMED_OUT;
-    } else {
-        if (enabled)
-            mDisplayInterface->waitVBlank();
+    }
+    int fence = mLhbmFence;
+    mLhbmFence = -1;
+    nsecs_t requestTime = mLhbmRequestTime;
+    lk.unlock();
+
+    if (!enabled) {
+        if (fence >= 0) close(fence);
+        return NO_ERROR;
+    }
+
+    /* The retire fence signals with the first frame showing LHBM */
+    if (fence < 0) {
+        mDisplayInterface->waitVBlank();
         return NO_ERROR;
     }
+    if (sync_wait(fence, 1000) < 0) {
+        ALOGW("setLhbmState =%d fence wait failed: %s", enabled, strerror(errno));
+    } else {
+        int64_t signalTime = getFenceSignalTime(fence);
+        if (signalTime > 0) {
+            ATRACE_INT64("LhbmLatency", signalTime - requestTime);
+            ALOGI("setLhbmState =%d shown in %" PRId64 " us", enabled,
+                  ns2us(signalTime - requestTime));
+        }
+    }
+    close(fence);
+    return NO_ERROR;
+}
+
+/* Returns once the request is queued, the commit reports through callback */
+int32_t ExynosPrimaryDisplay::setLhbmStateAsync(bool enabled, LhbmCallback callback) {
+    {
+        std::lock_guard<std::mutex> lk(lhbm_mutex_);
+        mLhbmChanged = false;
+        if (mLhbmCallback) mLhbmCallback(TIMED_OUT, -1);
+        mLhbmCallback = callback;
+        if (mLhbmFence >= 0) {
+            close(mLhbmFence);
+            mLhbmFence = -1;
+        }
+        mLhbmRequestTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+    ALOGI("setLhbmState =%d", enabled);
+    requestLhbm(enabled);
+    return NO_ERROR;
 }
 
 bool ExynosPrimaryDisplay::getLhbmState() {
     return mLhbmOn;
 }
 
-void ExynosPrimaryDisplay::notifyLhbmState(bool enabled) {
+void ExynosPrimaryDisplay::notifyLhbmState(bool enabled, int fence) {
     std::lock_guard<std::mutex> lk(lhbm_mutex_);
     mLhbmChanged = true;
-    lhbm_cond_.notify_one();
     mLhbmOn = enabled;
+    ATRACE_INT64("LhbmCommitLatency", systemTime(SYSTEM_TIME_MONOTONIC) - mLhbmRequestTime);
+    if (mLhbmCallback) {
+        LhbmCallback callback = std::move(mLhbmCallback);
+        mLhbmCallback = nullptr;
+        callback(NO_ERROR, fence);
+    } else {
+        if (mLhbmFence >= 0) close(mLhbmFence);
+        mLhbmFence = fence;
+    }
+    lhbm_cond_.notify_one();
 }
 
 void ExynosPrimaryDisplay::setWakeupDisplay() {
@@ -17,6 +17,8 @@
 #define EXYNOS_PRIMARY_DISPLAY_H
 
 #include <map>
+#include <mutex>
+#include <thread>
 
 #include "../libdevice/ExynosDisplay.h"
 
@@ -37,8 +39,9 @@ class ExynosPrimaryDisplay : public ExynosDisplay {
 
         virtual bool isLhbmSupported() { return mLhbmFd ? true : false; }
         virtual int32_t setLhbmState(bool enabled);
+        virtual int32_t setLhbmStateAsync(bool enabled, LhbmCallback callback);
         virtual bool getLhbmState();
-        virtual void notifyLhbmState(bool enabled);
+        virtual void notifyLhbmState(bool enabled, int fence = -1);
         virtual void setWakeupDisplay();
 
         virtual void initDisplayInterface(uint32_t interfaceType);
@@ -76,6 +79,13 @@ class ExynosPrimaryDisplay : public ExynosDisplay {
         void firstPowerOn();
 
         std::string getPanelSysfsPath(const displaycolor::DisplayType& type);
+        std::string getPanelGammaCalibration(const displaycolor::DisplayType type);
+
+        /* Panel gamma calibration data by display type, read once */
+        std::map<displaycolor::DisplayType, std::string> mPanelGammaCalibration;
+        std::mutex mPanelGammaMutex;
+        /* Loads the calibration at boot, then writes it on the first power on */
+        std::thread mPanelGammaThread;
 
         // LHBM
         FILE* mLhbmFd;
@@ -85,6 +95,10 @@ class ExynosPrimaryDisplay : public ExynosDisplay {
                 "/sys/class/backlight/panel0-backlight/local_hbm_mode";
         std::mutex lhbm_mutex_;
         std::condition_variable lhbm_cond_;
+        LhbmCallback mLhbmCallback;
+        /* Retire fence of the LHBM commit for the blocking setLhbmState() */
+        int mLhbmFence = -1;
+        nsecs_t mLhbmRequestTime = 0;
 
         FILE* mWakeupDispFd;
         static constexpr const char* kWakeupDispFilePath =
@@ -20,20 +20,27 @@
 #define ATRACE_TAG (ATRACE_TAG_GRAPHICS | ATRACE_TAG_HAL)
 #include <utils/Errors.h>
 #include <sync/sync.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cutils/properties.h>
 #include "ExynosMPP.h"
 #include "ExynosResourceRestriction.h"
 #include <hardware/hwcomposer_defs.h>
 #include <math.h>
+#include <inttypes.h>
 #include "VendorGraphicBuffer.h"
 #include "ExynosHWCDebug.h"
+#include "ExynosHWCTrace.h"
 #include "ExynosDisplay.h"
 #include "ExynosVirtualDisplay.h"
 #include "ExynosLayer.h"
 #include "ExynosHWCHelper.h"
 #include "exynos_sync.h"
 #include "ExynosResourceManager.h"
+#include "threadpolicy.h"
 
 /**
  * ExynosMPP implementation
@@ -160,6 +167,8 @@ ExynosMPP::ExynosMPP(ExynosResourceManager* resourceManager,
     mPrivDstBuf(-1),
     mNeedCompressedTarget(false),
     mDstAllocatedSize(DST_SIZE_UNKNOWN),
+    mAcrylicHandle(NULL),
+    mAcrylicSpec(NULL),
     mUseM2MSrcFence(false),
     mAttr(0),
     mNeedSolidColorLayer(false)
@@ -192,13 +201,8 @@ ExynosMPP::ExynosMPP(ExynosResourceManager* resourceManager,
         }
         /* Capacity means time(ms) that can be used for operation */
         mCapacity = MPP_G2D_CAPACITY;
-        mAcrylicHandle = AcrylicFactory::createAcrylic("default_compositor");
-        if (mAcrylicHandle == NULL) {
-            MPP_LOGE("Fail to allocate acrylic handle");
-            abort();
-        } else {
-            MPP_LOGI("mAcrylicHandle is created: %p", mAcrylicHandle);
-        }
+        /* The handle is created when the MPP is used first, see getAcrylicHandle() */
+        mAcrylicSpec = "default_compositor";
     }
 
     /* Basic feature supported flags */
@@ -213,19 +217,11 @@ ExynosMPP::ExynosMPP(ExynosResourceManager* resourceManager,
         * Capacity should be set
         */
         mCapacity = MPP_MSC_CAPACITY;
-        mAcrylicHandle = AcrylicFactory::createAcrylic("default_scaler");
-        if (mAcrylicHandle == NULL) {
-            MPP_LOGE("Fail to allocate acrylic handle");
-            abort();
-        } else {
-            MPP_LOGI("mAcrylicHandle is created: %p", mAcrylicHandle);
-        }
+        mAcrylicSpec = "default_scaler";
     }
 
-    if (mMaxSrcLayerNum > 1) {
+    if (mMaxSrcLayerNum > 1)
         mNeedSolidColorLayer = true;
-        mAcrylicHandle->setDefaultColor(0, 0, 0, 0);
-    }
 
     mAssignedSources.clear();
     resetUsedCapacity();
@@ -246,7 +242,9 @@ ExynosMPP::ExynosMPP(ExynosResourceManager* resourceManager,
         mSrcImgs[i].acrylicAcquireFenceFd = -1;
         mSrcImgs[i].acrylicReleaseFenceFd = -1;
     }
-    for (uint32_t i = 0; i < NUM_MPP_DST_BUFS(mLogicalType); i++) {
+    mDstBufNum = max(min((uint32_t)NUM_MPP_DST_BUFS(mLogicalType), (uint32_t)NUM_MPP_DST_BUFS_MAX),
+            (uint32_t)NUM_MPP_DST_BUFS_MIN);
+    for (uint32_t i = 0; i < NUM_MPP_DST_BUFS_MAX; i++) {
         memset(&mDstImgs[i], 0, sizeof(mDstImgs[i]));
         mDstImgs[i].acrylicAcquireFenceFd = -1;
         mDstImgs[i].acrylicReleaseFenceFd = -1;
@@ -261,18 +259,44 @@ ExynosMPP::ExynosMPP(ExynosResourceManager* resourceManager,
 ExynosMPP::~ExynosMPP()
 {
     mResourceManageThread->mRunning = false;
+    mResourceManageThread->wake();
     mResourceManageThread->requestExitAndWait();
+
+    if (mLaptimeFence >= 0)
+        close(mLaptimeFence);
+    if (mDstRing.stallFence >= 0)
+        close(mDstRing.stallFence);
 }
 
 
 ExynosMPP::ResourceManageThread::ResourceManageThread(ExynosMPP *exynosMPP)
 : mExynosMPP(exynosMPP),
+    mStateFenceError(false),
+    mEpollFd(-1),
+    mWakeFd(-1),
     mRunning(false)
 {
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((mEpollFd < 0) || (mWakeFd < 0)) {
+        ALOGE("%s:: Failed to create epoll(%d) or eventfd(%d): %s", __func__,
+                mEpollFd, mWakeFd, strerror(errno));
+        return;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = mWakeFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev) < 0)
+        ALOGE("%s:: Failed to add wake fd: %s", __func__, strerror(errno));
 }
 
 ExynosMPP::ResourceManageThread::~ResourceManageThread()
 {
+    if (mEpollFd >= 0)
+        close(mEpollFd);
+    if (mWakeFd >= 0)
+        close(mWakeFd);
 }
 
 bool ExynosMPP::isDataspaceSupportedByMPP(struct exynos_image &src, struct exynos_image &dst)
@@ -470,29 +494,12 @@ bool ExynosMPP::isSrcFormatSupported(struct exynos_image &src)
 
     if (mResourceManager == NULL) return false;
 
-    for (uint32_t i = 0 ; i < mResourceManager->mFormatRestrictionCnt; i++) {
-        if ((mResourceManager->mFormatRestrictions[i].hwType == mPhysicalType) &&
-                ((mResourceManager->mFormatRestrictions[i].nodeType == NODE_NONE) ||
-                 (mResourceManager->mFormatRestrictions[i].nodeType == NODE_SRC)) &&
-                (mResourceManager->mFormatRestrictions[i].format == src.format))
-            return true;
-    }
-
-    return false;
+    return (mSrcFormats.find(src.format) != mSrcFormats.end());
 }
 
 bool ExynosMPP::isDstFormatSupported(struct exynos_image &dst)
 {
-
-    for (uint32_t i = 0 ; i < mResourceManager->mFormatRestrictionCnt; i++) {
-        if ((mResourceManager->mFormatRestrictions[i].hwType == mPhysicalType) &&
-                ((mResourceManager->mFormatRestrictions[i].nodeType == NODE_NONE) ||
-                 (mResourceManager->mFormatRestrictions[i].nodeType == NODE_DST)) &&
-                (mResourceManager->mFormatRestrictions[i].format == dst.format))
-            return true;
-    }
-
-    return false;
+    return (mDstFormats.find(dst.format) != mDstFormats.end());
 }
 
 uint32_t ExynosMPP::getMaxUpscale(const struct exynos_image &src,
@@ -709,7 +716,7 @@ uint32_t ExynosMPP::getDstMinWidth(struct exynos_image &dst)
         (mPhysicalType == MPP_G2D))
         return 64;
 
-    if ((mNeedSolidColorLayer == false) && mNeedCompressedTarget)
+    if ((mNeedSolidColorLayer == false) && (mNeedCompressedTarget || dst.compressed))
         return 16;
 
     if ((mPhysicalType == MPP_G2D) && (mNeedSolidColorLayer == false) &&
@@ -721,7 +728,7 @@ uint32_t ExynosMPP::getDstMinWidth(struct exynos_image &dst)
 }
 uint32_t ExynosMPP::getDstMinHeight(struct exynos_image &dst)
 {
-    if ((mNeedSolidColorLayer == false) && mNeedCompressedTarget)
+    if ((mNeedSolidColorLayer == false) && (mNeedCompressedTarget || dst.compressed))
         return 16;
 
     if ((mPhysicalType == MPP_G2D) && (mNeedSolidColorLayer == false) &&
@@ -737,7 +744,7 @@ uint32_t ExynosMPP::getDstWidthAlign(const struct exynos_image &dst) const {
         (mPhysicalType == MPP_G2D))
         return 64;
 
-    if ((mNeedSolidColorLayer == false) && mNeedCompressedTarget)
+    if ((mNeedSolidColorLayer == false) && (mNeedCompressedTarget || dst.compressed))
         return 16;
 
     if ((mPhysicalType == MPP_G2D) && (mNeedSolidColorLayer == false) &&
@@ -748,7 +755,7 @@ uint32_t ExynosMPP::getDstWidthAlign(const struct exynos_image &dst) const {
     return mDstSizeRestrictions[idx].cropWidthAlign;
 }
 uint32_t ExynosMPP::getDstHeightAlign(const struct exynos_image &dst) const {
-    if ((mNeedSolidColorLayer == false) && mNeedCompressedTarget)
+    if ((mNeedSolidColorLayer == false) && (mNeedCompressedTarget || dst.compressed))
         return 16;
 
     if ((mPhysicalType == MPP_G2D) && (mNeedSolidColorLayer == false) &&
@@ -760,7 +767,7 @@ uint32_t ExynosMPP::getDstHeightAlign(const struct exynos_image &dst) const {
 }
 uint32_t ExynosMPP::getDstXOffsetAlign(struct exynos_image &dst)
 {
-    if ((mNeedSolidColorLayer == false) && mNeedCompressedTarget)
+    if ((mNeedSolidColorLayer == false) && (mNeedCompressedTarget || dst.compressed))
         return 16;
 
     if ((mPhysicalType == MPP_G2D) && (mNeedSolidColorLayer == false) &&
@@ -772,7 +779,7 @@ uint32_t ExynosMPP::getDstXOffsetAlign(struct exynos_image &dst)
 }
 uint32_t ExynosMPP::getDstYOffsetAlign(struct exynos_image &dst)
 {
-    if ((mNeedSolidColorLayer == false) && mNeedCompressedTarget)
+    if ((mNeedSolidColorLayer == false) && (mNeedCompressedTarget || dst.compressed))
         return 16;
 
     if ((mPhysicalType == MPP_G2D) && (mNeedSolidColorLayer == false) &&
@@ -802,113 +809,209 @@ int32_t ExynosMPP::isSupportLayerColorTransform(
     return false;
 }
 
+/*
+ * The thread sleeps in epoll_wait() until a pending fence signals, a buffer or
+ * fence is added, or the oldest fence times out. Each freed buffer is released
+ * as soon as its own fences are signaled.
+ */
 bool ExynosMPP::ResourceManageThread::threadLoop()
 {
     if (mExynosMPP == NULL)
         return false;
 
     ALOGI("%s threadLoop is started", mExynosMPP->mName.string());
+    ApplyThreadPolicy(ThreadRole::M2M_RESOURCE);
     while(mRunning) {
-        Mutex::Autolock lock(mMutex);
-        while((mFreedBuffers.size() == 0) &&
-                (mStateFences.size() == 0)) {
-            mCondition.wait(mMutex);
+        int timeoutMs;
+        {
+            Mutex::Autolock lock(mMutex);
+            timeoutMs = getWaitTimeoutMs(systemTime(SYSTEM_TIME_MONOTONIC));
         }
 
-        if ((mExynosMPP->mHWState == MPP_HW_STATE_RUNNING) &&
-                (mStateFences.size() != 0)) {
-            if (checkStateFences()) {
-                mExynosMPP->mHWState = MPP_HW_STATE_IDLE;
+        if (mEpollFd >= 0) {
+            struct epoll_event events[NUM_MPP_SRC_BUFS];
+            int nfds = epoll_wait(mEpollFd, events, NUM_MPP_SRC_BUFS, timeoutMs);
+            if ((nfds < 0) && (errno != EINTR)) {
+                ALOGE("%s:: epoll_wait failed: %s", mExynosMPP->mName.string(), strerror(errno));
+                usleep(ms2us(16));
             }
-        } else {
-            if ((mStateFences.size() != 0) &&
-                    (mExynosMPP->mHWState != MPP_HW_STATE_RUNNING)) {
-                ALOGW("%s, mHWState(%d) but mStateFences size(%zu)",
-                        mExynosMPP->mName.string(), mExynosMPP->mHWState,
-                        mStateFences.size());
-                checkStateFences();
+            for (int i = 0; i < nfds; i++) {
+                uint64_t count = 0;
+                if (events[i].data.fd == mWakeFd)
+                    read(mWakeFd, &count, sizeof(count));
             }
+        } else {
+            /* No epoll, check the fences every frame */
+            usleep(ms2us(((timeoutMs < 0) || (timeoutMs > 16)) ? 16 : timeoutMs));
         }
 
-        if (mFreedBuffers.size() != 0) {
-            freeBuffers();
+        std::vector<exynos_mpp_img_info> doneBuffers;
+        {
+            Mutex::Autolock lock(mMutex);
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            checkStateFences(now);
+            collectFreedBuffers(now, doneBuffers);
         }
+        freeBuffers(doneBuffers);
     }
     return true;
 }
 
-void ExynosMPP::ResourceManageThread::freeBuffers()
+/* This function must be called within a mMutex protection */
+void ExynosMPP::ResourceManageThread::watchFence(int fence)
+{
+    if ((mEpollFd < 0) || !fence_valid(fence))
+        return;
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fence;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fence, &ev) < 0)
+        HDEBUGLOGD(eDebugMPP|eDebugFence, "%s:: fence(%d) is not watched: %s",
+                mExynosMPP->mName.string(), fence, strerror(errno));
+}
+
+/* This function must be called within a mMutex protection */
+int ExynosMPP::ResourceManageThread::closeFence(int fence, hwc_fdebug_fence_type type)
+{
+    if (!fence_valid(fence))
+        return -1;
+
+    if (mEpollFd >= 0)
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fence, NULL);
+    return fence_close(fence, mExynosMPP->mAssignedDisplay, type, FENCE_IP_ALL);
+}
+
+/* This function must be called within a mMutex protection */
+int ExynosMPP::ResourceManageThread::getWaitTimeoutMs(nsecs_t now) const
+{
+    nsecs_t deadline = -1;
+
+    for (auto &buffer : mFreedBuffers) {
+        nsecs_t time = buffer.queuedTime + ms2ns(MPP_FREE_BUF_FENCE_TIMEOUT_MS);
+        if ((deadline < 0) || (time < deadline))
+            deadline = time;
+    }
+    for (auto &stateFence : mStateFences) {
+        nsecs_t time = stateFence.queuedTime + ms2ns(MPP_STATE_FENCE_TIMEOUT_MS);
+        if ((deadline < 0) || (time < deadline))
+            deadline = time;
+    }
+
+    if (deadline < 0)
+        return -1;
+    return (deadline > now) ? (int)ns2ms(deadline - now) + 1 : 0;
+}
+
+/* This function must be called within a mMutex protection */
+void ExynosMPP::ResourceManageThread::collectFreedBuffers(nsecs_t now,
+        std::vector<exynos_mpp_img_info> &doneBuffers)
+{
+    for (auto it = mFreedBuffers.begin(); it != mFreedBuffers.end();) {
+        exynos_mpp_img_info &freeBuffer = it->info;
+        bool expired = (now - it->queuedTime) >= ms2ns(MPP_FREE_BUF_FENCE_TIMEOUT_MS);
+        bool acquireDone = !fence_valid(freeBuffer.acrylicAcquireFenceFd) ||
+            (sync_wait(freeBuffer.acrylicAcquireFenceFd, 0) == 0);
+        bool releaseDone = !fence_valid(freeBuffer.acrylicReleaseFenceFd) ||
+            (sync_wait(freeBuffer.acrylicReleaseFenceFd, 0) == 0);
+
+        if ((!acquireDone || !releaseDone) && !expired) {
+            it++;
+            continue;
+        }
+
+        if (!acquireDone)
+            HWC_LOGE(NULL, "%s:: acquire fence sync_wait error", mExynosMPP->mName.string());
+        if (!releaseDone)
+            HWC_LOGE(NULL, "%s:: release fence sync_wait error", mExynosMPP->mName.string());
+        freeBuffer.acrylicAcquireFenceFd =
+            closeFence(freeBuffer.acrylicAcquireFenceFd, FENCE_TYPE_SRC_ACQUIRE);
+        freeBuffer.acrylicReleaseFenceFd =
+            closeFence(freeBuffer.acrylicReleaseFenceFd, FENCE_TYPE_SRC_RELEASE);
+
+        doneBuffers.push_back(freeBuffer);
+        it = mFreedBuffers.erase(it);
+    }
+}
+
+void ExynosMPP::ResourceManageThread::freeBuffers(std::vector<exynos_mpp_img_info> &doneBuffers)
 {
     VendorGraphicBufferAllocator& gAllocator(VendorGraphicBufferAllocator::get());
-    android::List<exynos_mpp_img_info >::iterator it;
-    android::List<exynos_mpp_img_info >::iterator end;
-    it = mFreedBuffers.begin();
-    end = mFreedBuffers.end();
-
-    uint32_t freebufNum = 0;
-    while (it != end) {
-        exynos_mpp_img_info freeBuffer = (exynos_mpp_img_info)(*it);
+
+    for (uint32_t freebufNum = 0; freebufNum < doneBuffers.size(); freebufNum++) {
+        exynos_mpp_img_info &freeBuffer = doneBuffers[freebufNum];
         HDEBUGLOGD(eDebugMPP|eDebugFence|eDebugBuf, "freebufNum: %d, buffer: %p", freebufNum, freeBuffer.bufferHandle);
         dumpExynosMPPImgInfo(eDebugMPP|eDebugFence|eDebugBuf, freeBuffer);
-        if (fence_valid(freeBuffer.acrylicAcquireFenceFd)) {
-            if (sync_wait(freeBuffer.acrylicAcquireFenceFd, 1000) < 0)
-                HWC_LOGE(NULL, "%s:: acquire fence sync_wait error", mExynosMPP->mName.string());
-            freeBuffer.acrylicAcquireFenceFd =
-                fence_close(freeBuffer.acrylicAcquireFenceFd, mExynosMPP->mAssignedDisplay,
-                        FENCE_TYPE_SRC_ACQUIRE, FENCE_IP_ALL);
-        }
-        if (fence_valid(freeBuffer.acrylicReleaseFenceFd)) {
-            if (sync_wait(freeBuffer.acrylicReleaseFenceFd, 1000) < 0)
-                HWC_LOGE(NULL, "%s:: release fence sync_wait error", mExynosMPP->mName.string());
-            freeBuffer.acrylicReleaseFenceFd =
-                fence_close(freeBuffer.acrylicReleaseFenceFd, mExynosMPP->mAssignedDisplay,
-                        FENCE_TYPE_SRC_RELEASE, FENCE_IP_ALL);
-        }
-        gAllocator.free(freeBuffer.bufferHandle);
-        it = mFreedBuffers.erase(it);
+        /* Buffers allocated by allocOutBuf() can be taken by any MPP */
+        if ((freeBuffer.allocUsage == 0) ||
+            !mExynosMPP->mResourceManager->putPooledDstBuf(freeBuffer.bufferHandle,
+                    freeBuffer.allocWidth, freeBuffer.allocHeight, freeBuffer.allocFormat,
+                    freeBuffer.allocUsage))
+            gAllocator.free(freeBuffer.bufferHandle);
     }
 }
 
-bool ExynosMPP::ResourceManageThread::checkStateFences()
+/*
+ * HW becomes idle once every state fence is signaled.
+ * This function must be called within a mMutex protection
+ */
+void ExynosMPP::ResourceManageThread::checkStateFences(nsecs_t now)
 {
-    bool ret = true;
-    android::List<int >::iterator it;
-    android::List<int >::iterator end;
+    if (mStateFences.empty())
+        return;
 
-    it = mStateFences.begin();
-    end = mStateFences.end();
-    uint32_t waitFenceNum = 0;
-    while (it != end) {
-        int fence = (int)(*it);
-        HDEBUGLOGD(eDebugMPP|eDebugFence, "%d wait fence: %d", waitFenceNum, fence);
-        waitFenceNum++;
-        if (fence_valid(fence)) {
-            if (sync_wait(fence, 5000) < 0) {
-                HWC_LOGE(NULL, "%s::[%s][%d] sync_wait(%d) error(%s)", __func__,
-                        mExynosMPP->mName.string(), mExynosMPP->mLogicalIndex, fence, strerror(errno));
-                ret = false;
-            }
-            fence = fence_close(fence, mExynosMPP->mAssignedDisplay,
-                    FENCE_TYPE_ALL, FENCE_IP_ALL);
+    for (auto it = mStateFences.begin(); it != mStateFences.end();) {
+        bool expired = (now - it->queuedTime) >= ms2ns(MPP_STATE_FENCE_TIMEOUT_MS);
+        bool signaled = !fence_valid(it->fence) || (sync_wait(it->fence, 0) == 0);
+        if (!signaled && !expired) {
+            it++;
+            continue;
+        }
+        if (!signaled) {
+            HWC_LOGE(NULL, "%s::[%s][%d] sync_wait(%d) error(%s)", __func__,
+                    mExynosMPP->mName.string(), mExynosMPP->mLogicalIndex, it->fence,
+                    strerror(errno));
+            mStateFenceError = true;
         }
+        HDEBUGLOGD(eDebugMPP|eDebugFence, "wait fence is done: %d", it->fence);
+        closeFence(it->fence, FENCE_TYPE_ALL);
         it = mStateFences.erase(it);
     }
-    return ret;
+
+    if (!mStateFences.empty())
+        return;
+
+    if (mExynosMPP->mHWState != MPP_HW_STATE_RUNNING)
+        ALOGW("%s, mHWState(%d) but state fences were pending",
+                mExynosMPP->mName.string(), mExynosMPP->mHWState);
+    else if (!mStateFenceError)
+        mExynosMPP->mHWState = MPP_HW_STATE_IDLE;
+    mStateFenceError = false;
 }
 
 void ExynosMPP::ResourceManageThread::addFreedBuffer(exynos_mpp_img_info freedBuffer)
 {
     android::Mutex::Autolock lock(mMutex);
-    mFreedBuffers.push_back(freedBuffer);
-    mCondition.signal();
+    watchFence(freedBuffer.acrylicAcquireFenceFd);
+    watchFence(freedBuffer.acrylicReleaseFenceFd);
+    mFreedBuffers.push_back({freedBuffer, systemTime(SYSTEM_TIME_MONOTONIC)});
+    wake();
 }
 
 void ExynosMPP::ResourceManageThread::addStateFence(int fence)
 {
     Mutex::Autolock lock(mMutex);
     HDEBUGLOGD(eDebugMPP|eDebugFence, "wait fence is added: %d", fence);
-    mStateFences.push_back(fence);
-    mCondition.signal();
+    watchFence(fence);
+    mStateFences.push_back({fence, systemTime(SYSTEM_TIME_MONOTONIC)});
+    wake();
+}
+
+void ExynosMPP::ResourceManageThread::wake()
+{
+    uint64_t count = 1;
+    if ((mWakeFd >= 0) && (write(mWakeFd, &count, sizeof(count)) != sizeof(count)))
+        ALOGE("%s:: Failed to wake up: %s", __func__, strerror(errno));
 }
 
 /**
@@ -924,7 +1027,7 @@ int32_t ExynosMPP::allocOutBuf(uint32_t w, uint32_t h, uint32_t format, uint64_t
 
     MPP_LOGD(eDebugMPP|eDebugBuf, "index: %d++++++++", index);
 
-    if (index >= NUM_MPP_DST_BUFS(mLogicalType)) {
+    if (index >= mDstBufNum) {
         return -EINVAL;
     }
 
@@ -943,8 +1046,9 @@ int32_t ExynosMPP::allocOutBuf(uint32_t w, uint32_t h, uint32_t format, uint64_t
 
     status_t error = NO_ERROR;
 
-    {
-        ATRACE_CALL();
+    dstBuffer = mResourceManager->getPooledDstBuf(w, h, format, allocUsage);
+    if (dstBuffer == NULL) {
+        ATRACE_NAME("allocateDstBuf");
 
         VendorGraphicBufferAllocator& gAllocator(VendorGraphicBufferAllocator::get());
         error = gAllocator.allocate(w, h, format, 1, allocUsage, &dstBuffer, &dstStride, "HWC");
@@ -956,12 +1060,17 @@ int32_t ExynosMPP::allocOutBuf(uint32_t w, uint32_t h, uint32_t format, uint64_t
     }
 
     memset(&mDstImgs[index], 0, sizeof(mDstImgs[index]));
+    mDstContents[index].valid = false;
 
     mDstImgs[index].acrylicAcquireFenceFd = -1;
     mDstImgs[index].acrylicReleaseFenceFd = -1;
     mDstImgs[index].bufferHandle = dstBuffer;
     mDstImgs[index].bufferType = getBufferType(usage);
     mDstImgs[index].format = format;
+    mDstImgs[index].allocWidth = w;
+    mDstImgs[index].allocHeight = h;
+    mDstImgs[index].allocFormat = format;
+    mDstImgs[index].allocUsage = allocUsage;
 
     MPP_LOGD(eDebugMPP|eDebugBuf, "free outbuf[%d] %p", index, freeDstBuf.bufferHandle);
     if (freeDstBuf.bufferHandle != NULL)
@@ -986,6 +1095,9 @@ int32_t ExynosMPP::allocOutBuf(uint32_t w, uint32_t h, uint32_t format, uint64_t
  */
 int32_t ExynosMPP::setOutBuf(buffer_handle_t outbuf, int32_t fence) {
     mDstImgs[mCurrentDstBuf].bufferHandle = NULL;
+    /* Not allocated by allocOutBuf(), never goes to the pool */
+    mDstImgs[mCurrentDstBuf].allocUsage = 0;
+    mDstContents[mCurrentDstBuf].valid = false;
     if (outbuf != NULL) {
         mDstImgs[mCurrentDstBuf].bufferHandle = outbuf;
         mDstImgs[mCurrentDstBuf].format =
@@ -1050,15 +1162,22 @@ uint64_t ExynosMPP::getBufferUsage(uint64_t usage)
     return allocUsage;
 }
 
+/*
+ * A composition target is compressed if G2D always writes AFBC or the
+ * resource manager chose it for the OTF MPP reading it. The output of a
+ * single layer is written as the mid image of the layer.
+ */
 bool ExynosMPP::needCompressDstBuf() const {
-    return (mMaxSrcLayerNum > 1) && mNeedCompressedTarget;
+    if (mMaxSrcLayerNum > 1)
+        return mNeedCompressedTarget || mCompressDst;
+    return (mAssignedSources.size() == 1) && mAssignedSources[0]->mMidImg.compressed;
 }
 
 bool ExynosMPP::needDstBufRealloc(struct exynos_image &dst, uint32_t index)
 {
     MPP_LOGD(eDebugMPP|eDebugBuf, "index: %d++++++++", index);
 
-    if (index >= NUM_MPP_DST_BUFS(mLogicalType)) {
+    if (index >= mDstBufNum) {
         MPP_LOGE("%s:: index(%d) is not valid", __func__, index);
         return false;
     }
@@ -1116,33 +1235,166 @@ bool ExynosMPP::canUsePrevFrame()
         return false;
 
     for (uint32_t i = 0; i < mPrevFrameInfo.srcNum; i++) {
-        if ((mPrevFrameInfo.srcInfo[i].bufferHandle != mAssignedSources[i]->mSrcImg.bufferHandle) ||
-            (mPrevFrameInfo.srcInfo[i].x !=  mAssignedSources[i]->mSrcImg.x) ||
-            (mPrevFrameInfo.srcInfo[i].y !=  mAssignedSources[i]->mSrcImg.y) ||
-            (mPrevFrameInfo.srcInfo[i].w !=  mAssignedSources[i]->mSrcImg.w) ||
-            (mPrevFrameInfo.srcInfo[i].h !=  mAssignedSources[i]->mSrcImg.h) ||
-            (mPrevFrameInfo.srcInfo[i].format !=  mAssignedSources[i]->mSrcImg.format) ||
-            (mPrevFrameInfo.srcInfo[i].usageFlags !=  mAssignedSources[i]->mSrcImg.usageFlags) ||
-            (mPrevFrameInfo.srcInfo[i].dataSpace !=  mAssignedSources[i]->mSrcImg.dataSpace) ||
-            (mPrevFrameInfo.srcInfo[i].blending !=  mAssignedSources[i]->mSrcImg.blending) ||
-            (mPrevFrameInfo.srcInfo[i].transform !=  mAssignedSources[i]->mSrcImg.transform) ||
-            (mPrevFrameInfo.srcInfo[i].compressed !=  mAssignedSources[i]->mSrcImg.compressed) ||
-            (mPrevFrameInfo.srcInfo[i].planeAlpha !=  mAssignedSources[i]->mSrcImg.planeAlpha) ||
-            (mPrevFrameInfo.dstInfo[i].x != mAssignedSources[i]->mMidImg.x) ||
-            (mPrevFrameInfo.dstInfo[i].y != mAssignedSources[i]->mMidImg.y) ||
-            (mPrevFrameInfo.dstInfo[i].w != mAssignedSources[i]->mMidImg.w) ||
-            (mPrevFrameInfo.dstInfo[i].h != mAssignedSources[i]->mMidImg.h) ||
-            (mPrevFrameInfo.dstInfo[i].format != mAssignedSources[i]->mMidImg.format))
+        if (!isSameSourceImage(mPrevFrameInfo.srcInfo[i], mPrevFrameInfo.dstInfo[i],
+                    *mAssignedSources[i]))
             return false;
     }
 
-   int32_t prevDstIndex  = (mCurrentDstBuf + NUM_MPP_DST_BUFS(mLogicalType) - 1)% NUM_MPP_DST_BUFS(mLogicalType);
+   int32_t prevDstIndex  = (mCurrentDstBuf + mDstBufNum - 1) % mDstBufNum;
    if (mDstImgs[prevDstIndex].bufferHandle == NULL)
        return false;
 
+    /* The compression of the output may have changed with the otfMPP */
+    if (isAFBCCompressed(mDstImgs[prevDstIndex].bufferHandle) != needCompressDstBuf())
+        return false;
+
     return true;
 }
 
+bool ExynosMPP::isSameSourceImage(const exynos_image &prevSrc, const exynos_image &prevDst,
+        const ExynosMPPSource &source) const
+{
+    return (prevSrc.bufferHandle == source.mSrcImg.bufferHandle) &&
+        (prevSrc.x == source.mSrcImg.x) &&
+        (prevSrc.y == source.mSrcImg.y) &&
+        (prevSrc.w == source.mSrcImg.w) &&
+        (prevSrc.h == source.mSrcImg.h) &&
+        (prevSrc.format == source.mSrcImg.format) &&
+        (prevSrc.usageFlags == source.mSrcImg.usageFlags) &&
+        (prevSrc.dataSpace == source.mSrcImg.dataSpace) &&
+        (prevSrc.blending == source.mSrcImg.blending) &&
+        (prevSrc.transform == source.mSrcImg.transform) &&
+        (prevSrc.compressed == source.mSrcImg.compressed) &&
+        (prevSrc.planeAlpha == source.mSrcImg.planeAlpha) &&
+        (prevDst.x == source.mMidImg.x) &&
+        (prevDst.y == source.mMidImg.y) &&
+        (prevDst.w == source.mMidImg.w) &&
+        (prevDst.h == source.mMidImg.h) &&
+        (prevDst.format == source.mMidImg.format);
+}
+
+/* Only layer sources have a buffer generation, false if any source is not a layer */
+bool ExynosMPP::getSourceGenerations(uint64_t *generation) const
+{
+    for (uint32_t i = 0; i < mAssignedSources.size(); i++) {
+        if ((mAssignedSources[i]->mSourceType != MPP_SOURCE_LAYER) ||
+            (mAssignedSources[i]->mSource == NULL))
+            return false;
+        generation[i] = ((ExynosLayer *)mAssignedSources[i]->mSource)->mBufferGeneration;
+        if (generation[i] == 0)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Index of a destination buffer that already holds the frame of mAssignedSources,
+ * -1 if there is none. canUsePrevFrame() only checks the last one.
+ */
+int32_t ExynosMPP::findDstContent(struct exynos_image &dst)
+{
+    if ((mAssignedDisplay && !mAssignedDisplay->mDisplayControl.skipM2mProcessing) ||
+        !exynosHWCControl.skipM2mProcessing)
+        return -1;
+
+    if ((mAllocOutBufFlag == false) || (mAssignedSources.size() == 0) ||
+        (mAssignedSources.size() > NUM_MPP_SRC_BUFS))
+        return -1;
+
+    uint64_t generation[NUM_MPP_SRC_BUFS];
+    if (!getSourceGenerations(generation))
+        return -1;
+
+    for (uint32_t i = 0; i < mDstBufNum; i++) {
+        const ExynosMPPDstContent &content = mDstContents[i];
+        if (!content.valid || (content.frameInfo.srcNum != mAssignedSources.size()) ||
+            (mDstImgs[i].bufferHandle == NULL))
+            continue;
+
+        bool sameFrame = true;
+        for (uint32_t j = 0; j < content.frameInfo.srcNum; j++) {
+            if ((content.generation[j] != generation[j]) ||
+                !isSameSourceImage(content.frameInfo.srcInfo[j], content.frameInfo.dstInfo[j],
+                        *mAssignedSources[j])) {
+                sameFrame = false;
+                break;
+            }
+        }
+        if (sameFrame && !needDstBufRealloc(dst, i))
+            return i;
+    }
+    return -1;
+}
+
+void ExynosMPP::saveDstContent(uint32_t index)
+{
+    if (index >= mDstBufNum)
+        return;
+
+    ExynosMPPDstContent &content = mDstContents[index];
+    content.valid = (mAssignedSources.size() <= NUM_MPP_SRC_BUFS) &&
+        getSourceGenerations(content.generation);
+    if (!content.valid)
+        return;
+
+    content.frameInfo.srcNum = (uint32_t)mAssignedSources.size();
+    for (uint32_t i = 0; i < content.frameInfo.srcNum; i++) {
+        content.frameInfo.srcInfo[i] = mAssignedSources[i]->mSrcImg;
+        content.frameInfo.dstInfo[i] = mAssignedSources[i]->mMidImg;
+    }
+    content.processTime = getAssignedCapacity();
+}
+
+void ExynosMPP::releaseSrcLayer(exynos_mpp_img_info &srcImgInfo)
+{
+    if (srcImgInfo.mppLayer != NULL) {
+        delete srcImgInfo.mppLayer;
+        srcImgInfo.mppLayer = NULL;
+    }
+    srcImgInfo.mppSource = NULL;
+    srcImgInfo.layerConfig.valid = false;
+}
+
+/*
+ * mAssignedSources is sorted by zOrder, so the index of a source changes
+ * when other sources are added or removed. The slots are swapped so that
+ * each source keeps its AcrylicLayer and the configuration of it.
+ */
+void ExynosMPP::mapSrcImgsToSources()
+{
+    size_t sourceNum = min(mAssignedSources.size(), (size_t)NUM_MPP_SRC_BUFS);
+
+    for (size_t i = 0; i < sourceNum; i++) {
+        ExynosMPPSource *source = mAssignedSources[i];
+        size_t k = i;
+        while ((k < NUM_MPP_SRC_BUFS) && (mSrcImgs[k].mppSource != source))
+            k++;
+
+        if (k == NUM_MPP_SRC_BUFS) {
+            /* New source, take a slot that no remaining source owns */
+            for (k = i; k < NUM_MPP_SRC_BUFS; k++) {
+                bool owned = false;
+                for (size_t j = i + 1; j < sourceNum; j++) {
+                    if (mSrcImgs[k].mppSource == mAssignedSources[j]) {
+                        owned = true;
+                        break;
+                    }
+                }
+                if (!owned)
+                    break;
+            }
+        }
+
+        if ((k != i) && (k < NUM_MPP_SRC_BUFS))
+            std::swap(mSrcImgs[i], mSrcImgs[k]);
+
+        if (mSrcImgs[i].mppSource != source) {
+            mSrcImgs[i].mppSource = source;
+            mSrcImgs[i].layerConfig.valid = false;
+        }
+    }
+}
+
 int32_t ExynosMPP::setupLayer(exynos_mpp_img_info *srcImgInfo, struct exynos_image &src, struct exynos_image &dst)
 {
     int ret = NO_ERROR;
@@ -1153,6 +1405,7 @@ int32_t ExynosMPP::setupLayer(exynos_mpp_img_info *srcImgInfo, struct exynos_ima
             MPP_LOGE("%s:: Fail to create layer", __func__);
             return -EINVAL;
         }
+        srcImgInfo->layerConfig.valid = false;
     }
 
     if (src.bufferHandle == NULL) {
@@ -1195,8 +1448,8 @@ int32_t ExynosMPP::setupLayer(exynos_mpp_img_info *srcImgInfo, struct exynos_ima
 
     /* HDR process */
     if (hasHdrInfo(src)) {
-        unsigned int max = (src.metaParcel.sHdrStaticInfo.sType1.mMaxDisplayLuminance/10000);
-        unsigned int min = src.metaParcel.sHdrStaticInfo.sType1.mMinDisplayLuminance;
+        unsigned int max = (src.getMetaParcel().sHdrStaticInfo.sType1.mMaxDisplayLuminance/10000);
+        unsigned int min = src.getMetaParcel().sHdrStaticInfo.sType1.mMinDisplayLuminance;
 
         srcImgInfo->mppLayer->setMasterDisplayLuminance(min,max);
         MPP_LOGD(eDebugMPP, "HWC2: G2D luminance min %d, max %d", min, max);
@@ -1205,7 +1458,9 @@ int32_t ExynosMPP::setupLayer(exynos_mpp_img_info *srcImgInfo, struct exynos_ima
 
     /* Transfer MetaData */
     if (src.hasMetaParcel) {
-        srcImgInfo->mppLayer->setLayerData(&src.metaParcel, sizeof(src.metaParcel));
+        /* Only read by libacryl, the source image keeps it alive */
+        srcImgInfo->mppLayer->setLayerData(const_cast<ExynosVideoMeta *>(src.metaParcel.get()),
+                                           sizeof(ExynosVideoMeta));
     }
 
     srcImgInfo->bufferType = getBufferType(srcHandle);
@@ -1229,12 +1484,27 @@ int32_t ExynosMPP::setupLayer(exynos_mpp_img_info *srcImgInfo, struct exynos_ima
             (int)src.x, (int)src.y, (int)(src.x + src.w), (int)(src.y + src.h),
             (int)dst.x, (int)dst.y, (int)(dst.x + dst.w), (int)(dst.y + dst.h), src.transform);
 
-    srcImgInfo->mppLayer->setImageDimension(src.fullWidth, src.fullHeight);
+    /*
+     * The layer keeps its configuration while it belongs to the same source,
+     * only the values that changed are set again.
+     */
+    exynos_mpp_layer_config_t &config = srcImgInfo->layerConfig;
+    bool dimensionChanged = !config.valid ||
+        (config.fullWidth != src.fullWidth) || (config.fullHeight != src.fullHeight);
+    if (dimensionChanged) {
+        /* This resets the crop of the layer */
+        config.valid = srcImgInfo->mppLayer->setImageDimension(src.fullWidth, src.fullHeight);
+        config.fullWidth = src.fullWidth;
+        config.fullHeight = src.fullHeight;
+    }
 
-    if (gmeta.format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV) {
-        srcImgInfo->mppLayer->setImageType(HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M, dataspace);
-    } else {
-        srcImgInfo->mppLayer->setImageType(gmeta.format, dataspace);
+    uint32_t imageFormat = gmeta.format;
+    if (gmeta.format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV)
+        imageFormat = HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M;
+    if (dimensionChanged || (config.format != imageFormat) || (config.dataspace != dataspace)) {
+        config.valid &= srcImgInfo->mppLayer->setImageType(imageFormat, dataspace);
+        config.format = imageFormat;
+        config.dataspace = dataspace;
     }
 
     if (mPhysicalType == MPP_G2D) {
@@ -1252,24 +1522,38 @@ int32_t ExynosMPP::setupLayer(exynos_mpp_img_info *srcImgInfo, struct exynos_ima
     srcImgInfo->mppLayer->setImageBuffer(bufFds, bufLength, bufferNum,
             srcImgInfo->acrylicAcquireFenceFd, attribute);
 
-    if (mMaxSrcLayerNum > 1) {
-        srcImgInfo->mppLayer->setCompositMode(src.blending, (uint8_t)(255 * src.planeAlpha), src.zOrder);
-    } else {
-        srcImgInfo->mppLayer->setCompositMode(src.blending, 255, src.zOrder);
+    uint8_t planeAlpha = 255;
+    if (mMaxSrcLayerNum > 1)
+        planeAlpha = (uint8_t)(255 * src.planeAlpha);
+    if (dimensionChanged || (config.blending != src.blending) ||
+        (config.planeAlpha != planeAlpha) || (config.zOrder != src.zOrder)) {
+        config.valid &= srcImgInfo->mppLayer->setCompositMode(src.blending, planeAlpha, src.zOrder);
+        config.blending = src.blending;
+        config.planeAlpha = planeAlpha;
+        config.zOrder = src.zOrder;
     }
 
     hwc_rect_t src_rect = {(int)src.x, (int)src.y, (int)(src.x + src.w), (int)(src.y + src.h)};
     hwc_rect_t dst_rect = {(int)dst.x, (int)dst.y, (int)(dst.x + dst.w), (int)(dst.y + dst.h)};
 
+    uint32_t compositAttr = 0;
     if ((mAssignedDisplay != NULL) &&
         ((mAssignedDisplay->mType == HWC_DISPLAY_VIRTUAL) ||
          (mAssignedDisplay->mType == HWC_DISPLAY_EXTERNAL)))
-        srcImgInfo->mppLayer->setCompositArea(src_rect, dst_rect, src.transform, AcrylicLayer::ATTR_NORESAMPLING);
-    else {
-        if(isFormatYUV(src.format))
-            srcImgInfo->mppLayer->setCompositArea(src_rect, dst_rect, src.transform, AcrylicLayer::ATTR_NORESAMPLING);
-        else
-            srcImgInfo->mppLayer->setCompositArea(src_rect, dst_rect, src.transform);
+        compositAttr = AcrylicLayer::ATTR_NORESAMPLING;
+    else if (isFormatYUV(src.format))
+        compositAttr = AcrylicLayer::ATTR_NORESAMPLING;
+
+    if (dimensionChanged ||
+        (memcmp(&config.srcRect, &src_rect, sizeof(src_rect)) != 0) ||
+        (memcmp(&config.dstRect, &dst_rect, sizeof(dst_rect)) != 0) ||
+        (config.transform != src.transform) || (config.attr != compositAttr)) {
+        config.valid &= srcImgInfo->mppLayer->setCompositArea(src_rect, dst_rect,
+                src.transform, compositAttr);
+        config.srcRect = src_rect;
+        config.dstRect = dst_rect;
+        config.transform = src.transform;
+        config.attr = compositAttr;
     }
 
     srcImgInfo->acrylicAcquireFenceFd = -1;
@@ -1289,9 +1573,9 @@ dstMetaInfo_t ExynosMPP::getDstMetaInfo(android_dataspace_t dstDataspace)
     if ((mAssignedSources.size() <= 1) &&
             (mAssignedSources[0]->mSrcImg.dataSpace == dstDataspace)) {
         metaInfo.minLuminance =
-            (uint16_t)mAssignedSources[0]->mSrcImg.metaParcel.sHdrStaticInfo.sType1.mMinDisplayLuminance;
+            (uint16_t)mAssignedSources[0]->mSrcImg.getMetaParcel().sHdrStaticInfo.sType1.mMinDisplayLuminance;
         metaInfo.maxLuminance =
-            (uint16_t)(mAssignedSources[0]->mSrcImg.metaParcel.sHdrStaticInfo.sType1.mMaxDisplayLuminance/10000);
+            (uint16_t)(mAssignedSources[0]->mSrcImg.getMetaParcel().sHdrStaticInfo.sType1.mMaxDisplayLuminance/10000);
     } else {
         // minLuminance: 0.0001nit unit, maxLuminance: 1nit unit
         metaInfo.minLuminance = (uint16_t)(mAssignedDisplay->mMinLuminance * 10000);
@@ -1425,11 +1709,13 @@ int32_t ExynosMPP::doPostProcessingInternal()
     int ret = NO_ERROR;
     size_t sourceNum = mAssignedSources.size();
 
-    if (mAcrylicHandle == NULL) {
+    if (getAcrylicHandle() == NULL) {
         MPP_LOGE("%s:: mAcrylicHandle is NULL", __func__);
         return -EINVAL;
     }
 
+    mapSrcImgsToSources();
+
     /* setup source layers */
     for(size_t i = 0; i < sourceNum; i++) {
         MPP_LOGD(eDebugMPP|eDebugFence, "Setup [%zu] source: %p", i, mAssignedSources[i]);
@@ -1452,10 +1738,7 @@ int32_t ExynosMPP::doPostProcessingInternal()
         for (size_t i = sourceNum; i < mPrevFrameInfo.srcNum; i++)
         {
             MPP_LOGD(eDebugMPP, "Remove mSrcImgs[%zu], %p", i, mSrcImgs[i].mppLayer);
-            if (mSrcImgs[i].mppLayer != NULL) {
-                delete mSrcImgs[i].mppLayer;
-                mSrcImgs[i].mppLayer = NULL;
-            }
+            releaseSrcLayer(mSrcImgs[i]);
         }
     }
 
@@ -1467,6 +1750,8 @@ int32_t ExynosMPP::doPostProcessingInternal()
     MPP_LOGD(eDebugFence, "setupDst ++ mDstImgs[%d] acrylicAcquireFenceFd(%d)",
             mCurrentDstBuf, mDstImgs[mCurrentDstBuf].acrylicAcquireFenceFd);
 
+    if (mAllocOutBufFlag)
+        checkDstStall(mDstImgs[mCurrentDstBuf].acrylicAcquireFenceFd);
     setupDst(&mDstImgs[mCurrentDstBuf]);
 
     MPP_LOGD(eDebugFence, "setupDst -- mDstImgs[%d] acrylicAcquireFenceFd(%d) closed",
@@ -1489,7 +1774,13 @@ int32_t ExynosMPP::doPostProcessingInternal()
     int *releaseFences = NULL;
 #endif
 
-    acrylicReturn = mAcrylicHandle->execute(releaseFences, usingFenceCnt);
+    if (mPhysicalType == MPP_G2D) {
+        /* libacryl measures the laptimes of the jobs with a handle */
+        int handle;
+        acrylicReturn = mAcrylicHandle->execute(releaseFences, usingFenceCnt, &handle);
+    } else {
+        acrylicReturn = mAcrylicHandle->execute(releaseFences, usingFenceCnt);
+    }
 
     if (acrylicReturn == false) {
         MPP_LOGE("%s:: fail to excute compositor", __func__);
@@ -1585,6 +1876,19 @@ int32_t ExynosMPP::doPostProcessingInternal()
                     mCurrentDstBuf, mDstImgs[mCurrentDstBuf].acrylicReleaseFenceFd, dstBufIdx);
         }
 
+        uint64_t pixels = 0;
+        for (size_t i = 0; i < sourceNum; i++)
+            pixels += (uint64_t)mAssignedSources[i]->mSrcImg.w * mAssignedSources[i]->mSrcImg.h;
+        updateUtilization(pixels);
+        sampleLaptime(mDstImgs[mCurrentDstBuf].acrylicReleaseFenceFd, usingFenceCnt == 0);
+
+        if (mPhysicalType == MPP_G2D) {
+            mLaptimeCalibration.modeled[mLaptimeCalibration.index] = mUsedCapacity;
+            mLaptimeCalibration.index = (mLaptimeCalibration.index + 1) % MPP_LAPTIME_HISTORY_NUM;
+            if (mLaptimeCalibration.count < MPP_LAPTIME_HISTORY_NUM)
+                mLaptimeCalibration.count++;
+        }
+
         if (exynosHWCControl.dumpMidBuf) {
             ALOGI("dump image");
             exynosHWCControl.dumpMidBuf = false;
@@ -1638,7 +1942,8 @@ bool ExynosMPP::canSkipProcessing()
         (mLogicalType == MPP_LOGICAL_G2D_COMBO)) {
         dst = mAssignedDisplay->mExynosCompositionInfo.mDstImg;
     }
-    return ((needDstBufRealloc(dst, mCurrentDstBuf) == false) & canUsePrevFrame());
+    return ((needDstBufRealloc(dst, mCurrentDstBuf) == false) & canUsePrevFrame()) ||
+        (findDstContent(dst) >= 0);
 
 }
 
@@ -1650,10 +1955,12 @@ bool ExynosMPP::canSkipProcessing()
 int32_t ExynosMPP::doPostProcessing(struct exynos_image &src, struct exynos_image &dst)
 {
     ATRACE_CALL();
+    HWC_TRACE_FUNC(eHwcTraceM2M);
     MPP_LOGD(eDebugMPP, "total assigned sources (%zu)++++++++", mAssignedSources.size());
 
     int ret = NO_ERROR;
     bool realloc = false;
+    int32_t contentIndex = -1;
     if (mAssignedSources.size() == 0) {
         MPP_LOGE("Assigned source size(%zu) is not valid",
                 mAssignedSources.size());
@@ -1694,9 +2001,20 @@ int32_t ExynosMPP::doPostProcessing(struct exynos_image &src, struct exynos_imag
         }
     }
 
-    if ((realloc == false) && canUsePrevFrame()) {
-        mCurrentDstBuf = (mCurrentDstBuf + NUM_MPP_DST_BUFS(mLogicalType) - 1)% NUM_MPP_DST_BUFS(mLogicalType);
+    if (realloc == false) {
+        if (canUsePrevFrame()) {
+            contentIndex = (mCurrentDstBuf + mDstBufNum - 1) % mDstBufNum;
+        } else {
+            contentIndex = findDstContent(dst);
+        }
+    }
+
+    if (contentIndex >= 0) {
+        mCurrentDstBuf = contentIndex;
         MPP_LOGD(eDebugMPP|eDebugFence, "Reuse previous frame, dstImg[%d]", mCurrentDstBuf);
+        mDstContentHit++;
+        if (mDstContents[mCurrentDstBuf].valid)
+            mDstContentSavedTime += mDstContents[mCurrentDstBuf].processTime;
         for (uint32_t i = 0; i < mAssignedSources.size(); i++) {
             mAssignedSources[i]->mSrcImg.acquireFenceFd =
                 fence_close(mAssignedSources[i]->mSrcImg.acquireFenceFd,
@@ -1706,11 +2024,16 @@ int32_t ExynosMPP::doPostProcessing(struct exynos_image &src, struct exynos_imag
     }
 
     /* G2D or sclaer case */
+    if (mAllocOutBufFlag)
+        mDstContentMiss++;
+    mDstContents[mCurrentDstBuf].valid = false;
     if ((ret = doPostProcessingInternal()) < 0) {
         MPP_LOGE("%s:: fail to post processing, ret %d",
                 __func__, ret);
         goto save_frame_info;
     }
+    if (mAllocOutBufFlag)
+        saveDstContent(mCurrentDstBuf);
 
 save_frame_info:
     /* Save current frame information for next frame*/
@@ -1753,13 +2076,13 @@ int32_t ExynosMPP::resetSrcReleaseFence()
 
 int32_t ExynosMPP::getDstImageInfo(exynos_image *img)
 {
-    if ((mCurrentDstBuf < 0) || (mCurrentDstBuf >= NUM_MPP_DST_BUFS(mLogicalType)) ||
+    if ((mCurrentDstBuf < 0) || (mCurrentDstBuf >= (int32_t)mDstBufNum) ||
         (mAssignedDisplay == NULL)) {
         MPP_LOGE("mCurrentDstBuf(%d), mAssignedDisplay(%p)", mCurrentDstBuf, mAssignedDisplay);
         return -EINVAL;
     }
 
-    memset(img, 0, sizeof(exynos_image));
+    *img = exynos_image();
     img->acquireFenceFd = -1;
     img->releaseFenceFd = -1;
 
@@ -1821,7 +2144,7 @@ int32_t ExynosMPP::setDstAcquireFence(int acquireFence)
         MPP_LOGD(eDebugFence|eDebugMPP,
                 "M2MMPP : same buffer was reused idx %d, %d",mPrivDstBuf, mCurrentDstBuf);
 
-    if (dstBufIndex < 0 || dstBufIndex >= NUM_MPP_DST_BUFS(mLogicalType)) {
+    if (dstBufIndex < 0 || dstBufIndex >= (int32_t)mDstBufNum) {
         // TODO fence_close..
         acquireFence = fence_close(acquireFence, mAssignedDisplay, FENCE_TYPE_DST_ACQUIRE, FENCE_IP_ALL);
         mPrivDstBuf = mCurrentDstBuf;
@@ -1858,7 +2181,7 @@ int32_t ExynosMPP::resetDstReleaseFence()
 {
     MPP_LOGD(eDebugFence, "");
 
-    if (mCurrentDstBuf < 0 || mCurrentDstBuf >= NUM_MPP_DST_BUFS(mLogicalType))
+    if (mCurrentDstBuf < 0 || mCurrentDstBuf >= (int32_t)mDstBufNum)
         return -EINVAL;
 
     mDstImgs[mCurrentDstBuf].acrylicReleaseFenceFd = -1;
@@ -1896,9 +2219,10 @@ int32_t ExynosMPP::requestHWStateChange(uint32_t state)
 
         /* Free all of output buffers */
         if (mMPPType == MPP_TYPE_M2M) {
-            for(uint32_t i = 0; i < NUM_MPP_DST_BUFS(mLogicalType); i++) {
+            for(uint32_t i = 0; i < mDstBufNum; i++) {
                 exynos_mpp_img_info freeDstBuf = mDstImgs[i];
                 memset(&mDstImgs[i], 0, sizeof(mDstImgs[i]));
+                mDstContents[i].valid = false;
                 mDstImgs[i].acrylicAcquireFenceFd = freeDstBuf.acrylicAcquireFenceFd;
                 mDstImgs[i].acrylicReleaseFenceFd = freeDstBuf.acrylicReleaseFenceFd;
                 freeDstBuf.acrylicAcquireFenceFd = -1;
@@ -1913,17 +2237,16 @@ int32_t ExynosMPP::requestHWStateChange(uint32_t state)
                 } else {
                     mDstImgs[i].bufferHandle = freeDstBuf.bufferHandle;
                     mDstImgs[i].bufferType = freeDstBuf.bufferType;
+                    mDstImgs[i].allocWidth = freeDstBuf.allocWidth;
+                    mDstImgs[i].allocHeight = freeDstBuf.allocHeight;
+                    mDstImgs[i].allocFormat = freeDstBuf.allocFormat;
+                    mDstImgs[i].allocUsage = freeDstBuf.allocUsage;
                 }
             }
         }
 
         for (uint32_t i = 0; i < NUM_MPP_SRC_BUFS; i++)
-        {
-            if (mSrcImgs[i].mppLayer != NULL) {
-                delete mSrcImgs[i].mppLayer;
-                mSrcImgs[i].mppLayer = NULL;
-            }
-        }
+            releaseSrcLayer(mSrcImgs[i]);
         memset(&mPrevFrameInfo, 0, sizeof(mPrevFrameInfo));
         for (int i = 0; i < NUM_MPP_SRC_BUFS; i++) {
             mPrevFrameInfo.srcInfo[i].acquireFenceFd = -1;
@@ -1953,6 +2276,23 @@ int32_t ExynosMPP::setupRestriction() {
 
     MPP_LOGD(eDebugMPP, "mPhysicalType(%d)", mPhysicalType);
 
+    resetSupportedCache();
+    setupPPCTable();
+
+    mSrcFormats.clear();
+    mDstFormats.clear();
+    for (uint32_t i = 0; i < mResourceManager->mFormatRestrictionCnt; i++) {
+        const restriction_key_t &restriction = mResourceManager->mFormatRestrictions[i];
+        if (restriction.hwType != mPhysicalType)
+            continue;
+        if ((restriction.nodeType == NODE_NONE) || (restriction.nodeType == NODE_SRC))
+            mSrcFormats.insert(restriction.format);
+        if ((restriction.nodeType == NODE_NONE) || (restriction.nodeType == NODE_DST))
+            mDstFormats.insert(restriction.format);
+    }
+    MPP_LOGD(eDebugMPP, "\tSupported formats src(%zu), dst(%zu)", mSrcFormats.size(),
+            mDstFormats.size());
+
     for (uint32_t i = 0; i < RESTRICTION_MAX; i++) {
         const restriction_size_element *restriction_size_table = mResourceManager->mSizeRestrictions[i];
         for (uint32_t j = 0; j < mResourceManager->mSizeRestrictionCnt[i]; j++) {
@@ -1995,7 +2335,66 @@ int32_t ExynosMPP::setupRestriction() {
     return NO_ERROR;
 }
 
+size_t MPPSupportedKeyHash::operator()(const mpp_supported_key_t &key) const {
+    size_t seed = 0;
+    hash_combine(seed, key.displayId);
+    hash_combine(seed, key.displayYres);
+    hash_combine(seed, key.btsRefreshRate);
+    hash_combine(seed, key.hasHdrLayer);
+    hash_combine(seed, key.hasDrmLayer);
+    for (const auto &img : {key.src, key.dst}) {
+        hash_combine(seed, img.fullWidth);
+        hash_combine(seed, img.fullHeight);
+        hash_combine(seed, img.x);
+        hash_combine(seed, img.y);
+        hash_combine(seed, img.w);
+        hash_combine(seed, img.h);
+        hash_combine(seed, img.format);
+        hash_combine(seed, img.usageFlags);
+        hash_combine(seed, img.layerFlags);
+        hash_combine(seed, (int32_t)img.dataSpace);
+        hash_combine(seed, img.blending);
+        hash_combine(seed, img.transform);
+        hash_combine(seed, img.compressed);
+        hash_combine(seed, (int32_t)img.metaType);
+        hash_combine(seed, img.needColorTransform);
+    }
+    return seed;
+}
+
 int64_t ExynosMPP::isSupported(ExynosDisplay &display, struct exynos_image &src, struct exynos_image &dst)
+{
+    mpp_supported_key_t key;
+    key.displayId = display.getId();
+    key.displayYres = display.mYres;
+    key.btsRefreshRate = display.getBtsRefreshRate();
+    key.hasHdrLayer = mResourceManager ? mResourceManager->hasHdrLayer : false;
+    key.hasDrmLayer = mResourceManager ? mResourceManager->hasDrmLayer : false;
+    key.src = mpp_supported_image_t(src);
+    key.dst = mpp_supported_image_t(dst);
+
+    auto iter = mSupportedCache.find(key);
+    if (iter != mSupportedCache.end())
+        return iter->second;
+
+    int64_t ret = isSupportedInternal(display, src, dst);
+
+    if (mSupportedCache.size() >= MPP_SUPPORTED_CACHE_SIZE)
+        mSupportedCache.clear();
+    mSupportedCache.emplace(key, ret);
+
+    return ret;
+}
+
+void ExynosMPP::resetSupportedCache()
+{
+    mSupportedCache.clear();
+    if (mResourceManager != NULL)
+        mResourceManager->resetSupportedResults();
+}
+
+int64_t ExynosMPP::isSupportedInternal(ExynosDisplay &display, struct exynos_image &src,
+                                       struct exynos_image &dst)
 {
     uint32_t maxSrcWidth = getSrcMaxWidth(src);
     uint32_t maxSrcHeight = getSrcMaxHeight(src);
@@ -2113,6 +2512,10 @@ int64_t ExynosMPP::isSupported(ExynosDisplay &display, struct exynos_image &src,
     if (!isSupportedCompression(src))
         return -eMPPUnsupportedCompression;
 
+    /* M2M MPPs write AFBC only if they can read it */
+    if ((mPhysicalType >= MPP_DPP_NUM) && dst.compressed && !(mAttr & MPP_ATTR_AFBC))
+        return -eMPPUnsupportedCompression;
+
     if (!isSupportLayerColorTransform(src,dst))
         return -eMPPUnsupportedColorTransform;
 
@@ -2212,11 +2615,25 @@ int32_t ExynosMPP::assignMPP(ExynosDisplay *display, ExynosMPPSource* mppSource)
 
     mAssignedDisplay = display;
 
+    /*
+     * Warm up the acrylic handle while validating so that the device is not
+     * opened in the middle of the first frame that is processed by this MPP
+     */
+    if ((mMPPType == MPP_TYPE_M2M) && (getAcrylicHandle() == NULL))
+        MPP_LOGE("%s:: mAcrylicHandle is NULL", __func__);
+
     /* Update information for used capacity */
     /* This should be called before mAssignedSources.add(mppSource) */
     bool needUpdateCapacity = addCapacity(mppSource);
 
-    mAssignedSources.add(mppSource);
+    /* Keep mAssignedSources sorted by zOrder */
+    if (mMaxSrcLayerNum > 1) {
+        auto pos = std::upper_bound(mAssignedSources.begin(), mAssignedSources.end(),
+                mppSource, exynosMPPSourceComp);
+        mAssignedSources.insertAt(mppSource, pos - mAssignedSources.begin());
+    } else {
+        mAssignedSources.add(mppSource);
+    }
 
     MPP_LOGD(eDebugCapacity|eDebugMPP, "\tassigned to source(%p) type(%d), mAssignedSources(%zu)",
             mppSource, mppSource->mSourceType,
@@ -2225,10 +2642,6 @@ int32_t ExynosMPP::assignMPP(ExynosDisplay *display, ExynosMPPSource* mppSource)
     if (needUpdateCapacity)
         updateUsedCapacity();
 
-    if (mMaxSrcLayerNum > 1) {
-        std::sort(mAssignedSources.begin(), mAssignedSources.end(), exynosMPPSourceComp);
-    }
-
     return NO_ERROR;
 }
 
@@ -2305,7 +2718,10 @@ bool ExynosMPP::isAssignableState(ExynosDisplay *display, struct exynos_image &s
             isAssignable = false;
         }
     } else if ((mAssignedState & MPP_ASSIGN_STATE_ASSIGNED) && !(mAssignedState & MPP_ASSIGN_STATE_RESERVED)) {
-        if (mAssignedSources.size() < getSrcMaxBlendingNum(src, dst))
+        /* One destination is composed per frame, it can't be shared by displays */
+        if (mAssignedDisplay != display)
+            isAssignable = false;
+        else if (mAssignedSources.size() < getSrcMaxBlendingNum(src, dst))
             isAssignable = true;
         else
             isAssignable = false;
@@ -2340,11 +2756,23 @@ bool ExynosMPP::hasEnoughCapa(ExynosDisplay *display, struct exynos_image &src,
     totalUsedCapacity -= mUsedCapacity;
 
     float requiredCapacity = getRequiredCapacity(display, src, dst);
+    float calibration = 1.0f;
+
+    if (mPhysicalType == MPP_G2D) {
+        calibration = getLaptimeCalibration();
+        totalUsedCapacity *= calibration;
+        requiredCapacity *= calibration;
+    }
 
     MPP_LOGD(eDebugCapacity|eDebugMPP, "mCapacity(%f), usedCapacity(%f), RequiredCapacity(%f)",
             mCapacity, totalUsedCapacity, requiredCapacity);
 
-    if (mCapacity >= (totalUsedCapacity + requiredCapacity))
+    bool enoughCapa = (mCapacity >= (totalUsedCapacity + requiredCapacity));
+    if ((mMPPType == MPP_TYPE_M2M) && mResourceManager->isM2mShareEnabled())
+        enoughCapa = mResourceManager->checkM2mShare(display, *this, totalUsedCapacity,
+                                                     requiredCapacity, calibration);
+
+    if (enoughCapa)
         return true;
     else if ((hasHdrInfo(src)) &&
              (totalUsedCapacity == 0) && (requiredCapacity < (mCapacity * 1.2))) {
@@ -2365,22 +2793,22 @@ void ExynosMPP::getPPCIndex(const struct exynos_image &src,
     scaleIndex = 0;
 
     /* Compare SBWC, AFBC and 10bitYUV420 first! because can be overlapped with other format */
-    if (isFormatSBWC(criteria.format) && hasPPC(mPhysicalType, PPC_FORMAT_SBWC, PPC_ROT_NO))
+    if (isFormatSBWC(criteria.format) && mHasPPCTable[PPC_FORMAT_SBWC][PPC_ROT_NO])
         formatIndex = PPC_FORMAT_SBWC;
     else if (src.compressed == 1) {
-        if ((isFormatRgb(criteria.format)) && hasPPC(mPhysicalType, PPC_FORMAT_AFBC_RGB, PPC_ROT_NO))
+        if ((isFormatRgb(criteria.format)) && mHasPPCTable[PPC_FORMAT_AFBC_RGB][PPC_ROT_NO])
             formatIndex = PPC_FORMAT_AFBC_RGB;
-        else if ((isFormatYUV(criteria.format)) && hasPPC(mPhysicalType, PPC_FORMAT_AFBC_YUV, PPC_ROT_NO))
+        else if ((isFormatYUV(criteria.format)) && mHasPPCTable[PPC_FORMAT_AFBC_YUV][PPC_ROT_NO])
             formatIndex = PPC_FORMAT_AFBC_YUV;
         else {
             formatIndex = PPC_FORMAT_RGB32;
             MPP_LOGW("%s:: AFBC PPC is not existed. Use default PPC", __func__);
         }
-    } else if (isFormatP010(criteria.format) && hasPPC(mPhysicalType, PPC_FORMAT_P010, PPC_ROT_NO))
+    } else if (isFormatP010(criteria.format) && mHasPPCTable[PPC_FORMAT_P010][PPC_ROT_NO])
         formatIndex = PPC_FORMAT_P010;
-    else if (isFormatYUV420(criteria.format) && hasPPC(mPhysicalType, PPC_FORMAT_YUV420, PPC_ROT_NO))
+    else if (isFormatYUV420(criteria.format) && mHasPPCTable[PPC_FORMAT_YUV420][PPC_ROT_NO])
         formatIndex = PPC_FORMAT_YUV420;
-    else if (isFormatYUV422(criteria.format) && hasPPC(mPhysicalType, PPC_FORMAT_YUV422, PPC_ROT_NO))
+    else if (isFormatYUV422(criteria.format) && mHasPPCTable[PPC_FORMAT_YUV422][PPC_ROT_NO])
         formatIndex = PPC_FORMAT_YUV422;
     else
         formatIndex = PPC_FORMAT_RGB32;
@@ -2419,28 +2847,72 @@ void ExynosMPP::getPPCIndex(const struct exynos_image &src,
     } else scaleIndex = 0; /* MSC doesn't refer scale Index */
 }
 
+void ExynosMPP::setupPPCTable()
+{
+    for (uint32_t formatIndex = 0; formatIndex < PPC_FORMAT_FORMAT_MAX; formatIndex++) {
+        for (uint32_t rotIndex = 0; rotIndex < PPC_ROT_MAX; rotIndex++) {
+            mHasPPCTable[formatIndex][rotIndex] = false;
+            if (mPhysicalType == MPP_G2D || mPhysicalType == MPP_MSC)
+                mHasPPCTable[formatIndex][rotIndex] =
+                    hasPPC(mPhysicalType, formatIndex, rotIndex);
+
+            for (uint32_t scaleIndex = 0; scaleIndex < PPC_SCALE_MAX; scaleIndex++) {
+                float PPC = 0;
+                if (mHasPPCTable[formatIndex][rotIndex])
+                    PPC = getPPCFromMap(formatIndex, rotIndex, scaleIndex);
+                mPPCTable[formatIndex][rotIndex][scaleIndex] = PPC;
+                /* Same fallback as getPPC() for an invalid PPC */
+                mCyclesPerPixelTable[formatIndex][rotIndex][scaleIndex] =
+                    1.0f / ((PPC == 0) ? 0.000001 : PPC);
+            }
+        }
+    }
+}
+
+float ExynosMPP::getPPCFromMap(uint32_t formatIndex, uint32_t rotIndex, uint32_t scaleIndex)
+{
+    if ((mPhysicalType == MPP_G2D || mPhysicalType == MPP_MSC) &&
+        hasPPC(mPhysicalType, formatIndex, rotIndex))
+        return ppc_table_map.at(PPC_IDX(mPhysicalType, formatIndex, rotIndex)).ppcList[scaleIndex];
+
+    return 0;
+}
+
+void ExynosMPP::getPPCTableIndex(const struct exynos_image &src,
+        const struct exynos_image &dst, const struct exynos_image &criteria,
+        const struct exynos_image *assignCheckSrc,
+        uint32_t &formatIndex, uint32_t &rotIndex, uint32_t &scaleIndex)
+{
+    getPPCIndex(src, dst, formatIndex, rotIndex, scaleIndex, criteria);
+
+    if ((rotIndex == PPC_ROT_NO) && (assignCheckSrc != NULL) &&
+        ((assignCheckSrc->transform & HAL_TRANSFORM_ROT_90) != 0)) {
+        rotIndex = PPC_ROT;
+    }
+}
+
 float ExynosMPP::getPPC(const struct exynos_image &src,
         const struct exynos_image &dst, const struct exynos_image &criteria,
         const struct exynos_image *assignCheckSrc,
-        const struct exynos_image *assignCheckDst)
+        const struct exynos_image __unused *assignCheckDst)
 {
     float PPC = 0;
     uint32_t formatIndex = 0;
     uint32_t rotIndex = 0;
     uint32_t scaleIndex = 0;
 
-    getPPCIndex(src, dst, formatIndex, rotIndex, scaleIndex, criteria);
+    getPPCTableIndex(src, dst, criteria, assignCheckSrc, formatIndex, rotIndex, scaleIndex);
 
-    if ((rotIndex == PPC_ROT_NO) && (assignCheckSrc != NULL) &&
-        ((assignCheckSrc->transform & HAL_TRANSFORM_ROT_90) != 0)) {
-        rotIndex = PPC_ROT;
-    }
+    PPC = mPPCTable[formatIndex][rotIndex][scaleIndex];
 
-    if (mPhysicalType == MPP_G2D || mPhysicalType == MPP_MSC) {
-        if (hasPPC(mPhysicalType, formatIndex, rotIndex)) {
-            PPC = ppc_table_map.at(PPC_IDX(mPhysicalType, formatIndex, rotIndex)).ppcList[scaleIndex];
-        }
+#if !defined(DISABLE_HWC_DEBUG)
+    if (hwcCheckDebugMessages(eDebugCapacity)) {
+        float mapPPC = getPPCFromMap(formatIndex, rotIndex, scaleIndex);
+        if (mapPPC != PPC)
+            MPP_LOGE("%s:: formatIndex(%d), rotIndex(%d), scaleIndex(%d), table PPC(%f) != map PPC(%f)",
+                    __func__, formatIndex, rotIndex, scaleIndex, PPC, mapPPC);
     }
+#endif
 
     if (PPC == 0) {
         MPP_LOGE("%s:: mPhysicalType(%d), formatIndex(%d), rotIndex(%d), scaleIndex(%d), PPC(%f) is not valid",
@@ -2455,6 +2927,24 @@ float ExynosMPP::getPPC(const struct exynos_image &src,
     return PPC;
 }
 
+float ExynosMPP::getCyclesPerPixel(const struct exynos_image &src,
+        const struct exynos_image &dst, const struct exynos_image &criteria,
+        const struct exynos_image *assignCheckSrc)
+{
+    uint32_t formatIndex = 0;
+    uint32_t rotIndex = 0;
+    uint32_t scaleIndex = 0;
+
+    getPPCTableIndex(src, dst, criteria, assignCheckSrc, formatIndex, rotIndex, scaleIndex);
+
+    /* Let getPPC() report an invalid PPC and do the debug cross-check */
+    if ((mPPCTable[formatIndex][rotIndex][scaleIndex] == 0) ||
+        hwcCheckDebugMessages(eDebugCapacity))
+        return 1.0f / getPPC(src, dst, criteria, assignCheckSrc);
+
+    return mCyclesPerPixelTable[formatIndex][rotIndex][scaleIndex];
+}
+
 float ExynosMPP::getAssignedCapacity()
 {
     float capacity = 0;
@@ -2521,6 +3011,146 @@ float ExynosMPP::getAssignedCapacity()
     return capacity;
 }
 
+/*
+ * Predict the workload of the coming frames from the workload of this frame.
+ * The peak of the recent frames covers layers updated at a lower rate than the
+ * display, a rising workload is extrapolated so that clocks are raised a frame early.
+ * The prediction is raised at once but lowered only after MPP_WORKLOAD_HOLD_FRAMES.
+ */
+float ExynosMPP::predictWorkload(float workload)
+{
+    WorkloadPrediction &prediction = mWorkloadPrediction;
+
+    if (workload > 0) {
+        if (workload > prediction.predicted * MPP_WORKLOAD_MARGIN)
+            prediction.underProvisioned++;
+        else if (prediction.predicted > workload * MPP_WORKLOAD_MARGIN * MPP_WORKLOAD_MARGIN)
+            prediction.overProvisioned++;
+    }
+
+    float prevWorkload = prediction.history[(prediction.index + MPP_WORKLOAD_HISTORY_NUM - 1) %
+        MPP_WORKLOAD_HISTORY_NUM];
+    prediction.history[prediction.index] = workload;
+    prediction.index = (prediction.index + 1) % MPP_WORKLOAD_HISTORY_NUM;
+
+    float target = workload;
+    for (uint32_t i = 0; i < MPP_WORKLOAD_HISTORY_NUM; i++)
+        target = max(target, prediction.history[i]);
+    if ((prevWorkload > 0) && (workload > prevWorkload))
+        target = max(target, workload * 2 - prevWorkload);
+    /* The MPP can't take more than its capacity */
+    if (mCapacity > 0)
+        target = min(target, max(workload, mCapacity));
+
+    if (target >= prediction.predicted) {
+        prediction.predicted = target;
+        prediction.holdFrames = 0;
+    } else if (++prediction.holdFrames >= MPP_WORKLOAD_HOLD_FRAMES) {
+        prediction.predicted = target;
+        prediction.holdFrames = 0;
+    }
+
+    MPP_LOGD(eDebugCapacity, "workload(%f), prev(%f), predicted(%f), hold(%d)",
+            workload, prevWorkload, prediction.predicted, prediction.holdFrames);
+
+    return prediction.predicted;
+}
+
+void ExynosMPP::updateUtilization(uint64_t pixels)
+{
+    mUtilization.frames.fetch_add(1, std::memory_order_relaxed);
+    mUtilization.pixels.fetch_add(pixels, std::memory_order_relaxed);
+
+    if ((mMPPType != MPP_TYPE_M2M) || (mCapacity <= 0))
+        return;
+
+    uint64_t permille = (uint64_t)(mUsedCapacity * 1000 / mCapacity);
+    mUtilization.capacityPermille.fetch_add(permille, std::memory_order_relaxed);
+    if (permille > mUtilization.peakCapacityPermille.load(std::memory_order_relaxed))
+        mUtilization.peakCapacityPermille.store(permille, std::memory_order_relaxed);
+}
+
+/*
+ * Acrylic only knows the laptime of blocking jobs, so the hardware time of
+ * a job is taken from the signal time of its target fence.
+ * One job is sampled at a time and never waited for.
+ */
+void ExynosMPP::sampleLaptime(int dstFence, bool blocking)
+{
+    collectLaptime();
+
+    if (blocking) {
+        /* Its laptime is already known */
+        uint64_t laptime = mAcrylicHandle->getLaptimeUSec();
+        if (laptime == 0)
+            return;
+        mUtilization.hwFrames.fetch_add(1, std::memory_order_relaxed);
+        mUtilization.hwTimeUs.fetch_add(laptime, std::memory_order_relaxed);
+        if (laptime > mUtilization.peakHwTimeUs.load(std::memory_order_relaxed))
+            mUtilization.peakHwTimeUs.store(laptime, std::memory_order_relaxed);
+        return;
+    }
+
+    if ((dstFence < 0) || (mLaptimeFence >= 0))
+        return;
+
+    mLaptimeFence = dup(dstFence);
+    mLaptimeSubmitTime = systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+void ExynosMPP::collectLaptime()
+{
+    if (mLaptimeFence < 0)
+        return;
+
+    int64_t signalTime = getFenceSignalTime(mLaptimeFence);
+    if (signalTime < 0)
+        return;
+
+    /* Queued jobs start when the previous one is done */
+    nsecs_t startTime = max(mLaptimeSubmitTime, mLastLaptimeSignalTime);
+    if (signalTime > startTime) {
+        uint64_t laptime = (signalTime - startTime) / 1000;
+        mUtilization.hwFrames.fetch_add(1, std::memory_order_relaxed);
+        mUtilization.hwTimeUs.fetch_add(laptime, std::memory_order_relaxed);
+        if (laptime > mUtilization.peakHwTimeUs.load(std::memory_order_relaxed))
+            mUtilization.peakHwTimeUs.store(laptime, std::memory_order_relaxed);
+    }
+    mLastLaptimeSignalTime = max(mLastLaptimeSignalTime, (nsecs_t)signalTime);
+
+    close(mLaptimeFence);
+    mLaptimeFence = -1;
+}
+
+/*
+ * Ratio of the laptime percentile measured by libacryl to the same percentile
+ * of the modeled capacity of the recent frames. The static cycle model is
+ * scaled by it to follow the real cost of the exynos composition.
+ */
+float ExynosMPP::getLaptimeCalibration()
+{
+    if ((mAcrylicHandle == NULL) || (mLaptimeCalibration.count < MPP_LAPTIME_HISTORY_NUM / 2))
+        return 1.0f;
+
+    unsigned int measuredUs = mAcrylicHandle->getLaptimePercentileUSec(MPP_LAPTIME_PERCENTILE);
+    if (measuredUs == 0)
+        return 1.0f;
+
+    float modeled[MPP_LAPTIME_HISTORY_NUM];
+    uint32_t count = mLaptimeCalibration.count;
+    memcpy(modeled, mLaptimeCalibration.modeled, sizeof(modeled[0]) * count);
+    uint32_t nth = (count - 1) * MPP_LAPTIME_PERCENTILE / 100;
+    std::nth_element(modeled, modeled + nth, modeled + count);
+    if (modeled[nth] <= 0)
+        return 1.0f;
+
+    float calibration = (measuredUs / 1000.0f) / modeled[nth];
+    MPP_LOGD(eDebugCapacity, "measured(%u us), modeled(%f ms), calibration(%f)",
+            measuredUs, modeled[nth], calibration);
+
+    return min(max(calibration, MPP_LAPTIME_CALIBRATION_MIN), MPP_LAPTIME_CALIBRATION_MAX);
+}
+
 float ExynosMPP::getRequiredCapacity(ExynosDisplay *display, struct exynos_image &src,
         struct exynos_image &dst)
 {
@@ -2568,19 +3198,21 @@ float ExynosMPP::getRequiredCapacity(ExynosDisplay *display, struct exynos_image
                 uint32_t assignedSrcResolution = mAssignedSources[i]->mSrcImg.w * mAssignedSources[i]->mSrcImg.h;
                 uint32_t assignedDstResolution = mAssignedSources[i]->mMidImg.w * mAssignedSources[i]->mMidImg.h;
                 uint32_t assignedMaxResolution = max(assignedSrcResolution, assignedDstResolution);
-                float assignedPPC = getPPC(mAssignedSources[i]->mSrcImg, mAssignedSources[i]->mMidImg,
-                        mAssignedSources[i]->mSrcImg, &src, &dst);
+                float assignedCyclesPerPixel = getCyclesPerPixel(mAssignedSources[i]->mSrcImg,
+                        mAssignedSources[i]->mMidImg, mAssignedSources[i]->mSrcImg, &src);
+                float assignedPPC = 1.0f / assignedCyclesPerPixel;
 
-                assignedSrcCycles = assignedMaxResolution/assignedPPC;
+                assignedSrcCycles = assignedMaxResolution * assignedCyclesPerPixel;
                 baseCycles += assignedSrcCycles;
 
                 MPP_LOGD(eDebugCapacity, "Src[%d] cycles: %f, total cycles: %f, PPC: %f, srcResolution: %d, dstResolution: %d, rot(%d)",
                         i, assignedSrcCycles, baseCycles, assignedPPC, assignedSrcResolution, assignedDstResolution, mAssignedSources[i]->mSrcImg.transform);
             }
 
-            PPC = getPPC(src, dst, src, &src, &dst);
+            float cyclesPerPixel = getCyclesPerPixel(src, dst, src, &src);
+            PPC = 1.0f / cyclesPerPixel;
 
-            srcCycles = maxResolution/PPC;
+            srcCycles = maxResolution * cyclesPerPixel;
             baseCycles += srcCycles;
 
             MPP_LOGD(eDebugCapacity, "check mppSource cycles: %f, total cycles: %f, PPC: %f, srcResolution: %d, dstResolution: %d, rot(%d)",
@@ -2596,10 +3228,10 @@ float ExynosMPP::getRequiredCapacity(ExynosDisplay *display, struct exynos_image
         capacity = mUsedCapacity;
 
         /* Just add capacity for current layer */
-        float srcPPC = getPPC(src, dst, src);
-        float dstPPC = getPPC(src, dst, dst);
-        float srcCapacity = (float((src.w * src.h))) / (mClockKhz * srcPPC);
-        float dstCapacity = (float((dst.w * dst.h))) / (mClockKhz * dstPPC);
+        float srcCyclesPerPixel = getCyclesPerPixel(src, dst, src);
+        float dstCyclesPerPixel = getCyclesPerPixel(src, dst, dst);
+        float srcCapacity = (float((src.w * src.h)) * srcCyclesPerPixel) / mClockKhz;
+        float dstCapacity = (float((dst.w * dst.h)) * dstCyclesPerPixel) / mClockKhz;
 
         capacity += max(srcCapacity, dstCapacity);
 
@@ -2617,7 +3249,7 @@ float ExynosMPP::getRequiredBaseCycles(struct exynos_image &src, struct exynos_i
     uint32_t dstResolution = dst.w * dst.h;
     uint32_t maxResolution = max(srcResolution, dstResolution);
 
-    return maxResolution/(float)getPPC(src, dst, src);
+    return maxResolution * getCyclesPerPixel(src, dst, src);
 }
 
 bool ExynosMPP::addCapacity(ExynosMPPSource* mppSource)
@@ -2786,7 +3418,7 @@ uint32_t ExynosMPP::getRestrictionClassification(const struct exynos_image &img)
 int ExynosMPP::prioritize(int priority)
 {
     if ((mPhysicalType != MPP_G2D) ||
-        (mAcrylicHandle == NULL)) {
+        (getAcrylicHandle() == NULL)) {
         MPP_LOGE("invalid function call");
         return -1;
     }
@@ -2805,47 +3437,184 @@ int ExynosMPP::prioritize(int priority)
 
 uint32_t ExynosMPP::increaseDstBuffIndex()
 {
-    if (mAllocOutBufFlag)
-        mCurrentDstBuf = (mCurrentDstBuf + 1) % NUM_MPP_DST_BUFS(mLogicalType);
+    if (mAllocOutBufFlag) {
+        if (mFreeOutBufFlag)
+            adaptDstBufNum();
+        mCurrentDstBuf = (mCurrentDstBuf + 1) % mDstBufNum;
+    }
     return mCurrentDstBuf;
 }
 
+/*
+ * The destination buffer is written again before the display released it,
+ * the job waits for its release fence.
+ */
+void ExynosMPP::checkDstStall(int dstAcquireFence)
+{
+    collectDstStall();
+
+    if (!fence_valid(dstAcquireFence) || (sync_wait(dstAcquireFence, 0) == 0))
+        return;
+
+    mDstRing.stalls++;
+    mDstRing.windowStalls++;
+    if (mDstRing.stallFence < 0) {
+        mDstRing.stallFence = dup(dstAcquireFence);
+        mDstRing.stallTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+}
+
+void ExynosMPP::collectDstStall()
+{
+    if (mDstRing.stallFence < 0)
+        return;
+
+    int64_t signalTime = getFenceSignalTime(mDstRing.stallFence);
+    if (signalTime < 0)
+        return;
+
+    if (signalTime > mDstRing.stallTime) {
+        uint64_t waitUs = (signalTime - mDstRing.stallTime) / 1000;
+        mDstRing.stallTimeUs += waitUs;
+        mDstRing.windowStallTimeUs += waitUs;
+    }
+    close(mDstRing.stallFence);
+    mDstRing.stallFence = -1;
+}
+
+/*
+ * Called once per frame before the ring moves on. A window that waited long
+ * for the display adds a slot, its buffer is taken from the pool when the
+ * ring reaches it. After windows without any stall the last slot is dropped
+ * when it is the next one, it holds the oldest frame then.
+ */
+void ExynosMPP::adaptDstBufNum()
+{
+    collectDstStall();
+
+    if (++mDstRing.windowFrames >= MPP_DST_RING_WINDOW_FRAMES) {
+        if (mDstRing.windowStallTimeUs >= MPP_DST_RING_GROW_WAIT_US) {
+            mDstRing.cleanWindows = 0;
+            mDstRing.shrinkPending = false;
+            if (mDstBufNum < NUM_MPP_DST_BUFS_MAX) {
+                mDstBufNum++;
+                mDstRing.grows++;
+                MPP_LOGD(eDebugBuf, "dst ring depth %d, waited %" PRIu64 " us for release",
+                        mDstBufNum, mDstRing.windowStallTimeUs);
+            }
+        } else if (mDstRing.windowStalls > 0) {
+            mDstRing.cleanWindows = 0;
+        } else if ((++mDstRing.cleanWindows >= MPP_DST_RING_SHRINK_WINDOWS) &&
+                   (mDstBufNum > NUM_MPP_DST_BUFS_MIN)) {
+            mDstRing.cleanWindows = 0;
+            mDstRing.shrinkPending = true;
+        }
+        mDstRing.windowFrames = 0;
+        mDstRing.windowStalls = 0;
+        mDstRing.windowStallTimeUs = 0;
+    }
+
+    if (mDstRing.shrinkPending && (mCurrentDstBuf == (int32_t)mDstBufNum - 2)) {
+        releaseDstBuf(mDstBufNum - 1);
+        mDstBufNum--;
+        mDstRing.shrinks++;
+        mDstRing.shrinkPending = false;
+        MPP_LOGD(eDebugBuf, "dst ring depth %d", mDstBufNum);
+    }
+}
+
+/* The buffer goes back to the pool once its fences are signaled */
+void ExynosMPP::releaseDstBuf(uint32_t index)
+{
+    exynos_mpp_img_info freeDstBuf = mDstImgs[index];
+    memset(&mDstImgs[index], 0, sizeof(mDstImgs[index]));
+    mDstImgs[index].acrylicAcquireFenceFd = -1;
+    mDstImgs[index].acrylicReleaseFenceFd = -1;
+    mDstContents[index].valid = false;
+
+    if (freeDstBuf.bufferHandle != NULL) {
+        freeOutBuf(freeDstBuf);
+    } else if (mAssignedDisplay != NULL) {
+        fence_close(freeDstBuf.acrylicAcquireFenceFd, mAssignedDisplay,
+                FENCE_TYPE_DST_ACQUIRE, FENCE_IP_G2D);
+        fence_close(freeDstBuf.acrylicReleaseFenceFd, mAssignedDisplay,
+                FENCE_TYPE_DST_RELEASE, FENCE_IP_G2D);
+    }
+}
+
+uint64_t ExynosMPP::getDstBufMemSize()
+{
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < mDstBufNum; i++) {
+        if (mDstImgs[i].bufferHandle != NULL)
+            size += (uint64_t)mDstImgs[i].allocWidth * mDstImgs[i].allocHeight *
+                formatToBpp(mDstImgs[i].allocFormat) / 8;
+    }
+    return size;
+}
+
+Acrylic *ExynosMPP::getAcrylicHandle()
+{
+    if ((mAcrylicHandle != NULL) || (mAcrylicSpec == NULL))
+        return mAcrylicHandle;
+
+    ATRACE_CALL();
+    mAcrylicHandle = AcrylicFactory::createAcrylic(mAcrylicSpec);
+    if (mAcrylicHandle == NULL) {
+        MPP_LOGE("Fail to allocate acrylic handle");
+        return NULL;
+    }
+    MPP_LOGI("mAcrylicHandle is created: %p", mAcrylicHandle);
+
+    if (mNeedSolidColorLayer)
+        mAcrylicHandle->setDefaultColor(0, 0, 0, 0);
+    /* Apply the target display that was set before the handle existed */
+    if (mTargetLuminance.set)
+        mAcrylicHandle->setTargetDisplayLuminance(mTargetLuminance.min, mTargetLuminance.max);
+    if (mTargetDevice.set)
+        mAcrylicHandle->setTargetDisplayInfo(&mTargetDevice.device);
+
+    return mAcrylicHandle;
+}
+
 void ExynosMPP::reloadResourceForHWFC()
 {
     ALOGI("reloadResourceForHWFC()");
+    resetSupportedCache();
     delete mAcrylicHandle;
-    mAcrylicHandle = AcrylicFactory::createAcrylic("default_compositor");
-    if (mAcrylicHandle == NULL) {
+    mAcrylicHandle = NULL;
+    mAcrylicSpec = "default_compositor";
+    mNeedSolidColorLayer = true;
+    mTargetLuminance.set = false;
+    mTargetDevice.set = false;
+    if (getAcrylicHandle() == NULL) {
         MPP_LOGE("Fail to allocate compositor");
     } else {
-        mAcrylicHandle->setDefaultColor(0, 0, 0, 0);
         MPP_LOGI("The resource is reloaded for HWFC: %p", mAcrylicHandle);
     }
     for (uint32_t i = 0; i < NUM_MPP_SRC_BUFS; i++)
-    {
-        if (mSrcImgs[i].mppLayer != NULL) {
-            delete mSrcImgs[i].mppLayer;
-            mSrcImgs[i].mppLayer = NULL;
-        }
-    }
+        releaseSrcLayer(mSrcImgs[i]);
 }
 
 void ExynosMPP::setTargetDisplayLuminance(uint16_t min, uint16_t max)
 {
     MPP_LOGD(eDebugMPP, "%s: min(%d), max(%d)", __func__, min, max);
-    if (mAcrylicHandle == NULL) {
-        MPP_LOGE("mAcrylicHandle is NULL");
-    } else
+    resetSupportedCache();
+    mTargetLuminance.min = min;
+    mTargetLuminance.max = max;
+    mTargetLuminance.set = true;
+    if (mAcrylicHandle != NULL)
         mAcrylicHandle->setTargetDisplayLuminance(min, max);
 }
 
 void ExynosMPP::setTargetDisplayDevice(int device)
 {
     ALOGI("%s: device(%d)", __func__, device);
-    if (mAcrylicHandle == NULL) {
-        MPP_LOGE("mAcrylicHandle is NULL");
-    } else
-        mAcrylicHandle->setTargetDisplayInfo(&device);
+    resetSupportedCache();
+    mTargetDevice.device = device;
+    mTargetDevice.set = true;
+    if (mAcrylicHandle != NULL)
+        mAcrylicHandle->setTargetDisplayInfo(&mTargetDevice.device);
 }
 
 void ExynosMPP::dump(String8& result)
@@ -2862,7 +3631,39 @@ void ExynosMPP::dump(String8& result)
             mPrevAssignedState, mPrevAssignedDisplayType, mReservedDisplay);
     result.appendFormat("\tassinedSourceNum(%zu), Capacity(%f), CapaUsed(%f), mCurrentDstBuf(%d)\n",
             mAssignedSources.size(), mCapacity, mUsedCapacity, mCurrentDstBuf);
-
+    if (mMPPType == MPP_TYPE_M2M) {
+        uint64_t total = mDstContentHit + mDstContentMiss;
+        result.appendFormat("\tOutput reuse hit(%" PRIu64 ") / %" PRIu64 " (%.1f%%), "
+                "saved %.1f ms\n", mDstContentHit, total,
+                total ? mDstContentHit * 100.0f / total : 0.0f, mDstContentSavedTime);
+        result.appendFormat("\tDst ring depth(%d) [%d - %d], held(%" PRIu64 " KB), stalls(%" PRIu64
+                "), stall time(%" PRIu64 " us), grows(%" PRIu64 "), shrinks(%" PRIu64 ")\n",
+                mDstBufNum, NUM_MPP_DST_BUFS_MIN, NUM_MPP_DST_BUFS_MAX, getDstBufMemSize() / 1024,
+                mDstRing.stalls, mDstRing.stallTimeUs, mDstRing.grows, mDstRing.shrinks);
+    }
+    {
+        uint64_t frames = mUtilization.frames.load(std::memory_order_relaxed);
+        uint64_t hwFrames = mUtilization.hwFrames.load(std::memory_order_relaxed);
+        uint64_t hwTimeUs = mUtilization.hwTimeUs.load(std::memory_order_relaxed);
+        result.appendFormat("\tUtilization frames(%" PRIu64 "), pixels(%" PRIu64 ")",
+                frames, mUtilization.pixels.load(std::memory_order_relaxed));
+        if (mMPPType == MPP_TYPE_M2M) {
+            uint64_t capacity = mUtilization.capacityPermille.load(std::memory_order_relaxed);
+            result.appendFormat(", capacity avg(%.1f%%) peak(%.1f%%), hw time avg(%" PRIu64
+                    " us) peak(%" PRIu64 " us), capacity fallbacks(%" PRIu64 ")",
+                    frames ? capacity / 10.0f / frames : 0.0f,
+                    mUtilization.peakCapacityPermille.load(std::memory_order_relaxed) / 10.0f,
+                    hwFrames ? hwTimeUs / hwFrames : 0,
+                    mUtilization.peakHwTimeUs.load(std::memory_order_relaxed),
+                    mUtilization.capacityFallbacks.load(std::memory_order_relaxed));
+        }
+        result.appendFormat("\n");
+    }
+    if (mMPPType == MPP_TYPE_M2M)
+        result.appendFormat("\tWorkload predicted(%f), under-provisioned(%" PRIu64
+                "), over-provisioned(%" PRIu64 ")\n",
+                mWorkloadPrediction.predicted, mWorkloadPrediction.underProvisioned,
+                mWorkloadPrediction.overProvisioned);
 }
 
 void ExynosMPP::closeFences()
@@ -2892,6 +3693,8 @@ void ExynosMPP::updateAttr()
 
     if (mResourceManager == NULL) return;
 
+    resetSupportedCache();
+
     auto iter = mResourceManager->mMPPAttrs.find(mPhysicalType);
     if (iter != mResourceManager->mMPPAttrs.end()) {
         mAttr = iter->second;
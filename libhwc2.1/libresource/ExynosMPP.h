@@ -28,7 +28,12 @@
 #include <utils/StrongPointer.h>
 #include <utils/List.h>
 #include <utils/Vector.h>
+#include <utils/Timers.h>
+#include <atomic>
+#include <list>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <hardware/exynos/acryl.h>
 #include <map>
 #include "ExynosHWCModule.h"
@@ -48,6 +53,17 @@ class ExynosResourceManager;
 #define NUM_MPP_DST_BUFS(type) (3)
 #endif
 
+/*
+ * Bounds of the destination buffer ring. It starts at NUM_MPP_DST_BUFS(type)
+ * and follows the stalls on the release fences of the display.
+ */
+#ifndef NUM_MPP_DST_BUFS_MIN
+#define NUM_MPP_DST_BUFS_MIN 2
+#endif
+#ifndef NUM_MPP_DST_BUFS_MAX
+#define NUM_MPP_DST_BUFS_MAX 5
+#endif
+
 #ifndef G2D_MAX_SRC_NUM
 #define G2D_MAX_SRC_NUM 15
 #endif
@@ -120,6 +136,42 @@ class ExynosResourceManager;
 /* Currently allowed capacity percentage is over 10% */
 #define MPP_CAPA_OVER_THRESHOLD 1.1
 
+/* Fences of freed buffers and HW state are waited for at most this long */
+#define MPP_FREE_BUF_FENCE_TIMEOUT_MS   1000
+#define MPP_STATE_FENCE_TIMEOUT_MS      5000
+
+/* Frames of workload history used to predict the next performance request */
+#ifndef MPP_WORKLOAD_HISTORY_NUM
+#define MPP_WORKLOAD_HISTORY_NUM    4
+#endif
+/* Frames the predicted workload is held before it is lowered */
+#ifndef MPP_WORKLOAD_HOLD_FRAMES
+#define MPP_WORKLOAD_HOLD_FRAMES    4
+#endif
+/* Workload above the prediction by this factor is counted as under-provisioned */
+#define MPP_WORKLOAD_MARGIN     1.1
+
+/* G2D frames whose modeled capacity is compared with the laptimes measured by libacryl */
+#ifndef MPP_LAPTIME_HISTORY_NUM
+#define MPP_LAPTIME_HISTORY_NUM     32
+#endif
+/* Frames of a destination ring window, the ring depth is changed once per window */
+#ifndef MPP_DST_RING_WINDOW_FRAMES
+#define MPP_DST_RING_WINDOW_FRAMES  60
+#endif
+/* Time waited for the release of destination buffers in a window to deepen the ring */
+#define MPP_DST_RING_GROW_WAIT_US   2000
+/* Windows without any stall before the ring is made shallower */
+#define MPP_DST_RING_SHRINK_WINDOWS 4
+
+/* Percentile of the recent laptimes that the frame budget should accommodate */
+#ifndef MPP_LAPTIME_PERCENTILE
+#define MPP_LAPTIME_PERCENTILE      90
+#endif
+/* Bounds of the measured to modeled capacity ratio */
+#define MPP_LAPTIME_CALIBRATION_MIN 0.5f
+#define MPP_LAPTIME_CALIBRATION_MAX 2.0f
+
 #ifndef MPP_G2D_SRC_SCALED_WEIGHT
 #define MPP_G2D_SRC_SCALED_WEIGHT   1.125
 #endif
@@ -168,6 +220,16 @@ enum {
     eMPPUnsupportedDynamicMeta    =     1ULL << 32,
 };
 
+/* Number of eMPP bits above, index of the fallback counters */
+#define MPP_UNSUPPORTED_REASON_NUM 33
+
+/* Content type of the fallback counters */
+enum {
+    FALLBACK_CONTENT_RGB,
+    FALLBACK_CONTENT_VIDEO,
+    FALLBACK_CONTENT_NUM
+};
+
 enum {
     MPP_TYPE_NONE,
     MPP_TYPE_OTF,
@@ -226,14 +288,40 @@ typedef enum {
 #define DEFAULT_MPP_DST_UNCOMP_YUV_FORMAT HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN
 #endif
 
+/* Values that were last set to the AcrylicLayer of a source slot */
+typedef struct exynos_mpp_layer_config {
+    bool valid;
+    uint32_t fullWidth;
+    uint32_t fullHeight;
+    uint32_t format;
+    android_dataspace_t dataspace;
+    uint32_t blending;
+    uint8_t planeAlpha;
+    uint32_t zOrder;
+    hwc_rect_t srcRect;
+    hwc_rect_t dstRect;
+    uint32_t transform;
+    uint32_t attr;
+} exynos_mpp_layer_config_t;
+
+class ExynosMPPSource;
+
 typedef struct exynos_mpp_img_info {
     buffer_handle_t bufferHandle;
     uint32_t bufferType;
     uint32_t format;
     android_dataspace_t dataspace;
     AcrylicLayer *mppLayer;
+    /* Source that owns mppLayer, mppLayer follows it between slots */
+    ExynosMPPSource *mppSource;
+    exynos_mpp_layer_config_t layerConfig;
     int acrylicAcquireFenceFd;
     int acrylicReleaseFenceFd;
+    /* Set by allocOutBuf() so the buffer can go back to the shared pool */
+    uint32_t allocWidth;
+    uint32_t allocHeight;
+    uint32_t allocFormat;
+    uint64_t allocUsage;
 } exynos_mpp_img_info_t;
 
 typedef enum {
@@ -430,6 +518,77 @@ const std::map<uint32_t, int32_t> dataspace_transfer_map =
 
 void dumpExynosMPPImgInfo(uint32_t type, exynos_mpp_img_info &imgInfo);
 
+#ifndef MPP_SUPPORTED_CACHE_SIZE
+#define MPP_SUPPORTED_CACHE_SIZE 64
+#endif
+
+/* Fields of exynos_image that are checked by ExynosMPP::isSupported() */
+typedef struct mpp_supported_image {
+    uint32_t fullWidth = 0;
+    uint32_t fullHeight = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t w = 0;
+    uint32_t h = 0;
+    uint32_t format = 0;
+    uint64_t usageFlags = 0;
+    uint32_t layerFlags = 0;
+    android_dataspace dataSpace = HAL_DATASPACE_UNKNOWN;
+    uint32_t blending = 0;
+    uint32_t transform = 0;
+    uint32_t compressed = 0;
+    ExynosVideoInfoType metaType = VIDEO_INFO_TYPE_INVALID;
+    bool needColorTransform = false;
+
+    mpp_supported_image() = default;
+    mpp_supported_image(const exynos_image &img)
+          : fullWidth(img.fullWidth),
+            fullHeight(img.fullHeight),
+            x(img.x),
+            y(img.y),
+            w(img.w),
+            h(img.h),
+            format(img.format),
+            usageFlags(img.usageFlags),
+            layerFlags(img.layerFlags),
+            dataSpace(img.dataSpace),
+            blending(img.blending),
+            transform(img.transform),
+            compressed(img.compressed),
+            metaType(img.metaType),
+            needColorTransform(img.needColorTransform) {}
+
+    bool operator==(const mpp_supported_image &rhs) const {
+        return (fullWidth == rhs.fullWidth) && (fullHeight == rhs.fullHeight) && (x == rhs.x) &&
+                (y == rhs.y) && (w == rhs.w) && (h == rhs.h) && (format == rhs.format) &&
+                (usageFlags == rhs.usageFlags) && (layerFlags == rhs.layerFlags) &&
+                (dataSpace == rhs.dataSpace) && (blending == rhs.blending) &&
+                (transform == rhs.transform) && (compressed == rhs.compressed) &&
+                (metaType == rhs.metaType) && (needColorTransform == rhs.needColorTransform);
+    }
+} mpp_supported_image_t;
+
+/* Key of the result cache of ExynosMPP::isSupported() */
+typedef struct mpp_supported_key {
+    int32_t displayId = -1;
+    uint32_t displayYres = 0;
+    uint32_t btsRefreshRate = 0;
+    bool hasHdrLayer = false;
+    bool hasDrmLayer = false;
+    mpp_supported_image_t src;
+    mpp_supported_image_t dst;
+
+    bool operator==(const mpp_supported_key &rhs) const {
+        return (displayId == rhs.displayId) && (displayYres == rhs.displayYres) &&
+                (btsRefreshRate == rhs.btsRefreshRate) && (hasHdrLayer == rhs.hasHdrLayer) &&
+                (hasDrmLayer == rhs.hasDrmLayer) && (src == rhs.src) && (dst == rhs.dst);
+    }
+} mpp_supported_key_t;
+
+struct MPPSupportedKeyHash {
+    size_t operator()(const mpp_supported_key_t &key) const;
+};
+
 struct ExynosMPPFrameInfo
 {
     uint32_t srcNum;
@@ -437,6 +596,17 @@ struct ExynosMPPFrameInfo
     exynos_image dstInfo[NUM_MPP_SRC_BUFS];
 };
 
+/* Frame held by an M2M destination buffer, see ExynosMPP::findDstContent() */
+struct ExynosMPPDstContent
+{
+    bool valid;
+    ExynosMPPFrameInfo frameInfo;
+    /* ExynosLayer::mBufferGeneration of each source */
+    uint64_t generation[NUM_MPP_SRC_BUFS];
+    /* Estimated processing time of the frame in ms */
+    float processTime;
+};
+
 class ExynosMPPSource {
     public:
         ExynosMPPSource();
@@ -461,13 +631,28 @@ class ExynosMPP {
 private:
     class ResourceManageThread: public Thread {
         private:
+            struct FreedBuffer {
+                exynos_mpp_img_info info;
+                nsecs_t queuedTime;
+            };
+            struct StateFence {
+                int fence;
+                nsecs_t queuedTime;
+            };
             ExynosMPP *mExynosMPP;
-            Condition mCondition;
-            List<exynos_mpp_img_info > mFreedBuffers;
-            List<int> mStateFences;
-
-            void freeBuffers();
-            bool checkStateFences();
+            std::list<FreedBuffer> mFreedBuffers;
+            std::list<StateFence> mStateFences;
+            bool mStateFenceError;
+            /* Pending fences and mWakeFd are watched by mEpollFd, see threadLoop() */
+            int mEpollFd;
+            int mWakeFd;
+
+            void watchFence(int fence);
+            int closeFence(int fence, hwc_fdebug_fence_type type);
+            int getWaitTimeoutMs(nsecs_t now) const;
+            void collectFreedBuffers(nsecs_t now, std::vector<exynos_mpp_img_info> &doneBuffers);
+            void freeBuffers(std::vector<exynos_mpp_img_info> &doneBuffers);
+            void checkStateFences(nsecs_t now);
         public:
             bool mRunning;
             Mutex mMutex;
@@ -476,6 +661,7 @@ private:
             virtual bool threadLoop();
             void addFreedBuffer(exynos_mpp_img_info freedBuffer);
             void addStateFence(int fence);
+            void wake();
     };
 
 public:
@@ -511,6 +697,12 @@ public:
     int32_t mPrevAssignedDisplayType;
     int32_t mReservedDisplay;
 
+    /*
+     * Color data hash of the layer whose DPP settings were committed last on
+     * this channel (otfMPP only), see ExynosLayer::getColorDataHash()
+     */
+    size_t mResidentColorHash = 0;
+
     android::sp<ResourceManageThread> mResourceManageThread;
     float mCapacity;
     float mUsedCapacity;
@@ -528,19 +720,81 @@ public:
     bool mHWBusyFlag;
     /* For reuse previous frame */
     ExynosMPPFrameInfo mPrevFrameInfo;
+    /* For reuse of any destination buffer that still holds the frame */
+    ExynosMPPDstContent mDstContents[NUM_MPP_DST_BUFS_MAX] = {};
+    uint64_t mDstContentHit = 0;
+    uint64_t mDstContentMiss = 0;
+    float mDstContentSavedTime = 0;
+    /*
+     * Layers composed by the client because this MPP didn't support them,
+     * counted per content type and eMPP reason bit in every frame
+     */
+    std::atomic<uint64_t> mFallbackLayers[FALLBACK_CONTENT_NUM][MPP_UNSUPPORTED_REASON_NUM] = {};
+    std::atomic<uint64_t> mFallbackPixels[FALLBACK_CONTENT_NUM][MPP_UNSUPPORTED_REASON_NUM] = {};
+    /* Rolling utilization counters, consumers take the difference of two reads */
+    struct UtilizationStats {
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> pixels{0};
+        /* Used capacity in permille of mCapacity (M2M only) */
+        std::atomic<uint64_t> capacityPermille{0};
+        std::atomic<uint64_t> peakCapacityPermille{0};
+        /* Hardware time of the frames whose completion was observed (M2M only) */
+        std::atomic<uint64_t> hwFrames{0};
+        std::atomic<uint64_t> hwTimeUs{0};
+        std::atomic<uint64_t> peakHwTimeUs{0};
+        /* Frames where a layer fell back because of hasEnoughCapa() (M2M only) */
+        std::atomic<uint64_t> capacityFallbacks{0};
+    } mUtilization;
+    /* Target fence of the last sampled job, its hardware time is taken once signaled */
+    int mLaptimeFence = -1;
+    nsecs_t mLaptimeSubmitTime = 0;
+    nsecs_t mLastLaptimeSignalTime = 0;
     struct exynos_mpp_img_info mSrcImgs[NUM_MPP_SRC_BUFS];
-    struct exynos_mpp_img_info mDstImgs[NUM_MPP_DST_BUFS_DEFAULT];
+    struct exynos_mpp_img_info mDstImgs[NUM_MPP_DST_BUFS_MAX];
+    /* Depth of the mDstImgs ring, mDstImgs beyond it hold no buffer */
+    uint32_t mDstBufNum;
+    struct DstRingStats {
+        /* Jobs whose destination buffer was not released by the display yet */
+        uint64_t stalls = 0;
+        uint64_t stallTimeUs = 0;
+        uint64_t grows = 0;
+        uint64_t shrinks = 0;
+        uint32_t windowFrames = 0;
+        uint32_t windowStalls = 0;
+        uint64_t windowStallTimeUs = 0;
+        uint32_t cleanWindows = 0;
+        bool shrinkPending = false;
+        /* Release fence of the last stall, its wait is taken once signaled */
+        int stallFence = -1;
+        nsecs_t stallTime = 0;
+    } mDstRing;
     int32_t mCurrentDstBuf;
     int32_t mPrivDstBuf;
     bool mNeedCompressedTarget;
+    /* The composition target is compressed for the OTF MPP in this frame */
+    bool mCompressDst = false;
     struct restriction_size mSrcSizeRestrictions[RESTRICTION_MAX];
     struct restriction_size mDstSizeRestrictions[RESTRICTION_MAX];
+    /* Formats of mResourceManager->mFormatRestrictions for this MPP, built by setupRestriction() */
+    std::unordered_set<uint32_t> mSrcFormats;
+    std::unordered_set<uint32_t> mDstFormats;
 
     // Force Dst buffer reallocation
     dst_alloc_buf_size_t mDstAllocatedSize;
 
-    /* For libacryl */
+    /* For libacryl, created on demand by getAcrylicHandle() */
     Acrylic *mAcrylicHandle;
+    const char *mAcrylicSpec;
+    /* Target display of the virtual display, kept until mAcrylicHandle is created */
+    struct {
+        bool set = false;
+        uint16_t min = 0;
+        uint16_t max = 0;
+    } mTargetLuminance;
+    struct {
+        bool set = false;
+        int device = 0;
+    } mTargetDevice;
 
     bool mUseM2MSrcFence;
     /* MPP's attribute bit (supported feature bit) */
@@ -548,6 +802,23 @@ public:
 
     bool mNeedSolidColorLayer;
 
+    /* Workload from getAssignedCapacity() of recent frames, see predictWorkload() */
+    struct WorkloadPrediction {
+        float history[MPP_WORKLOAD_HISTORY_NUM] = {};
+        uint32_t index = 0;
+        float predicted = 0;
+        uint32_t holdFrames = 0;
+        uint64_t underProvisioned = 0;
+        uint64_t overProvisioned = 0;
+    } mWorkloadPrediction;
+
+    /* Capacity modeled by getRequiredCapacity() for the recent G2D frames */
+    struct LaptimeCalibration {
+        float modeled[MPP_LAPTIME_HISTORY_NUM] = {};
+        uint32_t index = 0;
+        uint32_t count = 0;
+    } mLaptimeCalibration;
+
     ExynosMPP(ExynosResourceManager* resourceManager,
             uint32_t physicalType, uint32_t logicalType, const char *name,
             uint32_t physicalIndex, uint32_t logicalIndex, uint32_t preAssignInfo);
@@ -567,6 +838,8 @@ public:
     int32_t requestHWStateChange(uint32_t state);
     int32_t setHWStateFence(int32_t fence);
     virtual int64_t isSupported(ExynosDisplay &display, struct exynos_image &src, struct exynos_image &dst);
+    /* Also drops the results of the resource manager that depend on the restrictions */
+    void resetSupportedCache();
 
     bool isDataspaceSupportedByMPP(struct exynos_image &src, struct exynos_image &dst);
     bool isSupportedHDR10Plus(struct exynos_image &src, struct exynos_image &dst);
@@ -653,6 +926,8 @@ public:
 
     void closeFences();
 
+    /* Creates mAcrylicHandle when it is called first, NULL for OTF MPPs */
+    Acrylic *getAcrylicHandle();
     void reloadResourceForHWFC();
     void setTargetDisplayLuminance(uint16_t min, uint16_t max);
     void setTargetDisplayDevice(int device);
@@ -661,9 +936,25 @@ public:
     void updateAttr();
     dstMetaInfo getDstMetaInfo(android_dataspace_t dstDataspace);
     float getAssignedCapacity();
-
-    void setPPC(float ppc) { mPPC = ppc; };
-    void setClockKhz(uint32_t clock) { mClockKhz = clock; };
+    float predictWorkload(float workload);
+    void updateUtilization(uint64_t pixels);
+    void sampleLaptime(int dstFence, bool blocking);
+    void collectLaptime();
+    void checkDstStall(int dstAcquireFence);
+    void collectDstStall();
+    void adaptDstBufNum();
+    void releaseDstBuf(uint32_t index);
+    uint64_t getDstBufMemSize();
+    float getLaptimeCalibration();
+
+    void setPPC(float ppc) {
+        mPPC = ppc;
+        resetSupportedCache();
+    };
+    void setClockKhz(uint32_t clock) {
+        mClockKhz = clock;
+        resetSupportedCache();
+    };
 
 protected:
     uint32_t getBufferType(uint64_t usage);
@@ -672,8 +963,15 @@ protected:
     bool needCompressDstBuf() const;
     bool needDstBufRealloc(struct exynos_image &dst, uint32_t index);
     bool canUsePrevFrame();
+    bool isSameSourceImage(const exynos_image &prevSrc, const exynos_image &prevDst,
+            const ExynosMPPSource &source) const;
+    bool getSourceGenerations(uint64_t *generation) const;
+    int32_t findDstContent(struct exynos_image &dst);
+    void saveDstContent(uint32_t index);
     int32_t setupDst(exynos_mpp_img_info *dstImgInfo);
     virtual int32_t doPostProcessingInternal();
+    void mapSrcImgsToSources();
+    void releaseSrcLayer(exynos_mpp_img_info &srcImgInfo);
     virtual int32_t setupLayer(exynos_mpp_img_info *srcImgInfo,
             struct exynos_image &src, struct exynos_image &dst);
     virtual int32_t setColorConversionInfo() { return NO_ERROR; };
@@ -696,6 +994,21 @@ protected:
             uint32_t &formatIndex, uint32_t &rotIndex, uint32_t &scaleIndex,
             const struct exynos_image &criteria);
 
+    /*
+     * Fill mPPCTable and mCyclesPerPixelTable from ppc_table_map.
+     * Called from setupRestriction() so capacity checks don't search the map.
+     */
+    void setupPPCTable();
+    void getPPCTableIndex(const struct exynos_image &src, const struct exynos_image &dst,
+            const struct exynos_image &criteria, const struct exynos_image *assignCheckSrc,
+            uint32_t &formatIndex, uint32_t &rotIndex, uint32_t &scaleIndex);
+    /* Reciprocal of getPPC(), so cycles are resolution * cyclesPerPixel */
+    float getCyclesPerPixel(const struct exynos_image &src, const struct exynos_image &dst,
+            const struct exynos_image &criteria,
+            const struct exynos_image *assignCheckSrc = NULL);
+    /* Original ppc_table_map lookup, used to cross-check the table in debug builds */
+    float getPPCFromMap(uint32_t formatIndex, uint32_t rotIndex, uint32_t scaleIndex);
+
     float getRequiredBaseCycles(struct exynos_image &src, struct exynos_image &dst);
     bool addCapacity(ExynosMPPSource* mppSource);
     bool removeCapacity(ExynosMPPSource* mppSource);
@@ -704,9 +1017,25 @@ protected:
      * This function checks additional restriction for color space conversion
      */
     virtual bool checkCSCRestriction(struct exynos_image &src, struct exynos_image &dst);
+    int64_t isSupportedInternal(ExynosDisplay &display, struct exynos_image &src,
+                                struct exynos_image &dst);
 
     uint32_t mClockKhz = 0;
     float mPPC = 0;
+
+    /*
+     * PPC of this MPP indexed by format, rotation and scale index.
+     * 0 means that ppc_table_map has no PPC for the index.
+     */
+    float mPPCTable[PPC_FORMAT_FORMAT_MAX][PPC_ROT_MAX][PPC_SCALE_MAX] = {};
+    float mCyclesPerPixelTable[PPC_FORMAT_FORMAT_MAX][PPC_ROT_MAX][PPC_SCALE_MAX] = {};
+    bool mHasPPCTable[PPC_FORMAT_FORMAT_MAX][PPC_ROT_MAX] = {};
+
+    /*
+     * Result of isSupported() for each input.
+     * This should be reset when restriction or attribute of the MPP is changed.
+     */
+    std::unordered_map<mpp_supported_key_t, int64_t, MPPSupportedKeyHash> mSupportedCache;
 };
 
 #endif //_EXYNOSMPP_H
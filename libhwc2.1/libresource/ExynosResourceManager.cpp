@@ -23,17 +23,20 @@
 
 #include <cutils/properties.h>
 
+#include <algorithm>
 #include <numeric>
 #include <unordered_set>
 
 #include "ExynosDeviceInterface.h"
 #include "ExynosExternalDisplay.h"
 #include "ExynosHWCDebug.h"
+#include "ExynosHWCTrace.h"
 #include "ExynosLayer.h"
 #include "ExynosMPPModule.h"
 #include "ExynosPrimaryDisplayModule.h"
 #include "ExynosVirtualDisplay.h"
 #include "hardware/exynos/acryl.h"
+#include "threadpolicy.h"
 
 using namespace std::chrono_literals;
 constexpr float msecsPerSec = std::chrono::milliseconds(1s).count();
@@ -90,6 +93,25 @@ ExynosMPPVector ExynosResourceManager::mOtfMPPs;
 ExynosMPPVector ExynosResourceManager::mM2mMPPs;
 extern struct exynos_hwc_control exynosHWCControl;
 
+/* Indexed by the bit position of the eMPP flags in ExynosMPP.h */
+static const char *getMPPUnsupportedReasonStr(uint32_t reason)
+{
+    static const char *reasonStr[MPP_UNSUPPORTED_REASON_NUM] = {
+        "SaveCapability", "StrideCrop", "UnsupportedRotation", "HWBusy",
+        "ExeedSrcCropMax", "UnsupportedColorTransform", "UnsupportedBlending",
+        "UnsupportedFormat", "NotAlignedDstSize", "NotAlignedSrcCropPosition",
+        "NotAlignedHStride", "NotAlignedVStride", "ExceedHStrideMaximum",
+        "ExceedVStrideMaximum", "ExeedMaxDownScale", "ExeedMaxDstWidth",
+        "ExeedMaxDstHeight", "ExeedMinSrcWidth", "ExeedMinSrcHeight",
+        "ExeedMaxUpScale", "ExeedSrcWCropMax", "ExeedSrcHCropMax",
+        "ExeedSrcWCropMin", "ExeedSrcHCropMin", "NotAlignedCrop",
+        "NotAlignedOffset", "ExeedMinDstWidth", "ExeedMinDstHeight",
+        "UnsupportedCompression", "UnsupportedCSC", "UnsupportedDIMLayer",
+        "UnsupportedDRM", "UnsupportedDynamicMeta",
+    };
+    return (reason < MPP_UNSUPPORTED_REASON_NUM) ? reasonStr[reason] : "Unknown";
+}
+
 ExynosMPPVector::ExynosMPPVector() {
 }
 
@@ -147,6 +169,8 @@ ExynosResourceManager::ExynosResourceManager(ExynosDevice *device)
     hasDrmLayer(false),
     mFormatRestrictionCnt(0),
     mDstBufMgrThread(sp<DstBufMgrThread>::make(this)),
+    mCompositionPlanHit(0),
+    mCompositionPlanMiss(0),
     mResourceReserved(0x0)
 {
 
@@ -154,6 +178,21 @@ ExynosResourceManager::ExynosResourceManager(ExynosDevice *device)
     memset(mFormatRestrictions, 0, sizeof(mFormatRestrictions));
     memset(mSizeRestrictions, 0, sizeof(mSizeRestrictions));
 
+    mAssignSearchEnabled = property_get_bool("vendor.display.assign_search.enabled", false);
+    mAssignSearchMaxTry = property_get_int32("vendor.display.assign_search.max_try",
+                                             ASSIGN_SEARCH_MAX_TRY);
+    mBandwidthLimitKBps = property_get_int64("vendor.display.bw.limit_kbps", 0);
+    mBandwidthNearLimitPercent = property_get_int32("vendor.display.bw.near_limit_percent",
+                                                    BANDWIDTH_NEAR_LIMIT_PERCENT);
+    mCompressM2mDst = property_get_bool("vendor.display.m2m.compressed_dst", true);
+    mM2mShareEnabled = property_get_bool("vendor.display.m2m_share.enabled", true);
+    mM2mShareWeights[M2M_SHARE_PRIORITY_PRIMARY] =
+            property_get_int32("vendor.display.m2m_share.weight.primary", M2M_SHARE_WEIGHT_PRIMARY);
+    mM2mShareWeights[M2M_SHARE_PRIORITY_EXTERNAL] =
+            property_get_int32("vendor.display.m2m_share.weight.external", M2M_SHARE_WEIGHT_EXTERNAL);
+    mM2mShareWeights[M2M_SHARE_PRIORITY_VIRTUAL] =
+            property_get_int32("vendor.display.m2m_share.weight.virtual", M2M_SHARE_WEIGHT_VIRTUAL);
+
     size_t num_mpp_units = sizeof(AVAILABLE_OTF_MPP_UNITS)/sizeof(exynos_mpp_t);
     for (size_t i = 0; i < num_mpp_units; i++) {
         exynos_mpp_t exynos_mpp = AVAILABLE_OTF_MPP_UNITS[i];
@@ -181,6 +220,7 @@ ExynosResourceManager::ExynosResourceManager(ExynosDevice *device)
     }
 
     ALOGI("mOtfMPPs(%zu), mM2mMPPs(%zu)", mOtfMPPs.size(), mM2mMPPs.size());
+    buildMPPCandidateOrder();
     if (hwcCheckDebugMessages(eDebugResourceManager)) {
         for (uint32_t i = 0; i < mOtfMPPs.size(); i++)
         {
@@ -202,6 +242,34 @@ ExynosResourceManager::ExynosResourceManager(ExynosDevice *device)
     mDstBufMgrThread->run("DstBufMgrThread");
 }
 
+/*
+ * The MPP vectors don't change after construction, so the m2mMPPs that
+ * assignLayer() can try for each class of display and layer are listed once.
+ */
+void ExynosResourceManager::buildMPPCandidateOrder()
+{
+    for (uint32_t useDpu = 0; useDpu < 2; useDpu++) {
+        for (uint32_t g2dOnly = 0; g2dOnly < 2; g2dOnly++) {
+            std::vector<ExynosMPP *> &candidates = mM2mCandidates[useDpu][g2dOnly];
+            candidates.clear();
+            for (uint32_t i = 0; i < mM2mMPPs.size(); i++) {
+                ExynosMPP *mpp = mM2mMPPs[i];
+                if (useDpu && (mpp->mLogicalType == MPP_LOGICAL_G2D_COMBO))
+                    continue;
+                if (!useDpu && (mpp->mLogicalType == MPP_LOGICAL_G2D_RGB))
+                    continue;
+                /* Only G2D can be assigned when window is not sufficient */
+                if (g2dOnly &&
+                    (mpp->mLogicalType != MPP_LOGICAL_G2D_RGB) &&
+                    (mpp->mLogicalType != MPP_LOGICAL_G2D_COMBO))
+                    continue;
+                candidates.push_back(mpp);
+            }
+        }
+    }
+    mOtfCandidates.reserve(mOtfMPPs.size());
+}
+
 ExynosResourceManager::~ExynosResourceManager()
 {
     for (int32_t i = mOtfMPPs.size(); i-- > 0;) {
@@ -217,6 +285,88 @@ ExynosResourceManager::~ExynosResourceManager()
 
     mDstBufMgrThread->mRunning = false;
     mDstBufMgrThread->requestExitAndWait();
+
+    VendorGraphicBufferAllocator& gAllocator(VendorGraphicBufferAllocator::get());
+    for (auto &pool : mDstBufPool) {
+        for (auto &entry : pool)
+            gAllocator.free(entry.handle);
+        pool.clear();
+    }
+}
+
+static inline bool isFrameOverlapped(const hwc_rect_t &r1, const hwc_rect_t &r2)
+{
+    return (r1.left < r2.right) && (r2.left < r1.right) &&
+           (r1.top < r2.bottom) && (r2.top < r1.bottom);
+}
+
+static inline uint64_t getFrameArea(const hwc_rect_t &rect)
+{
+    if ((WIDTH(rect) <= 0) || (HEIGHT(rect) <= 0))
+        return 0;
+    return (uint64_t)WIDTH(rect) * HEIGHT(rect);
+}
+
+static inline uint32_t getDstBufPoolIndex(uint64_t usage)
+{
+    return (usage & VendorGraphicBufferUsage::NO_AFBC) ? DST_BUF_POOL_UNCOMPRESSED
+                                                       : DST_BUF_POOL_COMPRESSED;
+}
+
+buffer_handle_t ExynosResourceManager::getPooledDstBuf(uint32_t width, uint32_t height,
+        uint32_t format, uint64_t usage)
+{
+    Mutex::Autolock lock(mDstBufPoolMutex);
+    const uint32_t poolIndex = getDstBufPoolIndex(usage);
+    std::list<dst_buf_pool_entry_t> &pool = mDstBufPool[poolIndex];
+    for (auto it = pool.begin(); it != pool.end(); it++) {
+        if ((it->width != width) || (it->height != height) ||
+            (it->format != format) || (it->usage != usage))
+            continue;
+        buffer_handle_t handle = it->handle;
+        mDstBufPoolSize[poolIndex] -= it->size;
+        pool.erase(it);
+        mDstBufPoolHit++;
+        HDEBUGLOGD(eDebugBuf, "%s:: %p, %d x %d, format(0x%x)", __func__, handle,
+                width, height, format);
+        return handle;
+    }
+    mDstBufPoolMiss++;
+    return NULL;
+}
+
+/*
+ * Returns false if handle is not taken, the caller frees it then.
+ * The oldest buffers of the pool are freed to stay in DST_BUF_POOL_MAX_SIZE.
+ */
+bool ExynosResourceManager::putPooledDstBuf(buffer_handle_t handle, uint32_t width,
+        uint32_t height, uint32_t format, uint64_t usage)
+{
+    dst_buf_pool_entry_t entry = {handle, width, height, format, usage,
+        (uint64_t)width * height * formatToBpp(format) / 8};
+    std::vector<buffer_handle_t> evicted;
+
+    if ((handle == NULL) || (entry.size == 0) || (entry.size > DST_BUF_POOL_MAX_SIZE))
+        return false;
+
+    {
+        Mutex::Autolock lock(mDstBufPoolMutex);
+        const uint32_t poolIndex = getDstBufPoolIndex(usage);
+        std::list<dst_buf_pool_entry_t> &pool = mDstBufPool[poolIndex];
+        pool.push_front(entry);
+        mDstBufPoolSize[poolIndex] += entry.size;
+        while (mDstBufPoolSize[poolIndex] > DST_BUF_POOL_MAX_SIZE) {
+            mDstBufPoolSize[poolIndex] -= pool.back().size;
+            evicted.push_back(pool.back().handle);
+            pool.pop_back();
+        }
+    }
+
+    VendorGraphicBufferAllocator& gAllocator(VendorGraphicBufferAllocator::get());
+    for (auto evictedHandle : evicted)
+        gAllocator.free(evictedHandle);
+
+    return true;
 }
 
 void ExynosResourceManager::reloadResourceForHWFC()
@@ -314,6 +464,7 @@ void ExynosResourceManager::DstBufMgrThread::reallocDstBufs(uint32_t Xres, uint3
 
 bool ExynosResourceManager::DstBufMgrThread::threadLoop()
 {
+    ApplyThreadPolicy(ThreadRole::M2M_RESOURCE);
     while(mRunning) {
         Mutex::Autolock lock(mMutex);
         mCondition.wait(mMutex);
@@ -355,7 +506,7 @@ int32_t ExynosResourceManager::doAllocDstBufs(uint32_t Xres, uint32_t Yres)
         if (mM2mMPPs[i]->needPreAllocation())
         {
             mM2mMPPs[i]->mFreeOutBufFlag = false;
-            for (uint32_t index = 0; index < NUM_MPP_DST_BUFS(mM2mMPPs[i]->mLogicalType); index++) {
+            for (uint32_t index = 0; index < mM2mMPPs[i]->mDstBufNum; index++) {
                 HDEBUGLOGD(eDebugBuf, "%s allocate dst buffer[%d]%p, x: %d, y: %d",
                         __func__, index, mM2mMPPs[i]->mDstImgs[index].bufferHandle, Xres, Yres);
                 uint32_t bufAlign = mM2mMPPs[i]->getOutBufAlign();
@@ -417,17 +568,44 @@ int32_t ExynosResourceManager::checkScenario(ExynosDisplay __unused *display)
 int32_t ExynosResourceManager::assignResource(ExynosDisplay *display)
 {
     ATRACE_CALL();
+    HWC_TRACE_FUNC(eHwcTraceAssign);
     int ret = 0;
     if ((mDevice == NULL) || (display == NULL))
         return -EINVAL;
 
-    HDEBUGLOGD(eDebugResourceManager|eDebugSkipResourceAssign, "mGeometryChanged(0x%" PRIx64 "), display(%d)",
-            mDevice->mGeometryChanged, display->mType);
+    HDEBUGLOGD(eDebugResourceManager|eDebugSkipResourceAssign,
+            "mGeometryChanged(device: 0x%" PRIx64 ", display: 0x%" PRIx64 "), display(%d)",
+            mDevice->mGeometryChanged, display->mGeometryChanged, display->mType);
 
     if (mDevice->mGeometryChanged == 0) {
         return NO_ERROR;
     }
 
+    if (canReuseAssignedResource(display)) {
+        HDEBUGLOGD(eDebugResourceManager|eDebugSkipResourceAssign,
+                "reuse previous assignment, display(%d)", display->mType);
+        bool firstValidate = mDevice->isFirstValidate();
+        bool lastValidate = mDevice->isLastValidate(display);
+        if (firstValidate && lastValidate)
+            return finishAssignResourceWork();
+
+        /* Resources of this display are kept by resetResources() */
+        if (firstValidate) {
+            if ((ret = prepareResources()) != NO_ERROR) {
+                HWC_LOGE(display, "%s:: prepareResources() error (%d)",
+                        __func__, ret);
+                return ret;
+            }
+            preAssignWindows();
+        }
+        mKeptAssignDisplayCnt++;
+        mKeptAssignCount++;
+        updateM2mShares(display, true);
+        if (lastValidate)
+            return finishAssignResourceWork();
+        return NO_ERROR;
+    }
+
     for (uint32_t i = 0; i < display->mLayers.size(); i++) {
         display->mLayers[i]->resetValidateData();
     }
@@ -460,10 +638,60 @@ int32_t ExynosResourceManager::assignResource(ExynosDisplay *display)
         return ret;
     }
 
-    if ((ret = assignResourceInternal(display)) != NO_ERROR) {
-        HWC_LOGE(display, "%s:: assignResourceInternal() error (%d)",
-                __func__, ret);
-        return ret;
+    if (mDevice->mGeometryChanged & GEOMETRY_CROSS_DISPLAY_MASK)
+        clearCompositionPlans();
+    else if (display->mGeometryChanged &
+             ~(GEOMETRY_LAYER_CHANGED_MASK | GEOMETRY_DISPLAY_LAYER_ADDED | GEOMETRY_DISPLAY_LAYER_REMOVED))
+        clearCompositionPlans(display);
+
+    updateBandwidthState(display);
+
+    bool planApplied = false;
+    bool usePlan = canUseCompositionPlan(display);
+    size_t planHash = 0;
+    std::vector<layer_assign_signature_t> signatures;
+    if (usePlan) {
+        planHash = getCompositionPlanHash(display, signatures);
+        for (auto it = mCompositionPlans.begin(); it != mCompositionPlans.end(); it++) {
+            if ((it->display != display) || (it->hash != planHash) ||
+                (it->signatures != signatures))
+                continue;
+            if (applyCompositionPlan(display, *it) == NO_ERROR) {
+                mCompositionPlans.splice(mCompositionPlans.begin(), mCompositionPlans, it);
+                planApplied = true;
+            }
+            break;
+        }
+        if (planApplied)
+            mCompositionPlanHit++;
+        else
+            mCompositionPlanMiss++;
+    }
+
+    if (!planApplied) {
+        if ((ret = searchResourceAssignment(display)) != NO_ERROR) {
+            HWC_LOGE(display, "%s:: searchResourceAssignment() error (%d)",
+                    __func__, ret);
+            return ret;
+        }
+        if (usePlan)
+            saveCompositionPlan(display, planHash, signatures);
+    }
+    display->mEstimatedBandwidthKBps = estimateReadBandwidth(display);
+    display->mCompressedDstSavedKBps = estimateCompressedDstSaving(display);
+    updateM2mShares(display, false);
+
+    /*
+     * MPPs kept by other displays weren't offered to this display.
+     * Re-assign every display in the next frame if that cost this display a layer.
+     */
+    if (mKeptAssignDisplayCnt > 0) {
+        for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+            if (display->mLayers[i]->mOverlayInfo & (eInsufficientWindow | eInsufficientMPP)) {
+                mSharedMPPConflict = true;
+                break;
+            }
+        }
     }
 
     if ((ret = assignWindow(display)) != NO_ERROR) {
@@ -488,6 +716,11 @@ int32_t ExynosResourceManager::assignResource(ExynosDisplay *display)
         }
     }
 
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        display->mLayers[i]->updateAssignSignature();
+        display->mLayers[i]->updateCompositionFlip();
+    }
+
     if (mDevice->isLastValidate(display)) {
         if ((ret = finishAssignResourceWork()) != NO_ERROR) {
             HWC_LOGE(display, "%s:: finishAssignResourceWork() error (%d)",
@@ -515,6 +748,554 @@ int32_t ExynosResourceManager::assignResource(ExynosDisplay *display)
     return NO_ERROR;
 }
 
+/*
+ * Previous assignment can be reused if only layer attributes that don't affect
+ * the assignment were changed, for example buffer update.
+ * When the display is the only one that is validated in this frame
+ * any of its resources can be kept.
+ */
+bool ExynosResourceManager::canReuseAssignedResource(ExynosDisplay *display)
+{
+    if (!display->mUseDpu)
+        return false;
+
+    if (mDevice->mGeometryChanged & ~GEOMETRY_LAYER_CHANGED_MASK)
+        return canKeepAssignedResource(display);
+
+    if (!mDevice->isFirstValidate() || !mDevice->isLastValidate(display))
+        return canKeepAssignedResource(display);
+
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        if ((layer->mValidateCompositionType == HWC2_COMPOSITION_INVALID) ||
+            ((layer->mOverlayInfo & eCompositionHysteresis) && (layer->mClientHoldFrames == 0)) ||
+            layer->isAssignSignatureChanged()) {
+            HDEBUGLOGD(eDebugSkipResourceAssign, "%s:: layer[%d] is changed", __func__, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The layer can be programmed as the background color of the CRTC instead of
+ * taking a window if it is an opaque solid color layer that covers the whole
+ * display at the bottom of the layer stack.
+ */
+bool ExynosResourceManager::isBackgroundColorLayer(ExynosDisplay *display, ExynosLayer *layer)
+{
+    if ((display->mLayers.size() == 0) || (display->mLayers[0] != layer))
+        return false;
+
+    if ((layer->mCompositionType != HWC2_COMPOSITION_SOLID_COLOR) ||
+        (layer->mLayerBuffer != NULL))
+        return false;
+
+    if ((layer->mPlaneAlpha < 1.0f) || (layer->mColor.a != 0xff))
+        return false;
+
+    if (layer->mLayerColorTransform.enable)
+        return false;
+
+    hwc_rect_t &frame = layer->mDisplayFrame;
+    if ((frame.left > 0) || (frame.top > 0) ||
+        (frame.right < (int32_t)display->mXres) ||
+        (frame.bottom < (int32_t)display->mYres))
+        return false;
+
+    return true;
+}
+
+/*
+ * Other displays are re-assigned in this frame. The assignment of this display
+ * is kept if its own geometry is unchanged, nothing that affects every display
+ * was changed and it only holds OTF MPPs, which aren't shared between displays.
+ */
+bool ExynosResourceManager::canKeepAssignedResource(ExynosDisplay *display)
+{
+    if (!display->mUseDpu || !display->mPlugState)
+        return false;
+
+    if ((mDevice->mGeometryChanged & GEOMETRY_CROSS_DISPLAY_MASK) ||
+        (display->mGeometryChanged & ~GEOMETRY_LAYER_CHANGED_MASK))
+        return false;
+
+    if (display->mExynosCompositionInfo.mHasCompositionLayer)
+        return false;
+
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        if ((layer->mValidateCompositionType == HWC2_COMPOSITION_INVALID) ||
+            ((layer->mOverlayInfo & eCompositionHysteresis) && (layer->mClientHoldFrames == 0)) ||
+            (layer->mM2mMPP != NULL) || layer->isAssignSignatureChanged()) {
+            HDEBUGLOGD(eDebugSkipResourceAssign, "%s:: layer[%d] is changed", __func__, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ExynosResourceManager::canUseCompositionPlan(ExynosDisplay *display)
+{
+    /* Same restriction with canReuseAssignedResource() */
+    if (!display->mUseDpu)
+        return false;
+
+    if ((mDevice->mGeometryChanged & GEOMETRY_CROSS_DISPLAY_MASK) ||
+        (display->mGeometryChanged &
+         ~(GEOMETRY_LAYER_CHANGED_MASK | GEOMETRY_DISPLAY_LAYER_ADDED | GEOMETRY_DISPLAY_LAYER_REMOVED)))
+        return false;
+
+    if (!mDevice->isFirstValidate() || !mDevice->isLastValidate(display))
+        return false;
+
+    /* Plans don't know about layers held at client composition */
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        if (display->mLayers[i]->mClientHoldFrames > 0)
+            return false;
+    }
+
+    return true;
+}
+
+size_t ExynosResourceManager::getCompositionPlanHash(ExynosDisplay *display,
+        std::vector<layer_assign_signature_t> &signatures)
+{
+    size_t hash = display->mLayers.size();
+
+    signatures.clear();
+    signatures.reserve(display->mLayers.size());
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        layer_assign_signature_t signature = display->mLayers[i]->getAssignSignature();
+        hash_combine(hash, signature.compositionType);
+        hash_combine(hash, signature.format);
+        hash_combine(hash, signature.stride);
+        hash_combine(hash, signature.vstride);
+        hash_combine(hash, signature.sourceCrop.left);
+        hash_combine(hash, signature.sourceCrop.top);
+        hash_combine(hash, signature.sourceCrop.right);
+        hash_combine(hash, signature.sourceCrop.bottom);
+        hash_combine(hash, signature.displayFrame.left);
+        hash_combine(hash, signature.displayFrame.top);
+        hash_combine(hash, signature.displayFrame.right);
+        hash_combine(hash, signature.displayFrame.bottom);
+        hash_combine(hash, signature.transform);
+        hash_combine(hash, (int32_t)signature.dataSpace);
+        hash_combine(hash, signature.blending);
+        hash_combine(hash, signature.planeAlpha);
+        signatures.push_back(signature);
+    }
+    return hash;
+}
+
+/*
+ * Restore resource assignment that was stored by saveCompositionPlan().
+ * Resource state is reset and error is returned if any resource of the plan
+ * can't be assigned anymore.
+ */
+int32_t ExynosResourceManager::applyCompositionPlan(ExynosDisplay *display,
+        const composition_plan_t &plan)
+{
+    int32_t ret = NO_ERROR;
+    exynos_image src_img;
+    exynos_image dst_img;
+
+    Mutex::Autolock lock(mDstBufMgrThread->mStateMutex);
+
+    if (plan.layers.size() != display->mLayers.size())
+        return -EINVAL;
+
+    resetAssignedResources(display);
+
+    for (uint32_t i = 0; i < plan.layers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        const composition_plan_layer_t &planLayer = plan.layers[i];
+
+        layer->setSrcExynosImage(&src_img);
+        layer->setDstExynosImage(&dst_img);
+        layer->setExynosImage(src_img, dst_img);
+        layer->setExynosMidImage(dst_img);
+        layer->mValidateCompositionType = planLayer.validateCompositionType;
+        layer->mOverlayInfo = planLayer.overlayInfo;
+
+        if ((planLayer.otfMPP != NULL) &&
+            ((planLayer.otfMPP->isAssignableState(display, src_img, dst_img) == false) ||
+             ((ret = planLayer.otfMPP->assignMPP(display, layer)) != NO_ERROR))) {
+            ret = (ret == NO_ERROR) ? eInsufficientMPP : ret;
+            goto err;
+        }
+        if (planLayer.m2mMPP != NULL) {
+            if ((planLayer.m2mMPP->isAssignableState(display, src_img, dst_img) == false) ||
+                ((ret = planLayer.m2mMPP->assignMPP(display, layer)) != NO_ERROR)) {
+                ret = (ret == NO_ERROR) ? eInsufficientMPP : ret;
+                goto err;
+            }
+            if (planLayer.validateCompositionType == HWC2_COMPOSITION_DEVICE)
+                layer->setExynosMidImage(planLayer.midImg);
+        }
+    }
+
+    for (uint32_t type = COMPOSITION_CLIENT; type <= COMPOSITION_EXYNOS; type++) {
+        ExynosCompositionInfo &compositionInfo = (type == COMPOSITION_CLIENT) ?
+                display->mClientCompositionInfo : display->mExynosCompositionInfo;
+        const composition_plan_target_t &target = (type == COMPOSITION_CLIENT) ?
+                plan.clientTarget : plan.exynosTarget;
+
+        compositionInfo.mHasCompositionLayer = target.hasCompositionLayer;
+        compositionInfo.mFirstIndex = target.firstIndex;
+        compositionInfo.mLastIndex = target.lastIndex;
+        /* Source of M2mMPP is layer, assignMPP() was called already */
+        compositionInfo.mM2mMPP = target.m2mMPP;
+        if (target.otfMPP != NULL) {
+            display->setCompositionTargetExynosImage(type, &src_img, &dst_img);
+            if ((target.otfMPP->isAssignableState(display, src_img, dst_img) == false) ||
+                ((ret = target.otfMPP->assignMPP(display, &compositionInfo)) != NO_ERROR)) {
+                ret = (ret == NO_ERROR) ? eInsufficientMPP : ret;
+                goto err;
+            }
+            compositionInfo.setExynosImage(src_img, dst_img);
+            compositionInfo.setExynosMidImage(dst_img);
+        }
+    }
+    display->mWindowNumUsed = plan.windowNumUsed;
+
+    /* G2D can be busy by pending work */
+    if ((ret = setResourcePriority(display)) != NO_ERROR)
+        goto err;
+
+    HDEBUGLOGD(eDebugResourceManager, "%s:: composition plan is applied, display(%d)",
+            __func__, display->mType);
+    return NO_ERROR;
+
+err:
+    HDEBUGLOGD(eDebugResourceManager, "%s:: fail to apply composition plan, display(%d), ret(%d)",
+            __func__, display->mType, ret);
+    resetAssignedResources(display);
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        display->mLayers[i]->resetValidateData();
+    }
+    display->initializeValidateInfos();
+    return (ret == NO_ERROR) ? -EINVAL : ret;
+}
+
+void ExynosResourceManager::saveCompositionPlan(ExynosDisplay *display, size_t hash,
+        std::vector<layer_assign_signature_t> &signatures)
+{
+    composition_plan_t plan;
+
+    plan.display = display;
+    plan.hash = hash;
+    plan.signatures = std::move(signatures);
+    plan.layers.resize(display->mLayers.size());
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        plan.layers[i].validateCompositionType = layer->mValidateCompositionType;
+        plan.layers[i].overlayInfo = layer->mOverlayInfo;
+        plan.layers[i].otfMPP = layer->mOtfMPP;
+        plan.layers[i].m2mMPP = layer->mM2mMPP;
+        plan.layers[i].midImg = layer->mMidImg;
+    }
+
+    for (uint32_t type = COMPOSITION_CLIENT; type <= COMPOSITION_EXYNOS; type++) {
+        ExynosCompositionInfo &compositionInfo = (type == COMPOSITION_CLIENT) ?
+                display->mClientCompositionInfo : display->mExynosCompositionInfo;
+        composition_plan_target_t &target = (type == COMPOSITION_CLIENT) ?
+                plan.clientTarget : plan.exynosTarget;
+        target.hasCompositionLayer = compositionInfo.mHasCompositionLayer;
+        target.firstIndex = compositionInfo.mFirstIndex;
+        target.lastIndex = compositionInfo.mLastIndex;
+        target.otfMPP = compositionInfo.mOtfMPP;
+        target.m2mMPP = compositionInfo.mM2mMPP;
+    }
+    plan.windowNumUsed = display->mWindowNumUsed;
+
+    mCompositionPlans.push_front(std::move(plan));
+    if (mCompositionPlans.size() > COMPOSITION_PLAN_CACHE_SIZE)
+        mCompositionPlans.pop_back();
+}
+
+void ExynosResourceManager::clearCompositionPlans(ExynosDisplay *display)
+{
+    if (display == NULL) {
+        mCompositionPlans.clear();
+        return;
+    }
+    mCompositionPlans.remove_if([display](const composition_plan_t &plan) {
+        return plan.display == display;
+    });
+}
+
+/*
+ * Greedy assignment gives each layer the first assignable MPP in priority order.
+ * If that leaves layers for client or exynos composition, try again with
+ * a device layer kept off the MPP that those layers could have used and
+ * keep the cheapest result.
+ */
+int32_t ExynosResourceManager::searchResourceAssignment(ExynosDisplay *display)
+{
+    int32_t ret = NO_ERROR;
+
+    if ((ret = assignResourceInternal(display)) != NO_ERROR)
+        return ret;
+
+    if ((!mAssignSearchEnabled && !mBandwidthNearLimit) || !display->mUseDpu ||
+        display->isMinimalDozeComposition())
+        return NO_ERROR;
+
+    if (!display->mClientCompositionInfo.mHasCompositionLayer &&
+        !display->mExynosCompositionInfo.mHasCompositionLayer) {
+        mAssignSearchHints.erase(display);
+        return NO_ERROR;
+    }
+
+    std::vector<assign_constraint_t> constraints;
+    getAssignConstraints(display, constraints);
+    if (constraints.empty())
+        return NO_ERROR;
+
+    uint64_t bestCost = getAssignmentCost(display);
+    int32_t bestIndex = -1;
+    int32_t lastIndex = -1;
+    for (size_t i = 0; i < constraints.size(); i++) {
+        mAssignSearchTry++;
+        lastIndex = (int32_t)i;
+        if (assignResourceWithConstraint(display, &constraints[i]) != NO_ERROR)
+            continue;
+        uint64_t cost = getAssignmentCost(display);
+        HDEBUGLOGD(eDebugResourceManager, "%s:: layer(%p) without 0x%x, cost %" PRIu64
+                " (best %" PRIu64 ")", __func__, constraints[i].layer,
+                constraints[i].mppType, cost, bestCost);
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestIndex = (int32_t)i;
+        }
+    }
+
+    if (bestIndex < 0)
+        mAssignSearchHints.erase(display);
+    else {
+        mAssignSearchHints[display] = constraints[bestIndex];
+        mAssignSearchImproved++;
+    }
+
+    /* Redo the best assignment if it was not the last one tried */
+    if (bestIndex != lastIndex) {
+        if ((ret = assignResourceWithConstraint(display,
+                        (bestIndex < 0) ? NULL : &constraints[bestIndex])) != NO_ERROR) {
+            HWC_LOGE(display, "%s:: reassignment fail (%d)", __func__, ret);
+            return ret;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+int32_t ExynosResourceManager::assignResourceWithConstraint(ExynosDisplay *display,
+        const assign_constraint_t *constraint)
+{
+    int32_t ret = NO_ERROR;
+
+    resetAssignedResources(display, true);
+    for (uint32_t i = 0; i < display->mLayers.size(); i++)
+        display->mLayers[i]->resetValidateData();
+    display->initializeValidateInfos();
+
+    if (constraint == NULL)
+        return assignResourceInternal(display);
+
+    uint32_t supportedMPPFlag = constraint->layer->mSupportedMPPFlag;
+    constraint->layer->mSupportedMPPFlag &= ~constraint->mppType;
+    ret = assignResourceInternal(display);
+    constraint->layer->mSupportedMPPFlag = supportedMPPFlag;
+
+    return ret;
+}
+
+/*
+ * Cost of the current assignment of display in pixels.
+ * GPU composition is the most expensive, then M2M processing normalized
+ * by capacity, then the DPU read bandwidth.
+ * Near the bus limit the estimated bytes read are added so that
+ * compressed buffers and M2M outputs are preferred.
+ */
+uint64_t ExynosResourceManager::getAssignmentCost(ExynosDisplay *display)
+{
+    static constexpr uint64_t kGpuWeight = 4;
+    static constexpr uint64_t kM2mWeight = 2;
+    uint64_t displayPixels = (uint64_t)display->mXres * display->mYres;
+    uint64_t gpuPixels = 0;
+    uint64_t readPixels = 0;
+
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        uint64_t pixels = (uint64_t)WIDTH(layer->mPreprocessedInfo.displayFrame) *
+                HEIGHT(layer->mPreprocessedInfo.displayFrame);
+        if (layer->mValidateCompositionType == HWC2_COMPOSITION_CLIENT)
+            gpuPixels += pixels;
+        else if (layer->mValidateCompositionType == HWC2_COMPOSITION_DEVICE)
+            readPixels += pixels;
+    }
+    if (display->mClientCompositionInfo.mHasCompositionLayer)
+        readPixels += displayPixels;
+    if (display->mExynosCompositionInfo.mHasCompositionLayer)
+        readPixels += displayPixels;
+
+    float m2mUsage = 0;
+    for (uint32_t i = 0; i < mM2mMPPs.size(); i++) {
+        if (mM2mMPPs[i]->mCapacity > 0)
+            m2mUsage += mM2mMPPs[i]->getAssignedCapacity() / mM2mMPPs[i]->mCapacity;
+    }
+
+    uint64_t cost = gpuPixels * kGpuWeight + (uint64_t)(m2mUsage * displayPixels) * kM2mWeight +
+            readPixels;
+
+    if (mBandwidthNearLimit) {
+        /* Bytes read per frame in units of 32bit pixels */
+        uint32_t refreshRate = max(display->getBtsRefreshRate(), 1U);
+        cost += estimateReadBandwidth(display) * 1000 / refreshRate / 4;
+    }
+
+    return cost;
+}
+
+/*
+ * DPU read bandwidth of the current assignment of display.
+ * Layers processed by M2M are read from the M2M output.
+ */
+uint64_t ExynosResourceManager::estimateReadBandwidth(ExynosDisplay *display)
+{
+    const uint32_t refreshRate = display->getBtsRefreshRate();
+    uint64_t bandwidth = 0;
+
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        if (layer->mValidateCompositionType != HWC2_COMPOSITION_DEVICE)
+            continue;
+        const exynos_image &img = (layer->mM2mMPP != NULL) ? layer->mMidImg : layer->mSrcImg;
+        bandwidth += getReadBandwidthKBps(img.w, img.h, img.format, img.compressed,
+                                          refreshRate);
+    }
+
+    for (ExynosCompositionInfo *compositionInfo :
+            {&display->mClientCompositionInfo, &display->mExynosCompositionInfo}) {
+        if (!compositionInfo->mHasCompositionLayer)
+            continue;
+        bandwidth += getReadBandwidthKBps(display->mXres, display->mYres,
+                                          DEFAULT_MPP_DST_FORMAT,
+                                          compositionInfo->mCompressed, refreshRate);
+    }
+
+    return bandwidth;
+}
+
+/* DPU read bandwidth saved because M2M outputs of display are compressed */
+uint64_t ExynosResourceManager::estimateCompressedDstSaving(ExynosDisplay *display)
+{
+    const uint32_t refreshRate = display->getBtsRefreshRate();
+    uint64_t saved = 0;
+
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        if ((layer->mValidateCompositionType != HWC2_COMPOSITION_DEVICE) ||
+            (layer->mM2mMPP == NULL) || !layer->mMidImg.compressed)
+            continue;
+        const exynos_image &img = layer->mMidImg;
+        saved += getReadBandwidthKBps(img.w, img.h, img.format, false, refreshRate) -
+                getReadBandwidthKBps(img.w, img.h, img.format, true, refreshRate);
+    }
+
+    if (display->mExynosCompositionInfo.mHasCompositionLayer &&
+        display->mExynosCompositionInfo.mCompressed) {
+        saved += getReadBandwidthKBps(display->mXres, display->mYres, DEFAULT_MPP_DST_FORMAT,
+                                      false, refreshRate) -
+                getReadBandwidthKBps(display->mXres, display->mYres, DEFAULT_MPP_DST_FORMAT,
+                                     true, refreshRate);
+    }
+
+    return saved;
+}
+
+/*
+ * The other displays are counted with their last estimation,
+ * display itself with its previous frame.
+ */
+void ExynosResourceManager::updateBandwidthState(ExynosDisplay *display)
+{
+    mTotalBandwidthKBps = 0;
+    for (uint32_t i = 0; i < mDevice->mDisplays.size(); i++) {
+        ExynosDisplay *exynosDisplay = mDevice->mDisplays[i];
+        if ((exynosDisplay != NULL) && exynosDisplay->mPlugState)
+            mTotalBandwidthKBps += exynosDisplay->mEstimatedBandwidthKBps;
+    }
+
+    bool nearLimit = (mBandwidthLimitKBps > 0) &&
+        (mTotalBandwidthKBps * 100 >= mBandwidthLimitKBps * mBandwidthNearLimitPercent);
+    if (nearLimit)
+        mBandwidthNearLimitCount++;
+    if (nearLimit != mBandwidthNearLimit)
+        HDEBUGLOGD(eDebugResourceManager, "%s:: display(%d) total %" PRIu64 " KB/s, near limit %d",
+                __func__, display->mType, mTotalBandwidthKBps, nearLimit);
+    mBandwidthNearLimit = nearLimit;
+}
+
+void ExynosResourceManager::getAssignConstraints(ExynosDisplay *display,
+        std::vector<assign_constraint_t> &constraints)
+{
+    /* MPP types that layers not composited by DPU could use */
+    uint32_t wantedMPPFlag = 0;
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        if ((layer->mValidateCompositionType != HWC2_COMPOSITION_DEVICE) &&
+            (layer->mCompositionType != HWC2_COMPOSITION_CLIENT))
+            wantedMPPFlag |= layer->mSupportedMPPFlag;
+    }
+
+    std::vector<std::pair<uint64_t, assign_constraint_t>> candidates;
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        if (layer->mValidateCompositionType != HWC2_COMPOSITION_DEVICE)
+            continue;
+        uint64_t area = (uint64_t)WIDTH(layer->mPreprocessedInfo.displayFrame) *
+                HEIGHT(layer->mPreprocessedInfo.displayFrame);
+        for (ExynosMPP *mpp : {layer->mOtfMPP, layer->mM2mMPP}) {
+            if ((mpp == NULL) || !(wantedMPPFlag & mpp->mLogicalType))
+                continue;
+            assign_constraint_t constraint;
+            constraint.layer = layer;
+            constraint.mppType = mpp->mLogicalType;
+            candidates.push_back(std::make_pair(area, constraint));
+        }
+    }
+
+    /* Big layers that hold a wanted MPP are tried first */
+    std::stable_sort(candidates.begin(), candidates.end(),
+            [](const auto &lhs, const auto &rhs) { return lhs.first > rhs.first; });
+
+    constraints.clear();
+    /*
+     * Warm start from the constraint chosen in the previous frame.
+     * The layer can be destroyed since then so only compare the pointer.
+     */
+    auto hint = mAssignSearchHints.find(display);
+    if ((hint != mAssignSearchHints.end()) &&
+        (std::find(display->mLayers.begin(), display->mLayers.end(), hint->second.layer) !=
+         display->mLayers.end()) &&
+        (hint->second.layer->mSupportedMPPFlag & hint->second.mppType))
+        constraints.push_back(hint->second);
+
+    for (auto &candidate : candidates) {
+        if (constraints.size() >= mAssignSearchMaxTry)
+            break;
+        if ((constraints.size() > 0) &&
+            (constraints[0].layer == candidate.second.layer) &&
+            (constraints[0].mppType == candidate.second.mppType))
+            continue;
+        constraints.push_back(candidate.second);
+    }
+}
+
 int32_t ExynosResourceManager::setResourcePriority(ExynosDisplay *display)
 {
     int ret = NO_ERROR;
@@ -547,7 +1328,7 @@ int32_t ExynosResourceManager::setResourcePriority(ExynosDisplay *display)
     ExynosCompositionInfo &compositionInfo = display->mExynosCompositionInfo;
     if (compositionInfo.mHasCompositionLayer == true)
     {
-        if ((m2mMPP == NULL) || (m2mMPP->mAcrylicHandle == NULL)) {
+        if ((m2mMPP == NULL) || (m2mMPP->getAcrylicHandle() == NULL)) {
             HWC_LOGE(display, "There is exynos composition layers but resource is null (%p)",
                     m2mMPP);
         } else if ((check_ret = m2mMPP->prioritize(2)) != NO_ERROR) {
@@ -683,6 +1464,8 @@ int32_t ExynosResourceManager::assignResourceInternal(ExynosDisplay *display)
         ret = eUnknown;
         return ret;
     } else {
+        if ((ret = mergeM2mLayers(display)) != NO_ERROR)
+            return ret;
         if ((ret = updateExynosComposition(display)) != NO_ERROR)
             return ret;
         if ((ret = updateClientComposition(display)) != NO_ERROR)
@@ -831,6 +1614,115 @@ int32_t ExynosResourceManager::updateExynosComposition(ExynosDisplay *display)
     return ret;
 }
 
+/*
+ * Adjacent layers that got a G2D job of their own are merged into one
+ * exynos composition so that G2D runs a single job and only one window is
+ * used for them. MSC jobs are not merged, it can not blend into one target.
+ */
+int32_t ExynosResourceManager::mergeM2mLayers(ExynosDisplay *display)
+{
+    int32_t ret = NO_ERROR;
+
+    if ((display->mDisplayControl.mergeM2mLayers == false) ||
+        (display->mUseDpu == false) ||
+        (display->mExynosCompositionInfo.mHasCompositionLayer == true))
+        return NO_ERROR;
+
+    ExynosMPP *m2mMPP = NULL;
+    for (uint32_t i = 0; i < mM2mMPPs.size(); i++) {
+        if (mM2mMPPs[i]->mLogicalType == MPP_LOGICAL_G2D_RGB) {
+            m2mMPP = mM2mMPPs[i];
+            break;
+        }
+    }
+    if ((m2mMPP == NULL) || (m2mMPP->mMaxSrcLayerNum < 2))
+        return NO_ERROR;
+
+    /* Find the first run of at least two adjacent per-layer G2D jobs */
+    int32_t firstIndex = -1;
+    int32_t lastIndex = -1;
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        bool canMerge = (layer->mValidateCompositionType == HWC2_COMPOSITION_DEVICE) &&
+                        (layer->mM2mMPP != NULL) &&
+                        (layer->mM2mMPP->mPhysicalType == MPP_G2D) &&
+                        (layer->mSupportedMPPFlag & m2mMPP->mLogicalType) &&
+                        ((display->mDisplayControl.cursorSupport == false) ||
+                         (layer->mCompositionType != HWC2_COMPOSITION_CURSOR));
+        if (canMerge) {
+            exynos_image src_img;
+            exynos_image dst_img;
+            layer->setSrcExynosImage(&src_img);
+            layer->setDstExynosImage(&dst_img);
+            layer->setExynosImage(src_img, dst_img);
+            canMerge = m2mMPP->isAssignable(display, src_img, dst_img);
+        }
+
+        if (canMerge) {
+            if (firstIndex < 0)
+                firstIndex = i;
+            lastIndex = i;
+            if ((uint32_t)(lastIndex - firstIndex + 1) >= m2mMPP->mMaxSrcLayerNum)
+                break;
+        } else if (lastIndex > firstIndex) {
+            break;
+        } else {
+            firstIndex = -1;
+            lastIndex = -1;
+        }
+    }
+
+    if ((firstIndex < 0) || (lastIndex <= firstIndex))
+        return NO_ERROR;
+
+    /* The window of the first layer is reused for the composition target */
+    exynos_image target_src;
+    exynos_image target_dst;
+    ExynosMPP *otfMPP = display->mLayers[firstIndex]->mOtfMPP;
+    display->setCompositionTargetExynosImage(COMPOSITION_EXYNOS, &target_src, &target_dst);
+    if ((otfMPP == NULL) ||
+        (otfMPP->isSupported(*display, target_src, target_dst) != NO_ERROR))
+        return NO_ERROR;
+
+    HDEBUGLOGD(eDebugResourceManager, "%s:: merge layer[%d] - layer[%d] into exynos composition",
+            __func__, firstIndex, lastIndex);
+
+    for (int32_t i = firstIndex; i <= lastIndex; i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        exynos_image src_img;
+        exynos_image dst_img;
+        layer->setSrcExynosImage(&src_img);
+        layer->setDstExynosImage(&dst_img);
+        layer->setExynosImage(src_img, dst_img);
+
+        layer->resetAssignedResource();
+        layer->mOverlayInfo |= eUpdateExynosComposition;
+        if ((ret = m2mMPP->assignMPP(display, layer)) != NO_ERROR) {
+            ALOGE("%s:: %s MPP assignMPP() error (%d)",
+                    __func__, m2mMPP->mName.string(), ret);
+            return ret;
+        }
+        layer->setExynosMidImage(dst_img);
+        layer->mValidateCompositionType = HWC2_COMPOSITION_EXYNOS;
+        display->mWindowNumUsed--;
+
+        /* Range of the first layer is set before the target is assigned */
+        if (i == firstIndex) {
+            if (((ret = display->addExynosCompositionLayer(i)) < 0) ||
+                ((ret = assignCompositionTarget(display, COMPOSITION_EXYNOS)) != NO_ERROR))
+                break;
+        } else if ((ret = display->addExynosCompositionLayer(i)) < 0) {
+            break;
+        }
+        ret = NO_ERROR;
+    }
+
+    if (ret != NO_ERROR)
+        HWC_LOGE(display, "%s:: fail to merge layers (%d)", __func__, ret);
+
+    return ret;
+}
+
 int32_t ExynosResourceManager::changeLayerFromClientToDevice(ExynosDisplay *display, ExynosLayer *layer,
         uint32_t layer_index, exynos_image m2m_out_img, ExynosMPP *m2mMPP, ExynosMPP *otfMPP)
 {
@@ -926,27 +1818,201 @@ int32_t ExynosResourceManager::updateClientComposition(ExynosDisplay *display)
         uint32_t overlayInfo = 0;
         int32_t compositionType = 0;
         ExynosLayer *layer = display->mLayers[i];
-        if ((layer->mOverlayPriority >= ePriorityHigh) &&
-            (layer->mValidateCompositionType == HWC2_COMPOSITION_DEVICE)) {
-            display->mClientCompositionInfo.mLastIndex--;
+        if ((layer->mOverlayPriority >= ePriorityHigh) &&
+            (layer->mValidateCompositionType == HWC2_COMPOSITION_DEVICE)) {
+            display->mClientCompositionInfo.mLastIndex--;
+            continue;
+        }
+        compositionType = assignLayer(display, layer, i, m2m_out_img, &m2mMPP, &otfMPP, overlayInfo);
+        if (compositionType == HWC2_COMPOSITION_DEVICE) {
+            /*
+             * Don't allocate G2D
+             * Execute can be fail because of other job
+             * Prioritizing is required to allocate G2D
+             */
+            if ((m2mMPP != NULL) && (m2mMPP->mPhysicalType == MPP_G2D))
+                break;
+            if ((ret = changeLayerFromClientToDevice(display, layer, i, m2m_out_img, m2mMPP, otfMPP)) != NO_ERROR)
+                return ret;
+        } else {
+            break;
+        }
+    }
+
+    return groupClientCompositionLayers(display);
+}
+
+/*
+ * Assigns a window to the layer if it can be shown without m2mMPP or with
+ * MSC, @assigned is false if the layer stays as it is.
+ */
+int32_t ExynosResourceManager::assignGroupedLayer(ExynosDisplay *display, uint32_t index,
+        bool &assigned)
+{
+    int32_t ret = NO_ERROR;
+    ExynosLayer *layer = display->mLayers[index];
+    ExynosMPP *m2mMPP = NULL;
+    ExynosMPP *otfMPP = NULL;
+    exynos_image m2m_out_img;
+    uint32_t overlayInfo = 0;
+
+    assigned = false;
+    if ((assignLayer(display, layer, index, m2m_out_img, &m2mMPP, &otfMPP, overlayInfo) !=
+         HWC2_COMPOSITION_DEVICE) ||
+        ((m2mMPP != NULL) && (m2mMPP->mPhysicalType == MPP_G2D)))
+        return NO_ERROR;
+
+    if ((otfMPP != NULL) && ((ret = otfMPP->assignMPP(display, layer)) != NO_ERROR)) {
+        ALOGE("%s:: %s MPP assignMPP() error (%d)",
+                __func__, otfMPP->mName.string(), ret);
+        return ret;
+    }
+    if (m2mMPP != NULL) {
+        if ((ret = m2mMPP->assignMPP(display, layer)) != NO_ERROR) {
+            ALOGE("%s:: %s MPP assignMPP() error (%d)",
+                    __func__, m2mMPP->mName.string(), ret);
+            return ret;
+        }
+        layer->setExynosMidImage(m2m_out_img);
+    }
+    layer->mValidateCompositionType = HWC2_COMPOSITION_DEVICE;
+    display->mWindowNumUsed++;
+    assigned = true;
+
+    return NO_ERROR;
+}
+
+/*
+ * The client composition target is shown in the window of the last layer of
+ * the range, so a layer inside the range that gets its own window is shown
+ * below the composited layers. The z-order is kept if the layer does not
+ * overlap any client layer below it in the range, e.g. the full screen layer
+ * between small notification or widget layers usually does not.
+ *
+ * Such layers are moved out of the client composition, the largest first.
+ * They take the free windows and then the windows of the device layers right
+ * next to the range that are smaller, which join the client composition
+ * instead. Either way fewer pixels are composed by GLES.
+ */
+int32_t ExynosResourceManager::groupClientCompositionLayers(ExynosDisplay *display)
+{
+    if ((display->mDisplayControl.groupLayersByOverlap == false) ||
+        (display->mUseDpu == false) ||
+        (display->mClientCompositionInfo.mHasCompositionLayer == false))
+        return NO_ERROR;
+
+    ExynosCompositionInfo &clientInfo = display->mClientCompositionInfo;
+    ExynosLowFpsLayerInfo &lowFpsInfo = display->mLowFpsLayerInfo;
+    std::vector<uint32_t> candidates;
+    for (int32_t i = clientInfo.mFirstIndex + 1; i < clientInfo.mLastIndex; i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        if ((layer->mValidateCompositionType != HWC2_COMPOSITION_CLIENT) ||
+            (layer->mCompositionType == HWC2_COMPOSITION_CLIENT) ||
+            ((lowFpsInfo.mHasLowFpsLayer == true) &&
+             (lowFpsInfo.mFirstIndex <= i) && (i <= lowFpsInfo.mLastIndex)))
             continue;
+        candidates.push_back(i);
+    }
+    if (candidates.empty())
+        return NO_ERROR;
+
+    std::stable_sort(candidates.begin(), candidates.end(), [display](uint32_t a, uint32_t b) {
+        return getFrameArea(display->mLayers[a]->mDisplayFrame) >
+               getFrameArea(display->mLayers[b]->mDisplayFrame);
+    });
+
+    /* Only client layers are composed below a layer that leaves the range */
+    auto canLeaveRange = [display, &clientInfo](uint32_t index) {
+        const hwc_rect_t &frame = display->mLayers[index]->mDisplayFrame;
+        for (uint32_t i = clientInfo.mFirstIndex; i < index; i++) {
+            ExynosLayer *layer = display->mLayers[i];
+            if ((layer->mValidateCompositionType == HWC2_COMPOSITION_CLIENT) &&
+                isFrameOverlapped(layer->mDisplayFrame, frame))
+                return false;
         }
-        compositionType = assignLayer(display, layer, i, m2m_out_img, &m2mMPP, &otfMPP, overlayInfo);
-        if (compositionType == HWC2_COMPOSITION_DEVICE) {
-            /*
-             * Don't allocate G2D
-             * Execute can be fail because of other job
-             * Prioritizing is required to allocate G2D
-             */
-            if ((m2mMPP != NULL) && (m2mMPP->mPhysicalType == MPP_G2D))
-                break;
-            if ((ret = changeLayerFromClientToDevice(display, layer, i, m2m_out_img, m2mMPP, otfMPP)) != NO_ERROR)
+        return true;
+    };
+    /* A layer that joins the range from below is composed below the moved layers */
+    auto canJoinBelow = [display, &clientInfo](uint32_t index) {
+        const hwc_rect_t &frame = display->mLayers[index]->mDisplayFrame;
+        for (int32_t i = clientInfo.mFirstIndex; i <= clientInfo.mLastIndex; i++) {
+            ExynosLayer *layer = display->mLayers[i];
+            if ((layer->mValidateCompositionType != HWC2_COMPOSITION_CLIENT) &&
+                isFrameOverlapped(layer->mDisplayFrame, frame))
+                return false;
+        }
+        return true;
+    };
+    auto canJoinRange = [display](int32_t index, uint64_t maxArea) {
+        if ((index < 0) || (index >= (int32_t)display->mLayers.size()))
+            return false;
+        ExynosLayer *layer = display->mLayers[index];
+        return (layer->mValidateCompositionType == HWC2_COMPOSITION_DEVICE) &&
+               (layer->mOverlayPriority < ePriorityHigh) &&
+               (layer->mM2mMPP == NULL) &&
+               ((display->mDisplayControl.cursorSupport == false) ||
+                (layer->mCompositionType != HWC2_COMPOSITION_CURSOR)) &&
+               (getFrameArea(layer->mDisplayFrame) < maxArea);
+    };
+
+    int32_t ret = NO_ERROR;
+    uint32_t grouped = 0;
+    for (uint32_t index : candidates) {
+        ExynosLayer *layer = display->mLayers[index];
+        uint64_t area = getFrameArea(layer->mDisplayFrame);
+        if (!canLeaveRange(index))
+            continue;
+
+        int32_t victimIndex = -1;
+        if (display->mWindowNumUsed >= display->mMaxWindowNum) {
+            int32_t below = clientInfo.mFirstIndex - 1;
+            int32_t above = clientInfo.mLastIndex + 1;
+            if (canJoinRange(below, area) && canJoinBelow(below) &&
+                !isFrameOverlapped(display->mLayers[below]->mDisplayFrame, layer->mDisplayFrame))
+                victimIndex = below;
+            if (canJoinRange(above, area) &&
+                ((victimIndex < 0) ||
+                 (getFrameArea(display->mLayers[above]->mDisplayFrame) <
+                  getFrameArea(display->mLayers[victimIndex]->mDisplayFrame))))
+                victimIndex = above;
+            if (victimIndex < 0)
+                continue;
+            display->mLayers[victimIndex]->resetAssignedResource();
+            display->mWindowNumUsed--;
+        }
+
+        bool assigned = false;
+        if ((ret = assignGroupedLayer(display, index, assigned)) != NO_ERROR)
+            return ret;
+
+        if (victimIndex >= 0) {
+            ExynosLayer *victim = display->mLayers[victimIndex];
+            bool restored = false;
+            if (!assigned &&
+                ((ret = assignGroupedLayer(display, victimIndex, restored)) != NO_ERROR))
                 return ret;
-        } else {
-            break;
+            if (!restored) {
+                /* It is next to the range, no layer is sandwiched */
+                victim->mValidateCompositionType = HWC2_COMPOSITION_CLIENT;
+                victim->mOverlayInfo |= eInsufficientWindow;
+                if (victimIndex < clientInfo.mFirstIndex)
+                    clientInfo.mFirstIndex = victimIndex;
+                else
+                    clientInfo.mLastIndex = victimIndex;
+            }
+        }
+
+        if (assigned) {
+            HDEBUGLOGD(eDebugResourceManager, "%s:: [%d] layer leaves client composition [%d] - [%d]",
+                    __func__, index, clientInfo.mFirstIndex, clientInfo.mLastIndex);
+            grouped++;
         }
     }
 
+    if (grouped > 0)
+        HDEBUGLOGD(eDebugResourceManager, "%s:: %d layers are moved out of client composition",
+                __func__, grouped);
+
     return ret;
 }
 
@@ -1034,6 +2100,32 @@ int32_t ExynosResourceManager::assignCompositionTarget(ExynosDisplay * display,
         return NO_ERROR;
     }
 
+    /*
+     * The target of exynos composition is compressed if an otfMPP that
+     * reads AFBC is available, it falls back to the default otherwise.
+     */
+    if (targetType == COMPOSITION_EXYNOS) {
+        ExynosMPP *m2mMPP = compositionInfo->mM2mMPP;
+        m2mMPP->mCompressDst = false;
+        bool compressed = m2mMPP->needCompressDstBuf();
+        if (mCompressM2mDst && !compressed && m2mMPP->mAllocOutBufFlag &&
+            (m2mMPP->mAttr & MPP_ATTR_AFBC)) {
+            exynos_image compressed_img = src_img;
+            compressed_img.compressed = 1;
+            for (uint32_t i = 0; i < mOtfMPPs.size(); i++) {
+                if ((mOtfMPPs[i]->isSupported(*display, compressed_img, dst_img) == NO_ERROR) &&
+                    mOtfMPPs[i]->isAssignable(display, compressed_img, dst_img)) {
+                    compressed = true;
+                    break;
+                }
+            }
+            m2mMPP->mCompressDst = compressed;
+        }
+        compositionInfo->setCompressed(compressed);
+        src_img.compressed = compressed;
+        dst_img.compressed = compressed;
+    }
+
     int64_t isSupported = 0;
     bool isAssignable = false;
     for (uint32_t i = 0; i < mOtfMPPs.size(); i++) {
@@ -1106,6 +2198,9 @@ int32_t ExynosResourceManager::validateLayer(uint32_t index, ExynosDisplay *disp
         return eUnSupportedColorTransform;
 #endif
 
+    if (layer->mClientHoldFrames > 0)
+        return eCompositionHysteresis;
+
     if ((display->mLowFpsLayerInfo.mHasLowFpsLayer == true) &&
         (display->mLowFpsLayerInfo.mFirstIndex <= (int32_t)index) &&
         ((int32_t)index <= display->mLowFpsLayerInfo.mLastIndex))
@@ -1148,9 +2243,34 @@ exynos_image ExynosResourceManager::getAlignedImage(exynos_image image, const Ex
     return image;
 }
 
+/*
+ * The candidates only depend on the images, the display and the restrictions
+ * of the MPPs, so they are kept until ExynosMPP::resetSupportedCache() is called.
+ */
 void ExynosResourceManager::getCandidateScalingM2mMPPOutImages(
         const ExynosDisplay *display, const exynos_image &src_img, const exynos_image &dst_img,
         std::vector<exynos_image> &image_lists) {
+    mpp_supported_key_t key;
+    key.displayId = display->mDisplayId;
+    key.displayYres = display->mYres;
+    key.btsRefreshRate = display->getBtsRefreshRate();
+    key.src = mpp_supported_image_t(src_img);
+    key.dst = mpp_supported_image_t(dst_img);
+
+    auto iter = mScalingOutImageCache.find(key);
+    if (iter == mScalingOutImageCache.end()) {
+        std::vector<exynos_image> candidates;
+        getCandidateScalingM2mMPPOutImagesInternal(display, src_img, dst_img, candidates);
+        if (mScalingOutImageCache.size() >= MPP_SUPPORTED_CACHE_SIZE)
+            mScalingOutImageCache.clear();
+        iter = mScalingOutImageCache.emplace(key, std::move(candidates)).first;
+    }
+    image_lists.insert(image_lists.end(), iter->second.begin(), iter->second.end());
+}
+
+void ExynosResourceManager::getCandidateScalingM2mMPPOutImagesInternal(
+        const ExynosDisplay *display, const exynos_image &src_img, const exynos_image &dst_img,
+        std::vector<exynos_image> &image_lists) {
     const bool isPerpendicular = !!(src_img.transform & HAL_TRANSFORM_ROT_90);
     const uint32_t srcWidth = isPerpendicular ? src_img.h : src_img.w;
     const uint32_t srcHeight = isPerpendicular ? src_img.w : src_img.h;
@@ -1425,12 +2545,29 @@ int32_t ExynosResourceManager::getCandidateM2mMPPOutImages(ExynosDisplay *displa
 
     }
 
+    /*
+     * Compressed RGB outputs are tried first, they are taken only if
+     * both the m2mMPP and the otfMPP support AFBC.
+     */
+    if (mCompressM2mDst) {
+        for (auto it = image_lists.begin(); it != image_lists.end(); it++) {
+            if (!isFormatRgb(it->format) || it->compressed)
+                continue;
+            exynos_image compressed_img = *it;
+            compressed_img.compressed = 1;
+            it = image_lists.insert(it, compressed_img) + 1;
+        }
+    }
+
     return static_cast<int32_t>(image_lists.size());
 }
 
 int32_t ExynosResourceManager::assignLayer(ExynosDisplay *display, ExynosLayer *layer, uint32_t layer_index,
         exynos_image &m2m_out_img, ExynosMPP **m2mMPP, ExynosMPP **otfMPP, uint32_t &overlayInfo)
 {
+    HWC_TRACE_FUNC(eHwcTraceAssign);
+    /* Checked once, the candidate loops below are on the validate path */
+    const bool debug = hwcCheckDebugMessages(eDebugResourceManager);
     int32_t ret = NO_ERROR;
     uint32_t validateFlag = 0;
 
@@ -1446,31 +2583,53 @@ int32_t ExynosResourceManager::assignLayer(ExynosDisplay *display, ExynosLayer *
         (display->mWindowNumUsed >= display->mMaxWindowNum))
         validateFlag |= eInsufficientWindow;
 
-    HDEBUGLOGD(eDebugResourceManager, "\t[%d] layer: validateFlag(0x%8x), supportedMPPFlag(0x%8x)",
+    HDEBUGLOGD_IF(debug, "\t[%d] layer: validateFlag(0x%8x), supportedMPPFlag(0x%8x)",
             layer_index, validateFlag, layer->mSupportedMPPFlag);
 
-    if (hwcCheckDebugMessages(eDebugResourceManager)) {
+    if (debug) {
         layer->printLayer();
     }
 
-    if ((validateFlag == NO_ERROR) || (validateFlag == eInsufficientWindow) ||
-        (validateFlag == eDimLayer)) {
+    /*
+     * Low fps layers composed by the exynos composition skip otfMPPs,
+     * they share the window of the composed surface.
+     */
+    bool g2dOnly = (validateFlag == eInsufficientWindow) ||
+        (((validateFlag & ~eInsufficientWindow) == eLowFpsLayer) &&
+         (display->mLowFpsLayerInfo.mStrategy == LOW_FPS_COMPOSE_EXYNOS));
+
+    if ((validateFlag == NO_ERROR) || g2dOnly || (validateFlag == eDimLayer)) {
         bool isAssignable = false;
         uint64_t isSupported = 0;
-        /* 1. Find available otfMPP */
-        if (validateFlag != eInsufficientWindow) {
-            for (uint32_t j = 0; j < mOtfMPPs.size(); j++) {
-                if ((layer->mSupportedMPPFlag & mOtfMPPs[j]->mLogicalType) != 0)
-                    isAssignable = mOtfMPPs[j]->isAssignable(display, src_img, dst_img);
-
-                HDEBUGLOGD(eDebugResourceManager, "\t\t check %s: flag (%d) supportedBit(%d), isAssignable(%d)",
-                        mOtfMPPs[j]->mName.string(),layer->mSupportedMPPFlag,
-                        (layer->mSupportedMPPFlag & mOtfMPPs[j]->mLogicalType), isAssignable);
-                if ((layer->mSupportedMPPFlag & mOtfMPPs[j]->mLogicalType) && (isAssignable)) {
-                    isSupported = mOtfMPPs[j]->isSupported(*display, src_img, dst_img);
-                    HDEBUGLOGD(eDebugResourceManager, "\t\t\t isSuported(%" PRIx64 ")", -isSupported);
+        /*
+         * 1. Find available otfMPP
+         * The channels that already hold the color LUTs of the layer are
+         * tried first so that their DPP settings are not reprogrammed.
+         */
+        if (!g2dOnly) {
+            size_t colorHash = layer->getColorDataHash();
+            mOtfCandidates.clear();
+            for (uint32_t k = 0; k < mOtfMPPs.size(); k++) {
+                if (mOtfMPPs[k]->mResidentColorHash == colorHash)
+                    mOtfCandidates.push_back(mOtfMPPs[k]);
+            }
+            for (uint32_t k = 0; k < mOtfMPPs.size(); k++) {
+                if (mOtfMPPs[k]->mResidentColorHash != colorHash)
+                    mOtfCandidates.push_back(mOtfMPPs[k]);
+            }
+            for (uint32_t j = 0; j < mOtfCandidates.size(); j++) {
+                isAssignable = false;
+                if ((layer->mSupportedMPPFlag & mOtfCandidates[j]->mLogicalType) != 0)
+                    isAssignable = mOtfCandidates[j]->isAssignable(display, src_img, dst_img);
+
+                HDEBUGLOGD_IF(debug, "\t\t check %s: flag (%d) supportedBit(%d), isAssignable(%d)",
+                        mOtfCandidates[j]->mName.string(),layer->mSupportedMPPFlag,
+                        (layer->mSupportedMPPFlag & mOtfCandidates[j]->mLogicalType), isAssignable);
+                if ((layer->mSupportedMPPFlag & mOtfCandidates[j]->mLogicalType) && (isAssignable)) {
+                    isSupported = mOtfCandidates[j]->isSupported(*display, src_img, dst_img);
+                    HDEBUGLOGD_IF(debug, "\t\t\t isSuported(%" PRIx64 ")", -isSupported);
                     if (isSupported == NO_ERROR) {
-                        *otfMPP = mOtfMPPs[j];
+                        *otfMPP = mOtfCandidates[j];
                         return HWC2_COMPOSITION_DEVICE;
                     }
                 }
@@ -1478,34 +2637,18 @@ int32_t ExynosResourceManager::assignLayer(ExynosDisplay *display, ExynosLayer *
         }
 
         /* 2. Find available m2mMPP */
-        for (uint32_t j = 0; j < mM2mMPPs.size(); j++) {
-
-            if ((display->mUseDpu == true) &&
-                (mM2mMPPs[j]->mLogicalType == MPP_LOGICAL_G2D_COMBO))
-                continue;
-            if ((display->mUseDpu == false) &&
-                (mM2mMPPs[j]->mLogicalType == MPP_LOGICAL_G2D_RGB))
-                continue;
+        const std::vector<ExynosMPP *> &m2mCandidates =
+            mM2mCandidates[display->mUseDpu ? 1 : 0][g2dOnly ? 1 : 0];
+        for (uint32_t j = 0; j < m2mCandidates.size(); j++) {
+            bool isAssignableState = m2mCandidates[j]->isAssignableState(display, src_img, dst_img);
 
-            /* Only G2D can be assigned if layer is supported by G2D
-             * when window is not sufficient
-             */
-            if ((validateFlag == eInsufficientWindow) &&
-                (mM2mMPPs[j]->mLogicalType != MPP_LOGICAL_G2D_RGB) &&
-                (mM2mMPPs[j]->mLogicalType != MPP_LOGICAL_G2D_COMBO)) {
-                HDEBUGLOGD(eDebugResourceManager, "\t\tInsufficient window but exynosComposition is not assigned");
-                continue;
-            }
-
-            bool isAssignableState = mM2mMPPs[j]->isAssignableState(display, src_img, dst_img);
-
-            HDEBUGLOGD(eDebugResourceManager, "\t\t check %s: supportedBit(%d), isAssignableState(%d)",
-                    mM2mMPPs[j]->mName.string(),
-                    (layer->mSupportedMPPFlag & mM2mMPPs[j]->mLogicalType), isAssignableState);
+            HDEBUGLOGD_IF(debug, "\t\t check %s: supportedBit(%d), isAssignableState(%d)",
+                    m2mCandidates[j]->mName.string(),
+                    (layer->mSupportedMPPFlag & m2mCandidates[j]->mLogicalType), isAssignableState);
 
             if (isAssignableState) {
-                if ((mM2mMPPs[j]->mLogicalType != MPP_LOGICAL_G2D_RGB) &&
-                    (mM2mMPPs[j]->mLogicalType != MPP_LOGICAL_G2D_COMBO)) {
+                if ((m2mCandidates[j]->mLogicalType != MPP_LOGICAL_G2D_RGB) &&
+                    (m2mCandidates[j]->mLogicalType != MPP_LOGICAL_G2D_COMBO)) {
                     exynos_image otf_dst_img = dst_img;
 
                     otf_dst_img.format = DEFAULT_MPP_DST_FORMAT;
@@ -1516,9 +2659,10 @@ int32_t ExynosResourceManager::assignLayer(ExynosDisplay *display, ExynosLayer *
                         HWC_LOGE(display, "Fail getCandidateM2mMPPOutImages (%d)", ret);
                         return ret;
                     }
-                    HDEBUGLOGD(eDebugResourceManager, "candidate M2mMPPOutImage num: %zu", image_lists.size());
+                    HDEBUGLOGD_IF(debug, "candidate M2mMPPOutImage num: %zu", image_lists.size());
                     for (auto &otf_src_img : image_lists) {
-                        dumpExynosImage(eDebugResourceManager, otf_src_img);
+                        if (debug)
+                            dumpExynosImage(eDebugResourceManager, otf_src_img);
                         exynos_image m2m_src_img = src_img;
                         /* transform is already handled by m2mMPP */
                         if (CC_UNLIKELY(otf_src_img.transform != 0 || otf_dst_img.transform != 0)) {
@@ -1536,11 +2680,13 @@ int32_t ExynosResourceManager::assignLayer(ExynosDisplay *display, ExynosLayer *
                         if (otf_src_img.needColorTransform)
                             m2m_src_img.needColorTransform = false;
 
-                        if (((isSupported = mM2mMPPs[j]->isSupported(*display, m2m_src_img, otf_src_img)) != NO_ERROR) ||
-                            ((isAssignable = mM2mMPPs[j]->hasEnoughCapa(display, m2m_src_img, otf_src_img)) == false))
+                        if (((isSupported = m2mCandidates[j]->isSupported(*display, m2m_src_img, otf_src_img)) != NO_ERROR) ||
+                            ((isAssignable = m2mCandidates[j]->hasEnoughCapa(display, m2m_src_img, otf_src_img)) == false))
                         {
-                            HDEBUGLOGD(eDebugResourceManager, "\t\t\t check %s: supportedBit(0x%" PRIx64 "), hasEnoughCapa(%d)",
-                                    mM2mMPPs[j]->mName.string(), -isSupported, isAssignable);
+                            HDEBUGLOGD_IF(debug, "\t\t\t check %s: supportedBit(0x%" PRIx64 "), hasEnoughCapa(%d)",
+                                    m2mCandidates[j]->mName.string(), -isSupported, isAssignable);
+                            if (isSupported == NO_ERROR)
+                                layer->mCapacityRejectedMPPFlag |= m2mCandidates[j]->mLogicalType;
                             continue;
                         }
 
@@ -1551,10 +2697,10 @@ int32_t ExynosResourceManager::assignLayer(ExynosDisplay *display, ExynosLayer *
                             if (isSupported == NO_ERROR)
                                 isAssignable = mOtfMPPs[k]->isAssignable(display, otf_src_img, otf_dst_img);
 
-                            HDEBUGLOGD(eDebugResourceManager, "\t\t\t check %s: supportedBit(0x%" PRIx64 "), isAssignable(%d)",
+                            HDEBUGLOGD_IF(debug, "\t\t\t check %s: supportedBit(0x%" PRIx64 "), isAssignable(%d)",
                                     mOtfMPPs[k]->mName.string(), -isSupported, isAssignable);
                             if ((isSupported == NO_ERROR) && isAssignable) {
-                                *m2mMPP = mM2mMPPs[j];
+                                *m2mMPP = m2mCandidates[j];
                                 *otfMPP = mOtfMPPs[k];
                                 m2m_out_img = otf_src_img;
                                 return HWC2_COMPOSITION_DEVICE;
@@ -1562,13 +2708,15 @@ int32_t ExynosResourceManager::assignLayer(ExynosDisplay *display, ExynosLayer *
                         }
                     }
                 } else {
-                    if ((layer->mSupportedMPPFlag & mM2mMPPs[j]->mLogicalType) &&
-                        ((isAssignable = mM2mMPPs[j]->hasEnoughCapa(display, src_img, dst_img) == true))) {
-                        *m2mMPP = mM2mMPPs[j];
+                    if ((layer->mSupportedMPPFlag & m2mCandidates[j]->mLogicalType) &&
+                        ((isAssignable = m2mCandidates[j]->hasEnoughCapa(display, src_img, dst_img) == true))) {
+                        *m2mMPP = m2mCandidates[j];
                         return HWC2_COMPOSITION_EXYNOS;
                     } else {
-                        HDEBUGLOGD(eDebugResourceManager, "\t\t\t check %s: layer's mSupportedMPPFlag(0x%8x), hasEnoughCapa(%d)",
-                                mM2mMPPs[j]->mName.string(), layer->mSupportedMPPFlag, isAssignable);
+                        HDEBUGLOGD_IF(debug, "\t\t\t check %s: layer's mSupportedMPPFlag(0x%8x), hasEnoughCapa(%d)",
+                                m2mCandidates[j]->mName.string(), layer->mSupportedMPPFlag, isAssignable);
+                        if (layer->mSupportedMPPFlag & m2mCandidates[j]->mLogicalType)
+                            layer->mCapacityRejectedMPPFlag |= m2mCandidates[j]->mLogicalType;
                     }
                 }
             }
@@ -1768,10 +2916,82 @@ int32_t ExynosResourceManager::assignWindow(ExynosDisplay *display)
  * @param * display
  * @return int
  */
-int32_t ExynosResourceManager::updateSupportedMPPFlag(ExynosDisplay * display)
+mpp_supported_key_t ExynosResourceManager::getSupportedMPPKey(ExynosDisplay *display,
+        exynos_image &src_img, exynos_image &dst_img, bool hdr, bool drm)
+{
+    mpp_supported_key_t key;
+    key.displayId = display->mDisplayId;
+    key.displayYres = display->mYres;
+    key.btsRefreshRate = display->getBtsRefreshRate();
+    key.hasHdrLayer = hdr;
+    key.hasDrmLayer = drm;
+    key.src = mpp_supported_image_t(src_img);
+    key.dst = mpp_supported_image_t(dst_img);
+
+    return key;
+}
+
+/*
+ * Runs isSupported() of every MPP, @dst_img has DEFAULT_MPP_DST_FORMAT.
+ * An MPP that only takes YUV output is checked again with
+ * DEFAULT_MPP_DST_YUV_FORMAT.
+ */
+void ExynosResourceManager::checkSupportedMPPs(ExynosDisplay *display, exynos_image &src_img,
+        exynos_image &dst_img, uint32_t &supportedMPPFlag,
+        std::unordered_map<uint32_t, uint64_t> &checkMPPFlag)
 {
     int64_t ret = 0;
+    exynos_image dst_img_yuv = dst_img;
+    dst_img_yuv.format = DEFAULT_MPP_DST_YUV_FORMAT;
+
+    supportedMPPFlag = 0;
+    checkMPPFlag.clear();
+
+    for (const ExynosMPPVector *mpps : {&mOtfMPPs, &mM2mMPPs}) {
+        for (uint32_t j = 0; j < mpps->size(); j++) {
+            ExynosMPP *mpp = (*mpps)[j];
+            if ((ret = mpp->isSupported(*display, src_img, dst_img)) == NO_ERROR) {
+                supportedMPPFlag |= mpp->mLogicalType;
+                HDEBUGLOGD(eDebugResourceManager, "\t%s: supported", mpp->mName.string());
+            } else {
+                if (((-ret) == eMPPUnsupportedFormat) &&
+                    ((ret = mpp->isSupported(*display, src_img, dst_img_yuv)) == NO_ERROR)) {
+                    supportedMPPFlag |= mpp->mLogicalType;
+                    HDEBUGLOGD(eDebugResourceManager, "\t%s: supported with yuv dst", mpp->mName.string());
+                }
+            }
+            if (ret < 0) {
+                HDEBUGLOGD(eDebugResourceManager, "\t%s: unsupported flag(0x%" PRIx64 ")", mpp->mName.string(), -ret);
+                checkMPPFlag[mpp->mLogicalType] |= (-ret);
+            }
+        }
+    }
+}
+
+void ExynosResourceManager::prepareSupportedMPPFlag(ExynosDisplay *display, ExynosLayer *layer,
+        exynos_image &src_img, exynos_image &dst_img, const mpp_supported_key_t &key)
+{
+    if ((layer->mSupportedMPPGeneration == mSupportedGeneration) &&
+        (layer->mSupportedMPPKey == key))
+        return;
+
+    checkSupportedMPPs(display, src_img, dst_img, layer->mSupportedMPPFlagCache,
+            layer->mCheckMPPFlagCache);
+    layer->mSupportedMPPKey = key;
+    layer->mSupportedMPPGeneration = mSupportedGeneration;
+}
+
+int32_t ExynosResourceManager::updateSupportedMPPFlag(ExynosDisplay * display)
+{
     HDEBUGLOGD(eDebugResourceManager, "%s++++++++++", __func__);
+
+    /* Doze frames are composed by OTF MPPs, layers that need M2M fall back to the client */
+    uint32_t excludedMPPFlag = 0;
+    if (display->isMinimalDozeComposition()) {
+        for (uint32_t j = 0; j < mM2mMPPs.size(); j++)
+            excludedMPPFlag |= mM2mMPPs[j]->mLogicalType;
+    }
+
     for (uint32_t i = 0; i < display->mLayers.size(); i++) {
         ExynosLayer *layer = display->mLayers[i];
         HDEBUGLOGD(eDebugResourceManager, "[%d] layer ", i);
@@ -1781,68 +3001,36 @@ int32_t ExynosResourceManager::updateSupportedMPPFlag(ExynosDisplay * display)
 
         exynos_image src_img;
         exynos_image dst_img;
-        exynos_image dst_img_yuv;
         layer->setSrcExynosImage(&src_img);
         layer->setDstExynosImage(&dst_img);
-        layer->setDstExynosImage(&dst_img_yuv);
         dst_img.format = DEFAULT_MPP_DST_FORMAT;
-        dst_img_yuv.format = DEFAULT_MPP_DST_YUV_FORMAT;
+
+        /* Geometry changes that don't touch the checked fields keep the last result */
+        mpp_supported_key_t key = getSupportedMPPKey(display, src_img, dst_img,
+                hasHdrLayer, hasDrmLayer);
+        if ((layer->mSupportedMPPGeneration == mSupportedGeneration) &&
+            (layer->mSupportedMPPKey == key)) {
+            layer->mSupportedMPPFlag = layer->mSupportedMPPFlagCache &
+                    ~(layer->mTestFailedMPPFlag | excludedMPPFlag);
+            layer->mCheckMPPFlag = layer->mCheckMPPFlagCache;
+            HDEBUGLOGD(eDebugResourceManager, "[%d] layer mSupportedMPPFlag(0x%8x) is not changed",
+                    i, layer->mSupportedMPPFlag);
+            continue;
+        }
         HDEBUGLOGD(eDebugResourceManager, "\tsrc_img");
         dumpExynosImage(eDebugResourceManager, src_img);
         HDEBUGLOGD(eDebugResourceManager, "\tdst_img");
         dumpExynosImage(eDebugResourceManager, dst_img);
 
-        /* Initialize flags */
-        layer->mSupportedMPPFlag = 0;
-        layer->mCheckMPPFlag.clear();
-
-        /* Check OtfMPPs */
-        for (uint32_t j = 0; j < mOtfMPPs.size(); j++) {
-            if ((ret = mOtfMPPs[j]->isSupported(*display, src_img, dst_img)) == NO_ERROR) {
-                layer->mSupportedMPPFlag |= mOtfMPPs[j]->mLogicalType;
-                HDEBUGLOGD(eDebugResourceManager, "\t%s: supported", mOtfMPPs[j]->mName.string());
-            } else {
-                if (((-ret) == eMPPUnsupportedFormat) &&
-                    ((ret = mOtfMPPs[j]->isSupported(*display, src_img, dst_img_yuv)) == NO_ERROR)) {
-                    layer->mSupportedMPPFlag |= mOtfMPPs[j]->mLogicalType;
-                    HDEBUGLOGD(eDebugResourceManager, "\t%s: supported with yuv dst", mOtfMPPs[j]->mName.string());
-                }
-            }
-            if (ret < 0) {
-                HDEBUGLOGD(eDebugResourceManager, "\t%s: unsupported flag(0x%" PRIx64 ")", mOtfMPPs[j]->mName.string(), -ret);
-                uint64_t checkFlag = 0x0;
-                if (layer->mCheckMPPFlag.find(mOtfMPPs[j]->mLogicalType) !=
-                        layer->mCheckMPPFlag.end()) {
-                    checkFlag = layer->mCheckMPPFlag.at(mOtfMPPs[j]->mLogicalType);
-                }
-                checkFlag |= (-ret);
-                layer->mCheckMPPFlag[mOtfMPPs[j]->mLogicalType] = checkFlag;
-            }
-        }
+        checkSupportedMPPs(display, src_img, dst_img, layer->mSupportedMPPFlag,
+                layer->mCheckMPPFlag);
+        layer->mSupportedMPPKey = key;
+        layer->mSupportedMPPGeneration = mSupportedGeneration;
+        layer->mSupportedMPPFlagCache = layer->mSupportedMPPFlag;
+        layer->mCheckMPPFlagCache = layer->mCheckMPPFlag;
 
-        /* Check M2mMPPs */
-        for (uint32_t j = 0; j < mM2mMPPs.size(); j++) {
-            if ((ret = mM2mMPPs[j]->isSupported(*display, src_img, dst_img)) == NO_ERROR) {
-                layer->mSupportedMPPFlag |= mM2mMPPs[j]->mLogicalType;
-                HDEBUGLOGD(eDebugResourceManager, "\t%s: supported", mM2mMPPs[j]->mName.string());
-            } else {
-                if (((-ret) == eMPPUnsupportedFormat) &&
-                    ((ret = mM2mMPPs[j]->isSupported(*display, src_img, dst_img_yuv)) == NO_ERROR)) {
-                    layer->mSupportedMPPFlag |= mM2mMPPs[j]->mLogicalType;
-                    HDEBUGLOGD(eDebugResourceManager, "\t%s: supported with yuv dst", mM2mMPPs[j]->mName.string());
-                }
-            }
-            if (ret < 0) {
-                HDEBUGLOGD(eDebugResourceManager, "\t%s: unsupported flag(0x%" PRIx64 ")", mM2mMPPs[j]->mName.string(), -ret);
-                uint64_t checkFlag = 0x0;
-                if (layer->mCheckMPPFlag.find(mM2mMPPs[j]->mLogicalType) !=
-                        layer->mCheckMPPFlag.end()) {
-                    checkFlag = layer->mCheckMPPFlag.at(mM2mMPPs[j]->mLogicalType);
-                }
-                checkFlag |= (-ret);
-                layer->mCheckMPPFlag[mM2mMPPs[j]->mLogicalType] = checkFlag;
-            }
-        }
+        /* Exclude otfMPPs that are rejected by TEST_ONLY commit */
+        layer->mSupportedMPPFlag &= ~(layer->mTestFailedMPPFlag | excludedMPPFlag);
         HDEBUGLOGD(eDebugResourceManager, "[%d] layer mSupportedMPPFlag(0x%8x)", i, layer->mSupportedMPPFlag);
     }
     HDEBUGLOGD(eDebugResourceManager, "%s-------------", __func__);
@@ -1854,7 +3042,20 @@ int32_t ExynosResourceManager::resetResources()
 {
     HDEBUGLOGD(eDebugResourceManager, "%s+++++++++", __func__);
 
+    std::vector<ExynosDisplay *> keptDisplays;
+    for (auto display : mDevice->mDisplays) {
+        if ((display != nullptr) && canKeepAssignedResource(display))
+            keptDisplays.push_back(display);
+    }
+
     for (uint32_t i = 0; i < mOtfMPPs.size(); i++) {
+        if ((mOtfMPPs[i]->mAssignedDisplay != NULL) &&
+            (std::find(keptDisplays.begin(), keptDisplays.end(),
+                       mOtfMPPs[i]->mAssignedDisplay) != keptDisplays.end())) {
+            HDEBUGLOGD(eDebugResourceManager, "\t%s is kept for display %d",
+                    mOtfMPPs[i]->mName.string(), mOtfMPPs[i]->mAssignedDisplay->mDisplayId);
+            continue;
+        }
         mOtfMPPs[i]->resetMPP();
         if (hwcCheckDebugMessages(eDebugResourceManager)) {
             String8 dumpMPP;
@@ -1922,6 +3123,11 @@ int32_t ExynosResourceManager::preAssignResources()
             mM2mMPPs[i]->reserveMPP();
             continue;
         }
+        if (mM2mShareEnabled && (mM2mMPPs[i]->mCapacity != -1)) {
+            /* Displays share the capacity by checkM2mShare() */
+            HDEBUGLOGD(eDebugResourceManager, "\t%s is shared by displays", mM2mMPPs[i]->mName.string());
+            continue;
+        }
         HDEBUGLOGD(eDebugResourceManager, "\t%s check, 0x%8x", mM2mMPPs[i]->mName.string(), mM2mMPPs[i]->mPreAssignDisplayList[displayMode]);
         if (mM2mMPPs[i]->mPreAssignDisplayList[displayMode] != 0) {
             ExynosDisplay *display = NULL;
@@ -1981,34 +3187,16 @@ void ExynosResourceManager::preAssignWindows()
 int32_t ExynosResourceManager::preProcessLayer(ExynosDisplay * display)
 {
     int32_t ret = 0;
-    hasHdrLayer = false;
-    hasDrmLayer = false;
 
-    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
-        ExynosLayer *layer = display->mLayers[i];
-        if ((ret = layer->doPreProcess()) < 0) {
-            HWC_LOGE(display, "%s:: doPreProcess() error, display(%d), layer %d", __func__, display->mType, i);
+    /* Layers can be preprocessed already outside of mAssignMutex */
+    if (!display->mLayersPreProcessed) {
+        if ((ret = display->preProcessLayers()) != NO_ERROR)
             return ret;
-        }
-        /* mIsHdrLayer is known after preprocess */
-        if (layer->mIsHdrLayer) hasHdrLayer = true;
-        if ((layer->mLayerBuffer != NULL) && (getDrmMode(layer->mLayerBuffer) != NO_DRM))
-            hasDrmLayer = true;
     }
+    display->mLayersPreProcessed = false;
 
-    // Re-align layer priority for max overlay resources
-    uint32_t mNumMaxPriorityLayers = 0;
-    for (int i = (display->mLayers.size()-1); i >= 0; i--) {
-        ExynosLayer *layer = display->mLayers[i];
-        HDEBUGLOGD(eDebugResourceManager, "Priority align: i:%d, layer priority:%d, Max:%d, mNumMaxPriorityAllowed:%d", i,
-                layer->mOverlayPriority, mNumMaxPriorityLayers, display->mNumMaxPriorityAllowed);
-        if (layer->mOverlayPriority == ePriorityMax) {
-            if (mNumMaxPriorityLayers >= display->mNumMaxPriorityAllowed) {
-                layer->mOverlayPriority = ePriorityHigh;
-            }
-            mNumMaxPriorityLayers++;
-        }
-    }
+    hasHdrLayer = display->mHasHdrLayer;
+    hasDrmLayer = display->mHasDrmLayer;
 
     return NO_ERROR;
 }
@@ -2068,6 +3256,13 @@ void ExynosResourceManager::setFrameRateForPerformance(ExynosMPP &mpp,
         AcrylicPerformanceRequestFrame *frame)
 {
     int fps = ceil(msecsPerSec / mpp.mCapacity);
+    float workload = mpp.getAssignedCapacity();
+    float predicted = mpp.predictWorkload(workload);
+
+    /* Request the clock for the predicted workload before the frame that needs it */
+    if ((workload > 0) && (predicted > workload))
+        fps = ceil(fps * predicted / workload);
+
     HDEBUGLOGD(eDebugResourceAssigning, "%s setFrameRate %d",
             mpp.mName.string(), fps);
     frame->setFrameRate(fps);
@@ -2107,13 +3302,19 @@ int32_t ExynosResourceManager::deliverPerformanceInfo()
                 (mpp->mAssignedSources.size() > 0))
             {
                 assignedInstanceNum++;
+            } else {
+                /* Idle frames let the prediction come down */
+                mpp->predictWorkload(0);
             }
         }
         if ((canSkipSetting == true) && (assignedInstanceNum != 0)) {
             HWC_LOGE(NULL, "%s:: canSKip true but assignedInstanceNum(%d)",
                     __func__, assignedInstanceNum);
         }
-        request.reset(assignedInstanceNum);
+        if (request.reset(assignedInstanceNum) == false) {
+            HWC_LOGE(NULL, "%s:: request reset fail (%d)", __func__, assignedInstanceNum);
+            continue;
+        }
 
         if (canSkipSetting == true)
             continue;
@@ -2173,7 +3374,8 @@ int32_t ExynosResourceManager::deliverPerformanceInfo()
                 assignedInstanceIndex++;
             }
         }
-        if ((mpp = getExynosMPP(MPP_LOGICAL_G2D_RGB)) != NULL)
+        if (((mpp = getExynosMPP(MPP_LOGICAL_G2D_RGB)) != NULL) &&
+                (mpp->getAcrylicHandle() != NULL))
             mpp->mAcrylicHandle->requestPerformanceQoS(&request);
         else
             HWC_LOGE(NULL,"getExynosMPP(MPP_LOGICAL_G2D_RGB) failed");
@@ -2216,6 +3418,177 @@ float ExynosResourceManager::getResourceUsedCapa(ExynosMPP &mpp)
     return usedCapa;
 }
 
+bool ExynosResourceManager::isM2mShareActive(ExynosDisplay *display) const
+{
+    /* Same condition as the reservation of OTF MPPs in preAssignResources() */
+    return (display != NULL) && display->mPlugState &&
+            ((display->mType != HWC_DISPLAY_PRIMARY) ||
+             (display->mPowerModeState != HWC2_POWER_MODE_OFF));
+}
+
+static uint32_t getM2mSharePriority(ExynosDisplay *display)
+{
+    switch (display->mType) {
+    case HWC_DISPLAY_PRIMARY:
+        return M2M_SHARE_PRIORITY_PRIMARY;
+    case HWC_DISPLAY_EXTERNAL:
+        return M2M_SHARE_PRIORITY_EXTERNAL;
+    default:
+        return M2M_SHARE_PRIORITY_VIRTUAL;
+    }
+}
+
+uint32_t ExynosResourceManager::getM2mShareWeight(ExynosDisplay *display) const
+{
+    return mM2mShareWeights[getM2mSharePriority(display)];
+}
+
+/* Capacity used by @display in all instances of the HW resource of @mpp */
+float ExynosResourceManager::getM2mDisplayUsedCapa(ExynosMPP &mpp, ExynosDisplay *display) const
+{
+    float usedCapa = 0;
+
+    for (uint32_t i = 0; i < mM2mMPPs.size(); i++) {
+        if ((mpp.mPhysicalType == mM2mMPPs[i]->mPhysicalType) &&
+            (mpp.mPhysicalIndex == mM2mMPPs[i]->mPhysicalIndex) &&
+            (mM2mMPPs[i]->mAssignedDisplay == display) &&
+            (mM2mMPPs[i]->mAssignedState & MPP_ASSIGN_STATE_ASSIGNED))
+            usedCapa += mM2mMPPs[i]->mUsedCapacity;
+    }
+
+    return usedCapa;
+}
+
+m2m_share_state_t &ExynosResourceManager::getM2mShareState(ExynosMPP &mpp,
+                                                           ExynosDisplay *display)
+{
+    uint64_t key = ((uint64_t)display->mDisplayId << 32) |
+            ((uint64_t)mpp.mPhysicalType << 16) | mpp.mPhysicalIndex;
+    auto it = mM2mShares.find(key);
+    if (it == mM2mShares.end()) {
+        it = mM2mShares.emplace(key, m2m_share_state_t()).first;
+        it->second.physicalType = mpp.mPhysicalType;
+        it->second.physicalIndex = mpp.mPhysicalIndex;
+    }
+    return it->second;
+}
+
+bool ExynosResourceManager::checkM2mShare(ExynosDisplay *display, ExynosMPP &mpp,
+        float usedCapa, float requiredCapa, float calibration)
+{
+    float capacity = mpp.mCapacity;
+    uint32_t totalWeight = getM2mShareWeight(display);
+    uint32_t priority = getM2mSharePriority(display);
+
+    for (auto other : mDevice->mDisplays) {
+        if ((other != display) && isM2mShareActive(other))
+            totalWeight += getM2mShareWeight(other);
+    }
+    if (totalWeight == 0)
+        return (capacity >= (usedCapa + requiredCapa));
+
+    /*
+     * Capacity that the displays assigned in the previous frame but not yet
+     * in this one are expected to need within their share, and the capacity
+     * that displays of lower priority borrowed beyond their share.
+     */
+    float heldBack = 0;
+    float borrowedByLower = 0;
+    for (auto other : mDevice->mDisplays) {
+        if ((other == display) || !isM2mShareActive(other))
+            continue;
+        float otherShare = capacity * getM2mShareWeight(other) / totalWeight;
+        float otherUsed = getM2mDisplayUsedCapa(mpp, other) * calibration;
+        m2m_share_state_t &otherState = getM2mShareState(mpp, other);
+        if (otherState.round + 1 == mM2mShareRound)
+            heldBack += std::max(0.0f,
+                    std::min(otherShare, otherState.demand * calibration) - otherUsed);
+        if ((getM2mSharePriority(other) < priority) && (otherUsed > otherShare))
+            borrowedByLower += otherUsed - otherShare;
+    }
+
+    float share = capacity * getM2mShareWeight(display) / totalWeight;
+    /* mUsedCapacity of mpp is re-calculated in requiredCapa */
+    float ownUsed = getM2mDisplayUsedCapa(mpp, display) * calibration;
+    if ((mpp.mAssignedDisplay == display) && (mpp.mAssignedState & MPP_ASSIGN_STATE_ASSIGNED))
+        ownUsed -= mpp.mUsedCapacity * calibration;
+
+    HDEBUGLOGD(eDebugResourceManager|eDebugCapacity,
+            "%s:: %s display(%d) share(%f), own(%f), used(%f), required(%f), held back(%f), "
+            "borrowed by lower(%f)", __func__, mpp.mName.string(), display->mDisplayId,
+            share, ownUsed, usedCapa, requiredCapa, heldBack, borrowedByLower);
+
+    if (capacity >= (usedCapa + requiredCapa)) {
+        /* Within its own share or what is left over by the others */
+        if ((ownUsed + requiredCapa <= share) ||
+            (capacity >= (usedCapa + requiredCapa + heldBack)))
+            return true;
+    } else if ((ownUsed + requiredCapa <= share) && (borrowedByLower > 0)) {
+        /*
+         * Displays of lower priority were assigned first and borrowed this
+         * share. Over-committing the HW is not allowed, all displays are
+         * re-assigned in the next frame where they lend only what the
+         * denied demand of this display leaves.
+         */
+        for (auto other : mDevice->mDisplays) {
+            if ((other == display) || !isM2mShareActive(other) ||
+                (getM2mSharePriority(other) >= priority))
+                continue;
+            float otherShare = capacity * getM2mShareWeight(other) / totalWeight;
+            if (getM2mDisplayUsedCapa(mpp, other) * calibration > otherShare)
+                getM2mShareState(mpp, other).preempted++;
+        }
+        mSharedMPPConflict = true;
+    }
+
+    m2m_share_state_t &state = getM2mShareState(mpp, display);
+    state.denied = std::max(state.denied, requiredCapa / calibration);
+    return false;
+}
+
+void ExynosResourceManager::updateM2mShares(ExynosDisplay *display, bool kept)
+{
+    if (!mM2mShareEnabled)
+        return;
+
+    for (uint32_t i = 0; i < mM2mMPPs.size(); i++) {
+        ExynosMPP *mpp = mM2mMPPs[i];
+        if (mpp->mCapacity == -1)
+            continue;
+
+        bool counted = false;
+        for (uint32_t j = 0; j < i; j++) {
+            if ((mM2mMPPs[j]->mPhysicalType == mpp->mPhysicalType) &&
+                (mM2mMPPs[j]->mPhysicalIndex == mpp->mPhysicalIndex)) {
+                counted = true;
+                break;
+            }
+        }
+        if (counted)
+            continue;
+
+        m2m_share_state_t &state = getM2mShareState(*mpp, display);
+        state.round = mM2mShareRound;
+        /* Assignment of a kept display wasn't checked again */
+        if (kept)
+            continue;
+
+        float used = getM2mDisplayUsedCapa(*mpp, display);
+        state.demand = used + state.denied;
+        state.denied = 0;
+
+        uint32_t totalWeight = 0;
+        for (auto other : mDevice->mDisplays) {
+            if ((other == display) || isM2mShareActive(other))
+                totalWeight += getM2mShareWeight(other);
+        }
+        float calibration = (mpp->mPhysicalType == MPP_G2D) ? mpp->getLaptimeCalibration() : 1.0f;
+        if ((totalWeight > 0) &&
+            (used * calibration > mpp->mCapacity * getM2mShareWeight(display) / totalWeight))
+            state.borrowed++;
+    }
+}
+
 void ExynosResourceManager::enableMPP(uint32_t physicalType, uint32_t physicalIndex, uint32_t logicalIndex, uint32_t enable)
 {
     for (uint32_t i = 0; i < mOtfMPPs.size(); i++) {
@@ -2266,12 +3639,15 @@ void ExynosResourceManager::setScaleDownRatio(uint32_t physicalType,
     for (uint32_t i = RESTRICTION_RGB; i < RESTRICTION_MAX; i++) {
         findMpp->mDstSizeRestrictions[i].maxDownScale = scaleDownRatio;
     }
+    findMpp->resetSupportedCache();
 }
 
 int32_t  ExynosResourceManager::prepareResources()
 {
     int ret = NO_ERROR;
     HDEBUGLOGD(eDebugResourceManager, "This is first validate");
+    mKeptAssignDisplayCnt = 0;
+    mM2mShareRound++;
     if ((ret = resetResources()) != NO_ERROR) {
         HWC_LOGE(NULL,"%s:: resetResources() error (%d)",
                 __func__, ret);
@@ -2296,6 +3672,11 @@ int32_t ExynosResourceManager::finishAssignResourceWork()
     }
 
     mDevice->clearGeometryChanged();
+    if (mSharedMPPConflict) {
+        mSharedMPPConflictCount++;
+        mDevice->setGeometryChanged(GEOMETRY_DEVICE_SHARED_MPP_CONFLICT);
+        mSharedMPPConflict = false;
+    }
     return ret;
 }
 
@@ -2553,6 +3934,75 @@ float ExynosResourceManager::getM2MCapa(uint32_t physicalType)
 void ExynosResourceManager::dump(String8 &result) const {
     result.appendFormat("Resource Manager:\n");
 
+    result.appendFormat("[Composition Plan Cache]\n");
+    result.appendFormat("size(%zu/%d), hit(%" PRIu64 "), miss(%" PRIu64 ")\n",
+            mCompositionPlans.size(), COMPOSITION_PLAN_CACHE_SIZE,
+            mCompositionPlanHit, mCompositionPlanMiss);
+    result.appendFormat("[Per-display Assignment] kept(%" PRIu64 "), shared MPP conflict(%" PRIu64 ")\n",
+            mKeptAssignCount, mSharedMPPConflictCount);
+    mAssignMutex.dump(result, "Resource assign");
+    result.appendFormat("[Assignment Search] %s, tried(%" PRIu64 "), improved(%" PRIu64 ")\n",
+            mAssignSearchEnabled ? "enabled" : "disabled", mAssignSearchTry,
+            mAssignSearchImproved);
+    {
+        Mutex::Autolock lock(mDstBufPoolMutex);
+        result.appendFormat("[Dst Buffer Pool] uncompressed %zu buffers, %" PRIu64 " bytes, "
+                "compressed %zu buffers, %" PRIu64 " bytes, max %d bytes each, "
+                "hit(%" PRIu64 "), miss(%" PRIu64 ")\n",
+                mDstBufPool[DST_BUF_POOL_UNCOMPRESSED].size(),
+                mDstBufPoolSize[DST_BUF_POOL_UNCOMPRESSED],
+                mDstBufPool[DST_BUF_POOL_COMPRESSED].size(),
+                mDstBufPoolSize[DST_BUF_POOL_COMPRESSED], DST_BUF_POOL_MAX_SIZE,
+                mDstBufPoolHit, mDstBufPoolMiss);
+    }
+    result.appendFormat("[Bandwidth] limit(%" PRIu64 " KB/s), near limit at %u%%, "
+            "estimated(%" PRIu64 " KB/s), near limit frames(%" PRIu64 ")\n",
+            mBandwidthLimitKBps, mBandwidthNearLimitPercent, mTotalBandwidthKBps,
+            mBandwidthNearLimitCount);
+    uint64_t compressedDstSaved = 0;
+    for (auto display : mDevice->mDisplays) {
+        if ((display != NULL) && display->mPlugState)
+            compressedDstSaved += display->mCompressedDstSavedKBps;
+    }
+    result.appendFormat("[Compressed M2M Dst] %s, saved(%" PRIu64 " KB/s)\n",
+            mCompressM2mDst ? "enabled" : "disabled", compressedDstSaved);
+    result.appendFormat("[M2M Capacity Share] %s, weight primary(%u), external(%u), virtual(%u)\n",
+            mM2mShareEnabled ? "enabled" : "disabled",
+            mM2mShareWeights[M2M_SHARE_PRIORITY_PRIMARY],
+            mM2mShareWeights[M2M_SHARE_PRIORITY_EXTERNAL],
+            mM2mShareWeights[M2M_SHARE_PRIORITY_VIRTUAL]);
+    for (const auto &it : mM2mShares) {
+        const m2m_share_state_t &state = it.second;
+        result.appendFormat("\tdisplay(%u) mpp(%u, %u): demand(%f), borrowed(%" PRIu64 "), "
+                "preempted(%" PRIu64 ")\n", (uint32_t)(it.first >> 32),
+                state.physicalType, state.physicalIndex, state.demand, state.borrowed,
+                state.preempted);
+    }
+
+    result.appendFormat("[Client Composition Fallback]\n");
+    for (uint32_t content = 0; content < FALLBACK_CONTENT_NUM; content++) {
+        uint64_t checkedLayers = mFallbackCheckedLayers[content].load(std::memory_order_relaxed);
+        uint64_t checkedPixels = mFallbackCheckedPixels[content].load(std::memory_order_relaxed);
+        const char *contentStr = (content == FALLBACK_CONTENT_VIDEO) ? "video" : "rgb";
+        result.appendFormat("%s: checked layers(%" PRIu64 "), pixels(%" PRIu64 ")\n",
+                contentStr, checkedLayers, checkedPixels);
+        for (const ExynosMPPVector *mpps : {&mOtfMPPs, &mM2mMPPs}) {
+            for (uint32_t i = 0; i < mpps->size(); i++) {
+                ExynosMPP *mpp = (*mpps)[i];
+                for (uint32_t reason = 0; reason < MPP_UNSUPPORTED_REASON_NUM; reason++) {
+                    uint64_t layers = mpp->mFallbackLayers[content][reason].load(std::memory_order_relaxed);
+                    if (layers == 0)
+                        continue;
+                    uint64_t pixels = mpp->mFallbackPixels[content][reason].load(std::memory_order_relaxed);
+                    result.appendFormat("\t%s %s: layers(%" PRIu64 ", %.1f%%), pixels(%" PRIu64 ", %.1f%%)\n",
+                            mpp->mName.string(), getMPPUnsupportedReasonStr(reason),
+                            layers, checkedLayers ? layers * 100.0f / checkedLayers : 0.0f,
+                            pixels, checkedPixels ? pixels * 100.0f / checkedPixels : 0.0f);
+                }
+            }
+        }
+    }
+
     result.appendFormat("[RGB Restrictions]\n");
     dump(RESTRICTION_RGB, result);
 
@@ -2577,6 +4027,121 @@ void ExynosResourceManager::dump(const restriction_classification_t classificati
     }
 }
 
+/*
+ * Called after every validate, so only counters are updated here.
+ * A layer is counted for each MPP that rejected it and each reason.
+ */
+void ExynosResourceManager::updateFallbackStats(ExynosDisplay *display)
+{
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        ExynosLayer *layer = display->mLayers[i];
+        if ((layer->mLayerBuffer == NULL) ||
+            (layer->mCompositionType == HWC2_COMPOSITION_CLIENT))
+            continue;
+
+        const int format = layer->getBufferMeta(layer->mLayerBuffer)->format;
+        const uint32_t content = isFormatYUV(format) ? FALLBACK_CONTENT_VIDEO : FALLBACK_CONTENT_RGB;
+        const uint64_t pixels = layer->getDisplayFrameArea();
+        mFallbackCheckedLayers[content].fetch_add(1, std::memory_order_relaxed);
+        mFallbackCheckedPixels[content].fetch_add(pixels, std::memory_order_relaxed);
+
+        if ((layer->mValidateCompositionType != HWC2_COMPOSITION_CLIENT) ||
+            !(layer->mOverlayInfo & eMPPUnsupported))
+            continue;
+
+        for (auto &checkFlag : layer->mCheckMPPFlag) {
+            ExynosMPP *mpp = getExynosMPP(checkFlag.first);
+            if (mpp == NULL)
+                continue;
+            for (uint64_t reasons = checkFlag.second; reasons != 0; reasons &= (reasons - 1)) {
+                uint32_t reason = __builtin_ctzll(reasons);
+                if (reason >= MPP_UNSUPPORTED_REASON_NUM)
+                    break;
+                mpp->mFallbackLayers[content][reason].fetch_add(1, std::memory_order_relaxed);
+                mpp->mFallbackPixels[content][reason].fetch_add(pixels, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+/* Called for every frame that is delivered to the display */
+void ExynosResourceManager::updateUtilizationStats(ExynosDisplay *display)
+{
+    uint32_t capacityRejectedMPPFlag = 0;
+    for (uint32_t i = 0; i < display->mLayers.size(); i++) {
+        if (display->mLayers[i]->mValidateCompositionType == HWC2_COMPOSITION_CLIENT)
+            capacityRejectedMPPFlag |= display->mLayers[i]->mCapacityRejectedMPPFlag;
+    }
+
+    for (uint32_t i = 0; i < mOtfMPPs.size(); i++) {
+        ExynosMPP *mpp = mOtfMPPs[i];
+        if ((mpp->mAssignedDisplay != display) || (mpp->mAssignedSources.size() == 0))
+            continue;
+        uint64_t pixels = 0;
+        for (uint32_t j = 0; j < mpp->mAssignedSources.size(); j++)
+            pixels += (uint64_t)mpp->mAssignedSources[j]->mSrcImg.w *
+                    mpp->mAssignedSources[j]->mSrcImg.h;
+        mpp->updateUtilization(pixels);
+    }
+
+    /* M2M MPPs count their frames when they run */
+    for (uint32_t i = 0; i < mM2mMPPs.size(); i++) {
+        if (capacityRejectedMPPFlag & mM2mMPPs[i]->mLogicalType)
+            mM2mMPPs[i]->mUtilization.capacityFallbacks.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ExynosResourceManager::serializeUtilizationStats(std::vector<uint64_t> &out) const
+{
+    out.clear();
+    out.push_back(kUtilizationStatsVersion);
+    out.push_back(mOtfMPPs.size() + mM2mMPPs.size());
+    for (const ExynosMPPVector *mpps : {&mOtfMPPs, &mM2mMPPs}) {
+        for (uint32_t i = 0; i < mpps->size(); i++) {
+            ExynosMPP *mpp = (*mpps)[i];
+            const ExynosMPP::UtilizationStats &stats = mpp->mUtilization;
+            out.push_back(mpp->mPhysicalType);
+            out.push_back(mpp->mPhysicalIndex);
+            out.push_back(mpp->mLogicalIndex);
+            out.push_back(stats.frames.load(std::memory_order_relaxed));
+            out.push_back(stats.pixels.load(std::memory_order_relaxed));
+            out.push_back(stats.capacityPermille.load(std::memory_order_relaxed));
+            out.push_back(stats.peakCapacityPermille.load(std::memory_order_relaxed));
+            out.push_back(stats.hwFrames.load(std::memory_order_relaxed));
+            out.push_back(stats.hwTimeUs.load(std::memory_order_relaxed));
+            out.push_back(stats.peakHwTimeUs.load(std::memory_order_relaxed));
+            out.push_back(stats.capacityFallbacks.load(std::memory_order_relaxed));
+        }
+    }
+}
+
+void ExynosResourceManager::serializeFallbackStats(std::vector<uint64_t> &out) const
+{
+    out.clear();
+    out.push_back(kFallbackStatsVersion);
+    out.push_back(FALLBACK_CONTENT_NUM);
+    out.push_back(MPP_UNSUPPORTED_REASON_NUM);
+    for (uint32_t content = 0; content < FALLBACK_CONTENT_NUM; content++) {
+        out.push_back(mFallbackCheckedLayers[content].load(std::memory_order_relaxed));
+        out.push_back(mFallbackCheckedPixels[content].load(std::memory_order_relaxed));
+    }
+    out.push_back(mOtfMPPs.size() + mM2mMPPs.size());
+    for (const ExynosMPPVector *mpps : {&mOtfMPPs, &mM2mMPPs}) {
+        for (uint32_t i = 0; i < mpps->size(); i++) {
+            ExynosMPP *mpp = (*mpps)[i];
+            out.push_back(mpp->mPhysicalType);
+            out.push_back(mpp->mPhysicalIndex);
+            out.push_back(mpp->mLogicalIndex);
+            for (uint32_t content = 0; content < FALLBACK_CONTENT_NUM; content++) {
+                for (uint32_t reason = 0; reason < MPP_UNSUPPORTED_REASON_NUM; reason++) {
+                    out.push_back(mpp->mFallbackLayers[content][reason].load(std::memory_order_relaxed));
+                    out.push_back(mpp->mFallbackPixels[content][reason].load(std::memory_order_relaxed));
+                }
+            }
+        }
+    }
+}
+
 void ExynosResourceManager::setM2MCapa(uint32_t physicalType, uint32_t capa)
 {
     for (size_t i = 0; i < mM2mMPPs.size(); i++) {
@@ -21,6 +21,7 @@
 #ifndef _EXYNOSRESOURCEMANAGER_H
 #define _EXYNOSRESOURCEMANAGER_H
 
+#include <list>
 #include <unordered_map>
 #include "ExynosDevice.h"
 #include "ExynosDisplay.h"
@@ -66,6 +67,119 @@ const dpu_attr_map_t dpu_attr_map_table [] =
 };
 #endif
 
+#ifndef COMPOSITION_PLAN_CACHE_SIZE
+#define COMPOSITION_PLAN_CACHE_SIZE 8
+#endif
+
+/* Resource assignment result of a layer */
+typedef struct composition_plan_layer {
+    int32_t validateCompositionType = HWC2_COMPOSITION_INVALID;
+    uint32_t overlayInfo = 0;
+    ExynosMPP *otfMPP = NULL;
+    ExynosMPP *m2mMPP = NULL;
+    exynos_image midImg;
+} composition_plan_layer_t;
+
+/* Resource assignment result of a composition target */
+typedef struct composition_plan_target {
+    bool hasCompositionLayer = false;
+    int32_t firstIndex = -1;
+    int32_t lastIndex = -1;
+    ExynosMPP *otfMPP = NULL;
+    ExynosMPP *m2mMPP = NULL;
+} composition_plan_target_t;
+
+/*
+ * Resource assignment result of a display.
+ * It is looked up by hash of signatures of all layers.
+ */
+typedef struct composition_plan {
+    ExynosDisplay *display = NULL;
+    size_t hash = 0;
+    std::vector<layer_assign_signature_t> signatures;
+    std::vector<composition_plan_layer_t> layers;
+    composition_plan_target_t clientTarget;
+    composition_plan_target_t exynosTarget;
+    uint32_t windowNumUsed = 0;
+} composition_plan_t;
+
+#ifndef ASSIGN_SEARCH_MAX_TRY
+#define ASSIGN_SEARCH_MAX_TRY 4
+#endif
+
+/* Bytes of freed M2M destination buffers kept for reuse by any MPP, per pool */
+#ifndef DST_BUF_POOL_MAX_SIZE
+#define DST_BUF_POOL_MAX_SIZE   (32 * 1024 * 1024)
+#endif
+
+/* Compressed and uncompressed destination buffers don't evict each other */
+enum {
+    DST_BUF_POOL_UNCOMPRESSED = 0,
+    DST_BUF_POOL_COMPRESSED,
+    DST_BUF_POOL_NUM,
+};
+
+typedef struct dst_buf_pool_entry {
+    buffer_handle_t handle;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t usage;
+    uint64_t size;
+} dst_buf_pool_entry_t;
+
+/* Assignments start to be weighted by DPU read bandwidth at this percent of the limit */
+#ifndef BANDWIDTH_NEAR_LIMIT_PERCENT
+#define BANDWIDTH_NEAR_LIMIT_PERCENT 90
+#endif
+
+/*
+ * Weights of the displays in the capacity of an M2M MPP that they share.
+ * Overridden by vendor.display.m2m_share.weight.{primary,external,virtual}.
+ */
+#ifndef M2M_SHARE_WEIGHT_PRIMARY
+#define M2M_SHARE_WEIGHT_PRIMARY    4
+#endif
+#ifndef M2M_SHARE_WEIGHT_EXTERNAL
+#define M2M_SHARE_WEIGHT_EXTERNAL   2
+#endif
+#ifndef M2M_SHARE_WEIGHT_VIRTUAL
+#define M2M_SHARE_WEIGHT_VIRTUAL    1
+#endif
+
+/* A display takes back its share from the displays of lower priority */
+enum {
+    M2M_SHARE_PRIORITY_VIRTUAL = 0,
+    M2M_SHARE_PRIORITY_EXTERNAL,
+    M2M_SHARE_PRIORITY_PRIMARY,
+    M2M_SHARE_PRIORITY_NUM,
+};
+
+/* Capacity share of a display in an M2M MPP, capacity is not calibrated */
+typedef struct m2m_share_state {
+    uint32_t physicalType = 0;
+    uint32_t physicalIndex = 0;
+    /* mM2mShareRound when the display was assigned last */
+    uint64_t round = 0;
+    /* Capacity used by the last assignment and the capacity it was denied */
+    float demand = 0;
+    /* Largest capacity denied to a layer during the current assignment */
+    float denied = 0;
+    /* Assignments that used more than the share */
+    uint64_t borrowed = 0;
+    /* Assignments that had the borrowed share taken back by another display */
+    uint64_t preempted = 0;
+} m2m_share_state_t;
+
+/*
+ * Alternative resource assignment that is tried on top of the greedy one.
+ * The layer is not allowed to use MPPs of mppType.
+ */
+typedef struct assign_constraint {
+    ExynosLayer *layer = NULL;
+    uint32_t mppType = 0;
+} assign_constraint_t;
+
 /* Based on multi-resolution feature */
 enum dst_realloc_state {
     DST_REALLOC_DONE = 0,
@@ -107,6 +221,14 @@ class ExynosResourceManager {
         bool hasDrmLayer;
         bool isHdrExternal;
 
+        /**
+         * Serializes the part of validateDisplay() that touches resources
+         * shared between displays (MPP assignment, rendering state used by
+         * isFirstValidate()/isLastValidate(), performance info).
+         * Display local work runs outside of it.
+         */
+        TimedMutex mAssignMutex;
+
         uint32_t mFormatRestrictionCnt;
         uint32_t mSizeRestrictionCnt[RESTRICTION_MAX];
         restriction_key_t mFormatRestrictions[RESTRICTION_CNT_MAX];
@@ -117,6 +239,11 @@ class ExynosResourceManager {
         ExynosResourceManager(ExynosDevice *device);
         virtual ~ExynosResourceManager();
         void reloadResourceForHWFC();
+        /* Called when a restriction of an MPP is changed */
+        void resetSupportedResults() {
+            mScalingOutImageCache.clear();
+            mSupportedGeneration++;
+        };
         void setTargetDisplayLuminance(uint16_t min, uint16_t max);
         void setTargetDisplayDevice(int device);
         int32_t doPreProcessing();
@@ -124,6 +251,10 @@ class ExynosResourceManager {
         int32_t doAllocDstBufs(uint32_t mXres, uint32_t mYres);
         int32_t assignResource(ExynosDisplay *display);
         int32_t assignResourceInternal(ExynosDisplay *display);
+        bool canReuseAssignedResource(ExynosDisplay *display);
+        bool canKeepAssignedResource(ExynosDisplay *display);
+        bool isBackgroundColorLayer(ExynosDisplay *display, ExynosLayer *layer);
+        void clearCompositionPlans(ExynosDisplay *display = NULL);
         static ExynosMPP* getExynosMPP(uint32_t type);
         static ExynosMPP* getExynosMPP(uint32_t physicalType, uint32_t physicalIndex);
         static void enableMPP(uint32_t physicalType, uint32_t physicalIndex, uint32_t logicalIndex, uint32_t enable);
@@ -131,6 +262,15 @@ class ExynosResourceManager {
                 uint32_t physicalIndex, uint32_t logicalIndex,
                 uint32_t scaleDownRatio);
         int32_t updateSupportedMPPFlag(ExynosDisplay * display);
+        mpp_supported_key_t getSupportedMPPKey(ExynosDisplay *display, exynos_image &src_img,
+                                               exynos_image &dst_img, bool hdr, bool drm);
+        /*
+         * Fills the MPP check cache of the layer that updateSupportedMPPFlag()
+         * uses if the key is the same at validate time. mAssignMutex held.
+         */
+        void prepareSupportedMPPFlag(ExynosDisplay *display, ExynosLayer *layer,
+                                     exynos_image &src_img, exynos_image &dst_img,
+                                     const mpp_supported_key_t &key);
         int32_t resetResources();
         int32_t preAssignResources();
         void preAssignWindows();
@@ -146,7 +286,10 @@ class ExynosResourceManager {
         int32_t updateResourceState();
         static float getResourceUsedCapa(ExynosMPP &mpp);
         int32_t updateExynosComposition(ExynosDisplay *display);
+        int32_t mergeM2mLayers(ExynosDisplay *display);
         int32_t updateClientComposition(ExynosDisplay *display);
+        int32_t groupClientCompositionLayers(ExynosDisplay *display);
+        int32_t assignGroupedLayer(ExynosDisplay *display, uint32_t index, bool &assigned);
         int32_t getCandidateM2mMPPOutImages(ExynosDisplay *display,
                 ExynosLayer *layer, std::vector<exynos_image> &image_lists);
         int32_t setResourcePriority(ExynosDisplay *display);
@@ -179,23 +322,157 @@ class ExynosResourceManager {
         void dump(String8 &result) const;
         void setM2MCapa(uint32_t physicalType, uint32_t capa);
 
+        /* Counts layers that fell back to client composition per MPP and reason */
+        void updateFallbackStats(ExynosDisplay *display);
+        /*
+         * Layout: version, FALLBACK_CONTENT_NUM, MPP_UNSUPPORTED_REASON_NUM,
+         * checked layers and pixels per content, number of MPPs,
+         * then per MPP: physical type, physical index, logical index,
+         * rejected layers and pixels per content and reason.
+         */
+        void serializeFallbackStats(std::vector<uint64_t> &out) const;
+        static constexpr uint64_t kFallbackStatsVersion = 1;
+
+        /* Counts the frames of OTF MPPs and the capacity fallbacks of M2M MPPs */
+        void updateUtilizationStats(ExynosDisplay *display);
+        /*
+         * Layout: version, number of MPPs, then per MPP: physical type,
+         * physical index, logical index, frames, pixels, capacity permille sum,
+         * peak capacity permille, hw frames, hw time(us), peak hw time(us),
+         * capacity fallbacks.
+         */
+        void serializeUtilizationStats(std::vector<uint64_t> &out) const;
+        static constexpr uint64_t kUtilizationStatsVersion = 1;
+
+        /*
+         * Pool of M2M destination buffers shared by all MPPs.
+         * Buffers come back once their fences are signaled, the last returned is reused first.
+         */
+        buffer_handle_t getPooledDstBuf(uint32_t width, uint32_t height, uint32_t format,
+                                        uint64_t usage);
+        bool putPooledDstBuf(buffer_handle_t handle, uint32_t width, uint32_t height,
+                             uint32_t format, uint64_t usage);
+
+        /*
+         * Displays share the capacity of M2M MPPs that have one instead of
+         * reserving the MPPs in preAssignResources(). Each display gets its
+         * weighted share of mCapacity. The share that the displays not yet
+         * assigned in this frame don't need is lent to the others.
+         */
+        bool isM2mShareEnabled() const { return mM2mShareEnabled; };
+        /*
+         * Returns true if @display can add @requiredCapa to the MPP that has
+         * @usedCapa used by the other sources. Both are scaled by @calibration.
+         * mAssignMutex held.
+         */
+        bool checkM2mShare(ExynosDisplay *display, ExynosMPP &mpp, float usedCapa,
+                           float requiredCapa, float calibration);
+
     private:
+        void buildMPPCandidateOrder();
         int32_t changeLayerFromClientToDevice(ExynosDisplay *display, ExynosLayer *layer,
                 uint32_t layer_index, exynos_image m2m_out_img, ExynosMPP *m2mMPP, ExynosMPP *otfMPP);
         void dump(const restriction_classification_t, String8 &result) const;
 
+        bool canUseCompositionPlan(ExynosDisplay *display);
+        size_t getCompositionPlanHash(ExynosDisplay *display,
+                                      std::vector<layer_assign_signature_t> &signatures);
+        int32_t applyCompositionPlan(ExynosDisplay *display, const composition_plan_t &plan);
+        void saveCompositionPlan(ExynosDisplay *display, size_t hash,
+                                 std::vector<layer_assign_signature_t> &signatures);
+
+        int32_t searchResourceAssignment(ExynosDisplay *display);
+        int32_t assignResourceWithConstraint(ExynosDisplay *display,
+                                             const assign_constraint_t *constraint);
+        uint64_t getAssignmentCost(ExynosDisplay *display);
+        void getAssignConstraints(ExynosDisplay *display,
+                                  std::vector<assign_constraint_t> &constraints);
+        uint64_t estimateReadBandwidth(ExynosDisplay *display);
+        uint64_t estimateCompressedDstSaving(ExynosDisplay *display);
+        void updateBandwidthState(ExynosDisplay *display);
+
+        /* Constraint that gave the cheapest assignment in the previous frame */
+        std::unordered_map<ExynosDisplay *, assign_constraint_t> mAssignSearchHints;
+        bool mAssignSearchEnabled = false;
+        uint32_t mAssignSearchMaxTry = ASSIGN_SEARCH_MAX_TRY;
+        uint64_t mAssignSearchTry = 0;
+        uint64_t mAssignSearchImproved = 0;
+
+        /* DPU read bandwidth limit in KB/s, 0 disables bandwidth aware assignment */
+        uint64_t mBandwidthLimitKBps = 0;
+        uint32_t mBandwidthNearLimitPercent = BANDWIDTH_NEAR_LIMIT_PERCENT;
+        /* Sum of the estimated bandwidth of all displays */
+        uint64_t mTotalBandwidthKBps = 0;
+        bool mBandwidthNearLimit = false;
+        uint64_t mBandwidthNearLimitCount = 0;
+
+        /* M2M outputs are compressed whenever the OTF MPP reading them supports it */
+        bool mCompressM2mDst = true;
+
+        bool isM2mShareActive(ExynosDisplay *display) const;
+        uint32_t getM2mShareWeight(ExynosDisplay *display) const;
+        float getM2mDisplayUsedCapa(ExynosMPP &mpp, ExynosDisplay *display) const;
+        m2m_share_state_t &getM2mShareState(ExynosMPP &mpp, ExynosDisplay *display);
+        /* Records the demand of @display when its assignment is done or kept */
+        void updateM2mShares(ExynosDisplay *display, bool kept);
+
+        bool mM2mShareEnabled = true;
+        uint32_t mM2mShareWeights[M2M_SHARE_PRIORITY_NUM] = {
+                M2M_SHARE_WEIGHT_VIRTUAL, M2M_SHARE_WEIGHT_EXTERNAL, M2M_SHARE_WEIGHT_PRIMARY};
+        /* Incremented by prepareResources() for each frame */
+        uint64_t mM2mShareRound = 0;
+        /* Keyed by display id and physical type and index of the MPP */
+        std::unordered_map<uint64_t, m2m_share_state_t> mM2mShares;
+
+        /* Most recently used plan is at the front */
+        std::list<composition_plan_t> mCompositionPlans;
+        uint64_t mCompositionPlanHit;
+        uint64_t mCompositionPlanMiss;
+
+        /* Layers and pixels that were checked by updateFallbackStats(), per content */
+        std::atomic<uint64_t> mFallbackCheckedLayers[FALLBACK_CONTENT_NUM] = {};
+        std::atomic<uint64_t> mFallbackCheckedPixels[FALLBACK_CONTENT_NUM] = {};
+
+        /* Displays whose assignment was kept while other displays were re-assigned */
+        uint32_t mKeptAssignDisplayCnt = 0;
+        bool mSharedMPPConflict = false;
+        uint64_t mKeptAssignCount = 0;
+        uint64_t mSharedMPPConflictCount = 0;
+
         sp<DstBufMgrThread> mDstBufMgrThread;
 
+        mutable Mutex mDstBufPoolMutex;
+        std::list<dst_buf_pool_entry_t> mDstBufPool[DST_BUF_POOL_NUM];
+        uint64_t mDstBufPoolSize[DST_BUF_POOL_NUM] = {};
+        uint64_t mDstBufPoolHit = 0;
+        uint64_t mDstBufPoolMiss = 0;
+
     protected:
         virtual void setFrameRateForPerformance(ExynosMPP &mpp, AcrylicPerformanceRequestFrame *frame);
         void getCandidateScalingM2mMPPOutImages(const ExynosDisplay *display,
                                                 const exynos_image &src_img,
                                                 const exynos_image &dst_img,
                                                 std::vector<exynos_image> &image_lists);
+        void getCandidateScalingM2mMPPOutImagesInternal(const ExynosDisplay *display,
+                                                        const exynos_image &src_img,
+                                                        const exynos_image &dst_img,
+                                                        std::vector<exynos_image> &image_lists);
+        void checkSupportedMPPs(ExynosDisplay *display, exynos_image &src_img,
+                                exynos_image &dst_img, uint32_t &supportedMPPFlag,
+                                std::unordered_map<uint32_t, uint64_t> &checkMPPFlag);
+        /* Bumped to drop the mSupportedMPPFlag that layers keep */
+        uint64_t mSupportedGeneration = 1;
+        /* Aligned m2mMPP output images of getCandidateScalingM2mMPPOutImages() */
+        std::unordered_map<mpp_supported_key_t, std::vector<exynos_image>, MPPSupportedKeyHash>
+                mScalingOutImageCache;
         exynos_image getAlignedImage(exynos_image image, const ExynosMPP *m2mMpp,
                                      const ExynosMPP *otfMpp) const;
         static ExynosMPPVector mOtfMPPs;
         static ExynosMPPVector mM2mMPPs;
+        /* m2mMPPs that assignLayer() tries, indexed by [display->mUseDpu][g2dOnly] */
+        std::vector<ExynosMPP *> mM2mCandidates[2][2];
+        /* otfMPPs in the order assignLayer() tries them for the current layer */
+        std::vector<ExynosMPP *> mOtfCandidates;
         uint32_t mResourceReserved; /* Set MPP logical type for bit operation */
 };
 
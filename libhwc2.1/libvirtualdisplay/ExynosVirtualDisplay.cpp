@@ -16,7 +16,12 @@
 
 #undef LOG_TAG
 #define LOG_TAG "virtualdisplay"
+#define ATRACE_TAG (ATRACE_TAG_GRAPHICS | ATRACE_TAG_HAL)
 #include "ExynosVirtualDisplay.h"
+
+#include <sync/sync.h>
+#include <utils/Trace.h>
+
 #include "../libdevice/ExynosDevice.h"
 #include "../libdevice/ExynosLayer.h"
 
@@ -62,6 +67,24 @@ ExynosVirtualDisplay::ExynosVirtualDisplay(uint32_t index, ExynosDevice *device)
     mMaxTargetLuminance = 100;
     mSinkDeviceType = 0;
 
+    mBackpressureSkips = 0;
+    mBackpressureSkipsTotal = 0;
+    mFrameRateWindowStart = 0;
+    mPresentedInWindow = 0;
+    mSkippedInWindow = 0;
+    mEffectiveFps = 0;
+
+    mMirrorPrimary = false;
+    mIsMirroredFrame = false;
+    mMirrorWriteIndex = 0;
+    mMirrorReadbackRequested = false;
+    mMirrorBufWidth = 0;
+    mMirrorBufHeight = 0;
+    mMirrorBufFormat = 0;
+    mMirrorDataspace = HAL_DATASPACE_UNKNOWN;
+    mMirrorScaler = NULL;
+    mMirrorLayer = NULL;
+
     mUseDpu = false;
     mDisplayControl.enableExynosCompositionOptimization = false;
     mDisplayControl.enableClientCompositionOptimization = false;
@@ -71,7 +94,9 @@ ExynosVirtualDisplay::ExynosVirtualDisplay(uint32_t index, ExynosDevice *device)
 
 ExynosVirtualDisplay::~ExynosVirtualDisplay()
 {
-
+    freeMirrorBuffers();
+    delete mMirrorLayer;
+    delete mMirrorScaler;
 }
 
 void ExynosVirtualDisplay::createVirtualDisplay(uint32_t width, uint32_t height, int32_t* format)
@@ -109,6 +134,8 @@ void ExynosVirtualDisplay::destroyVirtualDisplay()
     mResourceManager->setTargetDisplayLuminance(mMinTargetLuminance, mMaxTargetLuminance);
     mResourceManager->setTargetDisplayDevice(mSinkDeviceType);
     mNeedReloadResourceForHWFC = false;
+    mMirrorPrimary = false;
+    freeMirrorBuffers();
 }
 
 int ExynosVirtualDisplay::setWFDMode(unsigned int mode)
@@ -146,6 +173,24 @@ int ExynosVirtualDisplay::sendWFDCommand(int32_t cmd, int32_t ext1, int32_t ext2
             mSinkDeviceType = ext1;
             mResourceManager->setTargetDisplayDevice(mSinkDeviceType);
             break;
+        case SET_MIRRORING_MODE:
+            /* ext1: enable, ext2: unused */
+            mMirrorPrimary = !!ext1;
+            if (mMirrorPrimary) {
+                ExynosDisplay *primary = mDevice->getDisplay(getDisplayId(HWC_DISPLAY_PRIMARY, 0));
+                int32_t format = 0;
+                if ((primary == NULL) ||
+                    (primary->getReadbackBufferAttributes(&format, &mMirrorDataspace) != NO_ERROR)) {
+                    ALOGW("mirroring mode is not supported without readback");
+                    mMirrorPrimary = false;
+                    ret = HWC2_ERROR_UNSUPPORTED;
+                    break;
+                }
+                mMirrorBufFormat = format;
+            } else {
+                freeMirrorBuffers();
+            }
+            break;
         default:
             ALOGE("invalid cmd(%d)", cmd);
             break;
@@ -236,8 +281,14 @@ int32_t ExynosVirtualDisplay::validateDisplay(
     /* validateDisplay should be called for preAssignResource */
     ret = ExynosDisplay::validateDisplay(outNumTypes, outNumRequests);
 
-    if (checkSkipFrame()) {
+    if (checkSkipFrame() || checkBackpressure()) {
         handleSkipFrame();
+    } else if (canMirrorPrimary()) {
+        /* nothing is composed for the sink, SurfaceFlinger neither */
+        for (size_t i = 0; i < mLayers.size(); i++)
+            mLayers[i]->mValidateCompositionType = HWC2_COMPOSITION_DEVICE;
+        mIsMirroredFrame = true;
+        mCompositionType = COMPOSITION_HWC;
     } else {
         setDrmMode();
         setSinkBufferUsage();
@@ -280,6 +331,7 @@ int32_t ExynosVirtualDisplay::presentDisplay(
         }
 
         handleAcquireFence();
+        updateFrameRate(false);
         /* this frame is not presented, but mRenderingState is updated to RENDERING_STATE_PRESENTED */
         mRenderingState = RENDERING_STATE_PRESENTED;
 
@@ -293,6 +345,16 @@ int32_t ExynosVirtualDisplay::presentDisplay(
         return ret;
     }
 
+    updateFrameRate(true);
+
+    if (mIsMirroredFrame) {
+        ret = presentMirroredFrame(outRetireFence);
+        mRenderingState = RENDERING_STATE_PRESENTED;
+        /* The resources assigned by validateDisplay() were not used */
+        setGeometryChanged(GEOMETRY_DISPLAY_FORCE_VALIDATE);
+        return ret;
+    }
+
     ret = ExynosDisplay::presentDisplay(outRetireFence);
 
     /* handle outbuf acquireFence */
@@ -424,6 +486,7 @@ void ExynosVirtualDisplay::setCompositionType()
 void ExynosVirtualDisplay::initPerFrameData()
 {
     mIsSkipFrame = false;
+    mIsMirroredFrame = false;
     mIsSecureDRM = false;
     mIsNormalDRM = false;
     mCompositionType = COMPOSITION_HWC;
@@ -462,6 +525,51 @@ bool ExynosVirtualDisplay::checkSkipFrame()
     return false;
 }
 
+bool ExynosVirtualDisplay::checkBackpressure()
+{
+    /* The encoder gave the sink buffer back, or nobody waits for it */
+    if ((mOutputBufferAcquireFenceFd < 0) || (sync_wait(mOutputBufferAcquireFenceFd, 0) == 0)) {
+        mBackpressureSkips = 0;
+        return false;
+    }
+
+    /* The sink still gets a frame now and then under congestion */
+    if (mBackpressureSkips >= kMaxBackpressureSkips) {
+        mBackpressureSkips = 0;
+        return false;
+    }
+
+    mBackpressureSkips++;
+    mBackpressureSkipsTotal++;
+    DISPLAY_LOGD(eDebugVirtualDisplay, "checkBackpressure(), sink buffer is busy, skips %u",
+            mBackpressureSkips);
+    return true;
+}
+
+void ExynosVirtualDisplay::updateFrameRate(bool presented)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    if (presented)
+        mPresentedInWindow++;
+    else
+        mSkippedInWindow++;
+
+    if (now - mFrameRateWindowStart < s2ns(1))
+        return;
+
+    if (mFrameRateWindowStart != 0) {
+        mEffectiveFps = mPresentedInWindow * s2ns(1) / (now - mFrameRateWindowStart);
+        ATRACE_INT("VirtualDisplayFps", mEffectiveFps);
+        DISPLAY_LOGD(eDebugVirtualDisplay, "effective fps %u, presented %u, skipped %u "
+                "(backpressure %u in total)", mEffectiveFps, mPresentedInWindow,
+                mSkippedInWindow, mBackpressureSkipsTotal);
+    }
+    mFrameRateWindowStart = now;
+    mPresentedInWindow = 0;
+    mSkippedInWindow = 0;
+}
+
 void ExynosVirtualDisplay::setDrmMode()
 {
     mIsSecureDRM = false;
@@ -529,3 +637,183 @@ int32_t ExynosVirtualDisplay::getHdrCapabilities(uint32_t* outNumTypes,
     outTypes[0] = HAL_HDR_HDR10;
     return 0;
 }
+
+bool ExynosVirtualDisplay::canMirrorPrimary()
+{
+    if (!mMirrorPrimary || (mOutputBuffer == NULL))
+        return false;
+
+    ExynosDisplay *primary = mDevice->getDisplay(getDisplayId(HWC_DISPLAY_PRIMARY, 0));
+    if ((primary == NULL) || (primary->mPowerModeState == HWC2_POWER_MODE_OFF))
+        return false;
+
+    /* Protected contents can't be written back to a normal buffer */
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        ExynosLayer *layer = mLayers[i];
+        if (layer->mLayerBuffer && getDrmMode(layer->mLayerBuffer) == SECURE_DRM)
+            return false;
+    }
+
+    /* The readback is taken by others such as screenshots */
+    if (primary->mDpuData.enable_readback &&
+        (!mMirrorReadbackRequested ||
+         (primary->mDpuData.readback_info.handle != mMirrorBufs[mMirrorWriteIndex].handle)))
+        return false;
+
+    if ((mMirrorBufWidth != primary->mXres) || (mMirrorBufHeight != primary->mYres) ||
+        (mMirrorBufs[0].handle == NULL)) {
+        freeMirrorBuffers();
+        if (allocMirrorBuffers(primary->mXres, primary->mYres, mMirrorBufFormat) != NO_ERROR) {
+            freeMirrorBuffers();
+            return false;
+        }
+    }
+
+    if (mMirrorScaler == NULL) {
+        mMirrorScaler = Acrylic::createScaler();
+        if (mMirrorScaler == NULL)
+            return false;
+        mMirrorLayer = mMirrorScaler->createLayer();
+        if (mMirrorLayer == NULL) {
+            delete mMirrorScaler;
+            mMirrorScaler = NULL;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int32_t ExynosVirtualDisplay::allocMirrorBuffers(uint32_t width, uint32_t height,
+        uint32_t format)
+{
+    VendorGraphicBufferAllocator& gAllocator(VendorGraphicBufferAllocator::get());
+    uint64_t usage = BufferUsage::COMPOSER_OVERLAY | VendorGraphicBufferUsage::NO_AFBC;
+
+    for (uint32_t i = 0; i < kMirrorBufNum; i++) {
+        uint32_t stride;
+        status_t error = gAllocator.allocate(width, height, format, 1, usage,
+                &mMirrorBufs[i].handle, &stride, "HWC");
+        if ((error != NO_ERROR) || (mMirrorBufs[i].handle == NULL)) {
+            DISPLAY_LOGE("failed to allocate mirroring buffer(%dx%d): %d", width, height, error);
+            mMirrorBufs[i].handle = NULL;
+            return -ENOMEM;
+        }
+    }
+
+    mMirrorBufWidth = width;
+    mMirrorBufHeight = height;
+    mMirrorWriteIndex = 0;
+    mMirrorReadbackRequested = false;
+    return NO_ERROR;
+}
+
+void ExynosVirtualDisplay::freeMirrorBuffers()
+{
+    VendorGraphicBufferAllocator& gAllocator(VendorGraphicBufferAllocator::get());
+    ExynosDisplay *primary = mDevice->getDisplay(getDisplayId(HWC_DISPLAY_PRIMARY, 0));
+
+    for (uint32_t i = 0; i < kMirrorBufNum; i++) {
+        if (mMirrorBufs[i].handle == NULL)
+            continue;
+        /* withdraw the pending readback before the buffer is gone */
+        if ((primary != NULL) && mMirrorReadbackRequested &&
+            (primary->mDpuData.readback_info.handle == mMirrorBufs[i].handle)) {
+            TimedMutex::Autolock lock(primary->getDisplayMutex());
+            primary->mDpuData.enable_readback = false;
+            primary->setReadbackBufferInternal(NULL, -1, false);
+            primary->mDpuData.readback_info.handle = NULL;
+        }
+        mMirrorBufs[i].releaseFence = fence_close(mMirrorBufs[i].releaseFence, this,
+                FENCE_TYPE_READBACK_RELEASE, FENCE_IP_MSC);
+        gAllocator.free(mMirrorBufs[i].handle);
+        mMirrorBufs[i].handle = NULL;
+    }
+
+    mMirrorBufWidth = 0;
+    mMirrorBufHeight = 0;
+    mMirrorReadbackRequested = false;
+}
+
+/*
+ * Scales the frame that the primary display wrote back in its present of
+ * this frame into the sink buffer and requests the readback of the next one.
+ * The first mirrored frame has nothing written back yet and keeps the sink
+ * buffer as it is.
+ */
+int32_t ExynosVirtualDisplay::presentMirroredFrame(int32_t* outRetireFence)
+{
+    ExynosDisplay *primary = mDevice->getDisplay(getDisplayId(HWC_DISPLAY_PRIMARY, 0));
+    int32_t readbackFence = -1;
+    int32_t sinkFence = -1;
+    bool written = mMirrorReadbackRequested &&
+        (primary->getReadbackBufferFence(&readbackFence) == NO_ERROR);
+
+    if (written) {
+        MirrorBuffer &src = mMirrorBufs[mMirrorWriteIndex];
+        VendorGraphicBufferMeta srcMeta(src.handle);
+        VendorGraphicBufferMeta dstMeta(mOutputBuffer);
+        int srcFds[MAX_HW2D_PLANES] = {srcMeta.fd, srcMeta.fd1, srcMeta.fd2};
+        int dstFds[MAX_HW2D_PLANES] = {dstMeta.fd, dstMeta.fd1, dstMeta.fd2};
+        size_t srcLen[MAX_HW2D_PLANES], dstLen[MAX_HW2D_PLANES];
+        uint32_t srcNum = getBufferNumOfFormat(srcMeta.format, getCompressionType(src.handle));
+        uint32_t dstNum = getBufferNumOfFormat(dstMeta.format, getCompressionType(mOutputBuffer));
+        hwc_rect_t srcRect = {0, 0, (int)mMirrorBufWidth, (int)mMirrorBufHeight};
+        hwc_rect_t dstRect = {0, 0, (int)mDisplayWidth, (int)mDisplayHeight};
+        android_dataspace_t dstDataspace = isFormatRgb(dstMeta.format) ? HAL_DATASPACE_V0_SRGB :
+            (android_dataspace)(HAL_DATASPACE_STANDARD_BT709 | HAL_DATASPACE_TRANSFER_GAMMA2_2 |
+                                HAL_DATASPACE_RANGE_LIMITED);
+        int fences[2] = {-1, -1};
+
+        setFenceInfo(readbackFence, this, FENCE_TYPE_READBACK_ACQUIRE, FENCE_IP_MSC, FENCE_TO);
+        setFenceInfo(mOutputBufferAcquireFenceFd, this, FENCE_TYPE_DST_ACQUIRE, FENCE_IP_MSC,
+                FENCE_TO);
+
+        if ((srcNum == 0) || (dstNum == 0) ||
+            (getBufLength(src.handle, MAX_HW2D_PLANES, srcLen, srcMeta.format,
+                          srcMeta.stride, srcMeta.vstride) != NO_ERROR) ||
+            (getBufLength(mOutputBuffer, MAX_HW2D_PLANES, dstLen, dstMeta.format,
+                          dstMeta.stride, dstMeta.vstride) != NO_ERROR) ||
+            !mMirrorLayer->setImageDimension(srcMeta.stride, srcMeta.vstride) ||
+            !mMirrorLayer->setImageType(srcMeta.format, mMirrorDataspace) ||
+            !mMirrorLayer->setImageBuffer(srcFds, srcLen, srcNum, readbackFence) ||
+            !mMirrorLayer->setCompositArea(srcRect, dstRect) ||
+            !mMirrorScaler->setCanvasDimension(dstMeta.stride, dstMeta.vstride) ||
+            !mMirrorScaler->setCanvasImageType(dstMeta.format, dstDataspace) ||
+            !mMirrorScaler->setCanvasBuffer(dstFds, dstLen, dstNum, mOutputBufferAcquireFenceFd) ||
+            !mMirrorScaler->execute(fences, 2)) {
+            DISPLAY_LOGE("%s:: failed to scale the mirrored frame", __func__);
+            fences[0] = fence_close(fences[0], this, FENCE_TYPE_READBACK_RELEASE, FENCE_IP_MSC);
+            fences[1] = fence_close(fences[1], this, FENCE_TYPE_DST_RELEASE, FENCE_IP_MSC);
+        }
+        /* the fences are owned by the scaler once they are configured */
+        mOutputBufferAcquireFenceFd = -1;
+
+        setFenceInfo(fences[0], this, FENCE_TYPE_READBACK_RELEASE, FENCE_IP_MSC, FENCE_FROM);
+        setFenceInfo(fences[1], this, FENCE_TYPE_DST_RELEASE, FENCE_IP_MSC, FENCE_FROM);
+        src.releaseFence = fences[0];
+        sinkFence = fences[1];
+        mMirrorWriteIndex = (mMirrorWriteIndex + 1) % kMirrorBufNum;
+    }
+
+    /* The layers are not read and the sink buffer is given back untouched if not written */
+    handleAcquireFence();
+    if (written) {
+        mOutputBufferReleaseFenceFd = fence_close(mOutputBufferReleaseFenceFd, this,
+                FENCE_TYPE_DST_RELEASE, FENCE_IP_MSC);
+        mOutputBufferReleaseFenceFd = sinkFence;
+    }
+
+    MirrorBuffer &next = mMirrorBufs[mMirrorWriteIndex];
+    primary->setReadbackBuffer(next.handle, next.releaseFence, true);
+    next.releaseFence = -1;
+    mMirrorReadbackRequested = true;
+
+    *outRetireFence = mOutputBufferReleaseFenceFd;
+    mOutputBufferReleaseFenceFd = -1;
+
+    DISPLAY_LOGD(eDebugVirtualDisplay, "presentMirroredFrame(), written %d, outRetireFence %d",
+            written, *outRetireFence);
+
+    return HWC2_ERROR_NONE;
+}
@@ -35,6 +35,7 @@ enum WFDCommand {
     SET_WFD_MODE,
     SET_TARGET_DISPLAY_LUMINANCE,
     SET_TARGET_DISPLAY_DEVICE,
+    SET_MIRRORING_MODE,
 };
 
 class ExynosVirtualDisplay : public ExynosDisplay {
@@ -60,6 +61,7 @@ public:
     void getWFDOutputResolution(unsigned int *width, unsigned int *height);
     void setPresentationMode(bool use);
     int getPresentationMode(void);
+    uint32_t getEffectiveFps() { return mEffectiveFps; }
     int setVDSGlesFormat(int format);
 
     /* setOutputBuffer(..., buffer, releaseFence)
@@ -145,10 +147,27 @@ protected:
 
     bool checkSkipFrame();
 
+    /*
+     * Skips the composition while the sink buffer is still held by the
+     * encoder, it would be dropped downstream anyway.
+     */
+    bool checkBackpressure();
+    void updateFrameRate(bool presented);
+
     void handleSkipFrame();
 
     void handleAcquireFence();
 
+    /*
+     * Mirroring mode: the output of the primary DPU is captured through its
+     * writeback connector and scaled into the sink buffer by one M2M pass
+     * instead of composing the layers of the virtual display again.
+     */
+    bool canMirrorPrimary();
+    int32_t presentMirroredFrame(int32_t* outRetireFence);
+    int32_t allocMirrorBuffers(uint32_t width, uint32_t height, uint32_t format);
+    void freeMirrorBuffers();
+
     /**
      * Display width, height information set by surfaceflinger
      */
@@ -214,6 +233,43 @@ protected:
      * WFD engine will set this values.
      */
     int32_t mSinkDeviceType;
+
+    /**
+     * Mirroring mode requested by SET_MIRRORING_MODE and whether the
+     * current frame is presented by it
+     */
+    /**
+     * Backpressure of the encoder: frames skipped in a row because the sink
+     * buffer wasn't released, and the frame rate that reached the sink during
+     * the last second
+     */
+    static constexpr uint32_t kMaxBackpressureSkips = 4;
+    uint32_t mBackpressureSkips;
+    uint32_t mBackpressureSkipsTotal;
+    nsecs_t mFrameRateWindowStart;
+    uint32_t mPresentedInWindow;
+    uint32_t mSkippedInWindow;
+    uint32_t mEffectiveFps;
+
+    bool mMirrorPrimary;
+    bool mIsMirroredFrame;
+
+    static constexpr uint32_t kMirrorBufNum = 2;
+    struct MirrorBuffer {
+        buffer_handle_t handle = NULL;
+        /* signaled when the scaler is done reading the buffer */
+        int32_t releaseFence = -1;
+    } mMirrorBufs[kMirrorBufNum];
+    /* buffer that the primary display writes back in its next present */
+    uint32_t mMirrorWriteIndex;
+    /* whether mMirrorBufs[mMirrorWriteIndex] was requested to the primary */
+    bool mMirrorReadbackRequested;
+    uint32_t mMirrorBufWidth;
+    uint32_t mMirrorBufHeight;
+    uint32_t mMirrorBufFormat;
+    int32_t mMirrorDataspace;
+    Acrylic *mMirrorScaler;
+    AcrylicLayer *mMirrorLayer;
 };
 
 #endif
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer2.h>
+
+#include "VendorGraphicBuffer.h"
+#include "exynos_format.h"
+
+/*
+ * Measures validateDisplay() of the primary display, that is the resource
+ * assignment of ExynosResourceManager, on synthetic layer stacks. The composer
+ * service must be stopped. The results are stored with RecordProperty() as
+ * "<case>.<key>" like the ion benchmarks; gpu_fallback is the number of layers
+ * the HWC changed to client composition.
+ */
+#define BENCH_ITERATIONS 64
+
+using namespace std;
+using namespace vendor::graphics;
+using bench_clock = chrono::steady_clock;
+
+namespace {
+
+struct LayerDesc {
+    uint32_t width;
+    uint32_t height;
+    int32_t format;
+    uint64_t usage;
+    int32_t dataspace;
+    int32_t transform;
+    hwc_rect_t frame;
+};
+
+constexpr uint64_t kUsage = GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE;
+
+} // namespace
+
+class ResourceBenchmark : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {
+        const hw_module_t *module = nullptr;
+        if (hw_get_module(HWC_HARDWARE_MODULE_ID, &module) || hwc2_open(module, &sDevice)) {
+            sDevice = nullptr;
+            return;
+        }
+        fn<HWC2_PFN_SET_POWER_MODE>(HWC2_FUNCTION_SET_POWER_MODE)(sDevice, kDisplay,
+                HWC2_POWER_MODE_ON);
+
+        hwc2_config_t config;
+        fn<HWC2_PFN_GET_ACTIVE_CONFIG>(HWC2_FUNCTION_GET_ACTIVE_CONFIG)(sDevice, kDisplay, &config);
+        auto getAttribute = fn<HWC2_PFN_GET_DISPLAY_ATTRIBUTE>(HWC2_FUNCTION_GET_DISPLAY_ATTRIBUTE);
+        getAttribute(sDevice, kDisplay, config, HWC2_ATTRIBUTE_WIDTH, &sWidth);
+        getAttribute(sDevice, kDisplay, config, HWC2_ATTRIBUTE_HEIGHT, &sHeight);
+    }
+
+    static void TearDownTestSuite() {
+        if (sDevice == nullptr)
+            return;
+        fn<HWC2_PFN_SET_POWER_MODE>(HWC2_FUNCTION_SET_POWER_MODE)(sDevice, kDisplay,
+                HWC2_POWER_MODE_OFF);
+        hwc2_close(sDevice);
+        sDevice = nullptr;
+    }
+
+    void SetUp() override {
+        ASSERT_NE(nullptr, sDevice) << "failed to open the composer HAL";
+    }
+
+    void TearDown() override {
+        auto destroyLayer = fn<HWC2_PFN_DESTROY_LAYER>(HWC2_FUNCTION_DESTROY_LAYER);
+        for (hwc2_layer_t layer : mLayers)
+            destroyLayer(sDevice, kDisplay, layer);
+        mLayers.clear();
+
+        for (buffer_handle_t handle : mBuffers)
+            VendorGraphicBufferAllocator::get().free(handle);
+        mBuffers.clear();
+    }
+
+    template <typename PFN>
+    static PFN fn(hwc2_function_descriptor_t descriptor) {
+        return reinterpret_cast<PFN>(sDevice->getFunction(sDevice, descriptor));
+    }
+
+    // Returns false if the buffer cannot be allocated, e.g. protected memory is not available
+    bool addLayer(const LayerDesc &desc) {
+        buffer_handle_t handle = nullptr;
+        uint32_t stride = 0;
+        if (VendorGraphicBufferAllocator::get().allocate(desc.width, desc.height, desc.format, 1,
+                    desc.usage, &handle, &stride, "hwcbench") != 0)
+            return false;
+        mBuffers.push_back(handle);
+
+        hwc2_layer_t layer;
+        if (fn<HWC2_PFN_CREATE_LAYER>(HWC2_FUNCTION_CREATE_LAYER)(sDevice, kDisplay, &layer) !=
+                HWC2_ERROR_NONE)
+            return false;
+        mLayers.push_back(layer);
+        if (mLayers.size() == 1)
+            mFirstFrame = desc.frame;
+
+        hwc_frect_t crop = {0, 0, (float)desc.width, (float)desc.height};
+        fn<HWC2_PFN_SET_LAYER_BUFFER>(HWC2_FUNCTION_SET_LAYER_BUFFER)(sDevice, kDisplay, layer,
+                handle, -1);
+        fn<HWC2_PFN_SET_LAYER_COMPOSITION_TYPE>(HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE)(
+                sDevice, kDisplay, layer, HWC2_COMPOSITION_DEVICE);
+        fn<HWC2_PFN_SET_LAYER_BLEND_MODE>(HWC2_FUNCTION_SET_LAYER_BLEND_MODE)(sDevice, kDisplay,
+                layer, HWC2_BLEND_MODE_PREMULTIPLIED);
+        fn<HWC2_PFN_SET_LAYER_DATASPACE>(HWC2_FUNCTION_SET_LAYER_DATASPACE)(sDevice, kDisplay,
+                layer, desc.dataspace);
+        fn<HWC2_PFN_SET_LAYER_TRANSFORM>(HWC2_FUNCTION_SET_LAYER_TRANSFORM)(sDevice, kDisplay,
+                layer, desc.transform);
+        fn<HWC2_PFN_SET_LAYER_SOURCE_CROP>(HWC2_FUNCTION_SET_LAYER_SOURCE_CROP)(sDevice, kDisplay,
+                layer, crop);
+        fn<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME)(sDevice,
+                kDisplay, layer, desc.frame);
+        fn<HWC2_PFN_SET_LAYER_PLANE_ALPHA>(HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA)(sDevice, kDisplay,
+                layer, 1.0f);
+        fn<HWC2_PFN_SET_LAYER_Z_ORDER>(HWC2_FUNCTION_SET_LAYER_Z_ORDER)(sDevice, kDisplay, layer,
+                mLayers.size());
+        return true;
+    }
+
+    LayerDesc uiLayer(hwc_rect_t frame) {
+        return {(uint32_t)(frame.right - frame.left), (uint32_t)(frame.bottom - frame.top),
+                HAL_PIXEL_FORMAT_RGBA_8888, kUsage, HAL_DATASPACE_V0_SRGB, 0, frame};
+    }
+
+    LayerDesc fullScreen(uint32_t width, uint32_t height, int32_t format) {
+        return {width, height, format, kUsage, HAL_DATASPACE_V0_BT709, 0,
+                {0, 0, sWidth, sHeight}};
+    }
+
+    /*
+     * Runs validateDisplay() with the geometry changed before every call so that
+     * the resources are assigned again. The display frame of the first layer is
+     * shrunk by one pixel on every other call for that.
+     */
+    void run(const string &name) {
+        auto setDisplayFrame = fn<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(
+                HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME);
+        auto validateDisplay = fn<HWC2_PFN_VALIDATE_DISPLAY>(HWC2_FUNCTION_VALIDATE_DISPLAY);
+        auto getChangedTypes = fn<HWC2_PFN_GET_CHANGED_COMPOSITION_TYPES>(
+                HWC2_FUNCTION_GET_CHANGED_COMPOSITION_TYPES);
+        vector<uint64_t> samples;
+        uint32_t fallback = 0;
+
+        ASSERT_FALSE(mLayers.empty());
+        for (int n = 0; n < BENCH_ITERATIONS; n++) {
+            hwc_rect_t frame = mFirstFrame;
+            frame.right -= (n & 1);
+            setDisplayFrame(sDevice, kDisplay, mLayers[0], frame);
+
+            uint32_t numTypes = 0, numRequests = 0;
+            auto begin = bench_clock::now();
+            int32_t ret = validateDisplay(sDevice, kDisplay, &numTypes, &numRequests);
+            samples.push_back(chrono::duration_cast<chrono::nanoseconds>(
+                        bench_clock::now() - begin).count());
+            ASSERT_TRUE(ret == HWC2_ERROR_NONE || ret == HWC2_ERROR_HAS_CHANGES) << ret;
+
+            fallback = 0;
+            if (numTypes) {
+                vector<hwc2_layer_t> layers(numTypes);
+                vector<int32_t> types(numTypes);
+                getChangedTypes(sDevice, kDisplay, &numTypes, layers.data(), types.data());
+                fallback = count(types.begin(), types.end(), HWC2_COMPOSITION_CLIENT);
+            }
+        }
+
+        sort(samples.begin(), samples.end());
+        uint64_t sum = 0;
+        for (uint64_t ns : samples)
+            sum += ns;
+
+        RecordProperty(name + ".layers", static_cast<int>(mLayers.size()));
+        RecordProperty(name + ".mean_ns", static_cast<int>(sum / samples.size()));
+        RecordProperty(name + ".p50_ns", static_cast<int>(samples[samples.size() / 2]));
+        RecordProperty(name + ".p99_ns", static_cast<int>(samples[(samples.size() * 99) / 100]));
+        RecordProperty(name + ".gpu_fallback", static_cast<int>(fallback));
+    }
+
+    static constexpr hwc2_display_t kDisplay = 0;
+    static hwc2_device_t *sDevice;
+    static int32_t sWidth;
+    static int32_t sHeight;
+
+    vector<hwc2_layer_t> mLayers;
+    vector<buffer_handle_t> mBuffers;
+    hwc_rect_t mFirstFrame;
+};
+
+hwc2_device_t *ResourceBenchmark::sDevice = nullptr;
+int32_t ResourceBenchmark::sWidth = 0;
+int32_t ResourceBenchmark::sHeight = 0;
+
+TEST_F(ResourceBenchmark, UiLayers)
+{
+    static const unsigned int bench_layers[] = { 1, 2, 4, 8, 12, 16 };
+
+    for (unsigned int num : bench_layers) {
+        SCOPED_TRACE(::testing::Message() << "layers: " << num);
+        for (unsigned int i = 0; i < num; i++)
+            ASSERT_TRUE(addLayer(uiLayer({0, 0, sWidth, sHeight})));
+        run("ui." + to_string(num));
+        TearDown();
+    }
+}
+
+TEST_F(ResourceBenchmark, ScaledVideo)
+{
+    ASSERT_TRUE(addLayer(fullScreen(1920, 1080, HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M)));
+    ASSERT_TRUE(addLayer(uiLayer({0, sHeight - 200, sWidth, sHeight})));
+    run("video");
+}
+
+TEST_F(ResourceBenchmark, RotatedCameraPreview)
+{
+    LayerDesc preview = fullScreen(1920, 1080, HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M);
+    preview.transform = HAL_TRANSFORM_ROT_90;
+    preview.usage |= GRALLOC_USAGE_HW_CAMERA_WRITE;
+    ASSERT_TRUE(addLayer(preview));
+    ASSERT_TRUE(addLayer(uiLayer({0, 0, sWidth, 200})));
+    run("camera");
+}
+
+TEST_F(ResourceBenchmark, HdrVideo)
+{
+    LayerDesc hdr = fullScreen(3840, 2160, HAL_PIXEL_FORMAT_YCBCR_P010);
+    hdr.dataspace = HAL_DATASPACE_STANDARD_BT2020 | HAL_DATASPACE_TRANSFER_ST2084 |
+        HAL_DATASPACE_RANGE_LIMITED;
+    ASSERT_TRUE(addLayer(hdr));
+    ASSERT_TRUE(addLayer(uiLayer({0, sHeight - 200, sWidth, sHeight})));
+    run("hdr");
+}
+
+TEST_F(ResourceBenchmark, SecureVideo)
+{
+    LayerDesc secure = fullScreen(1920, 1080, HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M);
+    secure.usage |= GRALLOC_USAGE_PROTECTED;
+    if (!addLayer(secure))
+        GTEST_SKIP() << "protected buffers are not available";
+    ASSERT_TRUE(addLayer(uiLayer({0, sHeight - 200, sWidth, sHeight})));
+    run("secure");
+}
+
+TEST_F(ResourceBenchmark, ManySmallLayers)
+{
+    const int32_t size = 64;
+
+    for (int i = 0; i < 32; i++) {
+        int32_t x = (i % 8) * size * 2, y = (i / 8) * size * 2;
+        ASSERT_TRUE(addLayer(uiLayer({x, y, x + size, y + size})));
+    }
+    run("small");
+}
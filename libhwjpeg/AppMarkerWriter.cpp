@@ -44,12 +44,14 @@ CEndianessChecker::CEndianessChecker()
 
 
 CAppMarkerWriter::CAppMarkerWriter()
-        : m_pAppBase(NULL), m_pApp1End(NULL), m_pExif(NULL), m_pExtra(NULL)
+        : m_pAppBase(NULL), m_pApp1End(NULL), m_pExif(NULL), m_pExtra(NULL),
+          m_bTemplateMode(false), m_bRecordTemplate(false), m_nTemplateHash(0)
 {
     Init();
 }
 
 CAppMarkerWriter::CAppMarkerWriter(char *base, exif_attribute_t *exif, debug_attribute_t *debug)
+        : m_bTemplateMode(false), m_bRecordTemplate(false), m_nTemplateHash(0)
 {
     extra_appinfo_t extraInfo;
     app_info_t appInfo[15];
@@ -360,6 +362,7 @@ char *CAppMarkerWriter::WriteAPP1(char *current, bool reserve_thumbnail_space, b
     CIFDWriter writer(tiffheader, current, m_n0thIFDFields);
 
     writer.WriteShort(EXIF_TAG_ORIENTATION, 1, &m_pExif->orientation);
+    RecordPatch(writer, sizeof(uint16_t), EXIF_PATCH_ORIENTATION);
     writer.WriteShort(EXIF_TAG_YCBCR_POSITIONING, 1, &m_pExif->ycbcr_positioning);
     writer.WriteRational(EXIF_TAG_X_RESOLUTION, 1, &m_pExif->x_resolution);
     writer.WriteRational(EXIF_TAG_Y_RESOLUTION, 1, &m_pExif->y_resolution);
@@ -371,49 +374,66 @@ char *CAppMarkerWriter::WriteAPP1(char *current, bool reserve_thumbnail_space, b
     if (m_szSoftware > 0)
         writer.WriteASCII(EXIF_TAG_SOFTWARE, m_szSoftware + 1, m_pExif->software);
     writer.WriteCString(EXIF_TAG_DATE_TIME, EXIF_DATETIME_LENGTH, m_pExif->date_time);
+    RecordPatch(writer, EXIF_DATETIME_LENGTH, EXIF_PATCH_DATE_TIME);
 
     char *pSubIFDBase = writer.BeginSubIFD(EXIF_TAG_EXIF_IFD_POINTER);
     if (pSubIFDBase) { // This should be always true!!
         CIFDWriter exifwriter(tiffheader, pSubIFDBase, m_nExifIFDFields);
         exifwriter.WriteRational(EXIF_TAG_EXPOSURE_TIME, 1, &m_pExif->exposure_time);
+        RecordPatch(exifwriter, sizeof(rational_t), EXIF_PATCH_EXPOSURE_TIME);
         exifwriter.WriteRational(EXIF_TAG_FNUMBER, 1, &m_pExif->fnumber);
         exifwriter.WriteShort(EXIF_TAG_EXPOSURE_PROGRAM, 1, &m_pExif->exposure_program);
         exifwriter.WriteShort(EXIF_TAG_ISO_SPEED_RATING, 1, &m_pExif->iso_speed_rating);
+        RecordPatch(exifwriter, sizeof(uint16_t), EXIF_PATCH_ISO_SPEED_RATING);
         exifwriter.WriteUndef(EXIF_TAG_EXIF_VERSION, 4, reinterpret_cast<unsigned char *>(m_pExif->exif_version));
         exifwriter.WriteCString(EXIF_TAG_DATE_TIME_ORG, EXIF_DATETIME_LENGTH, m_pExif->date_time);
+        RecordPatch(exifwriter, EXIF_DATETIME_LENGTH, EXIF_PATCH_DATE_TIME);
         exifwriter.WriteCString(EXIF_TAG_DATE_TIME_DIGITIZE, EXIF_DATETIME_LENGTH, m_pExif->date_time);
+        RecordPatch(exifwriter, EXIF_DATETIME_LENGTH, EXIF_PATCH_DATE_TIME);
         exifwriter.WriteSRational(EXIF_TAG_SHUTTER_SPEED, 1, &m_pExif->shutter_speed);
+        RecordPatch(exifwriter, sizeof(srational_t), EXIF_PATCH_SHUTTER_SPEED);
         exifwriter.WriteRational(EXIF_TAG_APERTURE, 1, &m_pExif->aperture);
         exifwriter.WriteSRational(EXIF_TAG_BRIGHTNESS, 1, &m_pExif->brightness);
+        RecordPatch(exifwriter, sizeof(srational_t), EXIF_PATCH_BRIGHTNESS);
         exifwriter.WriteSRational(EXIF_TAG_EXPOSURE_BIAS, 1, &m_pExif->exposure_bias);
+        RecordPatch(exifwriter, sizeof(srational_t), EXIF_PATCH_EXPOSURE_BIAS);
         exifwriter.WriteRational(EXIF_TAG_MAX_APERTURE, 1, &m_pExif->max_aperture);
         exifwriter.WriteShort(EXIF_TAG_METERING_MODE, 1, &m_pExif->metering_mode);
         exifwriter.WriteShort(EXIF_TAG_FLASH, 1, &m_pExif->flash);
+        RecordPatch(exifwriter, sizeof(uint16_t), EXIF_PATCH_FLASH);
         exifwriter.WriteUndef(EXIF_TAG_FLASHPIX_VERSION, 4, reinterpret_cast<const unsigned char *>("0100"));
         exifwriter.WriteUndef(EXIF_TAG_COMPONENTS_CONFIGURATION, 4, ComponentsConfiguration);
         exifwriter.WriteRational(EXIF_TAG_FOCAL_LENGTH, 1, &m_pExif->focal_length);
         exifwriter.WriteCString(EXIF_TAG_SUBSEC_TIME, EXIF_SUBSECTIME_LENGTH, m_pExif->sec_time);
+        RecordPatch(exifwriter, EXIF_SUBSECTIME_LENGTH, EXIF_PATCH_SUBSEC_TIME);
         exifwriter.WriteCString(EXIF_TAG_SUBSEC_TIME_ORIG, EXIF_SUBSECTIME_LENGTH, m_pExif->sec_time);
+        RecordPatch(exifwriter, EXIF_SUBSECTIME_LENGTH, EXIF_PATCH_SUBSEC_TIME);
         exifwriter.WriteCString(EXIF_TAG_SUBSEC_TIME_DIG, EXIF_SUBSECTIME_LENGTH, m_pExif->sec_time);
+        RecordPatch(exifwriter, EXIF_SUBSECTIME_LENGTH, EXIF_PATCH_SUBSEC_TIME);
         if (m_pExif->maker_note_size > 0)
             exifwriter.WriteUndef(EXIF_TAG_MAKER_NOTE, m_pExif->maker_note_size, m_pExif->maker_note);
         if (m_pExif->user_comment_size > 0)
             exifwriter.WriteUndef(EXIF_TAG_USER_COMMENT, m_pExif->user_comment_size, m_pExif->user_comment);
         exifwriter.WriteShort(EXIF_TAG_COLOR_SPACE, 1, &m_pExif->color_space);
         exifwriter.WriteLong(EXIF_TAG_PIXEL_X_DIMENSION, 1, &m_pExif->width);
+        RecordPatch(exifwriter, sizeof(uint32_t), EXIF_PATCH_PIXEL_X_DIMENSION);
         exifwriter.WriteLong(EXIF_TAG_PIXEL_Y_DIMENSION, 1, &m_pExif->height);
+        RecordPatch(exifwriter, sizeof(uint32_t), EXIF_PATCH_PIXEL_Y_DIMENSION);
         exifwriter.WriteUndef(EXIF_TAG_SCENE_TYPE, sizeof(SceneType), SceneType);
         exifwriter.WriteShort(EXIF_TAG_CUSTOM_RENDERED, 1, &m_pExif->custom_rendered);
         exifwriter.WriteShort(EXIF_TAG_EXPOSURE_MODE, 1, &m_pExif->exposure_mode);
         exifwriter.WriteShort(EXIF_TAG_WHITE_BALANCE, 1, &m_pExif->white_balance);
+        RecordPatch(exifwriter, sizeof(uint16_t), EXIF_PATCH_WHITE_BALANCE);
         exifwriter.WriteRational(EXIF_TAG_DIGITAL_ZOOM_RATIO, 1, &m_pExif->digital_zoom_ratio);
         exifwriter.WriteShort(EXIF_TAG_FOCA_LENGTH_IN_35MM_FILM, 1, &m_pExif->focal_length_in_35mm_length);
         exifwriter.WriteShort(EXIF_TAG_SCENCE_CAPTURE_TYPE, 1, &m_pExif->scene_capture_type);
         exifwriter.WriteShort(EXIF_TAG_CONTRAST, 1, &m_pExif->contrast);
         exifwriter.WriteShort(EXIF_TAG_SATURATION, 1, &m_pExif->saturation);
         exifwriter.WriteShort(EXIF_TAG_SHARPNESS, 1, &m_pExif->sharpness);
-        if (m_szUniqueID > 0)
+        if (m_szUniqueID > 0) {
             exifwriter.WriteASCII(EXIF_TAG_IMAGE_UNIQUE_ID, m_szUniqueID + 1, m_pExif->unique_id);
+            RecordPatch(exifwriter, m_szUniqueID + 1, EXIF_PATCH_IMAGE_UNIQUE_ID);
+        }
         pSubIFDBase = exifwriter.BeginSubIFD(EXIF_TAG_INTEROPERABILITY);
         if (pSubIFDBase) {
             CIFDWriter interopwriter(tiffheader, pSubIFDBase, 2);
@@ -477,6 +497,7 @@ char *CAppMarkerWriter::WriteAPP1(char *current, bool reserve_thumbnail_space, b
         thumbwriter.WriteLong(EXIF_TAG_IMAGE_HEIGHT, 1, &m_pExif->heightThumb);
         thumbwriter.WriteShort(EXIF_TAG_COMPRESSION_SCHEME, 1, &m_pExif->compression_scheme);
         thumbwriter.WriteShort(EXIF_TAG_ORIENTATION, 1, &m_pExif->orientation);
+        RecordPatch(thumbwriter, sizeof(uint16_t), EXIF_PATCH_ORIENTATION);
 
         ALOG_ASSERT(thumbwriter.GetNextIFDBase() != m_pThumbBase);
         uint32_t offset = thumbwriter.Offset(m_pThumbBase);
@@ -496,6 +517,174 @@ char *CAppMarkerWriter::WriteAPP1(char *current, bool reserve_thumbnail_space, b
     return writer.GetNextIFDBase();
 }
 
+static inline uint64_t HashExifData(uint64_t hash, const void *data, size_t len)
+{
+    // FNV-1a
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#define HASH_EXIF_FIELD(hash, field) HashExifData(hash, &m_pExif->field, sizeof(m_pExif->field))
+
+// Hash of every attribute stored in APP1 except the ones in the patch list
+uint64_t CAppMarkerWriter::HashStaticExif()
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    hash = HashExifData(hash, m_pExif->maker, m_szMake);
+    hash = HashExifData(hash, m_pExif->model, m_szModel);
+    hash = HashExifData(hash, m_pExif->software, m_szSoftware);
+    hash = HashExifData(hash, &m_szUniqueID, sizeof(m_szUniqueID));
+    hash = HASH_EXIF_FIELD(hash, ycbcr_positioning);
+    hash = HASH_EXIF_FIELD(hash, x_resolution);
+    hash = HASH_EXIF_FIELD(hash, y_resolution);
+    hash = HASH_EXIF_FIELD(hash, resolution_unit);
+    hash = HASH_EXIF_FIELD(hash, fnumber);
+    hash = HASH_EXIF_FIELD(hash, exposure_program);
+    hash = HashExifData(hash, m_pExif->exif_version, 4);
+    hash = HASH_EXIF_FIELD(hash, aperture);
+    hash = HASH_EXIF_FIELD(hash, max_aperture);
+    hash = HASH_EXIF_FIELD(hash, metering_mode);
+    hash = HASH_EXIF_FIELD(hash, focal_length);
+    hash = HASH_EXIF_FIELD(hash, maker_note_size);
+    hash = HashExifData(hash, m_pExif->maker_note, m_pExif->maker_note_size);
+    hash = HASH_EXIF_FIELD(hash, user_comment_size);
+    hash = HashExifData(hash, m_pExif->user_comment, m_pExif->user_comment_size);
+    hash = HASH_EXIF_FIELD(hash, color_space);
+    hash = HASH_EXIF_FIELD(hash, custom_rendered);
+    hash = HASH_EXIF_FIELD(hash, exposure_mode);
+    hash = HASH_EXIF_FIELD(hash, digital_zoom_ratio);
+    hash = HASH_EXIF_FIELD(hash, focal_length_in_35mm_length);
+    hash = HASH_EXIF_FIELD(hash, scene_capture_type);
+    hash = HASH_EXIF_FIELD(hash, contrast);
+    hash = HASH_EXIF_FIELD(hash, saturation);
+    hash = HASH_EXIF_FIELD(hash, sharpness);
+    hash = HASH_EXIF_FIELD(hash, interoperability_index);
+
+    hash = HASH_EXIF_FIELD(hash, enableGps);
+    if (m_pExif->enableGps) {
+        hash = HashExifData(hash, m_pExif->gps_version_id, 4);
+        hash = HashExifData(hash, m_pExif->gps_latitude_ref, 2);
+        hash = HashExifData(hash, m_pExif->gps_latitude, sizeof(rational_t) * 3);
+        hash = HashExifData(hash, m_pExif->gps_longitude_ref, 2);
+        hash = HashExifData(hash, m_pExif->gps_longitude, sizeof(rational_t) * 3);
+        hash = HASH_EXIF_FIELD(hash, gps_altitude_ref);
+        hash = HASH_EXIF_FIELD(hash, gps_altitude);
+        hash = HashExifData(hash, m_pExif->gps_datestamp, EXIF_GPSDATESTAMP_LENGTH);
+        hash = HashExifData(hash, m_pExif->gps_timestamp, sizeof(rational_t) * 3);
+        hash = HashExifData(hash, m_pExif->gps_processing_method,
+                            strlen(m_pExif->gps_processing_method));
+    }
+
+    hash = HASH_EXIF_FIELD(hash, enableThumb);
+    if (m_pExif->enableThumb) {
+        hash = HASH_EXIF_FIELD(hash, widthThumb);
+        hash = HASH_EXIF_FIELD(hash, heightThumb);
+        hash = HASH_EXIF_FIELD(hash, compression_scheme);
+    }
+
+    return hash;
+}
+
+bool CAppMarkerWriter::IsTemplateValid()
+{
+    return !m_Template.empty() && (m_szTemplateApp1 == m_szApp1) &&
+           (m_szTemplateMaxThumb == m_szMaxThumbSize) && (m_nTemplateHash == HashStaticExif());
+}
+
+void CAppMarkerWriter::RecordPatch(CIFDWriter &writer, uint32_t size, uint32_t field)
+{
+    if (!m_bRecordTemplate)
+        return;
+
+    ExifPatch patch;
+    patch.offset = static_cast<uint32_t>(PTR_DIFF(m_pAppBase, writer.GetLastValueAddress(size)));
+    patch.size = size;
+    patch.field = field;
+    m_TemplatePatches.push_back(patch);
+}
+
+// Stores the value as CIFDWriter does: strings are NUL terminated and numbers are in the host order
+void CAppMarkerWriter::ApplyPatch(char *value, uint32_t size, uint32_t field)
+{
+    const void *src = NULL;
+
+    switch (field) {
+        case EXIF_PATCH_DATE_TIME:
+            strncpy(value, m_pExif->date_time, size);
+            value[size - 1] = '\0';
+            return;
+        case EXIF_PATCH_SUBSEC_TIME:
+            strncpy(value, m_pExif->sec_time, size);
+            value[size - 1] = '\0';
+            return;
+        case EXIF_PATCH_IMAGE_UNIQUE_ID:
+            memcpy(value, m_pExif->unique_id, size);
+            value[size - 1] = '\0';
+            return;
+        case EXIF_PATCH_ORIENTATION:        src = &m_pExif->orientation; break;
+        case EXIF_PATCH_EXPOSURE_TIME:      src = &m_pExif->exposure_time; break;
+        case EXIF_PATCH_ISO_SPEED_RATING:   src = &m_pExif->iso_speed_rating; break;
+        case EXIF_PATCH_SHUTTER_SPEED:      src = &m_pExif->shutter_speed; break;
+        case EXIF_PATCH_BRIGHTNESS:         src = &m_pExif->brightness; break;
+        case EXIF_PATCH_EXPOSURE_BIAS:      src = &m_pExif->exposure_bias; break;
+        case EXIF_PATCH_FLASH:              src = &m_pExif->flash; break;
+        case EXIF_PATCH_WHITE_BALANCE:      src = &m_pExif->white_balance; break;
+        case EXIF_PATCH_PIXEL_X_DIMENSION:  src = &m_pExif->width; break;
+        case EXIF_PATCH_PIXEL_Y_DIMENSION:  src = &m_pExif->height; break;
+        default:
+            return;
+    }
+
+    memcpy(value, src, size);
+}
+
+void CAppMarkerWriter::PatchTemplate(char *base)
+{
+    for (size_t i = 0; i < m_TemplatePatches.size(); i++)
+        ApplyPatch(base + m_TemplatePatches[i].offset, m_TemplatePatches[i].size,
+                   m_TemplatePatches[i].field);
+}
+
+char *CAppMarkerWriter::WriteAPP1FromTemplate(char *base, bool reserve_thumbnail_space)
+{
+    if (!m_pExif)
+        return base;
+
+    size_t thumbspace = 0;
+    if (m_pExif->enableThumb && reserve_thumbnail_space)
+        thumbspace = m_szMaxThumbSize + JPEG_APP1_OEM_RESERVED;
+
+    if (IsTemplateValid() && (m_bTemplateReservedThumb == reserve_thumbnail_space)) {
+        memcpy(base, m_Template.data(), m_Template.size());
+        PatchTemplate(base);
+        if (m_nTemplateThumbSizeOffset > 0)
+            m_pThumbSizePlaceholder = base + m_nTemplateThumbSizeOffset;
+        return base + m_Template.size() + thumbspace;
+    }
+
+    m_TemplatePatches.clear();
+    m_bRecordTemplate = true;
+    char *end = WriteAPP1(base, reserve_thumbnail_space);
+    m_bRecordTemplate = false;
+
+    m_Template.assign(base, end - thumbspace);
+    m_nTemplateHash = HashStaticExif();
+    m_bTemplateReservedThumb = reserve_thumbnail_space;
+    m_szTemplateMaxThumb = m_szMaxThumbSize;
+    m_szTemplateApp1 = m_szApp1;
+    m_nTemplateThumbSizeOffset = m_pThumbSizePlaceholder ?
+            static_cast<uint32_t>(PTR_DIFF(base, m_pThumbSizePlaceholder)) : 0;
+
+    ALOGD("APP1 template: %zu bytes, %zu tags to patch", m_Template.size(), m_TemplatePatches.size());
+
+    return end;
+}
+
 void CAppMarkerWriter::Finalize(size_t thumbsize)
 {
     if (m_pThumbSizePlaceholder) {
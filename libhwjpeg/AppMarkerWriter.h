@@ -17,6 +17,8 @@
 #ifndef __HARDWARE_SAMSUNG_SLSI_EXYNOS_APPMARKER_WRITER_H__
 #define __HARDWARE_SAMSUNG_SLSI_EXYNOS_APPMARKER_WRITER_H__
 
+#include <vector>
+
 #include <ExynosExif.h>
 #include "include/hardware/exynos/ExynosExif.h"
 
@@ -45,7 +47,32 @@
 #define EXIF_DATETIME_LENGTH 20
 #define EXIF_GPSDATESTAMP_LENGTH 11
 
+class CIFDWriter;
+
 class CAppMarkerWriter {
+    // Tags that change between the shots of a burst, patched in the template
+    enum {
+        EXIF_PATCH_ORIENTATION,
+        EXIF_PATCH_DATE_TIME,
+        EXIF_PATCH_SUBSEC_TIME,
+        EXIF_PATCH_EXPOSURE_TIME,
+        EXIF_PATCH_ISO_SPEED_RATING,
+        EXIF_PATCH_SHUTTER_SPEED,
+        EXIF_PATCH_BRIGHTNESS,
+        EXIF_PATCH_EXPOSURE_BIAS,
+        EXIF_PATCH_FLASH,
+        EXIF_PATCH_WHITE_BALANCE,
+        EXIF_PATCH_PIXEL_X_DIMENSION,
+        EXIF_PATCH_PIXEL_Y_DIMENSION,
+        EXIF_PATCH_IMAGE_UNIQUE_ID,
+    };
+    struct ExifPatch {
+        uint32_t offset; // from the APP1 marker
+        uint32_t size;
+        uint32_t field;
+    };
+
+
     char *m_pAppBase;
     char *m_pApp1End;
     size_t m_szMaxThumbSize; // Maximum available thumbnail stream size minus JPEG_MARKER_SIZE
@@ -71,8 +98,26 @@ class CAppMarkerWriter {
     // Note that the address may not be aligned by 32-bit.
     char *m_pThumbSizePlaceholder;
 
+    // Template mode: APP1 is serialized once and the variable tags are
+    // patched in a copy of it as long as the other tags are unchanged.
+    bool m_bTemplateMode;
+    bool m_bRecordTemplate;
+    std::vector<char> m_Template; // APP1 without the thumbnail space
+    std::vector<ExifPatch> m_TemplatePatches;
+    uint64_t m_nTemplateHash;
+    bool m_bTemplateReservedThumb;
+    size_t m_szTemplateMaxThumb;
+    uint16_t m_szTemplateApp1;
+    uint32_t m_nTemplateThumbSizeOffset; // 0 if no thumbnail
+
     void Init();
 
+    uint64_t HashStaticExif();
+    bool IsTemplateValid();
+    void RecordPatch(CIFDWriter &writer, uint32_t size, uint32_t field);
+    void ApplyPatch(char *value, uint32_t size, uint32_t field);
+    void PatchTemplate(char *base);
+    char *WriteAPP1FromTemplate(char *base, bool reserve_thumbnail_space);
     char *WriteAPP1(char *base, bool reserve_thumbnail_space, bool updating = false);
     char *WriteAPPX(char *base, bool just_reserve);
     char *WriteAPP11(char *current, size_t dummy, size_t align);
@@ -88,6 +133,13 @@ public:
 
     void PrepareAppWriter(char *base, exif_attribute_t *exif, extra_appinfo_t *info);
 
+    // Template mode for bursts where only the variable tags change between shots
+    void EnableTemplate(bool enable) {
+        m_bTemplateMode = enable;
+        m_Template.clear();
+        m_TemplatePatches.clear();
+    }
+
     char *GetMainStreamBase() { return m_pMainBase; }
     char *GetThumbStreamBase() { return m_pThumbBase; }
     char *GetThumbStreamSizeAddr() {
@@ -96,6 +148,9 @@ public:
         return p;
     }
     size_t GetMaxThumbnailSize() { return m_szMaxThumbSize; }
+    // Shrinks the space for the thumbnail stream to @size if it is smaller.
+    // It should be called between PrepareAppWriter() and Write().
+    void LimitThumbnailSize(size_t size) { m_szMaxThumbSize = min(m_szMaxThumbSize, size); }
     size_t GetAPP1ResrevedSize() { return JPEG_APP1_OEM_RESERVED; }
     // CalculateAPPSize() is valid after Write() is successful.
     size_t CalculateAPPSize(size_t thumblen = JPEG_MAX_SEGMENT_SIZE) {
@@ -118,14 +173,21 @@ public:
     char *GetApp1End() { return m_pApp1End; }
 
     void Write(bool reserve_thumbnail_space, size_t dummy, size_t align, bool reserve_debug = false) {
-        m_pApp1End = WriteAPP1(m_pAppBase, reserve_thumbnail_space);
+        m_pApp1End = m_bTemplateMode ? WriteAPP1FromTemplate(m_pAppBase, reserve_thumbnail_space)
+                                     : WriteAPP1(m_pAppBase, reserve_thumbnail_space);
         char *appXend = WriteAPPX(m_pApp1End, reserve_debug);
         char *app11end = WriteAPP11(appXend, dummy, align);
         m_szApp11 = PTR_DIFF(appXend, app11end);
         m_pMainBase = app11end - dummy;
     }
 
-    void Update() { WriteAPP1(m_pAppBase, false, true); }
+    // Updates the tags in place, only the variable tags if the template matches
+    void Update() {
+        if (m_bTemplateMode && IsTemplateValid())
+            PatchTemplate(m_pAppBase);
+        else
+            WriteAPP1(m_pAppBase, false, true);
+    }
 
     bool IsThumbSpaceReserved() {
         return PTR_DIFF(m_pAppBase, m_pApp1End) ==
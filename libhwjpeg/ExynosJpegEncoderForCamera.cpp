@@ -15,6 +15,8 @@
  * limitations under the License.
  */
 
+#include <cmath>
+
 #include <sys/mman.h>
 #include <sys/types.h>
 
@@ -33,6 +35,15 @@
 // Data length written by H/W without the scan data.
 #define NECESSARY_JPEG_LENGTH   (0x24B + 2 * JPEG_MARKER_SIZE)
 
+// The compressed size is modeled to be proportional to S^-RATE_MODEL_EXPONENT
+// where S is the scale of the quantization tables by the quality factor, 5000/Q
+// if Q < 50, 200 - 2Q otherwise.
+#define RATE_MODEL_EXPONENT     0.8
+#define RATE_MIN_QUALITY        20
+#define RATE_DEFAULT_QUALITY    50
+// The portion of the target size to aim at to absorb the error of the model
+#define RATE_TARGET_MARGIN      0.9
+
 static size_t GetImageLength(unsigned int width, unsigned int height, int v4l2Format)
 {
     size_t size = width * height;
@@ -71,8 +82,18 @@ ExynosJpegEncoderForCamera::ExynosJpegEncoderForCamera(bool bBTBComp)
         : m_phwjpeg4thumb(NULL), m_fdIONClient(-1), m_fdIONThumbImgBuffer(-1), m_pIONThumbImgBuffer(NULL),
           m_szIONThumbImgBuffer(0), m_pIONThumbJpegBuffer(NULL), m_fdIONThumbJpegBuffer(-1), m_szIONThumbJpegBuffer(0),
           m_nThumbWidth(0), m_nThumbHeight(0), m_nThumbQuality(0),
-          m_pStreamBase(NULL), m_fThumbBufferType(0)
+          m_pStreamBase(NULL), m_fThumbBufferType(0), m_bThreadWorkerCreated(false),
+          m_bThreadWorkerExit(false), m_iThumbWorkerState(THUMB_WORKER_IDLE), m_szThumbWorkerResult(0),
+          m_szTargetStreamSize(0), m_szTargetThumbSize(0), m_nRateQuality(0)
 {
+    m_rateMain.quality = 0;
+    m_rateMain.bytes_per_pixel = 0;
+    m_rateThumb.quality = 0;
+    m_rateThumb.bytes_per_pixel = 0;
+
+    pthread_mutex_init(&m_mutexThumbWorker, NULL);
+    pthread_cond_init(&m_condThumbWorker, NULL);
+
     m_pAppWriter = new CAppMarkerWriter();
     if (!m_pAppWriter) {
         ALOGE("Failed to allocated an instance of CAppMarkerWriter");
@@ -114,6 +135,20 @@ ExynosJpegEncoderForCamera::ExynosJpegEncoderForCamera(bool bBTBComp)
 
 ExynosJpegEncoderForCamera::~ExynosJpegEncoderForCamera()
 {
+    if (m_bThreadWorkerCreated) {
+        WaitThumbnailCompression();
+
+        pthread_mutex_lock(&m_mutexThumbWorker);
+        m_bThreadWorkerExit = true;
+        pthread_cond_broadcast(&m_condThumbWorker);
+        pthread_mutex_unlock(&m_mutexThumbWorker);
+
+        pthread_join(m_threadWorker, NULL);
+    }
+
+    pthread_cond_destroy(&m_condThumbWorker);
+    pthread_mutex_destroy(&m_mutexThumbWorker);
+
     delete m_pAppWriter;
     delete m_phwjpeg4thumb;
 
@@ -171,6 +206,72 @@ int ExynosJpegEncoderForCamera::setThumbnailQuality(int quality)
     return GetCompressor().SetQuality(0, m_nThumbQuality) ? 0 : -1;
 }
 
+void ExynosJpegEncoderForCamera::setExifTemplateMode(bool enable)
+{
+    m_pAppWriter->EnableTemplate(enable);
+}
+
+int ExynosJpegEncoderForCamera::setTargetStreamSize(int size)
+{
+    if (size < 0) {
+        ALOGE("Invalid target stream size %d", size);
+        return -1;
+    }
+
+    // Restore the quality factor overridden by the rate control
+    if ((size == 0) && (m_nRateQuality > 0)) {
+        if ((GetQualityFactor() > 0) && !GetCompressor().SetQuality(GetQualityFactor()))
+            return -1;
+        m_nRateQuality = 0;
+    }
+
+    m_szTargetStreamSize = static_cast<size_t>(size);
+
+    return 0;
+}
+
+int ExynosJpegEncoderForCamera::setTargetThumbnailSize(int size)
+{
+    if (size < 0) {
+        ALOGE("Invalid target thumbnail stream size %d", size);
+        return -1;
+    }
+
+    m_szTargetThumbSize = static_cast<size_t>(size);
+
+    return 0;
+}
+
+static double GetQuantScale(int quality)
+{
+    double scale = (quality < 50) ? 5000.0 / quality : 200.0 - quality * 2;
+    return max(scale, 1.0);
+}
+
+int ExynosJpegEncoderForCamera::EstimateQuality(const RateSample &sample, int upper,
+                                                size_t pixels, size_t target)
+{
+    if (sample.quality <= 0)
+        return upper;
+
+    double ratio = sample.bytes_per_pixel * pixels / (target * RATE_TARGET_MARGIN);
+    double scale = GetQuantScale(sample.quality) * pow(ratio, 1.0 / RATE_MODEL_EXPONENT);
+    int quality = (scale >= 100.0) ? static_cast<int>(5000.0 / scale)
+                                   : static_cast<int>((200.0 - scale) / 2);
+
+    return min(upper, max(quality, RATE_MIN_QUALITY));
+}
+
+void ExynosJpegEncoderForCamera::RecordRate(RateSample &sample, int quality,
+                                            size_t len, size_t pixels)
+{
+    if ((quality <= 0) || (pixels == 0))
+        return;
+
+    sample.quality = quality;
+    sample.bytes_per_pixel = static_cast<double>(len) / pixels;
+}
+
 bool ExynosJpegEncoderForCamera::EnsureFormatIsApplied() {
     if (TestStateEither(STATE_PIXFMT_CHANGED | STATE_SIZE_CHANGED | STATE_THUMBSIZE_CHANGED)) {
         int thumb_width = m_nThumbWidth;
@@ -199,14 +300,20 @@ size_t ExynosJpegEncoderForCamera::RemoveTrailingDummies(char *base, size_t len)
     ALOG_ASSERT(len > 4);
     ALOG_ASSERT((base[0] == 0xFF) && (base[1] == 0xD8)); // SOI marker
 
-    size_t riter = len - 2;
+    // memrchr() is vectorized by libc. Looking for 0xFF backward skips the
+    // dummies and the entropy coded data several bytes at a time.
+    size_t riter = len - 1;
 
     while (riter > 0) {
-        if ((base[riter] == 0xFF) && (base[riter + 1] == 0xD9)) { // EOI marker
+        char *marker = reinterpret_cast<char *>(memrchr(base, 0xFF, riter));
+        if (marker == NULL)
+            break;
+
+        riter = PTR_DIFF(base, marker);
+        if (static_cast<unsigned char>(marker[1]) == 0xD9) { // EOI marker
             ALOGI_IF(riter < (len - 2), "Found %zu dummies after EOI", len - riter - 2);
             return riter + 2;
         }
-        riter--;
     }
 
     ALOGE("EOI is not found!");
@@ -219,8 +326,66 @@ void *ExynosJpegEncoderForCamera::tCompressThumbnail(void *p)
 {
     ExynosJpegEncoderForCamera *encoder = reinterpret_cast<ExynosJpegEncoderForCamera *>(p);
 
-    size_t thumblen = encoder->CompressThumbnail();
-    return reinterpret_cast<void *>(thumblen);
+    pthread_mutex_lock(&encoder->m_mutexThumbWorker);
+
+    while (true) {
+        while (!encoder->m_bThreadWorkerExit &&
+               (encoder->m_iThumbWorkerState != THUMB_WORKER_REQUESTED))
+            pthread_cond_wait(&encoder->m_condThumbWorker, &encoder->m_mutexThumbWorker);
+
+        if (encoder->m_bThreadWorkerExit)
+            break;
+
+        pthread_mutex_unlock(&encoder->m_mutexThumbWorker);
+
+        size_t thumblen = encoder->CompressThumbnail();
+
+        pthread_mutex_lock(&encoder->m_mutexThumbWorker);
+        encoder->m_szThumbWorkerResult = thumblen;
+        encoder->m_iThumbWorkerState = THUMB_WORKER_DONE;
+        pthread_cond_broadcast(&encoder->m_condThumbWorker);
+    }
+
+    pthread_mutex_unlock(&encoder->m_mutexThumbWorker);
+
+    return NULL;
+}
+
+bool ExynosJpegEncoderForCamera::RequestThumbnailCompression()
+{
+    if (!m_bThreadWorkerCreated) {
+        if (pthread_create(&m_threadWorker, NULL,
+                tCompressThumbnail, reinterpret_cast<void *>(this)) != 0) {
+            ALOGERR("Failed to create thumbnail generation thread");
+            return false;
+        }
+        m_bThreadWorkerCreated = true;
+    }
+
+    // The result of the previous request is discarded if the compression was aborted
+    WaitThumbnailCompression();
+
+    pthread_mutex_lock(&m_mutexThumbWorker);
+    m_iThumbWorkerState = THUMB_WORKER_REQUESTED;
+    pthread_cond_broadcast(&m_condThumbWorker);
+    pthread_mutex_unlock(&m_mutexThumbWorker);
+
+    return true;
+}
+
+size_t ExynosJpegEncoderForCamera::WaitThumbnailCompression()
+{
+    pthread_mutex_lock(&m_mutexThumbWorker);
+
+    while (m_iThumbWorkerState == THUMB_WORKER_REQUESTED)
+        pthread_cond_wait(&m_condThumbWorker, &m_mutexThumbWorker);
+
+    size_t thumblen = (m_iThumbWorkerState == THUMB_WORKER_DONE) ? m_szThumbWorkerResult : 0;
+    m_iThumbWorkerState = THUMB_WORKER_IDLE;
+
+    pthread_mutex_unlock(&m_mutexThumbWorker);
+
+    return thumblen;
 }
 
 bool ExynosJpegEncoderForCamera::ProcessExif(char *base, size_t limit,
@@ -267,6 +432,15 @@ bool ExynosJpegEncoderForCamera::ProcessExif(char *base, size_t limit,
 
     bool reserve_thumbspace = true;
 
+    if (exifInfo && exifInfo->enableThumb) {
+        // The compressed stream of the thumbnail image does not practically
+        // exceed 3 bytes per pixel with the headers. Reserving just the bound
+        // rather than the whole APP1 segment lets the main stream land at its
+        // final place in the smaller stream buffers, too.
+        m_pAppWriter->LimitThumbnailSize(
+                static_cast<size_t>(m_nThumbWidth) * m_nThumbHeight * 3 + NECESSARY_JPEG_LENGTH);
+    }
+
     // If the length of the given stream buffer is too small, and thumbnail
     // compression is also required, the compressed stream data of the main
     // image is appeneded after the end of the fields if IFD1. The place is
@@ -277,7 +451,8 @@ bool ExynosJpegEncoderForCamera::ProcessExif(char *base, size_t limit,
     // the compressed data of the main image is shifted by the length of the
     // compressed data of the thumbnail image. Then the compressed data of
     // the thumbnail image is copied to the place for it.
-    if (!exifInfo || !exifInfo->enableThumb || (limit < (JPEG_MAX_SEGMENT_SIZE * 10)))
+    size_t thumbspace = m_pAppWriter->GetMaxThumbnailSize() + m_pAppWriter->GetAPP1ResrevedSize();
+    if (!exifInfo || !exifInfo->enableThumb || (limit < (thumbspace * 10)))
         reserve_thumbspace = false;
 
     m_pAppWriter->Write(reserve_thumbspace, JPEG_MARKER_SIZE, align,
@@ -296,11 +471,8 @@ bool ExynosJpegEncoderForCamera::PrepareCompression(bool thumbnail)
         return true;
 
     if (IsThumbGenerationNeeded()) {
-        if (pthread_create(&m_threadWorker, NULL,
-                tCompressThumbnail, reinterpret_cast<void *>(this)) != 0) {
-            ALOGERR("Failed to create thumbnail generation thread");
+        if (!RequestThumbnailCompression())
             return false;
-        }
     } else {
         // allocate temporary thumbnail stream buffer
         // to prevent overflow of the compressed stream
@@ -367,6 +539,7 @@ int ExynosJpegEncoderForCamera::encode(int *size, exif_attribute_t *exifInfo,
 
     m_pStreamBase = *pcJpegBuffer;
     m_nStreamSize = *size; // contains max buffer length until the compression finishes
+    ClearState(STATE_THUMB_OVERLAPPED);
 
     char *jpeg_base = m_pStreamBase;
 
@@ -441,6 +614,25 @@ int ExynosJpegEncoderForCamera::encode(int *size, exif_attribute_t *exifInfo,
         return -1;
     }
 
+    size_t main_budget = 0;
+    if (m_szTargetStreamSize > 0) {
+        size_t appsize = m_pAppWriter->CalculateAPPSize();
+        if (m_szTargetStreamSize <= (appsize + NECESSARY_JPEG_LENGTH)) {
+            ALOGE("Too small target stream size %zu bytes (APPx %zu bytes)",
+                  m_szTargetStreamSize, appsize);
+            return -1;
+        }
+
+        main_budget = m_szTargetStreamSize - appsize;
+        m_nRateQuality = EstimateQuality(m_rateMain, GetQualityFactor() > 0 ? GetQualityFactor() : 100,
+                                         GetMainPixels(), main_budget);
+        if (!GetCompressor().SetQuality(m_nRateQuality)) {
+            ALOGE("Failed to configure quality factor %d for target size %zu",
+                  m_nRateQuality, m_szTargetStreamSize);
+            return -1;
+        }
+    }
+
     ssize_t mainlen = GetCompressor().Compress(&thumblen, block_mode);
     if (mainlen < 0) {
         ALOGE("Error occured while JPEG compression: %zd", mainlen);
@@ -452,6 +644,30 @@ int ExynosJpegEncoderForCamera::encode(int *size, exif_attribute_t *exifInfo,
         return 0;
     }
 
+    if (main_budget > 0) {
+        RecordRate(m_rateMain, m_nRateQuality, mainlen, GetMainPixels());
+
+        int quality = EstimateQuality(m_rateMain, m_nRateQuality - 1, GetMainPixels(), main_budget);
+        if ((static_cast<size_t>(mainlen) > main_budget) && (m_nRateQuality > RATE_MIN_QUALITY)) {
+            ALOGI("Too large stream size %zd (budget %zu, quality factor %d). Retrying with quality factor %d",
+                  mainlen, main_budget, m_nRateQuality, quality);
+
+            m_nRateQuality = quality;
+            if (!GetCompressor().SetQuality(m_nRateQuality))
+                return -1;
+
+            mainlen = GetCompressor().Compress(&thumblen, block_mode);
+            if (mainlen < 0) {
+                ALOGE("Error occured while JPEG compression: %zd", mainlen);
+                return -1;
+            }
+
+            RecordRate(m_rateMain, m_nRateQuality, mainlen, GetMainPixels());
+            ALOGW_IF(static_cast<size_t>(mainlen) > main_budget,
+                     "Stream size %zd still exceeds the budget %zu", mainlen, main_budget);
+        }
+    }
+
     *size = static_cast<int>(FinishCompression(mainlen, thumblen));
     if (*size < 0)
         return -1;
@@ -479,30 +695,28 @@ ssize_t ExynosJpegEncoderForCamera::FinishCompression(size_t mainlen, size_t thu
 
     if (thumbbase) {
         if (IsThumbGenerationNeeded()) {
-            void *len;
-            int ret = pthread_join(m_threadWorker, &len);
-            if (ret != 0) {
-                ALOGERR("Failed to wait thumbnail thread(%d)", ret);
-                return -1;
-            }
-
-            if (len == NULL)
+            thumblen = WaitThumbnailCompression();
+            if (thumblen == 0)
                 ALOGE("Error occurred during thumbnail creation: no thumbnail is embedded");
-
-            thumblen = reinterpret_cast<size_t>(len);
+        } else if (TestState(STATE_THUMB_OVERLAPPED)) {
+            thumblen = WaitThumbnailCompression();
+            if (thumblen == 0)
+                ALOGE("Error occurred during thumbnail compression: no thumbnail is embedded");
         } else if (TestState(STATE_NO_BTBCOMP) || !IsBTBCompressionSupported()) {
             thumblen = CompressThumbnailOnly(m_pAppWriter->GetMaxThumbnailSize(), m_nThumbQuality, getColorFormat(), checkInBufType());
         } else {
             btb = true;
+            RecordRate(m_rateThumb, m_nThumbQuality, thumblen, m_nThumbWidth * m_nThumbHeight);
         }
 
         size_t max_thumb = min(m_pAppWriter->GetMaxThumbnailSize(), max_streamsize - m_pAppWriter->CalculateAPPSize(0) - mainlen);
+        if (m_szTargetThumbSize > 0)
+            max_thumb = min(max_thumb, m_szTargetThumbSize);
 
         if (thumblen > max_thumb) {
             ALOGI("Too large thumbnail (%dx%d) stream size %zu (max: %zu, quality factor %d)",
                   m_nThumbWidth, m_nThumbHeight, thumblen, max_thumb, m_nThumbQuality);
-            ALOGI("Retrying thumbnail compression with quality factor 50");
-            thumblen = CompressThumbnailOnly(max_thumb, 50, getColorFormat(), checkInBufType());
+            thumblen = CompressThumbnailOnly(max_thumb, m_nThumbQuality, getColorFormat(), checkInBufType());
             if (thumblen == 0)
                 return -1;
         }
@@ -552,9 +766,28 @@ ssize_t ExynosJpegEncoderForCamera::FinishCompression(size_t mainlen, size_t thu
     m_pStreamBase[0] = 0xFF;
     m_pStreamBase[1] = 0xD8;
 
+    ClearState(STATE_THUMB_OVERLAPPED);
+
     return m_nStreamSize;
 }
 
+int ExynosJpegEncoderForCamera::NotifyThumbnailImageReady()
+{
+    // Only the thumbnail that is compressed after the main image is overlapped.
+    // The thumbnails generated from the main image and compressed back-to-back
+    // already run with the main image.
+    if (!TestState(STATE_HWFC_ENABLED) || (m_pAppWriter->GetThumbStreamBase() == NULL) ||
+            !IsThumbCompressedSeparately() || TestState(STATE_THUMB_OVERLAPPED))
+        return 0;
+
+    if (!RequestThumbnailCompression())
+        return -1;
+
+    SetState(STATE_THUMB_OVERLAPPED);
+
+    return 0;
+}
+
 /* The logic in WaitForHWFC() is the same with encode() */
 ssize_t ExynosJpegEncoderForCamera::WaitForCompression()
 {
@@ -566,6 +799,10 @@ ssize_t ExynosJpegEncoderForCamera::WaitForCompression()
     if (streamlen < 0)
         return streamlen;
 
+    // No chance to retry but the next frame benefits from the result.
+    if (m_szTargetStreamSize > 0)
+        RecordRate(m_rateMain, m_nRateQuality, streamlen, GetMainPixels());
+
     return FinishCompression(streamlen, thumblen);
 }
 
@@ -780,9 +1017,17 @@ size_t ExynosJpegEncoderForCamera::CompressThumbnailOnly(size_t limit, int quali
     // Since the compressed stream of the thumbnail image is to be embedded in
     // APP1 segment, at the end of Exif metadata, the length of the stream should
     // not exceed the maximum length of a segment, 64KB minus the length of Exif
-    // metadata. If the stream length is too large, repeat the compression until
-    // the length become proper to embed.
-    do {
+    // metadata. If the stream length is too large, the compression is retried
+    // once with the quality factor estimated from the first trial. In the
+    // target-size mode, the first trial is also estimated from the last thumbnail.
+    size_t pixels = m_nThumbWidth * m_nThumbHeight;
+    if (m_szTargetThumbSize > 0) {
+        limit = min(limit, m_szTargetThumbSize);
+        if (quality > 0)
+            quality = EstimateQuality(m_rateThumb, quality, pixels, limit);
+    }
+
+    for (int trial = 0; trial < 2; trial++) {
         if (!m_phwjpeg4thumb->SetQuality(quality)) {
             ALOGE("Failed to configure thumbnail quality factor %u", quality);
             return 0;
@@ -795,17 +1040,21 @@ size_t ExynosJpegEncoderForCamera::CompressThumbnailOnly(size_t limit, int quali
         }
 
         thumbsize = RemoveTrailingDummies(m_pIONThumbJpegBuffer, thumbsize);
-        if (static_cast<size_t>(thumbsize) > limit) {
-            quality = min(50, quality - 10);
-            ALOGI_IF(quality >= 20,
-                     "Too large thumbnail stream size %zu. Retrying with quality factor %d...",
-                     thumbsize, quality);
-        } else {
+        RecordRate(m_rateThumb, quality, thumbsize, pixels);
+        if (static_cast<size_t>(thumbsize) <= limit)
             return thumbsize;
-        }
-    } while (quality >= 20);
 
-    ALOG_ASSERT(false, "It should never reach here");
+        if ((quality > 0) && (quality <= RATE_MIN_QUALITY))
+            break;
+
+        // The quality factor of the device is unknown if it is not configured
+        quality = (quality > 0) ? EstimateQuality(m_rateThumb, quality - 1, pixels, limit)
+                                : RATE_DEFAULT_QUALITY;
+        ALOGI_IF(trial == 0,
+                 "Too large thumbnail stream size %zu. Retrying with quality factor %d...",
+                 thumbsize, quality);
+    }
+
     ALOGE("Thumbnail compression finally failed");
 
     return 0;
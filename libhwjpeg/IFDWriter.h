@@ -300,6 +300,10 @@ public:
 
     char *GetNextIFDBase() { return m_pValue; }
     char *GetNextTagAddress() { return m_pIFDBase; }
+    // Address of the value of the last written tag whose value is @size bytes
+    char *GetLastValueAddress(uint32_t size) {
+        return (size > IFD_VALOFF_SIZE) ? m_pValue - size : m_pIFDBase - IFD_VALOFF_SIZE;
+    }
 };
 
 #endif //__HARDWARE_SAMSUNG_SLSI_EXYNOS_IFDWRITER_H__
@@ -15,6 +15,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include "hwjpeg-internal.h"
 #include "LibScalerForJpeg.h"
 
@@ -31,18 +33,147 @@ static const char *getBufTypeString(unsigned int buftype)
 
 bool LibScalerForJpeg::RunStream(int srcBuf[SCALER_MAX_PLANES], int __unused srcLen[SCALER_MAX_PLANES], int dstBuf, size_t __unused dstLen)
 {
-    if (!mSrcImage.begin(V4L2_MEMORY_DMABUF) || !mDstImage.begin(V4L2_MEMORY_DMABUF))
-        return false;
-
-    return queue(srcBuf, dstBuf);
+    return run(srcBuf, V4L2_MEMORY_DMABUF, dstBuf);
 }
 
 bool LibScalerForJpeg::RunStream(char *srcBuf[SCALER_MAX_PLANES], int __unused srcLen[SCALER_MAX_PLANES], int dstBuf, size_t __unused dstLen)
 {
-    if (!mSrcImage.begin(V4L2_MEMORY_USERPTR) || !mDstImage.begin(V4L2_MEMORY_DMABUF))
+    return run(srcBuf, V4L2_MEMORY_USERPTR, dstBuf);
+}
+
+template<class T>
+bool LibScalerForJpeg::run(T srcBuf[SCALER_MAX_PLANES], unsigned int srcMemType, int dstBuf)
+{
+    DevicePool &pool = DevicePool::getInstance();
+    std::unique_ptr<Context> context = pool.acquire(mSrcFormat, mDstFormat);
+    if (!context)
         return false;
 
-    return queue(srcBuf, dstBuf);
+    bool ret = context->configure(mSrcFormat, mDstFormat) &&
+               context->mSrcImage.begin(srcMemType) &&
+               context->mDstImage.begin(V4L2_MEMORY_DMABUF) &&
+               context->queue(srcBuf, dstBuf);
+
+    // a device in an unknown state is closed rather than given to the next user
+    pool.release(std::move(context), ret);
+
+    return ret;
+}
+
+bool LibScalerForJpeg::available()
+{
+    return DevicePool::getInstance().available();
+}
+
+void LibScalerForJpeg::setDevicePool(unsigned int max_devices, unsigned int idle_msec)
+{
+    DevicePool::getInstance().setLimits(max_devices, idle_msec);
+}
+
+bool LibScalerForJpeg::Context::configure(const Format &src, const Format &dst)
+{
+    return mSrcImage.set(src.width, src.height, src.format) &&
+           mDstImage.set(dst.width, dst.height, dst.format);
+}
+
+LibScalerForJpeg::DevicePool &LibScalerForJpeg::DevicePool::getInstance()
+{
+    static DevicePool pool;
+
+    return pool;
+}
+
+std::unique_ptr<LibScalerForJpeg::Context> LibScalerForJpeg::DevicePool::acquire(const Format &src, const Format &dst)
+{
+    std::unique_ptr<Context> context;
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+
+        closeIdle(std::chrono::steady_clock::now());
+
+        auto it = std::find_if(mIdle.begin(), mIdle.end(),
+                               [&src, &dst] (std::unique_ptr<Context> &ctx) { return ctx->matches(src, dst); });
+        // reconfigure the least recently used device rather than opening more
+        if ((it == mIdle.end()) && !mIdle.empty() && (mNumDevices >= mMaxDevices))
+            it = std::prev(mIdle.end());
+
+        if (it != mIdle.end()) {
+            context = std::move(*it);
+            mIdle.erase(it);
+            return context;
+        }
+
+        // All devices are in use. The extra device is closed on release.
+        mNumDevices++;
+    }
+
+    context.reset(new Context());
+    if (context->mDevice.mFd < 0) {
+        release(std::move(context), false);
+        return nullptr;
+    }
+
+    return context;
+}
+
+void LibScalerForJpeg::DevicePool::release(std::unique_ptr<Context> context, bool reusable)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    auto now = std::chrono::steady_clock::now();
+
+    if (!reusable || (mNumDevices > mMaxDevices)) {
+        context.reset();
+        mNumDevices--;
+    } else {
+        context->mLastUsed = now;
+        mIdle.push_front(std::move(context));
+    }
+
+    closeIdle(now);
+}
+
+bool LibScalerForJpeg::DevicePool::available()
+{
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+
+        if (!mIdle.empty())
+            return true;
+
+        mNumDevices++;
+    }
+
+    // The device is kept open for the thumbnail that follows.
+    std::unique_ptr<Context> context(new Context());
+    bool opened = context->mDevice.mFd >= 0;
+
+    release(std::move(context), opened);
+
+    return opened;
+}
+
+void LibScalerForJpeg::DevicePool::setLimits(unsigned int max_devices, unsigned int idle_msec)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+
+    mMaxDevices = max(max_devices, 1U);
+    mIdleTimeout = std::chrono::milliseconds(idle_msec);
+
+    while ((mNumDevices > mMaxDevices) && !mIdle.empty()) {
+        mIdle.pop_back();
+        mNumDevices--;
+    }
+
+    closeIdle(std::chrono::steady_clock::now());
+}
+
+void LibScalerForJpeg::DevicePool::closeIdle(std::chrono::steady_clock::time_point now)
+{
+    while (!mIdle.empty() && ((now - mIdle.back()->mLastUsed) > mIdleTimeout)) {
+        mIdle.pop_back();
+        mNumDevices--;
+    }
 }
 
 bool LibScalerForJpeg::Image::set(unsigned int width, unsigned int height, unsigned int format)
@@ -55,11 +186,17 @@ bool LibScalerForJpeg::Image::set(unsigned int width, unsigned int height, unsig
             return false;
     }
 
-    if (!mDevice.setFormat(bufferType, format, width, height, planeLen))
+    if (!mDevice.setFormat(bufferType, format, width, height, planeLen)) {
+        this->width = 0; // not to match any format
         return false;
+    }
 
     memoryType = 0; // new reqbufs is required.
 
+    this->width = width;
+    this->height = height;
+    this->format = format;
+
     return true;
 }
 
@@ -16,30 +16,63 @@
 #ifndef __HARDWARE_EXYNOS_LIBSCALERFORJPEG_H__
 #define __HARDWARE_EXYNOS_LIBSCALERFORJPEG_H__
 
+#include <chrono>
 #include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 
 #include <linux/videodev2.h>
 
 #include "ThumbnailScaler.h"
 
+#define SCALER_POOL_DEFAULT_DEVICES 2
+#define SCALER_POOL_DEFAULT_IDLE_MSEC 3000
+
 class LibScalerForJpeg : public ThumbnailScaler {
 public:
     LibScalerForJpeg() { }
     ~LibScalerForJpeg() { }
 
     bool SetSrcImage(unsigned int width, unsigned int height, unsigned int v4l2_format) {
-        return mSrcImage.set(width, height, v4l2_format);
+        return mSrcFormat.set(width, height, v4l2_format);
     }
 
     bool SetDstImage(unsigned int width, unsigned int height, unsigned int v4l2_format) {
-        return mDstImage.set(width, height, v4l2_format);
+        return mDstFormat.set(width, height, v4l2_format);
     }
 
     bool RunStream(int srcBuf[SCALER_MAX_PLANES], int srcLen[SCALER_MAX_PLANES], int dstBuf, size_t dstLen);
     bool RunStream(char *srcBuf[SCALER_MAX_PLANES], int srcLen[SCALER_MAX_PLANES], int dstBuf, size_t dstLen);
 
-    bool available() { return mDevice.mFd >= 0; }
+    bool available();
+
+    /*
+     * The scaler devices are shared by all instances in the process. A device
+     * keeps its formats and keeps streaming after a thumbnail so that the next
+     * thumbnail of the same formats only queues and dequeues the buffers.
+     * @max_devices: the number of the devices open at the same time
+     * @idle_msec: the time after which an unused device is closed. The device
+     *             is closed when another device is acquired or released.
+     */
+    static void setDevicePool(unsigned int max_devices, unsigned int idle_msec);
 private:
+    struct Format {
+        unsigned int width = 0;
+        unsigned int height = 0;
+        unsigned int format = 0;
+
+        bool set(unsigned int w, unsigned int h, unsigned int f) {
+            width = w;
+            height = h;
+            format = f;
+            return true;
+        }
+        bool operator==(const Format &other) const {
+            return width == other.width && height == other.height && format == other.format;
+        }
+    };
+
     struct Device {
         int mFd;
 
@@ -80,28 +113,63 @@ private:
         bool same(unsigned int w, unsigned int h, unsigned int f) { return width == w && height == h && format == f; }
     };
 
-    template<class T>
-    bool queue(T srcBuf[SCALER_MAX_PLANES], int dstBuf) {
-        if (!mSrcImage.queueBuffer(srcBuf))
-            return false;
-
-        if (!mDstImage.queueBuffer(dstBuf)) {
-            mSrcImage.cancelBuffer();
-            return false;
+    // a scaler device configured with the formats of the source and the target
+    struct Context {
+        Device mDevice;
+        Image mSrcImage{mDevice, 0, 0, V4L2_PIX_FMT_YUYV, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE};
+        Image mDstImage{mDevice, 0, 0, V4L2_PIX_FMT_YUYV, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE};
+        std::chrono::steady_clock::time_point mLastUsed;
+
+        bool configure(const Format &src, const Format &dst);
+        bool matches(const Format &src, const Format &dst) {
+            return mSrcImage.same(src.width, src.height, src.format) &&
+                   mDstImage.same(dst.width, dst.height, dst.format);
         }
 
-        if (!mSrcImage.dequeueBuffer() || !mDstImage.dequeueBuffer()) {
-            mSrcImage.cancelBuffer();
-            mDstImage.cancelBuffer();
-            return false;
+        template<class T>
+        bool queue(T srcBuf[SCALER_MAX_PLANES], int dstBuf) {
+            if (!mSrcImage.queueBuffer(srcBuf))
+                return false;
+
+            if (!mDstImage.queueBuffer(dstBuf)) {
+                mSrcImage.cancelBuffer();
+                return false;
+            }
+
+            if (!mSrcImage.dequeueBuffer() || !mDstImage.dequeueBuffer()) {
+                mSrcImage.cancelBuffer();
+                mDstImage.cancelBuffer();
+                return false;
+            }
+
+            return true;
         }
+    };
 
-        return true;
-    }
+    class DevicePool {
+    public:
+        static DevicePool &getInstance();
+
+        // the context is not yet configured if no idle device has the formats
+        std::unique_ptr<Context> acquire(const Format &src, const Format &dst);
+        void release(std::unique_ptr<Context> context, bool reusable);
+        bool available();
+        void setLimits(unsigned int max_devices, unsigned int idle_msec);
+    private:
+        void closeIdle(std::chrono::steady_clock::time_point now);
+
+        std::mutex mLock;
+        std::list<std::unique_ptr<Context>> mIdle; // the most recently used first
+        unsigned int mNumDevices = 0; // including the devices in use
+        unsigned int mMaxDevices = SCALER_POOL_DEFAULT_DEVICES;
+        std::chrono::milliseconds mIdleTimeout{SCALER_POOL_DEFAULT_IDLE_MSEC};
+    };
+
+    template<class T>
+    bool run(T srcBuf[SCALER_MAX_PLANES], unsigned int srcMemType, int dstBuf);
 
-    Device mDevice;
-    Image mSrcImage{mDevice, 0, 0, V4L2_PIX_FMT_YUYV, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE};
-    Image mDstImage{mDevice, 0, 0, V4L2_PIX_FMT_YUYV, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE};
+    Format mSrcFormat;
+    Format mDstFormat;
 };
 
 #endif //__HARDWARE_EXYNOS_LIBSCALERFORJPEG_H__
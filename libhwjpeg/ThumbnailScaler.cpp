@@ -14,13 +14,86 @@
  * limitations under the License.
  */
 
+#include <memory>
+
 #include <log/log.h>
 
 #include "ThumbnailScaler.h"
+#include "ThumbnailScalerSW.h"
 #include "LibScalerForJpeg.h"
 
+// The software scaler is cheaper than the setup of the M2M scaler for small
+// thumbnails. Above the ratio, bilinear sampling misses too many pixels.
+#define THUMB_SW_MAX_PIXELS (512 * 384)
+#define THUMB_SW_MAX_RATIO 4
+
+/*
+ * Picks the software scaler or the M2M scaler for each configuration of the
+ * source and the target images. The M2M scaler is opened on its first use.
+ */
+class AdaptiveThumbnailScaler : public ThumbnailScaler {
+public:
+    AdaptiveThumbnailScaler() { }
+    ~AdaptiveThumbnailScaler() { }
+
+    bool SetSrcImage(unsigned int width, unsigned int height, unsigned int v4l2_format) {
+        mSrcWidth = width;
+        mSrcHeight = height;
+        mSrcFormat = v4l2_format;
+        return true;
+    }
+
+    bool SetDstImage(unsigned int width, unsigned int height, unsigned int v4l2_format) {
+        ThumbnailScaler *scaler = select(width, height, v4l2_format);
+        if (scaler != mCurrent) {
+            ALOGD("Thumbnail scaler for %ux%u -> %ux%u: %s", mSrcWidth, mSrcHeight, width, height,
+                  (scaler == &mSoftware) ? "software" : "legacy V4L2 Scaler");
+            mCurrent = scaler;
+        }
+
+        return mCurrent->SetSrcImage(mSrcWidth, mSrcHeight, mSrcFormat) &&
+               mCurrent->SetDstImage(width, height, v4l2_format);
+    }
+
+    bool RunStream(int srcBuf[SCALER_MAX_PLANES], int srcLen[SCALER_MAX_PLANES], int dstBuf, size_t dstLen) {
+        return mCurrent && mCurrent->RunStream(srcBuf, srcLen, dstBuf, dstLen);
+    }
+
+    bool RunStream(char *srcBuf[SCALER_MAX_PLANES], int srcLen[SCALER_MAX_PLANES], int dstBuf, size_t dstLen) {
+        return mCurrent && mCurrent->RunStream(srcBuf, srcLen, dstBuf, dstLen);
+    }
+
+    bool available() { return true; }
+private:
+    ThumbnailScaler *select(unsigned int width, unsigned int height, unsigned int v4l2_format) {
+        bool software = ThumbnailScalerSW::isSupportedFormat(mSrcFormat, v4l2_format);
+
+        if (software && ((width * height) <= THUMB_SW_MAX_PIXELS) &&
+                (mSrcWidth <= (width * THUMB_SW_MAX_RATIO)) &&
+                (mSrcHeight <= (height * THUMB_SW_MAX_RATIO)))
+            return &mSoftware;
+
+        if (!mHardware)
+            mHardware.reset(new LibScalerForJpeg());
+
+        // the software scaler is still better than nothing
+        if (!mHardware->available() && software)
+            return &mSoftware;
+
+        return mHardware.get();
+    }
+
+    unsigned int mSrcWidth = 0;
+    unsigned int mSrcHeight = 0;
+    unsigned int mSrcFormat = 0;
+
+    ThumbnailScaler *mCurrent = nullptr;
+    ThumbnailScalerSW mSoftware;
+    std::unique_ptr<LibScalerForJpeg> mHardware;
+};
+
 ThumbnailScaler *ThumbnailScaler::createInstance()
 {
-    ALOGD("Created thumbnail scaler: legacy V4L2 Scaler");
-    return new LibScalerForJpeg();
+    ALOGD("Created thumbnail scaler: software and legacy V4L2 Scaler");
+    return new AdaptiveThumbnailScaler();
 }
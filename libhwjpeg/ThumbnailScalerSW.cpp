@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+#include <linux/videodev2.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "hwjpeg-internal.h"
+#include "ThumbnailScalerSW.h"
+
+// weights of bilinear sampling are 7-bit: 128 is the whole pixel
+#define WEIGHT_SHIFT 7
+#define WEIGHT_ONE (1 << WEIGHT_SHIFT)
+
+bool ThumbnailScalerSW::isSupportedFormat(unsigned int v4l2_format)
+{
+    switch (v4l2_format) {
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+        case V4L2_PIX_FMT_NV12M:
+        case V4L2_PIX_FMT_NV21M:
+        case V4L2_PIX_FMT_YUYV:
+            return true;
+    }
+
+    return false;
+}
+
+static bool isYUYV(unsigned int v4l2_format)
+{
+    return v4l2_format == V4L2_PIX_FMT_YUYV;
+}
+
+static bool isSameLayout(unsigned int src_format, unsigned int dst_format)
+{
+    if (isYUYV(src_format) || isYUYV(dst_format))
+        return src_format == dst_format;
+
+    bool src_nv21 = (src_format == V4L2_PIX_FMT_NV21) || (src_format == V4L2_PIX_FMT_NV21M);
+    bool dst_nv21 = (dst_format == V4L2_PIX_FMT_NV21) || (dst_format == V4L2_PIX_FMT_NV21M);
+
+    return src_nv21 == dst_nv21;
+}
+
+bool ThumbnailScalerSW::isSupportedFormat(unsigned int src_format, unsigned int dst_format)
+{
+    return isSupportedFormat(src_format) && isSupportedFormat(dst_format) &&
+           isSameLayout(src_format, dst_format);
+}
+
+static size_t getImageLength(unsigned int width, unsigned int height, unsigned int v4l2_format)
+{
+    return isYUYV(v4l2_format) ? width * height * 2 : width * height * 3 / 2;
+}
+
+bool ThumbnailScalerSW::SetSrcImage(unsigned int width, unsigned int height, unsigned int v4l2_format)
+{
+    if (!isSupportedFormat(v4l2_format) || (width == 0) || (height == 0) ||
+            ((width | height) & 1)) {
+        ALOGE("Unsupported source image %ux%u of format %#x", width, height, v4l2_format);
+        return false;
+    }
+
+    if ((mSrcImage.width != width) || (mSrcImage.height != height) || (mSrcImage.format != v4l2_format))
+        mTapsValid = false;
+
+    mSrcImage.width = width;
+    mSrcImage.height = height;
+    mSrcImage.format = v4l2_format;
+
+    return true;
+}
+
+bool ThumbnailScalerSW::SetDstImage(unsigned int width, unsigned int height, unsigned int v4l2_format)
+{
+    if (!isSupportedFormat(v4l2_format) || (width == 0) || (height == 0) ||
+            ((width | height) & 1)) {
+        ALOGE("Unsupported target image %ux%u of format %#x", width, height, v4l2_format);
+        return false;
+    }
+
+    if ((mDstImage.width != width) || (mDstImage.height != height) || (mDstImage.format != v4l2_format))
+        mTapsValid = false;
+
+    mDstImage.width = width;
+    mDstImage.height = height;
+    mDstImage.format = v4l2_format;
+
+    return true;
+}
+
+// position of the source pixel of the target pixel @index with pixel centers aligned
+static void getSamplingPoint(uint32_t srcLen, uint32_t dstLen, uint32_t index,
+                             uint32_t &first, uint32_t &second, uint32_t &weight)
+{
+    int64_t pos = ((2 * static_cast<int64_t>(index) + 1) * srcLen << 16) / (2 * dstLen) - (1 << 15);
+    if (pos < 0)
+        pos = 0;
+
+    first = static_cast<uint32_t>(pos >> 16);
+    second = min(first + 1, srcLen - 1);
+    weight = static_cast<uint32_t>(pos >> (16 - WEIGHT_SHIFT)) & (WEIGHT_ONE - 1);
+}
+
+void ThumbnailScalerSW::buildTaps()
+{
+    uint32_t first, second, weight;
+
+    if (isYUYV(mSrcImage.format)) {
+        // Y0 U Y1 V: chroma is sampled at the half width
+        mTapsLuma.resize(mDstImage.width * 2);
+        for (uint32_t x = 0; x < mDstImage.width; x++) {
+            getSamplingPoint(mSrcImage.width, mDstImage.width, x, first, second, weight);
+            mTapsLuma[x * 2] = {first * 2, second * 2, weight};
+        }
+        for (uint32_t x = 0; x < mDstImage.width / 2; x++) {
+            getSamplingPoint(mSrcImage.width / 2, mDstImage.width / 2, x, first, second, weight);
+            mTapsLuma[x * 4 + 1] = {first * 4 + 1, second * 4 + 1, weight};
+            mTapsLuma[x * 4 + 3] = {first * 4 + 3, second * 4 + 3, weight};
+        }
+    } else {
+        mTapsLuma.resize(mDstImage.width);
+        for (uint32_t x = 0; x < mDstImage.width; x++) {
+            getSamplingPoint(mSrcImage.width, mDstImage.width, x, first, second, weight);
+            mTapsLuma[x] = {first, second, weight};
+        }
+
+        // CbCr pairs at the half width
+        mTapsChroma.resize(mDstImage.width);
+        for (uint32_t x = 0; x < mDstImage.width / 2; x++) {
+            getSamplingPoint(mSrcImage.width / 2, mDstImage.width / 2, x, first, second, weight);
+            mTapsChroma[x * 2] = {first * 2, second * 2, weight};
+            mTapsChroma[x * 2 + 1] = {first * 2 + 1, second * 2 + 1, weight};
+        }
+    }
+
+    mTapsValid = true;
+}
+
+static void blendRows(const uint8_t *row0, const uint8_t *row1, uint32_t weight,
+                      uint8_t *out, size_t len)
+{
+    size_t i = 0;
+
+    if (weight == 0) {
+        memcpy(out, row0, len);
+        return;
+    }
+
+#ifdef __ARM_NEON
+    uint8x8_t w0 = vdup_n_u8(static_cast<uint8_t>(WEIGHT_ONE - weight));
+    uint8x8_t w1 = vdup_n_u8(static_cast<uint8_t>(weight));
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t a = vld1q_u8(row0 + i);
+        uint8x16_t b = vld1q_u8(row1 + i);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), w0), vget_low_u8(b), w1);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), w0), vget_high_u8(b), w1);
+        vst1q_u8(out + i, vcombine_u8(vrshrn_n_u16(lo, WEIGHT_SHIFT), vrshrn_n_u16(hi, WEIGHT_SHIFT)));
+    }
+#endif
+
+    for (; i < len; i++)
+        out[i] = static_cast<uint8_t>((row0[i] * (WEIGHT_ONE - weight) + row1[i] * weight +
+                                       (WEIGHT_ONE / 2)) >> WEIGHT_SHIFT);
+}
+
+void ThumbnailScalerSW::scalePlane(const uint8_t *src, uint32_t srcStride, uint32_t srcHeight,
+                                   uint8_t *dst, uint32_t dstHeight, const std::vector<Tap> &taps)
+{
+    mRow.resize(srcStride);
+
+    for (uint32_t y = 0; y < dstHeight; y++) {
+        uint32_t first, second, weight;
+        getSamplingPoint(srcHeight, dstHeight, y, first, second, weight);
+
+        // vertical pass: only the two source rows of each target row are read
+        blendRows(src + first * srcStride, src + second * srcStride, weight, mRow.data(), srcStride);
+
+        for (const Tap &tap : taps) {
+            *dst++ = static_cast<uint8_t>((mRow[tap.first] * (WEIGHT_ONE - tap.weight) +
+                                           mRow[tap.second] * tap.weight +
+                                           (WEIGHT_ONE / 2)) >> WEIGHT_SHIFT);
+        }
+    }
+}
+
+bool ThumbnailScalerSW::run(char *src[SCALER_MAX_PLANES], char *dst)
+{
+    if (!isSameLayout(mSrcImage.format, mDstImage.format)) {
+        ALOGE("Unable to convert format %#x to %#x", mSrcImage.format, mDstImage.format);
+        return false;
+    }
+
+    if (!mTapsValid)
+        buildTaps();
+
+    uint8_t *target = reinterpret_cast<uint8_t *>(dst);
+
+    if (isYUYV(mSrcImage.format)) {
+        scalePlane(reinterpret_cast<uint8_t *>(src[0]), mSrcImage.width * 2, mSrcImage.height,
+                   target, mDstImage.height, mTapsLuma);
+    } else {
+        scalePlane(reinterpret_cast<uint8_t *>(src[0]), mSrcImage.width, mSrcImage.height,
+                   target, mDstImage.height, mTapsLuma);
+        scalePlane(reinterpret_cast<uint8_t *>(src[1]), mSrcImage.width, mSrcImage.height / 2,
+                   target + mDstImage.width * mDstImage.height, mDstImage.height / 2, mTapsChroma);
+    }
+
+    return true;
+}
+
+static unsigned int getNumPlanes(unsigned int v4l2_format)
+{
+    return ((v4l2_format == V4L2_PIX_FMT_NV12M) || (v4l2_format == V4L2_PIX_FMT_NV21M)) ? 2 : 1;
+}
+
+static bool syncBuffer(int fd, bool start, bool write)
+{
+    dma_buf_sync sync;
+
+    sync.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) |
+                 (write ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ);
+    if (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+        ALOGERR("Failed to sync dmabuf %d", fd);
+        return false;
+    }
+
+    return true;
+}
+
+static char *mapBuffer(int fd, size_t len, bool write)
+{
+    void *addr = mmap(NULL, len, write ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        ALOGERR("Failed to map %zu bytes of dmabuf %d", len, fd);
+        return NULL;
+    }
+
+    if (!syncBuffer(fd, true, write)) {
+        munmap(addr, len);
+        return NULL;
+    }
+
+    return reinterpret_cast<char *>(addr);
+}
+
+static void unmapBuffer(int fd, char *addr, size_t len, bool write)
+{
+    syncBuffer(fd, false, write);
+    munmap(addr, len);
+}
+
+static bool checkLength(unsigned int width, unsigned int height, unsigned int v4l2_format,
+                        int srcLen[ThumbnailScaler::SCALER_MAX_PLANES])
+{
+    size_t luma = width * height;
+    size_t required = (getNumPlanes(v4l2_format) == 2) ? luma : getImageLength(width, height, v4l2_format);
+
+    if ((static_cast<size_t>(srcLen[0]) < required) ||
+            ((getNumPlanes(v4l2_format) == 2) && (static_cast<size_t>(srcLen[1]) < (luma / 2)))) {
+        ALOGE("Too small source buffer for %ux%u of format %#x", width, height, v4l2_format);
+        return false;
+    }
+
+    return true;
+}
+
+bool ThumbnailScalerSW::RunStream(int srcBuf[SCALER_MAX_PLANES], int srcLen[SCALER_MAX_PLANES], int dstBuf, size_t dstLen)
+{
+    if (!checkLength(mSrcImage.width, mSrcImage.height, mSrcImage.format, srcLen))
+        return false;
+
+    if (dstLen < getImageLength(mDstImage.width, mDstImage.height, mDstImage.format)) {
+        ALOGE("Too small target buffer %zu bytes for %ux%u", dstLen, mDstImage.width, mDstImage.height);
+        return false;
+    }
+
+    char *src[SCALER_MAX_PLANES] = {NULL, NULL, NULL};
+    unsigned int num_planes = getNumPlanes(mSrcImage.format);
+    unsigned int mapped = 0;
+    bool okay = false;
+
+    for (; mapped < num_planes; mapped++) {
+        src[mapped] = mapBuffer(srcBuf[mapped], srcLen[mapped], false);
+        if (!src[mapped])
+            break;
+    }
+
+    char *dst = (mapped == num_planes) ? mapBuffer(dstBuf, dstLen, true) : NULL;
+    if (dst) {
+        if ((num_planes == 1) && !isYUYV(mSrcImage.format))
+            src[1] = src[0] + mSrcImage.width * mSrcImage.height;
+
+        okay = run(src, dst);
+
+        unmapBuffer(dstBuf, dst, dstLen, true);
+    }
+
+    for (unsigned int i = 0; i < mapped; i++)
+        unmapBuffer(srcBuf[i], src[i], srcLen[i], false);
+
+    return okay;
+}
+
+bool ThumbnailScalerSW::RunStream(char *srcBuf[SCALER_MAX_PLANES], int srcLen[SCALER_MAX_PLANES], int dstBuf, size_t dstLen)
+{
+    if (!checkLength(mSrcImage.width, mSrcImage.height, mSrcImage.format, srcLen))
+        return false;
+
+    if (dstLen < getImageLength(mDstImage.width, mDstImage.height, mDstImage.format)) {
+        ALOGE("Too small target buffer %zu bytes for %ux%u", dstLen, mDstImage.width, mDstImage.height);
+        return false;
+    }
+
+    char *dst = mapBuffer(dstBuf, dstLen, true);
+    if (!dst)
+        return false;
+
+    char *src[SCALER_MAX_PLANES] = {srcBuf[0], srcBuf[1], NULL};
+    if ((getNumPlanes(mSrcImage.format) == 1) && !isYUYV(mSrcImage.format))
+        src[1] = srcBuf[0] + mSrcImage.width * mSrcImage.height;
+
+    bool okay = run(src, dst);
+
+    unmapBuffer(dstBuf, dst, dstLen, true);
+
+    return okay;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __HARDWARE_EXYNOS_THUMBNAIL_SCALER_SW_H__
+#define __HARDWARE_EXYNOS_THUMBNAIL_SCALER_SW_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "ThumbnailScaler.h"
+
+/*
+ * Bilinear downscaling on the CPU for NV12, NV21 and YUYV. The sampling points
+ * are aligned to the pixel centers so that halving is the 2x2 box filter. The
+ * source and the target images should have the same chroma layout.
+ */
+class ThumbnailScalerSW : public ThumbnailScaler {
+public:
+    ThumbnailScalerSW() { }
+    ~ThumbnailScalerSW() { }
+
+    bool SetSrcImage(unsigned int width, unsigned int height, unsigned int v4l2_format);
+    bool SetDstImage(unsigned int width, unsigned int height, unsigned int v4l2_format);
+
+    bool RunStream(int srcBuf[SCALER_MAX_PLANES], int srcLen[SCALER_MAX_PLANES], int dstBuf, size_t dstLen);
+    bool RunStream(char *srcBuf[SCALER_MAX_PLANES], int srcLen[SCALER_MAX_PLANES], int dstBuf, size_t dstLen);
+
+    bool available() { return true; }
+
+    static bool isSupportedFormat(unsigned int v4l2_format);
+    // true if @src_format is scaled to @dst_format without color conversion
+    static bool isSupportedFormat(unsigned int src_format, unsigned int dst_format);
+private:
+    struct Image {
+        unsigned int width = 0;
+        unsigned int height = 0;
+        unsigned int format = 0;
+    };
+
+    // sampling point of a target byte in a row: the offsets of the two source
+    // bytes to blend and the weight of the second byte in 1/128
+    struct Tap {
+        uint32_t first;
+        uint32_t second;
+        uint32_t weight;
+    };
+
+    bool run(char *src[SCALER_MAX_PLANES], char *dst);
+    void buildTaps();
+    void scalePlane(const uint8_t *src, uint32_t srcStride, uint32_t srcHeight,
+                    uint8_t *dst, uint32_t dstHeight, const std::vector<Tap> &taps);
+
+    Image mSrcImage;
+    Image mDstImage;
+    std::vector<uint8_t> mRow;
+    std::vector<Tap> mTapsLuma; // taps of the only plane of YUYV
+    std::vector<Tap> mTapsChroma;
+    bool mTapsValid = false;
+};
+
+#endif //__HARDWARE_EXYNOS_THUMBNAIL_SCALER_SW_H__
@@ -28,8 +28,11 @@
 #include <unistd.h>
 #include <log/log.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 
+#include <vector>
+
 #ifdef __GNUC__
 #  define __UNUSED__ __attribute__((__unused__))
 #else
@@ -53,6 +56,9 @@
 
 #define ARRSIZE(v) (sizeof(v) / sizeof(v[0]))
 
+// The JPEG device node if no node is found by its name
+#define HWJPEG_DEFAULT_DEVNODE "/dev/video12"
+
 #ifndef min
 template <typename T>
 static inline T min(T val1, T val2) {
@@ -84,6 +90,57 @@ public:
     unsigned long GetElapsedUpdate();
 };
 
+/*
+ * CHWJpegScheduler - Shares the JPEG encoder devices among the compressors
+ *
+ * The video nodes of the JPEG encoders are discovered once by their names in
+ * sysfs. A compressor is bound to the least loaded node when it is created and
+ * moves to an idle node before queueing a frame if its node is busy with the
+ * frames of other compressors.
+ */
+class CHWJpegScheduler {
+public:
+    struct DeviceStats {
+        unsigned int bound;         // compressors that have the node open
+        unsigned int active;        // frames queued to the node
+        unsigned long jobs;         // completed frames
+        unsigned long busy_us;      // sum of the H/W delays of the completed frames
+        unsigned long elapsed_us;   // since the node is discovered
+    };
+
+    static CHWJpegScheduler &Instance();
+
+    unsigned int GetDeviceCount() { return static_cast<unsigned int>(m_Devices.size()); }
+    const char *GetDevicePath(unsigned int node) { return m_Devices[node].path; }
+
+    unsigned int Bind();
+    void Unbind(unsigned int node);
+    void Rebind(unsigned int from, unsigned int to);
+    // The node to queue the next frame of a compressor bound to @node
+    unsigned int Dispatch(unsigned int node);
+
+    void BeginJob(unsigned int node);
+    void EndJob(unsigned int node, unsigned int hw_delay_us);
+    void CancelJobs(unsigned int node, unsigned int count);
+
+    bool GetStats(unsigned int node, DeviceStats *stats);
+private:
+    struct Device {
+        char path[32];
+        unsigned int bound;
+        unsigned int active;
+        unsigned long jobs;
+        unsigned long busy_us;
+        CStopWatch since;
+    };
+    pthread_mutex_t m_Lock;
+    std::vector<Device> m_Devices; // never changes after discovery
+
+    CHWJpegScheduler();
+    void AddDevice(const char *path);
+    unsigned int LeastLoaded();
+};
+
 bool WriteToFile(const char *path, const char *data, size_t len);
 bool WriteToFile(const char *path, int dmabuf, size_t len);
 #endif //__HWJPEG_INTERNAL_H__
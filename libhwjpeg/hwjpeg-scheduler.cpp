@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <cutils/properties.h>
+
+#include "hwjpeg-internal.h"
+
+#define VIDEODEV_MAJOR 81
+#define VIDEODEV_NAME_LEN 64
+
+// The name of the JPEG encoders in /sys/class/video4linux/videoN/name
+#define HWJPEG_DEVNAME_PROP "vendor.hwjpeg.devname"
+#define HWJPEG_DEFAULT_DEVNAME "exynos-jpeg"
+
+static bool IsVideoNodeOf(int node, const char *devname)
+{
+    char filename[64];
+    char name[VIDEODEV_NAME_LEN];
+    struct stat s;
+
+    snprintf(filename, sizeof(filename), "/dev/video%d", node);
+    if ((lstat(filename, &s) != 0) || !S_ISCHR(s.st_mode) || (major(s.st_rdev) != VIDEODEV_MAJOR))
+        return false;
+
+    snprintf(filename, sizeof(filename), "/sys/class/video4linux/video%d/name", node);
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+        return false;
+
+    bool found = (fgets(name, sizeof(name), fp) != NULL) &&
+                 (strncmp(name, devname, strlen(devname)) == 0);
+    fclose(fp);
+
+    return found;
+}
+
+CHWJpegScheduler &CHWJpegScheduler::Instance()
+{
+    static CHWJpegScheduler scheduler;
+    return scheduler;
+}
+
+CHWJpegScheduler::CHWJpegScheduler()
+{
+    pthread_mutex_init(&m_Lock, NULL);
+
+    char devname[PROPERTY_VALUE_MAX];
+    property_get(HWJPEG_DEVNAME_PROP, devname, HWJPEG_DEFAULT_DEVNAME);
+
+    std::vector<int> nodes;
+    DIR *dir = opendir("/sys/class/video4linux");
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            int node;
+            if ((sscanf(entry->d_name, "video%d", &node) == 1) && IsVideoNodeOf(node, devname))
+                nodes.push_back(node);
+        }
+        closedir(dir);
+    }
+    std::sort(nodes.begin(), nodes.end());
+
+    for (int node : nodes) {
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/video%d", node);
+        AddDevice(path);
+    }
+
+    if (m_Devices.empty())
+        AddDevice(HWJPEG_DEFAULT_DEVNODE);
+
+    ALOGI("%zu JPEG encoder(s) found by the name '%s'", nodes.size(), devname);
+}
+
+void CHWJpegScheduler::AddDevice(const char *path)
+{
+    Device device;
+
+    strncpy(device.path, path, sizeof(device.path) - 1);
+    device.path[sizeof(device.path) - 1] = '\0';
+    device.bound = 0;
+    device.active = 0;
+    device.jobs = 0;
+    device.busy_us = 0;
+    device.since.Start();
+
+    m_Devices.push_back(device);
+}
+
+// Fewer frames in flight first, then fewer compressors to share the node with
+unsigned int CHWJpegScheduler::LeastLoaded()
+{
+    unsigned int best = 0;
+
+    for (unsigned int i = 1; i < m_Devices.size(); i++) {
+        if ((m_Devices[i].active < m_Devices[best].active) ||
+                ((m_Devices[i].active == m_Devices[best].active) &&
+                 (m_Devices[i].bound < m_Devices[best].bound)))
+            best = i;
+    }
+
+    return best;
+}
+
+unsigned int CHWJpegScheduler::Bind()
+{
+    pthread_mutex_lock(&m_Lock);
+    unsigned int node = LeastLoaded();
+    m_Devices[node].bound++;
+    pthread_mutex_unlock(&m_Lock);
+
+    return node;
+}
+
+void CHWJpegScheduler::Unbind(unsigned int node)
+{
+    pthread_mutex_lock(&m_Lock);
+    m_Devices[node].bound--;
+    pthread_mutex_unlock(&m_Lock);
+}
+
+void CHWJpegScheduler::Rebind(unsigned int from, unsigned int to)
+{
+    pthread_mutex_lock(&m_Lock);
+    m_Devices[from].bound--;
+    m_Devices[to].bound++;
+    pthread_mutex_unlock(&m_Lock);
+}
+
+unsigned int CHWJpegScheduler::Dispatch(unsigned int node)
+{
+    pthread_mutex_lock(&m_Lock);
+    // Moving to another node costs the format and buffer negotiation.
+    // It is worth only if the frame would wait for the other compressors.
+    if (m_Devices[node].active > 0) {
+        unsigned int idle = LeastLoaded();
+        if (m_Devices[idle].active == 0)
+            node = idle;
+    }
+    pthread_mutex_unlock(&m_Lock);
+
+    return node;
+}
+
+void CHWJpegScheduler::BeginJob(unsigned int node)
+{
+    pthread_mutex_lock(&m_Lock);
+    m_Devices[node].active++;
+    pthread_mutex_unlock(&m_Lock);
+}
+
+void CHWJpegScheduler::EndJob(unsigned int node, unsigned int hw_delay_us)
+{
+    pthread_mutex_lock(&m_Lock);
+    m_Devices[node].active--;
+    m_Devices[node].jobs++;
+    m_Devices[node].busy_us += hw_delay_us;
+    pthread_mutex_unlock(&m_Lock);
+}
+
+void CHWJpegScheduler::CancelJobs(unsigned int node, unsigned int count)
+{
+    pthread_mutex_lock(&m_Lock);
+    m_Devices[node].active -= count;
+    pthread_mutex_unlock(&m_Lock);
+}
+
+bool CHWJpegScheduler::GetStats(unsigned int node, DeviceStats *stats)
+{
+    if (node >= m_Devices.size())
+        return false;
+
+    pthread_mutex_lock(&m_Lock);
+    stats->bound = m_Devices[node].bound;
+    stats->active = m_Devices[node].active;
+    stats->jobs = m_Devices[node].jobs;
+    stats->busy_us = m_Devices[node].busy_us;
+    stats->elapsed_us = m_Devices[node].since.GetElapsed();
+    pthread_mutex_unlock(&m_Lock);
+
+    return true;
+}
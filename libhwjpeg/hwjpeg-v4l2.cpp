@@ -15,13 +15,22 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+
 #include <linux/videodev2.h>
 #include <linux/v4l2-controls.h>
 
 #include <exynos-hwjpeg.h>
 #include "hwjpeg-internal.h"
 
-CHWJpegV4L2Compressor::CHWJpegV4L2Compressor(): CHWJpegCompressor("/dev/video12")
+CHWJpegV4L2Compressor::CHWJpegV4L2Compressor()
+        : CHWJpegV4L2Compressor(CHWJpegScheduler::Instance().Bind())
+{
+}
+
+CHWJpegV4L2Compressor::CHWJpegV4L2Compressor(unsigned int device)
+        : CHWJpegCompressor(CHWJpegScheduler::Instance().GetDevicePath(device)),
+          m_uiDevice(device)
 {
     memset(&m_v4l2Format, 0, sizeof(m_v4l2Format));
     memset(&m_v4l2SrcBuffer, 0, sizeof(m_v4l2SrcBuffer));
@@ -46,13 +55,28 @@ CHWJpegV4L2Compressor::CHWJpegV4L2Compressor(): CHWJpegCompressor("/dev/video12"
     m_v4l2DstBuffer.m.planes = m_v4l2DstPlanes;
 
     m_uiControlsToSet = 0;
+    m_uiHWDelay = 0;
+    m_uiPipelineDepth = 1;
+    m_uiQueuedFrames = 0;
+    m_uiNextBufferIndex = 0;
 
     m_bEnableHWFC = false;
 
+    memset(&m_Sessions, 0, sizeof(m_Sessions));
+    for (auto &session : m_Sessions)
+        session.fd = -1;
+    m_uiSessionClock = 0;
+
+    memset(&m_QTables, 0, sizeof(m_QTables));
+    m_uiQTableGen = 0;
+    m_uiAppliedQTableGen = 0;
+    m_bQTableLast = false;
+
     v4l2_capability cap;
     memset(&cap, 0, sizeof(cap));
     if (ioctl(GetDeviceFD(), VIDIOC_QUERYCAP, &cap) < 0) {
-        ALOGERR("Failed to query capability of /dev/video12");
+        ALOGERR("Failed to query capability of %s",
+                CHWJpegScheduler::Instance().GetDevicePath(m_uiDevice));
     } else if (!!(cap.capabilities & V4L2_CAP_DEVICE_CAPS)) {
         SetDeviceCapabilities(cap.device_caps);
     }
@@ -60,12 +84,21 @@ CHWJpegV4L2Compressor::CHWJpegV4L2Compressor(): CHWJpegCompressor("/dev/video12"
     // Initialy declare that s_fmt is required.
     SetFlag(HWJPEG_FLAG_PIX_FMT);
 
-    ALOGD("CHWJpegV4L2Compressor Created: %p, FD %d", this, GetDeviceFD());
+    ALOGD("CHWJpegV4L2Compressor Created: %p, FD %d of %s", this, GetDeviceFD(),
+          CHWJpegScheduler::Instance().GetDevicePath(m_uiDevice));
 }
 
 CHWJpegV4L2Compressor::~CHWJpegV4L2Compressor()
 {
     StopStreaming();
+    DropSessions();
+    CHWJpegScheduler::Instance().Unbind(m_uiDevice);
+
+    CHWJpegScheduler::DeviceStats stats;
+    if (CHWJpegScheduler::Instance().GetStats(m_uiDevice, &stats) && (stats.elapsed_us > 0))
+        ALOGD("%s: %lu frames, %lu%% busy, %u compressors bound",
+              CHWJpegScheduler::Instance().GetDevicePath(m_uiDevice), stats.jobs,
+              stats.busy_us * 100 / stats.elapsed_us, stats.bound);
 
     ALOGD("CHWJpegV4L2Compressor Destroyed: %p, FD %d", this, GetDeviceFD());
 }
@@ -108,6 +141,7 @@ bool CHWJpegV4L2Compressor::SetQuality(
     }
 
     if (quality_factor > 0) {
+        m_bQTableLast = false;
         m_v4l2Controls[HWJPEG_CTRL_QFACTOR].id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
         m_v4l2Controls[HWJPEG_CTRL_QFACTOR].value = static_cast<__s32>(quality_factor);
         m_uiControlsToSet |= 1 << HWJPEG_CTRL_QFACTOR;
@@ -123,6 +157,19 @@ bool CHWJpegV4L2Compressor::SetQuality(
 }
 
 bool CHWJpegV4L2Compressor::SetQuality(const unsigned char qtable[])
+{
+    memcpy(m_QTables, qtable, sizeof(m_QTables));
+
+    if (!ApplyQTables())
+        return false;
+
+    m_uiAppliedQTableGen = ++m_uiQTableGen;
+    m_bQTableLast = true;
+
+    return true;
+}
+
+bool CHWJpegV4L2Compressor::ApplyQTables()
 {
     v4l2_ext_controls ctrls;
     v4l2_ext_control ctrl;
@@ -135,8 +182,8 @@ bool CHWJpegV4L2Compressor::SetQuality(const unsigned char qtable[])
     ctrls.count = 1;
 
     ctrl.id = V4L2_CID_JPEG_QTABLES2;
-    ctrl.size = 128; /* two quantization tables */
-    ctrl.p_u8 = const_cast<unsigned char *>(qtable);
+    ctrl.size = sizeof(m_QTables); /* two quantization tables */
+    ctrl.p_u8 = m_QTables;
 
     if (ioctl(GetDeviceFD(), VIDIOC_S_EXT_CTRLS, &ctrls) < 0) {
         ALOGERR("Failed to configure %u controls", ctrls.count);
@@ -146,6 +193,147 @@ bool CHWJpegV4L2Compressor::SetQuality(const unsigned char qtable[])
     return true;
 }
 
+void CHWJpegV4L2Compressor::SaveSession(StreamingSession &session)
+{
+    session.fd = GetDeviceFD();
+    session.format = m_v4l2Format;
+    session.flags = GetFlags() & (HWJPEG_FLAG_PIX_FMT | HWJPEG_FLAG_REQBUFS | HWJPEG_FLAG_STREAMING);
+    for (unsigned int i = 0; i < HWJPEG_CTRL_NUM; i++) {
+        session.controls[i] = m_v4l2Controls[i];
+        // the control is not applied to the device yet
+        if (!!(m_uiControlsToSet & (1 << i)))
+            session.controls[i].id = 0;
+    }
+    session.hwfc = m_bEnableHWFC;
+    session.qtable_gen = m_uiAppliedQTableGen;
+    session.last_used = ++m_uiSessionClock;
+}
+
+void CHWJpegV4L2Compressor::LoadSession(StreamingSession &session)
+{
+    ReplaceDeviceFD(session.fd);
+    m_v4l2Format = session.format;
+
+    ClearFlag(HWJPEG_FLAG_PIX_FMT | HWJPEG_FLAG_REQBUFS | HWJPEG_FLAG_STREAMING);
+    SetFlag(session.flags);
+    m_uiNextBufferIndex = 0;
+
+    // Only the controls that differ from the ones in the device are applied
+    for (unsigned int i = 0; i < HWJPEG_CTRL_NUM; i++) {
+        if (m_v4l2Controls[i].id == 0)
+            continue;
+        if ((session.controls[i].id != m_v4l2Controls[i].id) ||
+                (session.controls[i].value != m_v4l2Controls[i].value))
+            m_uiControlsToSet |= 1 << i;
+    }
+    m_bEnableHWFC = session.hwfc;
+
+    if (session.qtable_gen != m_uiQTableGen) {
+        // Keep the order of SetQuality(qtable) and SetQuality(factor) that the
+        // device of the session has not seen.
+        if (m_bQTableLast)
+            ApplyQTables(); // an error is reported by ApplyQTables()
+        else if (m_v4l2Controls[HWJPEG_CTRL_QFACTOR].id != 0)
+            m_uiControlsToSet |= 1 << HWJPEG_CTRL_QFACTOR;
+    }
+    m_uiAppliedQTableGen = m_uiQTableGen;
+
+    session.fd = -1;
+}
+
+bool CHWJpegV4L2Compressor::SwitchSession(__u32 v4l2_fmt, __u32 width, __u32 height)
+{
+    if (m_uiQueuedFrames > 0)
+        return false;
+
+    StreamingSession current;
+    StreamingSession *victim = &m_Sessions[0];
+
+    for (auto &session : m_Sessions) {
+        if ((session.fd >= 0) && (session.format.fmt.pix_mp.pixelformat == v4l2_fmt) &&
+                (session.format.fmt.pix_mp.width == width) &&
+                (session.format.fmt.pix_mp.height == height)) {
+            SaveSession(current);
+            LoadSession(session);
+            session = current;
+            return true;
+        }
+
+        if ((victim->fd >= 0) && ((session.fd < 0) || (session.last_used < victim->last_used)))
+            victim = &session;
+    }
+
+    // Nothing to keep if the current context has no buffer requested.
+    if (!TestFlag(HWJPEG_FLAG_REQBUFS) || TestFlag(HWJPEG_FLAG_PIX_FMT))
+        return false;
+
+    const char *path = CHWJpegScheduler::Instance().GetDevicePath(m_uiDevice);
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        ALOGERR("Failed to open '%s' for a new streaming session", path);
+        return false;
+    }
+
+    if (victim->fd >= 0)
+        close(victim->fd); // releases the buffers and stops the streaming
+    SaveSession(*victim);
+
+    // the new context has none of the controls applied
+    memset(&current, 0, sizeof(current));
+    current.fd = fd;
+    current.format = m_v4l2Format;
+    LoadSession(current);
+
+    return false;
+}
+
+void CHWJpegV4L2Compressor::DropSessions()
+{
+    for (auto &session : m_Sessions) {
+        if (session.fd >= 0)
+            close(session.fd);
+        session.fd = -1;
+    }
+}
+
+// The current context is replaced by a new one on @device with the format and
+// the controls to be applied again. The parked sessions are on the previous
+// device and are dropped.
+bool CHWJpegV4L2Compressor::MoveToDevice(unsigned int device)
+{
+    if (m_uiQueuedFrames > 0)
+        return false;
+
+    CHWJpegScheduler &scheduler = CHWJpegScheduler::Instance();
+    int fd = open(scheduler.GetDevicePath(device), O_RDWR);
+    if (fd < 0) {
+        ALOGERR("Failed to open '%s'", scheduler.GetDevicePath(device));
+        return false;
+    }
+
+    if (!StopStreaming()) {
+        close(fd);
+        return false;
+    }
+    DropSessions();
+
+    StreamingSession session;
+    memset(&session, 0, sizeof(session));
+    session.fd = fd;
+    session.format = m_v4l2Format;
+    int old_fd = GetDeviceFD();
+    LoadSession(session);
+    close(old_fd);
+    SetFlag(HWJPEG_FLAG_PIX_FMT);
+
+    scheduler.Rebind(m_uiDevice, device);
+    m_uiDevice = device;
+
+    ALOGD("CHWJpegV4L2Compressor %p moved to %s", this, scheduler.GetDevicePath(device));
+
+    return true;
+}
+
 bool CHWJpegV4L2Compressor::SetImageFormat(unsigned int v4l2_fmt,
                                            unsigned int width, unsigned int height,
                                            unsigned int width2, unsigned int height2)
@@ -155,6 +343,12 @@ bool CHWJpegV4L2Compressor::SetImageFormat(unsigned int v4l2_fmt,
         (m_v4l2Format.fmt.pix_mp.height == TO_IMAGE_SIZE(height, height2)))
         return true;
 
+    // Reuse the streaming context for the format if it is configured recently.
+    // Otherwise, the current context is kept aside for later use and the new
+    // format is configured to a new context.
+    if (SwitchSession(v4l2_fmt, TO_IMAGE_SIZE(width, width2), TO_IMAGE_SIZE(height, height2)))
+        return true;
+
     m_v4l2Format.fmt.pix_mp.pixelformat = v4l2_fmt;
     m_v4l2Format.fmt.pix_mp.width = TO_IMAGE_SIZE(width, width2);
     m_v4l2Format.fmt.pix_mp.height = TO_IMAGE_SIZE(height, height2);
@@ -352,6 +546,10 @@ bool CHWJpegV4L2Compressor::StopStreaming()
 
     // Stream off dequeues all queued buffers
     ClearFlag(HWJPEG_FLAG_QBUF_OUT | HWJPEG_FLAG_QBUF_CAP);
+    if (m_uiQueuedFrames > 0)
+        CHWJpegScheduler::Instance().CancelJobs(m_uiDevice, m_uiQueuedFrames);
+    m_uiQueuedFrames = 0;
+    m_uiNextBufferIndex = 0;
 
     // It is OK to skip DQBUF because STREAMOFF dequeues all queued buffers
     if (TestFlag(HWJPEG_FLAG_REQBUFS)) {
@@ -363,8 +561,63 @@ bool CHWJpegV4L2Compressor::StopStreaming()
     return true;
 }
 
+bool CHWJpegV4L2Compressor::SetPipelineDepth(unsigned int depth)
+{
+    if ((depth == 0) || (depth > HWJPEG_V4L2_MAX_PIPELINE_DEPTH)) {
+        ALOGE("Pipeline depth %u is out of range [1, %d]", depth, HWJPEG_V4L2_MAX_PIPELINE_DEPTH);
+        return false;
+    }
+
+    if (depth == m_uiPipelineDepth)
+        return true;
+
+    if (m_uiQueuedFrames > 0) {
+        ALOGE("Unable to change pipeline depth while %u frames are queued", m_uiQueuedFrames);
+        return false;
+    }
+
+    // REQBUFS should be performed again with the new number of buffers.
+    // The parked sessions are requested with the previous depth.
+    if (!StopStreaming())
+        return false;
+
+    DropSessions();
+
+    m_uiPipelineDepth = depth;
+
+    return true;
+}
+
 ssize_t CHWJpegV4L2Compressor::Compress(size_t *secondary_stream_size, bool block_mode)
 {
+    if (m_uiQueuedFrames > 0) {
+        // The format and the controls are shared by all queued frames
+        if (TestFlag(HWJPEG_FLAG_PIX_FMT) || (m_uiControlsToSet != 0) ||
+                (m_bEnableHWFC != !!(GetAuxFlags() & EXYNOS_HWJPEG_AUXOPT_ENABLE_HWFC))) {
+            ALOGE("Configuration is changed while %u frames are queued", m_uiQueuedFrames);
+            return -1;
+        }
+
+        if (m_uiQueuedFrames >= m_uiPipelineDepth) {
+            ALOGE("No more frame is allowed to be queued (depth %u)", m_uiPipelineDepth);
+            return -1;
+        }
+
+        if (block_mode) {
+            ALOGE("Blocking compression is not allowed while %u frames are queued",
+                  m_uiQueuedFrames);
+            return -1;
+        }
+    }
+
+    // HWFC ties the compression to the camera pipeline of the node
+    if ((m_uiQueuedFrames == 0) && !m_bEnableHWFC &&
+            !(GetAuxFlags() & EXYNOS_HWJPEG_AUXOPT_ENABLE_HWFC)) {
+        unsigned int device = CHWJpegScheduler::Instance().Dispatch(m_uiDevice);
+        if (device != m_uiDevice)
+            MoveToDevice(device); // keeps the current device on failure
+    }
+
     if (TestFlag(HWJPEG_FLAG_PIX_FMT)) {
         if (!StopStreaming() || !SetFormat())
             return -1;
@@ -399,7 +652,7 @@ ssize_t CHWJpegV4L2Compressor::Compress(size_t *secondary_stream_size, bool bloc
     if (!!(GetAuxFlags() & EXYNOS_HWJPEG_AUXOPT_DST_NOCACHECLEAN))
         m_v4l2DstBuffer.flags |= V4L2_BUF_FLAG_NO_CACHE_CLEAN;
 
-    if (!ReqBufs() || !StreamOn() || !UpdateControls() || !QBuf())
+    if (!ReqBufs(m_uiPipelineDepth) || !StreamOn() || !UpdateControls() || !QBuf())
         return -1;
 
     return block_mode ? DQBuf(secondary_stream_size) : 0;
@@ -474,8 +727,19 @@ bool CHWJpegV4L2Compressor::UpdateControls()
     }
 
     if (ioctl(GetDeviceFD(), VIDIOC_S_EXT_CTRLS, &ctrls) < 0) {
-        ALOGERR("Failed to configure %u controls", ctrls.count);
-        return false;
+        ALOGD("Failed to configure %u controls at once (%d), trying one by one",
+              ctrls.count, errno);
+
+        for (unsigned int i = 0; i < ctrls.count; i++) {
+            v4l2_control single;
+
+            single.id = ctrl[i].id;
+            single.value = ctrl[i].value;
+            if (ioctl(GetDeviceFD(), VIDIOC_S_CTRL, &single) < 0) {
+                ALOGERR("Failed to configure control %#x to %d", single.id, single.value);
+                return false;
+            }
+        }
     }
 
     return true;
@@ -573,6 +837,9 @@ bool CHWJpegV4L2Compressor::QBuf()
         return false;
     }
 
+    m_v4l2SrcBuffer.index = m_uiNextBufferIndex;
+    m_v4l2DstBuffer.index = m_uiNextBufferIndex;
+
     if (ioctl(GetDeviceFD(), VIDIOC_QBUF, &m_v4l2SrcBuffer) < 0) {
         ALOGERR("QBuf of the source buffers is failed (B2B %s)",
                 IsB2BCompression() ? "enabled" : "disabled");
@@ -589,6 +856,10 @@ bool CHWJpegV4L2Compressor::QBuf()
 
     SetFlag(HWJPEG_FLAG_QBUF_OUT | HWJPEG_FLAG_QBUF_CAP);
 
+    m_uiQueuedFrames++;
+    CHWJpegScheduler::Instance().BeginJob(m_uiDevice);
+    m_uiNextBufferIndex = (m_uiNextBufferIndex + 1) % m_uiPipelineDepth;
+
     return true;
 }
 
@@ -600,6 +871,11 @@ ssize_t CHWJpegV4L2Compressor::DQBuf(size_t *secondary_stream_size)
 
     ALOG_ASSERT(TestFlag(HWJPEG_FLAG_QBUF_OUT) == TestFlag(HWJPEG_FLAG_QBUF_CAP));
 
+    if (m_uiQueuedFrames == 0) {
+        ALOGE("No frame is queued for compression");
+        return -1;
+    }
+
     memset(&buffer_src, 0, sizeof(buffer_src));
     memset(&buffer_dst, 0, sizeof(buffer_dst));
     memset(&planes_src, 0, sizeof(planes_src));
@@ -625,7 +901,10 @@ ssize_t CHWJpegV4L2Compressor::DQBuf(size_t *secondary_stream_size)
         failed = true;
     }
 
-    ClearFlag(HWJPEG_FLAG_QBUF_OUT | HWJPEG_FLAG_QBUF_CAP);
+    // The frames are completed in the order they are queued.
+    if (--m_uiQueuedFrames == 0)
+        ClearFlag(HWJPEG_FLAG_QBUF_OUT | HWJPEG_FLAG_QBUF_CAP);
+    CHWJpegScheduler::Instance().EndJob(m_uiDevice, failed ? 0 : buffer_dst.reserved2);
 
     if (failed)
         return -1;
@@ -724,24 +1003,34 @@ bool CHWJpegV4L2Compressor::GetJpegBuffer(char **buffer, size_t *len_buffer)
 void CHWJpegV4L2Compressor::Release()
 {
     StopStreaming();
+    DropSessions();
 }
 
 /******************************************************************************/
 /********* D E C O M P R E S S I O N   S U P P O R T **************************/
 /******************************************************************************/
 
-CHWJpegV4L2Decompressor::CHWJpegV4L2Decompressor() : CHWJpegDecompressor("/dev/video12")
+CHWJpegV4L2Decompressor::CHWJpegV4L2Decompressor() : CHWJpegDecompressor(HWJPEG_DEFAULT_DEVNODE)
 {
     m_v4l2Format.type = 0; // inidication of uninitialized state
 
     memset(&m_v4l2DstBuffer, 0, sizeof(m_v4l2DstBuffer));
     m_v4l2DstBuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
+    m_uiStreamWidth = 0;
+    m_uiStreamHeight = 0;
+    memset(&m_v4l2Crop, 0, sizeof(m_v4l2Crop));
+    m_bCropChanged = false;
+
+    m_uiPipelineDepth = 1;
+    m_uiQueuedFrames = 0;
+    m_uiNextBufferIndex = 0;
+
     if (Okay()) {
         v4l2_capability cap;
         memset(&cap, 0, sizeof(cap));
         if (ioctl(GetDeviceFD(), VIDIOC_QUERYCAP, &cap) < 0) {
-            ALOGERR("Failed to query capability of /dev/video12");
+            ALOGERR("Failed to query capability of " HWJPEG_DEFAULT_DEVNODE);
         } else if (!!(cap.capabilities & V4L2_CAP_DEVICE_CAPS)) {
             SetDeviceCapabilities(cap.device_caps);
         }
@@ -767,7 +1056,7 @@ bool CHWJpegV4L2Decompressor::PrepareCapture()
     v4l2_requestbuffers reqbufs;
 
     memset(&reqbufs, 0, sizeof(reqbufs));
-    reqbufs.count = 1;
+    reqbufs.count = m_uiPipelineDepth;
     reqbufs.memory = m_v4l2DstBuffer.memory;
     reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
@@ -803,6 +1092,10 @@ void CHWJpegV4L2Decompressor::CancelCapture()
     ioctl(GetDeviceFD(), VIDIOC_REQBUFS, &reqbufs);
 
     ClearFlag(HWJPEG_FLAG_CAPTURE_READY);
+
+    // STREAMOFF dequeues all queued buffers
+    m_uiQueuedFrames = 0;
+    m_uiNextBufferIndex = 0;
 }
 
 bool CHWJpegV4L2Decompressor::SetImageFormat(unsigned int v4l2_fmt,
@@ -816,6 +1109,11 @@ bool CHWJpegV4L2Decompressor::SetImageFormat(unsigned int v4l2_fmt,
             return true;
     }
 
+    if (m_uiQueuedFrames > 0) {
+        ALOGE("Unable to change the image format while %u frames are queued", m_uiQueuedFrames);
+        return false;
+    }
+
     CancelCapture();
 
     memset(&m_v4l2Format, 0, sizeof(m_v4l2Format));
@@ -831,6 +1129,10 @@ bool CHWJpegV4L2Decompressor::SetImageFormat(unsigned int v4l2_fmt,
         return false;
     }
 
+    // S_FMT may reset the region to decompress
+    if (m_v4l2Crop.width != 0)
+        m_bCropChanged = true;
+
     return true;
 }
 
@@ -854,6 +1156,74 @@ bool CHWJpegV4L2Decompressor::SetImageBuffer(int buffer, size_t len_buffer)
     return true;
 }
 
+bool CHWJpegV4L2Decompressor::SetStreamPixelSize(unsigned int width, unsigned int height)
+{
+    m_uiStreamWidth = width;
+    m_uiStreamHeight = height;
+
+    return true;
+}
+
+bool CHWJpegV4L2Decompressor::SetImageCrop(unsigned int left, unsigned int top,
+                                           unsigned int width, unsigned int height)
+{
+    if ((width == 0) || (height == 0)) {
+        // the whole image is restored by ApplyCrop() only if a region is configured before
+        if (m_v4l2Crop.width != 0)
+            m_bCropChanged = true;
+        memset(&m_v4l2Crop, 0, sizeof(m_v4l2Crop));
+        return true;
+    }
+
+    if (!IsDeviceCapability(V4L2_CAP_EXYNOS_JPEG_DECOMPRESSION_CROP)) {
+        ALOGE("Decompression of a region is not supported by H/W");
+        return false;
+    }
+
+    if ((m_v4l2Crop.left != static_cast<__s32>(left)) || (m_v4l2Crop.top != static_cast<__s32>(top)) ||
+            (m_v4l2Crop.width != width) || (m_v4l2Crop.height != height)) {
+        m_v4l2Crop.left = static_cast<__s32>(left);
+        m_v4l2Crop.top = static_cast<__s32>(top);
+        m_v4l2Crop.width = width;
+        m_v4l2Crop.height = height;
+        m_bCropChanged = true;
+    }
+
+    return true;
+}
+
+bool CHWJpegV4L2Decompressor::ApplyCrop()
+{
+    if (!m_bCropChanged)
+        return true;
+
+    if (m_uiQueuedFrames > 0) {
+        ALOGE("Unable to change the region while %u frames are queued", m_uiQueuedFrames);
+        return false;
+    }
+
+    v4l2_selection sel;
+    memset(&sel, 0, sizeof(sel));
+
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP;
+    sel.r = m_v4l2Crop;
+    if (sel.r.width == 0) {
+        sel.r.width = m_uiStreamWidth;
+        sel.r.height = m_uiStreamHeight;
+    }
+
+    if (ioctl(GetDeviceFD(), VIDIOC_S_SELECTION, &sel) < 0) {
+        ALOGERR("Failed to configure the region (%d, %d) %ux%u to decompress",
+                sel.r.left, sel.r.top, sel.r.width, sel.r.height);
+        return false;
+    }
+
+    m_bCropChanged = false;
+
+    return true;
+}
+
 bool CHWJpegV4L2Decompressor::PrepareStream()
 {
     if (TestFlag(HWJPEG_FLAG_OUTPUT_READY))
@@ -868,7 +1238,7 @@ bool CHWJpegV4L2Decompressor::PrepareStream()
     v4l2_requestbuffers rb;
     memset(&rb, 0, sizeof(rb));
 
-    rb.count = 1;
+    rb.count = m_uiPipelineDepth;
     rb.memory = V4L2_MEMORY_USERPTR;
     rb.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
 
@@ -909,12 +1279,54 @@ void CHWJpegV4L2Decompressor::CancelStream()
     ioctl(GetDeviceFD(), VIDIOC_REQBUFS, &rb);
 
     ClearFlag(HWJPEG_FLAG_OUTPUT_READY);
+
+    // The image buffers queued without their streams are never completed
+    CancelCapture();
 }
 
-bool CHWJpegV4L2Decompressor::QBufAndWait(const char *buffer, size_t len)
+bool CHWJpegV4L2Decompressor::SetPipelineDepth(unsigned int depth)
+{
+    if ((depth == 0) || (depth > HWJPEG_V4L2_MAX_PIPELINE_DEPTH)) {
+        ALOGE("Pipeline depth %u is out of range [1, %d]", depth, HWJPEG_V4L2_MAX_PIPELINE_DEPTH);
+        return false;
+    }
+
+    if (depth == m_uiPipelineDepth)
+        return true;
+
+    if (m_uiQueuedFrames > 0) {
+        ALOGE("Unable to change the pipeline depth while %u frames are queued", m_uiQueuedFrames);
+        return false;
+    }
+
+    // The buffers should be requested again with the new depth
+    CancelStream();
+
+    m_uiPipelineDepth = depth;
+
+    return true;
+}
+
+bool CHWJpegV4L2Decompressor::CheckBuffers()
+{
+    if (m_v4l2Format.type == 0) {
+        ALOGE("Decompressed image format is not specified");
+        return false;
+    }
+
+    if (m_v4l2DstBuffer.length == 0) {
+        ALOGE("Decompressed image buffer is not specified");
+        return false;
+    }
+
+    return true;
+}
+
+bool CHWJpegV4L2Decompressor::QBuf(const char *buffer, size_t len)
 {
     v4l2_buffer buf;
     memset(&buf, 0, sizeof(buf));
+    buf.index = m_uiNextBufferIndex;
     buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
     buf.memory = V4L2_MEMORY_USERPTR;
     buf.bytesused = len;
@@ -926,12 +1338,32 @@ bool CHWJpegV4L2Decompressor::QBufAndWait(const char *buffer, size_t len)
         return false;
     }
 
+    m_v4l2DstBuffer.index = m_uiNextBufferIndex;
+
     if (ioctl(GetDeviceFD(), VIDIOC_QBUF, &m_v4l2DstBuffer) < 0) {
         CancelStream();
         ALOGERR("Failed to QBUF for the decompressed image");
         return false;
     }
 
+    m_uiQueuedFrames++;
+    m_uiNextBufferIndex = (m_uiNextBufferIndex + 1) % m_uiPipelineDepth;
+
+    return true;
+}
+
+bool CHWJpegV4L2Decompressor::DQBuf()
+{
+    if (m_uiQueuedFrames == 0) {
+        ALOGE("No decompression is queued");
+        return false;
+    }
+
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_USERPTR;
+
     bool ret = true;
 
     if (ioctl(GetDeviceFD(), VIDIOC_DQBUF, &buf) < 0) {
@@ -947,22 +1379,29 @@ bool CHWJpegV4L2Decompressor::QBufAndWait(const char *buffer, size_t len)
         ret = false;
     }
 
+    m_uiQueuedFrames--;
     m_uiHWDelay = buf.reserved2;
 
     return ret;
 }
 
+bool CHWJpegV4L2Decompressor::QBufAndWait(const char *buffer, size_t len)
+{
+    return QBuf(buffer, len) && DQBuf();
+}
+
 bool CHWJpegV4L2Decompressor::Decompress(const char *buffer, size_t len)
 {
-    if (m_v4l2Format.type == 0) {
-        ALOGE("Decompressed image format is not specified");
+    if (m_uiQueuedFrames > 0) {
+        ALOGE("Blocking decompression is not allowed while %u frames are queued", m_uiQueuedFrames);
         return false;
     }
 
-    if (m_v4l2DstBuffer.length == 0) {
-        ALOGE("Decompressed image buffer is not specified");
+    if (!CheckBuffers())
+        return false;
+
+    if (!ApplyCrop())
         return false;
-    }
 
     // Do not change the order of PrepareCapture() and PrepareStream().
     // Otherwise, decompression will fail.
@@ -974,3 +1413,28 @@ bool CHWJpegV4L2Decompressor::Decompress(const char *buffer, size_t len)
 
     return true;
 }
+
+bool CHWJpegV4L2Decompressor::QueueDecompress(const char *buffer, size_t len)
+{
+    if (!CheckBuffers())
+        return false;
+
+    if (m_uiQueuedFrames >= m_uiPipelineDepth) {
+        ALOGE("Too many decompressions are queued (depth %u)", m_uiPipelineDepth);
+        return false;
+    }
+
+    if (!ApplyCrop())
+        return false;
+
+    // Capture and output buffers are requested once for the geometry and the depth
+    if (!PrepareCapture() || !PrepareStream())
+        return false;
+
+    return QBuf(buffer, len);
+}
+
+bool CHWJpegV4L2Decompressor::WaitForDecompression()
+{
+    return DQBuf();
+}
@@ -88,6 +88,7 @@ protected:
     unsigned int GetDeviceCapabilities() { return m_hwjpeg.GetDeviceCapabilities(); }
     CHWJpegCompressor &GetCompressor() { return m_hwjpeg; }
     unsigned int GetHWDelay() { return m_hwjpeg.GetHWDelay(); }
+    int GetQualityFactor() { return m_nQFactor; }
 
     void SetState(unsigned int state) { m_uiState |= state; }
     void ClearState(unsigned int state) { m_uiState &= ~state; }
@@ -175,6 +176,31 @@ public:
         return (m_nStreamSize < 0) ? -1 : 0;
     }
 
+    // Burst encoding: queueEncode() returns as soon as the buffers configured
+    // by setInBuf() and setOutBuf() are queued to H/W. Up to the pipeline depth
+    // of frames can be queued before dequeueEncode() which waits for the oldest
+    // frame and returns its stream size. The format, the size and the quality
+    // should not be changed while frames are queued.
+    int setPipelineDepth(int depth) {
+        return m_hwjpeg.SetPipelineDepth(static_cast<unsigned int>(depth)) ? 0 : -1;
+    }
+
+    int queueEncode(void) {
+        if (!__EnsureFormatIsApplied())
+            return -1;
+
+        return (m_hwjpeg.Compress(NULL, false) < 0) ? -1 : 0;
+    }
+
+    int dequeueEncode(unsigned int *hw_delay_us = NULL) {
+        m_nStreamSize = static_cast<int>(m_hwjpeg.WaitForCompression());
+        if (hw_delay_us)
+            *hw_delay_us = m_hwjpeg.GetHWDelay();
+        return m_nStreamSize;
+    }
+
+    int getQueuedFrames(void) { return static_cast<int>(m_hwjpeg.GetQueuedFrames()); }
+
 };
 
 #endif //__HARDWARE_EXYNOS_EXYNOS_JPEG_API_H__
@@ -35,6 +35,7 @@ class ExynosJpegEncoderForCamera: public ExynosJpegEncoder {
         STATE_HWFC_ENABLED = STATE_BASE_MAX << 1,
         STATE_NO_CREATE_THUMBIMAGE = STATE_BASE_MAX << 2,
         STATE_NO_BTBCOMP = STATE_BASE_MAX << 3,
+        STATE_THUMB_OVERLAPPED = STATE_BASE_MAX << 4,
     };
 
     CHWJpegCompressor *m_phwjpeg4thumb;
@@ -70,7 +71,36 @@ class ExynosJpegEncoderForCamera: public ExynosJpegEncoder {
 
     CAppMarkerWriter *m_pAppWriter;
 
+    /*
+     * The worker thread lives as long as the encoder and compresses a thumbnail
+     * on every request until the encoder is destroyed.
+     */
+    enum {
+        THUMB_WORKER_IDLE,
+        THUMB_WORKER_REQUESTED,
+        THUMB_WORKER_DONE,
+    };
     pthread_t m_threadWorker;
+    bool m_bThreadWorkerCreated;
+    bool m_bThreadWorkerExit;
+    int m_iThumbWorkerState;
+    size_t m_szThumbWorkerResult;
+    pthread_mutex_t m_mutexThumbWorker;
+    pthread_cond_t m_condThumbWorker;
+
+    /*
+     * Target-size rate control picks the quality factor from the compressed
+     * size of the last frame at its quality factor.
+     */
+    struct RateSample {
+        int quality; // 0 if no frame is compressed yet
+        double bytes_per_pixel;
+    };
+    size_t m_szTargetStreamSize; // 0 if target-size mode is disabled
+    size_t m_szTargetThumbSize; // 0 if target-size mode is disabled for thumbnail
+    int m_nRateQuality; // quality factor of the main image chosen by rate control
+    RateSample m_rateMain;
+    RateSample m_rateThumb;
 
     extra_appinfo_t m_extraInfo;
     app_info_t m_appInfo[15];
@@ -84,7 +114,16 @@ class ExynosJpegEncoderForCamera: public ExynosJpegEncoder {
     ssize_t FinishCompression(size_t mainlen, size_t thumblen);
     bool ProcessExif(char *base, size_t limit, exif_attribute_t *exifInfo, extra_appinfo_t *extra);
     static void *tCompressThumbnail(void *p);
+    bool RequestThumbnailCompression();
+    size_t WaitThumbnailCompression();
     bool PrepareCompression(bool thumbnail);
+    static int EstimateQuality(const RateSample &sample, int upper, size_t pixels, size_t target);
+    static void RecordRate(RateSample &sample, int quality, size_t len, size_t pixels);
+    size_t GetMainPixels() {
+        int width = 0, height = 0;
+        getSize(&width, &height);
+        return static_cast<size_t>(width) * height;
+    }
 
     // IsThumbGenerationNeeded - true if thumbnail image needed to be generated from the main image
     //                           It also implies that a worker thread is generated to generate thumbnail concurrently.
@@ -96,6 +135,10 @@ class ExynosJpegEncoderForCamera: public ExynosJpegEncoder {
         return !!(GetDeviceCapabilities() & V4L2_CAP_EXYNOS_JPEG_B2B_COMPRESSION) &&
                     !TestState(STATE_NO_BTBCOMP);
     }
+    // The given thumbnail image is compressed separately from the main image (CASE3 and CASE7)
+    inline bool IsThumbCompressedSeparately() {
+        return !IsThumbGenerationNeeded() && (TestState(STATE_NO_BTBCOMP) || !IsBTBCompressionSupported());
+    }
 protected:
     virtual bool EnsureFormatIsApplied();
 public:
@@ -109,6 +152,14 @@ public:
     int setInBuf2(char **pcBuf, int *iSize);
     int setThumbnailSize(int w, int h);
     int setThumbnailQuality(int quality);
+    // Target-size mode: the quality factor is chosen to fit the stream in @size
+    // bytes with at most one retry. The quality factor configured by setQuality()
+    // or setThumbnailQuality() is the upper bound. @size of 0 disables the mode.
+    int setTargetStreamSize(int size);
+    int setTargetThumbnailSize(int size);
+    // Burst mode: APP1 is serialized once and only the tags that change
+    // between shots (date, exposure, orientation, ...) are rewritten
+    void setExifTemplateMode(bool enable);
 
     void setExtScalerNum(int csc_hwscaler_id) { m_iHWScalerID = csc_hwscaler_id; }
 
@@ -121,6 +172,11 @@ public:
         ClearState(STATE_HWFC_ENABLED);
     }
 
+    // Tells that the thumbnail image given by setInBuf2() is written while the
+    // main image is still streamed by HWFC. The thumbnail is compressed in the
+    // background instead of after WaitForCompression().
+    int NotifyThumbnailImageReady();
+
     ssize_t WaitForCompression();
 
     size_t GetThumbnailImage(char *buffer, size_t buflen);
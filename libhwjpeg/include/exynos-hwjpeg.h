@@ -85,6 +85,8 @@ protected:
     CHWJpegBase(const char *path);
     virtual ~CHWJpegBase();
     int GetDeviceFD() { return m_iFD; }
+    // Replaces the device file descriptor and returns the previous one
+    int ReplaceDeviceFD(int fd) { int old = m_iFD; m_iFD = fd; return old; }
     void SetDeviceCapabilities(unsigned int cap) { m_uiDeviceCaps = cap; }
     unsigned int GetAuxFlags() { return m_uiAuxFlags; }
 public:
@@ -426,6 +428,27 @@ public:
      */
     virtual bool SetStreamPixelSize(unsigned int __unused width, unsigned int __unused height) { return true; }
 
+    /*
+     * SetImageCrop - Configure the region of the compressed image to decompress
+     * @left[in]   : horizontal offset of the region in the compressed image
+     * @top[in]    : vertical offset of the region in the compressed image
+     * @width[in]  : The number of horizontal pixels of the region
+     * @height[in] : The number of vertical pixels of the region
+     * @return: true if the region is configured successfully.
+     *          false if decompression of a region is not supported.
+     *
+     * The region should be aligned by the MCU size of the compressed stream. The
+     * decompressed image size configured by SetImageFormat() is then the size of
+     * the region instead of the size of the compressed image, divided by the
+     * downscaling factor. @width and @height of zero restore decompression of the
+     * whole image. Decompression of a region is supported if
+     * V4L2_CAP_EXYNOS_JPEG_DECOMPRESSION_CROP is set in the device capabilities.
+     */
+    virtual bool SetImageCrop(unsigned int __unused left, unsigned int __unused top,
+                              unsigned int width, unsigned int height) {
+        return (width == 0) && (height == 0);
+    }
+
     /*
      * SetChromaSampFactor - Configure the chroma subsampling factor for JPEG stream
      * @horizontal[in] : horizontal chroma subsampling factor
@@ -499,6 +522,12 @@ class CHWJpegM2M1SHOTCompressor: public CHWJpegCompressor {
 
 #define TO_SEC_IMG_SIZE(val)    (((val) >> 16) & 0xFFFF)
 
+// The maximum number of frames that CHWJpegV4L2Compressor keeps in flight
+#define HWJPEG_V4L2_MAX_PIPELINE_DEPTH 4
+// The number of streaming contexts that CHWJpegV4L2Compressor keeps aside
+// for the image formats configured recently
+#define HWJPEG_V4L2_MAX_PARKED_SESSIONS 2
+
 class CHWJpegV4L2Compressor : public CHWJpegCompressor, private CHWJpegFlagManager {
     enum {
         HWJPEG_CTRL_CHROMFACTOR = 0,
@@ -528,9 +557,40 @@ class CHWJpegV4L2Compressor : public CHWJpegCompressor, private CHWJpegFlagManag
     } m_v4l2Controls[HWJPEG_CTRL_NUM];
 
     unsigned int m_uiControlsToSet;
+
+    // A streaming context on another open of the device that is kept with
+    // its format applied and its buffers requested. SetImageFormat() swaps
+    // it with the current context instead of renegotiating the format.
+    struct StreamingSession {
+        int fd; // -1 if the slot is unused
+        v4l2_format format;
+        unsigned int flags; // HWJPEG_FLAG_PIX_FMT, REQBUFS and STREAMING
+        // controls applied to @fd. id is 0 if the value is not known.
+        hwjpeg_v4l2_controls controls[HWJPEG_CTRL_NUM];
+        bool hwfc;
+        unsigned int qtable_gen;
+        unsigned int last_used;
+    } m_Sessions[HWJPEG_V4L2_MAX_PARKED_SESSIONS];
+    unsigned int m_uiSessionClock;
+
+    // The last quantization tables by SetQuality(qtable) to apply them again
+    // to the other streaming contexts
+    unsigned char m_QTables[128];
+    unsigned int m_uiQTableGen; // 0 if no quantization table is configured
+    unsigned int m_uiAppliedQTableGen; // m_uiQTableGen applied to the current context
+    bool m_bQTableLast; // true if SetQuality(qtable) is called after SetQuality(factor)
+
+    // The JPEG device node of CHWJpegScheduler that the compressor has open
+    unsigned int m_uiDevice;
+
     // H/W delay of the last compressoin in usec.
     // Only valid after Compression() successes.
     unsigned int m_uiHWDelay;
+    // The number of buffers requested by REQBUFS. Compress() without blocking
+    // can queue up to this number of frames before WaitForCompression().
+    unsigned int m_uiPipelineDepth;
+    unsigned int m_uiQueuedFrames;
+    unsigned int m_uiNextBufferIndex;
 
     v4l2_format m_v4l2Format; // v4l2 format for the source image
     v4l2_buffer m_v4l2SrcBuffer; // v4l2 source buffer
@@ -555,12 +615,29 @@ class CHWJpegV4L2Compressor : public CHWJpegCompressor, private CHWJpegFlagManag
     bool QBuf();
     ssize_t DQBuf(size_t *secondary_stream_size);
     bool StopStreaming();
+    bool ApplyQTables();
+
+    // Streaming session helpers
+    bool SwitchSession(__u32 v4l2_fmt, __u32 width, __u32 height);
+    void SaveSession(StreamingSession &session);
+    void LoadSession(StreamingSession &session);
+    void DropSessions();
+
+    CHWJpegV4L2Compressor(unsigned int device);
+    bool MoveToDevice(unsigned int device);
 public:
     CHWJpegV4L2Compressor();
     virtual ~CHWJpegV4L2Compressor();
 
+    // H/W delay of the frame returned by the last WaitForCompression()
     unsigned int GetHWDelay() { return m_uiHWDelay; }
 
+    // Configures the number of frames that are allowed to be in flight.
+    // It fails if a frame is still queued.
+    bool SetPipelineDepth(unsigned int depth);
+    unsigned int GetPipelineDepth() { return m_uiPipelineDepth; }
+    unsigned int GetQueuedFrames() { return m_uiQueuedFrames; }
+
     // SetChromaSampFactor can be called during streaming
     virtual bool SetChromaSampFactor(unsigned int horizontal,
                                      unsigned int vertical);
@@ -599,11 +676,28 @@ class CHWJpegV4L2Decompressor : public CHWJpegDecompressor, private CHWJpegFlagM
     v4l2_format m_v4l2Format;
     v4l2_buffer m_v4l2DstBuffer; /* multi-planar foramt is not supported */
 
+    unsigned int m_uiStreamWidth;
+    unsigned int m_uiStreamHeight;
+    v4l2_rect m_v4l2Crop; /* width and height are 0 if the whole image is decompressed */
+    bool m_bCropChanged;
+
+    /*
+     * The number of buffers requested by REQBUFS. QueueDecompress() can queue
+     * up to this number of frames of the same format before WaitForDecompression().
+     */
+    unsigned int m_uiPipelineDepth;
+    unsigned int m_uiQueuedFrames;
+    unsigned int m_uiNextBufferIndex;
+
+    bool ApplyCrop();
     bool PrepareCapture();
     void CancelCapture();
 
     bool PrepareStream();
     void CancelStream();
+    bool CheckBuffers();
+    bool QBuf(const char *buffer, size_t len);
+    bool DQBuf();
     bool QBufAndWait(const char *buffer, size_t len);
 public:
     CHWJpegV4L2Decompressor();
@@ -611,8 +705,32 @@ public:
     virtual bool SetImageFormat(unsigned int v4l2_fmt, unsigned int width, unsigned int height);
     virtual bool SetImageBuffer(char *buffer, size_t len_buffer);
     virtual bool SetImageBuffer(int buffer, size_t len_buffer);
+    virtual bool SetStreamPixelSize(unsigned int width, unsigned int height);
+    virtual bool SetImageCrop(unsigned int left, unsigned int top,
+                              unsigned int width, unsigned int height);
     virtual bool Decompress(const char *buffer, size_t len);
 
+    /*
+     * Configures the number of frames that are allowed to be in flight.
+     * It fails if a frame is still queued.
+     */
+    bool SetPipelineDepth(unsigned int depth);
+    unsigned int GetQueuedFrames() { return m_uiQueuedFrames; }
+    /*
+     * QueueDecompress - starts decompression of @buffer into the image buffer
+     * configured last without waiting for the completion. The image format and
+     * the region should not change while frames are queued. @buffer and the
+     * image buffer should be kept until WaitForDecompression() returns for them.
+     */
+    bool QueueDecompress(const char *buffer, size_t len);
+    /*
+     * WaitForDecompression - waits for the oldest queued frame.
+     * The frames are completed in the order they are queued.
+     */
+    bool WaitForDecompression();
+    /* The device is readable(POLLIN) when the oldest queued frame is completed */
+    int GetPollFD() { return GetDeviceFD(); }
+
     unsigned int GetHWDelay() { return m_uiHWDelay; }
 };
 #endif /* __EXYNOS_HWJPEG_H__ */
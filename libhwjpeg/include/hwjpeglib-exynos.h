@@ -132,6 +132,30 @@ bool hwjpeg_dmabuf_dst(hwjpeg_decompress_ptr cinfo, int outfd[], size_t outsize[
  */
 void hwjpeg_set_downscale_factor(hwjpeg_decompress_ptr cinfo, unsigned int factor);
 
+/*
+ * hwjpeg_set_crop - configure the region of the compressed image to decompress
+ *
+ * @cinfo: decompressor instance handle
+ * @left: horizontal offset of the region in the number of pixels
+ * @top: vertical offset of the region in the number of pixels
+ * @width: the number of horizontal pixels of the region. 0 to decompress the whole image.
+ * @height: the number of vertical pixels of the region. 0 to decompress the whole image.
+ *
+ * @left and @top should be multiples of the MCU size, 8 times the chroma sampling factors.
+ * The right and the bottom edges of the region should be also multiples of the MCU size
+ * unless they are the edges of the image. @cinfo->output_width and @cinfo->output_height
+ * is decided by the region instead of the image size.
+ *  - @cinfo->output_width = @width / @cinfo->scale_factor
+ *  - @cinfo->output_height = @height / @cinfo->scale_factor
+ * The region is validated by hwjpeg_read_header() that should be called after
+ * hwjpeg_set_crop(). A large image can be decompressed tile by tile into smaller
+ * buffers by repeating hwjpeg_set_crop(), hwjpeg_dmabuf_dst(), hwjpeg_read_header()
+ * and hwjpeg_start_decompress(). The headers of the stream are parsed only once.
+ * It fails if the H/W does not support decompression of a region.
+ */
+void hwjpeg_set_crop(hwjpeg_decompress_ptr cinfo, unsigned int left, unsigned int top,
+                     unsigned int width, unsigned int height);
+
 /*
  * hwjpeg_read_header - reads the headers of the compressed JPEG stream
  *
@@ -164,6 +188,55 @@ bool hwjpeg_has_enough_stream_buffer(hwjpeg_decompress_ptr cinfo);
  */
 bool hwjpeg_start_decompress(hwjpeg_decompress_ptr cinfo);
 
+/*
+ * hwjpeg_set_queue_depth - configure the number of decompressions in flight
+ *
+ * @cinfo: decompressor instance handle
+ * @depth: the number of decompressions that hwjpeg_queue_decompress() can queue
+ *         before hwjpeg_wait_decompress(). 1 by default.
+ * @return: false on failure.
+ *
+ * It fails if a decompression is still queued.
+ */
+bool hwjpeg_set_queue_depth(hwjpeg_decompress_ptr cinfo, unsigned int depth);
+
+/*
+ * hwjpeg_queue_decompress - starts decompression without waiting for the completion
+ *
+ * @cinfo: decompressor instance handle
+ * @return: false on failure.
+ *
+ * hwjpeg_read_header() should be called before every hwjpeg_queue_decompress() like
+ * hwjpeg_start_decompress(). The decompressions queued at the same time should have
+ * the same output size, format and region. Only the stream and the output buffers can
+ * be different. The buffers given by hwjpeg_mem_src(), hwjpeg_mem_dst() and
+ * hwjpeg_dmabuf_dst() should be kept until hwjpeg_wait_decompress() returns for them.
+ * The output buffers from hwjpeg_dmabuf_dst() are written by H/W without any CPU copy.
+ */
+bool hwjpeg_queue_decompress(hwjpeg_decompress_ptr cinfo);
+
+/*
+ * hwjpeg_wait_decompress - waits for the oldest queued decompression
+ *
+ * @cinfo: decompressor instance handle
+ * @return: false if the decompression failed or nothing is queued.
+ *
+ * The decompressions are completed in the order they are queued.
+ */
+bool hwjpeg_wait_decompress(hwjpeg_decompress_ptr cinfo);
+
+/*
+ * hwjpeg_get_completion_fd - returns a file descriptor to poll the completion
+ *
+ * @cinfo: decompressor instance handle
+ * @return: the file descriptor or -1 on failure.
+ *
+ * The file descriptor becomes readable(POLLIN) when the oldest queued decompression
+ * is completed. hwjpeg_wait_decompress() does not block then. The file descriptor is
+ * owned by @cinfo and should not be closed.
+ */
+int hwjpeg_get_completion_fd(hwjpeg_decompress_ptr cinfo);
+
 /*
  * hwjpeg_destroy_decompress - releases all resources of the decompressor instance
  *
@@ -224,7 +224,25 @@ class CLibhwjpegDecompressor: public hwjpeg_decompressor_struct {
 
     unsigned int m_flags;
     bool m_bPrepared;
-    CHWJpegDecompressor *m_hwjpeg;
+    bool m_bParsed; // true if the headers of the current stream are parsed
+    CHWJpegV4L2Decompressor *m_hwjpeg;
+
+    // The streams being decompressed by H/W, oldest first. A stream mapped by
+    // this library is unmapped when the last decompression of it is completed
+    // if another stream is configured in the meantime.
+    struct InFlight {
+        unsigned char *buffer;
+        size_t maplen;
+        bool mapped;
+    } m_InFlight[HWJPEG_V4L2_MAX_PIPELINE_DEPTH];
+    unsigned int m_nInFlightHead;
+    unsigned int m_nInFlight;
+
+    // The region of the image to decompress. The whole image if m_nCropWidth is 0.
+    unsigned int m_nCropLeft;
+    unsigned int m_nCropTop;
+    unsigned int m_nCropWidth;
+    unsigned int m_nCropHeight;
 
     unsigned char *m_pStreamBuffer;
     size_t m_nStreamLength;
@@ -243,14 +261,23 @@ public:
         output_width = 0;
         output_height = 0;
         m_bPrepared = false;
+        m_bParsed = false;
 	m_pStreamBuffer = NULL;
 
+        m_nCropLeft = 0;
+        m_nCropTop = 0;
+        m_nCropWidth = 0;
+        m_nCropHeight = 0;
+
         output_format = V4L2_PIX_FMT_RGB32;
 
         // members of this
         m_nStreamLength = 0;
         m_nDummyBytes = 0;
 
+        m_nInFlightHead = 0;
+        m_nInFlight = 0;
+
         m_hwjpeg = new CHWJpegV4L2Decompressor;
         if (!m_hwjpeg || !*m_hwjpeg) {
             ALOGE("Failed to create HWJPEG decompressor");
@@ -259,6 +286,9 @@ public:
     }
 
     ~CLibhwjpegDecompressor() {
+        while (m_nInFlight > 0)
+            WaitDecompression();
+
         delete m_hwjpeg;
 
         if (!!(m_flags & HWJPG_FLAG_NEED_MUNMAP))
@@ -266,12 +296,7 @@ public:
     }
 
     bool SetStreamPath(const char *path) {
-        if ((m_pStreamBuffer != NULL) && !!(m_flags & HWJPG_FLAG_NEED_MUNMAP)) {
-            munmap(m_pStreamBuffer, m_nStreamLength + m_nDummyBytes);
-            m_flags &= ~HWJPG_FLAG_NEED_MUNMAP;
-            m_pStreamBuffer = NULL;
-            m_nStreamLength = 0;
-        }
+        DropStream();
 
         int fd = open(path, O_RDONLY);
         if (fd < 0) {
@@ -300,6 +325,7 @@ public:
         }
 
         m_bPrepared = false;
+        m_bParsed = false;
 
         m_flags |= HWJPG_FLAG_NEED_MUNMAP;
 
@@ -308,25 +334,20 @@ public:
     }
 
     bool SetStreamBuffer(unsigned char *buffer, size_t len, size_t dummybytes) {
-        if ((m_pStreamBuffer != NULL) && !!(m_flags & HWJPG_FLAG_NEED_MUNMAP)) {
-            munmap(m_pStreamBuffer, m_nStreamLength + m_nDummyBytes);
-            m_flags &= ~HWJPG_FLAG_NEED_MUNMAP;
-        }
+        DropStream();
 
         m_pStreamBuffer = buffer;
         m_nStreamLength = len;
         m_nDummyBytes = dummybytes;
 
         m_bPrepared = false;
+        m_bParsed = false;
 
         return true;
     }
 
     bool SetStreamBuffer(int buffer, size_t len, size_t dummybytes) {
-        if ((m_pStreamBuffer != NULL) && !!(m_flags & HWJPG_FLAG_NEED_MUNMAP)) {
-            munmap(m_pStreamBuffer, m_nStreamLength + m_nDummyBytes);
-            m_flags &= ~HWJPG_FLAG_NEED_MUNMAP;
-        }
+        DropStream();
 
         m_nStreamLength = len;
         m_nDummyBytes = dummybytes;
@@ -343,6 +364,7 @@ public:
         m_flags |= HWJPG_FLAG_NEED_MUNMAP;
 
         m_bPrepared = false;
+        m_bParsed = false;
 
         return true;
     }
@@ -367,9 +389,45 @@ public:
 
     void SetDownscaleFactor(unsigned int factor) { scale_factor = factor; }
 
+    void SetCrop(unsigned int left, unsigned int top, unsigned int width, unsigned int height) {
+        m_nCropLeft = left;
+        m_nCropTop = top;
+        m_nCropWidth = width;
+        m_nCropHeight = height;
+        m_bPrepared = false;
+    }
+
+    // Unmaps the current stream unless H/W still reads it
+    void DropStream() {
+        if ((m_pStreamBuffer == NULL) || !(m_flags & HWJPG_FLAG_NEED_MUNMAP))
+            return;
+
+        bool busy = false;
+        for (unsigned int i = 0; i < m_nInFlight; i++) {
+            InFlight &req = m_InFlight[(m_nInFlightHead + i) % HWJPEG_V4L2_MAX_PIPELINE_DEPTH];
+            if (req.buffer == m_pStreamBuffer) {
+                req.maplen = m_nStreamLength + m_nDummyBytes;
+                req.mapped = true;
+                busy = true;
+            }
+        }
+
+        if (!busy)
+            munmap(m_pStreamBuffer, m_nStreamLength + m_nDummyBytes);
+
+        m_flags &= ~HWJPG_FLAG_NEED_MUNMAP;
+        m_pStreamBuffer = NULL;
+        m_nStreamLength = 0;
+    }
+
     bool PrepareDecompression();
     bool Decompress();
 
+    bool SetQueueDepth(unsigned int depth);
+    bool QueueDecompression();
+    bool WaitDecompression();
+    int GetCompletionFD() { return m_hwjpeg ? m_hwjpeg->GetPollFD() : -1; }
+
     bool IsEnoughStreamBuffer() { return true; }
 };
 
@@ -391,8 +449,12 @@ bool CLibhwjpegDecompressor::PrepareDecompression()
         return false;
     }
 
-    if (!m_jpegStreamParser.Parse(m_pStreamBuffer, m_nStreamLength))
-        return false;
+    // Decompressing the tiles of the same stream do not need parsing again
+    if (!m_bParsed) {
+        if (!m_jpegStreamParser.Parse(m_pStreamBuffer, m_nStreamLength))
+            return false;
+        m_bParsed = true;
+    }
 
     image_width = m_jpegStreamParser.GetWidth();
     image_height = m_jpegStreamParser.GetHeight();
@@ -400,21 +462,57 @@ bool CLibhwjpegDecompressor::PrepareDecompression()
     chroma_h_samp_factor = m_jpegStreamParser.m_iHorizontalFactor;
     chroma_v_samp_factor = m_jpegStreamParser.m_iVerticalFactor;
 
-    if (((image_width % (chroma_h_samp_factor * scale_factor)) != 0) ||
-            ((image_height % (chroma_v_samp_factor * scale_factor)) != 0)) {
+    unsigned int width = image_width;
+    unsigned int height = image_height;
+
+    if (m_nCropWidth != 0) {
+        unsigned int mcu_width = chroma_h_samp_factor * 8;
+        unsigned int mcu_height = chroma_v_samp_factor * 8;
+
+        if ((m_nCropLeft >= image_width) || (m_nCropTop >= image_height) ||
+                (m_nCropWidth > (image_width - m_nCropLeft)) ||
+                (m_nCropHeight > (image_height - m_nCropTop))) {
+            ALOGE("Region (%u, %u) %ux%u is out of the image %ux%u",
+                  m_nCropLeft, m_nCropTop, m_nCropWidth, m_nCropHeight, image_width, image_height);
+            return false;
+        }
+
+        // The region should start at MCU boundaries and end either at MCU boundaries or at the edges
+        if (((m_nCropLeft % mcu_width) != 0) || ((m_nCropTop % mcu_height) != 0) ||
+                ((((m_nCropLeft + m_nCropWidth) % mcu_width) != 0) &&
+                    ((m_nCropLeft + m_nCropWidth) != image_width)) ||
+                ((((m_nCropTop + m_nCropHeight) % mcu_height) != 0) &&
+                    ((m_nCropTop + m_nCropHeight) != image_height))) {
+            ALOGE("Region (%u, %u) %ux%u is not aligned by MCU %ux%u",
+                  m_nCropLeft, m_nCropTop, m_nCropWidth, m_nCropHeight, mcu_width, mcu_height);
+            return false;
+        }
+
+        width = m_nCropWidth;
+        height = m_nCropHeight;
+    }
+
+    if (((width % (chroma_h_samp_factor * scale_factor)) != 0) ||
+            ((height % (chroma_v_samp_factor * scale_factor)) != 0)) {
         ALOGE("Downscaling by factor %d of compressed image size %dx%d(chroma %d:%d) is not supported",
-                scale_factor, image_width, image_height, chroma_h_samp_factor, chroma_v_samp_factor);
+                scale_factor, width, height, chroma_h_samp_factor, chroma_v_samp_factor);
         return false;
     }
 
-    output_width = image_width / scale_factor;
-    output_height = image_height / scale_factor;
+    output_width = width / scale_factor;
+    output_height = height / scale_factor;
 
     if (!m_hwjpeg->SetStreamPixelSize(image_width, image_height)) {
         ALOGE("Failed to configure stream pixel size (%ux%u)", image_width, image_height);
         return false;
     }
 
+    if (!m_hwjpeg->SetImageCrop(m_nCropLeft, m_nCropTop, m_nCropWidth, m_nCropHeight)) {
+        ALOGE("Failed to configure the region (%u, %u) %ux%u to decompress",
+              m_nCropLeft, m_nCropTop, m_nCropWidth, m_nCropHeight);
+        return false;
+    }
+
     if (!m_hwjpeg->SetImageFormat(output_format, output_width, output_height)) {
         ALOGE("Failed to configure image format (%ux%u/%08X)", output_width, output_height, output_format);
         return false;
@@ -447,6 +545,71 @@ bool CLibhwjpegDecompressor::Decompress()
     return true;
 }
 
+bool CLibhwjpegDecompressor::SetQueueDepth(unsigned int depth)
+{
+    if (!m_hwjpeg) {
+        ALOGE("device node is not opened!");
+        return false;
+    }
+
+    return m_hwjpeg->SetPipelineDepth(depth);
+}
+
+bool CLibhwjpegDecompressor::QueueDecompression()
+{
+    if (!m_bPrepared) {
+        ALOGE("JPEG header is not parsed");
+        return false;
+    }
+
+    if (!IsEnoughStreamBuffer()) {
+        ALOGE("Not enough buffer length for HWJPEG");
+        return false;
+    }
+
+    m_bPrepared = false;
+
+    if (!m_hwjpeg->QueueDecompress(reinterpret_cast<char *>(m_pStreamBuffer), m_nStreamLength)) {
+        ALOGE("Failed to queue decompression");
+        return false;
+    }
+
+    InFlight &req = m_InFlight[(m_nInFlightHead + m_nInFlight) % HWJPEG_V4L2_MAX_PIPELINE_DEPTH];
+    req.buffer = m_pStreamBuffer;
+    req.maplen = 0;
+    req.mapped = false;
+    m_nInFlight++;
+
+    return true;
+}
+
+bool CLibhwjpegDecompressor::WaitDecompression()
+{
+    if (m_nInFlight == 0) {
+        ALOGE("No decompression is queued");
+        return false;
+    }
+
+    bool ret = m_hwjpeg->WaitForDecompression();
+    if (!ret)
+        ALOGE("Failed to decompress");
+
+    InFlight req = m_InFlight[m_nInFlightHead];
+    m_nInFlightHead = (m_nInFlightHead + 1) % HWJPEG_V4L2_MAX_PIPELINE_DEPTH;
+    m_nInFlight--;
+
+    if (req.mapped) {
+        bool busy = false;
+        for (unsigned int i = 0; i < m_nInFlight; i++)
+            if (m_InFlight[(m_nInFlightHead + i) % HWJPEG_V4L2_MAX_PIPELINE_DEPTH].buffer == req.buffer)
+                busy = true;
+        if (!busy)
+            munmap(req.buffer, req.maplen);
+    }
+
+    return ret;
+}
+
 hwjpeg_decompress_ptr hwjpeg_create_decompress()
 {
     hwjpeg_decompress_ptr p = new CLibhwjpegDecompressor();
@@ -498,6 +661,13 @@ void hwjpeg_set_downscale_factor(hwjpeg_decompress_ptr cinfo, unsigned int facto
     cinfo->scale_factor = factor;
 }
 
+void hwjpeg_set_crop(hwjpeg_decompress_ptr cinfo, unsigned int left, unsigned int top,
+                     unsigned int width, unsigned int height)
+{
+    CLibhwjpegDecompressor *decomp = reinterpret_cast<CLibhwjpegDecompressor *>(cinfo);
+    decomp->SetCrop(left, top, width, height);
+}
+
 bool hwjpeg_read_header(hwjpeg_decompress_ptr cinfo)
 {
     CLibhwjpegDecompressor *decomp = reinterpret_cast<CLibhwjpegDecompressor *>(cinfo);
@@ -521,3 +691,27 @@ bool hwjpeg_has_enough_stream_buffer(hwjpeg_decompress_ptr cinfo)
     CLibhwjpegDecompressor *decomp = reinterpret_cast<CLibhwjpegDecompressor *>(cinfo);
     return decomp->IsEnoughStreamBuffer();
 }
+
+bool hwjpeg_set_queue_depth(hwjpeg_decompress_ptr cinfo, unsigned int depth)
+{
+    CLibhwjpegDecompressor *decomp = reinterpret_cast<CLibhwjpegDecompressor *>(cinfo);
+    return decomp->SetQueueDepth(depth);
+}
+
+bool hwjpeg_queue_decompress(hwjpeg_decompress_ptr cinfo)
+{
+    CLibhwjpegDecompressor *decomp = reinterpret_cast<CLibhwjpegDecompressor *>(cinfo);
+    return decomp->QueueDecompression();
+}
+
+bool hwjpeg_wait_decompress(hwjpeg_decompress_ptr cinfo)
+{
+    CLibhwjpegDecompressor *decomp = reinterpret_cast<CLibhwjpegDecompressor *>(cinfo);
+    return decomp->WaitDecompression();
+}
+
+int hwjpeg_get_completion_fd(hwjpeg_decompress_ptr cinfo)
+{
+    CLibhwjpegDecompressor *decomp = reinterpret_cast<CLibhwjpegDecompressor *>(cinfo);
+    return decomp->GetCompletionFD();
+}
@@ -76,9 +76,62 @@ int exynos_ion_sync_fd_partial(int ion_fd, int fd, off_t offset, size_t len);
 
 const char *exynos_ion_get_heap_name(unsigned int legacy_heap_id);
 
+/*
+ * Writes the count, the size, the failures and the p50/p99 latency of the
+ * allocations of each heap to @buf as text. Returns the length of the whole
+ * text that may be larger than @size like snprintf().
+ */
+size_t exynos_ion_dump_alloc_stats(char *buf, size_t size);
+
 int exynos_ion_sync_start(int ion_fd, int fd, int direction);
 int exynos_ion_sync_end(int ion_fd, int fd, int direction);
 
+/*
+ * Cache maintenance of [@offset, @offset + @len) of the buffer. The whole
+ * buffer is synchronized if the kernel does not support partial sync.
+ */
+int exynos_ion_sync_start_partial(int ion_fd, int fd, int direction, off_t offset, size_t len);
+int exynos_ion_sync_end_partial(int ion_fd, int fd, int direction, off_t offset, size_t len);
+/* synchronizes all of @fds and returns the first error */
+int exynos_ion_sync_start_batch(int ion_fd, const int fds[], unsigned int count, int direction);
+int exynos_ion_sync_end_batch(int ion_fd, const int fds[], unsigned int count, int direction);
+
+/*
+ * Opt-in recycling of buffers for the clients that allocate and free the
+ * buffers of the same sizes repeatedly. exynos_ion_pool_release() keeps the
+ * buffer instead of freeing it so that the next exynos_ion_pool_alloc() of the
+ * same heap, flags and size class returns it without the page allocation and
+ * zeroing of the kernel. A recycled buffer keeps the contents of its previous
+ * use. The buffers of the protected heaps are never kept.
+ * @max_bytes limits the total size of the buffers kept in the pool.
+ */
+struct exynos_ion_pool;
+
+struct exynos_ion_pool *exynos_ion_pool_create(size_t max_bytes);
+void exynos_ion_pool_destroy(struct exynos_ion_pool *pool);
+int exynos_ion_pool_alloc(struct exynos_ion_pool *pool, size_t len,
+                          unsigned int heap_mask, unsigned int flags);
+int exynos_ion_pool_release(struct exynos_ion_pool *pool, int fd);
+/* frees the kept buffers until their total size is not larger than @max_bytes */
+void exynos_ion_pool_trim(struct exynos_ion_pool *pool, size_t max_bytes);
+
+/*
+ * Allocates @count buffers of the size class of @len in the background and
+ * keeps them in the pool for the following exynos_ion_pool_alloc() calls. The
+ * buffers already kept are counted, and the buffers beyond max_bytes of the
+ * pool are not allocated. Not available to the protected heaps.
+ */
+int exynos_ion_pool_prewarm(struct exynos_ion_pool *pool, size_t len,
+                            unsigned int heap_mask, unsigned int flags, unsigned int count);
+/*
+ * Starts exynos_ion_pool_alloc() in the background and returns an eventfd that
+ * becomes readable when it finishes. exynos_ion_pool_alloc_result() waits for
+ * the eventfd, closes it and returns the buffer fd or a negative error.
+ */
+int exynos_ion_pool_alloc_async(struct exynos_ion_pool *pool, size_t len,
+                                unsigned int heap_mask, unsigned int flags);
+int exynos_ion_pool_alloc_result(struct exynos_ion_pool *pool, int evfd);
+
 __END_DECLS
 
 #endif /* __HARDWARE_EXYNOS_ION_H__ */
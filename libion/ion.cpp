@@ -25,10 +25,21 @@
 #include <linux/dma-heap.h>
 #include <log/log.h>
 #include <stdatomic.h>
+#include <sys/ioctl.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
 #include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 static const struct {
     std::string heap_name;
@@ -64,22 +75,140 @@ BufferAllocator& exynos_ion_get_allocator(void) {
     return bufallocator;
 }
 
-int exynos_ion_alloc(int /* ion_fd */, size_t len, unsigned int heap_mask, unsigned int flags) {
+#define HEAP_LUT_IDS 32
+#define HEAP_LUT_FLAGS 4 /* ION_FLAG_CACHED and ION_FLAG_PROTECTED */
+#define ALLOC_LATENCY_BUCKETS 24 /* 1us to 8s in the power of two */
+
+/* allocation statistics of an entry of heap_map_table */
+struct heap_alloc_stats {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> failures;
+    std::atomic<uint32_t> latency[ALLOC_LATENCY_BUCKETS]; /* bucket i: < 2^(i + 1) us */
+};
+
+static heap_alloc_stats heap_stats[sizeof(heap_map_table) / sizeof(heap_map_table[0])];
+
+static int heap_lut_flags(unsigned int flags) {
     unsigned int heapflags = flags & (ION_FLAG_PROTECTED | ION_FLAG_CACHED);
 
-    auto& bufallocator = exynos_ion_get_allocator();
+    if (heapflags == 0) return 0;
+    if (heapflags == ION_FLAG_CACHED) return 1;
+    if (heapflags == ION_FLAG_PROTECTED) return 2;
+    if (heapflags == (ION_FLAG_PROTECTED | ION_FLAG_CACHED)) return 3;
 
-    for (const auto& it : heap_map_table) {
-        if ((heap_mask == it.legacy_ion_heap_mask) && (heapflags == it.ion_heap_flags)) {
-            int ret = bufallocator.Alloc(it.heap_name, len, flags);
-            if (ret < 0)
-                ALOGE("Failed to alloc %s, %zu %x (%d)", it.heap_name.c_str(), len, flags, ret);
+    return -1;
+}
 
-            return ret;
+/* index of heap_map_table for [heap id][heap_lut_flags()], or -1 */
+static int heap_lut_index(unsigned int heap_mask, unsigned int flags) {
+    static int lut[HEAP_LUT_IDS][HEAP_LUT_FLAGS];
+    static std::once_flag lut_once;
+
+    std::call_once(lut_once, [] {
+        for (auto& row : lut)
+            for (auto& idx : row) idx = -1;
+
+        for (int i = static_cast<int>(sizeof(heap_map_table) / sizeof(heap_map_table[0])) - 1;
+             i >= 0; i--) {
+            const auto& it = heap_map_table[i];
+            int id = __builtin_ctz(it.legacy_ion_heap_mask);
+
+            /* the first entry of the same key wins as the linear search did */
+            lut[id][heap_lut_flags(it.ion_heap_flags)] = i;
         }
+    });
+
+    int flagidx = heap_lut_flags(flags);
+
+    if ((heap_mask == 0) || ((heap_mask & (heap_mask - 1)) != 0) || (flagidx < 0)) return -1;
+
+    return lut[__builtin_ctz(heap_mask)][flagidx];
+}
+
+static void heap_record_alloc(int idx, size_t len, int ret, std::chrono::steady_clock::duration elapsed) {
+    heap_alloc_stats& stats = heap_stats[idx];
+
+    if (ret < 0) {
+        stats.failures.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
-    ALOGE("%s: unable to find heaps of heap_mask %#x", __func__, heap_mask);
-    return -EINVAL;
+
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    int bucket = (us < 2) ? 0 : (63 - __builtin_clzll(us));
+
+    if (bucket >= ALLOC_LATENCY_BUCKETS) bucket = ALLOC_LATENCY_BUCKETS - 1;
+
+    stats.count.fetch_add(1, std::memory_order_relaxed);
+    stats.bytes.fetch_add(len, std::memory_order_relaxed);
+    stats.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+int exynos_ion_alloc(int /* ion_fd */, size_t len, unsigned int heap_mask, unsigned int flags) {
+    int idx = heap_lut_index(heap_mask, flags);
+
+    if (idx < 0) {
+        ALOGE("%s: unable to find heaps of heap_mask %#x", __func__, heap_mask);
+        return -EINVAL;
+    }
+
+    const auto& it = heap_map_table[idx];
+    auto& bufallocator = exynos_ion_get_allocator();
+
+    auto begin = std::chrono::steady_clock::now();
+    int ret = bufallocator.Alloc(it.heap_name, len, flags);
+
+    heap_record_alloc(idx, len, ret, std::chrono::steady_clock::now() - begin);
+
+    if (ret < 0)
+        ALOGE("Failed to alloc %s, %zu %x (%d)", it.heap_name.c_str(), len, flags, ret);
+
+    return ret;
+}
+
+/* the upper bound in us of the bucket where @permille of the allocations are */
+static uint64_t heap_latency_percentile(const heap_alloc_stats& stats, uint64_t count,
+                                        unsigned int permille) {
+    uint64_t target = (count * permille + 999) / 1000;
+    uint64_t sum = 0;
+
+    for (int i = 0; i < ALLOC_LATENCY_BUCKETS; i++) {
+        sum += stats.latency[i].load(std::memory_order_relaxed);
+        if (sum >= target) return 2ULL << i;
+    }
+
+    return 2ULL << (ALLOC_LATENCY_BUCKETS - 1);
+}
+
+size_t exynos_ion_dump_alloc_stats(char* buf, size_t size) {
+    size_t written = 0;
+
+    auto print = [&](const char* fmt, auto... args) {
+        int n = snprintf(buf ? buf + written : nullptr, (written < size) ? size - written : 0,
+                         fmt, args...);
+        if (n > 0) written += n;
+    };
+
+    if (buf && (size > 0)) buf[0] = '\0';
+
+    print("%-20s %10s %12s %8s %10s %10s\n", "heap", "count", "KiB", "failed", "p50(us)", "p99(us)");
+
+    for (size_t i = 0; i < sizeof(heap_map_table) / sizeof(heap_map_table[0]); i++) {
+        const heap_alloc_stats& stats = heap_stats[i];
+        uint64_t count = stats.count.load(std::memory_order_relaxed);
+        uint64_t failures = stats.failures.load(std::memory_order_relaxed);
+
+        if ((count == 0) && (failures == 0)) continue;
+
+        print("%-20s %10llu %12llu %8llu %10llu %10llu\n", heap_map_table[i].heap_name.c_str(),
+              static_cast<unsigned long long>(count),
+              static_cast<unsigned long long>(stats.bytes.load(std::memory_order_relaxed) / 1024),
+              static_cast<unsigned long long>(failures),
+              static_cast<unsigned long long>(count ? heap_latency_percentile(stats, count, 500) : 0),
+              static_cast<unsigned long long>(count ? heap_latency_percentile(stats, count, 990) : 0));
+    }
+
+    return written;
 }
 
 int exynos_ion_import_handle(int /* ion_fd */, int fd, int* handle) {
@@ -110,3 +239,405 @@ int exynos_ion_sync_end(int __unused ion_fd, int fd, int direction) {
 
     return bufallocator.CpuSyncEnd(fd, static_cast<SyncType>(direction));
 }
+
+/* cleared if the kernel has no DMA_BUF_IOCTL_SYNC_PARTIAL */
+static std::atomic<bool> partial_sync_supported(true);
+
+static int exynos_ion_sync_range(int fd, bool start, int direction, off_t offset, size_t len) {
+#ifdef DMA_BUF_IOCTL_SYNC_PARTIAL
+    if (partial_sync_supported.load(std::memory_order_relaxed)) {
+        struct dma_buf_sync_partial sync;
+
+        memset(&sync, 0, sizeof(sync));
+        sync.flags = start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END;
+        switch (static_cast<SyncType>(direction)) {
+            case kSyncRead:
+                sync.flags |= DMA_BUF_SYNC_READ;
+                break;
+            case kSyncWrite:
+                sync.flags |= DMA_BUF_SYNC_WRITE;
+                break;
+            default:
+                sync.flags |= DMA_BUF_SYNC_RW;
+                break;
+        }
+        sync.offset = offset;
+        sync.len = len;
+
+        if (ioctl(fd, DMA_BUF_IOCTL_SYNC_PARTIAL, &sync) == 0) return 0;
+
+        // other errors fall back to the whole buffer just for this time
+        if (errno == ENOTTY) partial_sync_supported.store(false, std::memory_order_relaxed);
+    }
+#else
+    (void)offset;
+    (void)len;
+    partial_sync_supported.store(false, std::memory_order_relaxed);
+#endif
+
+    auto& bufallocator = exynos_ion_get_allocator();
+
+    if (start) return bufallocator.CpuSyncStart(fd, static_cast<SyncType>(direction));
+
+    return bufallocator.CpuSyncEnd(fd, static_cast<SyncType>(direction));
+}
+
+int exynos_ion_sync_fd_partial(int __unused ion_fd, int fd, off_t offset, size_t len) {
+    return exynos_ion_sync_range(fd, true, kSyncReadWrite, offset, len);
+}
+
+int exynos_ion_sync_start_partial(int __unused ion_fd, int fd, int direction, off_t offset,
+                                  size_t len) {
+    return exynos_ion_sync_range(fd, true, direction, offset, len);
+}
+
+int exynos_ion_sync_end_partial(int __unused ion_fd, int fd, int direction, off_t offset,
+                                size_t len) {
+    return exynos_ion_sync_range(fd, false, direction, offset, len);
+}
+
+static int exynos_ion_sync_batch(const int fds[], unsigned int count, bool start, int direction) {
+    auto& bufallocator = exynos_ion_get_allocator();
+    int ret = 0;
+
+    // every buffer is synchronized even if one of them fails
+    for (unsigned int i = 0; i < count; i++) {
+        int err = start ? bufallocator.CpuSyncStart(fds[i], static_cast<SyncType>(direction))
+                        : bufallocator.CpuSyncEnd(fds[i], static_cast<SyncType>(direction));
+        if (err < 0) {
+            ALOGE("%s: failed to sync fd %d (%d)", __func__, fds[i], err);
+            if (ret == 0) ret = err;
+        }
+    }
+
+    return ret;
+}
+
+int exynos_ion_sync_start_batch(int __unused ion_fd, const int fds[], unsigned int count,
+                                int direction) {
+    return exynos_ion_sync_batch(fds, count, true, direction);
+}
+
+int exynos_ion_sync_end_batch(int __unused ion_fd, const int fds[], unsigned int count,
+                              int direction) {
+    return exynos_ion_sync_batch(fds, count, false, direction);
+}
+
+/*
+ * The size classes are the multiples of 1/8 of the largest power of two not
+ * larger than the size so that a recycled buffer wastes less than 1/8 of it.
+ */
+static size_t exynos_ion_pool_size_class(size_t len) {
+    const size_t page = static_cast<size_t>(getpagesize());
+
+    len = (len + page - 1) & ~(page - 1);
+
+    size_t step = page;
+    while ((step * 16) <= len)
+        step *= 2;
+
+    return (len + step - 1) & ~(step - 1);
+}
+
+struct exynos_ion_pool {
+    struct Key {
+        unsigned int heap_mask;
+        unsigned int flags;
+        size_t size;
+
+        bool operator==(const Key& other) const {
+            return std::tie(heap_mask, flags, size) ==
+                    std::tie(other.heap_mask, other.flags, other.size);
+        }
+    };
+
+    struct Buffer {
+        Key key;
+        int fd;
+    };
+
+    // prewarming of @count buffers if @evfd < 0, or an asynchronous allocation
+    struct Job {
+        Key key;
+        unsigned int count;
+        int evfd;
+    };
+
+    std::mutex lock;
+    size_t max_bytes;
+    size_t kept_bytes = 0;
+    std::list<Buffer> kept; // the most recently released first
+    std::unordered_map<int, Key> lent; // fds allocated by the pool and not released
+    std::unordered_map<int, int> results; // eventfd -> fd or -errno of the async allocation
+
+    std::mutex job_lock;
+    std::condition_variable job_cond;
+    std::deque<Job> jobs;
+    std::thread worker; // started by the first job
+    bool stopping = false;
+
+    explicit exynos_ion_pool(size_t max) : max_bytes(max) {}
+
+    void trimLocked(size_t max) {
+        while (kept_bytes > max) {
+            kept_bytes -= kept.back().key.size;
+            close(kept.back().fd);
+            kept.pop_back();
+        }
+    }
+
+    // false if @buf is not kept and the caller should free it
+    bool keepLocked(const Buffer& buf, bool evict) {
+        // the secure memory is a small carveout shared with the other clients
+        if ((buf.key.flags & ION_FLAG_PROTECTED) || (buf.key.size > max_bytes)) return false;
+
+        if (!evict && (kept_bytes + buf.key.size > max_bytes)) return false;
+
+        trimLocked(max_bytes - buf.key.size);
+        kept.push_front(buf);
+        kept_bytes += buf.key.size;
+
+        return true;
+    }
+
+    bool queue(const Job& job) {
+        std::lock_guard<std::mutex> guard(job_lock);
+
+        if (stopping) return false;
+
+        if (!worker.joinable()) worker = std::thread(&exynos_ion_pool::work, this);
+
+        jobs.push_back(job);
+        job_cond.notify_one();
+
+        return true;
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> guard(job_lock);
+
+        while (true) {
+            job_cond.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (stopping) break;
+
+            Job job = jobs.front();
+            jobs.pop_front();
+
+            guard.unlock();
+            run(job);
+            guard.lock();
+        }
+    }
+
+    void run(const Job& job) {
+        if (job.evfd >= 0) {
+            int fd = exynos_ion_pool_alloc(this, job.key.size, job.key.heap_mask, job.key.flags);
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                results[job.evfd] = fd;
+            }
+
+            uint64_t done = 1;
+            if (write(job.evfd, &done, sizeof(done)) != sizeof(done))
+                ALOGE("%s: failed to signal eventfd %d (%d)", __func__, job.evfd, errno);
+
+            return;
+        }
+
+        for (unsigned int i = 0; i < job.count; i++) {
+            int fd = exynos_ion_alloc(0, job.key.size, job.key.heap_mask, job.key.flags);
+            if (fd < 0) return;
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            // prewarming does not push out the buffers released by the client
+            if (!keepLocked({job.key, fd}, false)) {
+                close(fd);
+                return;
+            }
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(job_lock);
+            stopping = true;
+            job_cond.notify_one();
+        }
+
+        if (worker.joinable()) worker.join();
+
+        // the async allocations never started are failed
+        for (auto& job : jobs) {
+            if (job.evfd < 0) continue;
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                results[job.evfd] = -ECANCELED;
+            }
+
+            uint64_t done = 1;
+            if (write(job.evfd, &done, sizeof(done)) != sizeof(done))
+                ALOGE("%s: failed to signal eventfd %d (%d)", __func__, job.evfd, errno);
+        }
+        jobs.clear();
+    }
+};
+
+struct exynos_ion_pool* exynos_ion_pool_create(size_t max_bytes) {
+    return new exynos_ion_pool(max_bytes);
+}
+
+void exynos_ion_pool_destroy(struct exynos_ion_pool* pool) {
+    if (!pool) return;
+
+    pool->stop();
+
+    {
+        std::lock_guard<std::mutex> lock(pool->lock);
+
+        pool->trimLocked(0);
+        for (auto& result : pool->results) {
+            if (result.second >= 0) {
+                pool->lent.erase(result.second);
+                close(result.second);
+            }
+        }
+        if (!pool->lent.empty())
+            ALOGW("%s: %zu buffers are not released to the pool", __func__, pool->lent.size());
+        if (!pool->results.empty())
+            ALOGW("%s: %zu async allocations are not collected", __func__, pool->results.size());
+    }
+
+    delete pool;
+}
+
+int exynos_ion_pool_alloc(struct exynos_ion_pool* pool, size_t len, unsigned int heap_mask,
+                          unsigned int flags) {
+    if (!pool) return exynos_ion_alloc(0, len, heap_mask, flags);
+
+    exynos_ion_pool::Key key = {heap_mask, flags, exynos_ion_pool_size_class(len)};
+
+    std::lock_guard<std::mutex> lock(pool->lock);
+
+    for (auto it = pool->kept.begin(); it != pool->kept.end(); ++it) {
+        if (it->key == key) {
+            int fd = it->fd;
+
+            pool->kept_bytes -= key.size;
+            pool->kept.erase(it);
+            pool->lent[fd] = key;
+
+            return fd;
+        }
+    }
+
+    int fd = exynos_ion_alloc(0, key.size, heap_mask, flags);
+    if ((fd < 0) && !pool->kept.empty()) {
+        // the buffers kept in the pool are the first to give up
+        pool->trimLocked(0);
+        fd = exynos_ion_alloc(0, key.size, heap_mask, flags);
+    }
+
+    if (fd >= 0)
+        pool->lent[fd] = key;
+
+    return fd;
+}
+
+int exynos_ion_pool_release(struct exynos_ion_pool* pool, int fd) {
+    if (!pool) return close(fd);
+
+    std::lock_guard<std::mutex> lock(pool->lock);
+
+    auto it = pool->lent.find(fd);
+    if (it == pool->lent.end()) {
+        ALOGE("%s: fd %d is not allocated by the pool", __func__, fd);
+        return -EINVAL;
+    }
+
+    exynos_ion_pool::Buffer buf = {it->second, fd};
+
+    pool->lent.erase(it);
+
+    if (!pool->keepLocked(buf, true))
+        return close(fd);
+
+    return 0;
+}
+
+void exynos_ion_pool_trim(struct exynos_ion_pool* pool, size_t max_bytes) {
+    if (!pool) return;
+
+    std::lock_guard<std::mutex> lock(pool->lock);
+
+    pool->trimLocked(max_bytes);
+}
+
+int exynos_ion_pool_prewarm(struct exynos_ion_pool* pool, size_t len, unsigned int heap_mask,
+                            unsigned int flags, unsigned int count) {
+    if (!pool || (flags & ION_FLAG_PROTECTED)) return -EINVAL;
+
+    exynos_ion_pool::Key key = {heap_mask, flags, exynos_ion_pool_size_class(len)};
+
+    {
+        std::lock_guard<std::mutex> lock(pool->lock);
+
+        for (auto& buf : pool->kept) {
+            if ((count > 0) && (buf.key == key)) count--;
+        }
+    }
+
+    if ((count > 0) && !pool->queue({key, count, -1})) return -ESHUTDOWN;
+
+    return 0;
+}
+
+int exynos_ion_pool_alloc_async(struct exynos_ion_pool* pool, size_t len, unsigned int heap_mask,
+                                unsigned int flags) {
+    if (!pool) return -EINVAL;
+
+    int evfd = eventfd(0, EFD_CLOEXEC);
+    if (evfd < 0) {
+        ALOGE("%s: failed to create eventfd (%d)", __func__, errno);
+        return -errno;
+    }
+
+    exynos_ion_pool::Key key = {heap_mask, flags, len};
+
+    if (!pool->queue({key, 0, evfd})) {
+        close(evfd);
+        return -ESHUTDOWN;
+    }
+
+    return evfd;
+}
+
+int exynos_ion_pool_alloc_result(struct exynos_ion_pool* pool, int evfd) {
+    if (!pool) return -EINVAL;
+
+    uint64_t done;
+    if (read(evfd, &done, sizeof(done)) != sizeof(done)) {
+        ALOGE("%s: failed to wait for eventfd %d (%d)", __func__, evfd, errno);
+        return -errno;
+    }
+
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(pool->lock);
+
+        auto it = pool->results.find(evfd);
+        if (it == pool->results.end()) {
+            ALOGE("%s: eventfd %d is not an allocation of the pool", __func__, evfd);
+            return -EINVAL;
+        }
+
+        fd = it->second;
+        pool->results.erase(it);
+    }
+
+    close(evfd);
+
+    return fd;
+}
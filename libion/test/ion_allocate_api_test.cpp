@@ -15,6 +15,7 @@
  */
 #include <cerrno>
 #include <cstring>
+#include <string>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -122,3 +123,64 @@ TEST_F(AllocateAPI, Allocate)
         }
     }
 }
+
+TEST_F(AllocateAPI, PoolRecycle)
+{
+    struct exynos_ion_pool *pool = exynos_ion_pool_create(mb(8));
+    ASSERT_NE(nullptr, pool);
+
+    int fd = exynos_ion_pool_alloc(pool, mb(3), EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_CACHED);
+    ASSERT_LE(0, fd) << ": " << strerror(errno);
+    EXPECT_EQ(0, exynos_ion_pool_release(pool, fd));
+
+    // the same size class of the same heap and flags is recycled
+    int recycled = exynos_ion_pool_alloc(pool, mb(3) - kb(4), EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_CACHED);
+    EXPECT_EQ(fd, recycled);
+
+    int other = exynos_ion_pool_alloc(pool, mb(3), EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+    EXPECT_LE(0, other);
+    EXPECT_NE(recycled, other);
+
+    EXPECT_EQ(0, exynos_ion_pool_release(pool, recycled));
+    EXPECT_EQ(0, exynos_ion_pool_release(pool, other));
+    // released twice
+    EXPECT_GT(0, exynos_ion_pool_release(pool, other));
+
+    exynos_ion_pool_trim(pool, 0);
+    exynos_ion_pool_destroy(pool);
+}
+
+TEST_F(AllocateAPI, PoolAsync)
+{
+    struct exynos_ion_pool *pool = exynos_ion_pool_create(mb(8));
+    ASSERT_NE(nullptr, pool);
+
+    EXPECT_EQ(0, exynos_ion_pool_prewarm(pool, mb(1), EXYNOS_ION_HEAP_SYSTEM_MASK, 0, 2));
+    EXPECT_GT(0, exynos_ion_pool_prewarm(pool, mb(1), EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_PROTECTED, 2));
+
+    int evfd = exynos_ion_pool_alloc_async(pool, mb(2), EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_CACHED);
+    ASSERT_LE(0, evfd) << ": " << strerror(-evfd);
+
+    int fd = exynos_ion_pool_alloc_result(pool, evfd);
+    ASSERT_LE(0, fd) << ": " << strerror(-fd);
+    EXPECT_EQ(0, exynos_ion_pool_release(pool, fd));
+
+    exynos_ion_pool_destroy(pool);
+}
+
+TEST_F(AllocateAPI, AllocStats)
+{
+    int fd = exynos_ion_alloc(0, kb(64), EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+    ASSERT_LE(0, fd) << ": " << strerror(-fd);
+    close(fd);
+
+    // more than one heap in the mask is not allowed
+    EXPECT_GT(0, exynos_ion_alloc(0, kb(64), EXYNOS_ION_HEAP_SYSTEM_MASK | EXYNOS_ION_HEAP_CRYPTO_MASK, 0));
+
+    size_t len = exynos_ion_dump_alloc_stats(nullptr, 0);
+    EXPECT_LT(0u, len);
+
+    std::string buf(len + 1, '\0');
+    EXPECT_EQ(len, exynos_ion_dump_alloc_stats(&buf[0], buf.size()));
+    EXPECT_NE(std::string::npos, buf.find("system"));
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2018 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+
+#include "ion_test_fixture.h"
+#include "ion_test_define.h"
+
+/*
+ * The results are stored with RecordProperty() as "<case>.<key>" so that
+ * --gtest_output=json or xml gives them to the dashboards without parsing
+ * the console output.
+ */
+#define BENCH_ITERATIONS 16
+
+using namespace std;
+using bench_clock = chrono::steady_clock;
+
+class Benchmark : public IonAllocTest {
+protected:
+    template <typename Fn>
+    static uint64_t measure(Fn fn) {
+        auto begin = bench_clock::now();
+        fn();
+        return chrono::duration_cast<chrono::nanoseconds>(bench_clock::now() - begin).count();
+    }
+
+    void report(const string &name, vector<uint64_t> &samples) {
+        if (samples.empty())
+            return;
+
+        sort(samples.begin(), samples.end());
+
+        uint64_t sum = 0;
+        for (uint64_t ns : samples)
+            sum += ns;
+
+        RecordProperty(name + ".count", static_cast<int>(samples.size()));
+        RecordProperty(name + ".mean_us", static_cast<int>(sum / samples.size() / 1000));
+        RecordProperty(name + ".p50_us", static_cast<int>(samples[samples.size() / 2] / 1000));
+        RecordProperty(name + ".p99_us", static_cast<int>(samples[(samples.size() * 99) / 100] / 1000));
+    }
+
+    // legacy heap masks of exynos_ion_alloc() that are available
+    vector<unsigned int> heapMasks() {
+        vector<unsigned int> masks;
+
+        for (unsigned int i = 0; i < MAX_LEGACY_HEAP_IDS; i++) {
+            unsigned int mask = 1 << getLegacyHeapId(i);
+            if (getAllHeapMask() & mask)
+                masks.push_back(mask);
+        }
+
+        return masks;
+    }
+};
+
+static const size_t bench_sizes[] = { kb(4), kb(64), mb(1), mb(4), mb(16) };
+
+TEST_F(Benchmark, AllocLatency)
+{
+    static const unsigned int bench_flags[] = { 0, ION_FLAG_CACHED };
+
+    for (unsigned int heapmask : heapMasks()) {
+        for (unsigned int flags : bench_flags) {
+            for (size_t size : bench_sizes) {
+                vector<uint64_t> samples;
+
+                SCOPED_TRACE(::testing::Message() << "heapmask: " << heapmask << ", size: " << size << ", flags: " << flags);
+
+                for (int n = 0; n < BENCH_ITERATIONS; n++) {
+                    int fd = -1;
+
+                    samples.push_back(measure([&] { fd = exynos_ion_alloc(getIonFd(), size, heapmask, flags); }));
+                    if (fd < 0) {
+                        samples.pop_back();
+                        break;
+                    }
+                    EXPECT_EQ(0, close(fd));
+                }
+
+                report("alloc." + to_string(heapmask) + "." + to_string(flags) + "." + to_string(size), samples);
+            }
+        }
+    }
+}
+
+TEST_F(Benchmark, Mmap)
+{
+    for (size_t size : bench_sizes) {
+        vector<uint64_t> map_samples, unmap_samples;
+
+        int fd = exynos_ion_alloc(getIonFd(), size, EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_CACHED);
+        ASSERT_LE(0, fd) << ": " << strerror(-fd);
+
+        for (int n = 0; n < BENCH_ITERATIONS; n++) {
+            void *p = MAP_FAILED;
+
+            map_samples.push_back(measure([&] { p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); }));
+            ASSERT_NE(MAP_FAILED, p) << ": " << strerror(errno);
+            // fault in the pages to measure the cost of tearing them down
+            for (size_t off = 0; off < size; off += 4096)
+                reinterpret_cast<volatile char *>(p)[off] = 0;
+            unmap_samples.push_back(measure([&] { munmap(p, size); }));
+        }
+
+        EXPECT_EQ(0, close(fd));
+
+        report("mmap." + to_string(size), map_samples);
+        report("munmap." + to_string(size), unmap_samples);
+    }
+}
+
+TEST_F(Benchmark, Sync)
+{
+    for (size_t size : bench_sizes) {
+        vector<uint64_t> start_samples, end_samples;
+
+        int fd = exynos_ion_alloc(getIonFd(), size, EXYNOS_ION_HEAP_SYSTEM_MASK, ION_FLAG_CACHED);
+        ASSERT_LE(0, fd) << ": " << strerror(-fd);
+
+        for (int n = 0; n < BENCH_ITERATIONS; n++) {
+            start_samples.push_back(measure([&] { EXPECT_EQ(0, exynos_ion_sync_start(getIonFd(), fd, DMA_BUF_SYNC_RW)); }));
+            end_samples.push_back(measure([&] { EXPECT_EQ(0, exynos_ion_sync_end(getIonFd(), fd, DMA_BUF_SYNC_RW)); }));
+        }
+
+        EXPECT_EQ(0, close(fd));
+
+        report("sync_start." + to_string(size), start_samples);
+        report("sync_end." + to_string(size), end_samples);
+    }
+}
+
+TEST_F(Benchmark, ConcurrentAlloc)
+{
+    static const unsigned int bench_threads[] = { 1, 2, 4, 8 };
+
+    for (unsigned int nr_threads : bench_threads) {
+        atomic<unsigned int> failures(0);
+        vector<thread> threads;
+
+        uint64_t elapsed = measure([&] {
+            for (unsigned int t = 0; t < nr_threads; t++) {
+                threads.emplace_back([&] {
+                    for (int n = 0; n < BENCH_ITERATIONS; n++) {
+                        int fd = exynos_ion_alloc(getIonFd(), mb(1), EXYNOS_ION_HEAP_SYSTEM_MASK, 0);
+                        if (fd < 0)
+                            failures++;
+                        else
+                            close(fd);
+                    }
+                });
+            }
+
+            for (thread &th : threads)
+                th.join();
+        });
+
+        EXPECT_EQ(0U, failures.load());
+
+        uint64_t allocs = nr_threads * BENCH_ITERATIONS;
+        RecordProperty("concurrent." + to_string(nr_threads) + ".allocs_per_sec",
+                       static_cast<int>(allocs * 1000000000ULL / max<uint64_t>(elapsed, 1)));
+    }
+}
+
+TEST_F(Benchmark, Pool)
+{
+    struct exynos_ion_pool *pool = exynos_ion_pool_create(mb(64));
+    ASSERT_NE(nullptr, pool);
+
+    for (size_t size : bench_sizes) {
+        vector<uint64_t> miss_samples, hit_samples;
+
+        for (int n = 0; n < BENCH_ITERATIONS; n++) {
+            int fd = -1;
+
+            // the first allocation of the size class misses the pool after the trim
+            exynos_ion_pool_trim(pool, 0);
+            miss_samples.push_back(measure([&] { fd = exynos_ion_pool_alloc(pool, size, EXYNOS_ION_HEAP_SYSTEM_MASK, 0); }));
+            ASSERT_LE(0, fd) << ": " << strerror(-fd);
+            EXPECT_EQ(0, exynos_ion_pool_release(pool, fd));
+
+            hit_samples.push_back(measure([&] { fd = exynos_ion_pool_alloc(pool, size, EXYNOS_ION_HEAP_SYSTEM_MASK, 0); }));
+            ASSERT_LE(0, fd) << ": " << strerror(-fd);
+            EXPECT_EQ(0, exynos_ion_pool_release(pool, fd));
+        }
+
+        report("pool_miss." + to_string(size), miss_samples);
+        report("pool_hit." + to_string(size), hit_samples);
+    }
+
+    exynos_ion_pool_destroy(pool);
+}
@@ -21,7 +21,7 @@ include $(CLEAR_VARS)
 LOCAL_MODULE_RELATIVE_PATH := hw
 LOCAL_HEADER_LIBRARIES := libcutils_headers libsystem_headers libhardware_headers
 LOCAL_SHARED_LIBRARIES := liblog libion_google
-LOCAL_SRC_FILES := memtrack_exynos.cpp mali.cpp ion.cpp dmabuf.cpp
+LOCAL_SRC_FILES := memtrack_exynos.cpp mali.cpp ion.cpp dmabuf.cpp snapshot.cpp
 LOCAL_MODULE := memtrack.$(TARGET_BOARD_PLATFORM)
 LOCAL_LICENSE_KINDS := SPDX-license-identifier-Apache-2.0
 LOCAL_LICENSE_CONDITIONS := notice
@@ -1,10 +1,9 @@
 #include <fstream>
-#include <sstream>
-#include <regex>
+#include <string>
 #include <vector>
-#include <algorithm>
 
 #include <cerrno>
+#include <cstring>
 #include <sys/stat.h>
 
 #include <hardware/memtrack.h>
@@ -30,57 +29,58 @@ struct DmabufBuffer {
     DmabufBuffer(unsigned int _id, size_t _size, size_t _pss)
         : id(_id), type(MEMTRACK_FLAG_SMAPS_UNACCOUNTED | MEMTRACK_FLAG_SHARED_PSS), size(_size), pss(_pss)
     { }
-    void setPoolType(string _type) { type |= (_type == "carveout") ? MEMTRACK_FLAG_DEDICATED : MEMTRACK_FLAG_SYSTEM; }
+    void setPoolType(bool carveout) { type |= carveout ? MEMTRACK_FLAG_DEDICATED : MEMTRACK_FLAG_SYSTEM; }
     void setFlags(unsigned int flags) { type |= (flags & ION_FLAG_PROTECTED) ? MEMTRACK_FLAG_SECURE : MEMTRACK_FLAG_NONSECURE; }
 };
 
 const char DMABUF_FOOTPRINT_PATH[] = "/sys/kernel/debug/dma_buf/footprint/";
 static bool build_dmabuf_footprint(vector<DmabufBuffer> &buffers, pid_t pid)
 {
-    ostringstream dmabuf_path;
-    dmabuf_path << DMABUF_FOOTPRINT_PATH << pid;
+    string dmabuf_path = DMABUF_FOOTPRINT_PATH + to_string(pid);
 
-    ifstream dmabuf(dmabuf_path.str());
+    ifstream dmabuf(dmabuf_path);
     if (!dmabuf)
         return false;
     //
     // exp_name      size     share
     // ion-102   69271552  34635776
-    regex rex("\\s*ion-(\\d+)\\s+(\\d+)\\s+(\\d+).*");
-    smatch mch;
-    // 1-id, 2-size, 3-pss
-    for (string line; getline(dmabuf, line); )
-        if (regex_match(line, mch, rex))
-            buffers.emplace_back(stoul(mch[1], 0, 10), stoul(mch[2], 0, 10), stoul(mch[3], 0, 10));
+    for (string line; getline(dmabuf, line); ) {
+        const char *p = line.c_str();
+        unsigned long id, size, pss;
+
+        while (isspace(*p))
+            p++;
+
+        if (strncmp(p, "ion-", 4) != 0)
+            continue;
+        p += 4;
+
+        if (memtrack_parse_number(p, 10, id) && isspace(*p) && memtrack_parse_number(p, 10, size) && isspace(*p) &&
+            memtrack_parse_number(p, 10, pss))
+            buffers.emplace_back(id, size, pss);
+    }
 
     return true;
 }
 
-const char ION_BUFFERS_PATH[] = "/sys/kernel/debug/ion/buffers";
 static bool complete_dmabuf_footprint(int type, vector<DmabufBuffer> &buffers)
 {
-    ifstream ion(ION_BUFFERS_PATH);
-    if (!ion)
+    auto snapshot = memtrack_get_snapshot();
+    if (!snapshot->ion_buffers_valid)
         return false;
 
-    // [  id]            heap heaptype flags size(kb) : iommu_mapped...
-    // [ 106] ion_system_heap   system  0x40    16912 : 19080000.dsim(0)
-    regex rexion("\\[ *(\\d+)\\] +[[:alnum:]\\-_]+ +(\\w+) +([x[:xdigit:]]+) +(\\d+).*");
-    smatch mch;
-    // 1-id, 2-heaptype, 3-flags, 4-size
-    for (string line; getline(ion, line); ) {
-        if (regex_match(line, mch, rexion)) {
-            unsigned int id = stoul(mch[1], 0, 10);
-            unsigned int flags = stoul(mch[3], 0, 16);
-            size_t len = stoul(mch[4], 0, 10) * 1024;
-            auto elem = find_if(begin(buffers), end(buffers), [id, len] (auto &item) {
-                                    return (item.id == id) && (item.size == len);
-                                });
-            // passes if type = OTHER && not flag & hwrender or type == GRAPHIC && flag & hwrender
-            if ((elem != end(buffers)) && ((type == MEMTRACK_TYPE_OTHER) == !(flags & ION_FLAG_MAY_HWRENDER))) {
-                elem->setFlags(flags);
-                elem->setPoolType(mch[2]);
-            }
+    const auto &ion_buffers = snapshot->ion_buffers;
+
+    for (auto &item : buffers) {
+        auto elem = ion_buffers.find(item.id);
+        if ((elem == ion_buffers.end()) || (elem->second.size != item.size))
+            continue;
+
+        unsigned int flags = elem->second.flags;
+        // passes if type = OTHER && not flag & hwrender or type == GRAPHIC && flag & hwrender
+        if ((type == MEMTRACK_TYPE_OTHER) == !(flags & ION_FLAG_MAY_HWRENDER)) {
+            item.setFlags(flags);
+            item.setPoolType(elem->second.carveout);
         }
     }
 
@@ -115,7 +115,7 @@ int dmabuf_memtrack_get_memory(pid_t pid, int type, struct memtrack_record *reco
     if (!complete_dmabuf_footprint(type, buffers))
         return -ENODEV;
 
-    for (auto item: buffers) {
+    for (auto &item: buffers) {
         for (size_t i = 0; i < *num_records; i++) {
             if (item.type == available_flags[i]) {
                 records[i].size_in_bytes += item.pss;
@@ -35,15 +35,15 @@ int exynos_memtrack_get_memory(const struct memtrack_module __unused *module,
                                 struct memtrack_record *records,
                                 size_t *num_records)
 {
-    struct stat st;
+    auto snapshot = memtrack_get_snapshot();
 
     switch (type) {
         case MEMTRACK_TYPE_GL:
-            if (!stat("/d/mali/mem", &st) && S_ISDIR(st.st_mode))
+            if (snapshot->has_mali)
                 return mali_memtrack_get_memory(pid, type, records, num_records);
             break;
         case MEMTRACK_TYPE_GRAPHICS:
-            if (!stat("/d/ion/clients", &st) && S_ISDIR(st.st_mode))
+            if (snapshot->has_ion_clients)
                 return ion_memtrack_get_memory(pid, type, records, num_records);
             [[fallthrough]];
         default:
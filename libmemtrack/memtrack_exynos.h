@@ -17,6 +17,12 @@
 #ifndef _MEMTRACK_EXYNOS5_H_
 #define _MEMTRACK_EXYNOS5_H_
 
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 int mali_memtrack_get_memory(pid_t pid, int type,
                              struct memtrack_record *records,
                              size_t *num_records);
@@ -27,4 +33,32 @@ int dmabuf_memtrack_get_memory(pid_t pid, int type,
                                struct memtrack_record *records,
                                size_t *num_records);
 
+#define MALI_MEM_PATH "/d/mali/mem"
+#define ION_CLIENTS_PATH "/d/ion/clients"
+
+struct IonBufferInfo {
+    unsigned int flags;
+    size_t size;
+    bool carveout;
+};
+
+/*
+ * The system-wide sources of memtrack read at once. memtrack_get_snapshot()
+ * shares a snapshot with the queries of all pids for a second instead of
+ * reading the global files again for every pid.
+ */
+struct MemtrackSnapshot {
+    std::chrono::steady_clock::time_point taken;
+    bool has_mali;
+    bool has_ion_clients;
+    bool ion_buffers_valid;
+    std::unordered_map<unsigned int, IonBufferInfo> ion_buffers; // by ION buffer id
+    std::unordered_map<pid_t, std::vector<std::string>> mali_contexts; // directories by pid
+};
+
+std::shared_ptr<const MemtrackSnapshot> memtrack_get_snapshot();
+
+bool memtrack_parse_number(const char *&p, int base, unsigned long &val);
+const char *memtrack_parse_word(const char *&p, size_t &len);
+
 #endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <log/log.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_exynos.h"
+
+using namespace std;
+
+// The global sources do not change much during a sweep of dumpsys meminfo over all pids.
+#define MEMTRACK_SNAPSHOT_TTL chrono::seconds(1)
+
+// Skips the spaces and parses a number at @p. @p points to the next character on success.
+bool memtrack_parse_number(const char *&p, int base, unsigned long &val)
+{
+    while (isspace(*p))
+        p++;
+
+    if (!isxdigit(*p))
+        return false;
+
+    char *end;
+    val = strtoul(p, &end, base);
+    if (end == p)
+        return false;
+
+    p = end;
+    return true;
+}
+
+// Skips the spaces and a word at @p. Returns the pointer to the word and its length in @len
+const char *memtrack_parse_word(const char *&p, size_t &len)
+{
+    while (isspace(*p))
+        p++;
+
+    const char *word = p;
+    while (*p && !isspace(*p))
+        p++;
+
+    len = p - word;
+    return len ? word : nullptr;
+}
+
+
+const char ION_BUFFERS_PATH[] = "/sys/kernel/debug/ion/buffers";
+static bool parse_ion_buffers(unordered_map<unsigned int, IonBufferInfo> &ion_buffers)
+{
+    ifstream ion(ION_BUFFERS_PATH);
+    if (!ion)
+        return false;
+
+    ion_buffers.clear();
+
+    // [  id]            heap heaptype flags size(kb) : iommu_mapped...
+    // [ 106] ion_system_heap   system  0x40    16912 : 19080000.dsim(0)
+    for (string line; getline(ion, line); ) {
+        const char *p = line.c_str();
+        const char *heaptype;
+        size_t len;
+        unsigned long id, flags, size;
+
+        while (isspace(*p))
+            p++;
+
+        if (*p++ != '[')
+            continue;
+
+        if (!memtrack_parse_number(p, 10, id) || (*p++ != ']'))
+            continue;
+
+        if (!memtrack_parse_word(p, len) || !(heaptype = memtrack_parse_word(p, len)))
+            continue;
+
+        if (memtrack_parse_number(p, 16, flags) && memtrack_parse_number(p, 10, size))
+            ion_buffers[id] = {static_cast<unsigned int>(flags), size * 1024,
+                               (len == 8) && !strncmp(heaptype, "carveout", len)};
+    }
+
+    return true;
+}
+
+// The contexts of Mali are the directories named "<pid>_<context id>"
+static bool scan_mali_contexts(unordered_map<pid_t, vector<string>> &contexts)
+{
+    DIR *dir = opendir(MALI_MEM_PATH);
+    if (!dir) {
+        ALOGE("libmemtrack-hw -- Couldn't open the directory - %s", MALI_MEM_PATH);
+        return false;
+    }
+
+    while (struct dirent *entry = readdir(dir)) {
+        char *end;
+        long pid = strtol(entry->d_name, &end, 10);
+
+        if ((end != entry->d_name) && (*end == '_'))
+            contexts[static_cast<pid_t>(pid)].push_back(string(MALI_MEM_PATH "/") + entry->d_name);
+    }
+
+    closedir(dir);
+
+    return true;
+}
+
+static bool is_directory(const char *path)
+{
+    struct stat st;
+
+    return !stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+shared_ptr<const MemtrackSnapshot> memtrack_get_snapshot()
+{
+    static mutex snapshot_mutex;
+    static shared_ptr<const MemtrackSnapshot> snapshot;
+
+    lock_guard<mutex> lock(snapshot_mutex);
+
+    auto now = chrono::steady_clock::now();
+    if (snapshot && ((now - snapshot->taken) <= MEMTRACK_SNAPSHOT_TTL))
+        return snapshot;
+
+    auto fresh = make_shared<MemtrackSnapshot>();
+
+    fresh->taken = now;
+    fresh->has_mali = is_directory(MALI_MEM_PATH);
+    if (fresh->has_mali)
+        scan_mali_contexts(fresh->mali_contexts);
+    fresh->has_ion_clients = is_directory(ION_CLIENTS_PATH);
+    fresh->ion_buffers_valid = parse_ion_buffers(fresh->ion_buffers);
+
+    // the queries still holding the previous snapshot are not affected
+    snapshot = fresh;
+
+    return snapshot;
+}
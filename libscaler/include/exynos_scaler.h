@@ -66,6 +66,14 @@ typedef enum _HW_SCAL_ID {
     HW_SCAL_MAX,
 } HW_SCAL_ID;
 
+// sampling of the S/W scaler
+enum {
+    EXYNOS_SC_SW_FILTER_NEAREST = 0,
+    // average of the source pixels covered by a target pixel. slower but
+    // without the aliasing of the nearest sampling on the large downscaling.
+    EXYNOS_SC_SW_FILTER_AREA,
+};
+
 // argument of non-blocking api
 typedef struct {
     uint32_t x;
@@ -160,6 +168,22 @@ struct SrcBlendInfo {
 	struct CSC_Spec cscspec;
 };
 
+/* A destination image of exynos_sc_convert_batch() */
+struct ScalerBatchTarget {
+	unsigned int width;
+	unsigned int height;
+	unsigned int v4l2_colorformat;
+	unsigned int crop_left;
+	unsigned int crop_top;
+	unsigned int crop_width;
+	unsigned int crop_height;
+	void *addr[SC_NUM_OF_PLANES];
+	int mem_type;
+	int rotation;
+	int flip_horizontal;
+	int flip_vertical;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -200,6 +224,31 @@ int exynos_sc_destroy(void *handle);
  */
 int exynos_sc_convert(void *handle);
 
+/*!
+ * Convert the presetup source image to each of the given destinations. The
+ * source is configured once and the jobs are submitted back to back. The call
+ * returns when all of the destinations are written or at the first failure.
+ * The destination and the rotation of the handle are left as the last target.
+ *
+ * \ingroup exynos_scaler
+ *
+ * \param handle
+ *   libscaler handle[in]
+ *
+ * \param targets
+ *   destination images[in]
+ *
+ * \param count
+ *   number of the elements in targets[in]
+ *
+ * \return
+ *   error code
+ */
+int exynos_sc_convert_batch(
+    void *handle,
+    const struct ScalerBatchTarget *targets,
+    unsigned int count);
+
 /*!
  * Convert color space with presetup color format
  *
@@ -425,6 +474,25 @@ int exynos_sc_set_rotation(
 void exynos_sc_set_framerate(
         void *handle,
         int framerate);
+
+/*!
+ * Set the sampling of the S/W scaler that runs the downscaling beyond 1/16
+ * instead of the H/W (optional).
+ *
+ * \ingroup exynos_scaler
+ *
+ * \param handle
+ *   libscaler handle[in]
+ *
+ * \param filter
+ *   EXYNOS_SC_SW_FILTER_NEAREST(default) or EXYNOS_SC_SW_FILTER_AREA[in]
+ *
+ * \return
+ *   error code
+ */
+int exynos_sc_set_sw_filter(
+        void *handle,
+        int filter);
 ////// non-blocking /////
 
 void *exynos_sc_create_exclusive(
@@ -445,6 +513,16 @@ int exynos_sc_run_exclusive(
     exynos_sc_img *src_img,
     exynos_sc_img *dst_img);
 
+/*
+ * Frames in flight up to @count(max 4, default 1) : exynos_sc_run_exclusive()
+ * waits for the oldest frame only if @count frames are not yet done and
+ * exynos_sc_wait_frame_done_exclusive() waits for the oldest frame. The
+ * device keeps streaming while the configuration is not changed.
+ */
+int exynos_sc_set_buffer_count_exclusive(
+    void *handle,
+    unsigned int count);
+
 void *exynos_sc_create_blend_exclusive(
         int dev_num,
         int allow_drm);
@@ -455,6 +533,38 @@ int exynos_sc_config_blend_exclusive(
     exynos_sc_img *dst_img,
     struct SrcBlendInfo  *srcblendinfo);
 
+/*!
+ * Blend several layers to the destination in sequence. Each element of
+ * src_imgs[] is blended to dst_img with the corresponding srcblendinfos[].
+ * The destination is updated in place and every layer waits for the release
+ * fence of the previous layer, so no intermediate buffer is required.
+ *
+ * \param handle
+ *   libscaler blend handle[in]
+ *
+ * \param src_imgs
+ *   source images with their acquire fences[in] and release fences[out]
+ *
+ * \param srcblendinfos
+ *   blending of each source[in]
+ *
+ * \param count
+ *   number of layers[in]
+ *
+ * \param dst_img
+ *   destination with its acquire fence[in] and the release fence of the
+ *   last layer[out]
+ *
+ * \return
+ *   error code
+ */
+int exynos_sc_blend_layers_exclusive(
+    void *handle,
+    exynos_sc_img *src_imgs,
+    struct SrcBlendInfo *srcblendinfos,
+    unsigned int count,
+    exynos_sc_img *dst_img);
+
 int exynos_sc_wait_frame_done_exclusive
 (void *handle);
 
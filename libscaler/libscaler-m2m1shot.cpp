@@ -31,6 +31,9 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
+#include <functional>
+#include <vector>
+
 #include <exynos_scaler.h>
 
 #include "libscaler-common.h"
@@ -79,7 +82,8 @@ const static PixFormat g_pixfmt_table[] = {
 };
 
 
-CScalerM2M1SHOT::CScalerM2M1SHOT(int devid, int __UNUSED__ drm) : m_iFD(-1)
+CScalerM2M1SHOT::CScalerM2M1SHOT(int devid, int __UNUSED__ drm)
+    : m_iFD(-1), m_iDevID(devid), m_nSWFilter(EXYNOS_SC_SW_FILTER_NEAREST)
 {
     memset(&m_task, 0, sizeof(m_task));
 
@@ -98,12 +102,50 @@ CScalerM2M1SHOT::CScalerM2M1SHOT(int devid, int __UNUSED__ drm) : m_iFD(-1)
     }
 }
 
+void CScalerM2M1SHOT::Reset()
+{
+    memset(&m_task, 0, sizeof(m_task));
+
+    m_task.buf_out.num_planes = 3;
+    m_task.buf_cap.num_planes = 3;
+    m_nSWFilter = EXYNOS_SC_SW_FILTER_NEAREST;
+}
+
 CScalerM2M1SHOT::~CScalerM2M1SHOT()
 {
     if (m_iFD >= 0)
         close(m_iFD);
 }
 
+static bool GetBuffer(m2m1shot_buffer &buf, char *addr[])
+{
+    for (int i = 0; i < buf.num_planes; i++) {
+            if (buf.type == M2M1SHOT_BUFFER_DMABUF) {
+                addr[i] = reinterpret_cast<char *>(mmap(NULL, buf.plane[i].len,
+                                 PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 buf.plane[i].fd, 0));
+                if (addr[i] == MAP_FAILED) {
+                    SC_LOGE("Failed to map FD %d", buf.plane[i].fd);
+                    while (i-- > 0)
+                        munmap(addr[i], buf.plane[i].len);
+                    return false;
+                }
+            } else {
+                addr[i] = reinterpret_cast<char *>(buf.plane[i].userptr);
+            }
+    }
+
+    return true;
+}
+
+static void PutBuffer(m2m1shot_buffer &buf, char *addr[])
+{
+    for (int i = 0; i < buf.num_planes; i++) {
+        if (buf.type == M2M1SHOT_BUFFER_DMABUF)
+            munmap(addr[i], buf.plane[i].len);
+    }
+}
+
 bool CScalerM2M1SHOT::Run()
 {
     int ret;
@@ -111,8 +153,18 @@ bool CScalerM2M1SHOT::Run()
     if (LibScaler::UnderOne16thScaling(
                 m_task.fmt_out.crop.width, m_task.fmt_out.crop.height,
                 m_task.fmt_cap.crop.width, m_task.fmt_cap.crop.height,
-                m_task.op.rotate))
-        return RunSWScaling();
+                m_task.op.rotate)) {
+        char *src[3];
+
+        if (!GetBuffer(m_task.buf_out, src))
+            return false;
+
+        bool sw_ret = RunSWScaling(src);
+
+        PutBuffer(m_task.buf_out, src);
+
+        return sw_ret;
+    }
 
     ret = ioctl(m_iFD, M2M1SHOT_IOC_PROCESS, &m_task);
     if (ret < 0) {
@@ -123,6 +175,51 @@ bool CScalerM2M1SHOT::Run()
     return true;
 }
 
+bool CScalerM2M1SHOT::RunBatch(const ScalerBatchTarget targets[], unsigned int count)
+{
+    char *src[3];
+    bool src_mapped = false;
+    bool ret = true;
+
+    for (unsigned int i = 0; ret && (i < count); i++) {
+        const ScalerBatchTarget &t = targets[i];
+        void *addr[SC_NUM_OF_PLANES] = { t.addr[0], t.addr[1], t.addr[2] };
+
+        // only the capture side of m_task changes between the jobs
+        if (!SetDstFormat(t.width, t.height, t.v4l2_colorformat) ||
+                !SetDstCrop(t.crop_left, t.crop_top, t.crop_width, t.crop_height) ||
+                !SetRotate(t.rotation, t.flip_horizontal, t.flip_vertical) ||
+                !SetDstAddr(addr, t.mem_type)) {
+            SC_LOGE("Invalid destination %u of the batch", i);
+            ret = false;
+            break;
+        }
+
+        if (LibScaler::UnderOne16thScaling(
+                    m_task.fmt_out.crop.width, m_task.fmt_out.crop.height,
+                    m_task.fmt_cap.crop.width, m_task.fmt_cap.crop.height,
+                    m_task.op.rotate)) {
+            if (!src_mapped) {
+                if (!GetBuffer(m_task.buf_out, src)) {
+                    ret = false;
+                    break;
+                }
+                src_mapped = true;
+            }
+
+            ret = RunSWScaling(src);
+        } else if (ioctl(m_iFD, M2M1SHOT_IOC_PROCESS, &m_task) < 0) {
+            SC_LOGERR("Failed to process the destination %u of the batch", i);
+            ret = false;
+        }
+    }
+
+    if (src_mapped)
+        PutBuffer(m_task.buf_out, src);
+
+    return ret;
+}
+
 #define SCALER_EXT_SIZE		512
 bool CScalerM2M1SHOT::SetFormat(m2m1shot_pix_format &fmt, m2m1shot_buffer &buf,
         unsigned int width, unsigned int height, unsigned int v4l2_fmt) {
@@ -233,78 +330,79 @@ bool CScalerM2M1SHOT::SetRotate(int rot, int hflip, int vflip) {
     return true;
 }
 
-static bool GetBuffer(m2m1shot_buffer &buf, char *addr[])
+bool CScalerM2M1SHOT::RunSWConversion(char *src[])
 {
-    for (int i = 0; i < buf.num_planes; i++) {
-            if (buf.type == M2M1SHOT_BUFFER_DMABUF) {
-                addr[i] = reinterpret_cast<char *>(mmap(NULL, buf.plane[i].len,
-                                 PROT_READ | PROT_WRITE, MAP_SHARED,
-                                 buf.plane[i].fd, 0));
-                if (addr[i] == MAP_FAILED) {
-                    SC_LOGE("Failed to map FD %d", buf.plane[i].fd);
-                    while (i-- > 0)
-                        munmap(addr[i], buf.plane[i].len);
-                    return false;
-                }
-            } else {
-                addr[i] = reinterpret_cast<char *>(buf.plane[i].userptr);
-            }
+    if (!CScalerSW_CSC::IsSupported(m_task.fmt_out.fmt, m_task.fmt_cap.fmt)) {
+        SC_LOGE("S/W Scaler does not convert format %x to %x",
+                m_task.fmt_out.fmt, m_task.fmt_cap.fmt);
+        return false;
     }
 
-    return true;
-}
+    SC_LOGI("Running S/W Scaler: %dx%d(%x) -> %dx%d(%x)",
+            m_task.fmt_out.crop.width, m_task.fmt_out.crop.height, m_task.fmt_out.fmt,
+            m_task.fmt_cap.crop.width, m_task.fmt_cap.crop.height, m_task.fmt_cap.fmt);
 
-static void PutBuffer(m2m1shot_buffer &buf, char *addr[])
-{
-    for (int i = 0; i < buf.num_planes; i++) {
-        if (buf.type == M2M1SHOT_BUFFER_DMABUF)
-            munmap(addr[i], buf.plane[i].len);
-    }
-}
+    char *dst[3];
 
-bool CScalerM2M1SHOT::RunSWScaling()
-{
-    if (m_task.fmt_cap.fmt != m_task.fmt_out.fmt) {
-        SC_LOGE("Source and target image format must be the same");
+    if (!GetBuffer(m_task.buf_cap, dst))
         return false;
-    }
 
+    // the chroma of the single plane formats of YUV420
+    if (m_task.buf_out.num_planes == 1)
+        src[1] = src[0] + m_task.fmt_out.width * m_task.fmt_out.height;
+    if (m_task.buf_cap.num_planes == 1)
+        dst[1] = dst[0] + m_task.fmt_cap.width * m_task.fmt_cap.height;
+
+    CScalerSW_CSC swsc(m_task.fmt_out.fmt, src, m_task.fmt_cap.fmt, dst);
+
+    swsc.SetCSC(!!(m_task.op.op & M2M1SHOT_OP_CSC_WIDE), !!(m_task.op.op & M2M1SHOT_OP_CSC_709));
+
+    swsc.SetSrcRect(m_task.fmt_out.crop.left, m_task.fmt_out.crop.top,
+            m_task.fmt_out.crop.width, m_task.fmt_out.crop.height,
+            m_task.fmt_out.width);
+
+    swsc.SetDstRect(m_task.fmt_cap.crop.left, m_task.fmt_cap.crop.top,
+            m_task.fmt_cap.crop.width, m_task.fmt_cap.crop.height,
+            m_task.fmt_cap.width);
+
+    bool ret = swsc.Scale();
+
+    PutBuffer(m_task.buf_cap, dst);
+
+    return ret;
+}
+
+bool CScalerM2M1SHOT::RunSWScaling(char *src[])
+{
     if (m_task.op.rotate != 0) {
         SC_LOGE("Rotation is not allowed for S/W Scaling");
         return false;
     }
 
+    if (m_task.fmt_cap.fmt != m_task.fmt_out.fmt)
+        return RunSWConversion(src);
+
     SC_LOGI("Running S/W Scaler: %dx%d -> %dx%d",
             m_task.fmt_out.crop.width, m_task.fmt_out.crop.height,
             m_task.fmt_cap.crop.width, m_task.fmt_cap.crop.height);
 
     CScalerSW *swsc;
-    char *src[3], *dst[3];
+    char *dst[3];
 
     switch (m_task.fmt_cap.fmt) {
         case V4L2_PIX_FMT_YUYV:
         case V4L2_PIX_FMT_YVYU:
-            if (!GetBuffer(m_task.buf_out, src))
+            if (!GetBuffer(m_task.buf_cap, dst))
                 return false;
 
-            if (!GetBuffer(m_task.buf_cap, dst)) {
-                PutBuffer(m_task.buf_out, src);
-                return false;
-            }
-
             swsc = new CScalerSW_YUYV(src[0], dst[0]);
             break;
         case V4L2_PIX_FMT_NV12M:
         case V4L2_PIX_FMT_NV21M:
         case V4L2_PIX_FMT_NV12:
         case V4L2_PIX_FMT_NV21:
-            if (!GetBuffer(m_task.buf_out, src))
-                return false;
-
-            if (!GetBuffer(m_task.buf_cap, dst)) {
-                PutBuffer(m_task.buf_out, src);
+            if (!GetBuffer(m_task.buf_cap, dst))
                 return false;
-            }
 
             if (m_task.buf_out.num_planes == 1)
                 src[1] = src[0] + m_task.fmt_out.width * m_task.fmt_out.height;
@@ -322,7 +420,6 @@ bool CScalerM2M1SHOT::RunSWScaling()
 
     if (swsc == NULL) {
         SC_LOGE("Failed to allocate SW Scaler");
-        PutBuffer(m_task.buf_out, src);
         PutBuffer(m_task.buf_cap, dst);
         return false;
     }
@@ -335,11 +432,12 @@ bool CScalerM2M1SHOT::RunSWScaling()
             m_task.fmt_cap.crop.width, m_task.fmt_cap.crop.height,
             m_task.fmt_cap.width);
 
+    swsc->SetFilter(m_nSWFilter);
+
     bool ret = swsc->Scale();
 
     delete swsc;
 
-    PutBuffer(m_task.buf_out, src);
     PutBuffer(m_task.buf_cap, dst);
 
     return ret;
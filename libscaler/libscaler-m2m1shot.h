@@ -32,7 +32,9 @@
 
 class CScalerM2M1SHOT {
     int m_iFD;
+    int m_iDevID;
     m2m1shot m_task;
+    unsigned int m_nSWFilter; // sampling of RunSWScaling()
 
     bool SetFormat(m2m1shot_pix_format &fmt, m2m1shot_buffer &buf,
                    unsigned int width, unsigned int height, unsigned int v4l2_fmt);
@@ -40,14 +42,23 @@ class CScalerM2M1SHOT {
                    unsigned int l, unsigned int t, unsigned int w, unsigned int h);
     bool SetAddr(m2m1shot_buffer &buf, void *addr[SC_NUM_OF_PLANES], int mem_type);
 
-    bool RunSWScaling();
+    // @src is the mapped planes of m_task.buf_out
+    bool RunSWScaling(char *src[]);
+    bool RunSWConversion(char *src[]);
 public:
     CScalerM2M1SHOT(int devid, int allow_drm = 0);
     ~CScalerM2M1SHOT();
 
     bool Run();
+    // runs the current source to each of @targets, mapping the source only
+    // once for the jobs of the S/W scaler
+    bool RunBatch(const ScalerBatchTarget targets[], unsigned int count);
 
     inline bool Valid() { return m_iFD >= 0; }
+    inline int GetDevID() { return m_iDevID; }
+
+    // clear the settings of the previous user to reuse the opened device
+    void Reset();
 
     inline bool SetSrcFormat(unsigned int width, unsigned int height, unsigned int v4l2_fmt) {
         return SetFormat(m_task.fmt_out, m_task.buf_out, width, height, v4l2_fmt);
@@ -98,6 +109,10 @@ public:
         m_task.reserved[0] = (unsigned long)framerate;
     }
 
+    inline void SetSWFilter(unsigned int filter) {
+        m_nSWFilter = filter;
+    }
+
     /* No effect in M2M1SHOT */
     inline void SetDRM(bool __UNUSED__ drm) { }
     inline void SetSrcPremultiplied(bool __UNUSED__ premultiplied) { }
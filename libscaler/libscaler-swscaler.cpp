@@ -1,3 +1,13 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include <linux/videodev2.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 #include "libscaler-swscaler.h"
 
 void CScalerSW::Clear() {
@@ -18,6 +28,115 @@ void CScalerSW::Clear() {
     m_nDstWidth = 0;
     m_nDstHeight = 0;
     m_nDstStride = 0;
+
+    m_nFilter = SW_FILTER_NEAREST;
+    m_nMaxThreads = LibScaler::min(std::thread::hardware_concurrency(), SW_SCALER_MAX_THREADS);
+    if (m_nMaxThreads == 0)
+        m_nMaxThreads = 1;
+}
+
+// The same positions in 16.16 fixed point as the per-pixel loops had so that
+// the nearest sampling stays bit-exact.
+void CScalerSW::BuildNearest(std::vector<unsigned int> &table, unsigned int start,
+                             unsigned int ratio, unsigned int limit, unsigned int count) {
+    unsigned int pos = start << 16;
+
+    table.resize(count);
+    for (unsigned int i = 0; i < count; i++) {
+        table[i] = pos >> 16;
+        pos = LibScaler::min(pos + ratio, limit << 16);
+    }
+}
+
+void CScalerSW::BuildSpans(std::vector<Span> &spans, unsigned int start,
+                           unsigned int srcCount, unsigned int dstCount) {
+    spans.resize(dstCount);
+    for (unsigned int i = 0; i < dstCount; i++) {
+        unsigned long long begin = (static_cast<unsigned long long>(i) * srcCount) / dstCount;
+        unsigned long long end = (static_cast<unsigned long long>(i + 1) * srcCount) / dstCount;
+
+        spans[i].begin = start + static_cast<unsigned int>(begin);
+        spans[i].end = start + static_cast<unsigned int>((end > begin) ? end : begin + 1);
+    }
+}
+
+static void AccumulateRow(unsigned int *acc, const unsigned char *src, unsigned int len) {
+    unsigned int i = 0;
+#ifdef __ARM_NEON
+    for (; (i + 16) <= len; i += 16) {
+        uint8x16_t pix = vld1q_u8(src + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(pix));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(pix));
+
+        vst1q_u32(acc + i, vaddw_u16(vld1q_u32(acc + i), vget_low_u16(lo)));
+        vst1q_u32(acc + i + 4, vaddw_u16(vld1q_u32(acc + i + 4), vget_high_u16(lo)));
+        vst1q_u32(acc + i + 8, vaddw_u16(vld1q_u32(acc + i + 8), vget_low_u16(hi)));
+        vst1q_u32(acc + i + 12, vaddw_u16(vld1q_u32(acc + i + 12), vget_high_u16(hi)));
+    }
+#endif
+    for (; i < len; i++)
+        acc[i] += src[i];
+}
+
+void CScalerSW::ScaleArea(const char *src, unsigned int srcStride, char *dst, unsigned int dstStride,
+                          const std::vector<Span> &rows, const Channel channels[], unsigned int numChannels,
+                          unsigned int accFirst, unsigned int accLen) {
+    if (rows.empty())
+        return;
+
+    unsigned long work = static_cast<unsigned long>(rows.back().end - rows.front().begin) * accLen;
+
+    RunBands(rows.size(), work, [&] (unsigned int begin, unsigned int end) {
+        // the column sums of the source rows of a target row
+        std::vector<unsigned int> acc(accLen);
+
+        for (unsigned int y = begin; y < end; y++) {
+            std::fill(acc.begin(), acc.end(), 0);
+
+            for (unsigned int sy = rows[y].begin; sy < rows[y].end; sy++)
+                AccumulateRow(acc.data(),
+                        reinterpret_cast<const unsigned char *>(src + sy * srcStride + accFirst), accLen);
+
+            unsigned int nrows = rows[y].end - rows[y].begin;
+            char *drow = dst + y * dstStride;
+
+            for (unsigned int c = 0; c < numChannels; c++) {
+                const Channel &ch = channels[c];
+
+                for (unsigned int x = 0; x < ch.count; x++) {
+                    unsigned int sum = 0;
+                    unsigned int idx = ch.srcOffset + ch.cols[x].begin * ch.srcStep - accFirst;
+
+                    for (unsigned int sx = ch.cols[x].begin; sx < ch.cols[x].end; sx++, idx += ch.srcStep)
+                        sum += acc[idx];
+
+                    unsigned int n = nrows * (ch.cols[x].end - ch.cols[x].begin);
+                    drow[ch.dstOffset + x * ch.dstStep] = static_cast<char>((sum + n / 2) / n);
+                }
+            }
+        }
+    });
+}
+
+void CScalerSW::RunBands(unsigned int rows, unsigned long work,
+                         const std::function<void(unsigned int, unsigned int)> &kernel) {
+    unsigned long bands = LibScaler::min(static_cast<unsigned long>(m_nMaxThreads),
+                                         work / SW_SCALER_BAND_WORK);
+    bands = LibScaler::min(bands, static_cast<unsigned long>(rows));
+
+    if (bands <= 1) {
+        kernel(0, rows);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned long i = 1; i < bands; i++)
+        threads.emplace_back(kernel, rows * i / bands, rows * (i + 1) / bands);
+
+    kernel(0, rows / bands);
+
+    for (auto &thread : threads)
+        thread.join();
 }
 
 bool CScalerSW_YUYV::Scale() {
@@ -26,34 +145,55 @@ bool CScalerSW_YUYV::Scale() {
         return false;
     }
 
+    if (m_nFilter == SW_FILTER_AREA) {
+        std::vector<Span> rows, cols, ccols;
+
+        BuildSpans(rows, m_nSrcTop, m_nSrcHeight, m_nDstHeight);
+        BuildSpans(cols, m_nSrcLeft, m_nSrcWidth, m_nDstWidth);
+        BuildSpans(ccols, m_nSrcLeft / 2, m_nSrcWidth / 2, m_nDstWidth / 2);
+
+        unsigned int cleft = (m_nDstLeft & ~1) * 2;
+        const Channel channels[] = {
+            {cols.data(), m_nDstWidth, 0, 2, m_nDstLeft * 2, 2},
+            {ccols.data(), m_nDstWidth / 2, 1, 4, cleft + 1, 4},
+            {ccols.data(), m_nDstWidth / 2, 3, 4, cleft + 3, 4},
+        };
+
+        ScaleArea(m_pSrc[0], m_nSrcStride * 2, m_pDst[0] + m_nDstTop * m_nDstStride * 2, m_nDstStride * 2,
+                  rows, channels, ARRSIZE(channels), m_nSrcLeft * 2, m_nSrcWidth * 2);
+
+        return true;
+    }
+
     unsigned int h_ratio = (m_nSrcWidth << 16) / m_nDstWidth;
     unsigned int v_ratio = (m_nSrcHeight << 16) / m_nDstHeight;
 
-    unsigned int src_x;
-    unsigned int src_y = m_nSrcTop << 16;
+    std::vector<unsigned int> rows, cols;
+
+    BuildNearest(rows, m_nSrcTop, v_ratio, m_nSrcTop + m_nSrcHeight, m_nDstHeight);
+    BuildNearest(cols, m_nSrcLeft, h_ratio, m_nSrcLeft + m_nSrcWidth, m_nDstWidth);
 
     // Luminance + Chrominance at once
-    for (unsigned int y = m_nDstTop; y < (m_nDstTop + m_nDstHeight); y++) {
-        src_x = m_nSrcLeft << 16;
-        for (unsigned int x = m_nDstLeft; x < (m_nDstLeft + m_nDstWidth); x++) {
-            m_pDst[0][y * (m_nDstStride * 2) + x * 2] =
-                m_pSrc[0][(src_y >> 16) * (m_nSrcStride * 2) + (src_x >> 16) * 2];
+    RunBands(m_nDstHeight, static_cast<unsigned long>(m_nDstWidth) * m_nDstHeight * 4,
+             [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            const char *src = m_pSrc[0] + rows[i] * (m_nSrcStride * 2);
+            char *dst = m_pDst[0] + (m_nDstTop + i) * (m_nDstStride * 2);
 
-            if (!(x & 1)) {
-                unsigned int cx = (src_x >> 16) & ~1;
+            for (unsigned int j = 0; j < m_nDstWidth; j++) {
+                unsigned int x = m_nDstLeft + j;
 
-                m_pDst[0][y * (m_nDstStride * 2) + x * 2 + 1] =
-                    m_pSrc[0][(src_y >> 16) * (m_nSrcStride * 2) + cx * 2 + 1];
-                m_pDst[0][y * (m_nDstStride * 2) + x * 2 + 3] =
-                    m_pSrc[0][(src_y >> 16) * (m_nSrcStride * 2) + cx * 2 + 3];
+                dst[x * 2] = src[cols[j] * 2];
 
-            }
+                if (!(x & 1)) {
+                    unsigned int cx = cols[j] & ~1;
 
-            src_x = LibScaler::min(src_x + h_ratio, (m_nSrcLeft + m_nSrcWidth) << 16);
+                    dst[x * 2 + 1] = src[cx * 2 + 1];
+                    dst[x * 2 + 3] = src[cx * 2 + 3];
+                }
+            }
         }
-
-        src_y = LibScaler::min(src_y + v_ratio, (m_nSrcTop + m_nSrcHeight) << 16);
-    }
+    });
 
     return true;
 }
@@ -65,23 +205,54 @@ bool CScalerSW_NV12::Scale() {
         return false;
     }
 
+    if (m_nFilter == SW_FILTER_AREA) {
+        std::vector<Span> rows, cols;
+
+        // Luminance
+        BuildSpans(rows, m_nSrcTop, m_nSrcHeight, m_nDstHeight);
+        BuildSpans(cols, m_nSrcLeft, m_nSrcWidth, m_nDstWidth);
+
+        const Channel luma[] = {
+            {cols.data(), m_nDstWidth, 0, 1, m_nDstLeft, 1},
+        };
+
+        ScaleArea(m_pSrc[0], m_nSrcStride, m_pDst[0] + m_nDstTop * m_nDstStride, m_nDstStride,
+                  rows, luma, ARRSIZE(luma), m_nSrcLeft, m_nSrcWidth);
+
+        // Chrominance
+        BuildSpans(rows, m_nSrcTop / 2, m_nSrcHeight / 2, m_nDstHeight / 2);
+        BuildSpans(cols, m_nSrcLeft / 2, m_nSrcWidth / 2, m_nDstWidth / 2);
+
+        const Channel chroma[] = {
+            {cols.data(), m_nDstWidth / 2, 0, 2, m_nDstLeft, 2},
+            {cols.data(), m_nDstWidth / 2, 1, 2, m_nDstLeft + 1, 2},
+        };
+
+        ScaleArea(m_pSrc[1], m_nSrcStride, m_pDst[1] + (m_nDstTop / 2) * m_nDstStride, m_nDstStride,
+                  rows, chroma, ARRSIZE(chroma), m_nSrcLeft, m_nSrcWidth);
+
+        return true;
+    }
+
     unsigned int h_ratio = (m_nSrcWidth << 16) / m_nDstWidth;
     unsigned int v_ratio = (m_nSrcHeight << 16) / m_nDstHeight;
 
-    unsigned int src_x;
-    unsigned int src_y = m_nSrcTop << 16;
+    std::vector<unsigned int> rows, cols;
 
     // Luminance
-    for (unsigned int y = m_nDstTop; y < (m_nDstTop + m_nDstHeight); y++) {
-        src_x = m_nSrcLeft << 16;
-        for (unsigned int x = m_nDstLeft; x < (m_nDstLeft + m_nDstWidth); x++) {
-            m_pDst[0][y * m_nDstStride + x] = m_pSrc[0][(src_y >> 16) * m_nSrcStride + (src_x >> 16)];
+    BuildNearest(rows, m_nSrcTop, v_ratio, m_nSrcTop + m_nSrcHeight, m_nDstHeight);
+    BuildNearest(cols, m_nSrcLeft, h_ratio, m_nSrcLeft + m_nSrcWidth, m_nDstWidth);
 
-            src_x = LibScaler::min(src_x + h_ratio, (m_nSrcLeft + m_nSrcWidth) << 16);
-        }
+    RunBands(m_nDstHeight, static_cast<unsigned long>(m_nDstWidth) * m_nDstHeight * 2,
+             [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            const char *src = m_pSrc[0] + rows[i] * m_nSrcStride;
+            char *dst = m_pDst[0] + (m_nDstTop + i) * m_nDstStride + m_nDstLeft;
 
-        src_y = LibScaler::min(src_y + v_ratio, (m_nSrcTop + m_nSrcHeight) << 16);
-    }
+            for (unsigned int j = 0; j < m_nDstWidth; j++)
+                dst[j] = src[cols[j]];
+        }
+    });
 
     // Chrominance
 
@@ -89,18 +260,225 @@ bool CScalerSW_NV12::Scale() {
     unsigned short *src = reinterpret_cast<unsigned short *>(m_pSrc[1]);
     unsigned short *dst = reinterpret_cast<unsigned short *>(m_pDst[1]);
 
-    src_y = (m_nSrcTop / 2) << 16;
-    for (unsigned int y = m_nDstTop / 2; y < ((m_nDstTop + m_nDstHeight) / 2); y++) {
-        // Move 2 pixels at once (CbCr)
-        src_x = (m_nSrcLeft / 2) << 16;
-        for (unsigned int x = m_nDstLeft / 2; x < ((m_nDstLeft + m_nDstWidth) / 2); x++) {
-            dst[y * (m_nDstStride / 2) + x] = src[(src_y >> 16) * (m_nSrcStride / 2) + (src_x >> 16)];
+    BuildNearest(rows, m_nSrcTop / 2, v_ratio, (m_nSrcTop + m_nSrcHeight) / 2, m_nDstHeight / 2);
+    BuildNearest(cols, m_nSrcLeft / 2, h_ratio, (m_nSrcLeft + m_nSrcWidth) / 2, m_nDstWidth / 2);
+
+    // Move 2 pixels at once (CbCr)
+    RunBands(m_nDstHeight / 2, static_cast<unsigned long>(m_nDstWidth) * m_nDstHeight,
+             [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            const unsigned short *srow = src + rows[i] * (m_nSrcStride / 2);
+            unsigned short *drow = dst + (m_nDstTop / 2 + i) * (m_nDstStride / 2) + m_nDstLeft / 2;
+
+            for (unsigned int j = 0; j < m_nDstWidth / 2; j++)
+                drow[j] = srow[cols[j]];
+        }
+    });
+
+    return true;
+}
+
+namespace {
+enum { CSC_YUV420, CSC_YUV422, CSC_RGB };
+
+struct CSCLayout {
+    unsigned int format;
+    unsigned int type;
+    // byte offsets of Cb and Cr in a chroma pair (YUV420) or a pixel pair (YUV422)
+    // and of R and B in a pixel (RGB)
+    unsigned int off0;
+    unsigned int off1;
+};
+
+const CSCLayout csc_layouts[] = {
+    {V4L2_PIX_FMT_NV12,   CSC_YUV420, 0, 1},
+    {V4L2_PIX_FMT_NV12M,  CSC_YUV420, 0, 1},
+    {V4L2_PIX_FMT_NV21,   CSC_YUV420, 1, 0},
+    {V4L2_PIX_FMT_NV21M,  CSC_YUV420, 1, 0},
+    {V4L2_PIX_FMT_YUYV,   CSC_YUV422, 1, 3},
+    {V4L2_PIX_FMT_YVYU,   CSC_YUV422, 3, 1},
+    {V4L2_PIX_FMT_RGB32,  CSC_RGB,    0, 2},
+    {V4L2_PIX_FMT_BGR32,  CSC_RGB,    2, 0},
+};
+
+const CSCLayout *FindLayout(unsigned int format) {
+    for (auto &layout: csc_layouts)
+        if (layout.format == format)
+            return &layout;
+    return NULL;
+}
+
+// coefficients in 1/256 of the conversion from YCbCr to RGB
+struct CSCCoef {
+    unsigned char y_offset;
+    short y, rv, gu, gv, bu;
+};
+
+// [BT.709][wide]
+const CSCCoef csc_coefs[2][2] = {
+    { {16, 298, 409, 100, 208, 516}, {0, 256, 359, 88, 183, 454} },
+    { {16, 298, 459,  55, 136, 541}, {0, 256, 403, 48, 120, 475} },
+};
+
+inline unsigned char Clamp8(int val) {
+    return static_cast<unsigned char>((val < 0) ? 0 : ((val > 255) ? 255 : val));
+}
+
+void ConvertRowToRGB(unsigned char *dst, const CSCLayout &layout, const CSCCoef &coef,
+                     const unsigned char *y, const unsigned char *u, const unsigned char *v, unsigned int len) {
+    unsigned int i = 0;
+#ifdef __ARM_NEON
+    for (; (i + 8) <= len; i += 8) {
+        int16x8_t yy = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(y + i), vdup_n_u8(coef.y_offset)));
+        int16x8_t uu = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(u + i), vdup_n_u8(128)));
+        int16x8_t vv = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(v + i), vdup_n_u8(128)));
+
+        int32x4_t ylo = vmull_n_s16(vget_low_s16(yy), coef.y);
+        int32x4_t yhi = vmull_n_s16(vget_high_s16(yy), coef.y);
+
+        int32x4_t rlo = vmlal_n_s16(ylo, vget_low_s16(vv), coef.rv);
+        int32x4_t rhi = vmlal_n_s16(yhi, vget_high_s16(vv), coef.rv);
+        int32x4_t glo = vmlsl_n_s16(vmlsl_n_s16(ylo, vget_low_s16(uu), coef.gu), vget_low_s16(vv), coef.gv);
+        int32x4_t ghi = vmlsl_n_s16(vmlsl_n_s16(yhi, vget_high_s16(uu), coef.gu), vget_high_s16(vv), coef.gv);
+        int32x4_t blo = vmlal_n_s16(ylo, vget_low_s16(uu), coef.bu);
+        int32x4_t bhi = vmlal_n_s16(yhi, vget_high_s16(uu), coef.bu);
 
-            src_x = LibScaler::min(src_x + h_ratio, ((m_nSrcLeft + m_nSrcWidth) / 2) << 16);
+        uint8x8_t r = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(rlo, 8), vqrshrun_n_s32(rhi, 8)));
+        uint8x8_t g = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(glo, 8), vqrshrun_n_s32(ghi, 8)));
+        uint8x8_t b = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(blo, 8), vqrshrun_n_s32(bhi, 8)));
+
+        uint8x8x4_t pix;
+        pix.val[layout.off0] = r;
+        pix.val[1] = g;
+        pix.val[layout.off1] = b;
+        pix.val[3] = vdup_n_u8(255);
+        vst4_u8(dst + i * 4, pix);
+    }
+#endif
+    for (; i < len; i++) {
+        int ys = (y[i] - coef.y_offset) * coef.y;
+        int cb = u[i] - 128;
+        int cr = v[i] - 128;
+
+        dst[i * 4 + layout.off0] = Clamp8((ys + coef.rv * cr + 128) >> 8);
+        dst[i * 4 + 1] = Clamp8((ys - coef.gu * cb - coef.gv * cr + 128) >> 8);
+        dst[i * 4 + layout.off1] = Clamp8((ys + coef.bu * cb + 128) >> 8);
+        dst[i * 4 + 3] = 255;
+    }
+}
+} // namespace
+
+bool CScalerSW_CSC::IsSupported(unsigned int srcfmt, unsigned int dstfmt) {
+    const CSCLayout *src = FindLayout(srcfmt);
+
+    return src && (src->type != CSC_RGB) && FindLayout(dstfmt);
+}
+
+void CScalerSW_CSC::FetchRow(unsigned int sy, const std::vector<unsigned int> &cols,
+                             unsigned char *y, unsigned char *u, unsigned char *v) {
+    const CSCLayout &layout = *FindLayout(m_nSrcFormat);
+
+    if (layout.type == CSC_YUV420) {
+        const unsigned char *yrow = reinterpret_cast<unsigned char *>(m_pSrc[0] + sy * m_nSrcStride);
+        const unsigned char *crow = reinterpret_cast<unsigned char *>(m_pSrc[1] + (sy / 2) * m_nSrcStride);
+
+        for (unsigned int i = 0; i < m_nDstWidth; i++) {
+            unsigned int cx = cols[i] & ~1;
+
+            y[i] = yrow[cols[i]];
+            u[i] = crow[cx + layout.off0];
+            v[i] = crow[cx + layout.off1];
         }
+    } else {
+        const unsigned char *row = reinterpret_cast<unsigned char *>(m_pSrc[0] + sy * m_nSrcStride * 2);
 
-        src_y = LibScaler::min(src_y + v_ratio, ((m_nSrcTop + m_nSrcHeight) / 2) << 16);
+        for (unsigned int i = 0; i < m_nDstWidth; i++) {
+            unsigned int cx = (cols[i] & ~1) * 2;
+
+            y[i] = row[cols[i] * 2];
+            u[i] = row[cx + layout.off0];
+            v[i] = row[cx + layout.off1];
+        }
     }
+}
+
+void CScalerSW_CSC::StoreRow(unsigned int dy, const unsigned char *y, const unsigned char *u, const unsigned char *v) {
+    const CSCLayout &layout = *FindLayout(m_nDstFormat);
+
+    if (layout.type == CSC_RGB) {
+        unsigned char *row = reinterpret_cast<unsigned char *>(
+                m_pDst[0] + (dy * m_nDstStride + m_nDstLeft) * 4);
+
+        ConvertRowToRGB(row, layout, csc_coefs[m_bBT709][m_bWide], y, u, v, m_nDstWidth);
+    } else if (layout.type == CSC_YUV420) {
+        unsigned char *yrow = reinterpret_cast<unsigned char *>(m_pDst[0] + dy * m_nDstStride + m_nDstLeft);
+
+        memcpy(yrow, y, m_nDstWidth);
+
+        if (dy & 1)
+            return;
+
+        unsigned char *crow = reinterpret_cast<unsigned char *>(
+                m_pDst[1] + (dy / 2) * m_nDstStride + m_nDstLeft);
+
+        for (unsigned int i = 0; i < m_nDstWidth; i += 2) {
+            crow[i + layout.off0] = u[i];
+            crow[i + layout.off1] = v[i];
+        }
+    } else {
+        unsigned char *row = reinterpret_cast<unsigned char *>(m_pDst[0] + (dy * m_nDstStride + m_nDstLeft) * 2);
+
+        for (unsigned int i = 0; i < m_nDstWidth; i += 2) {
+            row[i * 2] = y[i];
+            row[i * 2 + 2] = y[i + 1];
+            row[i * 2 + layout.off0] = u[i];
+            row[i * 2 + layout.off1] = v[i];
+        }
+    }
+}
+
+bool CScalerSW_CSC::Scale() {
+    const CSCLayout *src = FindLayout(m_nSrcFormat);
+    const CSCLayout *dst = FindLayout(m_nDstFormat);
+
+    if (!IsSupported(m_nSrcFormat, m_nDstFormat)) {
+        SC_LOGE("Conversion from %#x to %#x is not supported", m_nSrcFormat, m_nDstFormat);
+        return false;
+    }
+
+    if (((m_nSrcLeft | m_nSrcWidth | m_nSrcStride) % 2) != 0 ||
+            ((src->type == CSC_YUV420) && (((m_nSrcTop | m_nSrcHeight) % 2) != 0))) {
+        SC_LOGE("Invalid source area for YUV %u,%u,%ux%u", m_nSrcLeft, m_nSrcTop, m_nSrcWidth, m_nSrcHeight);
+        return false;
+    }
+
+    if ((dst->type != CSC_RGB) && ((((m_nDstLeft | m_nDstWidth | m_nDstStride) % 2) != 0) ||
+            ((dst->type == CSC_YUV420) && (((m_nDstTop | m_nDstHeight) % 2) != 0)))) {
+        SC_LOGE("Invalid target area for YUV %u,%u,%ux%u", m_nDstLeft, m_nDstTop, m_nDstWidth, m_nDstHeight);
+        return false;
+    }
+
+    unsigned int h_ratio = (m_nSrcWidth << 16) / m_nDstWidth;
+    unsigned int v_ratio = (m_nSrcHeight << 16) / m_nDstHeight;
+
+    std::vector<unsigned int> rows, cols;
+
+    BuildNearest(rows, m_nSrcTop, v_ratio, m_nSrcTop + m_nSrcHeight, m_nDstHeight);
+    BuildNearest(cols, m_nSrcLeft, h_ratio, m_nSrcLeft + m_nSrcWidth, m_nDstWidth);
+
+    RunBands(m_nDstHeight, static_cast<unsigned long>(m_nDstWidth) * m_nDstHeight * 8,
+             [&] (unsigned int begin, unsigned int end) {
+        // a target row in YUV444
+        std::vector<unsigned char> row(m_nDstWidth * 3);
+        unsigned char *y = row.data();
+        unsigned char *u = y + m_nDstWidth;
+        unsigned char *v = u + m_nDstWidth;
+
+        for (unsigned int i = begin; i < end; i++) {
+            FetchRow(rows[i], cols, y, u, v);
+            StoreRow(m_nDstTop + i, y, u, v);
+        }
+    });
 
     return true;
 }
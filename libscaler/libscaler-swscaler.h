@@ -1,9 +1,22 @@
 #ifndef __LIBSCALER_SWSCALER_H__
 #define __LIBSCALER_SWSCALER_H__
 
+#include <functional>
+#include <vector>
+
 #include "libscaler-common.h"
 
+// the most threads that scale the bands of the target rows at the same time
+#define SW_SCALER_MAX_THREADS   4U
+// the number of the bytes accessed by a band not to waste a thread
+#define SW_SCALER_BAND_WORK     (256 * 1024)
+
 class CScalerSW {
+    public:
+        enum {
+            SW_FILTER_NEAREST = 0,
+            SW_FILTER_AREA, // average of the source pixels covered by a target pixel
+        };
     protected:
         char *m_pSrc[3];
         char *m_pDst[3];
@@ -13,6 +26,33 @@ class CScalerSW {
         unsigned int m_nDstLeft, m_nDstTop;
         unsigned int m_nDstWidth, m_nDstHeight;
         unsigned int m_nDstStride;
+        unsigned int m_nFilter;
+        unsigned int m_nMaxThreads;
+
+        // [begin, end) of the source samples averaged for a target sample
+        struct Span {
+            unsigned int begin;
+            unsigned int end;
+        };
+
+        // a component of the pixels in a row. offsets and steps are in bytes.
+        struct Channel {
+            const Span *cols;
+            unsigned int count;
+            unsigned int srcOffset, srcStep;
+            unsigned int dstOffset, dstStep;
+        };
+
+        static void BuildNearest(std::vector<unsigned int> &table, unsigned int start,
+                                 unsigned int ratio, unsigned int limit, unsigned int count);
+        static void BuildSpans(std::vector<Span> &spans, unsigned int start,
+                               unsigned int srcCount, unsigned int dstCount);
+        // @src and @dst are the first row of the planes and the first target row
+        void ScaleArea(const char *src, unsigned int srcStride, char *dst, unsigned int dstStride,
+                       const std::vector<Span> &rows, const Channel channels[], unsigned int numChannels,
+                       unsigned int accFirst, unsigned int accLen);
+        void RunBands(unsigned int rows, unsigned long work,
+                      const std::function<void(unsigned int, unsigned int)> &kernel);
     public:
         CScalerSW() { Clear(); }
         virtual ~CScalerSW() { };
@@ -34,6 +74,9 @@ class CScalerSW {
             m_nDstHeight = height;
             m_nDstStride = stride;
         }
+
+        void SetFilter(unsigned int filter) { m_nFilter = filter; }
+        void SetMaxThreads(unsigned int threads) { m_nMaxThreads = threads ? threads : 1; }
 };
 
 class CScalerSW_YUYV: public CScalerSW {
@@ -58,4 +101,41 @@ class CScalerSW_NV12: public CScalerSW {
         virtual bool Scale();
 };
 
+/*
+ * S/W scaling with the conversion between the formats. The pixels are sampled
+ * at the nearest. YUV is converted to RGB32 and BGR32 by BT.601 or BT.709 in
+ * the narrow or the wide range. The conversions between YUV formats only
+ * relocate the samples.
+ * Source: NV12(M), NV21(M), YUYV and YVYU
+ * Target: NV12(M), NV21(M), YUYV, YVYU, RGB32 and BGR32
+ */
+class CScalerSW_CSC: public CScalerSW {
+        unsigned int m_nSrcFormat;
+        unsigned int m_nDstFormat;
+        bool m_bWide;
+        bool m_bBT709;
+
+        void FetchRow(unsigned int sy, const std::vector<unsigned int> &cols,
+                      unsigned char *y, unsigned char *u, unsigned char *v);
+        void StoreRow(unsigned int dy, const unsigned char *y, const unsigned char *u, const unsigned char *v);
+    public:
+        // the second planes of the single plane formats of YUV420 are given in @src[1] and @dst[1]
+        CScalerSW_CSC(unsigned int srcfmt, char *src[2], unsigned int dstfmt, char *dst[2])
+            : m_nSrcFormat(srcfmt), m_nDstFormat(dstfmt), m_bWide(false), m_bBT709(false) {
+            m_pSrc[0] = src[0];
+            m_pSrc[1] = src[1];
+            m_pDst[0] = dst[0];
+            m_pDst[1] = dst[1];
+        }
+
+        void SetCSC(bool wide, bool bt709) {
+            m_bWide = wide;
+            m_bBT709 = bt709;
+        }
+
+        virtual bool Scale();
+
+        static bool IsSupported(unsigned int srcfmt, unsigned int dstfmt);
+};
+
 #endif //__LIBSCALER_SWSCALER_H__
@@ -33,6 +33,9 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
+#include <functional>
+#include <vector>
+
 #include "libscaler-v4l2.h"
 #include "libscaler-swscaler.h"
 
@@ -61,8 +64,12 @@ CScalerV4L2::CScalerV4L2(int instance, int allow_drm)
     m_fdScaler = -1;
     m_iInstance = instance;
     m_nRotDegree = 0;
+    m_nBufferCount = 1;
     m_fStatus = 0;
+    m_fCtrlApplied = 0;
+    m_nIoctls = 0;
     m_filter = 0;
+    m_nSWFilter = EXYNOS_SC_SW_FILTER_NEAREST;
 
     memset(&m_frmSrc, 0, sizeof(m_frmSrc));
     memset(&m_frmDst, 0, sizeof(m_frmDst));
@@ -139,102 +146,137 @@ bool CScalerV4L2::Run()
     return DQBuf();
 }
 
-bool CScalerV4L2::SetCtrl()
+int CScalerV4L2::DevIoctl(unsigned long request, void *arg)
 {
-    struct v4l2_control ctrl;
+    m_nIoctls++;
 
-    if (TestFlag(m_fStatus, SCF_DRM_FRESH)) {
-        if (!Stop())
-            return false;
+    return ioctl(m_fdScaler, request, arg);
+}
 
-        ctrl.id = V4L2_CID_CONTENT_PROTECTION;
-        ctrl.value = TestFlag(m_fStatus, SCF_DRM);
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed configure V4L2_CID_CONTENT_PROTECTION to %d", TestFlag(m_fStatus, SCF_DRM));
-            return false;
-        }
+bool CScalerV4L2::DevSetExtCtrls(v4l2_ext_control ctrls[], unsigned int count)
+{
+    if (count == 0)
+        return true;
 
-        ClearFlag(m_fStatus, SCF_DRM_FRESH);
-    } else {
-        SC_LOGD("Skipping DRM configuration");
-    }
+    if (TestFlag(m_fStatus, SCF_NO_EXT_CTRLS))
+        return false;
 
-    if (TestFlag(m_fStatus, SCF_ROTATION_FRESH)) {
-        if (!Stop())
-            return false;
+    v4l2_ext_controls ext_ctrls;
 
-        ctrl.id = V4L2_CID_ROTATE;
-        ctrl.value = m_nRotDegree;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed V4L2_CID_ROTATE with degree %d", m_nRotDegree);
-            return false;
-        }
+    memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+    ext_ctrls.count = count;
+    ext_ctrls.controls = ctrls;
 
-        ctrl.id = V4L2_CID_VFLIP;
-        ctrl.value = TestFlag(m_fStatus, SCF_HFLIP);
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed V4L2_CID_VFLIP - %d", TestFlag(m_fStatus, SCF_VFLIP));
-            return false;
-        }
+    if (DevIoctl(VIDIOC_S_EXT_CTRLS, &ext_ctrls) == 0)
+        return true;
 
-        ctrl.id = V4L2_CID_HFLIP;
-        ctrl.value = TestFlag(m_fStatus, SCF_VFLIP);
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed V4L2_CID_HFLIP - %d", TestFlag(m_fStatus, SCF_HFLIP));
-            return false;
-        }
+    // an optional control unknown to the device fails the whole batch
+    SC_LOGD("Scaler%d: setting the controls one by one (errno %d at %u of %u)",
+            m_iInstance, errno, ext_ctrls.error_idx, count);
+    SetFlag(m_fStatus, SCF_NO_EXT_CTRLS);
+
+    return false;
+}
 
-        SC_LOGD("Successfully set CID_ROTATE(%d), CID_VFLIP(%d) and CID_HFLIP(%d)",
-                m_nRotDegree, TestFlag(m_fStatus, SCF_VFLIP), TestFlag(m_fStatus, SCF_HFLIP));
-        ClearFlag(m_fStatus, SCF_ROTATION_FRESH);
-    } else {
-        SC_LOGD("Skipping rotation and flip setting due to no change");
+bool CScalerV4L2::SetCtrl()
+{
+    enum { CTRL_REQUIRED, CTRL_OPTIONAL, CTRL_QUIET }; // handling of failure
+
+    struct {
+        unsigned int index; // enum SC_CTRL
+        __u32 id;
+        __s32 value;
+        bool requested;
+        int failure;
+        const char *name;
+    } ctrls[] = {
+        {SC_CTRL_DRM, V4L2_CID_CONTENT_PROTECTION, TestFlag(m_fStatus, SCF_DRM),
+            TestFlag(m_fStatus, SCF_DRM_FRESH), CTRL_REQUIRED, "V4L2_CID_CONTENT_PROTECTION"},
+        {SC_CTRL_ROTATE, V4L2_CID_ROTATE, static_cast<__s32>(m_nRotDegree),
+            TestFlag(m_fStatus, SCF_ROTATION_FRESH), CTRL_REQUIRED, "V4L2_CID_ROTATE"},
+        {SC_CTRL_VFLIP, V4L2_CID_VFLIP, TestFlag(m_fStatus, SCF_HFLIP),
+            TestFlag(m_fStatus, SCF_ROTATION_FRESH), CTRL_REQUIRED, "V4L2_CID_VFLIP"},
+        {SC_CTRL_HFLIP, V4L2_CID_HFLIP, TestFlag(m_fStatus, SCF_VFLIP),
+            TestFlag(m_fStatus, SCF_ROTATION_FRESH), CTRL_REQUIRED, "V4L2_CID_HFLIP"},
+        {SC_CTRL_DNOISE, LIBSC_V4L2_CID_DNOISE_FT, static_cast<__s32>(m_filter),
+            m_filter > 0, CTRL_REQUIRED, "LIBSC_V4L2_CID_DNOISE_FT"},
+        {SC_CTRL_CSC_RANGE, V4L2_CID_CSC_RANGE, TestFlag(m_fStatus, SCF_CSC_WIDE) ? 1 : 0,
+            TestFlag(m_fStatus, SCF_CSC_FRESH), CTRL_REQUIRED, "V4L2_CID_CSC_RANGE"},
+        {SC_CTRL_CSC_EQ, V4L2_CID_CSC_EQ, static_cast<__s32>(m_colorspace),
+            TestFlag(m_fStatus, SCF_CSC_FRESH), CTRL_OPTIONAL, "V4L2_CID_CSC_EQ"},
+        /* This is optional, so we don't return failure. */
+        {SC_CTRL_FRAMERATE, SC_CID_FRAMERATE, static_cast<__s32>(m_frameRate),
+            TestFlag(m_fStatus, SCF_FRAMERATE), CTRL_QUIET, "SC_CID_FRAMERATE"},
+    };
+
+    bool changed = false;
+
+    // Only the values different from the ones applied to the device are set
+    for (auto &ctrl : ctrls) {
+        if (ctrl.requested && TestFlag(m_fCtrlApplied, ctrl.index) &&
+                (m_ctrlValue[ctrl.index] == ctrl.value))
+            ctrl.requested = false;
+
+        changed = changed || ctrl.requested;
+    }
+
+    if (!changed) {
+        SC_LOGD("Skipping S_CTRL due to no change");
+    } else if (!Stop()) {
+        // the controls are not allowed to change while streaming
+        return false;
     }
 
-    if (m_filter > 0) {
-        if (!Stop())
-            return false;
+    v4l2_ext_control ext_ctrls[SC_CTRL_NUM];
+    unsigned int count = 0;
 
-        ctrl.id = LIBSC_V4L2_CID_DNOISE_FT;
-        ctrl.value = m_filter;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed LIBSC_V4L2_CID_DNOISE_FT to %d", m_filter);
-            return false;
+    memset(ext_ctrls, 0, sizeof(ext_ctrls));
+    for (auto &ctrl : ctrls) {
+        if (ctrl.requested) {
+            ext_ctrls[count].id = ctrl.id;
+            ext_ctrls[count].value = ctrl.value;
+            count++;
         }
     }
 
-    if (TestFlag(m_fStatus, SCF_CSC_FRESH)) {
-        if (!Stop())
-            return false;
+    bool batched = DevSetExtCtrls(ext_ctrls, count);
 
-        ctrl.id = V4L2_CID_CSC_RANGE;
-        ctrl.value = TestFlag(m_fStatus, SCF_CSC_WIDE) ? 1 : 0;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed V4L2_CID_CSC_RANGE to %d", TestFlag(m_fStatus, SCF_CSC_WIDE));
-            return false;
-        }
+    for (auto &ctrl : ctrls) {
+        if (!ctrl.requested)
+            continue;
 
-        ctrl.id = V4L2_CID_CSC_EQ;
-        ctrl.value = m_colorspace;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed V4L2_CID_CSC_EQ to %d", m_colorspace);
-        }
-        ClearFlag(m_fStatus, SCF_CSC_FRESH);
-    }
+        v4l2_control v4l2ctrl;
 
-    /* This is optional, so we don't return failure. */
-    if (TestFlag(m_fStatus, SCF_FRAMERATE)) {
-        if (!Stop())
-            return false;
+        v4l2ctrl.id = ctrl.id;
+        v4l2ctrl.value = ctrl.value;
+
+        if (!batched && (DevIoctl(VIDIOC_S_CTRL, &v4l2ctrl) < 0)) {
+            ClearFlag(m_fCtrlApplied, ctrl.index);
 
-        ctrl.id = SC_CID_FRAMERATE;
-        ctrl.value = m_frameRate;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGD("Failed SC_CID_FRAMERATE to %d", m_frameRate);
+            if (ctrl.failure == CTRL_QUIET) {
+                SC_LOGD("Failed %s to %d", ctrl.name, ctrl.value);
+                continue;
+            }
+
+            SC_LOGERR("Failed %s to %d", ctrl.name, ctrl.value);
+
+            if (ctrl.failure == CTRL_REQUIRED)
+                return false;
+
+            continue;
         }
-        ClearFlag(m_fStatus, SCF_FRAMERATE);
+
+        m_ctrlValue[ctrl.index] = ctrl.value;
+        SetFlag(m_fCtrlApplied, ctrl.index);
+
+        SC_LOGD("Successfully set %s to %d", ctrl.name, ctrl.value);
     }
 
+    ClearFlag(m_fStatus, SCF_DRM_FRESH);
+    ClearFlag(m_fStatus, SCF_ROTATION_FRESH);
+    ClearFlag(m_fStatus, SCF_CSC_FRESH);
+    ClearFlag(m_fStatus, SCF_FRAMERATE);
+
     return true;
 }
 
@@ -245,10 +287,13 @@ bool CScalerV4L2::DevSetCtrl()
 
 bool CScalerV4L2::ResetDevice(FrameInfo &frm)
 {
-    DQBuf(frm);
+    while (frm.queued > 0)
+        DQBuf(frm);
+
+    frm.next_index = 0;
 
     if (TestFlag(frm.flags, SCFF_STREAMING)) {
-        if (ioctl(m_fdScaler, VIDIOC_STREAMOFF, &frm.type) < 0) {
+        if (DevIoctl(VIDIOC_STREAMOFF, &frm.type) < 0) {
             SC_LOGERR("Failed STREAMOFF for the %s", frm.name);
         }
         ClearFlag(frm.flags, SCFF_STREAMING);
@@ -261,7 +306,7 @@ bool CScalerV4L2::ResetDevice(FrameInfo &frm)
         memset(&reqbufs, 0, sizeof(reqbufs));
         reqbufs.type = frm.type;
         reqbufs.memory = frm.memory;
-        if (ioctl(m_fdScaler, VIDIOC_REQBUFS, &reqbufs) < 0 ) {
+        if (DevIoctl(VIDIOC_REQBUFS, &reqbufs) < 0 ) {
             SC_LOGERR("Failed to REQBUFS(0) for the %s", frm.name);
         }
 
@@ -301,7 +346,7 @@ bool CScalerV4L2::DevSetFormat(FrameInfo &frm)
 #endif
     }
 
-    if (ioctl(m_fdScaler, VIDIOC_S_FMT, &fmt) < 0) {
+    if (DevIoctl(VIDIOC_S_FMT, &fmt) < 0) {
         SC_LOGERR("Failed S_FMT(fmt: %d, w:%d, h:%d) for the %s",
                 fmt.fmt.pix_mp.pixelformat, fmt.fmt.pix_mp.width, fmt.fmt.pix_mp.height,
                 frm.name);
@@ -318,7 +363,7 @@ bool CScalerV4L2::DevSetFormat(FrameInfo &frm)
     crop.type = frm.type;
     crop.c = frm.crop;
 
-    if (ioctl(m_fdScaler, VIDIOC_S_CROP, &crop) < 0) {
+    if (DevIoctl(VIDIOC_S_CROP, &crop) < 0) {
         SC_LOGERR("Failed S_CROP(fmt: %d, l:%d, t:%d, w:%d, h:%d) for the %s",
                 crop.type, crop.c.left, crop.c.top, crop.c.width, crop.c.height,
                 frm.name);
@@ -356,7 +401,8 @@ bool CScalerV4L2::QBuf(FrameInfo &frm, int *pfdReleaseFence)
         return false;
     }
 
-    if (!DQBuf(frm))
+    // wait for the oldest frame if all buffers are in flight
+    if ((frm.queued >= m_nBufferCount) && !DQBuf(frm))
         return false;
 
     memset(&buffer, 0, sizeof(buffer));
@@ -364,7 +410,7 @@ bool CScalerV4L2::QBuf(FrameInfo &frm, int *pfdReleaseFence)
 
     buffer.type   = frm.type;
     buffer.memory = frm.memory;
-    buffer.index  = 0;
+    buffer.index  = frm.next_index;
     buffer.length = frm.out_num_planes;
 
     if (pfdReleaseFence) {
@@ -384,12 +430,14 @@ bool CScalerV4L2::QBuf(FrameInfo &frm, int *pfdReleaseFence)
     }
 
 
-    if (ioctl(m_fdScaler, VIDIOC_QBUF, &buffer) < 0) {
+    if (DevIoctl(VIDIOC_QBUF, &buffer) < 0) {
         SC_LOGERR("Failed to QBUF for the %s", frm.name);
         return false;
     }
 
     SetFlag(frm.flags, SCFF_QBUF);
+    frm.queued++;
+    frm.next_index = (frm.next_index + 1) % m_nBufferCount;
 
     if (pfdReleaseFence) {
         if (frm.fdAcquireFence >= 0)
@@ -417,13 +465,20 @@ bool CScalerV4L2::ReqBufs(FrameInfo &frm)
 
     reqbufs.type    = frm.type;
     reqbufs.memory  = frm.memory;
-    reqbufs.count   = 1;
+    reqbufs.count   = m_nBufferCount;
 
-    if (ioctl(m_fdScaler, VIDIOC_REQBUFS, &reqbufs) < 0) {
+    if (DevIoctl(VIDIOC_REQBUFS, &reqbufs) < 0) {
         SC_LOGERR("Failed to REQBUFS for the %s", frm.name);
         return false;
     }
 
+    if (reqbufs.count < m_nBufferCount) {
+        SC_LOGE("Only %u buffers are allowed to the %s", reqbufs.count, frm.name);
+        reqbufs.count = 0;
+        DevIoctl(VIDIOC_REQBUFS, &reqbufs);
+        return false;
+    }
+
     SetFlag(frm.flags, SCFF_REQBUFS);
 
     SC_LOGD("Successfully REQBUFS for the %s", frm.name);
@@ -431,6 +486,25 @@ bool CScalerV4L2::ReqBufs(FrameInfo &frm)
     return true;
 }
 
+bool CScalerV4L2::SetBufferCount(unsigned int count)
+{
+    if ((count == 0) || (count > SC_MAX_BUFFERS)) {
+        SC_LOGE("Invalid buffer count %u (max %u)", count, SC_MAX_BUFFERS);
+        return false;
+    }
+
+    if (count == m_nBufferCount)
+        return true;
+
+    // REQBUFS with the new count is issued by the next frame
+    if (!Stop())
+        return false;
+
+    m_nBufferCount = count;
+
+    return true;
+}
+
 bool CScalerV4L2::SetRotate(int rot, int flip_h, int flip_v)
 {
     if ((rot % 90) != 0) {
@@ -464,7 +538,7 @@ bool CScalerV4L2::StreamOn(FrameInfo &frm)
     }
 
     if (!TestFlag(frm.flags, SCFF_STREAMING)) {
-        if (ioctl(m_fdScaler, VIDIOC_STREAMON, &frm.type) < 0 ) {
+        if (DevIoctl(VIDIOC_STREAMON, &frm.type) < 0 ) {
             SC_LOGERR("Failed StreamOn for the %s", frm.name);
             return false;
         }
@@ -479,7 +553,7 @@ bool CScalerV4L2::StreamOn(FrameInfo &frm)
 
 bool CScalerV4L2::DQBuf(FrameInfo &frm)
 {
-    if (!TestFlag(frm.flags, SCFF_QBUF))
+    if (frm.queued == 0)
         return true;
 
     v4l2_buffer buffer;
@@ -497,9 +571,10 @@ bool CScalerV4L2::DQBuf(FrameInfo &frm)
         buffer.m.planes = plane;
     }
 
-    ClearFlag(frm.flags, SCFF_QBUF);
+    if (--frm.queued == 0)
+        ClearFlag(frm.flags, SCFF_QBUF);
 
-    if (ioctl(m_fdScaler, VIDIOC_DQBUF, &buffer) < 0 ) {
+    if (DevIoctl(VIDIOC_DQBUF, &buffer) < 0 ) {
         SC_LOGERR("Failed to DQBuf the %s", frm.name);
         return false;
     }
@@ -544,18 +619,95 @@ static void PutBuffer(CScalerV4L2::FrameInfo &frm, char *addr[])
     }
 }
 
-bool CScalerV4L2::RunSWScaling()
+static bool SetSWPlanes(CScalerV4L2::FrameInfo &frm)
+{
+    switch (frm.color_format) {
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_YVYU:
+            frm.out_num_planes = 1;
+            frm.out_plane_size[0] = frm.width * frm.height * 2;
+            break;
+        case V4L2_PIX_FMT_RGB32:
+        case V4L2_PIX_FMT_BGR32:
+            frm.out_num_planes = 1;
+            frm.out_plane_size[0] = frm.width * frm.height * 4;
+            break;
+        case V4L2_PIX_FMT_NV12M:
+        case V4L2_PIX_FMT_NV21M:
+            frm.out_num_planes = 2;
+            frm.out_plane_size[0] = frm.width * frm.height;
+            frm.out_plane_size[1] = frm.out_plane_size[0] / 2;
+            break;
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+            frm.out_num_planes = 1;
+            frm.out_plane_size[0] = frm.width * frm.height;
+            frm.out_plane_size[0] += frm.out_plane_size[0] / 2;
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+bool CScalerV4L2::RunSWConversion()
 {
-    if (m_frmSrc.color_format != m_frmDst.color_format) {
-        SC_LOGE("Source and target image format must be the same");
+    if (!CScalerSW_CSC::IsSupported(m_frmSrc.color_format, m_frmDst.color_format) ||
+            !SetSWPlanes(m_frmSrc) || !SetSWPlanes(m_frmDst)) {
+        SC_LOGE("S/W Scaler does not convert format %x to %x",
+                m_frmSrc.color_format, m_frmDst.color_format);
         return false;
     }
 
+    SC_LOGI("Running S/W Scaler: %dx%d(%x) -> %dx%d(%x)",
+            m_frmSrc.crop.width, m_frmSrc.crop.height, m_frmSrc.color_format,
+            m_frmDst.crop.width, m_frmDst.crop.height, m_frmDst.color_format);
+
+    char *src[3], *dst[3];
+
+    if (!GetBuffer(m_frmSrc, src))
+        return false;
+
+    if (!GetBuffer(m_frmDst, dst)) {
+        PutBuffer(m_frmSrc, src);
+        return false;
+    }
+
+    // the chroma of the single plane formats of YUV420
+    if (m_frmSrc.out_num_planes == 1)
+        src[1] = src[0] + m_frmSrc.width * m_frmSrc.height;
+    if (m_frmDst.out_num_planes == 1)
+        dst[1] = dst[0] + m_frmDst.width * m_frmDst.height;
+
+    CScalerSW_CSC swsc(m_frmSrc.color_format, src, m_frmDst.color_format, dst);
+
+    swsc.SetCSC(TestFlag(m_fStatus, SCF_CSC_WIDE), m_colorspace == V4L2_COLORSPACE_REC709);
+
+    swsc.SetSrcRect(m_frmSrc.crop.left, m_frmSrc.crop.top,
+            m_frmSrc.crop.width, m_frmSrc.crop.height, m_frmSrc.width);
+
+    swsc.SetDstRect(m_frmDst.crop.left, m_frmDst.crop.top,
+            m_frmDst.crop.width, m_frmDst.crop.height, m_frmDst.width);
+
+    bool ret = swsc.Scale();
+
+    PutBuffer(m_frmSrc, src);
+    PutBuffer(m_frmDst, dst);
+
+    return ret;
+}
+
+bool CScalerV4L2::RunSWScaling()
+{
     if (m_nRotDegree != 0) {
         SC_LOGE("Rotation is not allowed for S/W Scaling");
         return false;
     }
 
+    if (m_frmSrc.color_format != m_frmDst.color_format)
+        return RunSWConversion();
+
     SC_LOGI("Running S/W Scaler: %dx%d -> %dx%d",
             m_frmSrc.crop.width, m_frmSrc.crop.height,
             m_frmDst.crop.width, m_frmDst.crop.height);
@@ -641,6 +793,8 @@ bool CScalerV4L2::RunSWScaling()
     swsc->SetDstRect(m_frmDst.crop.left, m_frmDst.crop.top,
             m_frmDst.crop.width, m_frmDst.crop.height, m_frmDst.width);
 
+    swsc->SetFilter(m_nSWFilter);
+
     bool ret = swsc->Scale();
 
     delete swsc;
@@ -29,6 +29,7 @@
 #define _LIBSCALER_V4L2_H_
 
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <exynos_scaler.h>
 
@@ -51,6 +52,7 @@ class CScalerV4L2 {
 public:
     enum { SC_MAX_PLANES = SC_NUM_OF_PLANES };
     enum { SC_MAX_NODENAME = 14 };
+    enum { SC_MAX_BUFFERS = 4 }; // frames in flight of a queue
     enum { SC_V4L2_FMT_PREMULTI_FLAG = 10 };
 
     enum SC_FRAME_FLAG {
@@ -79,6 +81,20 @@ public:
         SCF_CSC_WIDE,
 	SCF_SRC_BLEND,
 	SCF_FRAMERATE,
+        SCF_NO_EXT_CTRLS,
+    };
+
+    // the controls of which values applied to the device are kept
+    enum SC_CTRL {
+        SC_CTRL_DRM = 0,
+        SC_CTRL_ROTATE,
+        SC_CTRL_VFLIP,
+        SC_CTRL_HFLIP,
+        SC_CTRL_DNOISE,
+        SC_CTRL_CSC_RANGE,
+        SC_CTRL_CSC_EQ,
+        SC_CTRL_FRAMERATE,
+        SC_CTRL_NUM,
     };
 
     struct FrameInfo {
@@ -93,6 +109,8 @@ public:
         int out_num_planes;
         unsigned long out_plane_size[SC_MAX_PLANES];
         unsigned long flags; // enum SC_FRAME_FLAG
+        unsigned int queued; // buffers not yet dequeued
+        unsigned int next_index; // buffer index of the next QBUF
     };
 
 private:
@@ -101,6 +119,7 @@ private:
 
     unsigned int m_nRotDegree;
     unsigned int m_frameRate;
+    unsigned int m_nBufferCount; // buffers requested to each queue
     char m_cszNode[SC_MAX_NODENAME]; // /dev/videoXX
     int m_iInstance;
 
@@ -109,6 +128,11 @@ private:
     unsigned int m_filter;
     unsigned int m_colorspace;
 
+    __s32 m_ctrlValue[SC_CTRL_NUM]; // the last values applied to the device
+    unsigned long m_fCtrlApplied; // (1 << enum SC_CTRL) if m_ctrlValue[] is valid
+    unsigned int m_nIoctls; // ioctls since the last frame
+    unsigned int m_nSWFilter; // sampling of RunSWScaling()
+
     void Initialize(int instance);
     bool ResetDevice(FrameInfo &frm);
 
@@ -129,6 +153,12 @@ private:
 
     inline bool SetFormat(FrameInfo &frm, unsigned int width, unsigned int height,
                    unsigned int v4l2_colorformat) {
+        // S_FMT resets the queue. Frames in flight should not be discarded
+        // for the same configuration of the next frame.
+        if ((frm.color_format == v4l2_colorformat) &&
+                (frm.width == width) && (frm.height == height))
+            return true;
+
         frm.color_format = v4l2_colorformat;
         frm.width = width;
         frm.height = height;
@@ -138,6 +168,10 @@ private:
 
     inline bool SetCrop(FrameInfo &frm, unsigned int left, unsigned int top,
                  unsigned int width, unsigned int height) {
+        if ((frm.crop.left == static_cast<int>(left)) && (frm.crop.top == static_cast<int>(top)) &&
+                (frm.crop.width == width) && (frm.crop.height == height))
+            return true;
+
         frm.crop.left = left;
         frm.crop.top = top;
         frm.crop.width = width;
@@ -147,10 +181,16 @@ private:
     }
 
     inline void SetPremultiplied(FrameInfo &frm, unsigned int premultiplied) {
+        if (!!premultiplied == TestFlag(frm.flags, SCFF_PREMULTIPLIED))
+            return;
+
         if (premultiplied)
             SetFlag(frm.flags, SCFF_PREMULTIPLIED);
         else
             ClearFlag(frm.flags, SCFF_PREMULTIPLIED);
+
+        // the flag is configured by S_FMT
+        SetFlag(frm.flags, SCFF_BUF_FRESH);
     }
 
     inline void SetCacheable(FrameInfo &frm, bool __UNUSED__ cacheable) {
@@ -167,12 +207,19 @@ private:
     }
 
     bool RunSWScaling();
+    bool RunSWConversion();
 
 protected:
     unsigned long m_fStatus; // enum SC_FLAG
 
     int m_fdScaler;
 
+    // ioctl() on m_fdScaler counted for the debug log of each frame
+    int DevIoctl(unsigned long request, void *arg);
+    // sets @ctrls with a VIDIOC_S_EXT_CTRLS. false if the caller should set
+    // them one by one because the device does not take them at once.
+    bool DevSetExtCtrls(v4l2_ext_control ctrls[], unsigned int count);
+
     inline void SetFlag(unsigned long &flags, unsigned long flag) {
         flags |= (1 << flag);
     }
@@ -185,6 +232,11 @@ protected:
         return (flags & (1 << flag)) != 0;
     }
 
+    // the control @index (enum SC_CTRL) is changed behind SetCtrl()
+    inline void ForgetCtrl(unsigned int index) {
+        ClearFlag(m_fCtrlApplied, index);
+    }
+
 
 public:
     inline bool Valid() { return (m_fdScaler >= 0) && (m_fdScaler == -m_fdValidate); }
@@ -216,9 +268,18 @@ public:
             return false;
 
         if (!QBuf(m_frmDst, pfdDstReleaseFence)) {
-            ClearFlag(m_frmSrc.flags, SCFF_QBUF);
+            // the source without the target is never processed
+            if (--m_frmSrc.queued == 0)
+                ClearFlag(m_frmSrc.flags, SCFF_QBUF);
+            if (pfdSrcReleaseFence && (*pfdSrcReleaseFence >= 0))
+                close(*pfdSrcReleaseFence);
+            Stop();
             return false;
         }
+
+        SC_LOGD("Scaler%d: %u ioctls for the frame", m_iInstance, m_nIoctls);
+        m_nIoctls = 0;
+
         return true;
     }
 
@@ -320,6 +381,14 @@ public:
         m_frameRate = framerate;
         SetFlag(m_fStatus, SCF_FRAMERATE);
     }
+
+    // Number of the frames in flight. QBuf() does not wait for the previous
+    // frame until @count frames are queued. Changing it stops the device.
+    bool SetBufferCount(unsigned int count);
+
+    inline void SetSWFilter(unsigned int filter) {
+        m_nSWFilter = filter;
+    }
 };
 
 #endif //_LIBSCALER_V4L2_H_
@@ -36,6 +36,10 @@
 #include <unistd.h>
 #include <system/graphics.h>
 
+#include <chrono>
+#include <list>
+#include <mutex>
+
 #include "exynos_scaler.h"
 
 #include "libscaler-common.h"
@@ -183,16 +187,94 @@ static bool find_pixel(unsigned int sc_pxfmt, unsigned int __out *v4l2_pxfmt)
     return false;
 }
 
-bool exynos_sc_copy_pixels(exynos_sc_pxinfo *pxinfo, int dev_num)
+/*
+ * CScalerPool keeps the m2m1shot scaler instances that are released by
+ * exynos_sc_copy_pixels() and exynos_sc_destroy() open for the next user of
+ * the same device. m2m1shot carries all settings in each request, so clearing
+ * the settings is enough to reuse an instance. The idle instances beyond
+ * SC_POOL_IDLE_MSEC are closed when the pool is accessed.
+ */
+#define SC_POOL_MAX_IDLE    2 // per device
+#define SC_POOL_IDLE_MSEC   5000
+
+class CScalerPool {
+    struct Idle {
+        CScalerM2M1SHOT *sc;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::mutex m_lock;
+    std::list<Idle> m_idle; // the most recently returned first
+
+    void Expire(std::chrono::steady_clock::time_point now) {
+        while (!m_idle.empty() &&
+                ((now - m_idle.back().since) > std::chrono::milliseconds(SC_POOL_IDLE_MSEC))) {
+            delete m_idle.back().sc;
+            m_idle.pop_back();
+        }
+    }
+public:
+    ~CScalerPool() {
+        for (auto &idle : m_idle)
+            delete idle.sc;
+    }
+
+    static CScalerPool &Instance() {
+        static CScalerPool pool;
+        return pool;
+    }
+
+    CScalerM2M1SHOT *Get(int dev_num) {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+
+            Expire(std::chrono::steady_clock::now());
+
+            for (auto it = m_idle.begin(); it != m_idle.end(); ++it) {
+                if (it->sc->GetDevID() == dev_num) {
+                    CScalerM2M1SHOT *sc = it->sc;
+
+                    m_idle.erase(it);
+                    sc->Reset();
+                    return sc;
+                }
+            }
+        }
+
+        CScalerM2M1SHOT *sc = new CScalerM2M1SHOT(dev_num);
+        if (!sc->Valid()) {
+            delete sc;
+            return NULL;
+        }
+
+        return sc;
+    }
+
+    void Put(CScalerM2M1SHOT *sc) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto now = std::chrono::steady_clock::now();
+        int count = 0;
+
+        for (auto it = m_idle.begin(); it != m_idle.end(); ) {
+            if ((it->sc->GetDevID() == sc->GetDevID()) && (++count >= SC_POOL_MAX_IDLE)) {
+                delete it->sc;
+                it = m_idle.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        m_idle.push_front({sc, now});
+
+        Expire(now);
+    }
+};
+
+static bool CopyPixels(CScalerM2M1SHOT &sc, exynos_sc_pxinfo *pxinfo)
 {
     unsigned int srcfmt;
     unsigned int dstfmt;
 
-    CScalerM2M1SHOT sc(dev_num);
-
-    if (!sc.Valid())
-        return false;
-
     if (!find_pixel(pxinfo->src.pxfmt, &srcfmt))
         return false;
 
@@ -236,6 +318,19 @@ bool exynos_sc_copy_pixels(exynos_sc_pxinfo *pxinfo, int dev_num)
     return sc.Run();
 }
 
+bool exynos_sc_copy_pixels(exynos_sc_pxinfo *pxinfo, int dev_num)
+{
+    CScalerM2M1SHOT *sc = CScalerPool::Instance().Get(dev_num);
+    if (!sc)
+        return false;
+
+    bool ret = CopyPixels(*sc, pxinfo);
+
+    CScalerPool::Instance().Put(sc);
+
+    return ret;
+}
+
 #ifdef SCALER_USE_M2M1SHOT
 typedef CScalerM2M1SHOT CScalerNonStream;
 #else
@@ -260,6 +355,13 @@ static CScalerNonStream *GetNonStreamScaler(void *handle)
 
 void *exynos_sc_create(int dev_num)
 {
+#ifdef SCALER_USE_M2M1SHOT
+    CScalerNonStream *sc = CScalerPool::Instance().Get(dev_num);
+    if (!sc) {
+        SC_LOGE("Failed to create a Scaler handle for instance %d", dev_num);
+        return NULL;
+    }
+#else
     CScalerNonStream *sc = new CScalerNonStream(dev_num);
 
     if (!sc) {
@@ -272,6 +374,7 @@ void *exynos_sc_create(int dev_num)
         delete sc;
         return NULL;
     }
+#endif
 
     return reinterpret_cast<void *>(sc);
 }
@@ -289,7 +392,11 @@ int exynos_sc_destroy(void *handle)
         ret = -1;
     }
 
+#ifdef SCALER_USE_M2M1SHOT
+    CScalerPool::Instance().Put(sc);
+#else
     delete sc;
+#endif
 
     return ret;
 }
@@ -393,6 +500,24 @@ void exynos_sc_set_framerate(
     sc->SetFrameRate(framerate);
 }
 
+int exynos_sc_set_sw_filter(
+        void *handle,
+        int filter)
+{
+    CScalerNonStream *sc = GetNonStreamScaler(handle);
+    if (!sc)
+        return -1;
+
+    if ((filter != EXYNOS_SC_SW_FILTER_NEAREST) && (filter != EXYNOS_SC_SW_FILTER_AREA)) {
+        SC_LOGE("Unknown S/W scaling filter %d", filter);
+        return -1;
+    }
+
+    sc->SetSWFilter(filter);
+
+    return 0;
+}
+
 int exynos_sc_set_src_addr(
         void *handle,
         void *addr[SC_NUM_OF_PLANES],
@@ -430,6 +555,41 @@ int exynos_sc_convert(void *handle)
     return sc->Run() ? 0 : -1;
 }
 
+int exynos_sc_convert_batch(
+        void *handle,
+        const struct ScalerBatchTarget *targets,
+        unsigned int count)
+{
+    CScalerNonStream *sc = GetNonStreamScaler(handle);
+    if (!sc)
+        return -1;
+
+    if ((targets == NULL) || (count == 0)) {
+        SC_LOGE("No destination is given to the batch");
+        return -1;
+    }
+
+#ifdef SCALER_USE_M2M1SHOT
+    return sc->RunBatch(targets, count) ? 0 : -1;
+#else
+    // V4L2 has no shortcut: each destination reconfigures the device
+    for (unsigned int i = 0; i < count; i++) {
+        const ScalerBatchTarget &t = targets[i];
+        void *addr[SC_NUM_OF_PLANES] = { t.addr[0], t.addr[1], t.addr[2] };
+
+        if (!sc->SetDstFormat(t.width, t.height, t.v4l2_colorformat) ||
+                !sc->SetDstCrop(t.crop_left, t.crop_top, t.crop_width, t.crop_height) ||
+                !sc->SetRotate(t.rotation, t.flip_horizontal, t.flip_vertical) ||
+                !sc->SetDstAddr(addr, t.mem_type) || !sc->Run()) {
+            SC_LOGE("Failed to convert to the destination %u of the batch", i);
+            return -1;
+        }
+    }
+
+    return 0;
+#endif
+}
+
 static CScalerBlendV4L2 *GetScalerBlend(void *handle)
 {
     if (handle == NULL) {
@@ -502,6 +662,15 @@ int exynos_sc_free_and_close(void *handle)
     return ret;
 }
 
+int exynos_sc_set_buffer_count_exclusive(void *handle, unsigned int count)
+{
+    CScalerV4L2 *sc = GetScaler(handle);
+    if (!sc)
+        return -1;
+
+    return sc->SetBufferCount(count) ? 0 : -1;
+}
+
 int exynos_sc_stop_exclusive(void *handle)
 {
     CScalerV4L2 *sc = GetScaler(handle);
@@ -754,6 +923,46 @@ int exynos_sc_config_blend_exclusive(
     return 0;
 }
 
+int exynos_sc_blend_layers_exclusive(
+    void *handle,
+    exynos_sc_img *src_imgs,
+    struct SrcBlendInfo *srcblendinfos,
+    unsigned int count,
+    exynos_sc_img *dst_img)
+{
+    if ((src_imgs == NULL) || (srcblendinfos == NULL) || (count == 0)) {
+        SC_LOGE("No layer is given to blend");
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+        src_imgs[i].releaseFenceFd = -1;
+
+    // dst_img is the accumulator: each layer waits for the previous one
+    exynos_sc_img dst = *dst_img;
+    int fdDstReleaseFence = -1;
+
+    for (unsigned int i = 0; i < count; i++) {
+        if (i > 0)
+            dst.acquireFenceFd = fdDstReleaseFence;
+
+        if ((exynos_sc_config_blend_exclusive(handle, &src_imgs[i], &dst, &srcblendinfos[i]) < 0) ||
+                (exynos_sc_run_exclusive(handle, &src_imgs[i], &dst) < 0)) {
+            SC_LOGE("Failed to blend layer %u of %u", i, count);
+            if ((i > 0) && (fdDstReleaseFence >= 0))
+                close(fdDstReleaseFence);
+            dst_img->releaseFenceFd = -1;
+            return -1;
+        }
+
+        fdDstReleaseFence = dst.releaseFenceFd;
+    }
+
+    dst_img->releaseFenceFd = fdDstReleaseFence;
+
+    return 0;
+}
+
 int exynos_sc_wait_frame_done_exclusive(
         void *handle)
 {
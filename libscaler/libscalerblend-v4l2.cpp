@@ -1,5 +1,6 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <cstring>
 #include <linux/videodev2.h>
 
 #include "libscaler-v4l2.h"
@@ -7,8 +8,6 @@
 
 bool CScalerBlendV4L2::DevSetCtrl()
 {
-    struct v4l2_control ctrl;
-
     if (!SetCtrl())
         return false;
 
@@ -16,103 +15,85 @@ bool CScalerBlendV4L2::DevSetCtrl()
     if (!TestFlag(m_fStatus, SCF_SRC_BLEND))
         return false;
 
-    ctrl.id = V4L2_CID_2D_BLEND_OP;
-    ctrl.value = m_SrcBlndCfg.blop;
-    if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-        SC_LOGERR("Failed S_CTRL V4L2_CID_2D_BLEND_OP");
-        return false;
-    }
-
-    if (m_SrcBlndCfg.globalalpha.enable) {
-        ctrl.id = V4L2_CID_GLOBAL_ALPHA;
-        ctrl.value = m_SrcBlndCfg.globalalpha.val;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-               SC_LOGERR("Failed S_CTRL V4L2_CID_GLOBAL_ALPHA");
-               return false;
-        }
-    } else {
-        ctrl.id = V4L2_CID_GLOBAL_ALPHA;
-        ctrl.value = 0xff;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-                SC_LOGERR("Failed S_CTRL V4L2_CID_GLOBAL_ALPHA 0xff");
-                return false;
-        }
-    }
-
-    if (m_SrcBlndCfg.cscspec.enable) {
-        bool is_bt709 = (m_SrcBlndCfg.cscspec.space == COLORSPACE_REC709)? true : false;
-
-        ctrl.id = V4L2_CID_CSC_EQ;
-        ctrl.value = is_bt709;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed S_CTRL V4L2_CID_CSC_EQ - %d",
-                                                   m_SrcBlndCfg.cscspec.space);
-            return false;
-        }
-
-        ctrl.id = V4L2_CID_CSC_RANGE;
-        ctrl.value = m_SrcBlndCfg.cscspec.wide;
-        if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-            SC_LOGERR("Failed S_CTRL V4L2_CID_CSC_RANGE - %d",
-                                                   m_SrcBlndCfg.cscspec.wide);
-            return false;
+    struct {
+        int index; // enum SC_BLEND_CTRL or -1 if not kept
+        __u32 id;
+        __s32 value;
+        bool requested;
+        const char *name;
+    } ctrls[] = {
+        {SC_BLEND_CTRL_OP, V4L2_CID_2D_BLEND_OP,
+            static_cast<__s32>(m_SrcBlndCfg.blop), true, "V4L2_CID_2D_BLEND_OP"},
+        {SC_BLEND_CTRL_GLOBAL_ALPHA, V4L2_CID_GLOBAL_ALPHA,
+            m_SrcBlndCfg.globalalpha.enable ? static_cast<__s32>(m_SrcBlndCfg.globalalpha.val) : 0xff,
+            true, "V4L2_CID_GLOBAL_ALPHA"},
+        // shared with SetCtrl() that does not know the values of the blending
+        {-1, V4L2_CID_CSC_EQ, m_SrcBlndCfg.cscspec.space == COLORSPACE_REC709,
+            !!m_SrcBlndCfg.cscspec.enable, "V4L2_CID_CSC_EQ"},
+        {-1, V4L2_CID_CSC_RANGE, static_cast<__s32>(m_SrcBlndCfg.cscspec.wide),
+            !!m_SrcBlndCfg.cscspec.enable, "V4L2_CID_CSC_RANGE"},
+        {SC_BLEND_CTRL_FMT, V4L2_CID_2D_SRC_BLEND_SET_FMT,
+            static_cast<__s32>(m_SrcBlndCfg.srcblendfmt), true, "V4L2_CID_2D_SRC_BLEND_SET_FMT"},
+        {SC_BLEND_CTRL_PREMULTI, V4L2_CID_2D_SRC_BLEND_FMT_PREMULTI,
+            static_cast<__s32>(m_SrcBlndCfg.srcblendpremulti), true, "V4L2_CID_2D_SRC_BLEND_FMT_PREMULTI"},
+        {SC_BLEND_CTRL_STRIDE, V4L2_CID_2D_SRC_BLEND_SET_STRIDE,
+            static_cast<__s32>(m_SrcBlndCfg.srcblendstride), true, "V4L2_CID_2D_SRC_BLEND_SET_STRIDE"},
+        {SC_BLEND_CTRL_H_POS, V4L2_CID_2D_SRC_BLEND_SET_H_POS,
+            static_cast<__s32>(m_SrcBlndCfg.srcblendhpos), true, "V4L2_CID_2D_SRC_BLEND_SET_H_POS"},
+        {SC_BLEND_CTRL_V_POS, V4L2_CID_2D_SRC_BLEND_SET_V_POS,
+            static_cast<__s32>(m_SrcBlndCfg.srcblendvpos), true, "V4L2_CID_2D_SRC_BLEND_SET_V_POS"},
+        {SC_BLEND_CTRL_WIDTH, V4L2_CID_2D_SRC_BLEND_SET_WIDTH,
+            static_cast<__s32>(m_SrcBlndCfg.srcblendwidth), true, "V4L2_CID_2D_SRC_BLEND_SET_WIDTH"},
+        {SC_BLEND_CTRL_HEIGHT, V4L2_CID_2D_SRC_BLEND_SET_HEIGHT,
+            static_cast<__s32>(m_SrcBlndCfg.srcblendheight), true, "V4L2_CID_2D_SRC_BLEND_SET_HEIGHT"},
+    };
+
+    v4l2_ext_control ext_ctrls[sizeof(ctrls) / sizeof(ctrls[0])];
+    unsigned int count = 0;
+
+    memset(ext_ctrls, 0, sizeof(ext_ctrls));
+
+    // the layers blended in sequence mostly differ only in the position
+    for (auto &ctrl : ctrls) {
+        if (ctrl.requested && (ctrl.index >= 0) &&
+                TestFlag(m_fBlendCtrlApplied, ctrl.index) &&
+                (m_blendCtrlValue[ctrl.index] == ctrl.value))
+            ctrl.requested = false;
+
+        if (ctrl.requested) {
+            ext_ctrls[count].id = ctrl.id;
+            ext_ctrls[count].value = ctrl.value;
+            count++;
         }
     }
 
-    ctrl.id = V4L2_CID_2D_SRC_BLEND_SET_FMT;
-    ctrl.value = m_SrcBlndCfg.srcblendfmt;
-    if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-        SC_LOGERR("Failed V4L2_CID_2D_SRC_BLEND_SET_FMT - %d",
-                                                  m_SrcBlndCfg.srcblendfmt);
-        return false;
-    }
+    bool batched = DevSetExtCtrls(ext_ctrls, count);
 
-    ctrl.id = V4L2_CID_2D_SRC_BLEND_FMT_PREMULTI;
-    ctrl.value = m_SrcBlndCfg.srcblendpremulti;
-    if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-        SC_LOGERR("Failed V4L2_CID_2D_BLEND_FMT_PREMULTI - %d",
-                                                   m_SrcBlndCfg.srcblendpremulti);
-        return false;
-    }
+    for (auto &ctrl : ctrls) {
+        if (!ctrl.requested)
+            continue;
 
-    ctrl.id = V4L2_CID_2D_SRC_BLEND_SET_STRIDE;
-    ctrl.value = m_SrcBlndCfg.srcblendstride;
-    if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-        SC_LOGERR("Failed V4L2_CID_2D_SRC_BLEND_SET_STRIDE - %d",
-                                                   m_SrcBlndCfg.srcblendstride);
-        return false;
-    }
+        v4l2_control v4l2ctrl;
 
-    ctrl.id = V4L2_CID_2D_SRC_BLEND_SET_H_POS;
-    ctrl.value = m_SrcBlndCfg.srcblendhpos;
-    if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-        SC_LOGERR("Failed V4L2_CID_2D_SRC_BLEND_SET_H_POS with degree %d",
-                                                   m_SrcBlndCfg.srcblendhpos);
-        return false;
-    }
+        v4l2ctrl.id = ctrl.id;
+        v4l2ctrl.value = ctrl.value;
 
-    ctrl.id = V4L2_CID_2D_SRC_BLEND_SET_V_POS;
-    ctrl.value = m_SrcBlndCfg.srcblendvpos;
-    if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-        SC_LOGERR("Failed V4L2_CID_2D_SRC_BLEND_SET_V_POS - %d",
-                                                   m_SrcBlndCfg.srcblendvpos);
-        return false;
-    }
+        if (!batched && (DevIoctl(VIDIOC_S_CTRL, &v4l2ctrl) < 0)) {
+            if (ctrl.index >= 0)
+                ClearFlag(m_fBlendCtrlApplied, ctrl.index);
+            SC_LOGERR("Failed S_CTRL %s - %d", ctrl.name, ctrl.value);
+            return false;
+        }
 
-    ctrl.id = V4L2_CID_2D_SRC_BLEND_SET_WIDTH;
-    ctrl.value = m_SrcBlndCfg.srcblendwidth;
-    if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-        SC_LOGERR("Failed V4L2_CID_2D_SRC_BLEND_SET_WIDTH with degree %d",
-                                                   m_SrcBlndCfg.srcblendwidth);
-        return false;
+        if (ctrl.index >= 0) {
+            m_blendCtrlValue[ctrl.index] = ctrl.value;
+            SetFlag(m_fBlendCtrlApplied, ctrl.index);
+        }
     }
 
-    ctrl.id = V4L2_CID_2D_SRC_BLEND_SET_HEIGHT;
-    ctrl.value = m_SrcBlndCfg.srcblendheight;
-    if (ioctl(m_fdScaler, VIDIOC_S_CTRL, &ctrl) < 0) {
-        SC_LOGERR("Failed V4L2_CID_2D_SRC_BLEND_SET_HEIGHT - %d",
-                                                   m_SrcBlndCfg.srcblendheight);
-        return false;
+    if (m_SrcBlndCfg.cscspec.enable) {
+        ForgetCtrl(SC_CTRL_CSC_EQ);
+        ForgetCtrl(SC_CTRL_CSC_RANGE);
     }
 
     ClearFlag(m_fStatus, SCF_SRC_BLEND);
@@ -159,7 +140,7 @@ void CScalerBlendV4L2::GetCustomAlphaBlendFmt(int32_t &src_color_space,
 }
 
 CScalerBlendV4L2::CScalerBlendV4L2(int dev_num, int allow_drm) : CScalerV4L2(dev_num, allow_drm){
-
+    m_fBlendCtrlApplied = 0;
 }
 
 CScalerBlendV4L2::~CScalerBlendV4L2(){
@@ -4,6 +4,22 @@
 #include "libscaler-v4l2.h"
 
 class CScalerBlendV4L2 : public CScalerV4L2 {
+       // the blending controls of which values applied to the device are kept
+       enum SC_BLEND_CTRL {
+               SC_BLEND_CTRL_OP = 0,
+               SC_BLEND_CTRL_GLOBAL_ALPHA,
+               SC_BLEND_CTRL_FMT,
+               SC_BLEND_CTRL_PREMULTI,
+               SC_BLEND_CTRL_STRIDE,
+               SC_BLEND_CTRL_H_POS,
+               SC_BLEND_CTRL_V_POS,
+               SC_BLEND_CTRL_WIDTH,
+               SC_BLEND_CTRL_HEIGHT,
+               SC_BLEND_CTRL_NUM,
+       };
+
+       __s32 m_blendCtrlValue[SC_BLEND_CTRL_NUM];
+       unsigned long m_fBlendCtrlApplied; // (1 << enum SC_BLEND_CTRL)
 
 public:
        CScalerBlendV4L2(int instance, int allow_drm);
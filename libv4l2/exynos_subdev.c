@@ -34,6 +34,7 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "exynos_v4l2.h"
 
@@ -69,129 +70,130 @@ int exynos_subdev_open(const char *filename, int oflag, ...)
     return fd;
 }
 
-int exynos_subdev_get_node_num(const char *devname, int oflag, ...)
+#define SUBDEV_NODES (SUBDEV_MAX - 128 + 1)
+#define SUBDEV_NAME_LEN 64
+
+/*
+ * Names of /dev/v4l-subdev0 .. /dev/v4l-subdev(__subdev_node_probed - 1) read
+ * from sysfs, empty for the nodes that are not subdevs. A lookup searches the
+ * names probed so far and probes only the nodes beyond them.
+ */
+static pthread_mutex_t __subdev_node_lock = PTHREAD_MUTEX_INITIALIZER;
+static char __subdev_node_name[SUBDEV_NODES][SUBDEV_NAME_LEN];
+static int __subdev_node_probed;
+
+static void __subdev_probe_node(int i)
 {
-    bool found = false;
-    int ret = -1;
+    char filename[64];
+    char *name = __subdev_node_name[i];
     struct stat s;
     FILE *stream_fd;
-    char filename[64], name[64];
-    int i = 0;
 
-    do {
-        if (i > (SUBDEV_MAX - 128))
-            break;
+    name[0] = '\0';
 
-        /* video device node */
-        snprintf(filename, sizeof(filename), "/dev/v4l-subdev%d", i);
+    /* video device node */
+    snprintf(filename, sizeof(filename), "/dev/v4l-subdev%d", i);
 
-        /* if the node is video device */
-        if ((lstat(filename, &s) == 0) && S_ISCHR(s.st_mode) &&
-                ((int)((unsigned short)(s.st_rdev) >> 8) == 81)) {
-            ALOGD("try node: %s", filename);
-            /* open sysfs entry */
-            snprintf(filename, sizeof(filename), "/sys/class/video4linux/v4l-subdev%d/name", i);
-            if (S_ISLNK(s.st_mode)) {
-                ALOGE("symbolic link detected");
-                return -1;
-            }
-            stream_fd = fopen(filename, "r");
-            if (stream_fd == NULL) {
-                ALOGE("failed to open sysfs entry for subdev");
-                continue;   /* try next */
-            }
-
-            /* read sysfs entry for device name */
-	    char *p = fgets(name, sizeof(name), stream_fd);
-            fclose(stream_fd);
-
-            /* check read size */
-            if (p == NULL) {
-                ALOGE("failed to read sysfs entry for subdev");
-            } else {
-                /* matched */
-                if (strncmp(name, devname, strlen(devname)) == 0) {
-                    ALOGI("node found for device %s: /dev/v4l-subdev%d", devname, i);
-                    found = true;
-                    break;
-                }
-            }
-        }
-        i++;
-    } while (found == false);
+    /* if the node is video device */
+    if ((lstat(filename, &s) != 0) || !S_ISCHR(s.st_mode) ||
+            ((int)((unsigned short)(s.st_rdev) >> 8) != 81))
+        return;
+
+    ALOGD("try node: %s", filename);
+
+    /* open sysfs entry */
+    snprintf(filename, sizeof(filename), "/sys/class/video4linux/v4l-subdev%d/name", i);
+    stream_fd = fopen(filename, "r");
+    if (stream_fd == NULL) {
+        ALOGE("failed to open sysfs entry for subdev");
+        return;
+    }
 
-    if (found)
-        ret = i;
+    /* read sysfs entry for device name */
+    if (fgets(name, SUBDEV_NAME_LEN, stream_fd) == NULL) {
+        ALOGE("failed to read sysfs entry for subdev");
+        name[0] = '\0';
+    }
+    fclose(stream_fd);
+}
+
+static bool __subdev_node_matches(int i, const char *devname)
+{
+    const char *name = __subdev_node_name[i];
+
+    return (name[0] != '\0') && (strncmp(name, devname, strlen(devname)) == 0);
+}
+
+static int __subdev_find_node(const char *devname)
+{
+    int node = -1;
+    int i;
+
+    pthread_mutex_lock(&__subdev_node_lock);
+
+    for (i = 0; (node < 0) && (i < __subdev_node_probed); i++) {
+        if (__subdev_node_matches(i, devname))
+            node = i;
+    }
+
+    while ((node < 0) && (__subdev_node_probed < SUBDEV_NODES)) {
+        i = __subdev_node_probed++;
+        __subdev_probe_node(i);
+        if (__subdev_node_matches(i, devname))
+            node = i;
+    }
+
+    /* probe again next time since the subdev may be registered later */
+    if (node < 0)
+        __subdev_node_probed = 0;
+
+    pthread_mutex_unlock(&__subdev_node_lock);
+
+    if (node >= 0)
+        ALOGI("node found for device %s: /dev/v4l-subdev%d", devname, node);
     else
         ALOGE("no subdev device found");
 
-    return ret;
+    return node;
+}
+
+static void __subdev_forget_nodes(void)
+{
+    pthread_mutex_lock(&__subdev_node_lock);
+    __subdev_node_probed = 0;
+    pthread_mutex_unlock(&__subdev_node_lock);
+}
+
+int exynos_subdev_get_node_num(const char *devname, int oflag, ...)
+{
+    return __subdev_find_node(devname);
 }
 
 int exynos_subdev_open_devname(const char *devname, int oflag, ...)
 {
-    bool found = false;
     int fd = -1;
-    struct stat s;
     va_list ap;
-    FILE *stream_fd;
-    char filename[64], name[64];
-    int i = 0;
-
-    do {
-        if (i > (SUBDEV_MAX - 128))
+    char filename[64];
+    int retry;
+    int i;
+
+    /* the cached node is probed again if it is not opened */
+    for (retry = 0; (fd < 0) && (retry < 2); retry++) {
+        i = __subdev_find_node(devname);
+        if (i < 0)
             break;
 
-        /* video device node */
-        snprintf(filename, sizeof(filename), "/dev/v4l-subdev%d", i);
-
-        /* if the node is video device */
-        if ((lstat(filename, &s) == 0) && S_ISCHR(s.st_mode) &&
-                ((int)((unsigned short)(s.st_rdev) >> 8) == 81)) {
-            ALOGD("try node: %s", filename);
-            /* open sysfs entry */
-            snprintf(filename, sizeof(filename), "/sys/class/video4linux/v4l-subdev%d/name", i);
-            if (S_ISLNK(s.st_mode)) {
-                ALOGE("symbolic link detected");
-                return -1;
-            }
-            stream_fd = fopen(filename, "r");
-            if (stream_fd == NULL) {
-                ALOGE("failed to open sysfs entry for subdev");
-                continue;   /* try next */
-            }
-
-            /* read sysfs entry for device name */
-            char *p = fgets(name, sizeof(name), stream_fd);
-            fclose(stream_fd);
-
-            /* check read size */
-            if (p == NULL) {
-                ALOGE("failed to read sysfs entry for subdev");
-            } else {
-                /* matched */
-                if (strncmp(name, devname, strlen(devname)) == 0) {
-                    ALOGI("node found for device %s: /dev/v4l-subdev%d", devname, i);
-                    found = true;
-                    break;
-                }
-            }
-        }
-	i++;
-    } while (found == false);
-
-    if (found) {
         snprintf(filename, sizeof(filename), "/dev/v4l-subdev%d", i);
         va_start(ap, oflag);
         fd = __subdev_open(filename, oflag, ap);
         va_end(ap);
 
-        if (fd > 0)
+        if (fd > 0) {
             ALOGI("open subdev device %s", filename);
-        else
+        } else {
             ALOGE("failed to open subdev device %s", filename);
-    } else {
-        ALOGE("no subdev device found");
+            __subdev_forget_nodes();
+        }
     }
 
     return fd;
@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "exynos_v4l2.h"
 
@@ -45,6 +46,7 @@
 #include "Exynos_log.h"
 
 #define VIDEODEV_MAX 255
+#define VIDEODEV_NAME_LEN 64
 
 //#define EXYNOS_V4L2_TRACE 0
 #ifdef EXYNOS_V4L2_TRACE
@@ -105,73 +107,123 @@ int exynos_v4l2_open(const char *filename, int oflag, ...)
     return fd;
 }
 
-int exynos_v4l2_open_devname(const char *devname, int oflag, ...)
+/*
+ * Names of /dev/video0 .. /dev/video(__v4l2_node_probed - 1) read from sysfs,
+ * empty for the nodes that are not video devices. A lookup searches the names
+ * probed so far and probes only the nodes beyond them.
+ */
+static pthread_mutex_t __v4l2_node_lock = PTHREAD_MUTEX_INITIALIZER;
+static char __v4l2_node_name[VIDEODEV_MAX + 1][VIDEODEV_NAME_LEN];
+static int __v4l2_node_probed;
+
+static void __v4l2_probe_node(int i)
 {
-    bool found = false;
-    int fd = -1;
+    char filename[64];
+    char *name = __v4l2_node_name[i];
     struct stat s;
-    va_list ap;
     FILE *stream_fd;
-    char filename[64], name[64];
-    int i = 0;
 
-    Exynos_v4l2_In();
+    name[0] = '\0';
 
-    do {
-        if (i > VIDEODEV_MAX)
-            break;
+    /* video device node */
+    snprintf(filename, sizeof(filename), "/dev/video%d", i);
 
-        /* video device node */
-        snprintf(filename, sizeof(filename), "/dev/video%d", i);
+    /* if the node is video device */
+    if ((lstat(filename, &s) != 0) || !S_ISCHR(s.st_mode) ||
+            ((int)((unsigned short)(s.st_rdev) >> 8) != 81))
+        return;
 
-        /* if the node is video device */
-        if ((lstat(filename, &s) == 0) && S_ISCHR(s.st_mode) &&
-                ((int)((unsigned short)(s.st_rdev) >> 8) == 81)) {
-            ALOGD("try node: %s", filename);
-            /* open sysfs entry */
-            snprintf(filename, sizeof(filename), "/sys/class/video4linux/video%d/name", i);
-            if (S_ISLNK(s.st_mode)) {
-                ALOGE("symbolic link detected");
-                return -1;
-            }
-            stream_fd = fopen(filename, "r");
-            if (stream_fd == NULL) {
-                ALOGE("failed to open sysfs entry for videodev (%d - %s)", errno, strerror(errno));
-                i++;
-                continue;   /* try next */
-            }
+    ALOGD("try node: %s", filename);
 
-            /* read sysfs entry for device name */
-            char *p = fgets(name, sizeof(name), stream_fd);
-            fclose(stream_fd);
-
-            /* check read size */
-            if (p == NULL) {
-                ALOGE("failed to read sysfs entry for videodev");
-            } else {
-                /* matched */
-                if (strncmp(name, devname, strlen(devname)) == 0) {
-                    ALOGI("node found for device %s: /dev/video%d", devname, i);
-                    found = true;
-                    break;
-                }
-            }
+    /* open sysfs entry */
+    snprintf(filename, sizeof(filename), "/sys/class/video4linux/video%d/name", i);
+    stream_fd = fopen(filename, "r");
+    if (stream_fd == NULL) {
+        ALOGE("failed to open sysfs entry for videodev (%d - %s)", errno, strerror(errno));
+        return;
+    }
+
+    /* read sysfs entry for device name */
+    if (fgets(name, VIDEODEV_NAME_LEN, stream_fd) == NULL) {
+        ALOGE("failed to read sysfs entry for videodev");
+        name[0] = '\0';
+    }
+    fclose(stream_fd);
+}
+
+static bool __v4l2_node_matches(int i, const char *devname)
+{
+    const char *name = __v4l2_node_name[i];
+
+    return (name[0] != '\0') && (strncmp(name, devname, strlen(devname)) == 0);
+}
+
+static int __v4l2_find_node(const char *devname)
+{
+    int node = -1;
+    int i;
+
+    pthread_mutex_lock(&__v4l2_node_lock);
+
+    for (i = 0; (node < 0) && (i < __v4l2_node_probed); i++) {
+        if (__v4l2_node_matches(i, devname))
+            node = i;
+    }
+
+    while ((node < 0) && (__v4l2_node_probed <= VIDEODEV_MAX)) {
+        i = __v4l2_node_probed++;
+        __v4l2_probe_node(i);
+        if (__v4l2_node_matches(i, devname))
+            node = i;
+    }
+
+    /* probe again next time since the device may be registered later */
+    if (node < 0)
+        __v4l2_node_probed = 0;
+
+    pthread_mutex_unlock(&__v4l2_node_lock);
+
+    return node;
+}
+
+static void __v4l2_forget_nodes(void)
+{
+    pthread_mutex_lock(&__v4l2_node_lock);
+    __v4l2_node_probed = 0;
+    pthread_mutex_unlock(&__v4l2_node_lock);
+}
+
+int exynos_v4l2_open_devname(const char *devname, int oflag, ...)
+{
+    int fd = -1;
+    va_list ap;
+    char filename[64];
+    int retry;
+    int i;
+
+    Exynos_v4l2_In();
+
+    /* the cached node is probed again if it is not opened */
+    for (retry = 0; (fd < 0) && (retry < 2); retry++) {
+        i = __v4l2_find_node(devname);
+        if (i < 0) {
+            ALOGE("no video device found");
+            break;
         }
-        i++;
-    } while (found == false);
 
-    if (found) {
+        ALOGI("node found for device %s: /dev/video%d", devname, i);
+
         snprintf(filename, sizeof(filename), "/dev/video%d", i);
         va_start(ap, oflag);
         fd = __v4l2_open(filename, oflag, ap);
         va_end(ap);
 
-        if (fd > 0)
+        if (fd > 0) {
             ALOGI("open video device %s", filename);
-        else
+        } else {
             ALOGE("failed to open video device %s", filename);
-    } else {
-        ALOGE("no video device found");
+            __v4l2_forget_nodes();
+        }
     }
 
     Exynos_v4l2_Out();
@@ -888,3 +940,68 @@ int exynos_v4l2_s_ext_ctrl(int fd, struct v4l2_ext_controls *ctrl)
 
     return ret;
 }
+
+void exynos_v4l2_ctrl_batch_init(struct exynos_v4l2_ctrl_batch *batch, int fd)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->fd = fd;
+}
+
+int exynos_v4l2_ctrl_batch_add(struct exynos_v4l2_ctrl_batch *batch, unsigned int id, int value)
+{
+    int ret = 0;
+
+    /* flush the full batch rather than failing the caller */
+    if (batch->count == EXYNOS_V4L2_CTRL_BATCH_MAX)
+        ret = exynos_v4l2_ctrl_batch_commit(batch);
+
+    memset(&batch->ctrls[batch->count], 0, sizeof(batch->ctrls[0]));
+    batch->ctrls[batch->count].id = id;
+    batch->ctrls[batch->count].value = value;
+    batch->count++;
+
+    return ret;
+}
+
+int exynos_v4l2_ctrl_batch_commit(struct exynos_v4l2_ctrl_batch *batch)
+{
+    struct v4l2_ext_controls ext_ctrls;
+    unsigned int i;
+    int ret = 0;
+
+    Exynos_v4l2_In();
+
+    if (batch->count == 0)
+        return 0;
+
+    if (batch->fd < 0) {
+        ALOGE("%s: invalid fd: %d", __func__, batch->fd);
+        batch->count = 0;
+        return -1;
+    }
+
+    /* ctrl_class 0 allows the controls of different classes */
+    memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+    ext_ctrls.count = batch->count;
+    ext_ctrls.controls = batch->ctrls;
+
+    if (ioctl(batch->fd, VIDIOC_S_EXT_CTRLS, &ext_ctrls) != 0) {
+        ALOGD("VIDIOC_S_EXT_CTRLS of %u controls failed at %u (%d), setting one by one",
+              batch->count, ext_ctrls.error_idx, errno);
+
+        for (i = 0; i < batch->count; i++) {
+            if (exynos_v4l2_s_ctrl(batch->fd, batch->ctrls[i].id, batch->ctrls[i].value) != 0) {
+                ALOGE("failed to set control %#x to %d",
+                      batch->ctrls[i].id, batch->ctrls[i].value);
+                if (ret == 0)
+                    ret = -1;
+            }
+        }
+    }
+
+    batch->count = 0;
+
+    Exynos_v4l2_Out();
+
+    return ret;
+}
@@ -96,6 +96,24 @@ int exynos_v4l2_g_ext_ctrl(int fd, struct v4l2_ext_controls *ctrl);
 /*! \ingroup exynos_v4l2 */
 int exynos_v4l2_s_ext_ctrl(int fd, struct v4l2_ext_controls *ctrl);
 
+#define EXYNOS_V4L2_CTRL_BATCH_MAX 16
+
+/*! \ingroup exynos_v4l2
+ * Controls collected by exynos_v4l2_ctrl_batch_add() to be set together by
+ * exynos_v4l2_ctrl_batch_commit() */
+struct exynos_v4l2_ctrl_batch {
+    int fd;
+    unsigned int count;
+    struct v4l2_ext_control ctrls[EXYNOS_V4L2_CTRL_BATCH_MAX];
+};
+
+/*! \ingroup exynos_v4l2 */
+void exynos_v4l2_ctrl_batch_init(struct exynos_v4l2_ctrl_batch *batch, int fd);
+/*! \ingroup exynos_v4l2 */
+int exynos_v4l2_ctrl_batch_add(struct exynos_v4l2_ctrl_batch *batch, unsigned int id, int value);
+/*! \ingroup exynos_v4l2 */
+int exynos_v4l2_ctrl_batch_commit(struct exynos_v4l2_ctrl_batch *batch);
+
 /* V4L2_SUBDEV */
 #include <v4l2-subdev.h>
 
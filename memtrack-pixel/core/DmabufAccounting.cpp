@@ -0,0 +1,184 @@
+#include "DmabufAccounting.h"
+
+#include <log/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "filesystem.h"
+
+#undef LOG_TAG
+#define LOG_TAG "memtrack-dmabufaccounting"
+
+namespace {
+constexpr char kProcPath[] = "/proc";
+
+bool parsePid(const std::string& name, pid_t* pid) {
+    char* end;
+    long val = strtol(name.c_str(), &end, 10);
+    if (end == name.c_str() || *end != '\0')
+        return false;
+
+    *pid = static_cast<pid_t>(val);
+    return true;
+}
+
+// The files of dma-buf are "/dmabuf:<name>" or "anon_inode:dmabuf" on the older kernels
+bool isDmabufPath(const char* path) {
+    return !strncmp(path, "/dmabuf:", 8) || !strcmp(path, "anon_inode:dmabuf");
+}
+} // namespace
+
+bool DmabufAccounting::readSignature(const std::string& procDir,
+                                     std::vector<std::pair<int, ino_t>>* signature) {
+    const std::string fdDir = procDir + "/fd";
+
+    if (!filesystem::is_directory(filesystem::path(fdDir)))
+        return false;
+
+    for (auto& entry : filesystem::directory_iterator(filesystem::path(fdDir))) {
+        const std::string path = entry.path().string();
+        char link[64];
+
+        ssize_t len = readlink(path.c_str(), link, sizeof(link) - 1);
+        if (len <= 0)
+            continue;
+        link[len] = '\0';
+
+        if (!isDmabufPath(link))
+            continue;
+
+        struct stat s;
+        if (stat(path.c_str(), &s))
+            continue;
+
+        signature->emplace_back(atoi(entry.path().filename().string().c_str()), s.st_ino);
+    }
+
+    std::sort(signature->begin(), signature->end());
+
+    return true;
+}
+
+void DmabufAccounting::scanFdinfo(const std::string& procDir, Process* process) {
+    for (auto& fd : process->signature) {
+        if (mSizes.count(fd.second)) {
+            process->buffers[fd.second] = mSizes[fd.second];
+            continue;
+        }
+
+        std::ifstream fdinfo(procDir + "/fdinfo/" + std::to_string(fd.first));
+        uint64_t size = 0;
+
+        // pos, flags, mnt_id, ino, size, count, exp_name, name
+        for (std::string line; std::getline(fdinfo, line);) {
+            if (!line.compare(0, 5, "size:")) {
+                size = strtoull(line.c_str() + 5, nullptr, 10);
+                break;
+            }
+        }
+
+        if (size == 0)
+            continue;
+
+        mSizes[fd.second] = size;
+        process->buffers[fd.second] = size;
+    }
+}
+
+void DmabufAccounting::scanMaps(const std::string& procDir, Process* process) {
+    std::ifstream maps(procDir + "/maps");
+    std::unordered_map<ino_t, uint64_t> mapped;
+
+    // 7b1c2d000-7b1c3d000 rw-s 00000000 00:0a 36481   /dmabuf:
+    for (std::string line; std::getline(maps, line);) {
+        unsigned long start, end;
+        unsigned long ino;
+        int pathPos = 0;
+
+        if (sscanf(line.c_str(), "%lx-%lx %*s %*s %*s %lu %n", &start, &end, &ino, &pathPos) != 3 ||
+            pathPos == 0)
+            continue;
+
+        if (isDmabufPath(line.c_str() + pathPos))
+            mapped[ino] += end - start;
+    }
+
+    // the buffers only mapped without fds are as large as their mappings
+    for (auto& buf : mapped) {
+        if (process->buffers.count(buf.first))
+            continue;
+
+        auto size = mSizes.find(buf.first);
+        process->buffers[buf.first] = (size != mSizes.end()) ? size->second : buf.second;
+    }
+}
+
+void DmabufAccounting::update() {
+    std::unordered_map<pid_t, Process> processes;
+
+    for (auto& entry : filesystem::directory_iterator(filesystem::path(kProcPath))) {
+        const std::string procDir = entry.path().string();
+        pid_t pid;
+
+        if (!parsePid(entry.path().filename().string(), &pid))
+            continue;
+
+        Process process;
+        if (!readSignature(procDir, &process.signature))
+            continue;
+
+        auto prev = mProcesses.find(pid);
+        if (prev != mProcesses.end() && prev->second.signature == process.signature) {
+            processes[pid] = std::move(prev->second);
+            continue;
+        }
+
+        scanFdinfo(procDir, &process);
+        scanMaps(procDir, &process);
+
+        processes[pid] = std::move(process);
+    }
+
+    mProcesses = std::move(processes);
+
+    std::unordered_map<ino_t, unsigned int> sharers;
+    for (auto& process : mProcesses)
+        for (auto& buf : process.second.buffers)
+            sharers[buf.first]++;
+
+    for (auto& process : mProcesses) {
+        Usage& usage = process.second.usage;
+
+        usage = {.rss = 0, .pss = 0};
+        for (auto& buf : process.second.buffers) {
+            usage.rss += buf.second;
+            usage.pss += buf.second / sharers[buf.first];
+        }
+    }
+
+    // forget the sizes of the freed buffers
+    for (auto it = mSizes.begin(); it != mSizes.end();) {
+        if (sharers.count(it->first))
+            ++it;
+        else
+            it = mSizes.erase(it);
+    }
+}
+
+bool DmabufAccounting::getUsage(pid_t pid, Usage* usage) const {
+    auto it = mProcesses.find(pid);
+    if (it == mProcesses.end())
+        return false;
+
+    *usage = it->second.usage;
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Accounts the dma-bufs held by the processes from /proc/<pid>/fdinfo and
+// /proc/<pid>/maps. A buffer shared by several processes is counted once in
+// each of them by its inode and divided among them for PSS.
+class DmabufAccounting {
+public:
+    struct Usage {
+        uint64_t rss;
+        uint64_t pss;
+    };
+
+    // Re-scans the processes whose dma-buf fds changed since the last update
+    void update();
+
+    bool getUsage(pid_t pid, Usage* usage) const;
+
+private:
+    struct Process {
+        // (fd, inode) of the dma-buf fds that tells if the process should be re-scanned
+        std::vector<std::pair<int, ino_t>> signature;
+        std::unordered_map<ino_t, uint64_t> buffers; // size by inode
+        Usage usage;
+    };
+
+    bool readSignature(const std::string& procDir, std::vector<std::pair<int, ino_t>>* signature);
+    void scanFdinfo(const std::string& procDir, Process* process);
+    void scanMaps(const std::string& procDir, Process* process);
+
+    std::unordered_map<pid_t, Process> mProcesses;
+    std::unordered_map<ino_t, uint64_t> mSizes; // sizes of the inodes found in fdinfo
+};
@@ -1,11 +1,18 @@
 #include "GpuSysfsReader.h"
 
+#include <android-base/thread_annotations.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <log/log.h>
+#include <stdlib.h>
+#include <unistd.h>
 
-#include <fstream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <unordered_map>
 
-#include "filesystem.h"
 
 #undef LOG_TAG
 #define LOG_TAG "memtrack-gpusysfsreader"
@@ -13,30 +20,102 @@
 using namespace GpuSysfsReader;
 
 namespace {
+// The nodes stay open and are read again with pread() from the beginning.
+// The nodes of a process are closed when its directory is gone.
+class NodeCache {
+public:
+    uint64_t read(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return readLocked(path);
+    }
+
+    std::unordered_map<pid_t, GpuMem> readAllProcesses() {
+        std::unordered_map<pid_t, GpuMem> out;
+        const std::string procDir = std::string(kSysfsDevicePath) + "/" + kProcessDir;
+
+        std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(procDir.c_str()), &closedir);
+        if (!dir) {
+            ALOGV("Failed to open %s directory", procDir.c_str());
+            return out;
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        while (struct dirent* dent = readdir(dir.get())) {
+            char* end;
+            long pid = strtol(dent->d_name, &end, 10);
+            if ((end == dent->d_name) || (*end != '\0'))
+                continue;
+
+            const std::string pidDir = procDir + "/" + dent->d_name + "/";
+            out[pid] = {.dmaBuf = readLocked(pidDir + kDmaBufGpuMemNode),
+                        .total = readLocked(pidDir + kTotalGpuMemNode)};
+        }
+
+        // forget the nodes of the processes that exited
+        for (auto it = mNodes.begin(); it != mNodes.end();) {
+            if (it->second.generation != mGeneration && !it->first.compare(0, procDir.size(), procDir)) {
+                close(it->second.fd);
+                it = mNodes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        mGeneration++;
+
+        return out;
+    }
+
+private:
+    uint64_t readLocked(const std::string& path) REQUIRES(mMutex) {
+        auto it = mNodes.find(path);
+        if (it == mNodes.end()) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                ALOGV("File not found: %s", path.c_str());
+                return 0;
+            }
+            it = mNodes.emplace(path, Node{fd, mGeneration}).first;
+        }
+        it->second.generation = mGeneration;
+
+        char buf[32];
+        ssize_t len = pread(it->second.fd, buf, sizeof(buf) - 1, 0);
+        if (len <= 0) {
+            ALOGW("Failed to read %s path", path.c_str());
+            close(it->second.fd);
+            mNodes.erase(it);
+            return 0;
+        }
+        buf[len] = '\0';
+
+        return strtoull(buf, nullptr, 10);
+    }
+
+    struct Node {
+        int fd;
+        unsigned int generation; // of the last readAllProcesses() that read it
+    };
+
+    std::mutex mMutex;
+    std::unordered_map<std::string, Node> mNodes GUARDED_BY(mMutex);
+    unsigned int mGeneration GUARDED_BY(mMutex) = 0;
+};
+
+NodeCache& getNodeCache() {
+    static NodeCache cache;
+    return cache;
+}
+
 uint64_t readNode(const std::string node, pid_t pid) {
     std::stringstream ss;
     if (pid)
         ss << kSysfsDevicePath << "/" << kProcessDir << "/" << pid << "/" << node;
     else
         ss << kSysfsDevicePath << "/" << node;
-    const std::string path = ss.str();
-
-    if (!filesystem::exists(filesystem::path(path))) {
-        ALOGV("File not found: %s", path.c_str());
-        return 0;
-    }
-
-    std::ifstream file(path.c_str());
-    if (!file.is_open()) {
-        ALOGW("Failed to open %s path", path.c_str());
-        return 0;
-    }
-
-    uint64_t out;
-    file >> out;
-    file.close();
 
-    return out;
+    return getNodeCache().read(ss.str());
 }
 } // namespace
 
@@ -44,16 +123,23 @@ uint64_t GpuSysfsReader::getDmaBufGpuMem(pid_t pid) { return readNode(kDmaBufGpu
 
 uint64_t GpuSysfsReader::getGpuMemTotal(pid_t pid) { return readNode(kTotalGpuMemNode, pid); }
 
-uint64_t GpuSysfsReader::getPrivateGpuMem(pid_t pid) {
-    auto dma_buf_size = getDmaBufGpuMem(pid);
-    auto gpu_total_size = getGpuMemTotal(pid);
-
-    if (dma_buf_size > gpu_total_size) {
+uint64_t GpuSysfsReader::GpuMem::getPrivate() const {
+    if (dmaBuf > total) {
         ALOGE("Bug in reader, dma-buf size (%" PRIu64 ") is higher than total gpu size (%" PRIu64
               ")",
-              dma_buf_size, gpu_total_size);
+              dmaBuf, total);
         return 0;
     }
 
-    return gpu_total_size - dma_buf_size;
+    return total - dmaBuf;
+}
+
+uint64_t GpuSysfsReader::getPrivateGpuMem(pid_t pid) {
+    GpuMem mem = {.dmaBuf = getDmaBufGpuMem(pid), .total = getGpuMemTotal(pid)};
+
+    return mem.getPrivate();
+}
+
+std::unordered_map<pid_t, GpuMem> GpuSysfsReader::getAllGpuMem() {
+    return getNodeCache().readAllProcesses();
 }
@@ -4,11 +4,23 @@
 #include <inttypes.h>
 #include <sys/types.h>
 
+#include <unordered_map>
+
 namespace GpuSysfsReader {
 uint64_t getDmaBufGpuMem(pid_t pid = 0);
 uint64_t getGpuMemTotal(pid_t pid = 0);
 uint64_t getPrivateGpuMem(pid_t pid = 0);
 
+struct GpuMem {
+    uint64_t dmaBuf;
+    uint64_t total;
+
+    uint64_t getPrivate() const;
+};
+
+// Reads the GPU memory of every process in kProcessDir in one pass
+std::unordered_map<pid_t, GpuMem> getAllGpuMem();
+
 constexpr char kSysfsDevicePath[] = "/sys/class/misc/mali0/device";
 constexpr char kProcessDir[] = "kprcs";
 constexpr char kMappedDmaBufsDir[] = "dma_bufs";
@@ -1,10 +1,16 @@
 #include <Memtrack.h>
+#include <android-base/properties.h>
+#include <android-base/thread_annotations.h>
 #include <stdlib.h>
 
+#include <chrono>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "DmabufAccounting.h"
 #include "GpuSysfsReader.h"
 #include "filesystem.h"
 
@@ -16,6 +22,71 @@ namespace android {
 namespace hardware {
 namespace memtrack {
 
+namespace {
+// dumpsys meminfo queries every pid in a row. They are served from one pass
+// over the processes of the GPU driver for this long.
+constexpr auto kGpuMemCacheTtl = std::chrono::seconds(1);
+
+class GpuMemCache {
+public:
+    bool get(pid_t pid, GpuSysfsReader::GpuMem* mem) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto now = std::chrono::steady_clock::now();
+        if (!mValid || (now - mUpdated) > kGpuMemCacheTtl) {
+            mGpuMem = GpuSysfsReader::getAllGpuMem();
+            mUpdated = now;
+            mValid = true;
+        }
+
+        auto it = mGpuMem.find(pid);
+        if (it == mGpuMem.end())
+            return false;
+
+        *mem = it->second;
+        return true;
+    }
+
+private:
+    std::mutex mMutex;
+    std::unordered_map<pid_t, GpuSysfsReader::GpuMem> mGpuMem GUARDED_BY(mMutex);
+    std::chrono::steady_clock::time_point mUpdated GUARDED_BY(mMutex);
+    bool mValid GUARDED_BY(mMutex) = false;
+};
+
+GpuMemCache gGpuMemCache;
+
+// The PSS of dma-buf needs procfs of all processes that the HAL is not always allowed to read
+class DmabufPssCache {
+public:
+    bool get(pid_t pid, DmabufAccounting::Usage* usage) {
+        static const bool enabled =
+                ::android::base::GetBoolProperty("ro.vendor.memtrack.dmabuf_pss", false);
+        if (!enabled)
+            return false;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto now = std::chrono::steady_clock::now();
+        if (!mValid || (now - mUpdated) > kGpuMemCacheTtl) {
+            mAccounting.update();
+            mUpdated = now;
+            mValid = true;
+        }
+
+        return mAccounting.getUsage(pid, usage);
+    }
+
+private:
+    std::mutex mMutex;
+    DmabufAccounting mAccounting GUARDED_BY(mMutex);
+    std::chrono::steady_clock::time_point mUpdated GUARDED_BY(mMutex);
+    bool mValid GUARDED_BY(mMutex) = false;
+};
+
+DmabufPssCache gDmabufPssCache;
+} // namespace
+
 ndk::ScopedAStatus Memtrack::getMemory(int pid, MemtrackType type,
                                        std::vector<MemtrackRecord>* _aidl_return) {
     if (pid < 0)
@@ -35,17 +106,29 @@ ndk::ScopedAStatus Memtrack::getMemory(int pid, MemtrackType type,
     if (pid == 0 && type != MemtrackType::GL)
         return ndk::ScopedAStatus::ok();
 
+    // pid 0 is the device total. A process started after the last pass is read directly.
+    GpuSysfsReader::GpuMem mem;
+    if (pid == 0 || !gGpuMemCache.get(pid, &mem))
+        mem = {.dmaBuf = GpuSysfsReader::getDmaBufGpuMem(pid),
+               .total = (type == MemtrackType::GL) ? GpuSysfsReader::getGpuMemTotal(pid) : 0};
+
     uint64_t size = 0;
     switch (type) {
         case MemtrackType::GL:
-            size = GpuSysfsReader::getPrivateGpuMem(pid);
+            size = mem.getPrivate();
             break;
-        case MemtrackType::GRAPHICS:
+        case MemtrackType::GRAPHICS: {
+            DmabufAccounting::Usage usage;
+            if (gDmabufPssCache.get(pid, &usage)) {
+                size = usage.pss;
+                break;
+            }
             // TODO(b/194483693): This is not PSS as required by memtrack HAL
             // but complete dmabuf allocations. Reporting PSS requires reading
             // procfs. This HAL does not have that permission yet.
-            size = GpuSysfsReader::getDmaBufGpuMem(pid);
+            size = mem.dmaBuf;
             break;
+        }
         default:
             break;
     }
@@ -51,6 +51,7 @@ std::vector<directory_entry> directory_iterator(const path& p) {
     std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(p.string().c_str()), &closedir);
     if (!dir) {
         ALOGE("Failed to open %s directory", p.string().c_str());
+        return {};
     }
 
     std::vector<directory_entry> out;
@@ -59,8 +60,8 @@ std::vector<directory_entry> directory_iterator(const path& p) {
         if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
             continue;
 
-        std::stringstream ss(p.string());
-        ss << "/" << dent->d_name;
+        std::stringstream ss;
+        ss << p.string() << "/" << dent->d_name;
         out.emplace_back(ss.str());
     }
 